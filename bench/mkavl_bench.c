@@ -0,0 +1,1262 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This benchmark times each operation of a single threaded mkavl tree: add,
+ * find of each find type, iteration, walk, copy, key index updates, remove
+ * and delete.  The items are integers 0 to N-1 indexed by up to four keys,
+ * the first ascending and each other in its own scrambled order.
+ *
+ * The items are added in one of the insertion orders of libavl's test
+ * program and the lookups follow a uniform, Zipf or sequential distribution.
+ * A comparison may be made more expensive with a busy loop to stand in for
+ * the comparison functions of real items.  Each run is repeated for each item
+ * count given.
+ *
+ * Operations are timed in batches so that reading the clock does not dwarf
+ * the operations themselves.  For each operation the mean ns/op and the
+ * percentiles and maximum of the mean ns/op of the batches are given, along
+ * with the bytes the tree allocated per item once the operation is done (for
+ * a copy, the bytes of the copy).  A batch size of 1 times each operation on
+ * its own.  The output is CSV or JSON.
+ *
+ * \verbatim
+   Benchmark of the operations of a mkavl tree
+
+   Usage:
+   -s <seed>
+      The seed for the RNG (default=seeded by time()).
+   -n <items>[,<items>...]
+      The item counts to run, up to 100000000
+      (default=1000,10000,100000,1000000).
+   -k <keys>
+      The number of keys, from 1 to 4 (default=2).
+   -o <order>
+      The insertion order: random, ascending, descending, balanced, zigzag
+      or shifted (default=random).
+   -d <distribution>
+      The lookup distribution: uniform, zipf or sequential
+      (default=uniform).
+   -z <alpha>
+      The alpha parameter of the Zipf distribution (default=1.0).
+   -c <cost>
+      The iterations of a busy loop added to each comparison (default=0).
+   -b <batch>
+      The number of operations timed together (default=64).
+   -p
+      Pool the nodes of the tree (default=off).
+   -f <format>
+      The output format: csv or json (default=csv).
+   -h
+      Display this help message.
+   \endverbatim
+ */
+
+#include "../examples/examples_common.h"
+
+/** The default item counts to run */
+static const char default_item_cnts[] = "1000,10000,100000,1000000";
+/** The default number of keys */
+static const uint32_t default_key_cnt = 2;
+/** The default alpha parameter of the Zipf distribution */
+static const double default_zipf_alpha = 1.0;
+/** The default number of operations timed together */
+static const uint32_t default_batch_cnt = 64;
+/** The most keys the items are indexed by */
+#define MKAVL_BENCH_MAX_KEYS 4
+/** The most item counts in a single run */
+#define MKAVL_BENCH_MAX_RUNS 16
+/** The largest item count */
+#define MKAVL_BENCH_MAX_ITEMS 100000000
+
+/**
+ * The orders in which the items are added, as in libavl's test program.
+ */
+typedef enum mkavl_bench_order_e_ {
+    /** A random permutation */
+    MKAVL_BENCH_ORDER_E_RANDOM,
+    /** Ascending */
+    MKAVL_BENCH_ORDER_E_ASCENDING,
+    /** Descending */
+    MKAVL_BENCH_ORDER_E_DESCENDING,
+    /** The order that builds a balanced binary tree without rotations */
+    MKAVL_BENCH_ORDER_E_BALANCED,
+    /** Alternately the lowest and the highest remaining */
+    MKAVL_BENCH_ORDER_E_ZIGZAG,
+    /** Ascending from the middle, then from the start */
+    MKAVL_BENCH_ORDER_E_SHIFTED,
+    /** Max value for bounds testing */
+    MKAVL_BENCH_ORDER_E_MAX,
+} mkavl_bench_order_e;
+
+/** The names of the insertion orders */
+static const char * const mkavl_bench_order_names[] = {
+    "random",
+    "ascending",
+    "descending",
+    "balanced",
+    "zigzag",
+    "shifted",
+};
+
+CT_ASSERT(NELEMS(mkavl_bench_order_names) == MKAVL_BENCH_ORDER_E_MAX);
+
+/**
+ * The distributions of the items looked up.
+ */
+typedef enum mkavl_bench_dist_e_ {
+    /** Each item equally likely */
+    MKAVL_BENCH_DIST_E_UNIFORM,
+    /** A few items looked up most of the time */
+    MKAVL_BENCH_DIST_E_ZIPF,
+    /** Each item in turn, in ascending order */
+    MKAVL_BENCH_DIST_E_SEQUENTIAL,
+    /** Max value for bounds testing */
+    MKAVL_BENCH_DIST_E_MAX,
+} mkavl_bench_dist_e;
+
+/** The names of the lookup distributions */
+static const char * const mkavl_bench_dist_names[] = {
+    "uniform",
+    "zipf",
+    "sequential",
+};
+
+CT_ASSERT(NELEMS(mkavl_bench_dist_names) == MKAVL_BENCH_DIST_E_MAX);
+
+/** The find types timed, and their names */
+static const mkavl_find_type_e mkavl_bench_find_types[] = {
+    MKAVL_FIND_TYPE_E_EQUAL,
+    MKAVL_FIND_TYPE_E_GT,
+    MKAVL_FIND_TYPE_E_LT,
+    MKAVL_FIND_TYPE_E_GE,
+    MKAVL_FIND_TYPE_E_LE,
+};
+
+/** The names of the find operations */
+static const char * const mkavl_bench_find_names[] = {
+    "find_equal",
+    "find_gt",
+    "find_lt",
+    "find_ge",
+    "find_le",
+};
+
+CT_ASSERT(NELEMS(mkavl_bench_find_types) == NELEMS(mkavl_bench_find_names));
+
+/** The output formats */
+typedef enum mkavl_bench_format_e_ {
+    /** One line of comma separated values per operation */
+    MKAVL_BENCH_FORMAT_E_CSV,
+    /** A JSON object per run */
+    MKAVL_BENCH_FORMAT_E_JSON,
+} mkavl_bench_format_e;
+
+/**
+ * State for the current benchmark execution.
+ */
+typedef struct mkavl_bench_opts_st_ {
+    /** The item counts to run */
+    uint32_t item_cnt_array[MKAVL_BENCH_MAX_RUNS];
+    /** The number of item counts */
+    uint32_t run_cnt;
+    /** The number of keys */
+    uint32_t key_cnt;
+    /** The insertion order */
+    mkavl_bench_order_e order;
+    /** The lookup distribution */
+    mkavl_bench_dist_e dist;
+    /** The alpha parameter of the Zipf distribution */
+    double zipf_alpha;
+    /** The iterations of a busy loop added to each comparison */
+    uint32_t cmp_cost;
+    /** The number of operations timed together */
+    uint32_t batch_cnt;
+    /** Whether the nodes are pooled */
+    bool pooled_nodes;
+    /** The output format */
+    mkavl_bench_format_e format;
+    /** The RNG seed */
+    uint32_t seed;
+} mkavl_bench_opts_st;
+
+/**
+ * The context of the trees of a run.
+ */
+typedef struct mkavl_bench_ctx_st_ {
+    /** The iterations of a busy loop added to each comparison */
+    uint32_t cmp_cost;
+    /** The bytes allocated by the trees and not yet freed */
+    uint64_t live_bytes;
+} mkavl_bench_ctx_st;
+
+/**
+ * The timings of one operation.
+ */
+typedef struct mkavl_bench_timer_st_ {
+    /** The mean ns/op of each batch */
+    double *sample_array;
+    /** The number of batches */
+    size_t sample_cnt;
+    /** The size of sample_array */
+    size_t sample_max;
+    /** The total time of every batch */
+    uint64_t total_ns;
+    /** The total number of operations */
+    uint64_t op_cnt;
+} mkavl_bench_timer_st;
+
+/**
+ * The state of a run for one item count.
+ */
+typedef struct mkavl_bench_run_st_ {
+    /** The options for the benchmark */
+    const mkavl_bench_opts_st *opts;
+    /** The number of items */
+    uint32_t item_cnt;
+    /** The items */
+    uint32_t *value_array;
+    /** The values in insertion order */
+    uint32_t *insert_array;
+    /** The values in the order they are removed */
+    uint32_t *remove_array;
+    /** The values looked up */
+    uint32_t *lookup_array;
+    /** The context of the trees */
+    mkavl_bench_ctx_st ctx;
+    /** The bytes allocated by the trees other than the one being timed */
+    uint64_t base_bytes;
+    /** The timings of the operation being run */
+    mkavl_bench_timer_st timer;
+    /** Whether an operation has been output yet */
+    bool is_first_output;
+} mkavl_bench_run_st;
+
+/** Where the busy loop of the comparisons writes so it is not optimized out */
+static volatile uint32_t mkavl_bench_sink;
+
+/**
+ * Display the program's help screen and exit as needed.
+ *
+ * @param do_exit Whether to exit after the output.
+ * @param exit_val If exiting the value with which to exit.
+ */
+static void
+print_usage (bool do_exit, int32_t exit_val)
+{
+    printf("\nBenchmark of the operations of a mkavl tree\n\n");
+    printf("Usage:\n");
+    printf("-s <seed>\n"
+           "   The seed for the RNG (default=seeded by time()).\n");
+    printf("-n <items>[,<items>...]\n"
+           "   The item counts to run, up to %u (default=%s).\n",
+           MKAVL_BENCH_MAX_ITEMS, default_item_cnts);
+    printf("-k <keys>\n"
+           "   The number of keys, from 1 to %u (default=%u).\n",
+           MKAVL_BENCH_MAX_KEYS, default_key_cnt);
+    printf("-o <order>\n"
+           "   The insertion order: random, ascending, descending, "
+           "balanced, zigzag\n"
+           "   or shifted (default=random).\n");
+    printf("-d <distribution>\n"
+           "   The lookup distribution: uniform, zipf or sequential "
+           "(default=uniform).\n");
+    printf("-z <alpha>\n"
+           "   The alpha parameter of the Zipf distribution "
+           "(default=%.1lf).\n", default_zipf_alpha);
+    printf("-c <cost>\n"
+           "   The iterations of a busy loop added to each comparison "
+           "(default=0).\n");
+    printf("-b <batch>\n"
+           "   The number of operations timed together (default=%u).\n",
+           default_batch_cnt);
+    printf("-p\n"
+           "   Pool the nodes of the tree (default=off).\n");
+    printf("-f <format>\n"
+           "   The output format: csv or json (default=csv).\n");
+    printf("-h\n"
+           "   Display this help message.\n");
+    printf("\n");
+
+    if (do_exit) {
+        exit(exit_val);
+    }
+}
+
+/**
+ * Find a name in an array of names.
+ *
+ * @param name The name to find.
+ * @param name_array The names.
+ * @param name_cnt The number of names.
+ * @return The index of the name, or name_cnt if it is not found.
+ */
+static uint32_t
+mkavl_bench_find_name (const char *name, const char * const *name_array,
+                       uint32_t name_cnt)
+{
+    uint32_t i;
+
+    for (i = 0; i < name_cnt; ++i) {
+        if (0 == strcmp(name, name_array[i])) {
+            break;
+        }
+    }
+
+    return (i);
+}
+
+/**
+ * Parse a comma separated list of item counts.
+ *
+ * @param str The list.
+ * @param opts The options in which to store the item counts.
+ * @return Whether every item count was valid.
+ */
+static bool
+mkavl_bench_parse_item_cnts (const char *str, mkavl_bench_opts_st *opts)
+{
+    const char *cur = str;
+    char *end_ptr;
+    unsigned long val;
+
+    opts->run_cnt = 0;
+    while (opts->run_cnt < MKAVL_BENCH_MAX_RUNS) {
+        errno = 0;
+        val = strtoul(cur, &end_ptr, 10);
+        if ((end_ptr == cur) || (0 != errno) || (0 == val) ||
+            (val > MKAVL_BENCH_MAX_ITEMS)) {
+            return (false);
+        }
+        opts->item_cnt_array[opts->run_cnt++] = val;
+        if ('\0' == *end_ptr) {
+            return (true);
+        }
+        if (',' != *end_ptr) {
+            return (false);
+        }
+        cur = (end_ptr + 1);
+    }
+
+    return (false);
+}
+
+/**
+ * Store the command line options into a local structure.
+ *
+ * @param argc The number of options
+ * @param argv The string for the options.
+ * @param opts The local structure in which to store the parsed info.
+ */
+static void
+parse_command_line (int argc, char **argv, mkavl_bench_opts_st *opts)
+{
+    const char *item_cnts = default_item_cnts;
+    int c;
+    char *end_ptr;
+    uint32_t val;
+    double dval;
+
+    if (NULL == opts) {
+        return;
+    }
+
+    opts->key_cnt = default_key_cnt;
+    opts->order = MKAVL_BENCH_ORDER_E_RANDOM;
+    opts->dist = MKAVL_BENCH_DIST_E_UNIFORM;
+    opts->zipf_alpha = default_zipf_alpha;
+    opts->cmp_cost = 0;
+    opts->batch_cnt = default_batch_cnt;
+    opts->pooled_nodes = false;
+    opts->format = MKAVL_BENCH_FORMAT_E_CSV;
+    opts->seed = (uint32_t) time(NULL);
+
+    while ((c = getopt(argc, argv, "s:n:k:o:d:z:c:b:pf:h")) != -1) {
+        switch (c) {
+        case 's':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->seed = val;
+            }
+            break;
+        case 'n':
+            item_cnts = optarg;
+            break;
+        case 'k':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->key_cnt = val;
+            }
+            break;
+        case 'o':
+            opts->order = mkavl_bench_find_name(optarg,
+                                                mkavl_bench_order_names,
+                                                MKAVL_BENCH_ORDER_E_MAX);
+            break;
+        case 'd':
+            opts->dist = mkavl_bench_find_name(optarg, mkavl_bench_dist_names,
+                                               MKAVL_BENCH_DIST_E_MAX);
+            break;
+        case 'z':
+            dval = strtod(optarg, &end_ptr);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->zipf_alpha = dval;
+            }
+            break;
+        case 'c':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->cmp_cost = val;
+            }
+            break;
+        case 'b':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->batch_cnt = val;
+            }
+            break;
+        case 'p':
+            opts->pooled_nodes = true;
+            break;
+        case 'f':
+            if (0 == strcmp(optarg, "csv")) {
+                opts->format = MKAVL_BENCH_FORMAT_E_CSV;
+            } else if (0 == strcmp(optarg, "json")) {
+                opts->format = MKAVL_BENCH_FORMAT_E_JSON;
+            } else {
+                printf("Error: unknown format(%s)\n", optarg);
+                print_usage(true, EXIT_SUCCESS);
+            }
+            break;
+        case 'h':
+        case '?':
+        default:
+            print_usage(true, EXIT_SUCCESS);
+            break;
+        }
+    }
+
+    if (optind < argc) {
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (!mkavl_bench_parse_item_cnts(item_cnts, opts)) {
+        printf("Error: item counts(%s) must be at most %u counts between 1 "
+               "and %u\n", item_cnts, MKAVL_BENCH_MAX_RUNS,
+               MKAVL_BENCH_MAX_ITEMS);
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if ((0 == opts->key_cnt) || (opts->key_cnt > MKAVL_BENCH_MAX_KEYS)) {
+        printf("Error: key count(%u) must be between 1 and %u\n",
+               opts->key_cnt, MKAVL_BENCH_MAX_KEYS);
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (MKAVL_BENCH_ORDER_E_MAX == opts->order) {
+        printf("Error: unknown insertion order\n");
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (MKAVL_BENCH_DIST_E_MAX == opts->dist) {
+        printf("Error: unknown lookup distribution\n");
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (0 == opts->batch_cnt) {
+        printf("Error: batch size(%u) must be non-zero\n", opts->batch_cnt);
+        print_usage(true, EXIT_SUCCESS);
+    }
+}
+
+/**
+ * Get the value of a key of an item.  The first key is the item itself and
+ * each other key multiplies it by its own odd constant, which scrambles the
+ * order while keeping the values of the key distinct.
+ *
+ * @param item The item.
+ * @param key_idx The key.
+ * @return The value of the key.
+ */
+static inline uint32_t
+mkavl_bench_key (const void *item, uint32_t key_idx)
+{
+    static const uint32_t mult_array[MKAVL_BENCH_MAX_KEYS] = {
+        1, 2654435761U, 2246822519U, 3266489917U
+    };
+
+    return (*((const uint32_t *) item) * mult_array[key_idx]);
+}
+
+/**
+ * Compare two items by a key, with the added cost of the run.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @param key_idx The key.
+ * @return Comparison result
+ */
+static inline int32_t
+mkavl_bench_cmp (const void *item1, const void *item2, void *context,
+                 uint32_t key_idx)
+{
+    const mkavl_bench_ctx_st *ctx = context;
+    uint32_t v1 = mkavl_bench_key(item1, key_idx);
+    uint32_t v2 = mkavl_bench_key(item2, key_idx);
+    uint32_t i;
+
+    for (i = 0; i < ctx->cmp_cost; ++i) {
+        mkavl_bench_sink = i;
+    }
+
+    if (v1 < v2) {
+        return (-1);
+    } else if (v1 > v2) {
+        return (1);
+    }
+
+    return (0);
+}
+
+/**
+ * Compare two items by the first key.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+mkavl_bench_cmp0 (const void *item1, const void *item2, void *context)
+{
+    return (mkavl_bench_cmp(item1, item2, context, 0));
+}
+
+/**
+ * Compare two items by the second key.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+mkavl_bench_cmp1 (const void *item1, const void *item2, void *context)
+{
+    return (mkavl_bench_cmp(item1, item2, context, 1));
+}
+
+/**
+ * Compare two items by the third key.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+mkavl_bench_cmp2 (const void *item1, const void *item2, void *context)
+{
+    return (mkavl_bench_cmp(item1, item2, context, 2));
+}
+
+/**
+ * Compare two items by the fourth key.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+mkavl_bench_cmp3 (const void *item1, const void *item2, void *context)
+{
+    return (mkavl_bench_cmp(item1, item2, context, 3));
+}
+
+/** The comparison functions for the keys of the tree */
+static mkavl_compare_fn cmp_fn_array[] = {
+    mkavl_bench_cmp0,
+    mkavl_bench_cmp1,
+    mkavl_bench_cmp2,
+    mkavl_bench_cmp3,
+};
+
+CT_ASSERT(NELEMS(cmp_fn_array) == MKAVL_BENCH_MAX_KEYS);
+
+/**
+ * The allocating function of the trees, which counts the bytes allocated.
+ *
+ * @param size Size of memory to allocate.
+ * @param context The tree context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_bench_malloc (size_t size, void *context)
+{
+    mkavl_bench_ctx_st *ctx = context;
+    max_align_t *block;
+
+    /* The size is kept ahead of the memory so that it can be freed */
+    block = malloc(sizeof(*block) + size);
+    if (NULL == block) {
+        return (NULL);
+    }
+    *((size_t *) block) = size;
+    ctx->live_bytes += size;
+
+    return (block + 1);
+}
+
+/**
+ * The freeing function of the trees.
+ *
+ * @param ptr The memory to free.
+ * @param context The tree context.
+ */
+static void
+mkavl_bench_free (void *ptr, void *context)
+{
+    mkavl_bench_ctx_st *ctx = context;
+    max_align_t *block = ptr;
+
+    if (NULL == ptr) {
+        return;
+    }
+    --block;
+    ctx->live_bytes -= *((size_t *) block);
+    free(block);
+}
+
+/** The allocator of the trees */
+static mkavl_allocator_st mkavl_bench_allocator = {
+    mkavl_bench_malloc,
+    mkavl_bench_free
+};
+
+/**
+ * Get the time of a monotonic clock.
+ *
+ * @return The time in nanoseconds.
+ */
+static inline uint64_t
+mkavl_bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+}
+
+/**
+ * Start timing an operation.
+ *
+ * @param run The run.
+ * @param op_cnt The number of operations to be timed.
+ */
+static void
+mkavl_bench_timer_start (mkavl_bench_run_st *run, uint64_t op_cnt)
+{
+    mkavl_bench_timer_st *timer = &(run->timer);
+    size_t sample_max;
+
+    sample_max = ((op_cnt + run->opts->batch_cnt - 1) / run->opts->batch_cnt);
+    if (sample_max > timer->sample_max) {
+        free(timer->sample_array);
+        timer->sample_array = calloc(sample_max,
+                                     sizeof(*(timer->sample_array)));
+        assert_abort(NULL != timer->sample_array);
+        timer->sample_max = sample_max;
+    }
+    timer->sample_cnt = 0;
+    timer->total_ns = 0;
+    timer->op_cnt = 0;
+}
+
+/**
+ * Record the time of a batch of operations.
+ *
+ * @param run The run.
+ * @param elapsed_ns The time of the batch.
+ * @param op_cnt The number of operations in the batch.
+ */
+static inline void
+mkavl_bench_timer_record (mkavl_bench_run_st *run, uint64_t elapsed_ns,
+                          uint64_t op_cnt)
+{
+    mkavl_bench_timer_st *timer = &(run->timer);
+
+    if (timer->sample_cnt < timer->sample_max) {
+        timer->sample_array[timer->sample_cnt++] =
+            ((double) elapsed_ns / op_cnt);
+    }
+    timer->total_ns += elapsed_ns;
+    timer->op_cnt += op_cnt;
+}
+
+/**
+ * Compare doubles for qsort().
+ *
+ * @param a The first double.
+ * @param b The second double.
+ * @return The comparison result
+ */
+static int
+mkavl_bench_double_cmp (const void *a, const void *b)
+{
+    double d1 = *((const double *) a);
+    double d2 = *((const double *) b);
+
+    if (d1 < d2) {
+        return (-1);
+    } else if (d1 > d2) {
+        return (1);
+    }
+
+    return (0);
+}
+
+/**
+ * Get a percentile of the sorted samples of the timer.
+ *
+ * @param timer The timer.
+ * @param pct The percentile.
+ * @return The mean ns/op of the batch at the percentile.
+ */
+static double
+mkavl_bench_percentile (const mkavl_bench_timer_st *timer, double pct)
+{
+    size_t idx;
+
+    if (0 == timer->sample_cnt) {
+        return (0.0);
+    }
+
+    idx = (size_t) ((pct / 100.0) * (timer->sample_cnt - 1) + 0.5);
+
+    return (timer->sample_array[idx]);
+}
+
+/**
+ * Output the timings of an operation.
+ *
+ * @param run The run.
+ * @param op_name The name of the operation.
+ */
+static void
+mkavl_bench_output (mkavl_bench_run_st *run, const char *op_name)
+{
+    const mkavl_bench_opts_st *opts = run->opts;
+    mkavl_bench_timer_st *timer = &(run->timer);
+    double ns_per_op, bytes_per_item;
+
+    qsort(timer->sample_array, timer->sample_cnt,
+          sizeof(*(timer->sample_array)), mkavl_bench_double_cmp);
+    ns_per_op = (0 == timer->op_cnt) ? 0.0 :
+        ((double) timer->total_ns / timer->op_cnt);
+    bytes_per_item = ((double) (run->ctx.live_bytes - run->base_bytes) /
+                      run->item_cnt);
+
+    if (MKAVL_BENCH_FORMAT_E_CSV == opts->format) {
+        printf("%s,%u,%u,%s,%s,%u,%u,%s,%" PRIu64 ",%.2lf,%.2lf,%.2lf,%.2lf,"
+               "%.2lf,%.2lf\n", op_name, run->item_cnt, opts->key_cnt,
+               mkavl_bench_order_names[opts->order],
+               mkavl_bench_dist_names[opts->dist], opts->cmp_cost,
+               opts->batch_cnt, opts->pooled_nodes ? "yes" : "no",
+               timer->op_cnt, ns_per_op,
+               mkavl_bench_percentile(timer, 50.0),
+               mkavl_bench_percentile(timer, 90.0),
+               mkavl_bench_percentile(timer, 99.0),
+               mkavl_bench_percentile(timer, 100.0), bytes_per_item);
+    } else {
+        printf("%s\n        {\"op\": \"%s\", \"ops\": %" PRIu64 ", "
+               "\"ns_per_op\": %.2lf, \"p50_ns\": %.2lf, \"p90_ns\": %.2lf, "
+               "\"p99_ns\": %.2lf, \"max_ns\": %.2lf, "
+               "\"bytes_per_item\": %.2lf}", run->is_first_output ? "" : ",",
+               op_name, timer->op_cnt, ns_per_op,
+               mkavl_bench_percentile(timer, 50.0),
+               mkavl_bench_percentile(timer, 90.0),
+               mkavl_bench_percentile(timer, 99.0),
+               mkavl_bench_percentile(timer, 100.0), bytes_per_item);
+    }
+    run->is_first_output = false;
+}
+
+/**
+ * Generate the values that build a balanced binary tree when added in order.
+ * This is gen_balanced_tree() of libavl's test program.
+ *
+ * @param min The lowest value.
+ * @param max The highest value.
+ * @param array Where to write the values, advanced past them.
+ */
+static void
+mkavl_bench_gen_balanced (int64_t min, int64_t max, uint32_t **array)
+{
+    int64_t i;
+
+    if (min > max) {
+        return;
+    }
+
+    i = ((min + max + 1) / 2);
+    *(*array)++ = i;
+    mkavl_bench_gen_balanced(min, (i - 1), array);
+    mkavl_bench_gen_balanced((i + 1), max, array);
+}
+
+/**
+ * Shuffle an array of values.
+ *
+ * @param array The values.
+ * @param cnt The number of values.
+ */
+static void
+mkavl_bench_shuffle (uint32_t *array, uint32_t cnt)
+{
+    uint32_t i, j, tmp;
+
+    for (i = (cnt - 1); i > 0; --i) {
+        j = (((uint64_t) rand() * (RAND_MAX + 1ULL) + rand()) % (i + 1));
+        tmp = array[i];
+        array[i] = array[j];
+        array[j] = tmp;
+    }
+}
+
+/**
+ * Generate the order in which the values are added, as gen_insertions() of
+ * libavl's test program does.
+ *
+ * @param order The insertion order.
+ * @param array Where to write the values.
+ * @param cnt The number of values.
+ */
+static void
+mkavl_bench_gen_order (mkavl_bench_order_e order, uint32_t *array,
+                       uint32_t cnt)
+{
+    uint32_t i;
+
+    switch (order) {
+    case MKAVL_BENCH_ORDER_E_RANDOM:
+        for (i = 0; i < cnt; ++i) {
+            array[i] = i;
+        }
+        mkavl_bench_shuffle(array, cnt);
+        break;
+    case MKAVL_BENCH_ORDER_E_ASCENDING:
+        for (i = 0; i < cnt; ++i) {
+            array[i] = i;
+        }
+        break;
+    case MKAVL_BENCH_ORDER_E_DESCENDING:
+        for (i = 0; i < cnt; ++i) {
+            array[i] = (cnt - i - 1);
+        }
+        break;
+    case MKAVL_BENCH_ORDER_E_BALANCED:
+        mkavl_bench_gen_balanced(0, ((int64_t) cnt - 1), &array);
+        break;
+    case MKAVL_BENCH_ORDER_E_ZIGZAG:
+        for (i = 0; i < cnt; ++i) {
+            array[i] = (0 == (i % 2)) ? (i / 2) : (cnt - (i / 2) - 1);
+        }
+        break;
+    case MKAVL_BENCH_ORDER_E_SHIFTED:
+        for (i = 0; i < cnt; ++i) {
+            array[i] = ((i + (cnt / 2)) % cnt);
+        }
+        break;
+    default:
+        abort();
+    }
+}
+
+/**
+ * Generate the values looked up.  The ranks drawn from the Zipf distribution
+ * are mapped to items through the removal order, so that the most popular
+ * items are spread over the tree.
+ *
+ * @param run The run.
+ */
+static void
+mkavl_bench_gen_lookups (mkavl_bench_run_st *run)
+{
+    uint32_t i;
+
+    for (i = 0; i < run->item_cnt; ++i) {
+        switch (run->opts->dist) {
+        case MKAVL_BENCH_DIST_E_UNIFORM:
+            run->lookup_array[i] = (((uint64_t) rand() * (RAND_MAX + 1ULL) +
+                                     rand()) % run->item_cnt);
+            break;
+        case MKAVL_BENCH_DIST_E_ZIPF:
+            run->lookup_array[i] =
+                run->remove_array[zipf(run->opts->zipf_alpha,
+                                       run->item_cnt) - 1];
+            break;
+        case MKAVL_BENCH_DIST_E_SEQUENTIAL:
+            run->lookup_array[i] = i;
+            break;
+        default:
+            abort();
+        }
+    }
+}
+
+/**
+ * Walk callback that counts the items.
+ *
+ * @param item The current item.
+ * @param tree_context The context for the tree.
+ * @param walk_context The count.
+ * @param stop_walk Unused.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_bench_walk_cb (void *item, void *tree_context, void *walk_context,
+                     bool *stop_walk)
+{
+    ++(*((uint32_t *) walk_context));
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Time the adds of the items in insertion order.
+ *
+ * @param run The run.
+ * @param tree_h The empty tree.
+ */
+static void
+mkavl_bench_add (mkavl_bench_run_st *run, mkavl_tree_handle tree_h)
+{
+    uint32_t batch = run->opts->batch_cnt;
+    uint32_t i, j, end;
+    uint64_t start_ns;
+    void *existing_item;
+    mkavl_rc_e rc;
+
+    mkavl_bench_timer_start(run, run->item_cnt);
+    for (i = 0; i < run->item_cnt; i = end) {
+        end = ((run->item_cnt - i) > batch) ? (i + batch) : run->item_cnt;
+        start_ns = mkavl_bench_now_ns();
+        for (j = i; j < end; ++j) {
+            rc = mkavl_add(tree_h, &(run->value_array[run->insert_array[j]]),
+                           &existing_item);
+            assert_abort(mkavl_rc_e_is_ok(rc) && (NULL == existing_item));
+        }
+        mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                                 (end - i));
+    }
+    mkavl_bench_output(run, "add");
+}
+
+/**
+ * Time the lookups of each find type by the first key.
+ *
+ * @param run The run.
+ * @param tree_h The tree holding every item.
+ */
+static void
+mkavl_bench_find (mkavl_bench_run_st *run, mkavl_tree_handle tree_h)
+{
+    uint32_t batch = run->opts->batch_cnt;
+    uint32_t i, j, end, type_idx;
+    uint64_t start_ns;
+    void *found_item;
+    mkavl_rc_e rc;
+
+    for (type_idx = 0; type_idx < NELEMS(mkavl_bench_find_types);
+         ++type_idx) {
+        mkavl_bench_timer_start(run, run->item_cnt);
+        for (i = 0; i < run->item_cnt; i = end) {
+            end = ((run->item_cnt - i) > batch) ? (i + batch) :
+                run->item_cnt;
+            start_ns = mkavl_bench_now_ns();
+            for (j = i; j < end; ++j) {
+                rc = mkavl_find(tree_h, mkavl_bench_find_types[type_idx], 0,
+                                &(run->lookup_array[j]), &found_item);
+                assert_abort(mkavl_rc_e_is_ok(rc));
+            }
+            mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                                     (end - i));
+        }
+        mkavl_bench_output(run, mkavl_bench_find_names[type_idx]);
+    }
+}
+
+/**
+ * Time an iteration over the items by the first key and a walk of them.
+ *
+ * @param run The run.
+ * @param tree_h The tree holding every item.
+ */
+static void
+mkavl_bench_iterate (mkavl_bench_run_st *run, mkavl_tree_handle tree_h)
+{
+    uint32_t batch = run->opts->batch_cnt;
+    mkavl_iterator_handle iter_h;
+    uint32_t i, walk_cnt = 0;
+    uint64_t start_ns;
+    void *item;
+    mkavl_rc_e rc;
+
+    rc = mkavl_iter_new(&iter_h, tree_h, 0);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+    mkavl_bench_timer_start(run, run->item_cnt);
+    start_ns = mkavl_bench_now_ns();
+    rc = mkavl_iter_first(iter_h, &item);
+    i = 1;
+    while (mkavl_rc_e_is_ok(rc) && (NULL != item)) {
+        if (0 == (i % batch)) {
+            mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                                     batch);
+            start_ns = mkavl_bench_now_ns();
+        }
+        rc = mkavl_iter_next(iter_h, &item);
+        ++i;
+    }
+    assert_abort(mkavl_rc_e_is_ok(rc) && ((i - 1) == run->item_cnt));
+    if (0 != ((i - 1) % batch)) {
+        mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                                 ((i - 1) % batch));
+    }
+    mkavl_iter_delete(&iter_h);
+    mkavl_bench_output(run, "iterate");
+
+    /* A walk is a single operation, so it gives a single sample */
+    mkavl_bench_timer_start(run, run->item_cnt);
+    start_ns = mkavl_bench_now_ns();
+    rc = mkavl_walk(tree_h, mkavl_bench_walk_cb, &walk_cnt);
+    mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                             run->item_cnt);
+    assert_abort(mkavl_rc_e_is_ok(rc) && (walk_cnt == run->item_cnt));
+    mkavl_bench_output(run, "walk");
+}
+
+/**
+ * Time a copy of the tree and the delete of the copy, each per item.
+ *
+ * @param run The run.
+ * @param tree_h The tree holding every item.
+ */
+static void
+mkavl_bench_copy (mkavl_bench_run_st *run, mkavl_tree_handle tree_h)
+{
+    mkavl_tree_handle copy_h;
+    uint64_t start_ns;
+    mkavl_rc_e rc;
+
+    /* Only the bytes of the copy count */
+    run->base_bytes = run->ctx.live_bytes;
+    mkavl_bench_timer_start(run, run->item_cnt);
+    start_ns = mkavl_bench_now_ns();
+    rc = mkavl_copy(tree_h, &copy_h, NULL, NULL, true, NULL, NULL,
+                    &mkavl_bench_allocator);
+    mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                             run->item_cnt);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+    mkavl_bench_output(run, "copy");
+
+    mkavl_bench_timer_start(run, run->item_cnt);
+    start_ns = mkavl_bench_now_ns();
+    rc = mkavl_delete(&copy_h, NULL, NULL);
+    mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                             run->item_cnt);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+    mkavl_bench_output(run, "delete");
+    run->base_bytes = 0;
+}
+
+/**
+ * Time the updates of a key of looked up items: each is removed from the
+ * last key and added back, as is done to change the fields of that key.
+ *
+ * @param run The run.
+ * @param tree_h The tree holding every item.
+ */
+static void
+mkavl_bench_update_key_idx (mkavl_bench_run_st *run, mkavl_tree_handle tree_h)
+{
+    uint32_t batch = run->opts->batch_cnt;
+    uint32_t key_idx = (run->opts->key_cnt - 1);
+    uint32_t i, j, end;
+    uint64_t start_ns;
+    void *found_item, *existing_item;
+    mkavl_rc_e rc;
+
+    mkavl_bench_timer_start(run, run->item_cnt);
+    for (i = 0; i < run->item_cnt; i = end) {
+        end = ((run->item_cnt - i) > batch) ? (i + batch) : run->item_cnt;
+        start_ns = mkavl_bench_now_ns();
+        for (j = i; j < end; ++j) {
+            rc = mkavl_remove_key_idx(tree_h, key_idx,
+                                      &(run->lookup_array[j]), &found_item);
+            assert_abort(mkavl_rc_e_is_ok(rc) && (NULL != found_item));
+            rc = mkavl_add_key_idx(tree_h, key_idx, found_item,
+                                   &existing_item);
+            assert_abort(mkavl_rc_e_is_ok(rc) && (NULL == existing_item));
+        }
+        mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                                 (end - i));
+    }
+    mkavl_bench_output(run, "update_key_idx");
+}
+
+/**
+ * Time the removes of the items in a random order.
+ *
+ * @param run The run.
+ * @param tree_h The tree holding every item.
+ */
+static void
+mkavl_bench_remove (mkavl_bench_run_st *run, mkavl_tree_handle tree_h)
+{
+    uint32_t batch = run->opts->batch_cnt;
+    uint32_t i, j, end;
+    uint64_t start_ns;
+    void *found_item;
+    mkavl_rc_e rc;
+
+    mkavl_bench_timer_start(run, run->item_cnt);
+    for (i = 0; i < run->item_cnt; i = end) {
+        end = ((run->item_cnt - i) > batch) ? (i + batch) : run->item_cnt;
+        start_ns = mkavl_bench_now_ns();
+        for (j = i; j < end; ++j) {
+            rc = mkavl_remove(tree_h, &(run->remove_array[j]), &found_item);
+            assert_abort(mkavl_rc_e_is_ok(rc) && (NULL != found_item));
+        }
+        mkavl_bench_timer_record(run, (mkavl_bench_now_ns() - start_ns),
+                                 (end - i));
+    }
+    mkavl_bench_output(run, "remove");
+}
+
+/**
+ * Do the run for one item count.
+ *
+ * @param opts The options for the benchmark.
+ * @param item_cnt The number of items.
+ * @param timer The timer, kept between runs to reuse its samples.
+ * @param is_first_run Whether this is the first run.
+ */
+static void
+mkavl_bench_run (const mkavl_bench_opts_st *opts, uint32_t item_cnt,
+                 mkavl_bench_timer_st *timer, bool is_first_run)
+{
+    mkavl_bench_run_st run = {0};
+    mkavl_opts_st tree_opts = {0};
+    mkavl_tree_handle tree_h;
+    uint32_t i;
+    mkavl_rc_e rc;
+
+    run.opts = opts;
+    run.item_cnt = item_cnt;
+    run.ctx.cmp_cost = opts->cmp_cost;
+    run.timer = *timer;
+    run.is_first_output = true;
+    run.value_array = calloc(item_cnt, sizeof(*(run.value_array)));
+    run.insert_array = calloc(item_cnt, sizeof(*(run.insert_array)));
+    run.remove_array = calloc(item_cnt, sizeof(*(run.remove_array)));
+    run.lookup_array = calloc(item_cnt, sizeof(*(run.lookup_array)));
+    assert_abort((NULL != run.value_array) && (NULL != run.insert_array) &&
+                 (NULL != run.remove_array) && (NULL != run.lookup_array));
+
+    for (i = 0; i < item_cnt; ++i) {
+        run.value_array[i] = i;
+    }
+    mkavl_bench_gen_order(opts->order, run.insert_array, item_cnt);
+    mkavl_bench_gen_order(MKAVL_BENCH_ORDER_E_RANDOM, run.remove_array,
+                          item_cnt);
+    mkavl_bench_gen_lookups(&run);
+
+    tree_opts.pooled_nodes = opts->pooled_nodes;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, opts->key_cnt, &(run.ctx),
+                        &mkavl_bench_allocator, &tree_opts);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+
+    if (MKAVL_BENCH_FORMAT_E_JSON == opts->format) {
+        printf("%s\n    {\"items\": %u, \"keys\": %u, \"order\": \"%s\", "
+               "\"dist\": \"%s\", \"zipf_alpha\": %.2lf, \"cmp_cost\": %u, "
+               "\"batch\": %u, \"pooled\": %s, \"seed\": %u,\n"
+               "     \"results\": [", is_first_run ? "" : ",", item_cnt,
+               opts->key_cnt, mkavl_bench_order_names[opts->order],
+               mkavl_bench_dist_names[opts->dist], opts->zipf_alpha,
+               opts->cmp_cost, opts->batch_cnt,
+               opts->pooled_nodes ? "true" : "false", opts->seed);
+    }
+
+    mkavl_bench_add(&run, tree_h);
+    mkavl_bench_find(&run, tree_h);
+    mkavl_bench_iterate(&run, tree_h);
+    mkavl_bench_copy(&run, tree_h);
+    mkavl_bench_update_key_idx(&run, tree_h);
+    mkavl_bench_remove(&run, tree_h);
+
+    rc = mkavl_delete(&tree_h, NULL, NULL);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+
+    if (MKAVL_BENCH_FORMAT_E_JSON == opts->format) {
+        printf("\n     ]}");
+    }
+
+    *timer = run.timer;
+    free(run.lookup_array);
+    free(run.remove_array);
+    free(run.insert_array);
+    free(run.value_array);
+}
+
+/**
+ * Main function for the benchmark.
+ */
+int
+main (int argc, char *argv[])
+{
+    mkavl_bench_opts_st opts;
+    mkavl_bench_timer_st timer = {0};
+    uint32_t i;
+
+    parse_command_line(argc, argv, &opts);
+    srand(opts.seed);
+
+    if (MKAVL_BENCH_FORMAT_E_CSV == opts.format) {
+        printf("op,items,keys,order,dist,cmp_cost,batch,pooled,ops,"
+               "ns_per_op,p50_ns,p90_ns,p99_ns,max_ns,bytes_per_item\n");
+    } else {
+        printf("[");
+    }
+
+    for (i = 0; i < opts.run_cnt; ++i) {
+        mkavl_bench_run(&opts, opts.item_cnt_array[i], &timer, (0 == i));
+    }
+
+    if (MKAVL_BENCH_FORMAT_E_JSON == opts.format) {
+        printf("\n]\n");
+    }
+
+    free(timer.sample_array);
+
+    return (0);
+}
@@ -0,0 +1,597 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This benchmark shows how the throughput of a thread safe mkavl tree scales
+ * with the number of threads sharing it.  The tree holds integers under two
+ * keys (ascending and descending).  Each thread looks up random integers and,
+ * for a given percentage of its operations, adds or removes a random integer
+ * instead.
+ *
+ * The run is repeated with 1, 2, 4, ... up to the maximum number of threads,
+ * each for a fixed duration, and the operations per second and the speedup over
+ * one thread are displayed.  A run of one thread on a tree that is not thread
+ * safe is given first as the cost of the lock itself.  With lockless reads,
+ * lookups do not write the lock at all and should scale with the number of
+ * threads as long as writes are rare.  With shards, the items are spread over
+ * a sharded tree so that writers mostly take different locks.  With a
+ * dedicated writer, one more thread changes the tree back to back for the whole
+ * run and only the operations of the other threads are counted, which shows
+ * whether lookups keep scaling under a steady stream of writes.
+ *
+ * \verbatim
+   Benchmark of a thread safe mkavl tree
+
+   Usage:
+   -s <seed>
+      The starting seed for the RNGs (default=seeded by time()).
+   -n <items>
+      The number of items initially in the tree (default=100000).
+   -t <threads>
+      The maximum number of threads (default=number of CPUs).
+   -d <milliseconds>
+      The duration of each run (default=1000).
+   -w <write percentage>
+      The percentage of operations that change the tree (default=5).
+   -p
+      Give waiting writers preference over new readers (default=off).
+   -l
+      Read without taking the lock (default=off).
+   -W
+      Add a thread that only changes the tree, back to back (default=off).
+   -S <shards>
+      Spread the items over a sharded tree with this many shards
+      (default=0, a single tree).
+   -h
+      Display this help message.
+   \endverbatim
+ */
+
+#include "../examples/examples_common.h"
+#include "../mkavl_sharded.h"
+#include <pthread.h>
+
+/** The default number of items initially in the tree */
+static const uint32_t default_item_cnt = 100000;
+/** The default duration of a run in milliseconds */
+static const uint32_t default_duration_ms = 1000;
+/** The default percentage of operations that change the tree */
+static const uint32_t default_write_pct = 5;
+/** An upper bound on the number of threads */
+#define RWLOCK_BENCH_MAX_THREADS 256
+
+/**
+ * State for the current benchmark execution.
+ */
+typedef struct rwlock_bench_opts_st_ {
+    /** The number of items initially in the tree */
+    uint32_t item_cnt;
+    /** The maximum number of threads */
+    uint32_t thread_cnt;
+    /** The duration of each run in milliseconds */
+    uint32_t duration_ms;
+    /** The percentage of operations that change the tree */
+    uint32_t write_pct;
+    /** Whether writers are preferred over readers */
+    bool writer_preference;
+    /** Whether reads take no lock */
+    bool lockless_reads;
+    /** Whether a dedicated thread changes the tree */
+    bool dedicated_writer;
+    /** The number of shards, or 0 for a single tree */
+    uint32_t shard_cnt;
+    /** The RNG seed */
+    uint32_t seed;
+} rwlock_bench_opts_st;
+
+/**
+ * The state shared by the threads of a run.
+ */
+typedef struct rwlock_bench_run_st_ {
+    /** The options for the benchmark */
+    const rwlock_bench_opts_st *opts;
+    /** The tree being shared, if not sharded */
+    mkavl_tree_handle tree_h;
+    /** The sharded tree being shared, if sharded */
+    mkavl_sharded_handle sharded_h;
+    /**
+     * The integers that may be in the tree.  There are twice as many as
+     * initially added so that about half the lookups succeed.
+     */
+    uint32_t *value_array;
+    /** Set by the main thread to end the run */
+    bool stop;
+} rwlock_bench_run_st;
+
+/**
+ * The state of one thread of a run.
+ */
+typedef struct rwlock_bench_thread_st_ {
+    /** The shared state of the run */
+    rwlock_bench_run_st *run;
+    /** The RNG state of the thread */
+    unsigned int seed;
+    /** The number of operations done */
+    uint64_t op_cnt;
+} rwlock_bench_thread_st;
+
+/**
+ * Display the program's help screen and exit as needed.
+ *
+ * @param do_exit Whether to exit after the output.
+ * @param exit_val If exiting the value with which to exit.
+ */
+static void
+print_usage (bool do_exit, int32_t exit_val)
+{
+    printf("\nBenchmark of a thread safe mkavl tree\n\n");
+    printf("Usage:\n");
+    printf("-s <seed>\n"
+           "   The starting seed for the RNGs (default=seeded by time()).\n");
+    printf("-n <items>\n"
+           "   The number of items initially in the tree (default=%u).\n",
+           default_item_cnt);
+    printf("-t <threads>\n"
+           "   The maximum number of threads (default=number of CPUs).\n");
+    printf("-d <milliseconds>\n"
+           "   The duration of each run (default=%u).\n",
+           default_duration_ms);
+    printf("-w <write percentage>\n"
+           "   The percentage of operations that change the tree "
+           "(default=%u).\n", default_write_pct);
+    printf("-p\n"
+           "   Give waiting writers preference over new readers "
+           "(default=off).\n");
+    printf("-l\n"
+           "   Read without taking the lock (default=off).\n");
+    printf("-W\n"
+           "   Add a thread that only changes the tree, back to back "
+           "(default=off).\n");
+    printf("-S <shards>\n"
+           "   Spread the items over a sharded tree with this many shards "
+           "(default=0, a single tree).\n");
+    printf("-h\n"
+           "   Display this help message.\n");
+    printf("\n");
+
+    if (do_exit) {
+        exit(exit_val);
+    }
+}
+
+/**
+ * Store the command line options into a local structure.
+ *
+ * @param argc The number of options
+ * @param argv The string for the options.
+ * @param opts The local structure in which to store the parsed info.
+ */
+static void
+parse_command_line (int argc, char **argv, rwlock_bench_opts_st *opts)
+{
+    int c;
+    char *end_ptr;
+    uint32_t val;
+    long cpu_cnt;
+
+    if (NULL == opts) {
+        return;
+    }
+
+    cpu_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    opts->item_cnt = default_item_cnt;
+    opts->thread_cnt = (cpu_cnt > 0) ? cpu_cnt : 1;
+    opts->duration_ms = default_duration_ms;
+    opts->write_pct = default_write_pct;
+    opts->writer_preference = false;
+    opts->lockless_reads = false;
+    opts->dedicated_writer = false;
+    opts->shard_cnt = 0;
+    opts->seed = (uint32_t) time(NULL);
+
+    while ((c = getopt(argc, argv, "n:t:d:w:s:S:plWh")) != -1) {
+        switch (c) {
+        case 'n':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->item_cnt = val;
+            }
+            break;
+        case 't':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->thread_cnt = val;
+            }
+            break;
+        case 'd':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->duration_ms = val;
+            }
+            break;
+        case 'w':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->write_pct = val;
+            }
+            break;
+        case 's':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->seed = val;
+            }
+            break;
+        case 'S':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->shard_cnt = val;
+            }
+            break;
+        case 'p':
+            opts->writer_preference = true;
+            break;
+        case 'l':
+            opts->lockless_reads = true;
+            break;
+        case 'W':
+            opts->dedicated_writer = true;
+            break;
+        case 'h':
+        case '?':
+        default:
+            print_usage(true, EXIT_SUCCESS);
+            break;
+        }
+    }
+
+    if (optind < argc) {
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (0 == opts->item_cnt) {
+        printf("Error: item count(%u) must be non-zero\n", opts->item_cnt);
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if ((0 == opts->thread_cnt) ||
+        (opts->thread_cnt > RWLOCK_BENCH_MAX_THREADS)) {
+        printf("Error: thread count(%u) must be between 1 and %u\n",
+               opts->thread_cnt, RWLOCK_BENCH_MAX_THREADS);
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (opts->write_pct > 100) {
+        printf("Error: write percentage(%u) must be at most 100\n",
+               opts->write_pct);
+        print_usage(true, EXIT_SUCCESS);
+    }
+}
+
+/**
+ * Compare integers in ascending order.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+rwlock_bench_cmp_asc (const void *item1, const void *item2, void *context)
+{
+    const uint32_t *v1 = item1;
+    const uint32_t *v2 = item2;
+
+    if (*v1 < *v2) {
+        return (-1);
+    } else if (*v1 > *v2) {
+        return (1);
+    }
+
+    return (0);
+}
+
+/**
+ * Compare integers in descending order.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+rwlock_bench_cmp_desc (const void *item1, const void *item2, void *context)
+{
+    return (rwlock_bench_cmp_asc(item2, item1, context));
+}
+
+/** The comparison functions for the keys of the tree */
+static mkavl_compare_fn cmp_fn_array[] = {
+    rwlock_bench_cmp_asc,
+    rwlock_bench_cmp_desc
+};
+
+/**
+ * Hash an integer to pick its shard.
+ *
+ * @param item The integer.
+ * @param context Context for the tree
+ * @return The hash of the integer.
+ */
+static uint64_t
+rwlock_bench_hash (const void *item, void *context)
+{
+    return (*((const uint32_t *) item) * 2654435761ULL);
+}
+
+/**
+ * Add an integer to the tree of a run.
+ *
+ * @param run The run.
+ * @param item The integer to add.
+ * @param existing_item Set to the integer already in the tree, if any.
+ * @return The return code
+ */
+static mkavl_rc_e
+rwlock_bench_add (rwlock_bench_run_st *run, void *item, void **existing_item)
+{
+    if (NULL != run->sharded_h) {
+        return (mkavl_sharded_add(run->sharded_h, item, existing_item));
+    }
+
+    return (mkavl_add(run->tree_h, item, existing_item));
+}
+
+/**
+ * Flip whether an integer is in the tree of a run.
+ *
+ * @param run The run.
+ * @param idx The index of the integer.
+ */
+static void
+rwlock_bench_flip (rwlock_bench_run_st *run, uint32_t idx)
+{
+    void *found_item, *existing_item;
+    mkavl_rc_e rc;
+
+    rc = rwlock_bench_add(run, &(run->value_array[idx]), &existing_item);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+    if (NULL != existing_item) {
+        rc = (NULL != run->sharded_h) ?
+            mkavl_sharded_remove(run->sharded_h, existing_item, &found_item) :
+            mkavl_remove(run->tree_h, existing_item, &found_item);
+        assert_abort(mkavl_rc_e_is_ok(rc));
+    }
+}
+
+/**
+ * The body of the dedicated writer of a run: flip random integers until told
+ * to stop.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+rwlock_bench_writer (void *arg)
+{
+    rwlock_bench_thread_st *thread = arg;
+    rwlock_bench_run_st *run = thread->run;
+    uint32_t value_cnt = run->opts->item_cnt * 2;
+
+    while (!__atomic_load_n(&(run->stop), __ATOMIC_RELAXED)) {
+        rwlock_bench_flip(run, (rand_r(&(thread->seed)) % value_cnt));
+        ++(thread->op_cnt);
+    }
+
+    return (NULL);
+}
+
+/**
+ * The body of each thread of a run: look up, add or remove random integers
+ * until told to stop.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+rwlock_bench_thread (void *arg)
+{
+    rwlock_bench_thread_st *thread = arg;
+    rwlock_bench_run_st *run = thread->run;
+    uint32_t value_cnt = run->opts->item_cnt * 2;
+    uint32_t idx, lookup;
+    void *found_item;
+    mkavl_rc_e rc;
+
+    while (!__atomic_load_n(&(run->stop), __ATOMIC_RELAXED)) {
+        idx = rand_r(&(thread->seed)) % value_cnt;
+        if ((uint32_t) (rand_r(&(thread->seed)) % 100) < run->opts->write_pct) {
+            rwlock_bench_flip(run, idx);
+        } else {
+            lookup = idx;
+            rc = (NULL != run->sharded_h) ?
+                mkavl_sharded_find(run->sharded_h, MKAVL_FIND_TYPE_E_EQUAL, 0,
+                                   &lookup, &found_item) :
+                mkavl_find(run->tree_h, MKAVL_FIND_TYPE_E_EQUAL, 0, &lookup,
+                           &found_item);
+            assert_abort(mkavl_rc_e_is_ok(rc));
+        }
+        ++(thread->op_cnt);
+    }
+
+    return (NULL);
+}
+
+/**
+ * Do a single run with the given number of threads.  The operations of the
+ * dedicated writer, if any, are not counted.
+ *
+ * @param opts The options for the benchmark.
+ * @param thread_cnt The number of threads to run.
+ * @param thread_safe Whether the tree is thread safe.
+ * @param value_array The integers that may be in the tree.
+ * @return The number of operations per second.
+ */
+static double
+rwlock_bench_run (const rwlock_bench_opts_st *opts, uint32_t thread_cnt,
+                  bool thread_safe, uint32_t *value_array)
+{
+    rwlock_bench_run_st run = {0};
+    rwlock_bench_thread_st thread_array[RWLOCK_BENCH_MAX_THREADS];
+    pthread_t tid_array[RWLOCK_BENCH_MAX_THREADS];
+    rwlock_bench_thread_st writer;
+    pthread_t writer_tid;
+    bool has_writer;
+    mkavl_opts_st tree_opts = {0};
+    struct timeval start_tv, end_tv;
+    struct timespec duration;
+    void *existing_item;
+    uint64_t op_cnt = 0;
+    double elapsed;
+    uint32_t i;
+    mkavl_rc_e rc;
+
+    tree_opts.thread_safe = thread_safe;
+    tree_opts.writer_preference = opts->writer_preference;
+    tree_opts.lockless_reads = (thread_safe && opts->lockless_reads);
+    if (thread_safe && (0 != opts->shard_cnt)) {
+        rc = mkavl_sharded_new(&(run.sharded_h), opts->shard_cnt,
+                               rwlock_bench_hash, cmp_fn_array,
+                               NELEMS(cmp_fn_array), NULL, NULL, &tree_opts);
+    } else {
+        rc = mkavl_new_opts(&(run.tree_h), cmp_fn_array, NELEMS(cmp_fn_array),
+                            NULL, NULL, &tree_opts);
+    }
+    assert_abort(mkavl_rc_e_is_ok(rc));
+
+    for (i = 0; i < (opts->item_cnt * 2); ++i) {
+        value_array[i] = i;
+    }
+    for (i = 0; i < (opts->item_cnt * 2); i += 2) {
+        rc = rwlock_bench_add(&run, &(value_array[i]), &existing_item);
+        assert_abort(mkavl_rc_e_is_ok(rc) && (NULL == existing_item));
+    }
+
+    run.opts = opts;
+    run.value_array = value_array;
+    run.stop = false;
+
+    has_writer = (thread_safe && opts->dedicated_writer);
+    if (has_writer) {
+        writer.run = &run;
+        writer.seed = opts->seed + RWLOCK_BENCH_MAX_THREADS;
+        writer.op_cnt = 0;
+        assert_abort(0 == pthread_create(&writer_tid, NULL,
+                                         rwlock_bench_writer, &writer));
+    }
+
+    gettimeofday(&start_tv, NULL);
+    for (i = 0; i < thread_cnt; ++i) {
+        thread_array[i].run = &run;
+        thread_array[i].seed = opts->seed + i;
+        thread_array[i].op_cnt = 0;
+        assert_abort(0 == pthread_create(&(tid_array[i]), NULL,
+                                         rwlock_bench_thread,
+                                         &(thread_array[i])));
+    }
+
+    duration.tv_sec = opts->duration_ms / 1000;
+    duration.tv_nsec = (opts->duration_ms % 1000) * 1000000L;
+    nanosleep(&duration, NULL);
+    __atomic_store_n(&(run.stop), true, __ATOMIC_RELAXED);
+
+    for (i = 0; i < thread_cnt; ++i) {
+        assert_abort(0 == pthread_join(tid_array[i], NULL));
+        op_cnt += thread_array[i].op_cnt;
+    }
+    gettimeofday(&end_tv, NULL);
+    if (has_writer) {
+        assert_abort(0 == pthread_join(writer_tid, NULL));
+    }
+
+    if (NULL != run.sharded_h) {
+        rc = mkavl_sharded_delete(&(run.sharded_h), NULL, NULL);
+    } else {
+        rc = mkavl_delete(&(run.tree_h), NULL, NULL);
+    }
+    assert_abort(mkavl_rc_e_is_ok(rc));
+
+    elapsed = timeval_to_seconds(&end_tv) - timeval_to_seconds(&start_tv);
+    if (elapsed <= 0.0) {
+        return (0.0);
+    }
+
+    return (op_cnt / elapsed);
+}
+
+/**
+ * Main function for the benchmark.
+ */
+int
+main (int argc, char *argv[])
+{
+    rwlock_bench_opts_st opts;
+    uint32_t *value_array;
+    uint32_t thread_cnt;
+    double ops_per_sec, base_ops_per_sec;
+    const char *lock_name;
+
+    parse_command_line(argc, argv, &opts);
+
+    value_array = calloc(opts.item_cnt * 2, sizeof(*value_array));
+    assert_abort(NULL != value_array);
+
+    printf("\nitems=%u write_pct=%u duration_ms=%u writer_preference=%s "
+           "dedicated_writer=%s shards=%u seed=%u\n\n", opts.item_cnt,
+           opts.write_pct, opts.duration_ms,
+           opts.writer_preference ? "yes" : "no",
+           opts.dedicated_writer ? "yes" : "no", opts.shard_cnt, opts.seed);
+    lock_name = opts.lockless_reads ? "lockless" : "rwlock";
+    if (0 != opts.shard_cnt) {
+        lock_name = opts.lockless_reads ? "sh-lockless" : "sh-rwlock";
+    }
+    printf("%-12s %-8s %14s %8s\n", "lock", "threads", "ops/sec", "speedup");
+
+    /* Single threaded use of an unlocked tree gives the cost of the lock */
+    ops_per_sec = rwlock_bench_run(&opts, 1, false, value_array);
+    printf("%-12s %-8u %14.0lf %8s\n", "none", 1, ops_per_sec, "-");
+
+    base_ops_per_sec = 0.0;
+    for (thread_cnt = 1; thread_cnt <= opts.thread_cnt; thread_cnt *= 2) {
+        ops_per_sec = rwlock_bench_run(&opts, thread_cnt, true, value_array);
+        if (1 == thread_cnt) {
+            base_ops_per_sec = ops_per_sec;
+        }
+        printf("%-12s %-8u %14.0lf %8.2lf\n", lock_name, thread_cnt,
+               ops_per_sec, (base_ops_per_sec > 0.0) ?
+               (ops_per_sec / base_ops_per_sec) : 0.0);
+
+        /* Always finish with the maximum number of threads */
+        if ((thread_cnt < opts.thread_cnt) &&
+            ((thread_cnt * 2) > opts.thread_cnt)) {
+            thread_cnt = opts.thread_cnt / 2;
+        }
+    }
+
+    printf("\n");
+
+    free(value_array);
+
+    return (0);
+}
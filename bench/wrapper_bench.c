@@ -0,0 +1,680 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This benchmark isolates what mkavl costs over the libavl trees it is built
+ * on.  The same workload is run against M raw libavl trees, one per key, and
+ * against a mkavl tree with M keys: add every integer in a random order, look
+ * each up by the first key in another random order, and remove them all in a
+ * third.  The raw trees are driven with avl_probe(), avl_find() and
+ * avl_delete() directly, so the difference is the validation, locking and
+ * comparison wrapper of mkavl along with any extra searches it makes.
+ *
+ * The comparison functions count their calls, so the comparisons per
+ * operation are given with the ns/op of each, along with the extra time of
+ * mkavl over the raw trees.  Each workload is repeated and the fastest run is
+ * kept.  The output is CSV or JSON.
+ *
+ * \verbatim
+   Benchmark of mkavl against raw libavl
+
+   Usage:
+   -s <seed>
+      The seed for the RNG (default=seeded by time()).
+   -n <items>
+      The number of items (default=100000).
+   -k <keys>
+      The number of keys, from 1 to 4 (default=1).
+   -r <repetitions>
+      The number of times each workload is run (default=5).
+   -f <format>
+      The output format: csv or json (default=csv).
+   -h
+      Display this help message.
+   \endverbatim
+ */
+
+#include "../examples/examples_common.h"
+#include "../libavl/avl.h"
+
+/** The default number of items */
+static const uint32_t default_item_cnt = 100000;
+/** The default number of keys */
+static const uint32_t default_key_cnt = 1;
+/** The default number of times each workload is run */
+static const uint32_t default_rep_cnt = 5;
+/** The most keys the items are indexed by */
+#define WRAPPER_BENCH_MAX_KEYS 4
+
+/**
+ * The operations timed.
+ */
+typedef enum wrapper_bench_op_e_ {
+    /** Add each item */
+    WRAPPER_BENCH_OP_E_ADD,
+    /** Look up each item by the first key */
+    WRAPPER_BENCH_OP_E_FIND,
+    /** Remove each item */
+    WRAPPER_BENCH_OP_E_REMOVE,
+    /** Max value for bounds testing */
+    WRAPPER_BENCH_OP_E_MAX,
+} wrapper_bench_op_e;
+
+/** The names of the operations */
+static const char * const wrapper_bench_op_names[] = {
+    "add",
+    "find",
+    "remove",
+};
+
+CT_ASSERT(NELEMS(wrapper_bench_op_names) == WRAPPER_BENCH_OP_E_MAX);
+
+/**
+ * State for the current benchmark execution.
+ */
+typedef struct wrapper_bench_opts_st_ {
+    /** The number of items */
+    uint32_t item_cnt;
+    /** The number of keys */
+    uint32_t key_cnt;
+    /** The number of times each workload is run */
+    uint32_t rep_cnt;
+    /** Whether the output is JSON rather than CSV */
+    bool is_json;
+    /** The RNG seed */
+    uint32_t seed;
+} wrapper_bench_opts_st;
+
+/**
+ * The context of the comparison functions.
+ */
+typedef struct wrapper_bench_ctx_st_ {
+    /** The number of comparisons made */
+    uint64_t cmp_cnt;
+} wrapper_bench_ctx_st;
+
+/**
+ * The best timing of an operation over the repetitions.
+ */
+typedef struct wrapper_bench_result_st_ {
+    /** The fastest time of the operation over every item */
+    uint64_t best_ns;
+    /** The comparisons made by the operation over every item */
+    uint64_t cmp_cnt;
+} wrapper_bench_result_st;
+
+/**
+ * Display the program's help screen and exit as needed.
+ *
+ * @param do_exit Whether to exit after the output.
+ * @param exit_val If exiting the value with which to exit.
+ */
+static void
+print_usage (bool do_exit, int32_t exit_val)
+{
+    printf("\nBenchmark of mkavl against raw libavl\n\n");
+    printf("Usage:\n");
+    printf("-s <seed>\n"
+           "   The seed for the RNG (default=seeded by time()).\n");
+    printf("-n <items>\n"
+           "   The number of items (default=%u).\n", default_item_cnt);
+    printf("-k <keys>\n"
+           "   The number of keys, from 1 to %u (default=%u).\n",
+           WRAPPER_BENCH_MAX_KEYS, default_key_cnt);
+    printf("-r <repetitions>\n"
+           "   The number of times each workload is run (default=%u).\n",
+           default_rep_cnt);
+    printf("-f <format>\n"
+           "   The output format: csv or json (default=csv).\n");
+    printf("-h\n"
+           "   Display this help message.\n");
+    printf("\n");
+
+    if (do_exit) {
+        exit(exit_val);
+    }
+}
+
+/**
+ * Store the command line options into a local structure.
+ *
+ * @param argc The number of options
+ * @param argv The string for the options.
+ * @param opts The local structure in which to store the parsed info.
+ */
+static void
+parse_command_line (int argc, char **argv, wrapper_bench_opts_st *opts)
+{
+    int c;
+    char *end_ptr;
+    uint32_t val;
+
+    if (NULL == opts) {
+        return;
+    }
+
+    opts->item_cnt = default_item_cnt;
+    opts->key_cnt = default_key_cnt;
+    opts->rep_cnt = default_rep_cnt;
+    opts->is_json = false;
+    opts->seed = (uint32_t) time(NULL);
+
+    while ((c = getopt(argc, argv, "s:n:k:r:f:h")) != -1) {
+        switch (c) {
+        case 's':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->seed = val;
+            }
+            break;
+        case 'n':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->item_cnt = val;
+            }
+            break;
+        case 'k':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->key_cnt = val;
+            }
+            break;
+        case 'r':
+            val = strtol(optarg, &end_ptr, 10);
+            if ((end_ptr != optarg) && (0 == errno)) {
+                opts->rep_cnt = val;
+            }
+            break;
+        case 'f':
+            if (0 == strcmp(optarg, "json")) {
+                opts->is_json = true;
+            } else if (0 != strcmp(optarg, "csv")) {
+                printf("Error: unknown format(%s)\n", optarg);
+                print_usage(true, EXIT_SUCCESS);
+            }
+            break;
+        case 'h':
+        case '?':
+        default:
+            print_usage(true, EXIT_SUCCESS);
+            break;
+        }
+    }
+
+    if (optind < argc) {
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (0 == opts->item_cnt) {
+        printf("Error: item count(%u) must be non-zero\n", opts->item_cnt);
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if ((0 == opts->key_cnt) || (opts->key_cnt > WRAPPER_BENCH_MAX_KEYS)) {
+        printf("Error: key count(%u) must be between 1 and %u\n",
+               opts->key_cnt, WRAPPER_BENCH_MAX_KEYS);
+        print_usage(true, EXIT_SUCCESS);
+    }
+
+    if (0 == opts->rep_cnt) {
+        printf("Error: repetitions(%u) must be non-zero\n", opts->rep_cnt);
+        print_usage(true, EXIT_SUCCESS);
+    }
+}
+
+/**
+ * Compare two integers by a key and count the comparison.  The first key is
+ * the integer itself and each other key multiplies it by its own odd
+ * constant, which scrambles the order while keeping the values distinct.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context The wrapper_bench_ctx_st.
+ * @param key_idx The key.
+ * @return Comparison result
+ */
+static inline int32_t
+wrapper_bench_cmp (const void *item1, const void *item2, void *context,
+                   uint32_t key_idx)
+{
+    static const uint32_t mult_array[WRAPPER_BENCH_MAX_KEYS] = {
+        1, 2654435761U, 2246822519U, 3266489917U
+    };
+    wrapper_bench_ctx_st *ctx = context;
+    uint32_t v1 = (*((const uint32_t *) item1) * mult_array[key_idx]);
+    uint32_t v2 = (*((const uint32_t *) item2) * mult_array[key_idx]);
+
+    ++(ctx->cmp_cnt);
+    if (v1 < v2) {
+        return (-1);
+    } else if (v1 > v2) {
+        return (1);
+    }
+
+    return (0);
+}
+
+/**
+ * Compare two items by the first key for mkavl.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+wrapper_bench_cmp0 (const void *item1, const void *item2, void *context)
+{
+    return (wrapper_bench_cmp(item1, item2, context, 0));
+}
+
+/**
+ * Compare two items by the second key for mkavl.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+wrapper_bench_cmp1 (const void *item1, const void *item2, void *context)
+{
+    return (wrapper_bench_cmp(item1, item2, context, 1));
+}
+
+/**
+ * Compare two items by the third key for mkavl.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+wrapper_bench_cmp2 (const void *item1, const void *item2, void *context)
+{
+    return (wrapper_bench_cmp(item1, item2, context, 2));
+}
+
+/**
+ * Compare two items by the fourth key for mkavl.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+wrapper_bench_cmp3 (const void *item1, const void *item2, void *context)
+{
+    return (wrapper_bench_cmp(item1, item2, context, 3));
+}
+
+/** The comparison functions for the keys of the mkavl tree */
+static mkavl_compare_fn cmp_fn_array[] = {
+    wrapper_bench_cmp0,
+    wrapper_bench_cmp1,
+    wrapper_bench_cmp2,
+    wrapper_bench_cmp3,
+};
+
+CT_ASSERT(NELEMS(cmp_fn_array) == WRAPPER_BENCH_MAX_KEYS);
+
+/**
+ * Compare two items by the first key for libavl.
+ *
+ * @param avl_a Item to compare
+ * @param avl_b Item to compare
+ * @param avl_param Context for the tree
+ * @return Comparison result
+ */
+static int
+wrapper_bench_avl_cmp0 (const void *avl_a, const void *avl_b, void *avl_param)
+{
+    return (wrapper_bench_cmp(avl_a, avl_b, avl_param, 0));
+}
+
+/**
+ * Compare two items by the second key for libavl.
+ *
+ * @param avl_a Item to compare
+ * @param avl_b Item to compare
+ * @param avl_param Context for the tree
+ * @return Comparison result
+ */
+static int
+wrapper_bench_avl_cmp1 (const void *avl_a, const void *avl_b, void *avl_param)
+{
+    return (wrapper_bench_cmp(avl_a, avl_b, avl_param, 1));
+}
+
+/**
+ * Compare two items by the third key for libavl.
+ *
+ * @param avl_a Item to compare
+ * @param avl_b Item to compare
+ * @param avl_param Context for the tree
+ * @return Comparison result
+ */
+static int
+wrapper_bench_avl_cmp2 (const void *avl_a, const void *avl_b, void *avl_param)
+{
+    return (wrapper_bench_cmp(avl_a, avl_b, avl_param, 2));
+}
+
+/**
+ * Compare two items by the fourth key for libavl.
+ *
+ * @param avl_a Item to compare
+ * @param avl_b Item to compare
+ * @param avl_param Context for the tree
+ * @return Comparison result
+ */
+static int
+wrapper_bench_avl_cmp3 (const void *avl_a, const void *avl_b, void *avl_param)
+{
+    return (wrapper_bench_cmp(avl_a, avl_b, avl_param, 3));
+}
+
+/** The comparison functions for the raw libavl trees */
+static avl_comparison_func *avl_cmp_fn_array[] = {
+    wrapper_bench_avl_cmp0,
+    wrapper_bench_avl_cmp1,
+    wrapper_bench_avl_cmp2,
+    wrapper_bench_avl_cmp3,
+};
+
+CT_ASSERT(NELEMS(avl_cmp_fn_array) == WRAPPER_BENCH_MAX_KEYS);
+
+/**
+ * Get the time of a monotonic clock.
+ *
+ * @return The time in nanoseconds.
+ */
+static inline uint64_t
+wrapper_bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+}
+
+/**
+ * Generate a random permutation of the integers 0 to N-1.
+ *
+ * @param array Where to write the integers.
+ * @param cnt The number of integers.
+ */
+static void
+wrapper_bench_permute (uint32_t *array, uint32_t cnt)
+{
+    uint32_t i, j, tmp;
+
+    for (i = 0; i < cnt; ++i) {
+        array[i] = i;
+    }
+
+    for (i = (cnt - 1); i > 0; --i) {
+        j = (((uint64_t) rand() * (RAND_MAX + 1ULL) + rand()) % (i + 1));
+        tmp = array[i];
+        array[i] = array[j];
+        array[j] = tmp;
+    }
+}
+
+/**
+ * Record the time and comparisons of an operation, keeping the fastest run.
+ *
+ * @param result The result of the operation.
+ * @param elapsed_ns The time of this run.
+ * @param cmp_cnt The comparisons made by this run.
+ */
+static void
+wrapper_bench_record (wrapper_bench_result_st *result, uint64_t elapsed_ns,
+                      uint64_t cmp_cnt)
+{
+    if ((0 == result->best_ns) || (elapsed_ns < result->best_ns)) {
+        result->best_ns = elapsed_ns;
+    }
+    result->cmp_cnt = cmp_cnt;
+}
+
+/**
+ * Run the workload once against raw libavl trees, one per key.
+ *
+ * @param opts The options for the benchmark.
+ * @param value_array The items.
+ * @param order_array The orders of the items for each operation.
+ * @param result_array The results of each operation.
+ */
+static void
+wrapper_bench_run_avl (const wrapper_bench_opts_st *opts,
+                       uint32_t *value_array, uint32_t **order_array,
+                       wrapper_bench_result_st *result_array)
+{
+    struct avl_table *tree_array[WRAPPER_BENCH_MAX_KEYS];
+    wrapper_bench_ctx_st ctx = {0};
+    uint64_t start_ns, elapsed_ns;
+    uint32_t i, key_idx;
+    void **probe;
+    void *item;
+
+    for (key_idx = 0; key_idx < opts->key_cnt; ++key_idx) {
+        tree_array[key_idx] = avl_create(avl_cmp_fn_array[key_idx], &ctx,
+                                         NULL);
+        assert_abort(NULL != tree_array[key_idx]);
+    }
+
+    start_ns = wrapper_bench_now_ns();
+    for (i = 0; i < opts->item_cnt; ++i) {
+        item = &(value_array[order_array[WRAPPER_BENCH_OP_E_ADD][i]]);
+        for (key_idx = 0; key_idx < opts->key_cnt; ++key_idx) {
+            probe = avl_probe(tree_array[key_idx], item);
+            assert_abort((NULL != probe) && (item == *probe));
+        }
+    }
+    elapsed_ns = (wrapper_bench_now_ns() - start_ns);
+    wrapper_bench_record(&(result_array[WRAPPER_BENCH_OP_E_ADD]), elapsed_ns,
+                         ctx.cmp_cnt);
+
+    ctx.cmp_cnt = 0;
+    start_ns = wrapper_bench_now_ns();
+    for (i = 0; i < opts->item_cnt; ++i) {
+        item = avl_find(tree_array[0],
+                        &(order_array[WRAPPER_BENCH_OP_E_FIND][i]));
+        assert_abort(NULL != item);
+    }
+    elapsed_ns = (wrapper_bench_now_ns() - start_ns);
+    wrapper_bench_record(&(result_array[WRAPPER_BENCH_OP_E_FIND]), elapsed_ns,
+                         ctx.cmp_cnt);
+
+    ctx.cmp_cnt = 0;
+    start_ns = wrapper_bench_now_ns();
+    for (i = 0; i < opts->item_cnt; ++i) {
+        item = &(value_array[order_array[WRAPPER_BENCH_OP_E_REMOVE][i]]);
+        for (key_idx = 0; key_idx < opts->key_cnt; ++key_idx) {
+            assert_abort(item == avl_delete(tree_array[key_idx], item));
+        }
+    }
+    elapsed_ns = (wrapper_bench_now_ns() - start_ns);
+    wrapper_bench_record(&(result_array[WRAPPER_BENCH_OP_E_REMOVE]),
+                         elapsed_ns, ctx.cmp_cnt);
+
+    for (key_idx = 0; key_idx < opts->key_cnt; ++key_idx) {
+        avl_destroy(tree_array[key_idx], NULL);
+    }
+}
+
+/**
+ * Run the workload once against a mkavl tree.
+ *
+ * @param opts The options for the benchmark.
+ * @param value_array The items.
+ * @param order_array The orders of the items for each operation.
+ * @param result_array The results of each operation.
+ */
+static void
+wrapper_bench_run_mkavl (const wrapper_bench_opts_st *opts,
+                         uint32_t *value_array, uint32_t **order_array,
+                         wrapper_bench_result_st *result_array)
+{
+    mkavl_tree_handle tree_h;
+    wrapper_bench_ctx_st ctx = {0};
+    uint64_t start_ns, elapsed_ns;
+    uint32_t i;
+    void *item, *found_item;
+    mkavl_rc_e rc;
+
+    rc = mkavl_new(&tree_h, cmp_fn_array, opts->key_cnt, &ctx, NULL);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+
+    start_ns = wrapper_bench_now_ns();
+    for (i = 0; i < opts->item_cnt; ++i) {
+        item = &(value_array[order_array[WRAPPER_BENCH_OP_E_ADD][i]]);
+        rc = mkavl_add(tree_h, item, &found_item);
+        assert_abort(mkavl_rc_e_is_ok(rc) && (NULL == found_item));
+    }
+    elapsed_ns = (wrapper_bench_now_ns() - start_ns);
+    wrapper_bench_record(&(result_array[WRAPPER_BENCH_OP_E_ADD]), elapsed_ns,
+                         ctx.cmp_cnt);
+
+    ctx.cmp_cnt = 0;
+    start_ns = wrapper_bench_now_ns();
+    for (i = 0; i < opts->item_cnt; ++i) {
+        rc = mkavl_find(tree_h, MKAVL_FIND_TYPE_E_EQUAL, 0,
+                        &(order_array[WRAPPER_BENCH_OP_E_FIND][i]),
+                        &found_item);
+        assert_abort(mkavl_rc_e_is_ok(rc) && (NULL != found_item));
+    }
+    elapsed_ns = (wrapper_bench_now_ns() - start_ns);
+    wrapper_bench_record(&(result_array[WRAPPER_BENCH_OP_E_FIND]), elapsed_ns,
+                         ctx.cmp_cnt);
+
+    ctx.cmp_cnt = 0;
+    start_ns = wrapper_bench_now_ns();
+    for (i = 0; i < opts->item_cnt; ++i) {
+        item = &(value_array[order_array[WRAPPER_BENCH_OP_E_REMOVE][i]]);
+        rc = mkavl_remove(tree_h, item, &found_item);
+        assert_abort(mkavl_rc_e_is_ok(rc) && (item == found_item));
+    }
+    elapsed_ns = (wrapper_bench_now_ns() - start_ns);
+    wrapper_bench_record(&(result_array[WRAPPER_BENCH_OP_E_REMOVE]),
+                         elapsed_ns, ctx.cmp_cnt);
+
+    rc = mkavl_delete(&tree_h, NULL, NULL);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+}
+
+/**
+ * Output the results of an operation for both implementations.
+ *
+ * @param opts The options for the benchmark.
+ * @param op The operation.
+ * @param avl_result The result against raw libavl.
+ * @param mkavl_result The result against mkavl.
+ */
+static void
+wrapper_bench_output (const wrapper_bench_opts_st *opts, wrapper_bench_op_e op,
+                      const wrapper_bench_result_st *avl_result,
+                      const wrapper_bench_result_st *mkavl_result)
+{
+    double avl_ns, mkavl_ns, avl_cmp, mkavl_cmp, overhead_pct;
+
+    avl_ns = ((double) avl_result->best_ns / opts->item_cnt);
+    mkavl_ns = ((double) mkavl_result->best_ns / opts->item_cnt);
+    avl_cmp = ((double) avl_result->cmp_cnt / opts->item_cnt);
+    mkavl_cmp = ((double) mkavl_result->cmp_cnt / opts->item_cnt);
+    overhead_pct = (avl_ns > 0.0) ? (100.0 * (mkavl_ns - avl_ns) / avl_ns) :
+        0.0;
+
+    if (opts->is_json) {
+        printf("%s\n    {\"op\": \"%s\", \"items\": %u, \"keys\": %u, "
+               "\"avl_ns_per_op\": %.2lf, \"mkavl_ns_per_op\": %.2lf, "
+               "\"avl_cmp_per_op\": %.2lf, \"mkavl_cmp_per_op\": %.2lf, "
+               "\"overhead_pct\": %.1lf}",
+               (WRAPPER_BENCH_OP_E_ADD == op) ? "" : ",",
+               wrapper_bench_op_names[op], opts->item_cnt, opts->key_cnt,
+               avl_ns, mkavl_ns, avl_cmp, mkavl_cmp, overhead_pct);
+    } else {
+        printf("%s,%u,%u,%.2lf,%.2lf,%.2lf,%.2lf,%.1lf\n",
+               wrapper_bench_op_names[op], opts->item_cnt, opts->key_cnt,
+               avl_ns, mkavl_ns, avl_cmp, mkavl_cmp, overhead_pct);
+    }
+}
+
+/**
+ * Main function for the benchmark.
+ */
+int
+main (int argc, char *argv[])
+{
+    wrapper_bench_opts_st opts;
+    wrapper_bench_result_st avl_result_array[WRAPPER_BENCH_OP_E_MAX] = {{0}};
+    wrapper_bench_result_st mkavl_result_array[WRAPPER_BENCH_OP_E_MAX] =
+        {{0}};
+    uint32_t *order_array[WRAPPER_BENCH_OP_E_MAX];
+    uint32_t *value_array;
+    uint32_t i;
+
+    parse_command_line(argc, argv, &opts);
+    srand(opts.seed);
+
+    value_array = calloc(opts.item_cnt, sizeof(*value_array));
+    assert_abort(NULL != value_array);
+    for (i = 0; i < opts.item_cnt; ++i) {
+        value_array[i] = i;
+    }
+    for (i = 0; i < WRAPPER_BENCH_OP_E_MAX; ++i) {
+        order_array[i] = calloc(opts.item_cnt, sizeof(*(order_array[i])));
+        assert_abort(NULL != order_array[i]);
+        wrapper_bench_permute(order_array[i], opts.item_cnt);
+    }
+
+    /* Alternate the two so that neither gets a warmer machine */
+    for (i = 0; i < opts.rep_cnt; ++i) {
+        wrapper_bench_run_avl(&opts, value_array, order_array,
+                              avl_result_array);
+        wrapper_bench_run_mkavl(&opts, value_array, order_array,
+                                mkavl_result_array);
+    }
+
+    if (opts.is_json) {
+        printf("[");
+    } else {
+        printf("op,items,keys,avl_ns_per_op,mkavl_ns_per_op,avl_cmp_per_op,"
+               "mkavl_cmp_per_op,overhead_pct\n");
+    }
+    for (i = 0; i < WRAPPER_BENCH_OP_E_MAX; ++i) {
+        wrapper_bench_output(&opts, i, &(avl_result_array[i]),
+                             &(mkavl_result_array[i]));
+    }
+    if (opts.is_json) {
+        printf("\n]\n");
+    }
+
+    for (i = 0; i < WRAPPER_BENCH_OP_E_MAX; ++i) {
+        free(order_array[i]);
+    }
+    free(value_array);
+
+    return (0);
+}
@@ -203,56 +203,28 @@ typedef struct employee_walk_ctx_st_ {
 } employee_walk_ctx_st;
 
 /**
- * Get a random variable from a Zipf distribution within the range [1,n].
- * Implementation is from:
- * http://www.cse.usf.edu/~christen/tools/genzipf.c
- *
- * @param alpha The alpha paremeter for the distribution.
- * @param n The maximum value (inclusive) for the random variable.
- * @return A value between 1 and n (inclusive).
+ * Context for a range lookup of employees by last name.
  */
-static uint32_t
-zipf (double alpha, uint32_t n)
-{
-    static uint32_t cached_n = 0;
-    static double cached_c = 0.0;
-    double z;
-    double sum_prob;
-    double zipf_value;
-    double c = 0.0;
-    uint32_t i;
-
-    if (n != cached_n) {
-        for (i = 1; i <= n; ++i) {
-            c = (c + (1.0 / pow((double) i, alpha)));
-        }
-        cached_c = (1.0 / c);
-        cached_n = n;
-    }
-    c = cached_c;
-
-    /* Insert industrial strength RNG method here */
-    z = ((double) rand() / RAND_MAX);
-
-    /* Map z to the value */
-    sum_prob = 0;
-    for (i = 1; i <= n; i++) {
-        sum_prob = sum_prob + (c / pow((double) i, alpha));
-        if (sum_prob >= z) {
-            zipf_value = i;
-            break;
-        }
-    }
-
-    /* Equations below are for Pareto and bounded Pareto distributions */
-    //r=(m * pow((1- z), (-1/a)));
-    //r = pow((pow(l, a) / (z*pow((l/h), a) - z + 1)), (1.0/a));
+typedef struct employee_range_ctx_st_ {
+    /** The maximum number of records to find (if find_all is false) */
+    uint32_t max_records;
+    /** If true, find all the records in the range */
+    bool find_all;
+    /** Whether to print the info for each record */
+    bool do_print;
+    /** The number of records found so far */
+    uint32_t num_records;
+} employee_range_ctx_st;
 
-    /* Assert that zipf_value is between 1 and N */
-   assert_abort((zipf_value >= 1) && (zipf_value <= n));
-
-    return (zipf_value);
-}
+/**
+ * Context for changing the last name of an employee.
+ */
+typedef struct employee_rename_ctx_st_ {
+    /** The last name to give the employee */
+    const char *new_last_name;
+    /** The last name to restore if the change is undone */
+    const char *old_last_name;
+} employee_rename_ctx_st;
 
 /**
  * Display the program's help screen and exit as needed.
@@ -576,7 +548,46 @@ free_employee (void *item, void *context)
 }
 
 /**
- * Look up a (sub)set of employees by their last name.
+ * Callback for each employee found in a range lookup by last name.
+ *
+ * @param item The current employee object.
+ * @param tree_context The context for the tree.
+ * @param walk_context The employee_range_ctx_st for the lookup.
+ * @param stop_walk Set to true once enough records are found.
+ * @return The return code.
+ */
+static mkavl_rc_e
+last_name_range_cb (void *item, void *tree_context, void *walk_context,
+                    bool *stop_walk)
+{
+    employee_obj_st *e = item;
+    employee_range_ctx_st *range_ctx = (employee_range_ctx_st *) walk_context;
+
+    if ((NULL == e) || (NULL == range_ctx) || (NULL == stop_walk)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (!range_ctx->find_all &&
+        (range_ctx->num_records >= range_ctx->max_records)) {
+        *stop_walk = true;
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    if (range_ctx->do_print) {
+        printf("%2u. ", (range_ctx->num_records + 1));
+        display_employee(e);
+    }
+    ++(range_ctx->num_records);
+    *stop_walk = (!range_ctx->find_all &&
+                  (range_ctx->num_records >= range_ctx->max_records));
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Look up a (sub)set of employees by their last name.  All the records for a
+ * last name lie between the lowest and highest possible IDs with that name, so
+ * a single range lookup finds them.
  *
  * @param input The input parameters for the run.
  * @param last_name The last name for which to search.
@@ -591,41 +602,29 @@ lookup_employees_by_last_name (employee_example_input_st *input,
                                const char *last_name, uint32_t max_records,
                                bool find_all, bool do_print)
 {
-    employee_obj_st *found_item;
-    employee_obj_st lookup_item = {0};
-    uint32_t num_records = 0;
+    employee_obj_st lo_item = {0}, hi_item = {0};
+    employee_range_ctx_st range_ctx = {0};
     mkavl_rc_e rc;
     employee_ctx_st *ctx = mkavl_get_tree_context(input->tree_h);
 
     assert_abort(NULL != ctx);
 
-    /* Set ID to the minimum possible value */
-    lookup_item.id = 0;
-    my_strlcpy(lookup_item.last_name, last_name, sizeof(lookup_item.last_name));
+    /* Bound the range by the minimum and maximum possible IDs */
+    lo_item.id = 0;
+    my_strlcpy(lo_item.last_name, last_name, sizeof(lo_item.last_name));
+    hi_item.id = UINT32_MAX;
+    my_strlcpy(hi_item.last_name, last_name, sizeof(hi_item.last_name));
 
-    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_GE,
-                    EMPLOYEE_EXAMPLE_KEY_E_LNAME_ID, &lookup_item,
-                    (void **) &found_item);
-    assert_abort(mkavl_rc_e_is_ok(rc));
-
-    while ((NULL != found_item) &&
-           (0 == strncmp(last_name, found_item->last_name,
-                         sizeof(found_item->last_name))) &&
-           (find_all || (num_records < max_records))) {
-
-        if (do_print) {
-            printf("%2u. ", (num_records + 1));
-            display_employee(found_item);
-        }
+    range_ctx.max_records = max_records;
+    range_ctx.find_all = find_all;
+    range_ctx.do_print = do_print;
 
-        rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_GT,
-                        EMPLOYEE_EXAMPLE_KEY_E_LNAME_ID, found_item,
-                        (void **) &found_item);
-        assert_abort(mkavl_rc_e_is_ok(rc));
-        ++num_records;
-    }
+    rc = mkavl_find_range(input->tree_h, EMPLOYEE_EXAMPLE_KEY_E_LNAME_ID,
+                          &lo_item, true, &hi_item, true, false,
+                          last_name_range_cb, &range_ctx);
+    assert_abort(mkavl_rc_e_is_ok(rc));
 
-    ctx->match_cnt = num_records;
+    ctx->match_cnt = range_ctx.num_records;
 }
 
 /**
@@ -660,6 +659,34 @@ last_name_walk_cb (void *item, void *tree_context, void *walk_context,
     return (MKAVL_RC_E_SUCCESS);
 }
 
+/**
+ * Update callback to change the last name of an employee.
+ *
+ * @param item The employee object.
+ * @param undo If true, restore the old last name.
+ * @param tree_context The context for the tree.
+ * @param update_context The employee_rename_ctx_st for the change.
+ * @return The return code.
+ */
+static mkavl_rc_e
+rename_update_fn (void *item, bool undo, void *tree_context,
+                  void *update_context)
+{
+    employee_obj_st *e = item;
+    employee_rename_ctx_st *rename_ctx =
+        (employee_rename_ctx_st *) update_context;
+
+    if ((NULL == e) || (NULL == rename_ctx)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    my_strlcpy(e->last_name,
+               undo ? rename_ctx->old_last_name : rename_ctx->new_last_name,
+               sizeof(e->last_name));
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
 /**
  * Run a single instance of an example.
  *
@@ -679,6 +706,7 @@ run_employee_example (employee_example_input_st *input)
     uint32_t lookup_id;
     const char *new_last_name;
     char old_last_name[MAX_NAME_LEN];
+    employee_rename_ctx_st rename_ctx;
     struct timeval tv;
     double t1, t2;
     double key_lookup_time, nonkey_lookup_time;
@@ -750,17 +778,11 @@ run_employee_example (employee_example_input_st *input)
            cur_item->first_name, cur_item->last_name, cur_item->id,
            new_last_name);
 
-    mkavl_rc = mkavl_remove_key_idx(input->tree_h,
-                                    EMPLOYEE_EXAMPLE_KEY_E_LNAME_ID, cur_item,
-                                    (void **) &found_item);
-    assert_abort((NULL != found_item) && 
-                 mkavl_rc_e_is_ok(mkavl_rc));
-    cur_item = found_item;
-
-    my_strlcpy(cur_item->last_name, new_last_name, sizeof(cur_item->last_name));
-
-    mkavl_rc = mkavl_add_key_idx(input->tree_h, EMPLOYEE_EXAMPLE_KEY_E_LNAME_ID,
-                                 cur_item, (void **) &found_item);
+    /* Only the last name key moves, the ID key stays as it is */
+    rename_ctx.new_last_name = new_last_name;
+    rename_ctx.old_last_name = old_last_name;
+    mkavl_rc = mkavl_update(input->tree_h, cur_item, rename_update_fn,
+                            &rename_ctx, (void **) &found_item);
     assert_abort((NULL == found_item) && 
                  mkavl_rc_e_is_ok(mkavl_rc));
 
@@ -33,6 +33,9 @@
 #include <stdio.h>
 #include <time.h>
 #include <errno.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <math.h>
 #include <sys/time.h>
 #include "../mkavl.h"
 
@@ -86,6 +89,66 @@ timeval_to_seconds (struct timeval *tv)
     return (tv->tv_sec + (tv->tv_usec / 1000000.0));
 }
 
+/**
+ * Get a random variable from a Zipf distribution within the range [1,n].
+ * Implementation is from:
+ * http://www.cse.usf.edu/~christen/tools/genzipf.c
+ *
+ * The cumulative probabilities for n are computed once and kept, so each call
+ * after the first for a given n takes O(lg n) time rather than O(n).
+ *
+ * @param alpha The alpha paremeter for the distribution.
+ * @param n The maximum value (inclusive) for the random variable.
+ * @return A value between 1 and n (inclusive).
+ */
+static inline uint32_t
+zipf (double alpha, uint32_t n)
+{
+    static uint32_t cached_n = 0;
+    static double cached_alpha = 0.0;
+    static double *cached_sum_prob = NULL;
+    double z;
+    double sum_prob;
+    double c = 0.0;
+    uint32_t i, lo, hi;
+
+    assert_abort(0 != n);
+
+    if ((n != cached_n) || (alpha != cached_alpha)) {
+        free(cached_sum_prob);
+        cached_sum_prob = malloc(n * sizeof(*cached_sum_prob));
+        assert_abort(NULL != cached_sum_prob);
+        for (i = 1; i <= n; ++i) {
+            c = (c + (1.0 / pow((double) i, alpha)));
+        }
+        c = (1.0 / c);
+        sum_prob = 0;
+        for (i = 1; i <= n; ++i) {
+            sum_prob = sum_prob + (c / pow((double) i, alpha));
+            cached_sum_prob[i - 1] = sum_prob;
+        }
+        cached_n = n;
+        cached_alpha = alpha;
+    }
+
+    /* Insert industrial strength RNG method here */
+    z = ((double) rand() / RAND_MAX);
+
+    /* Map z to the first value whose cumulative probability reaches it */
+    lo = 0;
+    hi = (n - 1);
+    while (lo < hi) {
+        i = (lo + ((hi - lo) / 2));
+        if (cached_sum_prob[i] >= z) {
+            hi = i;
+        } else {
+            lo = (i + 1);
+        }
+    }
+
+    return (lo + 1);
+}
+
 /**
  * Sigh, yes for reasons divorced from reality, you just have to keep
  * implementing this.  Copied from the BSD source.  See 
@@ -145,6 +145,20 @@ typedef struct malloc_example_input_st_ {
     mkavl_tree_handle tree_h;
 } malloc_example_input_st;
 
+/**
+ * The context for changing a memory block with memblock_update_fn().
+ */
+typedef struct memblock_update_ctx_st_ {
+    /** The new byte count for the block */
+    size_t byte_cnt;
+    /** The new allocation status for the block */
+    bool is_allocated;
+    /** The byte count before the change */
+    size_t old_byte_cnt;
+    /** The allocation status before the change */
+    bool old_is_allocated;
+} memblock_update_ctx_st;
+
 /**
  * The context associated with the memblock AVLs.
  */
@@ -384,8 +398,21 @@ static mkavl_compare_fn cmp_fn_array[] = {
     memblock_cmp_by_size 
 };
 
+/**
+ * The aggregates to keep per key.  Free blocks sort first by size, so summing
+ * the byte counts by size gives the free memory in O(lg N).
+ */
+static const mkavl_aggregate_st aggregate_array[] = {
+    { .type = MKAVL_AGGREGATE_TYPE_E_NONE },
+    { .type = MKAVL_AGGREGATE_TYPE_E_SUM,
+      .field_offset = offsetof(memblock_obj_st, byte_cnt),
+      .field_type = (sizeof(size_t) == sizeof(uint64_t)) ?
+          MKAVL_AGGREGATE_FIELD_E_U64 : MKAVL_AGGREGATE_FIELD_E_U32 },
+};
+
 /** @cond doxygen_suppress */
 CT_ASSERT(NELEMS(cmp_fn_array) == MALLOC_EXAMPLE_KEY_E_MAX);
+CT_ASSERT(NELEMS(aggregate_array) == MALLOC_EXAMPLE_KEY_E_MAX);
 /** @endcond */
 
 /**
@@ -407,6 +434,41 @@ free_memblock (void *item, void *context)
     return (MKAVL_RC_E_SUCCESS);
 }
 
+/**
+ * Update callback to change the size and allocation status of a block.
+ *
+ * @param item The memory block object.
+ * @param undo If true, restore the old values.
+ * @param tree_context Context for the tree.
+ * @param update_context The memblock_update_ctx_st for the change.
+ * @return The return code
+ */
+static mkavl_rc_e
+memblock_update_fn (void *item, bool undo, void *tree_context,
+                    void *update_context)
+{
+    memblock_update_ctx_st *update_ctx =
+        (memblock_update_ctx_st *) update_context;
+    memblock_obj_st *obj = item;
+
+    if ((NULL == obj) || (NULL == update_ctx)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (undo) {
+        obj->byte_cnt = update_ctx->old_byte_cnt;
+        obj->is_allocated = update_ctx->old_is_allocated;
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    update_ctx->old_byte_cnt = obj->byte_cnt;
+    update_ctx->old_is_allocated = obj->is_allocated;
+    obj->byte_cnt = update_ctx->byte_cnt;
+    obj->is_allocated = update_ctx->is_allocated;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
 /**
  * Display memory in the given range.
  *
@@ -421,10 +483,18 @@ display_memory (mkavl_tree_handle tree_h, void *start_addr, size_t bytes)
     memblock_obj_st lookup_item = {0};
     uint32_t loop_cnt = 0;
     void *end_addr = (start_addr + bytes);
+    int64_t free_bytes;
     mkavl_rc_e rc;
 
     assert_abort(NULL != tree_h);
 
+    /* Everything ordered before the smallest allocated block is free */
+    lookup_item.is_allocated = true;
+    rc = mkavl_aggregate_range(tree_h, MALLOC_EXAMPLE_KEY_E_SIZE, NULL, false,
+                               &lookup_item, false, &free_bytes);
+    assert_abort(mkavl_rc_e_is_ok(rc));
+    lookup_item.is_allocated = false;
+
     lookup_item.start_addr = start_addr;
     rc = mkavl_find(tree_h, MKAVL_FIND_TYPE_E_GE,
                     MALLOC_EXAMPLE_KEY_E_ADDR, &lookup_item,
@@ -434,7 +504,8 @@ display_memory (mkavl_tree_handle tree_h, void *start_addr, size_t bytes)
 
     printf("\n*** Displaying memory from %p to %p (size=%zu) ***\n",
            start_addr, end_addr, bytes);
-    printf("XXX = allocated, OOO = free\n\n");
+    printf("XXX = allocated, OOO = free, %" PRId64 " bytes free in total\n\n",
+           free_bytes);
 
     while ((NULL != cur_item) &&
            (cur_item->start_addr <= end_addr)) {
@@ -505,6 +576,7 @@ my_malloc (mkavl_tree_handle tree_h, size_t size)
 {
     memblock_obj_st lookup_item = {0};
     memblock_obj_st *cur_item, *found_item, *new_item;
+    memblock_update_ctx_st update_ctx;
     size_t new_size;
     void *new_addr;
     bool bool_rc;
@@ -530,21 +602,18 @@ my_malloc (mkavl_tree_handle tree_h, size_t size)
     }
 
     cur_item = found_item;
+    new_size = (cur_item->byte_cnt - size);
 
-    rc = mkavl_remove_key_idx(tree_h, MALLOC_EXAMPLE_KEY_E_SIZE, 
-                              cur_item, (void **) &found_item);
-    assert_abort((NULL != found_item) && 
-                 mkavl_rc_e_is_ok(rc));
-    cur_item = found_item;
-
-    cur_item->is_allocated = true;
+    /* Only the size key moves, the address stays the same */
+    update_ctx.byte_cnt = size;
+    update_ctx.is_allocated = true;
+    rc = mkavl_update(tree_h, cur_item, memblock_update_fn, &update_ctx,
+                      (void **) &found_item);
+    assert_abort((NULL == found_item) && mkavl_rc_e_is_ok(rc));
 
     /* Split the memory block in two if larger than necessary */
-    if (cur_item->byte_cnt > size) {
-
+    if (new_size > 0) {
         new_addr = (cur_item->start_addr + size);
-        new_size = (cur_item->byte_cnt - size);
-        cur_item->byte_cnt = size;
 
         bool_rc = generate_memblock(&new_item, new_addr, new_size);
         assert_abort((NULL != new_item) && bool_rc);
@@ -553,11 +622,6 @@ my_malloc (mkavl_tree_handle tree_h, size_t size)
         assert_abort((NULL == found_item) && mkavl_rc_e_is_ok(rc));
     }
 
-    rc = mkavl_add_key_idx(tree_h, MALLOC_EXAMPLE_KEY_E_SIZE,
-                           cur_item, (void **) &found_item);
-    assert_abort((NULL == found_item) && 
-                 mkavl_rc_e_is_ok(rc));
-
     return (cur_item->start_addr);
 }
 
@@ -573,6 +637,7 @@ my_free (mkavl_tree_handle tree_h, void *ptr)
     memblock_obj_st *found_item, *cur_item, *prev_item, *next_item;
     memblock_obj_st *update_item = NULL;
     memblock_obj_st lookup_item = {0};
+    memblock_update_ctx_st update_ctx;
     size_t new_size;
     mkavl_rc_e rc;
 
@@ -622,19 +687,11 @@ my_free (mkavl_tree_handle tree_h, void *ptr)
         cur_item = NULL;
     }
 
-    rc = mkavl_remove_key_idx(tree_h, MALLOC_EXAMPLE_KEY_E_SIZE, 
-                              update_item, (void **) &found_item);
-    assert_abort((NULL != found_item) && 
-                 mkavl_rc_e_is_ok(rc));
-    update_item = found_item;
-
-    update_item->byte_cnt = new_size;
-    update_item->is_allocated = false;
-
-    rc = mkavl_add_key_idx(tree_h, MALLOC_EXAMPLE_KEY_E_SIZE,
-                           update_item, (void **) &found_item);
-    assert_abort((NULL == found_item) && 
-                 mkavl_rc_e_is_ok(rc));
+    update_ctx.byte_cnt = new_size;
+    update_ctx.is_allocated = false;
+    rc = mkavl_update(tree_h, update_item, memblock_update_fn, &update_ctx,
+                      (void **) &found_item);
+    assert_abort((NULL == found_item) && mkavl_rc_e_is_ok(rc));
 }
 
 /**
@@ -650,12 +707,13 @@ run_malloc_example (malloc_example_input_st *input)
     memblock_ctx_st ctx = {0};
     uint32_t i, size_idx, idx, cnt;
     void *ptr_array[input->opts->malloc_cnt];
+    mkavl_opts_st tree_opts = { .aggregate_array = aggregate_array };
     mkavl_rc_e mkavl_rc;
 
     printf("\n");
 
-    mkavl_rc = mkavl_new(&(input->tree_h), cmp_fn_array, NELEMS(cmp_fn_array),
-                         &ctx, NULL);
+    mkavl_rc = mkavl_new_opts(&(input->tree_h), cmp_fn_array,
+                              NELEMS(cmp_fn_array), &ctx, NULL, &tree_opts);
     assert_abort(mkavl_rc_e_is_ok(mkavl_rc));
 
     /* Create the entire block of memory to use */
@@ -29,6 +29,22 @@
 #include <string.h>
 #include "avl.h"
 
+/* Returns the number of nodes in the subtree rooted at |p|. */
+#define SUBTREE_SIZE(p) ((p) != NULL ? (size_t) (p)->avl_size : 0)
+
+/* Recomputes |p|'s subtree size from the sizes of its children,
+   then lets |tree|'s update function, if any, refresh the rest of
+   |p|'s augmentation.
+   |p|'s children must already be up to date. */
+static inline void
+refresh_node (struct avl_table *tree, struct avl_node *p)
+{
+  p->avl_size = (unsigned int) (1 + SUBTREE_SIZE (p->avl_link[0])
+                                + SUBTREE_SIZE (p->avl_link[1]));
+  if (tree->avl_update != NULL)
+    tree->avl_update (p, tree->avl_param);
+}
+
 /* Creates and returns a new table
    with comparison function |compare| using parameter |param|
    and memory allocator |allocator|.
@@ -54,6 +70,10 @@ avl_create (avl_comparison_func *compare, void *param,
   tree->avl_alloc = allocator;
   tree->avl_count = 0;
   tree->avl_generation = 0;
+  tree->avl_update = NULL;
+  tree->avl_node_size = sizeof (struct avl_node);
+  tree->avl_unshare = NULL;
+  tree->avl_rotations = 0;
 
   return tree;
 }
@@ -81,22 +101,104 @@ avl_find (const struct avl_table *tree, const void *item)
   return NULL;
 }
 
+/* Returns the number of items in |tree| less than |item|,
+   or less than or equal to |item| if |or_equal| is nonzero.
+   If |item| is in |tree|, this is its 0-based position in inorder
+   when |or_equal| is zero.
+   Takes O(lg n) time. */
+size_t
+avl_rank (const struct avl_table *tree, const void *item, int or_equal)
+{
+  const struct avl_node *p;
+  size_t rank = 0;
+
+  assert (tree != NULL && item != NULL);
+  for (p = tree->avl_root; p != NULL; )
+    {
+      int cmp = tree->avl_compare (item, p->avl_data, tree->avl_param);
+
+      if (cmp > 0 || (cmp == 0 && or_equal))
+        {
+          /* |p| and everything to its left is counted. */
+          rank += SUBTREE_SIZE (p->avl_link[0]) + 1;
+          if (cmp == 0)
+            break;
+          p = p->avl_link[1];
+        }
+      else if (cmp < 0)
+        p = p->avl_link[0];
+      else
+        {
+          rank += SUBTREE_SIZE (p->avl_link[0]);
+          break;
+        }
+    }
+
+  return rank;
+}
+
+/* Returns the item at 0-based position |idx| in inorder in |tree|,
+   or a null pointer if |idx| is not less than the number of items.
+   Takes O(lg n) time. */
+void *
+avl_select (const struct avl_table *tree, size_t idx)
+{
+  const struct avl_node *p;
+
+  assert (tree != NULL);
+  if (idx >= tree->avl_count)
+    return NULL;
+
+  for (p = tree->avl_root; p != NULL; )
+    {
+      size_t left = SUBTREE_SIZE (p->avl_link[0]);
+
+      if (idx < left)
+        p = p->avl_link[0];
+      else if (idx > left)
+        {
+          idx -= left + 1;
+          p = p->avl_link[1];
+        }
+      else
+        return p->avl_data;
+    }
+
+  assert (0);
+  return NULL;
+}
+
 /* Inserts |item| into |tree| and returns a pointer to |item|'s address.
    If a duplicate item is found in the tree,
    returns a pointer to the duplicate without inserting |item|.
    Returns |NULL| in case of memory allocation failure. */
 void **
 avl_probe (struct avl_table *tree, void *item)
+{
+  return avl_probe_node (tree, item, NULL);
+}
+
+/* Inserts |item| into |tree| using |n| as its node
+   and returns a pointer to |item|'s address.
+   If |n| is |NULL|, a node is obtained from |tree|'s allocator instead.
+   If a duplicate item is found in the tree,
+   returns a pointer to the duplicate without inserting |item|
+   and without touching |n|.
+   Returns |NULL| in case of memory allocation failure. */
+void **
+avl_probe_node (struct avl_table *tree, void *item, struct avl_node *n)
 {
   struct avl_node *y, *z; /* Top node to update balance factor, and parent. */
   struct avl_node *p, *q; /* Iterator, and parent. */
-  struct avl_node *n;     /* Newly inserted node. */
   struct avl_node *w;     /* New root of rebalanced subtree. */
   int dir;                /* Direction to descend. */
 
   unsigned char da[AVL_MAX_HEIGHT]; /* Cached comparison results. */
   int k = 0;              /* Number of cached results. */
 
+  struct avl_node *pa[AVL_MAX_HEIGHT]; /* Nodes on the path to |n|. */
+  int h = 0;              /* Number of nodes in |pa[]|. */
+
   assert (tree != NULL && item != NULL);
 
   z = (struct avl_node *) &tree->avl_root;
@@ -111,17 +213,26 @@ avl_probe (struct avl_table *tree, void *item)
       if (p->avl_balance != 0)
         z = q, y = p, k = 0;
       da[k++] = dir = cmp > 0;
+      assert (h < AVL_MAX_HEIGHT);
+      pa[h++] = p;
     }
 
-  n = q->avl_link[dir] =
-    tree->avl_alloc->libavl_malloc (tree->avl_alloc, sizeof *n);
   if (n == NULL)
-    return NULL;
+    {
+      n = tree->avl_alloc->libavl_malloc (tree->avl_alloc,
+                                          tree->avl_node_size);
+      if (n == NULL)
+        return NULL;
+    }
+  q->avl_link[dir] = n;
 
   tree->avl_count++;
   n->avl_data = item;
   n->avl_link[0] = n->avl_link[1] = NULL;
   n->avl_balance = 0;
+  refresh_node (tree, n);
+  while (h > 0)
+    refresh_node (tree, pa[--h]);
   if (y == NULL)
     return &n->avl_data;
 
@@ -140,6 +251,9 @@ avl_probe (struct avl_table *tree, void *item)
           y->avl_link[0] = x->avl_link[1];
           x->avl_link[1] = y;
           x->avl_balance = y->avl_balance = 0;
+          refresh_node (tree, y);
+          refresh_node (tree, x);
+          tree->avl_rotations++;
         }
       else
         {
@@ -156,6 +270,10 @@ avl_probe (struct avl_table *tree, void *item)
           else /* |w->avl_balance == +1| */
             x->avl_balance = -1, y->avl_balance = 0;
           w->avl_balance = 0;
+          refresh_node (tree, x);
+          refresh_node (tree, y);
+          refresh_node (tree, w);
+          tree->avl_rotations += 2;
         }
     }
   else if (y->avl_balance == +2)
@@ -167,6 +285,9 @@ avl_probe (struct avl_table *tree, void *item)
           y->avl_link[1] = x->avl_link[0];
           x->avl_link[0] = y;
           x->avl_balance = y->avl_balance = 0;
+          refresh_node (tree, y);
+          refresh_node (tree, x);
+          tree->avl_rotations++;
         }
       else
         {
@@ -183,6 +304,10 @@ avl_probe (struct avl_table *tree, void *item)
           else /* |w->avl_balance == -1| */
             x->avl_balance = +1, y->avl_balance = 0;
           w->avl_balance = 0;
+          refresh_node (tree, x);
+          refresh_node (tree, y);
+          refresh_node (tree, w);
+          tree->avl_rotations += 2;
         }
     }
   else
@@ -227,31 +352,26 @@ avl_replace (struct avl_table *table, void *item)
 void *
 avl_delete (struct avl_table *tree, const void *item)
 {
-  /* Stack of nodes. */
-  struct avl_node *pa[AVL_MAX_HEIGHT]; /* Nodes. */
-  unsigned char da[AVL_MAX_HEIGHT];    /* |avl_link[]| indexes. */
-  int k;                               /* Stack pointer. */
-
-  struct avl_node *p;   /* Traverses tree to find node to delete. */
-  int cmp;              /* Result of comparison between |item| and |p|. */
+  struct avl_node *p = avl_delete_node (tree, item);
+  void *data;
 
-  assert (tree != NULL && item != NULL);
-
-  k = 0;
-  p = (struct avl_node *) &tree->avl_root;
-  for (cmp = -1; cmp != 0;
-       cmp = tree->avl_compare (item, p->avl_data, tree->avl_param))
-    {
-      int dir = cmp > 0;
+  if (p == NULL)
+    return NULL;
 
-      pa[k] = p;
-      da[k++] = dir;
+  data = p->avl_data;
+  tree->avl_alloc->libavl_free (tree->avl_alloc, p);
+  return data;
+}
 
-      p = p->avl_link[dir];
-      if (p == NULL)
-        return NULL;
-    }
-  item = p->avl_data;
+/* Unlinks from |tree| the node at the end of the path |pa[]|, |da[]|
+   of |k| nodes and link directions, where |pa[0]| is the pseudo-root,
+   then rebalances the tree.
+   Returns the node, which is not freed. */
+static struct avl_node *
+unlink_path (struct avl_table *tree, struct avl_node **pa,
+             unsigned char *da, int k)
+{
+  struct avl_node *p = pa[k - 1]->avl_link[da[k - 1]];
 
   if (p->avl_link[1] == NULL)
     pa[k - 1]->avl_link[da[k - 1]] = p->avl_link[0];
@@ -293,7 +413,15 @@ avl_delete (struct avl_table *tree, const void *item)
         }
     }
 
-  tree->avl_alloc->libavl_free (tree->avl_alloc, p);
+  /* Every node on the path lost a node from its subtree
+     and some took over |p|'s children, so refresh them bottom-up.
+     |pa[0]| is the pseudo-root, so it is skipped. */
+  {
+    int i;
+
+    for (i = k - 1; i > 0; i--)
+      refresh_node (tree, pa[i]);
+  }
 
   assert (k > 0);
   while (--k > 0)
@@ -324,13 +452,20 @@ avl_delete (struct avl_table *tree, const void *item)
                   else /* |w->avl_balance == -1| */
                     x->avl_balance = +1, y->avl_balance = 0;
                   w->avl_balance = 0;
+                  refresh_node (tree, x);
+                  refresh_node (tree, y);
+                  refresh_node (tree, w);
                   pa[k - 1]->avl_link[da[k - 1]] = w;
+                  tree->avl_rotations += 2;
                 }
               else
                 {
                   y->avl_link[1] = x->avl_link[0];
                   x->avl_link[0] = y;
+                  refresh_node (tree, y);
+                  refresh_node (tree, x);
                   pa[k - 1]->avl_link[da[k - 1]] = x;
+                  tree->avl_rotations++;
                   if (x->avl_balance == 0)
                     {
                       x->avl_balance = -1;
@@ -366,13 +501,20 @@ avl_delete (struct avl_table *tree, const void *item)
                   else /* |w->avl_balance == +1| */
                     x->avl_balance = -1, y->avl_balance = 0;
                   w->avl_balance = 0;
+                  refresh_node (tree, x);
+                  refresh_node (tree, y);
+                  refresh_node (tree, w);
                   pa[k - 1]->avl_link[da[k - 1]] = w;
+                  tree->avl_rotations += 2;
                 }
               else
                 {
                   y->avl_link[0] = x->avl_link[1];
                   x->avl_link[1] = y;
+                  refresh_node (tree, y);
+                  refresh_node (tree, x);
                   pa[k - 1]->avl_link[da[k - 1]] = x;
+                  tree->avl_rotations++;
                   if (x->avl_balance == 0)
                     {
                       x->avl_balance = +1;
@@ -388,7 +530,154 @@ avl_delete (struct avl_table *tree, const void *item)
 
   tree->avl_count--;
   tree->avl_generation++;
-  return (void *) item;
+  return p;
+}
+
+/* Unlinks from |tree| the node holding an item matching |item|
+   and returns the node, which is not freed.
+   Returns a null pointer if no matching item found. */
+struct avl_node *
+avl_delete_node (struct avl_table *tree, const void *item)
+{
+  /* Stack of nodes. */
+  struct avl_node *pa[AVL_MAX_HEIGHT]; /* Nodes. */
+  unsigned char da[AVL_MAX_HEIGHT];    /* |avl_link[]| indexes. */
+  int k;                               /* Stack pointer. */
+
+  struct avl_node *p;   /* Traverses tree to find node to delete. */
+  int cmp;              /* Result of comparison between |item| and |p|. */
+
+  assert (tree != NULL && item != NULL);
+
+  k = 0;
+  p = (struct avl_node *) &tree->avl_root;
+  for (cmp = -1; cmp != 0;
+       cmp = tree->avl_compare (item, p->avl_data, tree->avl_param))
+    {
+      int dir = cmp > 0;
+
+      pa[k] = p;
+      da[k++] = dir;
+
+      p = p->avl_link[dir];
+      if (p == NULL)
+        return NULL;
+    }
+
+  return unlink_path (tree, pa, da, k);
+}
+
+/* Makes |q|'s child on side |dir| private to |tree|,
+   by way of |tree|'s unshare function.
+   Returns nonzero if successful, zero if the unshare function failed. */
+static int
+own_link (struct avl_table *tree, struct avl_node *q, int dir)
+{
+  struct avl_node *p = q->avl_link[dir];
+  struct avl_node *n;
+
+  if (p == NULL)
+    return 1;
+  n = tree->avl_unshare (p, tree->avl_param);
+  if (n == NULL)
+    return 0;
+  if (n != p)
+    {
+      q->avl_link[dir] = n;
+      tree->avl_generation++;
+    }
+  return 1;
+}
+
+/* Makes private to |tree| the nodes that rebalancing at |y| would rotate
+   once |y|'s subtree on side |dir| became shorter,
+   given |y|'s balance factor |balance| before that.
+   |y| must already be private.
+   Returns nonzero if successful, zero if the unshare function failed. */
+static int
+own_rotation (struct avl_table *tree, struct avl_node *y, int dir,
+              int balance)
+{
+  int heavy = dir == 0 ? +1 : -1;
+
+  if (balance != heavy)
+    return 1;
+  if (!own_link (tree, y, !dir))
+    return 0;
+  if (y->avl_link[!dir]->avl_balance == -heavy)
+    return own_link (tree, y->avl_link[!dir], dir);
+  return 1;
+}
+
+/* Makes private to |tree|, by way of its unshare function,
+   every node that inserting |item| into |tree|, or deleting it from |tree|
+   if |deleting| is nonzero, would change,
+   so that the change leaves alone any nodes shared with other tables.
+   Only the links to replaced nodes change, so |tree| holds the same items
+   in the same shape whether or not this succeeds.
+   Does nothing if |tree| has no unshare function.
+   Returns nonzero if successful, zero if the unshare function failed. */
+int
+avl_unshare (struct avl_table *tree, const void *item, int deleting)
+{
+  struct avl_node *pa[AVL_MAX_HEIGHT]; /* Nodes on the path to |item|. */
+  unsigned char da[AVL_MAX_HEIGHT];    /* Directions taken from them. */
+  int k = 0;                           /* Stack height. */
+
+  struct avl_node *p, *q; /* Iterator, and parent. */
+  int dir = 0;            /* Direction taken from |q|. */
+  int i;
+
+  assert (tree != NULL && item != NULL);
+
+  if (tree->avl_unshare == NULL)
+    return 1;
+
+  /* Inserting or deleting changes every node on the path to |item|. */
+  q = (struct avl_node *) &tree->avl_root;
+  for (;;)
+    {
+      int cmp;
+
+      if (!own_link (tree, q, dir))
+        return 0;
+      p = q->avl_link[dir];
+      if (p == NULL)
+        return 1;
+      cmp = tree->avl_compare (item, p->avl_data, tree->avl_param);
+      if (cmp == 0)
+        break;
+
+      assert (k < AVL_MAX_HEIGHT);
+      pa[k] = p;
+      da[k++] = dir = cmp > 0;
+      q = p;
+    }
+  if (!deleting)
+    return 1;
+
+  /* Deleting also changes the nodes down to |p|'s successor,
+     and any that rebalancing rotates on the way back up. */
+  for (i = 0; i < k; i++)
+    if (!own_rotation (tree, pa[i], da[i], pa[i]->avl_balance))
+      return 0;
+  if (p->avl_link[1] == NULL)
+    return 1;
+
+  if (!own_link (tree, p, 1))
+    return 0;
+  q = p->avl_link[1];
+  if (!own_rotation (tree, p, 1, p->avl_balance))
+    return 0;
+  while (q->avl_link[0] != NULL)
+    {
+      if (!own_link (tree, q, 0)
+          || !own_rotation (tree, q, 0, q->avl_balance))
+        return 0;
+      q = q->avl_link[0];
+    }
+
+  return 1;
 }
 
 /* Refreshes the stack of parent pointers in |trav|
@@ -521,6 +810,104 @@ avl_t_find (struct avl_traverser *trav, struct avl_table *tree, void *item)
   return NULL;
 }
 
+/* Searches |tree| for the item nearest to |item| in direction |dir|:
+   the least item greater than |item| if |dir| is 1,
+   or the greatest item less than |item| if |dir| is 0.
+   If |or_equal| is nonzero, an item equal to |item| also qualifies.
+   If found, initializes |trav| to the item found and returns the item
+   as well, so that |trav| can continue from there in either direction.
+   If there is no such item, initializes |trav| to the null item
+   and returns |NULL|. */
+void *
+avl_t_seek (struct avl_traverser *trav, struct avl_table *tree,
+            const void *item, int dir, int or_equal)
+{
+  struct avl_node *p, *q;
+  struct avl_node *found = NULL;
+  size_t found_height = 0;
+
+  assert (trav != NULL && tree != NULL && item != NULL);
+  assert (dir == 0 || dir == 1);
+  trav->avl_table = tree;
+  trav->avl_height = 0;
+  trav->avl_generation = tree->avl_generation;
+  for (p = tree->avl_root; p != NULL; p = q)
+    {
+      int cmp = tree->avl_compare (item, p->avl_data, tree->avl_param);
+
+      if (cmp == 0 && or_equal)
+        {
+          found = p;
+          found_height = trav->avl_height;
+          break;
+        }
+
+      /* |p| qualifies if it lies on the |dir| side of |item|,
+         in which case a nearer item can only be on its other side. */
+      if (dir ? cmp < 0 : cmp > 0)
+        {
+          found = p;
+          found_height = trav->avl_height;
+          q = p->avl_link[!dir];
+        }
+      else
+        q = p->avl_link[dir];
+
+      assert (trav->avl_height < AVL_MAX_HEIGHT);
+      trav->avl_stack[trav->avl_height++] = p;
+    }
+
+  /* The nodes above |found| are the first |found_height| on the stack. */
+  trav->avl_height = found != NULL ? found_height : 0;
+  trav->avl_node = found;
+  return found != NULL ? found->avl_data : NULL;
+}
+
+/* Initializes |trav| to the item at 0-based position |idx| in inorder
+   in |tree| and returns the item.
+   If |idx| is not less than the number of items,
+   initializes |trav| to the null item and returns |NULL|. */
+void *
+avl_t_select (struct avl_traverser *trav, struct avl_table *tree, size_t idx)
+{
+  struct avl_node *p;
+
+  assert (trav != NULL && tree != NULL);
+  trav->avl_table = tree;
+  trav->avl_height = 0;
+  trav->avl_generation = tree->avl_generation;
+  trav->avl_node = NULL;
+  if (idx >= tree->avl_count)
+    return NULL;
+
+  for (p = tree->avl_root; p != NULL; )
+    {
+      size_t left = SUBTREE_SIZE (p->avl_link[0]);
+      int dir;
+
+      if (idx == left)
+        {
+          trav->avl_node = p;
+          return p->avl_data;
+        }
+      else if (idx > left)
+        {
+          idx -= left + 1;
+          dir = 1;
+        }
+      else
+        dir = 0;
+
+      assert (trav->avl_height < AVL_MAX_HEIGHT);
+      trav->avl_stack[trav->avl_height++] = p;
+      p = p->avl_link[dir];
+    }
+
+  assert (0);
+  trav->avl_height = 0;
+  return NULL;
+}
+
 /* Attempts to insert |item| into |tree|.
    If |item| is inserted successfully, it is returned and |trav| is
    initialized to its location.
@@ -703,6 +1090,67 @@ avl_t_replace (struct avl_traverser *trav, void *new)
   return old;
 }
 
+/* Unlinks the node selected by |trav| from its table and returns
+   the node, which is not freed.
+   The node is found through the path saved in |trav| rather than by
+   comparing items, so its item may no longer be in order, as when the
+   item's key was changed in place.
+   |trav| must not have the null item selected
+   and its table must not have changed since |trav| was positioned.
+   Afterward, |trav| selects the null item. */
+struct avl_node *
+avl_t_unlink (struct avl_traverser *trav)
+{
+  struct avl_node *pa[AVL_MAX_HEIGHT]; /* Nodes. */
+  unsigned char da[AVL_MAX_HEIGHT];    /* |avl_link[]| indexes. */
+  struct avl_table *tree;
+  struct avl_node *p;
+  int i, k;
+
+  assert (trav != NULL && trav->avl_node != NULL);
+  tree = trav->avl_table;
+  assert (trav->avl_generation == tree->avl_generation);
+
+  k = 0;
+  pa[k] = (struct avl_node *) &tree->avl_root;
+  da[k++] = 0;
+  for (i = 0; i < trav->avl_height; i++)
+    pa[k++] = trav->avl_stack[i];
+  for (i = 1; i < k; i++)
+    da[i] = pa[i]->avl_link[1] == (i + 1 < k ? pa[i + 1] : trav->avl_node);
+
+  p = unlink_path (tree, pa, da, k);
+  assert (p == trav->avl_node);
+
+  trav->avl_node = NULL;
+  trav->avl_height = 0;
+  trav->avl_generation = tree->avl_generation;
+  return p;
+}
+
+/* Recomputes the augmentation of the node selected by |trav|
+   and of all its ancestors, after its item changed
+   in a way that does not affect the ordering of the tree.
+   |trav| must not have the null item selected
+   and its table must not have changed since |trav| was positioned. */
+void
+avl_t_refresh (struct avl_traverser *trav)
+{
+  struct avl_table *tree;
+  int i;
+
+  assert (trav != NULL && trav->avl_node != NULL);
+  tree = trav->avl_table;
+  assert (trav->avl_generation == tree->avl_generation);
+
+  if (tree->avl_update == NULL)
+    return;
+
+  refresh_node (tree, trav->avl_node);
+  for (i = trav->avl_height - 1; i >= 0; i--)
+    refresh_node (tree, trav->avl_stack[i]);
+}
+
 /* Destroys |new| with |avl_destroy (new, destroy)|,
    first setting right links of nodes in |stack| within |new|
    to null pointers to avoid touching uninitialized data. */
@@ -743,6 +1191,9 @@ avl_copy (const struct avl_table *org, avl_copy_func *copy,
   if (new == NULL)
     return NULL;
   new->avl_count = org->avl_count;
+  new->avl_update = org->avl_update;
+  new->avl_node_size = org->avl_node_size;
+  new->avl_unshare = NULL; /* The copy shares no nodes. */
   if (new->avl_count == 0)
     return new;
 
@@ -756,7 +1207,7 @@ avl_copy (const struct avl_table *org, avl_copy_func *copy,
 
           y->avl_link[0] =
             new->avl_alloc->libavl_malloc (new->avl_alloc,
-                                           sizeof *y->avl_link[0]);
+                                           new->avl_node_size);
           if (y->avl_link[0] == NULL)
             {
               if (y != (struct avl_node *) &new->avl_root)
@@ -779,6 +1230,9 @@ avl_copy (const struct avl_table *org, avl_copy_func *copy,
       for (;;)
         {
           y->avl_balance = x->avl_balance;
+          y->avl_size = x->avl_size;
+          /* Copy any augmentation that follows the node proper. */
+          memcpy (y + 1, x + 1, org->avl_node_size - sizeof *y);
           if (copy == NULL)
             y->avl_data = x->avl_data;
           else
@@ -796,7 +1250,7 @@ avl_copy (const struct avl_table *org, avl_copy_func *copy,
             {
               y->avl_link[1] =
                 new->avl_alloc->libavl_malloc (new->avl_alloc,
-                                               sizeof *y->avl_link[1]);
+                                               new->avl_node_size);
               if (y->avl_link[1] == NULL)
                 {
                   copy_error_recovery (stack, height, new, destroy);
@@ -819,6 +1273,52 @@ avl_copy (const struct avl_table *org, avl_copy_func *copy,
     }
 }
 
+/* Links the |n| nodes in |nodes[]| into a perfectly balanced subtree
+   and returns its root, storing the subtree's height in |*height|.
+   The nodes must be in inorder and have their |avl_data| set. */
+static struct avl_node *
+build_subtree (struct avl_table *tree, struct avl_node **nodes, size_t n,
+               int *height)
+{
+  struct avl_node *p;
+  int left, right;
+  size_t mid;
+
+  if (n == 0)
+    {
+      *height = 0;
+      return NULL;
+    }
+
+  mid = n / 2;
+  p = nodes[mid];
+  p->avl_link[0] = build_subtree (tree, nodes, mid, &left);
+  p->avl_link[1] = build_subtree (tree, nodes + mid + 1, n - mid - 1, &right);
+  p->avl_balance = (signed char) (right - left);
+  refresh_node (tree, p);
+  *height = (left > right ? left : right) + 1;
+
+  return p;
+}
+
+/* Makes the |n| nodes in |nodes[]| the contents of |tree|,
+   which must be empty, as a perfectly balanced tree.
+   The nodes must be in strictly increasing order of their |avl_data|
+   according to |tree|'s comparison function.
+   Takes O(n) time and allocates no memory. */
+void
+avl_build (struct avl_table *tree, struct avl_node **nodes, size_t n)
+{
+  int height;
+
+  assert (tree != NULL && tree->avl_count == 0);
+  assert (nodes != NULL || n == 0);
+
+  tree->avl_root = build_subtree (tree, nodes, n, &height);
+  tree->avl_count = n;
+  tree->avl_generation++;
+}
+
 /* Frees storage allocated for |tree|.
    If |destroy != NULL|, applies it to each data item in inorder. */
 void
@@ -28,11 +28,16 @@
 
 #include <stddef.h>
 
+struct avl_node;
+
 /* Function types. */
 typedef int avl_comparison_func (const void *avl_a, const void *avl_b,
                                  void *avl_param);
 typedef void avl_item_func (void *avl_item, void *avl_param);
 typedef void *avl_copy_func (void *avl_item, void *avl_param);
+typedef void avl_update_func (struct avl_node *avl_node, void *avl_param);
+typedef struct avl_node *avl_unshare_func (struct avl_node *avl_node,
+                                           void *avl_param);
 
 #ifndef LIBAVL_ALLOCATOR
 #define LIBAVL_ALLOCATOR
@@ -63,6 +68,10 @@ struct avl_table
     struct libavl_allocator *avl_alloc; /* Memory allocator. */
     size_t avl_count;                   /* Number of items in tree. */
     unsigned long avl_generation;       /* Generation number. */
+    avl_update_func *avl_update;        /* Refreshes node augmentation. */
+    size_t avl_node_size;               /* Bytes allocated per node. */
+    avl_unshare_func *avl_unshare;      /* Privatizes a shared node. */
+    unsigned long avl_rotations;        /* Rotations done to rebalance. */
   };
 
 /* An AVL tree node. */
@@ -71,6 +80,7 @@ struct avl_node
     struct avl_node *avl_link[2];  /* Subtrees. */
     void *avl_data;                /* Pointer to data. */
     signed char avl_balance;       /* Balance factor. */
+    unsigned int avl_size;         /* Number of nodes in subtree. */
   };
 
 /* AVL traverser structure. */
@@ -91,9 +101,16 @@ struct avl_table *avl_copy (const struct avl_table *, avl_copy_func *,
                             avl_item_func *, struct libavl_allocator *);
 void avl_destroy (struct avl_table *, avl_item_func *);
 void **avl_probe (struct avl_table *, void *);
+void **avl_probe_node (struct avl_table *, void *, struct avl_node *);
 void *avl_insert (struct avl_table *, void *);
 void *avl_replace (struct avl_table *, void *);
 void *avl_delete (struct avl_table *, const void *);
+struct avl_node *avl_delete_node (struct avl_table *, const void *);
+int avl_unshare (struct avl_table *, const void *, int);
+void avl_build (struct avl_table *, struct avl_node **, size_t);
+size_t avl_rank (const struct avl_table *, const void *, int);
+void *avl_select (const struct avl_table *, size_t);
+void *avl_t_select (struct avl_traverser *, struct avl_table *, size_t);
 void *avl_find (const struct avl_table *, const void *);
 void avl_assert_insert (struct avl_table *, void *);
 void *avl_assert_delete (struct avl_table *, void *);
@@ -105,11 +122,15 @@ void avl_t_init (struct avl_traverser *, struct avl_table *);
 void *avl_t_first (struct avl_traverser *, struct avl_table *);
 void *avl_t_last (struct avl_traverser *, struct avl_table *);
 void *avl_t_find (struct avl_traverser *, struct avl_table *, void *);
+void *avl_t_seek (struct avl_traverser *, struct avl_table *, const void *,
+                  int, int);
 void *avl_t_insert (struct avl_traverser *, struct avl_table *, void *);
 void *avl_t_copy (struct avl_traverser *, const struct avl_traverser *);
 void *avl_t_next (struct avl_traverser *);
 void *avl_t_prev (struct avl_traverser *);
 void *avl_t_cur (struct avl_traverser *);
 void *avl_t_replace (struct avl_traverser *, void *);
+struct avl_node *avl_t_unlink (struct avl_traverser *);
+void avl_t_refresh (struct avl_traverser *);
 
 #endif /* avl.h */
@@ -26,6 +26,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "avl.h"
 #include "test.h"
 
@@ -113,6 +114,78 @@ check_traverser (struct avl_traverser *trav, int i, int n, const char *label)
   return okay;
 }
 
+/* Checks that |avl_t_seek()| finds the nearest item in each direction,
+   with and without equality, for every value from |-1| to |n|,
+   and leaves the traverser usable from the item found.
+   There should be |n| items in |tree| numbered |0|@dots{}|n - 1|.
+   Returns nonzero only if no errors detected. */
+static int
+check_seek (struct avl_table *tree, int n)
+{
+  int okay = 1;
+  int i, dir, or_equal;
+
+  for (i = -1; i <= n; i++)
+    for (dir = 0; dir < 2; dir++)
+      for (or_equal = 0; or_equal < 2; or_equal++)
+        {
+          struct avl_traverser trav;
+          int expect = i + (or_equal ? 0 : dir ? 1 : -1);
+          int *found = avl_t_seek (&trav, tree, &i, dir, or_equal);
+
+          /* Values beyond either end are nearest to the end item. */
+          if (dir == 1 && expect < 0 && n > 0)
+            expect = 0;
+          else if (dir == 0 && expect >= n)
+            expect = n - 1;
+
+          if (expect < 0 || expect >= n)
+            {
+              if (found != NULL)
+                {
+                  printf ("   Seek from %d (dir=%d, or_equal=%d) found %d, "
+                          "but should have found nothing.\n",
+                          i, dir, or_equal, *found);
+                  okay = 0;
+                }
+            }
+          else if (found == NULL || *found != expect)
+            {
+              printf ("   Seek from %d (dir=%d, or_equal=%d) found %d, "
+                      "but should have found %d.\n",
+                      i, dir, or_equal, found != NULL ? *found : -1, expect);
+              okay = 0;
+            }
+          else
+            okay &= check_traverser (&trav, expect, n, "Seek");
+        }
+
+  return okay;
+}
+
+/* A node augmented with the sum of the data in its subtree. */
+struct sum_node
+  {
+    struct avl_node node;
+    long sum;
+  };
+
+/* Nonzero if the tree being verified has |struct sum_node|s. */
+static int augmented;
+
+/* Refreshes the subtree sum of |node| from its children. */
+static void
+update_sum (struct avl_node *node, void *param)
+{
+  struct sum_node *s = (struct sum_node *) node;
+  int i;
+
+  s->sum = *(int *) node->avl_data;
+  for (i = 0; i < 2; i++)
+    if (node->avl_link[i] != NULL)
+      s->sum += ((struct sum_node *) node->avl_link[i])->sum;
+}
+
 /* Compares binary trees rooted at |a| and |b|,
    making sure that they are identical. */
 static int
@@ -129,11 +202,13 @@ compare_trees (struct avl_node *a, struct avl_node *b)
   if (*(int *) a->avl_data != *(int *) b->avl_data
       || ((a->avl_link[0] != NULL) != (b->avl_link[0] != NULL))
       || ((a->avl_link[1] != NULL) != (b->avl_link[1] != NULL))
-      || a->avl_balance != b->avl_balance)
+      || a->avl_balance != b->avl_balance
+      || a->avl_size != b->avl_size)
     {
-      printf (" Copied nodes differ: a=%d (bal=%d) b=%d (bal=%d) a:",
-              *(int *) a->avl_data, a->avl_balance,
-              *(int *) b->avl_data, b->avl_balance);
+      printf (" Copied nodes differ: a=%d (bal=%d size=%u) "
+              "b=%d (bal=%d size=%u) a:",
+              *(int *) a->avl_data, a->avl_balance, a->avl_size,
+              *(int *) b->avl_data, b->avl_balance, b->avl_size);
 
       if (a->avl_link[0] != NULL)
         printf ("l");
@@ -168,16 +243,18 @@ compare_trees (struct avl_node *a, struct avl_node *b)
    but no greater than |max|. */
 static void
 recurse_verify_tree (struct avl_node *node, int *okay, size_t *count,
-                     int min, int max, int *height)
+                     int min, int max, int *height, long *sum)
 {
   int d;                /* Value of this node's data. */
   size_t subcount[2];   /* Number of nodes in subtrees. */
   int subheight[2];     /* Heights of subtrees. */
+  long subsum[2];       /* Sums of data in subtrees. */
 
   if (node == NULL)
     {
       *count = 0;
       *height = 0;
+      *sum = 0;
       return;
     }
   d = *(int *) node->avl_data;
@@ -196,12 +273,27 @@ recurse_verify_tree (struct avl_node *node, int *okay, size_t *count,
     }
 
   recurse_verify_tree (node->avl_link[0], okay, &subcount[0],
-                       min, d -  1, &subheight[0]);
+                       min, d -  1, &subheight[0], &subsum[0]);
   recurse_verify_tree (node->avl_link[1], okay, &subcount[1],
-                       d + 1, max, &subheight[1]);
+                       d + 1, max, &subheight[1], &subsum[1]);
   *count = 1 + subcount[0] + subcount[1];
+  *sum = d + subsum[0] + subsum[1];
   *height = 1 + (subheight[0] > subheight[1] ? subheight[0] : subheight[1]);
 
+  if (node->avl_size != *count)
+    {
+      printf (" Subtree size of node %d is %u, but should be %lu.\n",
+              d, node->avl_size, (unsigned long) *count);
+      *okay = 0;
+    }
+
+  if (augmented && ((struct sum_node *) node)->sum != *sum)
+    {
+      printf (" Subtree sum of node %d is %ld, but should be %ld.\n",
+              d, ((struct sum_node *) node)->sum, *sum);
+      *okay = 0;
+    }
+
   if (subheight[1] - subheight[0] != node->avl_balance)
     {
       printf (" Balance factor of node %d is %d, but should be %d.\n",
@@ -237,9 +329,11 @@ verify_tree (struct avl_table *tree, int array[], size_t n)
       /* Recursively verify tree structure. */
       size_t count;
       int height;
+      long sum;
 
+      augmented = tree->avl_update == update_sum;
       recurse_verify_tree (tree->avl_root, &okay, &count,
-                           0, INT_MAX, &height);
+                           0, INT_MAX, &height, &sum);
       if (count != n)
         {
           printf (" Tree has %lu nodes, but should have %lu.\n",
@@ -261,6 +355,54 @@ verify_tree (struct avl_table *tree, int array[], size_t n)
           }
     }
 
+  if (okay)
+    {
+      /* Check that |avl_select()| and |avl_rank()| agree with inorder. */
+      struct avl_traverser trav;
+      size_t i;
+      int *item;
+
+      for (i = 0, item = avl_t_first (&trav, tree); item != NULL;
+           i++, item = avl_t_next (&trav))
+        {
+          int *selected = avl_select (tree, i);
+          int *trav_selected;
+          struct avl_traverser select_trav;
+
+          if (selected != item)
+            {
+              printf (" Selecting position %lu found %d, but should "
+                      "find %d.\n", (unsigned long) i,
+                      selected != NULL ? *selected : -1, *item);
+              okay = 0;
+            }
+          trav_selected = avl_t_select (&select_trav, tree, i);
+          if (trav_selected != item || avl_t_next (&select_trav)
+              != (i + 1 < n ? avl_select (tree, i + 1) : NULL))
+            {
+              printf (" Traverser selecting position %lu is wrong.\n",
+                      (unsigned long) i);
+              okay = 0;
+            }
+          if (avl_rank (tree, item, 0) != i
+              || avl_rank (tree, item, 1) != i + 1)
+            {
+              printf (" Rank of %d is %lu/%lu, but should be %lu/%lu.\n",
+                      *item, (unsigned long) avl_rank (tree, item, 0),
+                      (unsigned long) avl_rank (tree, item, 1),
+                      (unsigned long) i, (unsigned long) i + 1);
+              okay = 0;
+            }
+        }
+
+      if (avl_select (tree, n) != NULL)
+        {
+          printf (" Selecting position %lu past the end found an item.\n",
+                  (unsigned long) n);
+          okay = 0;
+        }
+    }
+
   if (okay)
     {
       /* Check that |avl_t_first()| and |avl_t_next()| work properly. */
@@ -359,6 +501,62 @@ verify_tree (struct avl_table *tree, int array[], size_t n)
   return okay;
 }
 
+/* Checks |avl_t_unlink()| and |avl_t_refresh()| on each item of |tree|,
+   which must hold the items |array[0]|@dots{}|array[n - 1]|
+   with |array[i] == i|.
+   Each item is changed so that it is out of order before being unlinked,
+   then restored and linked back in using the same node.
+   Returns nonzero only if no errors detected. */
+static int
+check_unlink (struct avl_table *tree, int array[], int n)
+{
+  int okay = 1;
+  int i, j;
+
+  for (i = 0; i < n; i++)
+    {
+      struct avl_traverser trav;
+      struct avl_node *node;
+
+      if (avl_t_find (&trav, tree, &i) != &array[i])
+        {
+          printf ("   Can't find item %d to unlink.\n", i);
+          return 0;
+        }
+
+      /* Spoil the sums along the path, which a refresh must fix. */
+      if (augmented)
+        {
+          ((struct sum_node *) trav.avl_node)->sum++;
+          for (j = 0; j < trav.avl_height; j++)
+            ((struct sum_node *) trav.avl_stack[j])->sum++;
+        }
+      avl_t_refresh (&trav);
+
+      array[i] = -1 - i;
+      node = avl_t_unlink (&trav);
+      array[i] = i;
+      if (node == NULL || node->avl_data != &array[i])
+        {
+          printf ("   Unlinking item %d returned the wrong node.\n", i);
+          return 0;
+        }
+      if (avl_count (tree) != (size_t) n - 1 || avl_find (tree, &i) != NULL)
+        {
+          printf ("   Item %d still in tree after unlinking.\n", i);
+          okay = 0;
+        }
+
+      if (avl_probe_node (tree, &array[i], node) != &node->avl_data)
+        {
+          printf ("   Relinking item %d failed.\n", i);
+          return 0;
+        }
+    }
+
+  return okay;
+}
+
 /* Tests tree functions.
    |insert[]| and |delete[]| must contain some permutation of values
    |0|@dots{}|n - 1|.
@@ -381,6 +579,10 @@ test_correctness (struct libavl_allocator *allocator,
       return 1;
     }
 
+  /* Keep subtree sums to test augmented nodes. */
+  tree->avl_update = update_sum;
+  tree->avl_node_size = sizeof (struct sum_node);
+
   for (i = 0; i < n; i++)
     {
       if (verbosity >= 2)
@@ -509,8 +711,57 @@ test_correctness (struct libavl_allocator *allocator,
       okay = 0;
     }
 
-  /* Test destroying the tree. */
-  avl_destroy (tree, NULL);
+  /* Test building a tree from nodes in order. */
+  {
+    struct avl_node **nodes = malloc (sizeof *nodes * (n + 1));
+    int *sorted = malloc (sizeof *sorted * (n + 1));
+
+    if (verbosity >= 2)
+      printf ("  Building tree from sorted nodes...\n");
+
+    for (i = 0; nodes != NULL && sorted != NULL && i < n; i++)
+      {
+        sorted[i] = i;
+        nodes[i] = tree->avl_alloc->libavl_malloc (tree->avl_alloc,
+                                                   tree->avl_node_size);
+        if (nodes[i] == NULL)
+          break;
+        nodes[i]->avl_data = &sorted[i];
+      }
+
+    if (nodes == NULL || sorted == NULL || i < n)
+      {
+        if (verbosity >= 0)
+          printf ("    Out of memory building tree.\n");
+        while (nodes != NULL && i-- > 0)
+          tree->avl_alloc->libavl_free (tree->avl_alloc, nodes[i]);
+        free (nodes);
+        free (sorted);
+        avl_destroy (tree, NULL);
+        return 1;
+      }
+
+    avl_build (tree, nodes, n);
+    free (nodes);
+
+    if (verbosity >= 3)
+      print_whole_tree (tree, "    Afterward");
+
+    okay &= verify_tree (tree, insert, n);
+
+    if (verbosity >= 2)
+      printf ("  Seeking in built tree...\n");
+    okay &= check_seek (tree, n);
+
+    if (verbosity >= 2)
+      printf ("  Unlinking from built tree...\n");
+    okay &= check_unlink (tree, sorted, n);
+    okay &= verify_tree (tree, insert, n);
+
+    /* Test destroying the tree. */
+    avl_destroy (tree, NULL);
+    free (sorted);
+  }
 
   return okay;
 }
@@ -22,9 +22,22 @@
  * This is the implementation for the multi-key AVL interface.
  */
 
+/* For the writer preference kind of pthread rwlock */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "mkavl.h"
+#include "mkavl_workers.h"
+#include "mkavl_mapped.h"
+#include "mkavl_wal.h"
+#include "mkavl_hist.h"
 #include "libavl/avl.h"
 #include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 /**
  * Compile time assert macro from:
@@ -41,11 +54,6 @@
 #define NELEMS(x) (sizeof(x) / sizeof(x[0]))
 #endif
 
-/**
- * Sanity value to make sure we don't get stuck in an infinite loop.
- */
-#define MKAVL_RUNAWAY_SANITY 100000
-
 /**
  * Magic number indicating a pointer is valid for sanity checks.
  */
@@ -56,6 +64,110 @@
  */
 #define MKAVL_CTX_STALE 0xDEADBEEF
 
+/**
+ * The size of the slabs from which a node pool carves its objects.
+ */
+#define MKAVL_POOL_SLAB_SIZE (64 * 1024)
+
+/**
+ * The minimum number of objects held by each slab of a node pool.
+ */
+#define MKAVL_POOL_SLAB_MIN_OBJS 16
+
+/**
+ * The alignment of objects carved from a slab.
+ */
+#define MKAVL_POOL_ALIGN (2 * sizeof(void *))
+
+/**
+ * The size of a cache line, used to keep data written by different threads
+ * apart.
+ */
+#define MKAVL_CACHE_LINE_SIZE 64
+
+/**
+ * The number of reader slots of a tree with lockless reads.  Threads are spread
+ * over the slots so that readers seldom write the same cache line.
+ */
+#define MKAVL_EPOCH_SLOT_CNT 64
+
+/**
+ * The number of times a lockless read is tried before giving up and taking
+ * the lock of the tree.
+ */
+#define MKAVL_LOCKLESS_TRY_CNT 8
+
+/**
+ * The number of times a lockless read checks the sequence count while a
+ * writer is changing the tree before the attempt is counted as failed.  A
+ * writer only holds the count odd while it changes the AVL trees, so a reader
+ * waiting this long seldom has to take the lock.
+ */
+#define MKAVL_LOCKLESS_SPIN_CNT 1024
+
+/**
+ * The number of stripes of the counters of a tree that keeps stats and may be
+ * used by several threads at once.
+ */
+#define MKAVL_STATS_STRIPE_CNT 16
+
+#ifdef MKAVL_HISTOGRAMS
+/**
+ * Declare and set the tick at which a call whose latency is recorded starts.
+ * This goes last among the declarations of the call.
+ */
+#define MKAVL_LATENCY_START(start) uint64_t start = mkavl_hist_ticks()
+
+/**
+ * Record the latency of a call from the tick at which it started.
+ */
+#define MKAVL_LATENCY_END(op, start) \
+    mkavl_latency_record((op), (mkavl_hist_ticks() - (start)))
+#else
+#define MKAVL_LATENCY_START(start)
+#define MKAVL_LATENCY_END(op, start)
+#endif
+
+/**
+ * The counters kept for the whole of a tree with stats.
+ *
+ * @see mkavl_stats_st
+ */
+typedef enum mkavl_stat_e_ {
+    /** Items added */
+    MKAVL_STAT_E_ADD,
+    /** Items removed */
+    MKAVL_STAT_E_REMOVE,
+    /** Finds, one counter per find type starting here */
+    MKAVL_STAT_E_FIND,
+    /** Calls to the client allocator */
+    MKAVL_STAT_E_ALLOC = (MKAVL_STAT_E_FIND + MKAVL_FIND_TYPE_E_MAX),
+    /** Bytes asked of the client allocator */
+    MKAVL_STAT_E_ALLOC_BYTES,
+    /** Calls to the client free function */
+    MKAVL_STAT_E_FREE,
+    /** Max value for bounds testing */
+    MKAVL_STAT_E_MAX,
+} mkavl_stat_e;
+
+/**
+ * The counters kept for each key of a tree with stats.
+ *
+ * @see mkavl_key_stats_st
+ */
+typedef enum mkavl_key_stat_e_ {
+    /** Calls to the comparison function */
+    MKAVL_KEY_STAT_E_CMP,
+    /** Finds */
+    MKAVL_KEY_STAT_E_FIND,
+    /** Nodes compared against by finds */
+    MKAVL_KEY_STAT_E_FIND_VISIT,
+    /** Descents of iterators whose place was lost to a change */
+    MKAVL_KEY_STAT_E_ITER_REFRESH,
+    /** Max value for bounds testing */
+    MKAVL_KEY_STAT_E_MAX,
+} mkavl_key_stat_e;
+
 /**
  * The internal context data for AVL callbacks.
  */
@@ -68,6 +180,116 @@ typedef struct mkavl_avl_ctx_st_ {
     size_t key_idx;
 } mkavl_avl_ctx_st;
 
+/**
+ * The header of a slab allocated for a node pool.  The objects of the pool are
+ * carved out of the memory following the header.
+ */
+typedef struct mkavl_slab_st_ {
+    /** The next slab owned by the pool */
+    struct mkavl_slab_st_ *next;
+} mkavl_slab_st;
+
+/**
+ * A pool of fixed size objects carved out of large slabs.  When the tree uses
+ * pooled nodes, every AVL node (or node block for intrusive nodes) comes from a
+ * pool owned by the tree.  Freed objects go on the free list of the pool and
+ * the slabs are only returned to the client allocator when the tree is
+ * deleted.
+ *
+ * @see mkavl_opts_st
+ */
+typedef struct mkavl_node_pool_st_ {
+    /**
+     * The libavl allocator.  Must be the first member for use in casting.
+     */
+    struct libavl_allocator avl_allocator;
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The tree owning the pool */
+    mkavl_tree_handle tree_h;
+    /** The size of each object in the pool */
+    size_t obj_size;
+    /** The size of each slab in the pool */
+    size_t slab_size;
+    /** The list of slabs owned by the pool */
+    mkavl_slab_st *slab_list;
+    /** The next unused object in the most recent slab */
+    char *slab_cur;
+    /** The end of the most recent slab */
+    char *slab_end;
+    /** The list of freed objects, linked through their first word */
+    void *free_list;
+} mkavl_node_pool_st;
+
+/**
+ * The readers of a tree with lockless reads that share a slot.  Each counts the
+ * readers that entered in an even or odd epoch.
+ */
+typedef struct mkavl_epoch_slot_st_ {
+    /** The number of readers inside for each parity of epoch */
+    uint64_t active[2];
+    /** Keeps each slot in its own cache line */
+    char pad[MKAVL_CACHE_LINE_SIZE - (2 * sizeof(uint64_t))];
+} mkavl_epoch_slot_st;
+
+/**
+ * What a reader needs to leave the epoch it entered.
+ */
+typedef struct mkavl_epoch_guard_st_ {
+    /** The slot in which the reader is counted */
+    mkavl_epoch_slot_st *slot;
+    /** The parity of the epoch in which the reader entered */
+    uint32_t parity;
+} mkavl_epoch_guard_st;
+
+/**
+ * An item given to mkavl_retire() that lockless readers may still be using.
+ */
+typedef struct mkavl_retired_st_ {
+    /** The item */
+    void *item;
+    /** The function to apply to the item once no reader can see it */
+    mkavl_item_fn item_fn;
+    /** The epoch in which the item was retired */
+    uint64_t epoch;
+    /** The next item retired, in the order of retirement */
+    struct mkavl_retired_st_ *next;
+} mkavl_retired_st;
+
+/**
+ * The state for lockless reads of a tree.
+ *
+ * Writers make the sequence count odd for the length of each change.  A reader
+ * notes the count before it starts and checks it is unchanged before it uses
+ * anything read from the tree, so only items from a consistent tree reach the
+ * comparison functions.  Nodes always come from pools whose memory stays with
+ * the tree, so a reader that strays onto a node freed under it reads garbage
+ * rather than faulting and then retries.
+ *
+ * Items are the client's memory, so readers also count themselves in the
+ * current epoch.  A retired item is held until the epoch has advanced twice,
+ * and each advance waits for the readers of the other parity to leave, so no
+ * reader that could have seen the item remains.
+ *
+ * @see mkavl_retire
+ */
+typedef struct mkavl_lockless_st_ {
+    /** Odd while a writer is changing the tree */
+    uint32_t seq;
+    /** Keeps the sequence count in its own cache line */
+    char seq_pad[MKAVL_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    /** The current epoch, only changed with the lock held */
+    uint64_t epoch;
+    /** Keeps the epoch in its own cache line */
+    char epoch_pad[MKAVL_CACHE_LINE_SIZE - sizeof(uint64_t)];
+    /** The reader slots */
+    mkavl_epoch_slot_st slot_array[MKAVL_EPOCH_SLOT_CNT];
+    /** The oldest item retired but not yet released */
+    mkavl_retired_st *retired_head;
+    /** The newest item retired but not yet released */
+    mkavl_retired_st *retired_tail;
+} mkavl_lockless_st;
+
 /**
  * Maintains info on the AVL data associated with an AVL tree in the mkavl tree.
  */
@@ -78,8 +300,30 @@ typedef struct mkavl_avl_tree_st_ {
     mkavl_compare_fn compare_fn;
     /** The context used for the AVL tree */
     mkavl_avl_ctx_st *avl_ctx;
+    /** The pool for the nodes of the AVL tree if nodes are pooled */
+    mkavl_node_pool_st node_pool;
+    /** The number of iterators outstanding on the AVL tree */
+    uint32_t iter_count;
 } mkavl_avl_tree_st;
 
+/**
+ * The storage for the AVL nodes of a single item when the tree uses intrusive
+ * nodes.  One block is allocated per item and holds the node for every key
+ * index, so adding an item costs one allocation regardless of the key count.
+ *
+ * @see mkavl_opts_st
+ */
+typedef struct mkavl_node_block_st_ {
+    /** The number of AVL trees in which the nodes of the block are linked */
+    uint32_t link_count;
+    /**
+     * The AVL node for each key index, avl_tree_count in size.  The nodes are
+     * node_size bytes apart to leave room for aggregates, so they must be
+     * reached with mkavl_node_block_node().
+     */
+    struct avl_node node_array[];
+} mkavl_node_block_st;
+
 /**
  * A wrapper structure to map the mkavl_allocator to the avl_allocator.
  */
@@ -96,6 +340,19 @@ typedef struct mkavl_allocator_wrapper_st_ {
     mkavl_tree_handle tree_h;
 } mkavl_allocator_wrapper_st;
 
+/**
+ * The header in front of the memory libavl allocates for a tree that tracks
+ * memory, so that the size of the memory is known when it is freed.
+ *
+ * @see mkavl_opts_st
+ */
+typedef union mkavl_mem_hdr_st_ {
+    /** The size of the allocation, header included */
+    size_t size;
+    /** Keeps the memory following the header aligned for any use */
+    max_align_t align;
+} mkavl_mem_hdr_st;
+
 /**
  * The internal representation of the mkavl tree object.
  */
@@ -104,6 +361,11 @@ typedef struct mkavl_tree_st_ {
     void *context;
     /** The memory allocator info passed in by the client */
     mkavl_allocator_wrapper_st allocator;
+    /**
+     * The client allocator as used for the AVL nodes of a persistent tree,
+     * which sets the link count of each new node.
+     */
+    mkavl_allocator_wrapper_st node_allocator;
     /** The number of AVL trees within this object */
     size_t avl_tree_count;
     /** An array of the AVL tree info of size avl_tree_count */
@@ -114,11 +376,45 @@ typedef struct mkavl_tree_st_ {
      * have been inserted in the mkavl, then this value is 5, not 15.
      */
     uint32_t item_count;
-    /** 
-     * The copy function passed in my the client to apply to items when
-     * mkavl_copy is done.
+    /** The options given when the tree was created */
+    mkavl_opts_st opts;
+    /**
+     * The tree's copy of the aggregates given in the options, or NULL if no
+     * key has an aggregate.
      */
-    mkavl_copy_fn copy_fn;
+    mkavl_aggregate_st *aggregate_array;
+    /**
+     * The size of the nodes of a node block.  This leaves room after each
+     * AVL node for the aggregate of its subtree if any key has an aggregate.
+     */
+    size_t node_size;
+    /** The pool for node blocks if nodes are both intrusive and pooled */
+    mkavl_node_pool_st block_pool;
+    /** The lock for the tree if it is thread safe */
+    pthread_rwlock_t rwlock;
+    /** The state for lockless reads, or NULL if reads take the lock */
+    mkavl_lockless_st *lockless;
+    /** Whether the tree is a snapshot, which may not be changed */
+    bool read_only;
+    /** The log of the changes to the tree, or NULL if they are not logged */
+    mkavl_wal_handle wal;
+    /**
+     * The counters of the tree, or NULL if it keeps no stats.  These are
+     * stats_stripe_cnt stripes of stats_stripe_len counters each, the
+     * mkavl_stat_e counters followed by the mkavl_key_stat_e counters of
+     * each key.  The count is the sum over the stripes.
+     */
+    uint64_t *stats;
+    /** The number of counters in a stripe, padded to whole cache lines */
+    size_t stats_stripe_len;
+    /** The number of stripes, 1 unless threads may count at once */
+    uint32_t stats_stripe_cnt;
+    /** The number of node blocks allocated if nodes are intrusive */
+    size_t block_count;
+    /** The bytes held from the client allocator if the tree tracks memory */
+    uint64_t mem_live;
+    /** The most that mem_live has been */
+    uint64_t mem_high_water;
 } mkavl_tree_st;
 
 /**
@@ -131,6 +427,14 @@ typedef struct mkavl_iterator_st_ {
     mkavl_tree_handle tree_h;
     /** The index in the mkavl tree of the AVL tree for the iteration */
     size_t key_idx;
+    /**
+     * The current item.  With lockless reads avl_t is unused, and otherwise
+     * the iterator finds its place again from the item if the tree changed
+     * between calls.
+     */
+    void *cur_item;
+    /** With lockless reads, the epoch held while the iterator exists */
+    mkavl_epoch_guard_st epoch_guard;
 } mkavl_iterator_st;
 
 /**
@@ -148,6 +452,259 @@ mkavl_assert_abort (bool condition)
     }
 }
 
+/** The stripe of the counters of trees in which the calling thread counts */
+static __thread uint32_t mkavl_stats_thread_stripe = UINT32_MAX;
+
+/** The stripe to assign to the next thread that counts */
+static uint32_t mkavl_stats_next_stripe;
+
+/**
+ * The comparisons made by the calling thread in trees with stats or while
+ * tracing, from which a call gets the number of nodes it visited.
+ */
+static __thread uint64_t mkavl_thread_cmp_cnt;
+
+/**
+ * Add to a counter of a tree if the tree keeps stats.  With more than one
+ * stripe, the count goes to the stripe of the calling thread.
+ *
+ * @param tree_h The tree.
+ * @param stat The index of the counter within a stripe.
+ * @param val The amount to add.
+ */
+static inline void
+mkavl_stats_add (mkavl_tree_handle tree_h, size_t stat, uint64_t val)
+{
+    uint64_t *counter;
+
+    if (NULL == tree_h->stats) {
+        return;
+    }
+
+    if (1 == tree_h->stats_stripe_cnt) {
+        tree_h->stats[stat] += val;
+        return;
+    }
+
+    if (UINT32_MAX == mkavl_stats_thread_stripe) {
+        mkavl_stats_thread_stripe =
+            (__atomic_fetch_add(&mkavl_stats_next_stripe, 1, __ATOMIC_RELAXED) %
+             MKAVL_STATS_STRIPE_CNT);
+    }
+
+    counter = &(tree_h->stats[(mkavl_stats_thread_stripe *
+                               tree_h->stats_stripe_len) + stat]);
+    __atomic_fetch_add(counter, val, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add to a counter of a key of a tree if the tree keeps stats.
+ *
+ * @param tree_h The tree.
+ * @param key_idx The key.
+ * @param stat The counter of the key.
+ * @param val The amount to add.
+ */
+static inline void
+mkavl_key_stats_add (mkavl_tree_handle tree_h, size_t key_idx,
+                     mkavl_key_stat_e stat, uint64_t val)
+{
+    mkavl_stats_add(tree_h, (MKAVL_STAT_E_MAX +
+                             (key_idx * MKAVL_KEY_STAT_E_MAX) + stat), val);
+}
+
+/** The hook given trace events, or NULL if there is none */
+static const mkavl_trace_hook_st *mkavl_trace_hook;
+
+/**
+ * Get the trace hook if there is one that wants an event.  With no hook this
+ * is a load and a branch.
+ *
+ * @param event The event.
+ * @return The hook, or NULL if the event is not traced.
+ */
+static inline const mkavl_trace_hook_st *
+mkavl_trace_hook_get (mkavl_trace_event_e event)
+{
+    const mkavl_trace_hook_st *hook;
+
+    hook = __atomic_load_n(&mkavl_trace_hook, __ATOMIC_ACQUIRE);
+    if ((NULL == hook) || (0 == (hook->event_mask & (1U << event)))) {
+        return (NULL);
+    }
+
+    return (hook);
+}
+
+/**
+ * Trace the entry or exit of a call.
+ *
+ * @param event The event.
+ * @param tree_h The tree.
+ * @param key_idx The key, or MKAVL_TRACE_ALL_KEYS.
+ * @param type The find type of a find, or MKAVL_FIND_TYPE_E_INVALID.
+ * @param item The item of the call.
+ * @param cmp_cnt The comparisons made by the calling thread when the call was
+ * entered, from which the depth is found.
+ * @param rc The return code of an exit, or MKAVL_RC_E_INVALID.
+ */
+static inline void
+mkavl_trace_call (mkavl_trace_event_e event, mkavl_tree_handle tree_h,
+                  size_t key_idx, mkavl_find_type_e type, const void *item,
+                  uint64_t cmp_cnt, mkavl_rc_e rc)
+{
+    const mkavl_trace_hook_st *hook = mkavl_trace_hook_get(event);
+    mkavl_trace_st trace;
+
+    if (NULL == hook) {
+        return;
+    }
+
+    memset(&trace, 0, sizeof(trace));
+    trace.event = event;
+    trace.tree_h = tree_h;
+    trace.key_idx = key_idx;
+    trace.type = type;
+    trace.item = item;
+    trace.depth = (mkavl_thread_cmp_cnt - cmp_cnt);
+    trace.rc = rc;
+    hook->trace_fn(&trace, hook->context);
+}
+
+/**
+ * Trace the rotations done to an AVL tree by a change, if any.
+ *
+ * @param tree_h The tree.
+ * @param key_idx The key of the AVL tree.
+ * @param rotation_cnt The rotations of the AVL tree before the change.
+ */
+static inline void
+mkavl_trace_rebalance (mkavl_tree_handle tree_h, size_t key_idx,
+                       unsigned long rotation_cnt)
+{
+    const mkavl_trace_hook_st *hook;
+    mkavl_trace_st trace;
+
+    hook = mkavl_trace_hook_get(MKAVL_TRACE_EVENT_E_REBALANCE);
+    if ((NULL == hook) ||
+        (rotation_cnt == tree_h->avl_tree_array[key_idx].tree->avl_rotations)) {
+        return;
+    }
+
+    memset(&trace, 0, sizeof(trace));
+    trace.event = MKAVL_TRACE_EVENT_E_REBALANCE;
+    trace.tree_h = tree_h;
+    trace.key_idx = key_idx;
+    trace.depth = (tree_h->avl_tree_array[key_idx].tree->avl_rotations -
+                   rotation_cnt);
+    hook->trace_fn(&trace, hook->context);
+}
+
+/**
+ * Count bytes taken from the client allocator by a tree that tracks memory,
+ * raising its high-water mark if need be.
+ *
+ * @param tree_h The tree.
+ * @param size The bytes allocated.
+ */
+static inline void
+mkavl_mem_add (mkavl_tree_handle tree_h, uint64_t size)
+{
+    uint64_t live, high_water;
+
+    if (!tree_h->opts.track_memory) {
+        return;
+    }
+
+    live = __atomic_add_fetch(&(tree_h->mem_live), size, __ATOMIC_RELAXED);
+    high_water = __atomic_load_n(&(tree_h->mem_high_water), __ATOMIC_RELAXED);
+    while ((live > high_water) &&
+           !__atomic_compare_exchange_n(&(tree_h->mem_high_water),
+                                        &high_water, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * Count bytes given back to the client allocator by a tree that tracks
+ * memory.
+ *
+ * @param tree_h The tree.
+ * @param size The bytes freed.
+ */
+static inline void
+mkavl_mem_sub (mkavl_tree_handle tree_h, uint64_t size)
+{
+    if (!tree_h->opts.track_memory) {
+        return;
+    }
+
+    __atomic_sub_fetch(&(tree_h->mem_live), size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count and trace a call to the client allocator for the nodes of a tree.
+ *
+ * @param tree_h The tree.
+ * @param ptr The memory allocated, or NULL if the allocation failed.
+ * @param size The size asked for.
+ */
+static inline void
+mkavl_note_alloc (mkavl_tree_handle tree_h, const void *ptr, size_t size)
+{
+    const mkavl_trace_hook_st *hook;
+    mkavl_trace_st trace;
+
+    mkavl_stats_add(tree_h, MKAVL_STAT_E_ALLOC, 1);
+    mkavl_stats_add(tree_h, MKAVL_STAT_E_ALLOC_BYTES, size);
+    if (NULL != ptr) {
+        mkavl_mem_add(tree_h, size);
+    }
+
+    hook = mkavl_trace_hook_get(MKAVL_TRACE_EVENT_E_ALLOC);
+    if (NULL == hook) {
+        return;
+    }
+
+    memset(&trace, 0, sizeof(trace));
+    trace.event = MKAVL_TRACE_EVENT_E_ALLOC;
+    trace.tree_h = tree_h;
+    trace.key_idx = MKAVL_TRACE_ALL_KEYS;
+    trace.item = ptr;
+    trace.size = size;
+    hook->trace_fn(&trace, hook->context);
+}
+
+/**
+ * Count and trace a call to the client free function for the nodes of a tree.
+ *
+ * @param tree_h The tree.
+ * @param ptr The memory about to be freed.
+ * @param size The size of the memory, or 0 if it is not known.
+ */
+static inline void
+mkavl_note_free (mkavl_tree_handle tree_h, const void *ptr, size_t size)
+{
+    const mkavl_trace_hook_st *hook;
+    mkavl_trace_st trace;
+
+    mkavl_stats_add(tree_h, MKAVL_STAT_E_FREE, 1);
+    mkavl_mem_sub(tree_h, size);
+
+    hook = mkavl_trace_hook_get(MKAVL_TRACE_EVENT_E_FREE);
+    if (NULL == hook) {
+        return;
+    }
+
+    memset(&trace, 0, sizeof(trace));
+    trace.event = MKAVL_TRACE_EVENT_E_FREE;
+    trace.tree_h = tree_h;
+    trace.key_idx = MKAVL_TRACE_ALL_KEYS;
+    trace.item = ptr;
+    trace.size = size;
+    hook->trace_fn(&trace, hook->context);
+}
+
 /**
  * String representations of the return codes.
  *
@@ -159,6 +716,7 @@ static const char * const mkavl_rc_e_string[] = {
     "Invalid input",
     "No memory",
     "Out of sync",
+    "I/O error",
     "Max RC"
 };
 
@@ -222,6 +780,40 @@ mkavl_rc_e_get_string (mkavl_rc_e rc)
     return (retval);
 }
 
+/** The CRC-32 of each value of four bits, for mkavl_crc32() */
+static const uint32_t mkavl_crc32_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+/**
+ * Compute the CRC-32 of some bytes, the same as zlib's crc32() using the
+ * reflected IEEE 802.3 polynomial.
+ *
+ * @param crc Zero to start a new CRC-32, or the CRC-32 of the bytes before buf
+ * to continue it.
+ * @param buf The bytes.
+ * @param len The number of bytes.
+ * @return The CRC-32 of the bytes so far.
+ */
+uint32_t
+mkavl_crc32 (uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *bytes = buf;
+    size_t i;
+
+    crc = ~crc;
+    for (i = 0; i < len; ++i) {
+        crc ^= bytes[i];
+        crc = (mkavl_crc32_table[crc & 0xF] ^ (crc >> 4));
+        crc = (mkavl_crc32_table[crc & 0xF] ^ (crc >> 4));
+    }
+
+    return (~crc);
+}
+
 /**
  * String representations of the return codes.
  *
@@ -240,6 +832,9 @@ static const char * const mkavl_find_type_e_string[] = {
 /** @cond doxygen_suppress */
 /* Ensure there is a string for each enum declared */
 CT_ASSERT(NELEMS(mkavl_find_type_e_string) == (MKAVL_FIND_TYPE_E_MAX + 1));
+/* Ensure the latency of each find type can be found from the type */
+CT_ASSERT((MKAVL_LATENCY_OP_E_FIND_LE - MKAVL_LATENCY_OP_E_FIND_EQUAL) ==
+          (MKAVL_FIND_TYPE_E_LE - MKAVL_FIND_TYPE_E_EQUAL));
 /** @endcond */
 
 /**
@@ -340,6 +935,8 @@ mkavl_allocator_wrapper_is_valid (mkavl_allocator_wrapper_st *allocator)
 
 /**
  * A wrapper to map the AVL callback to the client callback for the mkavl tree.
+ * If the tree tracks memory, the memory is preceded by a header holding its
+ * size.
  *
  * @param allocator The memory allocator associated with the callback
  * @param size The size to allocate
@@ -350,11 +947,30 @@ mkavl_malloc_wrapper (struct libavl_allocator *allocator, size_t size)
 {
     mkavl_allocator_wrapper_st *mkavl_allocator =
         (mkavl_allocator_wrapper_st *) allocator;
+    mkavl_tree_handle tree_h;
+    mkavl_mem_hdr_st *hdr;
+    void *ptr;
 
     mkavl_assert_abort(mkavl_allocator_wrapper_is_valid(mkavl_allocator));
+    tree_h = mkavl_allocator->tree_h;
+
+    if (!tree_h->opts.track_memory) {
+        ptr = mkavl_allocator->mkavl_allocator.malloc_fn(size,
+                                                         tree_h->context);
+        mkavl_note_alloc(tree_h, ptr, size);
+
+        return (ptr);
+    }
 
-    return (mkavl_allocator->mkavl_allocator.malloc_fn(size,
-                mkavl_allocator->tree_h->context));
+    size += sizeof(*hdr);
+    hdr = mkavl_allocator->mkavl_allocator.malloc_fn(size, tree_h->context);
+    mkavl_note_alloc(tree_h, hdr, size);
+    if (NULL == hdr) {
+        return (NULL);
+    }
+    hdr->size = size;
+
+    return (hdr + 1);
 }
 
 /**
@@ -368,11 +984,23 @@ mkavl_free_wrapper (struct libavl_allocator *allocator, void *libavl_block)
 {
     mkavl_allocator_wrapper_st *mkavl_allocator =
         (mkavl_allocator_wrapper_st *) allocator;
+    mkavl_tree_handle tree_h;
+    mkavl_mem_hdr_st *hdr;
 
     mkavl_assert_abort(mkavl_allocator_wrapper_is_valid(mkavl_allocator));
+    tree_h = mkavl_allocator->tree_h;
+
+    if (!tree_h->opts.track_memory) {
+        mkavl_note_free(tree_h, libavl_block, 0);
 
-    return (mkavl_allocator->mkavl_allocator.free_fn(libavl_block,
-                mkavl_allocator->tree_h->context));
+        return (mkavl_allocator->mkavl_allocator.free_fn(libavl_block,
+                    tree_h->context));
+    }
+
+    hdr = ((mkavl_mem_hdr_st *) libavl_block) - 1;
+    mkavl_note_free(tree_h, hdr, hdr->size);
+
+    return (mkavl_allocator->mkavl_allocator.free_fn(hdr, tree_h->context));
 }
 
 /**
@@ -417,62 +1045,621 @@ static struct libavl_allocator mkavl_allocator_wrapper = {
 };
 
 /**
- * A wrapper to map the AVL callback to the client callback for the mkavl tree.
+ * Get the count of the links to a node of a persistent tree, which is kept at
+ * the end of the node.
  *
- * @param avl_a The first item in the comparison
- * @param avl_b The second item in the comparison
- * @param avl_param The context associated with the callback
- * @return 0 if equal, -1 if avl_a < avl_b, and 1 if avl_a > avl_b
+ * @param avl_tree The AVL tree of the node.
+ * @param node The AVL node.
+ * @return A pointer to the link count of the node.
  */
-static int
-mkavl_compare_wrapper (const void *avl_a, const void *avl_b, void *avl_param)
+static inline uint32_t *
+mkavl_node_refs (const struct avl_table *avl_tree, struct avl_node *node)
 {
-    mkavl_avl_ctx_st *avl_ctx;
-    mkavl_compare_fn cmp_fn;
-
-    avl_ctx = (mkavl_avl_ctx_st *) avl_param;
-    mkavl_assert_abort(mkavl_avl_ctx_is_valid(avl_ctx));
-
-    cmp_fn = avl_ctx->tree_h->avl_tree_array[avl_ctx->key_idx].compare_fn;
-    mkavl_assert_abort(NULL != cmp_fn);
-
-    return (cmp_fn(avl_a, avl_b, avl_ctx->tree_h->context));
+    return ((uint32_t *) ((char *) node + avl_tree->avl_node_size -
+                          sizeof(uint32_t)));
 }
 
 /**
- * A wrapper to map the AVL callback to the client callback for the mkavl tree.
+ * A wrapper to map the AVL callback to the client callback for the nodes of a
+ * persistent tree.  The new node starts with a single link, the one its
+ * caller is about to make.
  *
- * @param avl_item The AVL item to copy
- * @param avl_param The context associated with the callback
- * @return The new, copied item
+ * @param allocator The memory allocator associated with the callback
+ * @param size The size to allocate
+ * @return A pointer to the new memory, or NULL on failure.
  */
 static void *
-mkavl_copy_wrapper (void *avl_item, void *avl_param)
+mkavl_node_malloc_wrapper (struct libavl_allocator *allocator, size_t size)
 {
-    mkavl_avl_ctx_st *avl_ctx;
-    mkavl_copy_fn copy_fn;
-
-    avl_ctx = (mkavl_avl_ctx_st *) avl_param;
-    mkavl_assert_abort(mkavl_avl_ctx_is_valid(avl_ctx));
+    void *node;
 
-    copy_fn = avl_ctx->tree_h->copy_fn;
-    mkavl_assert_abort(NULL != copy_fn);
+    node = mkavl_malloc_wrapper(allocator, size);
+    if (NULL != node) {
+        *((uint32_t *) ((char *) node + size - sizeof(uint32_t))) = 1;
+    }
 
-    return (copy_fn(avl_item, avl_ctx->tree_h->context));
+    return (node);
 }
 
 /**
- * This will free all memory associated with the tree and set the pointer to
- * NULL.
+ * Wrapper to convert AVL callback to client callback for the nodes of a
+ * persistent tree.
+ */
+static struct libavl_allocator mkavl_node_allocator_wrapper = {
+    mkavl_node_malloc_wrapper,
+    mkavl_free_wrapper
+};
+
+/**
+ * Drop a link to a node of a persistent tree.  Once nothing links to the node
+ * it is freed, dropping its links to its children in turn.
  *
- * @param tree_h Pointer to the tree to delete
- * @return The return code
+ * @param avl_tree The AVL tree that linked to the node.
+ * @param node The node, which may be NULL.
  */
-static mkavl_rc_e
-mkavl_delete_tree (mkavl_tree_handle *tree_h)
+static void
+mkavl_node_release (struct avl_table *avl_tree, struct avl_node *node)
 {
-    mkavl_allocator_st local_allocator;
-    mkavl_tree_handle local_tree_h;
+    struct avl_node *next;
+
+    /* Recurse on the left only so the depth is bounded by the height */
+    for (; NULL != node; node = next) {
+        if (0 != __atomic_sub_fetch(mkavl_node_refs(avl_tree, node), 1,
+                                    __ATOMIC_ACQ_REL)) {
+            return;
+        }
+        mkavl_node_release(avl_tree, node->avl_link[0]);
+        next = node->avl_link[1];
+        avl_tree->avl_alloc->libavl_free(avl_tree->avl_alloc, node);
+    }
+}
+
+/**
+ * Get an object from a node pool, allocating a new slab if needed.
+ *
+ * @param pool The pool from which to allocate.
+ * @return A pointer to the object or NULL if a slab could not be allocated.
+ */
+static void *
+mkavl_pool_alloc (mkavl_node_pool_st *pool)
+{
+    mkavl_slab_st *slab;
+    size_t hdr_size;
+    void *obj;
+
+    if (NULL != pool->free_list) {
+        obj = pool->free_list;
+        pool->free_list = *((void **) obj);
+        return (obj);
+    }
+
+    /* The pointers are NULL until the first slab, so compare the bytes left */
+    if ((NULL == pool->slab_cur) ||
+        ((size_t) (pool->slab_end - pool->slab_cur) < pool->obj_size)) {
+        slab = pool->tree_h->allocator.mkavl_allocator.malloc_fn(
+                   pool->slab_size, pool->tree_h->context);
+        mkavl_note_alloc(pool->tree_h, slab, pool->slab_size);
+        if (NULL == slab) {
+            return (NULL);
+        }
+        hdr_size = ((sizeof(*slab) + MKAVL_POOL_ALIGN - 1) /
+                    MKAVL_POOL_ALIGN) * MKAVL_POOL_ALIGN;
+
+        slab->next = pool->slab_list;
+        pool->slab_list = slab;
+        pool->slab_cur = ((char *) slab) + hdr_size;
+        pool->slab_end = ((char *) slab) + pool->slab_size;
+    }
+
+    obj = pool->slab_cur;
+    pool->slab_cur += pool->obj_size;
+
+    return (obj);
+}
+
+/**
+ * Return an object to the free list of its node pool.
+ *
+ * @param pool The pool from which the object was allocated.
+ * @param obj The object to free.
+ */
+static void
+mkavl_pool_free (mkavl_node_pool_st *pool, void *obj)
+{
+    *((void **) obj) = pool->free_list;
+    pool->free_list = obj;
+}
+
+/**
+ * A wrapper to map the AVL callback to the node pool of an AVL tree.
+ *
+ * @param allocator The node pool associated with the callback
+ * @param size The size to allocate, which must be the object size of the pool
+ * @return A pointer to the new memory, or NULL on failure.
+ */
+static void *
+mkavl_pool_malloc_wrapper (struct libavl_allocator *allocator, size_t size)
+{
+    mkavl_node_pool_st *pool = (mkavl_node_pool_st *) allocator;
+
+    mkavl_assert_abort(MKAVL_CTX_MAGIC == pool->magic);
+    mkavl_assert_abort(size <= pool->obj_size);
+
+    return (mkavl_pool_alloc(pool));
+}
+
+/**
+ * A wrapper to map the AVL callback to the node pool of an AVL tree.
+ *
+ * @param allocator The node pool associated with the callback
+ * @param libavl_block The memory to free
+ */
+static void
+mkavl_pool_free_wrapper (struct libavl_allocator *allocator, void *libavl_block)
+{
+    mkavl_node_pool_st *pool = (mkavl_node_pool_st *) allocator;
+
+    mkavl_assert_abort(MKAVL_CTX_MAGIC == pool->magic);
+
+    mkavl_pool_free(pool, libavl_block);
+}
+
+/**
+ * Wrapper to convert AVL allocations to allocations from a node pool.
+ */
+static struct libavl_allocator mkavl_pool_allocator_wrapper = {
+    mkavl_pool_malloc_wrapper,
+    mkavl_pool_free_wrapper
+};
+
+/**
+ * Initialize a node pool.  No memory is allocated until the first object is
+ * requested.
+ *
+ * @param pool The pool to initialize.
+ * @param tree_h The tree owning the pool, whose allocator supplies the slabs.
+ * @param obj_size The size of the objects handed out by the pool.
+ */
+static void
+mkavl_pool_init (mkavl_node_pool_st *pool, mkavl_tree_handle tree_h,
+                 size_t obj_size)
+{
+    size_t hdr_size;
+
+    hdr_size = ((sizeof(mkavl_slab_st) + MKAVL_POOL_ALIGN - 1) /
+                MKAVL_POOL_ALIGN) * MKAVL_POOL_ALIGN;
+    obj_size = ((obj_size + sizeof(void *) - 1) / sizeof(void *)) *
+        sizeof(void *);
+
+    memcpy(&(pool->avl_allocator), &mkavl_pool_allocator_wrapper,
+           sizeof(pool->avl_allocator));
+    pool->tree_h = tree_h;
+    pool->obj_size = obj_size;
+    pool->slab_size = MKAVL_POOL_SLAB_SIZE;
+    if (pool->slab_size < (hdr_size + (MKAVL_POOL_SLAB_MIN_OBJS * obj_size))) {
+        pool->slab_size = (hdr_size + (MKAVL_POOL_SLAB_MIN_OBJS * obj_size));
+    }
+    pool->slab_list = NULL;
+    pool->slab_cur = NULL;
+    pool->slab_end = NULL;
+    pool->free_list = NULL;
+    pool->magic = MKAVL_CTX_MAGIC;
+}
+
+/**
+ * Free all the slabs of a node pool at once.  Any objects still allocated from
+ * the pool are invalid afterwards.
+ *
+ * @param pool The pool to destroy.
+ */
+static void
+mkavl_pool_destroy (mkavl_node_pool_st *pool)
+{
+    mkavl_slab_st *slab;
+
+    if (MKAVL_CTX_MAGIC != pool->magic) {
+        /* The pool was never initialized */
+        return;
+    }
+
+    while (NULL != pool->slab_list) {
+        slab = pool->slab_list;
+        pool->slab_list = slab->next;
+        mkavl_note_free(pool->tree_h, slab, pool->slab_size);
+        pool->tree_h->allocator.mkavl_allocator.free_fn(slab,
+                                                        pool->tree_h->context);
+    }
+
+    pool->slab_cur = NULL;
+    pool->slab_end = NULL;
+    pool->free_list = NULL;
+    pool->magic = MKAVL_CTX_STALE;
+}
+
+/**
+ * Get the bytes of the slabs of a node pool, whether or not their objects are
+ * in use.
+ *
+ * @param pool The pool.
+ * @return The bytes of the slabs, 0 if the pool was never initialized.
+ */
+static uint64_t
+mkavl_pool_bytes (const mkavl_node_pool_st *pool)
+{
+    const mkavl_slab_st *slab;
+    uint64_t bytes = 0;
+
+    if (MKAVL_CTX_MAGIC != pool->magic) {
+        return (0);
+    }
+
+    for (slab = pool->slab_list; NULL != slab; slab = slab->next) {
+        bytes += pool->slab_size;
+    }
+
+    return (bytes);
+}
+
+/**
+ * A wrapper to map the AVL callback to the client callback for the mkavl tree.
+ *
+ * @param avl_a The first item in the comparison
+ * @param avl_b The second item in the comparison
+ * @param avl_param The context associated with the callback
+ * @return 0 if equal, -1 if avl_a < avl_b, and 1 if avl_a > avl_b
+ */
+static int
+mkavl_compare_wrapper (const void *avl_a, const void *avl_b, void *avl_param)
+{
+    mkavl_avl_ctx_st *avl_ctx;
+    mkavl_compare_fn cmp_fn;
+
+    avl_ctx = (mkavl_avl_ctx_st *) avl_param;
+    mkavl_assert_abort(mkavl_avl_ctx_is_valid(avl_ctx));
+
+    cmp_fn = avl_ctx->tree_h->avl_tree_array[avl_ctx->key_idx].compare_fn;
+    mkavl_assert_abort(NULL != cmp_fn);
+
+    if (NULL != avl_ctx->tree_h->stats) {
+        ++mkavl_thread_cmp_cnt;
+        mkavl_key_stats_add(avl_ctx->tree_h, avl_ctx->key_idx,
+                            MKAVL_KEY_STAT_E_CMP, 1);
+    } else if (NULL != __atomic_load_n(&mkavl_trace_hook, __ATOMIC_RELAXED)) {
+        ++mkavl_thread_cmp_cnt;
+    }
+
+    return (cmp_fn(avl_a, avl_b, avl_ctx->tree_h->context));
+}
+
+/**
+ * Get the aggregate value stored after an AVL node of a key with an aggregate.
+ *
+ * @param node The AVL node.
+ * @return A pointer to the aggregate of the subtree rooted at the node.
+ */
+static inline int64_t *
+mkavl_node_aggregate (struct avl_node *node)
+{
+    return ((int64_t *) (node + 1));
+}
+
+/**
+ * Get the aggregate of an empty range.
+ *
+ * @param aggregate The aggregate description.
+ * @return The identity value of the aggregate.
+ */
+static inline int64_t
+mkavl_aggregate_identity (const mkavl_aggregate_st *aggregate)
+{
+    switch (aggregate->type) {
+    case MKAVL_AGGREGATE_TYPE_E_MINIMUM:
+        return (INT64_MAX);
+    case MKAVL_AGGREGATE_TYPE_E_MAXIMUM:
+        return (INT64_MIN);
+    case MKAVL_AGGREGATE_TYPE_E_CUSTOM:
+        return (aggregate->identity);
+    default:
+        return (0);
+    }
+}
+
+/**
+ * Get the value an item contributes to an aggregate.
+ *
+ * @param aggregate The aggregate description.
+ * @param item The item.
+ * @param context The context of the tree.
+ * @return The value of the item.
+ */
+static inline int64_t
+mkavl_aggregate_extract (const mkavl_aggregate_st *aggregate,
+                         const void *item, void *context)
+{
+    const char *field;
+
+    if (MKAVL_AGGREGATE_TYPE_E_CUSTOM == aggregate->type) {
+        return (aggregate->extract_fn(item, context));
+    }
+
+    field = (const char *) item + aggregate->field_offset;
+    switch (aggregate->field_type) {
+    case MKAVL_AGGREGATE_FIELD_E_U32:
+        return (*((const uint32_t *) field));
+    case MKAVL_AGGREGATE_FIELD_E_I32:
+        return (*((const int32_t *) field));
+    case MKAVL_AGGREGATE_FIELD_E_U64:
+        return ((int64_t) *((const uint64_t *) field));
+    default:
+        return (*((const int64_t *) field));
+    }
+}
+
+/**
+ * Combine two values of an aggregate, the first coming before the second in
+ * key order.
+ *
+ * @param aggregate The aggregate description.
+ * @param value1 The first value.
+ * @param value2 The second value.
+ * @param context The context of the tree.
+ * @return The combined value.
+ */
+static inline int64_t
+mkavl_aggregate_combine (const mkavl_aggregate_st *aggregate, int64_t value1,
+                         int64_t value2, void *context)
+{
+    switch (aggregate->type) {
+    case MKAVL_AGGREGATE_TYPE_E_SUM:
+        /* Wrap rather than overflow */
+        return ((int64_t) ((uint64_t) value1 + (uint64_t) value2));
+    case MKAVL_AGGREGATE_TYPE_E_MINIMUM:
+        return ((value1 < value2) ? value1 : value2);
+    case MKAVL_AGGREGATE_TYPE_E_MAXIMUM:
+        return ((value1 > value2) ? value1 : value2);
+    default:
+        return (aggregate->combine_fn(value1, value2, context));
+    }
+}
+
+/**
+ * Sanity check for an aggregate description given by the client.
+ *
+ * @param aggregate The aggregate description.
+ * @return true if the description is valid.
+ */
+static bool
+mkavl_aggregate_is_valid (const mkavl_aggregate_st *aggregate)
+{
+    switch (aggregate->type) {
+    case MKAVL_AGGREGATE_TYPE_E_NONE:
+        return (true);
+    case MKAVL_AGGREGATE_TYPE_E_SUM:
+    case MKAVL_AGGREGATE_TYPE_E_MINIMUM:
+    case MKAVL_AGGREGATE_TYPE_E_MAXIMUM:
+        return (aggregate->field_type < MKAVL_AGGREGATE_FIELD_E_MAX);
+    case MKAVL_AGGREGATE_TYPE_E_CUSTOM:
+        return ((NULL != aggregate->extract_fn) &&
+                (NULL != aggregate->combine_fn));
+    default:
+        return (false);
+    }
+}
+
+/**
+ * Check whether a key of the tree keeps an aggregate.
+ *
+ * @param tree_h The tree.
+ * @param key_idx The key index.
+ * @return true if the AVL nodes of the key hold aggregates.
+ */
+static inline bool
+mkavl_aggregate_is_kept (mkavl_tree_handle tree_h, size_t key_idx)
+{
+    return ((NULL != tree_h->aggregate_array) &&
+            (MKAVL_AGGREGATE_TYPE_E_NONE !=
+             tree_h->aggregate_array[key_idx].type));
+}
+
+/**
+ * The libavl callback to recompute the aggregate of a node from the node's item
+ * and the aggregates of its children.  It is called bottom up whenever the
+ * subtree below a node changes.
+ *
+ * @param avl_node The node to update.
+ * @param avl_param The context associated with the callback
+ */
+static void
+mkavl_avl_update (struct avl_node *avl_node, void *avl_param)
+{
+    const mkavl_aggregate_st *aggregate;
+    mkavl_avl_ctx_st *avl_ctx;
+    void *context;
+    int64_t value;
+
+    avl_ctx = (mkavl_avl_ctx_st *) avl_param;
+    mkavl_assert_abort(mkavl_avl_ctx_is_valid(avl_ctx));
+
+    aggregate = &(avl_ctx->tree_h->aggregate_array[avl_ctx->key_idx]);
+    context = avl_ctx->tree_h->context;
+
+    value = mkavl_aggregate_extract(aggregate, avl_node->avl_data, context);
+    if (NULL != avl_node->avl_link[0]) {
+        value = mkavl_aggregate_combine(aggregate,
+                    *mkavl_node_aggregate(avl_node->avl_link[0]), value,
+                    context);
+    }
+    if (NULL != avl_node->avl_link[1]) {
+        value = mkavl_aggregate_combine(aggregate, value,
+                    *mkavl_node_aggregate(avl_node->avl_link[1]), context);
+    }
+    *mkavl_node_aggregate(avl_node) = value;
+}
+
+/**
+ * Give a persistent tree a node of its own in place of one it may share with
+ * other trees, so that the node can be changed.  A node with a single link is
+ * reached only through the nodes above it, which are already the tree's own by
+ * the time libavl asks for it, so it is returned as is.  Otherwise the copy
+ * takes over the link to the node, and adds links to its children.
+ *
+ * @param avl_node The node about to be changed.
+ * @param avl_param The context associated with the callback
+ * @return The node to change, or NULL if a copy could not be allocated.
+ */
+static struct avl_node *
+mkavl_avl_unshare (struct avl_node *avl_node, void *avl_param)
+{
+    mkavl_avl_ctx_st *avl_ctx;
+    struct avl_table *avl_tree;
+    struct avl_node *copy;
+    size_t i;
+
+    avl_ctx = (mkavl_avl_ctx_st *) avl_param;
+    mkavl_assert_abort(mkavl_avl_ctx_is_valid(avl_ctx));
+    avl_tree = avl_ctx->tree_h->avl_tree_array[avl_ctx->key_idx].tree;
+
+    if (1 == __atomic_load_n(mkavl_node_refs(avl_tree, avl_node),
+                             __ATOMIC_ACQUIRE)) {
+        return (avl_node);
+    }
+
+    copy = avl_tree->avl_alloc->libavl_malloc(avl_tree->avl_alloc,
+                                              avl_tree->avl_node_size);
+    if (NULL == copy) {
+        return (NULL);
+    }
+    memcpy(copy, avl_node, (avl_tree->avl_node_size - sizeof(uint32_t)));
+
+    for (i = 0; i < NELEMS(copy->avl_link); ++i) {
+        if (NULL != copy->avl_link[i]) {
+            __atomic_add_fetch(mkavl_node_refs(avl_tree, copy->avl_link[i]), 1,
+                               __ATOMIC_RELAXED);
+        }
+    }
+    mkavl_node_release(avl_tree, avl_node);
+
+    return (copy);
+}
+
+/**
+ * Give the tree its own copy of the aggregates from the options and size the
+ * nodes to hold them.  If no key has an aggregate, the tree keeps no copy.
+ *
+ * @param tree_h The tree being created.
+ * @param aggregate_array The aggregates from the options, one per key.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_aggregate_array_init (mkavl_tree_handle tree_h,
+                            const mkavl_aggregate_st *aggregate_array)
+{
+    bool is_kept = false;
+    size_t i;
+
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        if (!mkavl_aggregate_is_valid(&(aggregate_array[i]))) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+        if (MKAVL_AGGREGATE_TYPE_E_NONE != aggregate_array[i].type) {
+            is_kept = true;
+        }
+    }
+
+    if (!is_kept) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    tree_h->aggregate_array = tree_h->allocator.mkavl_allocator.malloc_fn(
+        (tree_h->avl_tree_count * sizeof(*(tree_h->aggregate_array))),
+        tree_h->context);
+    if (NULL == tree_h->aggregate_array) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memcpy(tree_h->aggregate_array, aggregate_array,
+           (tree_h->avl_tree_count * sizeof(*(tree_h->aggregate_array))));
+    tree_h->opts.aggregate_array = tree_h->aggregate_array;
+    tree_h->node_size += sizeof(int64_t);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Allocate the counters of a tree that keeps stats.  A tree that several
+ * threads may count in at once, thread safe or with workers, gets a stripe of
+ * counters per group of threads.
+ *
+ * @param tree_h The tree being created.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_stats_init (mkavl_tree_handle tree_h)
+{
+    size_t line_len = (MKAVL_CACHE_LINE_SIZE / sizeof(*(tree_h->stats)));
+    size_t size;
+
+    tree_h->stats_stripe_len = (MKAVL_STAT_E_MAX + (tree_h->avl_tree_count *
+                                                    MKAVL_KEY_STAT_E_MAX));
+    tree_h->stats_stripe_len =
+        (((tree_h->stats_stripe_len + line_len - 1) / line_len) * line_len);
+    tree_h->stats_stripe_cnt =
+        (tree_h->opts.thread_safe || (NULL != tree_h->opts.workers)) ?
+        MKAVL_STATS_STRIPE_CNT : 1;
+
+    size = (tree_h->stats_stripe_cnt * tree_h->stats_stripe_len *
+            sizeof(*(tree_h->stats)));
+    tree_h->stats = tree_h->allocator.mkavl_allocator.malloc_fn(size,
+                                                             tree_h->context);
+    if (NULL == tree_h->stats) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(tree_h->stats, 0, size);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the bytes of the structures a tree allocates for itself, apart from
+ * those of each key.
+ *
+ * @param tree_h The tree.
+ * @return The bytes of the tree, its key array, aggregates, lockless read
+ * state and counters.
+ */
+static uint64_t
+mkavl_memory_tree_bytes (mkavl_tree_handle tree_h)
+{
+    uint64_t bytes;
+
+    bytes = (sizeof(*tree_h) +
+             (tree_h->avl_tree_count * sizeof(*(tree_h->avl_tree_array))));
+    if (NULL != tree_h->aggregate_array) {
+        bytes += (tree_h->avl_tree_count *
+                  sizeof(*(tree_h->aggregate_array)));
+    }
+    if (NULL != tree_h->lockless) {
+        bytes += sizeof(*(tree_h->lockless));
+    }
+    if (NULL != tree_h->stats) {
+        bytes += (tree_h->stats_stripe_cnt * tree_h->stats_stripe_len *
+                  sizeof(*(tree_h->stats)));
+    }
+
+    return (bytes);
+}
+
+/**
+ * This will free all memory associated with the tree and set the pointer to
+ * NULL.
+ *
+ * @param tree_h Pointer to the tree to delete
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_delete_tree (mkavl_tree_handle *tree_h)
+{
+    mkavl_allocator_st local_allocator;
+    mkavl_tree_handle local_tree_h;
     void *context;
     uint32_t i;
 
@@ -489,6 +1676,11 @@ mkavl_delete_tree (mkavl_tree_handle *tree_h)
         return (MKAVL_RC_E_SUCCESS);
     }
 
+    if (NULL != local_tree_h->stats) {
+        local_allocator.free_fn(local_tree_h->stats, context);
+        local_tree_h->stats = NULL;
+    }
+
     if (NULL != local_tree_h->avl_tree_array) {
         for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
             if (NULL != local_tree_h->avl_tree_array[i].tree) { 
@@ -497,14 +1689,35 @@ mkavl_delete_tree (mkavl_tree_handle *tree_h)
                         local_tree_h->avl_tree_array[i].avl_ctx, context);
                     local_tree_h->avl_tree_array[i].avl_ctx = NULL;
                 }
+                /* 
+                 * The table itself came from the client allocator, so switch
+                 * back from the node pool or node allocator before destroying
+                 * it.
+                 */
+                local_tree_h->avl_tree_array[i].tree->avl_alloc =
+                    &(local_tree_h->allocator.avl_allocator);
                 avl_destroy(local_tree_h->avl_tree_array[i].tree, NULL);
                 local_tree_h->avl_tree_array[i].tree = NULL;
             }
+            mkavl_pool_destroy(&(local_tree_h->avl_tree_array[i].node_pool));
         }
         local_allocator.free_fn(local_tree_h->avl_tree_array, context);
     }
+    mkavl_pool_destroy(&(local_tree_h->block_pool));
+    if (NULL != local_tree_h->aggregate_array) {
+        local_allocator.free_fn(local_tree_h->aggregate_array, context);
+    }
+    if (local_tree_h->opts.thread_safe) {
+        pthread_rwlock_destroy(&(local_tree_h->rwlock));
+    }
+    if (NULL != local_tree_h->lockless) {
+        mkavl_assert_abort(NULL == local_tree_h->lockless->retired_head);
+        local_allocator.free_fn(local_tree_h->lockless, context);
+    }
     local_tree_h->allocator.tree_h = NULL;
     local_tree_h->allocator.magic = MKAVL_CTX_STALE;
+    local_tree_h->node_allocator.tree_h = NULL;
+    local_tree_h->node_allocator.magic = MKAVL_CTX_STALE;
 
     local_allocator.free_fn(local_tree_h, context);
 
@@ -561,464 +1774,5048 @@ mkavl_tree_is_valid (mkavl_tree_handle tree_h)
 }
 
 /**
- * Sanity check for mkavl_iterator_handle objects.
+ * Take the shared side of the lock of a thread safe tree.  Nothing is done for
+ * a tree that is not thread safe.
  *
- * @param iterator_h The object to check.  If NULL, false is returned.
- * @return true if the object is valid.
+ * @param tree_h The tree to lock.  If NULL, nothing is done.
  */
-static bool
-mkavl_iterator_is_valid (mkavl_iterator_handle iterator_h)
+static inline void
+mkavl_read_lock (mkavl_tree_handle tree_h)
+{
+    if ((NULL != tree_h) && tree_h->opts.thread_safe) {
+        mkavl_assert_abort(0 == pthread_rwlock_rdlock(&(tree_h->rwlock)));
+    }
+}
+
+/**
+ * Check whether a tree has lockless reads and no change of the current writer
+ * has been made visible to them yet.
+ *
+ * @param tree_h The tree being changed.
+ * @return true if the tree has lockless reads and its sequence count is even.
+ */
+static inline bool
+mkavl_lockless_is_idle (mkavl_tree_handle tree_h)
+{
+    return ((NULL != tree_h->lockless) && (0 == (tree_h->lockless->seq & 1)));
+}
+
+/**
+ * Make the sequence count of a tree with lockless reads odd just before a
+ * writer first changes the AVL trees, if it is not odd already.  Lockless
+ * readers wait while the count is odd, so it is only made odd around the
+ * changes themselves, not for the whole time the lock is held: the write-ahead
+ * log and the stats are left outside.  Must be called with the exclusive side
+ * of the lock held, or on a tree no other thread can reach yet.
+ *
+ * @param tree_h The tree about to be changed.
+ */
+static inline void
+mkavl_lockless_write_begin (mkavl_tree_handle tree_h)
+{
+    mkavl_lockless_st *lockless = tree_h->lockless;
+
+    if (mkavl_lockless_is_idle(tree_h)) {
+        __atomic_store_n(&(lockless->seq), (lockless->seq + 1),
+                         __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Make the sequence count of a tree with lockless reads even again once the
+ * AVL trees are consistent, publishing the changes to lockless readers.
+ * Nothing is done if mkavl_lockless_write_begin() was not called.
+ *
+ * @param tree_h The tree that was changed.
+ */
+static inline void
+mkavl_lockless_write_end (mkavl_tree_handle tree_h)
+{
+    mkavl_lockless_st *lockless = tree_h->lockless;
+
+    if ((NULL != lockless) && (0 != (lockless->seq & 1))) {
+        __atomic_store_n(&(lockless->seq), (lockless->seq + 1),
+                         __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Take the exclusive side of the lock of a thread safe tree.  Nothing is done
+ * for a tree that is not thread safe.
+ *
+ * @param tree_h The tree to lock.  If NULL, nothing is done.
+ */
+static inline void
+mkavl_write_lock (mkavl_tree_handle tree_h)
+{
+    if ((NULL != tree_h) && tree_h->opts.thread_safe) {
+        mkavl_assert_abort(0 == pthread_rwlock_wrlock(&(tree_h->rwlock)));
+    }
+}
+
+/**
+ * Release the exclusive side of the lock of a thread safe tree, publishing
+ * any change not yet published to lockless readers.
+ *
+ * @param tree_h The tree to unlock.  If NULL, nothing is done.
+ */
+static inline void
+mkavl_write_unlock (mkavl_tree_handle tree_h)
+{
+    if ((NULL != tree_h) && tree_h->opts.thread_safe) {
+        mkavl_lockless_write_end(tree_h);
+        mkavl_assert_abort(0 == pthread_rwlock_unlock(&(tree_h->rwlock)));
+    }
+}
+
+/**
+ * Release the shared side of the lock of a thread safe tree.
+ *
+ * @param tree_h The tree to unlock.  If NULL, nothing is done.
+ */
+static inline void
+mkavl_unlock (mkavl_tree_handle tree_h)
+{
+    if ((NULL != tree_h) && tree_h->opts.thread_safe) {
+        mkavl_assert_abort(0 == pthread_rwlock_unlock(&(tree_h->rwlock)));
+    }
+}
+
+/**
+ * Initialize the lock of a thread safe tree.
+ *
+ * @param tree_h The tree being created.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_lock_init (mkavl_tree_handle tree_h)
+{
+    pthread_rwlockattr_t attr;
+    int err;
+
+    if (0 != pthread_rwlockattr_init(&attr)) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+#ifdef __GLIBC__
+    /* The default kind lets a steady stream of readers starve writers */
+    if (tree_h->opts.writer_preference) {
+        pthread_rwlockattr_setkind_np(&attr,
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    }
+#endif
+
+    err = pthread_rwlock_init(&(tree_h->rwlock), &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    return ((0 == err) ? MKAVL_RC_E_SUCCESS : MKAVL_RC_E_ENOMEM);
+}
+
+/** The reader slot of the calling thread, assigned on first use */
+static __thread uint32_t mkavl_epoch_thread_slot = UINT32_MAX;
+
+/** The slot to assign to the next thread that reads */
+static uint32_t mkavl_epoch_next_slot;
+
+/**
+ * Count the calling thread as a reader in the current epoch of a tree with
+ * lockless reads.
+ *
+ * @param lockless The lockless read state of the tree.
+ * @param guard Filled in with what mkavl_epoch_exit() needs.
+ */
+static inline void
+mkavl_epoch_enter (mkavl_lockless_st *lockless, mkavl_epoch_guard_st *guard)
+{
+    if (UINT32_MAX == mkavl_epoch_thread_slot) {
+        mkavl_epoch_thread_slot =
+            (__atomic_fetch_add(&mkavl_epoch_next_slot, 1, __ATOMIC_RELAXED) %
+             MKAVL_EPOCH_SLOT_CNT);
+    }
+
+    guard->slot = &(lockless->slot_array[mkavl_epoch_thread_slot]);
+    guard->parity = (__atomic_load_n(&(lockless->epoch), __ATOMIC_RELAXED) & 1);
+
+    /*
+     * This must be seen before anything the reader loads from the tree, so a
+     * writer that misses it also made its change before the reader looked.
+     */
+    __atomic_fetch_add(&(guard->slot->active[guard->parity]), 1,
+                       __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Stop counting a reader in the epoch it entered.
+ *
+ * @param guard What mkavl_epoch_enter() filled in.
+ */
+static inline void
+mkavl_epoch_exit (mkavl_epoch_guard_st *guard)
+{
+    __atomic_fetch_sub(&(guard->slot->active[guard->parity]), 1,
+                       __ATOMIC_RELEASE);
+}
+
+/**
+ * Advance the epoch of a tree with lockless reads if no reader remains from
+ * the previous epoch, whose parity the next epoch reuses.  The lock of the tree
+ * must be held exclusively.
+ *
+ * @param lockless The lockless read state of the tree.
+ * @return true if the epoch was advanced.
+ */
+static bool
+mkavl_epoch_try_advance (mkavl_lockless_st *lockless)
+{
+    uint64_t epoch = lockless->epoch;
+    uint32_t parity = ((epoch + 1) & 1);
+    uint32_t i;
+
+    /* Pairs with the increment in mkavl_epoch_enter() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (i = 0; i < MKAVL_EPOCH_SLOT_CNT; ++i) {
+        if (0 != __atomic_load_n(&(lockless->slot_array[i].active[parity]),
+                                 __ATOMIC_ACQUIRE)) {
+            return (false);
+        }
+    }
+
+    __atomic_store_n(&(lockless->epoch), (epoch + 1), __ATOMIC_SEQ_CST);
+
+    return (true);
+}
+
+/**
+ * Take the retired items that no lockless reader can still see off the
+ * retired list of a tree.  The lock of the tree must be held exclusively.
+ *
+ * @param lockless The lockless read state of the tree.
+ * @param take_all Take every item regardless of the epoch, e.g., when no
+ * reader remains because the tree is being deleted.
+ * @return The items taken, in the order of retirement.
+ */
+static mkavl_retired_st *
+mkavl_retired_take (mkavl_lockless_st *lockless, bool take_all)
+{
+    mkavl_retired_st *head = lockless->retired_head;
+    mkavl_retired_st *last = NULL;
+    mkavl_retired_st *cur;
+
+    for (cur = head; NULL != cur; cur = cur->next) {
+        if (!take_all && ((cur->epoch + 2) > lockless->epoch)) {
+            break;
+        }
+        last = cur;
+    }
+
+    if (NULL == last) {
+        return (NULL);
+    }
+
+    lockless->retired_head = last->next;
+    if (NULL == lockless->retired_head) {
+        lockless->retired_tail = NULL;
+    }
+    last->next = NULL;
+
+    return (head);
+}
+
+/**
+ * Apply the item function of each of a list of retired items and free the
+ * list.
+ *
+ * @param tree_h The tree from which the items were retired.
+ * @param retired The items taken by mkavl_retired_take().
+ * @return The return code of the first item function that failed, if any.
+ */
+static mkavl_rc_e
+mkavl_retired_release (mkavl_tree_handle tree_h, mkavl_retired_st *retired)
+{
+    mkavl_retired_st *next;
+    mkavl_rc_e rc, retval = MKAVL_RC_E_SUCCESS;
+
+    for (; NULL != retired; retired = next) {
+        next = retired->next;
+        rc = retired->item_fn(retired->item, tree_h->context);
+        if (mkavl_rc_e_is_notok(rc) && mkavl_rc_e_is_ok(retval)) {
+            retval = rc;
+        }
+        tree_h->allocator.mkavl_allocator.free_fn(retired, tree_h->context);
+    }
+
+    return (retval);
+}
+
+/**
+ * Let the CPU know that the calling thread is spinning.
+ */
+static inline void
+mkavl_cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Start a lockless read: note the sequence count of the tree, waiting a
+ * little for a writer that is changing the tree to finish.
+ *
+ * @param lockless The lockless read state of the tree.
+ * @param seq Filled in with the sequence count.
+ * @return false if a writer is still changing the tree.
+ */
+static inline bool
+mkavl_lockless_read_begin (mkavl_lockless_st *lockless, uint32_t *seq)
+{
+    uint32_t i;
+
+    for (i = 0; i < MKAVL_LOCKLESS_SPIN_CNT; ++i) {
+        *seq = __atomic_load_n(&(lockless->seq), __ATOMIC_ACQUIRE);
+        if (0 == (*seq & 1)) {
+            return (true);
+        }
+        mkavl_cpu_relax();
+    }
+
+    return (false);
+}
+
+/**
+ * Check that nothing loaded from the tree since a lockless read began was
+ * changed by a writer.
+ *
+ * @param lockless The lockless read state of the tree.
+ * @param seq The sequence count from mkavl_lockless_read_begin().
+ * @return true if what was loaded is from a consistent tree.
+ */
+static inline bool
+mkavl_lockless_read_valid (mkavl_lockless_st *lockless, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (__atomic_load_n(&(lockless->seq), __ATOMIC_RELAXED) == seq);
+}
+
+/**
+ * One attempt at a lookup in a tree with lockless reads.  Every load from the
+ * tree is checked against the sequence count before the item loaded is
+ * compared, and the descent is bounded, so a writer getting in the way only
+ * makes the attempt fail.
+ *
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param type The type of lookup.  If lookup_item is NULL, MKAVL_FIND_TYPE_E_GT
+ * gives the first item and MKAVL_FIND_TYPE_E_LT gives the last item.
+ * @param lookup_item The item to use as the lookup target, or NULL.
+ * @param found_item The item found, or NULL if there is none.
+ * @return false if the attempt must be retried.
+ */
+static bool
+mkavl_lockless_find_try (mkavl_tree_handle tree_h, size_t key_idx,
+                         mkavl_find_type_e type, const void *lookup_item,
+                         void **found_item)
+{
+    struct avl_table *avl_tree = tree_h->avl_tree_array[key_idx].tree;
+    mkavl_lockless_st *lockless = tree_h->lockless;
+    struct avl_node *p;
+    void *data, *best = NULL;
+    uint32_t seq, depth = 0;
+    int cmp, dir;
+
+    if (!mkavl_lockless_read_begin(lockless, &seq)) {
+        return (false);
+    }
+
+    p = __atomic_load_n(&(avl_tree->avl_root), __ATOMIC_RELAXED);
+    while (NULL != p) {
+        data = __atomic_load_n(&(p->avl_data), __ATOMIC_RELAXED);
+        if ((depth++ >= AVL_MAX_HEIGHT) ||
+            !mkavl_lockless_read_valid(lockless, seq)) {
+            return (false);
+        }
+
+        if (NULL == lookup_item) {
+            cmp = (MKAVL_FIND_TYPE_E_GT == type) ? -1 : 1;
+        } else {
+            cmp = avl_tree->avl_compare(lookup_item, data,
+                                        avl_tree->avl_param);
+        }
+
+        if ((0 == cmp) && (MKAVL_FIND_TYPE_E_GT != type) &&
+            (MKAVL_FIND_TYPE_E_LT != type)) {
+            best = data;
+            break;
+        }
+
+        switch (type) {
+        case MKAVL_FIND_TYPE_E_GT:
+        case MKAVL_FIND_TYPE_E_GE:
+            if (cmp < 0) {
+                best = data;
+            }
+            dir = (cmp >= 0);
+            break;
+        case MKAVL_FIND_TYPE_E_LT:
+        case MKAVL_FIND_TYPE_E_LE:
+            if (cmp > 0) {
+                best = data;
+            }
+            dir = (cmp > 0);
+            break;
+        default:
+            dir = (cmp > 0);
+            break;
+        }
+
+        p = __atomic_load_n(&(p->avl_link[dir]), __ATOMIC_RELAXED);
+    }
+
+    if (!mkavl_lockless_read_valid(lockless, seq)) {
+        return (false);
+    }
+    *found_item = best;
+
+    return (true);
+}
+
+/**
+ * One attempt at finding the item at a position in a tree with lockless
+ * reads.
+ *
+ * @see mkavl_lockless_find_try
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param idx The 0-based position of the item.
+ * @param found_item The item found, or NULL if there is none.
+ * @return false if the attempt must be retried.
+ */
+static bool
+mkavl_lockless_select_try (mkavl_tree_handle tree_h, size_t key_idx,
+                           size_t idx, void **found_item)
+{
+    struct avl_table *avl_tree = tree_h->avl_tree_array[key_idx].tree;
+    mkavl_lockless_st *lockless = tree_h->lockless;
+    struct avl_node *p, *left;
+    void *data, *best = NULL;
+    uint32_t seq, depth = 0;
+    size_t left_size;
+
+    if (!mkavl_lockless_read_begin(lockless, &seq)) {
+        return (false);
+    }
+
+    p = __atomic_load_n(&(avl_tree->avl_root), __ATOMIC_RELAXED);
+    while (NULL != p) {
+        left = __atomic_load_n(&(p->avl_link[0]), __ATOMIC_RELAXED);
+        left_size = (NULL != left) ?
+            __atomic_load_n(&(left->avl_size), __ATOMIC_RELAXED) : 0;
+        data = __atomic_load_n(&(p->avl_data), __ATOMIC_RELAXED);
+        if ((depth++ >= AVL_MAX_HEIGHT) ||
+            !mkavl_lockless_read_valid(lockless, seq)) {
+            return (false);
+        }
+
+        if (idx < left_size) {
+            p = left;
+        } else if (idx == left_size) {
+            best = data;
+            break;
+        } else {
+            idx -= (left_size + 1);
+            p = __atomic_load_n(&(p->avl_link[1]), __ATOMIC_RELAXED);
+        }
+    }
+
+    if (!mkavl_lockless_read_valid(lockless, seq)) {
+        return (false);
+    }
+    *found_item = best;
+
+    return (true);
+}
+
+/**
+ * Do a lookup in a tree with lockless reads.  If writers keep getting in the
+ * way, the lookup is done with the shared side of the lock held instead.
+ *
+ * @see mkavl_lockless_find_try
+ */
+static void
+mkavl_lockless_find (mkavl_tree_handle tree_h, size_t key_idx,
+                     mkavl_find_type_e type, const void *lookup_item,
+                     void **found_item)
+{
+    uint32_t i;
+    bool found;
+
+    for (i = 0; i < MKAVL_LOCKLESS_TRY_CNT; ++i) {
+        if (mkavl_lockless_find_try(tree_h, key_idx, type, lookup_item,
+                                    found_item)) {
+            return;
+        }
+    }
+
+    mkavl_read_lock(tree_h);
+    found = mkavl_lockless_find_try(tree_h, key_idx, type, lookup_item,
+                                    found_item);
+    mkavl_unlock(tree_h);
+    mkavl_assert_abort(found);
+}
+
+/**
+ * Find the item at a position in a tree with lockless reads.  If writers keep
+ * getting in the way, this is done with the shared side of the lock held
+ * instead.
+ *
+ * @see mkavl_lockless_select_try
+ */
+static void
+mkavl_lockless_select (mkavl_tree_handle tree_h, size_t key_idx, size_t idx,
+                       void **found_item)
+{
+    uint32_t i;
+    bool found;
+
+    for (i = 0; i < MKAVL_LOCKLESS_TRY_CNT; ++i) {
+        if (mkavl_lockless_select_try(tree_h, key_idx, idx, found_item)) {
+            return;
+        }
+    }
+
+    mkavl_read_lock(tree_h);
+    found = mkavl_lockless_select_try(tree_h, key_idx, idx, found_item);
+    mkavl_unlock(tree_h);
+    mkavl_assert_abort(found);
+}
+
+/**
+ * Sanity check for mkavl_iterator_handle objects.
+ *
+ * @param iterator_h The object to check.  If NULL, false is returned.
+ * @return true if the object is valid.
+ */
+static bool
+mkavl_iterator_is_valid (mkavl_iterator_handle iterator_h)
+{
+    bool is_valid = true;
+
+    if (is_valid && (NULL == iterator_h)) {
+        is_valid = false;
+    }
+
+    if (is_valid && !mkavl_tree_is_valid(iterator_h->tree_h)) {
+        is_valid = false;
+    }
+
+    if (is_valid && 
+        (iterator_h->key_idx >= iterator_h->tree_h->avl_tree_count)) {
+        is_valid = false;
+    }
+
+    return (is_valid);
+}
+
+/**
+ * Get the size of a node block for the tree.
+ *
+ * @param tree_h The tree using intrusive nodes.
+ * @return The size in bytes of the block holding all the nodes of an item.
+ */
+static inline size_t
+mkavl_node_block_size (mkavl_tree_handle tree_h)
+{
+    return (offsetof(mkavl_node_block_st, node_array) +
+            (tree_h->avl_tree_count * tree_h->node_size));
+}
+
+/**
+ * Get the AVL node of a node block for a key index.
+ *
+ * @param tree_h The tree using intrusive nodes.
+ * @param block The node block.
+ * @param key_idx The key index of the AVL node.
+ * @return The AVL node.
+ */
+static inline struct avl_node *
+mkavl_node_block_node (mkavl_tree_handle tree_h, mkavl_node_block_st *block,
+                       size_t key_idx)
+{
+    return ((struct avl_node *) ((char *) block->node_array +
+                                 (key_idx * tree_h->node_size)));
+}
+
+/**
+ * Get the node block containing an AVL node.
+ *
+ * @param tree_h The tree using intrusive nodes.
+ * @param node The AVL node, which must belong to a node block.
+ * @param key_idx The key index of the AVL tree in which the node is linked.
+ * @return The node block holding the node.
+ */
+static inline mkavl_node_block_st *
+mkavl_node_block_from_node (mkavl_tree_handle tree_h, struct avl_node *node,
+                            size_t key_idx)
+{
+    return ((mkavl_node_block_st *) ((char *) node -
+                (key_idx * tree_h->node_size) -
+                offsetof(mkavl_node_block_st, node_array)));
+}
+
+/**
+ * Allocate a new node block for an item that is not linked in any AVL tree.
+ *
+ * @param tree_h The tree using intrusive nodes.
+ * @return The new block or NULL if the allocation failed.
+ */
+static mkavl_node_block_st *
+mkavl_node_block_new (mkavl_tree_handle tree_h)
+{
+    mkavl_node_block_st *block;
+
+    if (tree_h->opts.pooled_nodes) {
+        block = mkavl_pool_alloc(&(tree_h->block_pool));
+    } else {
+        block = tree_h->allocator.mkavl_allocator.malloc_fn(
+                    mkavl_node_block_size(tree_h), tree_h->context);
+        mkavl_note_alloc(tree_h, block, mkavl_node_block_size(tree_h));
+    }
+    if (NULL != block) {
+        block->link_count = 0;
+        ++(tree_h->block_count);
+    }
+
+    return (block);
+}
+
+/**
+ * Release a node block once none of its nodes are linked in an AVL tree.
+ *
+ * @param tree_h The tree using intrusive nodes.
+ * @param block The block to check and free.
+ */
+static void
+mkavl_node_block_release (mkavl_tree_handle tree_h, mkavl_node_block_st *block)
+{
+    if (0 != block->link_count) {
+        return;
+    }
+
+    --(tree_h->block_count);
+    if (tree_h->opts.pooled_nodes) {
+        mkavl_pool_free(&(tree_h->block_pool), block);
+    } else {
+        mkavl_note_free(tree_h, block, mkavl_node_block_size(tree_h));
+        tree_h->allocator.mkavl_allocator.free_fn(block, tree_h->context);
+    }
+}
+
+/**
+ * Find the node block of an item by looking for the item in the AVL trees
+ * other than the given one.  This is needed when an item is re-added to a
+ * single key via mkavl_add_key_idx().
+ *
+ * @param tree_h The tree using intrusive nodes.
+ * @param skip_key_idx The key index of the AVL tree not to search.
+ * @param item The item whose block is wanted.
+ * @return The node block or NULL if the item is not in any other AVL tree.
+ */
+static mkavl_node_block_st *
+mkavl_node_block_lookup (mkavl_tree_handle tree_h, size_t skip_key_idx,
+                         void *item)
+{
+    struct avl_traverser avl_t;
+    size_t i;
+
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        if (i == skip_key_idx) {
+            continue;
+        }
+
+        if (item == avl_t_find(&avl_t, tree_h->avl_tree_array[i].tree, item)) {
+            return (mkavl_node_block_from_node(tree_h, avl_t.avl_node, i));
+        }
+    }
+
+    return (NULL);
+}
+
+/**
+ * Insert an item into a single AVL tree of the mkavl tree.  With intrusive
+ * nodes, the item is linked using its node block.
+ *
+ * @param tree_h The mkavl tree.
+ * @param key_idx The index of the AVL tree in which to insert.
+ * @param item The item to insert.
+ * @param block The node block of the item if the tree uses intrusive nodes.
+ * If NULL, the block is found from the other AVL trees or a new one is
+ * allocated.
+ * @param existing_item If an equal item is already in the AVL tree, it is
+ * returned.  Otherwise, NULL is returned.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_avl_insert (mkavl_tree_handle tree_h, size_t key_idx, void *item,
+                  mkavl_node_block_st *block, void **existing_item)
+{
+    struct avl_table *avl_tree = tree_h->avl_tree_array[key_idx].tree;
+    unsigned long rotation_cnt = avl_tree->avl_rotations;
+    size_t count;
+    void **found;
+
+    *existing_item = NULL;
+
+    /*
+     * Whether the item was linked is told by the count since the item found
+     * may be the very one being added.  The probe itself is the search, so
+     * lockless readers are held off from its start even if it finds an equal
+     * item and changes nothing.
+     */
+    count = avl_count(avl_tree);
+    mkavl_lockless_write_begin(tree_h);
+    if (!tree_h->opts.intrusive_nodes) {
+        if (tree_h->opts.persistent && (0 == avl_unshare(avl_tree, item, 0))) {
+            return (MKAVL_RC_E_ENOMEM);
+        }
+
+        found = avl_probe(avl_tree, item);
+        if (NULL == found) {
+            return (MKAVL_RC_E_ENOMEM);
+        }
+
+        if (avl_count(avl_tree) == count) {
+            *existing_item = *found;
+        }
+        mkavl_trace_rebalance(tree_h, key_idx, rotation_cnt);
+
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    if (NULL == block) {
+        block = mkavl_node_block_lookup(tree_h, key_idx, item);
+    }
+
+    if (NULL == block) {
+        block = mkavl_node_block_new(tree_h);
+        if (NULL == block) {
+            return (MKAVL_RC_E_ENOMEM);
+        }
+    }
+
+    found = avl_probe_node(avl_tree, item,
+                           mkavl_node_block_node(tree_h, block, key_idx));
+    if (avl_count(avl_tree) != count) {
+        ++(block->link_count);
+    } else {
+        *existing_item = *found;
+        mkavl_node_block_release(tree_h, block);
+    }
+    mkavl_trace_rebalance(tree_h, key_idx, rotation_cnt);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Delete an item from a single AVL tree of the mkavl tree.  With intrusive
+ * nodes, the node block of the item is freed once the item is no longer in any
+ * AVL tree.
+ *
+ * @param tree_h The mkavl tree.
+ * @param key_idx The index of the AVL tree from which to delete.
+ * @param item The item to delete.
+ * @return The item deleted from the AVL tree, or NULL if not found.
+ */
+static void *
+mkavl_avl_delete (mkavl_tree_handle tree_h, size_t key_idx, const void *item)
+{
+    struct avl_table *avl_tree = tree_h->avl_tree_array[key_idx].tree;
+    unsigned long rotation_cnt = avl_tree->avl_rotations;
+    mkavl_node_block_st *block;
+    struct avl_node *node;
+    void *found_item;
+
+    mkavl_lockless_write_begin(tree_h);
+    if (!tree_h->opts.intrusive_nodes) {
+        found_item = avl_delete(avl_tree, item);
+        mkavl_trace_rebalance(tree_h, key_idx, rotation_cnt);
+        return (found_item);
+    }
+
+    node = avl_delete_node(avl_tree, item);
+    if (NULL == node) {
+        return (NULL);
+    }
+    found_item = node->avl_data;
+    mkavl_trace_rebalance(tree_h, key_idx, rotation_cnt);
+
+    block = mkavl_node_block_from_node(tree_h, node, key_idx);
+    mkavl_assert_abort(block->link_count > 0);
+    --(block->link_count);
+    mkavl_node_block_release(tree_h, block);
+
+    return (found_item);
+}
+
+/**
+ * Unlink and free every node of an AVL tree in linear time without
+ * rebalancing, leaving the AVL tree empty.  The nodes are visited in order by
+ * rotating left children up, as libavl's avl_destroy() does.  With pooled nodes
+ * the nodes are not freed individually since the slabs are dropped with the
+ * tree.  The nodes of a persistent tree may be shared, so they are walked in
+ * place and only the link to the root is dropped.
+ *
+ * @param tree_h The tree owning the AVL tree.
+ * @param key_idx The index of the AVL tree to empty.
+ * @param item_fn If non-NULL, applied to the item of each node.  Must only be
+ * given for the last AVL tree emptied so the item is in no other AVL tree.
+ * @param retval Set to the return code of item_fn if it fails.
+ */
+static void
+mkavl_avl_destroy_nodes (mkavl_tree_handle tree_h, size_t key_idx,
+                         mkavl_item_fn item_fn, mkavl_rc_e *retval)
+{
+    struct avl_table *avl_tree = tree_h->avl_tree_array[key_idx].tree;
+    struct avl_traverser avl_t;
+    mkavl_node_block_st *block;
+    struct avl_node *p, *q;
+    void *item;
+    mkavl_rc_e rc;
+
+    if (tree_h->opts.persistent) {
+        if (NULL != item_fn) {
+            for (item = avl_t_first(&avl_t, avl_tree); NULL != item;
+                 item = avl_t_next(&avl_t)) {
+                rc = item_fn(item, tree_h->context);
+                if (mkavl_rc_e_is_notok(rc)) {
+                    *retval = rc;
+                }
+            }
+        }
+        mkavl_node_release(avl_tree, avl_tree->avl_root);
+        p = NULL;
+    } else if (tree_h->opts.pooled_nodes && (NULL == item_fn)) {
+        /* Nothing to visit, the nodes go away with their slabs */
+        p = NULL;
+    } else {
+        p = avl_tree->avl_root;
+    }
+
+    for (; NULL != p; p = q) {
+        if (NULL != p->avl_link[0]) {
+            q = p->avl_link[0];
+            p->avl_link[0] = q->avl_link[1];
+            q->avl_link[1] = p;
+            continue;
+        }
+        q = p->avl_link[1];
+
+        if (NULL != item_fn) {
+            rc = item_fn(p->avl_data, tree_h->context);
+            if (mkavl_rc_e_is_notok(rc)) {
+                *retval = rc;
+            }
+        }
+
+        if (tree_h->opts.pooled_nodes) {
+            continue;
+        }
+
+        if (tree_h->opts.intrusive_nodes) {
+            block = mkavl_node_block_from_node(tree_h, p, key_idx);
+            mkavl_assert_abort(block->link_count > 0);
+            --(block->link_count);
+            mkavl_node_block_release(tree_h, block);
+        } else {
+            avl_tree->avl_alloc->libavl_free(avl_tree->avl_alloc, p);
+        }
+    }
+
+    avl_tree->avl_root = NULL;
+    avl_tree->avl_count = 0;
+    ++(avl_tree->avl_generation);
+}
+
+/**
+ * Create a new mkavl tree composed of AVL trees using the given array of
+ * comparison functions.
+ *
+ * @see mkavl_delete
+ * @param tree_h A pointer to the memory location for the new tree.
+ * @param compare_fn_array An array of size compare_fn_array_count of the
+ * comparison functions for the mkavl.  This allows the same set of data items
+ * to be stored in different orders by mulitple keys.  A deep copy of the
+ * functions is made for the tree_h.  There must be at least one function passed
+ * in.
+ * @param compare_fn_array_count The size of the compare_fn_array.
+ * @param context An opaque context passed back to the client in callbacks.
+ * @param allocator The memory allocation functions to use for the tree, or NULL
+ * if the default functions are to be used.
+ * @return The return value
+ */
+mkavl_rc_e
+mkavl_new (mkavl_tree_handle *tree_h,
+           mkavl_compare_fn *compare_fn_array, 
+           size_t compare_fn_array_count, 
+           void *context, mkavl_allocator_st *allocator)
+{
+    return (mkavl_new_opts(tree_h, compare_fn_array, compare_fn_array_count,
+                           context, allocator, NULL));
+}
+
+/**
+ * Create a new mkavl tree as with mkavl_new(), additionally specifying
+ * options for how the tree is stored.
+ *
+ * @see mkavl_new
+ * @see mkavl_opts_st
+ * @param tree_h A pointer to the memory location for the new tree.
+ * @param compare_fn_array An array of size compare_fn_array_count of the
+ * comparison functions for the mkavl.
+ * @param compare_fn_array_count The size of the compare_fn_array.
+ * @param context An opaque context passed back to the client in callbacks.
+ * @param allocator The memory allocation functions to use for the tree, or NULL
+ * if the default functions are to be used.
+ * @param opts The options for the tree, or NULL for the defaults.  A copy of
+ * the options is made for the tree.
+ * @return The return value
+ */
+mkavl_rc_e
+mkavl_new_opts (mkavl_tree_handle *tree_h,
+                mkavl_compare_fn *compare_fn_array, 
+                size_t compare_fn_array_count, 
+                void *context, mkavl_allocator_st *allocator,
+                const mkavl_opts_st *opts)
+{
+    mkavl_allocator_st *local_allocator;
+    mkavl_tree_handle local_tree_h;
+    mkavl_avl_ctx_st *avl_ctx = NULL;
+    struct avl_table *avl_tree;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
+    uint32_t i;
+
+    if ((NULL == tree_h) || (NULL == compare_fn_array) ||
+        (0 == compare_fn_array_count)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *tree_h = NULL;
+
+    /* Nodes shared between trees can be neither in a block nor in a pool */
+    if ((NULL != opts) && opts->persistent &&
+        (opts->intrusive_nodes || opts->pooled_nodes ||
+         opts->lockless_reads)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    /* Nor can they be counted against the memory of any one tree */
+    if ((NULL != opts) && opts->persistent && opts->track_memory) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if ((NULL != opts) && (NULL != opts->workers) &&
+        (0 == mkavl_workers_count(opts->workers))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    local_allocator = 
+        (NULL == allocator) ? &mkavl_allocator_default : allocator;
+
+    local_tree_h = local_allocator->malloc_fn(sizeof(*local_tree_h), context);
+    if (NULL == local_tree_h) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+
+    local_tree_h->context = context;
+    memcpy(&(local_tree_h->allocator.avl_allocator), &mkavl_allocator_wrapper,
+           sizeof(local_tree_h->allocator.avl_allocator));
+    memcpy(&(local_tree_h->allocator.mkavl_allocator), local_allocator,
+           sizeof(local_tree_h->allocator.mkavl_allocator));
+    local_tree_h->allocator.tree_h = local_tree_h;
+    local_tree_h->allocator.magic = MKAVL_CTX_MAGIC;
+    memcpy(&(local_tree_h->node_allocator), &(local_tree_h->allocator),
+           sizeof(local_tree_h->node_allocator));
+    memcpy(&(local_tree_h->node_allocator.avl_allocator),
+           &mkavl_node_allocator_wrapper,
+           sizeof(local_tree_h->node_allocator.avl_allocator));
+    local_tree_h->avl_tree_count = compare_fn_array_count;
+    local_tree_h->avl_tree_array = NULL;
+    local_tree_h->item_count = 0;
+    local_tree_h->block_pool.magic = MKAVL_CTX_STALE;
+    local_tree_h->aggregate_array = NULL;
+    local_tree_h->node_size = sizeof(struct avl_node);
+    memset(&(local_tree_h->opts), 0, sizeof(local_tree_h->opts));
+    local_tree_h->lockless = NULL;
+    local_tree_h->read_only = false;
+    local_tree_h->wal = NULL;
+    local_tree_h->stats = NULL;
+    local_tree_h->stats_stripe_len = 0;
+    local_tree_h->stats_stripe_cnt = 0;
+    local_tree_h->block_count = 0;
+    local_tree_h->mem_live = 0;
+    local_tree_h->mem_high_water = 0;
+    if (NULL != opts) {
+        memcpy(&(local_tree_h->opts), opts, sizeof(local_tree_h->opts));
+        local_tree_h->opts.aggregate_array = NULL;
+    }
+
+    if (local_tree_h->opts.lockless_reads) {
+        /* Readers may stray onto freed nodes, so their memory must stay */
+        local_tree_h->opts.thread_safe = true;
+        local_tree_h->opts.pooled_nodes = true;
+    }
+
+    if (local_tree_h->opts.thread_safe) {
+        rc = mkavl_lock_init(local_tree_h);
+        if (mkavl_rc_e_is_notok(rc)) {
+            local_tree_h->opts.thread_safe = false;
+            goto err_exit;
+        }
+    }
+
+    if (local_tree_h->opts.lockless_reads) {
+        local_tree_h->lockless =
+            local_allocator->malloc_fn(sizeof(*(local_tree_h->lockless)),
+                                       context);
+        if (NULL == local_tree_h->lockless) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto err_exit;
+        }
+        memset(local_tree_h->lockless, 0, sizeof(*(local_tree_h->lockless)));
+    }
+
+    local_tree_h->avl_tree_array = 
+        local_allocator->malloc_fn(local_tree_h->avl_tree_count * 
+                                   sizeof(*(local_tree_h->avl_tree_array)),
+                                   context);
+    if (NULL == local_tree_h->avl_tree_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+
+    for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
+        local_tree_h->avl_tree_array[i].tree = NULL;
+        local_tree_h->avl_tree_array[i].node_pool.magic = MKAVL_CTX_STALE;
+        local_tree_h->avl_tree_array[i].compare_fn = compare_fn_array[i];
+        if (NULL == local_tree_h->avl_tree_array[i].compare_fn) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto err_exit;
+        }
+        local_tree_h->avl_tree_array[i].avl_ctx = NULL;
+        local_tree_h->avl_tree_array[i].iter_count = 0;
+    }
+
+    if ((NULL != opts) && (NULL != opts->aggregate_array)) {
+        rc = mkavl_aggregate_array_init(local_tree_h, opts->aggregate_array);
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto err_exit;
+        }
+    }
+
+    for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
+        avl_ctx = local_allocator->malloc_fn(sizeof(*avl_ctx), context);
+        if (NULL == avl_ctx) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto err_exit;
+        }
+        avl_ctx->magic = MKAVL_CTX_STALE;
+
+        local_tree_h->avl_tree_array[i].tree = 
+            avl_create(mkavl_compare_wrapper, avl_ctx,
+                       &(local_tree_h->allocator.avl_allocator));
+        if (NULL == local_tree_h->avl_tree_array[i].tree) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto err_exit;
+        }
+
+        avl_ctx->tree_h = local_tree_h;
+        avl_ctx->key_idx = i;
+        avl_ctx->magic = MKAVL_CTX_MAGIC;
+        local_tree_h->avl_tree_array[i].avl_ctx = avl_ctx;
+        avl_ctx = NULL;
+
+        avl_tree = local_tree_h->avl_tree_array[i].tree;
+        if (mkavl_aggregate_is_kept(local_tree_h, i)) {
+            avl_tree->avl_update = mkavl_avl_update;
+            avl_tree->avl_node_size =
+                (sizeof(struct avl_node) + sizeof(int64_t));
+        }
+
+        if (local_tree_h->opts.persistent) {
+            /* Each node ends with the count of the links to it */
+            avl_tree->avl_node_size += sizeof(uint32_t);
+            avl_tree->avl_unshare = mkavl_avl_unshare;
+            avl_tree->avl_alloc =
+                &(local_tree_h->node_allocator.avl_allocator);
+        }
+
+        if (local_tree_h->opts.pooled_nodes &&
+            !local_tree_h->opts.intrusive_nodes) {
+            mkavl_pool_init(&(local_tree_h->avl_tree_array[i].node_pool),
+                            local_tree_h, avl_tree->avl_node_size);
+            avl_tree->avl_alloc =
+                &(local_tree_h->avl_tree_array[i].node_pool.avl_allocator);
+        }
+    }
+
+    if (local_tree_h->opts.pooled_nodes &&
+        local_tree_h->opts.intrusive_nodes) {
+        mkavl_pool_init(&(local_tree_h->block_pool), local_tree_h,
+                        mkavl_node_block_size(local_tree_h));
+    }
+
+    if (local_tree_h->opts.stats) {
+        rc = mkavl_stats_init(local_tree_h);
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto err_exit;
+        }
+    }
+
+    /* The AVL trees were counted as libavl allocated them */
+    mkavl_mem_add(local_tree_h, (mkavl_memory_tree_bytes(local_tree_h) +
+                                 (local_tree_h->avl_tree_count *
+                                  sizeof(mkavl_avl_ctx_st))));
+
+    if (!mkavl_tree_is_valid(local_tree_h)) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto err_exit;
+    }
+
+    *tree_h = local_tree_h;
+
+    return (rc);
+
+err_exit:
+
+    if (NULL != local_tree_h) {
+        err_rc = mkavl_delete_tree(&local_tree_h);
+        mkavl_assert_abort(mkavl_rc_e_is_ok(err_rc));
+    }
+
+    if (NULL != avl_ctx) {
+        /* Ownership of this memory hasn't been transferred to a tree yet */
+        local_allocator->free_fn(avl_ctx, context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Get the context pointer for the tree.
+ *
+ * @see mkavl_new
+ * @param tree_h The tree whose context to get.  This must be a valid, non-NULL
+ * tree pointer or else a crash will occur.
+ * @return The tree's context (possibly NULL if that was passed to mkavl_new()).
+ */
+void *
+mkavl_get_tree_context (mkavl_tree_handle tree_h)
+{
+    mkavl_assert_abort(mkavl_tree_is_valid(tree_h));
+
+    return (tree_h->context);
+}
+
+/**
+ * Get the allocator of the tree, for memory that belongs with the tree but is
+ * kept outside it, such as the buffers of a write-ahead log replay.
+ *
+ * @see mkavl_new
+ * @param tree_h The tree.
+ * @return The allocator given to mkavl_new(), or the default one if none was
+ * given.  NULL is returned if the tree is not valid.
+ */
+const mkavl_allocator_st *
+mkavl_get_allocator (mkavl_tree_handle tree_h)
+{
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (NULL);
+    }
+
+    return (&(tree_h->allocator.mkavl_allocator));
+}
+
+/**
+ * Get the number of keys of the tree.
+ *
+ * @param tree_h The tree.
+ * @return The number of keys, or 0 if the tree is not valid.
+ */
+size_t
+mkavl_get_key_count (mkavl_tree_handle tree_h)
+{
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (0);
+    }
+
+    return (tree_h->avl_tree_count);
+}
+
+/**
+ * Attach a write-ahead log to the tree, or detach it.  Each change to the
+ * tree is then logged, and the call that made it waits for the record to be
+ * written as the sync mode of the log asks.  One log serves one tree, and no
+ * change may be in progress when it is detached.  Copies and snapshots of the
+ * tree are not logged.
+ *
+ * @see mkavl_wal_new
+ * @param tree_h The tree.
+ * @param wal_h The log, or NULL to stop logging.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned for a snapshot.
+ */
+mkavl_rc_e
+mkavl_set_wal (mkavl_tree_handle tree_h, mkavl_wal_handle wal_h)
+{
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_write_lock(tree_h);
+    tree_h->wal = wal_h;
+    mkavl_write_unlock(tree_h);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the height of an AVL tree by descending along the taller subtree of each
+ * node, as told by its balance.  This is O(lg N) for N items.
+ *
+ * @param avl_tree The AVL tree.
+ * @return The number of nodes on the longest path from the root to a leaf.
+ */
+static uint32_t
+mkavl_avl_height (const struct avl_table *avl_tree)
+{
+    const struct avl_node *node;
+    uint32_t height = 0;
+
+    for (node = avl_tree->avl_root; NULL != node;
+         node = node->avl_link[(node->avl_balance > 0)]) {
+        ++height;
+    }
+
+    return (height);
+}
+
+/**
+ * Sum a counter of the tree over its stripes.
+ *
+ * @param tree_h The tree, which keeps stats.
+ * @param stat The index of the counter within a stripe.
+ * @return The count.
+ */
+static uint64_t
+mkavl_stats_sum (mkavl_tree_handle tree_h, size_t stat)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < tree_h->stats_stripe_cnt; ++i) {
+        sum += __atomic_load_n(&(tree_h->stats[(i * tree_h->stats_stripe_len) +
+                                               stat]), __ATOMIC_RELAXED);
+    }
+
+    return (sum);
+}
+
+/**
+ * Get the counters of a tree created with the stats option.  Counts made by
+ * other threads while this runs may or may not be included.
+ *
+ * @see mkavl_opts_st
+ * @param tree_h The tree.
+ * @param stats Filled in with the counters of the tree.  May be NULL.
+ * @param key_stats_array Filled in with the counters of each key, starting
+ * with key 0.  May be NULL.
+ * @param key_stats_cnt The size of key_stats_array.  Only the first
+ * key_stats_cnt keys are filled in if the tree has more.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the tree keeps no
+ * stats.
+ */
+mkavl_rc_e
+mkavl_get_stats (mkavl_tree_handle tree_h, mkavl_stats_st *stats,
+                 mkavl_key_stats_st *key_stats_array, size_t key_stats_cnt)
+{
+    mkavl_key_stats_st *key_stats;
+    size_t i, base;
+    uint32_t type;
+
+    if (!mkavl_tree_is_valid(tree_h) || (NULL == tree_h->stats)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if ((NULL == key_stats_array) ||
+        (key_stats_cnt > tree_h->avl_tree_count)) {
+        key_stats_cnt = (NULL == key_stats_array) ? 0 : tree_h->avl_tree_count;
+    }
+
+    mkavl_read_lock(tree_h);
+
+    if (NULL != stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->add_cnt = mkavl_stats_sum(tree_h, MKAVL_STAT_E_ADD);
+        stats->remove_cnt = mkavl_stats_sum(tree_h, MKAVL_STAT_E_REMOVE);
+        for (type = MKAVL_FIND_TYPE_E_FIRST; type < MKAVL_FIND_TYPE_E_MAX;
+             ++type) {
+            stats->find_cnt[type] =
+                mkavl_stats_sum(tree_h, (MKAVL_STAT_E_FIND + type));
+        }
+        stats->alloc_cnt = mkavl_stats_sum(tree_h, MKAVL_STAT_E_ALLOC);
+        stats->alloc_bytes = mkavl_stats_sum(tree_h, MKAVL_STAT_E_ALLOC_BYTES);
+        stats->free_cnt = mkavl_stats_sum(tree_h, MKAVL_STAT_E_FREE);
+    }
+
+    for (i = 0; i < key_stats_cnt; ++i) {
+        key_stats = &(key_stats_array[i]);
+        base = (MKAVL_STAT_E_MAX + (i * MKAVL_KEY_STAT_E_MAX));
+        memset(key_stats, 0, sizeof(*key_stats));
+        key_stats->cmp_cnt =
+            mkavl_stats_sum(tree_h, (base + MKAVL_KEY_STAT_E_CMP));
+        key_stats->rotation_cnt =
+            tree_h->avl_tree_array[i].tree->avl_rotations;
+        key_stats->find_cnt =
+            mkavl_stats_sum(tree_h, (base + MKAVL_KEY_STAT_E_FIND));
+        key_stats->find_visit_cnt =
+            mkavl_stats_sum(tree_h, (base + MKAVL_KEY_STAT_E_FIND_VISIT));
+        key_stats->iter_refresh_cnt =
+            mkavl_stats_sum(tree_h, (base + MKAVL_KEY_STAT_E_ITER_REFRESH));
+        key_stats->height = mkavl_avl_height(tree_h->avl_tree_array[i].tree);
+    }
+
+    mkavl_unlock(tree_h);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Set the counters of a tree created with the stats option back to zero.
+ * Counts made by other threads while this runs may be lost.
+ *
+ * @see mkavl_get_stats
+ * @param tree_h The tree.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the tree keeps no
+ * stats.
+ */
+mkavl_rc_e
+mkavl_reset_stats (mkavl_tree_handle tree_h)
+{
+    size_t i, cnt;
+
+    if (!mkavl_tree_is_valid(tree_h) || (NULL == tree_h->stats)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_write_lock(tree_h);
+
+    cnt = (tree_h->stats_stripe_cnt * tree_h->stats_stripe_len);
+    for (i = 0; i < cnt; ++i) {
+        __atomic_store_n(&(tree_h->stats[i]), 0, __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        tree_h->avl_tree_array[i].tree->avl_rotations = 0;
+    }
+
+    mkavl_write_unlock(tree_h);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Set the hook given trace events by all the trees of the process, in place
+ * of any hook set before.  With no hook set, each traced point costs a load
+ * and a branch.  The hook is not copied: it, and its context, must stay valid
+ * until calls that may have loaded it have returned, even after another hook
+ * is set.
+ *
+ * @see mkavl_trace_event_e
+ * @param hook The hook, or NULL to stop tracing.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the hook has no
+ * function.
+ */
+mkavl_rc_e
+mkavl_set_trace_hook (const mkavl_trace_hook_st *hook)
+{
+    if ((NULL != hook) && (NULL == hook->trace_fn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    __atomic_store_n(&mkavl_trace_hook, hook, __ATOMIC_RELEASE);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the memory used by a tree, in total and for each key.  The counts are
+ * worked out from the number of nodes of each key and the slabs of the node
+ * pools, so they are exact for what the tree asks of the allocator but do not
+ * include any overhead of the allocator itself.  A persistent tree counts the
+ * nodes it shares with its copies and snapshots as its own.  If the tree
+ * tracks memory, the bytes it holds as counted by its allocator wrapper and
+ * their high-water mark are given as well.
+ *
+ * @see mkavl_opts_st
+ * @param tree_h The tree.
+ * @param memory Filled in with the memory of the tree.  May be NULL.
+ * @param key_memory_array Filled in with the memory of each key, starting
+ * with key 0.  May be NULL.
+ * @param key_memory_cnt The size of key_memory_array.  Only the first
+ * key_memory_cnt keys are filled in if the tree has more.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_memory_usage (mkavl_tree_handle tree_h, mkavl_memory_st *memory,
+                    mkavl_key_memory_st *key_memory_array,
+                    size_t key_memory_cnt)
+{
+    mkavl_key_memory_st key_memory;
+    struct avl_table *avl_tree;
+    size_t hdr_size = 0;
+    uint64_t node_bytes;
+    size_t i;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (NULL == key_memory_array) {
+        key_memory_cnt = 0;
+    }
+
+    if (tree_h->opts.track_memory) {
+        hdr_size = sizeof(mkavl_mem_hdr_st);
+    }
+
+    mkavl_read_lock(tree_h);
+
+    if (NULL != memory) {
+        memset(memory, 0, sizeof(*memory));
+    }
+
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        avl_tree = tree_h->avl_tree_array[i].tree;
+
+        memset(&key_memory, 0, sizeof(key_memory));
+        key_memory.header_bytes =
+            (sizeof(*avl_tree) + hdr_size + sizeof(mkavl_avl_ctx_st));
+        key_memory.iter_bytes =
+            (__atomic_load_n(&(tree_h->avl_tree_array[i].iter_count),
+                             __ATOMIC_RELAXED) * sizeof(mkavl_iterator_st));
+        if (tree_h->opts.intrusive_nodes) {
+            /* The share of the key in the node blocks */
+            key_memory.node_bytes = (avl_count(avl_tree) * tree_h->node_size);
+        } else if (tree_h->opts.pooled_nodes) {
+            key_memory.node_bytes =
+                (avl_count(avl_tree) * avl_tree->avl_node_size);
+            key_memory.slack_bytes =
+                (mkavl_pool_bytes(&(tree_h->avl_tree_array[i].node_pool)) -
+                 key_memory.node_bytes);
+        } else {
+            key_memory.node_bytes =
+                (avl_count(avl_tree) * avl_tree->avl_node_size);
+            key_memory.slack_bytes = (avl_count(avl_tree) * hdr_size);
+        }
+
+        if (i < key_memory_cnt) {
+            memcpy(&(key_memory_array[i]), &key_memory, sizeof(key_memory));
+        }
+
+        if (NULL != memory) {
+            memory->node_bytes += key_memory.node_bytes;
+            memory->header_bytes += key_memory.header_bytes;
+            memory->iter_bytes += key_memory.iter_bytes;
+            memory->slack_bytes += key_memory.slack_bytes;
+        }
+    }
+
+    if (NULL != memory) {
+        memory->header_bytes += mkavl_memory_tree_bytes(tree_h);
+        if (tree_h->opts.intrusive_nodes) {
+            /* Whole blocks, with their headers and any nodes left unlinked */
+            node_bytes = (tree_h->block_count * mkavl_node_block_size(tree_h));
+            memory->node_bytes = node_bytes;
+            if (tree_h->opts.pooled_nodes) {
+                memory->slack_bytes +=
+                    (mkavl_pool_bytes(&(tree_h->block_pool)) - node_bytes);
+            }
+        }
+        memory->total_bytes = (memory->node_bytes + memory->header_bytes +
+                               memory->iter_bytes + memory->slack_bytes);
+        memory->live_bytes =
+            __atomic_load_n(&(tree_h->mem_live), __ATOMIC_RELAXED);
+        memory->high_water_bytes =
+            __atomic_load_n(&(tree_h->mem_high_water), __ATOMIC_RELAXED);
+    }
+
+    mkavl_unlock(tree_h);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Serialize the item of a change for its record before the change is made,
+ * if the tree has a log, so that a change that cannot be logged is not made.
+ *
+ * @param tree_h The tree.
+ * @param item The item to log, or NULL if the change will change nothing.
+ * @return The return code.  If not successful, the tree must not be changed.
+ * MKAVL_RC_E_EINVAL is returned if the log has failed.
+ */
+static mkavl_rc_e
+mkavl_prepare_change (mkavl_tree_handle tree_h, const void *item)
+{
+    if ((NULL == tree_h->wal) || (NULL == item)) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    return (mkavl_wal_prepare(tree_h->wal, item, tree_h->context));
+}
+
+/**
+ * Serialize the item a removal will remove from an AVL tree before it is
+ * removed, if the tree has a log.
+ *
+ * @see mkavl_prepare_change
+ * @param tree_h The tree.
+ * @param key_idx The AVL tree from which the item will be removed.
+ * @param item_to_remove The item being removed.
+ * @return The return code.  If not successful, the tree must not be changed.
+ */
+static mkavl_rc_e
+mkavl_prepare_remove (mkavl_tree_handle tree_h, size_t key_idx,
+                      const void *item_to_remove)
+{
+    if (NULL == tree_h->wal) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    return (mkavl_prepare_change(tree_h,
+                                 avl_find(tree_h->avl_tree_array[key_idx].tree,
+                                          item_to_remove)));
+}
+
+/**
+ * Log a change just made to the tree if it has a log, with the item from
+ * mkavl_prepare_change().  This is called with the lock of the tree held, so
+ * that the records are in the order of the changes.
+ *
+ * @param tree_h The tree.
+ * @param op The change.
+ * @param key_idx The key, for the changes to a single key.
+ * @param wal_h Set to the log to wait on, or NULL if there is none.
+ * @param lsn Set to the LSN of the record.
+ * @return The return code.  MKAVL_RC_E_EIO means the change is made but is
+ * not logged.
+ */
+static mkavl_rc_e
+mkavl_log_change (mkavl_tree_handle tree_h, mkavl_wal_op_e op, size_t key_idx,
+                  mkavl_wal_handle *wal_h, uint64_t *lsn)
+{
+    *wal_h = tree_h->wal;
+    *lsn = 0;
+    if (NULL == tree_h->wal) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    return (mkavl_wal_append(tree_h->wal, op, key_idx, lsn));
+}
+
+/**
+ * Wait for the record of a change to be written, once the lock of the tree is
+ * released.
+ *
+ * @param wal_h The log to wait on, or NULL if the change was not logged.
+ * @param lsn The LSN of the record.
+ * @param rc The return code of the change.
+ * @return The return code of the change, or of the log if the change
+ * succeeded.  MKAVL_RC_E_EIO means the change was made but may not be
+ * durable, and the log takes no more records.
+ */
+static mkavl_rc_e
+mkavl_commit_change (mkavl_wal_handle wal_h, uint64_t lsn, mkavl_rc_e rc)
+{
+    if (mkavl_rc_e_is_notok(rc) || (NULL == wal_h) || (0 == lsn)) {
+        return (rc);
+    }
+
+    return (mkavl_wal_commit(wal_h, lsn));
+}
+
+/**
+ * The destroys the tree that was allocated by mkavl_new.  Note that this
+ * doesn't actually free the data of the items as that is left to the client.
+ * The item_fn parameter can be used for this purpose.  Upon return, the tree_h
+ * memory is set to NULL.  This is O(N) for N items.
+ *
+ * @see mkavl_new
+ * @see mkavl_delete_tree
+ * @param tree_h A pointer the the tree to free.
+ * @param item_fn This function is applied to each item after it has been
+ * removed from all the AVL trees.  This is only called once per item regardless
+ * of how many AVL trees there are.  E.g., this could be the function to free
+ * the memory for the data.  If NULL, no function is applied.
+ * @param delete_context_fn This function is applied to the tree's opaque client
+ * context that was given via mkavl_new().  E.g., this could free the client
+ * context if it was a heap memory pointer.  If NULL, no function is applied.
+ * If given, the function will be called even if the client context is NULL.
+ * This function is called after all the items have been deleted and item
+ * functions called.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_delete (mkavl_tree_handle *tree_h, mkavl_item_fn item_fn,
+              mkavl_delete_context_fn delete_context_fn)
+{
+    mkavl_tree_handle local_tree_h;
+    uint32_t i;
+    void *context;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+    mkavl_rc_e retval = MKAVL_RC_E_SUCCESS;
+    MKAVL_LATENCY_START(start);
+
+    if (NULL == tree_h) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_tree_h = *tree_h;
+
+    if (!mkavl_tree_is_valid(local_tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    /* No reader remains, so retired items can all go */
+    if (NULL != local_tree_h->lockless) {
+        rc = mkavl_retired_release(local_tree_h,
+                 mkavl_retired_take(local_tree_h->lockless, true));
+        if (mkavl_rc_e_is_notok(rc)) {
+            retval = rc;
+        }
+    }
+
+    /* 
+     * All trees should have the same set of data, just in different orders.
+     * Empty all but the first one, then apply the item function while emptying
+     * the first so each item has been removed everywhere when it is called.
+     */
+    for (i = (local_tree_h->avl_tree_count - 1); i > 0; --i) {
+        mkavl_avl_destroy_nodes(local_tree_h, i, NULL, &retval);
+    }
+    mkavl_avl_destroy_nodes(local_tree_h, 0, item_fn, &retval);
+    local_tree_h->item_count = 0;
+
+    context = local_tree_h->context;
+
+    rc = mkavl_delete_tree(tree_h);
+    mkavl_assert_abort(mkavl_rc_e_is_ok(rc));
+
+    if (NULL != delete_context_fn) {
+        rc = delete_context_fn(context);
+        if (mkavl_rc_e_is_notok(rc)) {
+            retval = rc;
+        }
+    }
+    MKAVL_LATENCY_END(MKAVL_LATENCY_OP_E_DELETE, start);
+
+    return (retval);
+}
+
+/**
+ * Prototype for the work done on one key of a tree by mkavl_for_each_key().
+ *
+ * @param tree_h The tree.
+ * @param key_idx The index of the key.
+ * @param context The context given to mkavl_for_each_key().
+ * @return The return code
+ */
+typedef mkavl_rc_e
+(*mkavl_key_fn)(mkavl_tree_handle tree_h, size_t key_idx, void *context);
+
+/**
+ * The task of one key of mkavl_for_each_key().
+ */
+typedef struct mkavl_key_task_st_ {
+    /** The task given to the workers */
+    mkavl_task_st task;
+    /** The tree */
+    mkavl_tree_handle tree_h;
+    /** The index of the key */
+    size_t key_idx;
+    /** The work to do on the key */
+    mkavl_key_fn key_fn;
+    /** The context given to key_fn */
+    void *context;
+    /** The return code of key_fn */
+    mkavl_rc_e rc;
+} mkavl_key_task_st;
+
+/**
+ * Run the task of one key of mkavl_for_each_key().
+ *
+ * @param task_context The mkavl_key_task_st.
+ */
+static void
+mkavl_key_task_run (void *task_context)
+{
+    mkavl_key_task_st *key_task = task_context;
+
+    key_task->rc = key_task->key_fn(key_task->tree_h, key_task->key_idx,
+                                    key_task->context);
+}
+
+/**
+ * Do some work on every key of a tree.  With workers in the options of the
+ * tree, the keys are worked on in parallel, one task per key, else one after
+ * another on the calling thread.
+ *
+ * @param tree_h The tree.
+ * @param key_fn The work to do on each key.
+ * @param context The context given to key_fn.
+ * @return The return code of the first key whose work failed, if any.  The
+ * work is done on every key either way.
+ */
+static mkavl_rc_e
+mkavl_for_each_key (mkavl_tree_handle tree_h, mkavl_key_fn key_fn,
+                    void *context)
+{
+    mkavl_key_task_st key_task_array[tree_h->avl_tree_count];
+    mkavl_task_group_st group = MKAVL_TASK_GROUP_INIT;
+    size_t i;
+
+    for (i = 0; i < NELEMS(key_task_array); ++i) {
+        key_task_array[i].tree_h = tree_h;
+        key_task_array[i].key_idx = i;
+        key_task_array[i].key_fn = key_fn;
+        key_task_array[i].context = context;
+        key_task_array[i].rc = MKAVL_RC_E_SUCCESS;
+        mkavl_workers_spawn(tree_h->opts.workers, &group,
+                            &(key_task_array[i].task), mkavl_key_task_run,
+                            &(key_task_array[i]));
+    }
+    mkavl_workers_wait(tree_h->opts.workers, &group);
+
+    for (i = 0; i < NELEMS(key_task_array); ++i) {
+        if (mkavl_rc_e_is_notok(key_task_array[i].rc)) {
+            return (key_task_array[i].rc);
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * The nodes of mkavl_build_unlocked() from which each AVL tree is built.
+ */
+typedef struct mkavl_build_st_ {
+    /** For each key in turn, item_cnt nodes in order */
+    struct avl_node **node_array;
+    /** The number of items */
+    size_t item_cnt;
+} mkavl_build_st;
+
+/**
+ * Build the AVL tree of one key from its nodes.
+ *
+ * @param tree_h The tree.
+ * @param key_idx The index of the key.
+ * @param context The mkavl_build_st.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_build_key (mkavl_tree_handle tree_h, size_t key_idx, void *context)
+{
+    mkavl_build_st *build = context;
+
+    avl_build(tree_h->avl_tree_array[key_idx].tree,
+              &(build->node_array[key_idx * build->item_cnt]),
+              build->item_cnt);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Build every AVL tree of an empty mkavl tree from an array of items whose order
+ * by each key is already known.  The nodes are all allocated first and each AVL
+ * tree is then built bottom-up as a perfectly balanced tree in O(N) time, so
+ * either all the items are added or none are.  The nodes are allocated on the
+ * calling thread, while the AVL trees are built on the workers of the tree, if
+ * any.
+ *
+ * @param tree_h The tree, which must be empty.
+ * @param item_array The items to add, none of them equal by any key.  If
+ * pos_array is NULL, the items are instead given in increasing order by each
+ * key in turn, item_cnt of them per key.
+ * @param item_cnt The number of items to add, at least one.
+ * @param pos_array For each key in turn, item_cnt positions into item_array
+ * giving the items in increasing order by that key, or NULL as above.  Must be
+ * given for intrusive nodes, so that each item gets a single node block.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_build_unlocked (mkavl_tree_handle tree_h, void **item_array,
+                      size_t item_cnt, const size_t *pos_array)
+{
+    mkavl_allocator_st *allocator;
+    mkavl_node_block_st **block_array = NULL;
+    struct avl_node **node_array = NULL;
+    mkavl_build_st build;
+    struct avl_table *avl_tree;
+    struct avl_node *node;
+    size_t i, j, idx, key_cnt, node_cnt = 0;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    key_cnt = tree_h->avl_tree_count;
+    mkavl_assert_abort(!tree_h->opts.intrusive_nodes || (NULL != pos_array));
+    if (item_cnt > (SIZE_MAX / (key_cnt * sizeof(*node_array)))) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    allocator = &(tree_h->allocator.mkavl_allocator);
+    node_array = allocator->malloc_fn(
+                     (key_cnt * item_cnt * sizeof(*node_array)),
+                     tree_h->context);
+    if (NULL == node_array) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    if (tree_h->opts.intrusive_nodes) {
+        block_array = allocator->malloc_fn((item_cnt * sizeof(*block_array)),
+                                           tree_h->context);
+        if (NULL == block_array) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto cleanup;
+        }
+
+        for (node_cnt = 0; node_cnt < item_cnt; ++node_cnt) {
+            block_array[node_cnt] = mkavl_node_block_new(tree_h);
+            if (NULL == block_array[node_cnt]) {
+                rc = MKAVL_RC_E_ENOMEM;
+                goto cleanup;
+            }
+        }
+    }
+
+    for (i = 0; i < key_cnt; ++i) {
+        avl_tree = tree_h->avl_tree_array[i].tree;
+        for (j = 0; j < item_cnt; ++j) {
+            idx = (i * item_cnt) + j;
+            if (NULL != pos_array) {
+                idx = pos_array[idx];
+            }
+
+            if (tree_h->opts.intrusive_nodes) {
+                node = mkavl_node_block_node(tree_h, block_array[idx], i);
+            } else {
+                node = avl_tree->avl_alloc->libavl_malloc(
+                           avl_tree->avl_alloc, avl_tree->avl_node_size);
+                if (NULL == node) {
+                    rc = MKAVL_RC_E_ENOMEM;
+                    goto cleanup;
+                }
+                ++node_cnt;
+            }
+            node->avl_data = item_array[idx];
+            node_array[(i * item_cnt) + j] = node;
+        }
+    }
+
+    /* Nothing can fail from here on */
+    build.node_array = node_array;
+    build.item_cnt = item_cnt;
+    mkavl_lockless_write_begin(tree_h);
+    mkavl_for_each_key(tree_h, mkavl_build_key, &build);
+    if (tree_h->opts.intrusive_nodes) {
+        for (j = 0; j < item_cnt; ++j) {
+            block_array[j]->link_count = key_cnt;
+        }
+    }
+    tree_h->item_count = item_cnt;
+    mkavl_lockless_write_end(tree_h);
+    node_cnt = 0;
+
+cleanup:
+
+    if (tree_h->opts.intrusive_nodes) {
+        for (j = 0; j < node_cnt; ++j) {
+            mkavl_node_block_release(tree_h, block_array[j]);
+        }
+    } else {
+        for (j = 0; j < node_cnt; ++j) {
+            avl_tree = tree_h->avl_tree_array[j / item_cnt].tree;
+            avl_tree->avl_alloc->libavl_free(avl_tree->avl_alloc,
+                                             node_array[j]);
+        }
+    }
+
+    if (NULL != block_array) {
+        allocator->free_fn(block_array, tree_h->context);
+    }
+    allocator->free_fn(node_array, tree_h->context);
+
+    return (rc);
+}
+
+/**
+ * A source item of a copy and the position of its copy in the order of the
+ * first key, so that the position can be looked up by the item.
+ */
+typedef struct mkavl_copy_pos_st_ {
+    /** The item in the source tree */
+    const void *item;
+    /** The position of the copy of the item */
+    size_t pos;
+} mkavl_copy_pos_st;
+
+/**
+ * Order copy positions by the address of their source item.
+ *
+ * @param a The first mkavl_copy_pos_st.
+ * @param b The second mkavl_copy_pos_st.
+ * @return Less than, equal to or greater than zero as a is before, the same as
+ * or after b.
+ */
+static int
+mkavl_copy_pos_cmp (const void *a, const void *b)
+{
+    uintptr_t item_a = (uintptr_t) ((const mkavl_copy_pos_st *) a)->item;
+    uintptr_t item_b = (uintptr_t) ((const mkavl_copy_pos_st *) b)->item;
+
+    return ((item_a > item_b) - (item_a < item_b));
+}
+
+/**
+ * The state of mkavl_copy_items() shared by the work on each key.
+ */
+typedef struct mkavl_copy_st_ {
+    /** The tree from which to copy */
+    mkavl_tree_handle source_tree_h;
+    /** The number of items */
+    size_t item_cnt;
+    /** The items in order by each key in turn, when they are not mapped */
+    void **item_array;
+    /** The positions of the copies in order by each key in turn, if mapped */
+    size_t *pos_array;
+    /** The position of the copy of each source item, by item address */
+    mkavl_copy_pos_st *copy_pos_array;
+} mkavl_copy_st;
+
+/**
+ * Take the items of one key of the source tree in order.
+ *
+ * @param tree_h The tree being filled.
+ * @param key_idx The index of the key.
+ * @param context The mkavl_copy_st.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_copy_walk_key (mkavl_tree_handle tree_h, size_t key_idx, void *context)
+{
+    mkavl_copy_st *copy = context;
+    struct avl_traverser avl_t;
+    size_t j = (key_idx * copy->item_cnt);
+    void *item;
+
+    for (item = avl_t_first(&avl_t,
+                            copy->source_tree_h->avl_tree_array[key_idx].tree);
+         NULL != item; item = avl_t_next(&avl_t)) {
+        copy->item_array[j++] = item;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Find the position of the copy of each item of one key of the source tree,
+ * other than the first key, whose positions are already known.
+ *
+ * @param tree_h The tree being filled.
+ * @param key_idx The index of the key.
+ * @param context The mkavl_copy_st.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_copy_map_key (mkavl_tree_handle tree_h, size_t key_idx, void *context)
+{
+    mkavl_copy_st *copy = context;
+    mkavl_copy_pos_st lookup, *found;
+    struct avl_traverser avl_t;
+    size_t j = (key_idx * copy->item_cnt);
+    void *item;
+
+    if (0 == key_idx) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    for (item = avl_t_first(&avl_t,
+                            copy->source_tree_h->avl_tree_array[key_idx].tree);
+         NULL != item; item = avl_t_next(&avl_t)) {
+        lookup.item = item;
+        found = bsearch(&lookup, copy->copy_pos_array, copy->item_cnt,
+                        sizeof(*(copy->copy_pos_array)), mkavl_copy_pos_cmp);
+        if (NULL == found) {
+            return (MKAVL_RC_E_EOOSYNC);
+        }
+        copy->pos_array[j++] = found->pos;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Fill an empty tree with copies of the items of another tree with the same
+ * keys, building each AVL tree balanced in O(N) time from the order of the
+ * source tree's AVL tree for the same key.  No key is compared.  When the items
+ * are not copied and nodes are not intrusive, the items of each key are simply
+ * taken in order.  Otherwise the items are copied in the order of the first
+ * key, and the copy of each item in the order of another key is found by the
+ * address of the source item, in O(N lg N) time.  The keys are walked on the
+ * workers of the tree, if any, but the items are copied on the calling thread.
+ *
+ * @param source_tree_h The tree from which to copy.
+ * @param tree_h The empty tree to fill.
+ * @param copy_fn If non-NULL, applied to each item to get the item to add,
+ * which must order as the item does by every key.
+ * @param item_fn If the copy fails, applied to each copy made so far.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_copy_items (mkavl_tree_handle source_tree_h, mkavl_tree_handle tree_h,
+                  mkavl_copy_fn copy_fn, mkavl_item_fn item_fn)
+{
+    mkavl_allocator_st *allocator = &(tree_h->allocator.mkavl_allocator);
+    mkavl_copy_pos_st *copy_pos_array = NULL;
+    mkavl_copy_st copy;
+    struct avl_traverser avl_t;
+    void **item_array = NULL;
+    size_t *pos_array = NULL;
+    size_t i, j, key_cnt, item_cnt, copy_cnt = 0;
+    bool is_mapped;
+    void *item;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    key_cnt = tree_h->avl_tree_count;
+    item_cnt = avl_count(source_tree_h->avl_tree_array[0].tree);
+    if (0 == item_cnt) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    for (i = 1; i < key_cnt; ++i) {
+        if (avl_count(source_tree_h->avl_tree_array[i].tree) != item_cnt) {
+            return (MKAVL_RC_E_EOOSYNC);
+        }
+    }
+
+    if (item_cnt > (SIZE_MAX / (key_cnt * sizeof(*pos_array)))) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    is_mapped = ((NULL != copy_fn) || tree_h->opts.intrusive_nodes);
+    if (!is_mapped) {
+        item_array = allocator->malloc_fn(
+                         (key_cnt * item_cnt * sizeof(*item_array)),
+                         tree_h->context);
+        if (NULL == item_array) {
+            return (MKAVL_RC_E_ENOMEM);
+        }
+
+        copy.source_tree_h = source_tree_h;
+        copy.item_cnt = item_cnt;
+        copy.item_array = item_array;
+        mkavl_for_each_key(tree_h, mkavl_copy_walk_key, &copy);
+
+        rc = mkavl_build_unlocked(tree_h, item_array, item_cnt, NULL);
+        goto cleanup;
+    }
+
+    item_array = allocator->malloc_fn((item_cnt * sizeof(*item_array)),
+                                      tree_h->context);
+    pos_array = allocator->malloc_fn((key_cnt * item_cnt * sizeof(*pos_array)),
+                                     tree_h->context);
+    copy_pos_array = allocator->malloc_fn(
+                         (item_cnt * sizeof(*copy_pos_array)),
+                         tree_h->context);
+    if ((NULL == item_array) || (NULL == pos_array) ||
+        (NULL == copy_pos_array)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+
+    for (item = avl_t_first(&avl_t, source_tree_h->avl_tree_array[0].tree);
+         NULL != item; item = avl_t_next(&avl_t)) {
+        copy_pos_array[copy_cnt].item = item;
+        copy_pos_array[copy_cnt].pos = copy_cnt;
+        if (NULL != copy_fn) {
+            item = copy_fn(item, source_tree_h->context);
+            if (NULL == item) {
+                rc = MKAVL_RC_E_ENOMEM;
+                goto cleanup;
+            }
+        }
+        item_array[copy_cnt] = item;
+        pos_array[copy_cnt] = copy_cnt;
+        ++copy_cnt;
+    }
+
+    qsort(copy_pos_array, item_cnt, sizeof(*copy_pos_array),
+          mkavl_copy_pos_cmp);
+
+    copy.source_tree_h = source_tree_h;
+    copy.item_cnt = item_cnt;
+    copy.pos_array = pos_array;
+    copy.copy_pos_array = copy_pos_array;
+    rc = mkavl_for_each_key(tree_h, mkavl_copy_map_key, &copy);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    rc = mkavl_build_unlocked(tree_h, item_array, item_cnt, pos_array);
+
+cleanup:
+
+    if (mkavl_rc_e_is_notok(rc) && (NULL != copy_fn) && (NULL != item_fn)) {
+        /* The copies never made it into the tree */
+        for (j = 0; j < copy_cnt; ++j) {
+            item_fn(item_array[j], tree_h->context);
+        }
+    }
+
+    if (NULL != copy_pos_array) {
+        allocator->free_fn(copy_pos_array, tree_h->context);
+    }
+    if (NULL != pos_array) {
+        allocator->free_fn(pos_array, tree_h->context);
+    }
+    if (NULL != item_array) {
+        allocator->free_fn(item_array, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Create a tree that shares every node of a persistent tree.  Only the link to
+ * the root of each AVL tree is copied, so this takes O(M) time for M keys.
+ *
+ * @param source_tree_h The persistent tree to share, which must be valid.
+ * @param new_tree_h A pointer to the memory location for the new tree.
+ * @param read_only Whether the new tree is a snapshot, which may not be changed
+ * and so takes no lock.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_share_unlocked (mkavl_tree_handle source_tree_h,
+                      mkavl_tree_handle *new_tree_h, bool read_only)
+{
+    mkavl_compare_fn cmp_fn_array[source_tree_h->avl_tree_count];
+    struct avl_table *source_avl_tree, *avl_tree;
+    mkavl_tree_handle local_tree_h;
+    mkavl_opts_st opts;
+    mkavl_rc_e rc;
+    uint32_t i;
+
+    for (i = 0; i < NELEMS(cmp_fn_array); ++i) {
+        cmp_fn_array[i] = source_tree_h->avl_tree_array[i].compare_fn;
+    }
+
+    memcpy(&opts, &(source_tree_h->opts), sizeof(opts));
+    if (read_only) {
+        opts.thread_safe = false;
+        opts.writer_preference = false;
+    }
+
+    rc = mkavl_new_opts(&local_tree_h, cmp_fn_array, NELEMS(cmp_fn_array),
+                        source_tree_h->context,
+                        &(source_tree_h->allocator.mkavl_allocator), &opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
+        source_avl_tree = source_tree_h->avl_tree_array[i].tree;
+        avl_tree = local_tree_h->avl_tree_array[i].tree;
+        avl_tree->avl_root = source_avl_tree->avl_root;
+        avl_tree->avl_count = source_avl_tree->avl_count;
+        if (NULL != avl_tree->avl_root) {
+            __atomic_add_fetch(mkavl_node_refs(avl_tree, avl_tree->avl_root),
+                               1, __ATOMIC_RELAXED);
+        }
+    }
+    local_tree_h->item_count = source_tree_h->item_count;
+    local_tree_h->read_only = read_only;
+
+    *new_tree_h = local_tree_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Take a snapshot of a persistent tree in O(M) time for M keys, however many
+ * items the tree holds.  The snapshot is a tree of its own that holds the
+ * items of the tree as they are now, and keeps them as the tree goes on
+ * changing.  It may be looked up, walked, iterated, copied and snapshotted by
+ * any number of threads without a lock, and is freed by mkavl_delete(), which
+ * must not be given an item function that frees items the tree still holds.
+ * Changing the snapshot fails with MKAVL_RC_E_EINVAL.
+ *
+ * @see mkavl_opts_st
+ * @param tree_h The tree, which must have been created with the persistent
+ * option.
+ * @param snapshot_h A pointer to the memory location for the snapshot.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_snapshot (mkavl_tree_handle tree_h, mkavl_tree_handle *snapshot_h)
+{
+    mkavl_rc_e rc;
+
+    if (NULL == snapshot_h) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *snapshot_h = NULL;
+
+    if (!mkavl_tree_is_valid(tree_h) || !tree_h->opts.persistent) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_share_unlocked(tree_h, snapshot_h, true);
+    mkavl_unlock(tree_h);
+
+    return (rc);
+}
+
+/**
+ * Deep copy a mkavl tree into a new tree.  Each AVL tree of the copy is built
+ * balanced from the order of the same AVL tree of the source, without
+ * comparing any keys, in O(M N) time for N items and M keys.  If copy_fn is
+ * given or the new tree uses intrusive nodes, matching the copies of each item
+ * across the keys adds O(M N lg N) pointer comparisons.
+ *
+ * @param source_tree_h The tree from which to copy.
+ * @param new_tree_h A pointer to the new tree to which the copy will be done.
+ * @param copy_fn A function that is applied to each item in the source tree
+ * before it is copied to the new tree.  This is applied once per item
+ * regardless of how many AVL trees there are.  E.g., this may allocate a deep
+ * copy of the data.  If NULL, then a shallow copy of the data is copied to the
+ * new tree.  Note that this function is called with the source tree's context
+ * value.
+ * @param item_fn If there is an error copying the new tree, this function is
+ * applied to all items in the new tree as it is destroyed.  E.g., this may be a
+ * function to free the data.
+ * @param use_source_context If true, the client context from source_tree_h is
+ * used for the new tree.  If false, new_context is used for the new tree.
+ * @param new_context The opaque client context to use for the new tree if
+ * user_source_context if false.
+ * @param delete_context_fn Upon an error, this function will be applied to the
+ * new_context if use_source_context is false.  If use_source_context is true,
+ * this is a no-op in the case of an error (will not call on the source tree's
+ * context).  If NULL, no function is applied.  If given, the function will be
+ * called even if the client context is NULL.
+ * @param allocator The memory allocation functions to use for the new tree.
+ * If the source tree is persistent and copy_fn and allocator are NULL and
+ * use_source_context is true, the new tree shares the nodes of the source tree
+ * in O(M) time for M keys instead of copying them.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_copy (mkavl_tree_handle source_tree_h, 
+            mkavl_tree_handle *new_tree_h,
+            mkavl_copy_fn copy_fn, mkavl_item_fn item_fn, 
+            bool use_source_context, void *new_context,
+            mkavl_delete_context_fn delete_context_fn,
+            mkavl_allocator_st *allocator)
+{
+    return (mkavl_copy_opts(source_tree_h, new_tree_h, copy_fn, item_fn,
+                            use_source_context, new_context,
+                            delete_context_fn, allocator, NULL));
+}
+
+/**
+ * The body of mkavl_copy_opts() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_copy_opts
+ */
+static mkavl_rc_e
+mkavl_copy_opts_unlocked (mkavl_tree_handle source_tree_h, 
+                          mkavl_tree_handle *new_tree_h,
+                          mkavl_copy_fn copy_fn, mkavl_item_fn item_fn, 
+                          bool use_source_context, void *new_context,
+                          mkavl_delete_context_fn delete_context_fn,
+                          mkavl_allocator_st *allocator,
+                          const mkavl_opts_st *opts)
+{
+    mkavl_tree_handle local_tree_h = NULL;
+    mkavl_allocator_st *local_allocator = allocator;
+    bool allocated_mkavl_tree = false;
+    void *context_to_use;
+    mkavl_delete_context_fn delete_context_fn_to_use;
+    uint32_t i;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if (NULL == new_tree_h) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *new_tree_h = NULL;
+
+    if (!mkavl_tree_is_valid(source_tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (source_tree_h->opts.persistent && (NULL == copy_fn) &&
+        use_source_context && (NULL == allocator) && (NULL == opts)) {
+        return (mkavl_share_unlocked(source_tree_h, new_tree_h, false));
+    }
+
+    if (NULL == local_allocator) {
+        local_allocator = &(source_tree_h->allocator.mkavl_allocator);
+    }
+
+    {
+        mkavl_compare_fn cmp_fn_array[source_tree_h->avl_tree_count];
+
+        for (i = 0; i < NELEMS(cmp_fn_array); ++i) {
+            cmp_fn_array[i] = source_tree_h->avl_tree_array[i].compare_fn;
+        }
+
+        context_to_use = new_context;
+        if (use_source_context) {
+            context_to_use = source_tree_h->context;
+        }
+
+        rc = mkavl_new_opts(&local_tree_h,
+                            cmp_fn_array, NELEMS(cmp_fn_array),
+                            context_to_use, local_allocator,
+                            (NULL == opts) ? &(source_tree_h->opts) : opts);
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto err_exit;
+        }
+        allocated_mkavl_tree = true;
+    }
+
+    rc = mkavl_copy_items(source_tree_h, local_tree_h, copy_fn, item_fn);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto err_exit;
+    }
+
+    *new_tree_h = local_tree_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+
+err_exit:
+
+    if (allocated_mkavl_tree) {
+        delete_context_fn_to_use = NULL;
+        if (!use_source_context) {
+            delete_context_fn_to_use = delete_context_fn;
+        }
+        /* Just deleting the tree should clean everything up. */
+        mkavl_delete(&local_tree_h, item_fn, delete_context_fn_to_use);
+    }
+
+    return (rc);
+}
+
+/**
+ * Deep copy a mkavl tree into a new tree as with mkavl_copy(), additionally
+ * specifying options for how the new tree is stored.
+ *
+ * @see mkavl_copy
+ * @see mkavl_opts_st
+ * @param source_tree_h The tree from which to copy.
+ * @param new_tree_h A pointer to the new tree to which the copy will be done.
+ * @param copy_fn A function that is applied to each item in the source tree
+ * before it is copied to the new tree.  If NULL, then a shallow copy of the
+ * data is copied to the new tree.
+ * @param item_fn If there is an error copying the new tree, this function is
+ * applied to all items in the new tree as it is destroyed.
+ * @param use_source_context If true, the client context from source_tree_h is
+ * used for the new tree.  If false, new_context is used for the new tree.
+ * @param new_context The opaque client context to use for the new tree if
+ * user_source_context if false.
+ * @param delete_context_fn Upon an error, this function will be applied to the
+ * new_context if use_source_context is false.
+ * @param allocator The memory allocation functions to use for the new tree.
+ * @param opts The options for the new tree, or NULL to use the options of the
+ * source tree.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_copy_opts (mkavl_tree_handle source_tree_h, 
+                 mkavl_tree_handle *new_tree_h,
+                 mkavl_copy_fn copy_fn, mkavl_item_fn item_fn, 
+                 bool use_source_context, void *new_context,
+                 mkavl_delete_context_fn delete_context_fn,
+                 mkavl_allocator_st *allocator, const mkavl_opts_st *opts)
+{
+    mkavl_rc_e rc;
+    MKAVL_LATENCY_START(start);
+
+    if (!mkavl_tree_is_valid(source_tree_h)) {
+        if (NULL != new_tree_h) {
+            *new_tree_h = NULL;
+        }
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(source_tree_h);
+    rc = mkavl_copy_opts_unlocked(source_tree_h, new_tree_h, copy_fn, item_fn,
+                                  use_source_context, new_context,
+                                  delete_context_fn, allocator, opts);
+    mkavl_unlock(source_tree_h);
+    MKAVL_LATENCY_END(MKAVL_LATENCY_OP_E_COPY, start);
+
+    return (rc);
+}
+
+/**
+ * Add an item to a persistent tree.  The nodes the insertions would change are
+ * made the tree's own and the new nodes are allocated before any AVL tree is
+ * changed, so the item is added to every AVL tree or to none without having to
+ * undo anything, which could itself need to copy shared nodes.
+ *
+ * @param tree_h The mkavl tree.
+ * @param item_to_add A pointer to the data to add.
+ * @param existing_item If an existing item is found, it is returned.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_add_persistent (mkavl_tree_handle tree_h, void *item_to_add,
+                      void **existing_item)
+{
+    struct avl_node *node_array[tree_h->avl_tree_count];
+    struct avl_table *avl_tree;
+    unsigned long rotation_cnt;
+    void *item, **found;
+    uint32_t i, node_cnt;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        item = avl_find(tree_h->avl_tree_array[i].tree, item_to_add);
+        if (NULL != item) {
+            if (0 != i) {
+                return (MKAVL_RC_E_EOOSYNC);
+            }
+            *existing_item = item;
+            return (MKAVL_RC_E_SUCCESS);
+        }
+    }
+
+    for (node_cnt = 0; node_cnt < tree_h->avl_tree_count; ++node_cnt) {
+        avl_tree = tree_h->avl_tree_array[node_cnt].tree;
+        if (0 == avl_unshare(avl_tree, item_to_add, 0)) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto cleanup;
+        }
+        node_array[node_cnt] = avl_tree->avl_alloc->libavl_malloc(
+                                   avl_tree->avl_alloc,
+                                   avl_tree->avl_node_size);
+        if (NULL == node_array[node_cnt]) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto cleanup;
+        }
+    }
+
+    /* Nothing can fail from here on */
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        avl_tree = tree_h->avl_tree_array[i].tree;
+        rotation_cnt = avl_tree->avl_rotations;
+        found = avl_probe_node(avl_tree, item_to_add, node_array[i]);
+        mkavl_assert_abort((NULL != found) && (item_to_add == *found));
+        mkavl_trace_rebalance(tree_h, i, rotation_cnt);
+    }
+    ++(tree_h->item_count);
+    node_cnt = 0;
+
+cleanup:
+
+    for (i = 0; i < node_cnt; ++i) {
+        avl_tree = tree_h->avl_tree_array[i].tree;
+        avl_tree->avl_alloc->libavl_free(avl_tree->avl_alloc, node_array[i]);
+    }
+
+    return (rc);
+}
+
+/**
+ * The body of mkavl_add() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_add
+ */
+static mkavl_rc_e
+mkavl_add_unlocked (mkavl_tree_handle tree_h, void *item_to_add, 
+                    void **existing_item)
+{
+    uint32_t i, err_idx = 0;
+    void *item, *first_item = NULL;
+    mkavl_node_block_st *block = NULL;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if ((NULL == item_to_add) || (NULL == existing_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *existing_item = NULL;
+
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    rc = mkavl_prepare_change(tree_h, item_to_add);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    if (tree_h->opts.persistent) {
+        return (mkavl_add_persistent(tree_h, item_to_add, existing_item));
+    }
+
+    if (tree_h->opts.intrusive_nodes) {
+        block = mkavl_node_block_new(tree_h);
+        if (NULL == block) {
+            return (MKAVL_RC_E_ENOMEM);
+        }
+    }
+
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        rc = mkavl_avl_insert(tree_h, i, item_to_add, block, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            err_idx = i;
+            goto err_exit;
+        }
+
+        if (0 == i) {
+            first_item = item;
+            if (NULL != first_item) {
+                /* The item was not linked, so the block has been freed */
+                break;
+            }
+        } else if (first_item != item) {
+            err_idx = i;
+            rc = MKAVL_RC_E_EOOSYNC;
+            goto err_exit;
+        }
+    }
+
+    if (NULL == first_item) {
+        ++(tree_h->item_count);
+    }
+
+    *existing_item = first_item;
+
+    return (rc);
+
+err_exit:
+
+    for (i = 0; i < err_idx; ++i) {
+        if (NULL == first_item) {
+            /* Attempt to remove all the items we added */
+            item = mkavl_avl_delete(tree_h, i, item_to_add);
+            mkavl_assert_abort(NULL != item);
+        }
+    }
+
+    return (rc);
+}
+
+/**
+ * Add an item to each AVL tree in the mkavl.
+ *
+ * @param tree_h The mkavl tree.
+ * @param item_to_add A pointer to the data to add.
+ * @param existing_item If an existing item is found, it is returned.
+ * Otherwise, NULL if the item was not found.
+ * @return The return code.  With a write-ahead log, the item is serialized
+ * before it is added, and an error from the serialize function is returned as
+ * is with the tree unchanged.  MKAVL_RC_E_EINVAL is returned, with the tree
+ * unchanged, once the log has failed.  MKAVL_RC_E_EIO means the item was added
+ * but may not be durable, since the log failed.
+ */
+mkavl_rc_e
+mkavl_add (mkavl_tree_handle tree_h, void *item_to_add, 
+           void **existing_item)
+{
+    mkavl_wal_handle wal_h = NULL;
+    uint64_t cmp_cnt = mkavl_thread_cmp_cnt;
+    uint64_t lsn = 0;
+    mkavl_rc_e rc;
+    MKAVL_LATENCY_START(start);
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != existing_item) {
+            *existing_item = NULL;
+        }
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_trace_call(MKAVL_TRACE_EVENT_E_ADD_ENTRY, tree_h, MKAVL_TRACE_ALL_KEYS,
+                     MKAVL_FIND_TYPE_E_INVALID, item_to_add, cmp_cnt,
+                     MKAVL_RC_E_INVALID);
+    mkavl_write_lock(tree_h);
+    rc = mkavl_add_unlocked(tree_h, item_to_add, existing_item);
+    mkavl_lockless_write_end(tree_h);
+    if (mkavl_rc_e_is_ok(rc) && (NULL == *existing_item)) {
+        mkavl_stats_add(tree_h, MKAVL_STAT_E_ADD, 1);
+        rc = mkavl_log_change(tree_h, MKAVL_WAL_OP_E_ADD, 0, &wal_h, &lsn);
+    }
+    mkavl_write_unlock(tree_h);
+
+    rc = mkavl_commit_change(wal_h, lsn, rc);
+    MKAVL_LATENCY_END(MKAVL_LATENCY_OP_E_ADD, start);
+    mkavl_trace_call(MKAVL_TRACE_EVENT_E_ADD_EXIT, tree_h, MKAVL_TRACE_ALL_KEYS,
+                     MKAVL_FIND_TYPE_E_INVALID, item_to_add, cmp_cnt, rc);
+
+    return (rc);
+}
+
+/**
+ * Merge two sorted runs of positions into an item array, the second run right
+ * after the first, by one of the keys of the tree.  Equal items keep their
+ * order.
+ *
+ * @param tree_h The tree whose comparison function to use.
+ * @param key_idx The index of the key by which to merge.
+ * @param item_array The items to which the positions refer.
+ * @param src The two runs.
+ * @param mid The length of the first run.
+ * @param cnt The length of both runs together.
+ * @param dst Where to write the cnt merged positions.
+ */
+static void
+mkavl_merge_positions (mkavl_tree_handle tree_h, size_t key_idx,
+                       void **item_array, const size_t *src, size_t mid,
+                       size_t cnt, size_t *dst)
+{
+    mkavl_compare_fn compare_fn = tree_h->avl_tree_array[key_idx].compare_fn;
+    size_t a = 0, b = mid, k = 0;
+
+    while ((a < mid) && (b < cnt)) {
+        if (compare_fn(item_array[src[b]], item_array[src[a]],
+                       tree_h->context) < 0) {
+            dst[k++] = src[b++];
+        } else {
+            dst[k++] = src[a++];
+        }
+    }
+    while (a < mid) {
+        dst[k++] = src[a++];
+    }
+    while (b < cnt) {
+        dst[k++] = src[b++];
+    }
+}
+
+/**
+ * Sort an array of positions into an item array by one of the keys of the tree
+ * using a bottom-up merge sort.
+ *
+ * @param tree_h The tree whose comparison function to use.
+ * @param key_idx The index of the key by which to sort.
+ * @param item_array The items to which the positions refer.
+ * @param pos_array The positions to sort.
+ * @param tmp_array Scratch space of the same size as pos_array.
+ * @param cnt The number of positions.
+ */
+static void
+mkavl_sort_positions (mkavl_tree_handle tree_h, size_t key_idx,
+                      void **item_array, size_t *pos_array, size_t *tmp_array,
+                      size_t cnt)
+{
+    size_t *src = pos_array, *dst = tmp_array, *swap;
+    size_t width, lo, mid, hi;
+
+    for (width = 1; width < cnt; width *= 2) {
+        for (lo = 0; lo < cnt; lo += (2 * width)) {
+            mid = ((cnt - lo) > width) ? (lo + width) : cnt;
+            hi = ((cnt - mid) > width) ? (mid + width) : cnt;
+            mkavl_merge_positions(tree_h, key_idx, item_array, &(src[lo]),
+                                  (mid - lo), (hi - lo), &(dst[lo]));
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != pos_array) {
+        memcpy(pos_array, src, (cnt * sizeof(*pos_array)));
+    }
+}
+
+/**
+ * The fewest positions that mkavl_sort_task_run() sorts in each half of an
+ * array it splits between two tasks.  Smaller arrays are sorted by a single
+ * task, as spawning would cost more than it saves.
+ */
+#define MKAVL_SORT_SPLIT_CNT 16384
+
+/**
+ * A task of a parallel sort of positions by one key.
+ */
+typedef struct mkavl_sort_task_st_ {
+    /** The task given to the workers */
+    mkavl_task_st task;
+    /** The tree whose comparison function and workers to use */
+    mkavl_tree_handle tree_h;
+    /** The index of the key by which to sort */
+    size_t key_idx;
+    /** The items to which the positions refer */
+    void **item_array;
+    /** The positions to sort */
+    size_t *pos_array;
+    /** Scratch space of the same size as pos_array */
+    size_t *tmp_array;
+    /** The number of positions */
+    size_t cnt;
+} mkavl_sort_task_st;
+
+/**
+ * Sort positions as mkavl_sort_positions() does, splitting a large array in
+ * half and sorting the halves in parallel on the workers of the tree before
+ * merging them.  The halves are split again in turn, so idle workers steal the
+ * largest pieces of the sort first.
+ *
+ * @param task_context The mkavl_sort_task_st.
+ */
+static void
+mkavl_sort_task_run (void *task_context)
+{
+    mkavl_sort_task_st *sort_task = task_context, lo_task, hi_task;
+    mkavl_workers_handle workers_h = sort_task->tree_h->opts.workers;
+    mkavl_task_group_st group = MKAVL_TASK_GROUP_INIT;
+    size_t mid;
+
+    if ((NULL == workers_h) || (sort_task->cnt < (2 * MKAVL_SORT_SPLIT_CNT))) {
+        mkavl_sort_positions(sort_task->tree_h, sort_task->key_idx,
+                             sort_task->item_array, sort_task->pos_array,
+                             sort_task->tmp_array, sort_task->cnt);
+        return;
+    }
+
+    mid = (sort_task->cnt / 2);
+    lo_task = *sort_task;
+    lo_task.cnt = mid;
+    hi_task = *sort_task;
+    hi_task.pos_array += mid;
+    hi_task.tmp_array += mid;
+    hi_task.cnt -= mid;
+
+    mkavl_workers_spawn(workers_h, &group, &(hi_task.task),
+                        mkavl_sort_task_run, &hi_task);
+    mkavl_sort_task_run(&lo_task);
+    mkavl_workers_wait(workers_h, &group);
+
+    mkavl_merge_positions(sort_task->tree_h, sort_task->key_idx,
+                          sort_task->item_array, sort_task->pos_array, mid,
+                          sort_task->cnt, sort_task->tmp_array);
+    memcpy(sort_task->pos_array, sort_task->tmp_array,
+           (sort_task->cnt * sizeof(*(sort_task->pos_array))));
+}
+
+/**
+ * The state of mkavl_bulk_load_unlocked() shared by the work on each key.
+ */
+typedef struct mkavl_bulk_load_st_ {
+    /** The items to load */
+    void **item_array;
+    /** The number of items */
+    size_t item_cnt;
+    /** For each key in turn, item_cnt positions to sort */
+    size_t *pos_array;
+    /**
+     * Scratch space of item_cnt positions for each key in turn, or for only
+     * one key when the tree has no workers and so sorts one key at a time.
+     */
+    size_t *tmp_array;
+    /** Whether the items are already sorted by sorted_key_idx */
+    bool is_sorted;
+    /** The key by which the items are sorted if is_sorted */
+    size_t sorted_key_idx;
+} mkavl_bulk_load_st;
+
+/**
+ * Sort the items of a bulk load by one key and check that no two are equal.
+ *
+ * @param tree_h The tree being loaded.
+ * @param key_idx The index of the key.
+ * @param context The mkavl_bulk_load_st.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_bulk_load_key (mkavl_tree_handle tree_h, size_t key_idx, void *context)
+{
+    mkavl_bulk_load_st *bulk_load = context;
+    mkavl_compare_fn compare_fn = tree_h->avl_tree_array[key_idx].compare_fn;
+    void **item_array = bulk_load->item_array;
+    mkavl_sort_task_st sort_task;
+    size_t *pos;
+    size_t j, item_cnt = bulk_load->item_cnt;
+
+    pos = &(bulk_load->pos_array[key_idx * item_cnt]);
+    for (j = 0; j < item_cnt; ++j) {
+        pos[j] = j;
+    }
+
+    if (!bulk_load->is_sorted || (key_idx != bulk_load->sorted_key_idx)) {
+        sort_task.tree_h = tree_h;
+        sort_task.key_idx = key_idx;
+        sort_task.item_array = item_array;
+        sort_task.pos_array = pos;
+        sort_task.tmp_array = bulk_load->tmp_array;
+        if (NULL != tree_h->opts.workers) {
+            sort_task.tmp_array += (key_idx * item_cnt);
+        }
+        sort_task.cnt = item_cnt;
+        mkavl_sort_task_run(&sort_task);
+    }
+
+    for (j = 1; j < item_cnt; ++j) {
+        if (compare_fn(item_array[pos[j - 1]], item_array[pos[j]],
+                       tree_h->context) >= 0) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Check whether a tree holds no items in any of its AVL trees.
+ *
+ * @param tree_h The tree, which must be valid.
+ * @return Whether the tree is empty.
+ */
+static bool
+mkavl_is_empty_unlocked (mkavl_tree_handle tree_h)
+{
+    size_t i;
+
+    if (0 != tree_h->item_count) {
+        return (false);
+    }
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        if (0 != avl_count(tree_h->avl_tree_array[i].tree)) {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+/**
+ * The body of mkavl_bulk_load() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_bulk_load
+ */
+static mkavl_rc_e
+mkavl_bulk_load_unlocked (mkavl_tree_handle tree_h, void **item_array,
+                          size_t item_cnt, bool is_sorted,
+                          size_t sorted_key_idx)
+{
+    mkavl_allocator_st *allocator;
+    mkavl_bulk_load_st bulk_load;
+    size_t *pos_array = NULL, *tmp_array = NULL;
+    size_t j, key_cnt, tmp_cnt;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    /* The items would not be logged */
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only ||
+        (NULL != tree_h->wal) || ((NULL == item_array) && (0 != item_cnt))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    key_cnt = tree_h->avl_tree_count;
+
+    if (is_sorted && (sorted_key_idx >= key_cnt)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (!mkavl_is_empty_unlocked(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    for (j = 0; j < item_cnt; ++j) {
+        if (NULL == item_array[j]) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+    }
+
+    if (0 == item_cnt) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    if (item_cnt > (SIZE_MAX / (key_cnt * sizeof(*pos_array)))) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    /* Keys sorted in parallel each need scratch space of their own */
+    tmp_cnt = ((NULL != tree_h->opts.workers) ? key_cnt : 1);
+    allocator = &(tree_h->allocator.mkavl_allocator);
+    pos_array = allocator->malloc_fn((key_cnt * item_cnt * sizeof(*pos_array)),
+                                     tree_h->context);
+    tmp_array = allocator->malloc_fn((tmp_cnt * item_cnt * sizeof(*tmp_array)),
+                                     tree_h->context);
+    if ((NULL == pos_array) || (NULL == tmp_array)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+
+    /* Order the items by each key before any node is allocated */
+    bulk_load.item_array = item_array;
+    bulk_load.item_cnt = item_cnt;
+    bulk_load.pos_array = pos_array;
+    bulk_load.tmp_array = tmp_array;
+    bulk_load.is_sorted = is_sorted;
+    bulk_load.sorted_key_idx = sorted_key_idx;
+    rc = mkavl_for_each_key(tree_h, mkavl_bulk_load_key, &bulk_load);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    rc = mkavl_build_unlocked(tree_h, item_array, item_cnt, pos_array);
+
+cleanup:
+
+    if (NULL != tmp_array) {
+        allocator->free_fn(tmp_array, tree_h->context);
+    }
+    if (NULL != pos_array) {
+        allocator->free_fn(pos_array, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Load an array of items into an empty mkavl tree.  Rather than inserting the
+ * items one at a time, the items are sorted by each key and every AVL tree is
+ * built bottom-up as a perfectly balanced tree.  This is O(M N lg N) for N
+ * items and M keys, or O(M N) when sorting is not needed, with no rebalancing.
+ * With workers in the options of the tree, the keys are sorted and built in
+ * parallel.
+ *
+ * Either all the items are loaded or none are.
+ *
+ * @param tree_h The tree into which to load the items.  It must be empty.
+ * @param item_array The array of items to load.  The array is not modified and
+ * may be freed after the call.
+ * @param item_cnt The number of items in item_array.
+ * @param is_sorted If true, item_array is already sorted in increasing order by
+ * the key at sorted_key_idx, so it need not be sorted for that key.
+ * @param sorted_key_idx The key index by which item_array is sorted if
+ * is_sorted is true.  Ignored otherwise.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the tree is not
+ * empty, if any items are equal by any key, or if is_sorted is true and
+ * item_array is not in fact sorted.
+ */
+mkavl_rc_e
+mkavl_bulk_load (mkavl_tree_handle tree_h, void **item_array, size_t item_cnt,
+                 bool is_sorted, size_t sorted_key_idx)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_write_lock(tree_h);
+    rc = mkavl_bulk_load_unlocked(tree_h, item_array, item_cnt, is_sorted,
+                                  sorted_key_idx);
+    mkavl_write_unlock(tree_h);
+
+    return (rc);
+}
+
+/** The bytes that start a file written by mkavl_save() */
+static const uint8_t mkavl_save_magic[8] = {
+    'M', 'K', 'A', 'V', 'L', 'S', 'N', 'P'
+};
+
+/** The version of the format written by mkavl_save() */
+#define MKAVL_SAVE_VERSION 1
+
+/** The number of bytes buffered by mkavl_save() and mkavl_load() */
+#define MKAVL_STREAM_BUF_SIZE 65536
+
+/**
+ * A buffered file descriptor that keeps a CRC-32 of the bytes passed through
+ * it.  The integers of mkavl_save() go through it as little-endian.
+ */
+typedef struct mkavl_stream_st_ {
+    /** The file descriptor */
+    int fd;
+    /** The buffer of MKAVL_STREAM_BUF_SIZE bytes */
+    uint8_t *buf;
+    /** The number of bytes in buf, waiting to be written or read */
+    size_t len;
+    /** The offset in buf of the next byte to read */
+    size_t buf_off;
+    /** Set once a read has hit the end of the file */
+    bool is_eof;
+    /** The number of bytes passed through the stream */
+    uint64_t off;
+    /** The CRC-32 of the bytes passed through the stream */
+    uint32_t crc;
+} mkavl_stream_st;
+
+/**
+ * Set up a stream over a file descriptor.
+ *
+ * @param stream The stream.
+ * @param fd The file descriptor.
+ * @param buf The buffer of MKAVL_STREAM_BUF_SIZE bytes.
+ */
+static void
+mkavl_stream_init (mkavl_stream_st *stream, int fd, uint8_t *buf)
+{
+    stream->fd = fd;
+    stream->buf = buf;
+    stream->len = 0;
+    stream->buf_off = 0;
+    stream->is_eof = false;
+    stream->off = 0;
+    stream->crc = 0;
+}
+
+/**
+ * Account for bytes passed through a stream.
+ *
+ * @param stream The stream.
+ * @param data The bytes.
+ * @param len The number of bytes.
+ */
+static void
+mkavl_stream_crc (mkavl_stream_st *stream, const uint8_t *data, size_t len)
+{
+    stream->crc = mkavl_crc32(stream->crc, data, len);
+    stream->off += len;
+}
+
+/**
+ * Write out the buffered bytes of a stream.
+ *
+ * @param stream The stream.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_stream_flush (mkavl_stream_st *stream)
+{
+    size_t off = 0;
+    ssize_t cnt;
+
+    while (off < stream->len) {
+        cnt = write(stream->fd, &(stream->buf[off]), (stream->len - off));
+        if (cnt < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return (MKAVL_RC_E_EIO);
+        }
+        off += cnt;
+    }
+    stream->len = 0;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Write bytes to a stream.
+ *
+ * @param stream The stream.
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_stream_write (mkavl_stream_st *stream, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    size_t cnt;
+    mkavl_rc_e rc;
+
+    mkavl_stream_crc(stream, src, len);
+    while (0 != len) {
+        if (MKAVL_STREAM_BUF_SIZE == stream->len) {
+            rc = mkavl_stream_flush(stream);
+            if (mkavl_rc_e_is_notok(rc)) {
+                return (rc);
+            }
+        }
+        cnt = (MKAVL_STREAM_BUF_SIZE - stream->len);
+        if (cnt > len) {
+            cnt = len;
+        }
+        memcpy(&(stream->buf[stream->len]), src, cnt);
+        stream->len += cnt;
+        src += cnt;
+        len -= cnt;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Write a 32-bit integer to a stream.
+ *
+ * @param stream The stream.
+ * @param value The integer.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_stream_write_u32 (mkavl_stream_st *stream, uint32_t value)
+{
+    uint8_t bytes[4];
+    uint32_t i;
+
+    for (i = 0; i < NELEMS(bytes); ++i) {
+        bytes[i] = ((value >> (8 * i)) & 0xFF);
+    }
+
+    return (mkavl_stream_write(stream, bytes, sizeof(bytes)));
+}
+
+/**
+ * Read bytes from a stream.
+ *
+ * @param stream The stream.
+ * @param data Where to put the bytes.
+ * @param len The number of bytes.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the file ends
+ * first.
+ */
+static mkavl_rc_e
+mkavl_stream_read (mkavl_stream_st *stream, void *data, size_t len)
+{
+    uint8_t *dst = data;
+    size_t cnt;
+    ssize_t read_cnt;
+
+    while (0 != len) {
+        if (stream->buf_off == stream->len) {
+            if (stream->is_eof) {
+                return (MKAVL_RC_E_EINVAL);
+            }
+            read_cnt = read(stream->fd, stream->buf, MKAVL_STREAM_BUF_SIZE);
+            if (read_cnt < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                return (MKAVL_RC_E_EIO);
+            }
+            stream->is_eof = (0 == read_cnt);
+            stream->len = read_cnt;
+            stream->buf_off = 0;
+            continue;
+        }
+        cnt = (stream->len - stream->buf_off);
+        if (cnt > len) {
+            cnt = len;
+        }
+        memcpy(dst, &(stream->buf[stream->buf_off]), cnt);
+        mkavl_stream_crc(stream, dst, cnt);
+        stream->buf_off += cnt;
+        dst += cnt;
+        len -= cnt;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Read a 32-bit integer from a stream.
+ *
+ * @param stream The stream.
+ * @param value Set to the integer.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_stream_read_u32 (mkavl_stream_st *stream, uint32_t *value)
+{
+    uint8_t bytes[4];
+    uint32_t i;
+    mkavl_rc_e rc;
+
+    rc = mkavl_stream_read(stream, bytes, sizeof(bytes));
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    *value = 0;
+    for (i = 0; i < NELEMS(bytes); ++i) {
+        *value |= (((uint32_t) bytes[i]) << (8 * i));
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Count the items of a tree to be saved, checking that every key holds them
+ * all.
+ *
+ * @param tree_h The tree, which must be valid.
+ * @param item_cnt Set to the number of items.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_save_count (mkavl_tree_handle tree_h, size_t *item_cnt)
+{
+    size_t i;
+
+    *item_cnt = avl_count(tree_h->avl_tree_array[0].tree);
+    for (i = 1; i < tree_h->avl_tree_count; ++i) {
+        if (avl_count(tree_h->avl_tree_array[i].tree) != *item_cnt) {
+            return (MKAVL_RC_E_EOOSYNC);
+        }
+    }
+
+    if (*item_cnt > (SIZE_MAX / (tree_h->avl_tree_count * sizeof(size_t)))) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Find, for every key of a tree, the position of each of its items in the
+ * order of the first key, by the address of the item as mkavl_copy() does.
+ *
+ * @param tree_h The tree.
+ * @param item_cnt The number of items, at least one.
+ * @param pos_array Set to item_cnt positions for each key in turn, to be freed
+ * with the allocator of the tree.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_save_positions (mkavl_tree_handle tree_h, size_t item_cnt,
+                      size_t **pos_array)
+{
+    mkavl_allocator_st *allocator = &(tree_h->allocator.mkavl_allocator);
+    mkavl_copy_pos_st *copy_pos_array = NULL;
+    mkavl_copy_st copy;
+    struct avl_traverser avl_t;
+    size_t j = 0;
+    void *item;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    *pos_array = allocator->malloc_fn(
+                     (tree_h->avl_tree_count * item_cnt * sizeof(**pos_array)),
+                     tree_h->context);
+    copy_pos_array = allocator->malloc_fn((item_cnt * sizeof(*copy_pos_array)),
+                                          tree_h->context);
+    if ((NULL == *pos_array) || (NULL == copy_pos_array)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+
+    for (item = avl_t_first(&avl_t, tree_h->avl_tree_array[0].tree);
+         NULL != item; item = avl_t_next(&avl_t)) {
+        copy_pos_array[j].item = item;
+        copy_pos_array[j].pos = j;
+        (*pos_array)[j] = j;
+        ++j;
+    }
+    qsort(copy_pos_array, item_cnt, sizeof(*copy_pos_array),
+          mkavl_copy_pos_cmp);
+
+    copy.source_tree_h = tree_h;
+    copy.item_cnt = item_cnt;
+    copy.pos_array = *pos_array;
+    copy.copy_pos_array = copy_pos_array;
+    rc = mkavl_for_each_key(tree_h, mkavl_copy_map_key, &copy);
+
+cleanup:
+
+    if (mkavl_rc_e_is_notok(rc) && (NULL != *pos_array)) {
+        allocator->free_fn(*pos_array, tree_h->context);
+        *pos_array = NULL;
+    }
+    if (NULL != copy_pos_array) {
+        allocator->free_fn(copy_pos_array, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Serialize an item into a buffer, growing the buffer if the item needs more
+ * room.  An item of more than UINT32_MAX bytes is refused before any room is
+ * made for it, as its length is written in 32 bits.
+ *
+ * @param tree_h The tree of the item.
+ * @param serialize_fn The serialize function.
+ * @param item The item.
+ * @param item_buf The buffer, which may be NULL, to be freed with the
+ * allocator of the tree.
+ * @param item_buf_len The size of the buffer.
+ * @param item_len Set to the number of bytes of the item.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_save_serialize (mkavl_tree_handle tree_h, mkavl_serialize_fn serialize_fn,
+                      const void *item, uint8_t **item_buf,
+                      size_t *item_buf_len, size_t *item_len)
+{
+    mkavl_allocator_st *allocator = &(tree_h->allocator.mkavl_allocator);
+    mkavl_rc_e rc;
+
+    rc = serialize_fn(item, *item_buf, *item_buf_len, item_len,
+                      tree_h->context);
+    if (mkavl_rc_e_is_ok(rc) && (*item_len > UINT32_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (*item_len > *item_buf_len)) {
+        if (NULL != *item_buf) {
+            allocator->free_fn(*item_buf, tree_h->context);
+        }
+        *item_buf_len = *item_len;
+        *item_buf = allocator->malloc_fn(*item_buf_len, tree_h->context);
+        if (NULL == *item_buf) {
+            *item_buf_len = 0;
+            return (MKAVL_RC_E_ENOMEM);
+        }
+        rc = serialize_fn(item, *item_buf, *item_buf_len, item_len,
+                          tree_h->context);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    if ((*item_len > *item_buf_len) || (*item_len > UINT32_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * The body of mkavl_save() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_save
+ */
+static mkavl_rc_e
+mkavl_save_unlocked (mkavl_tree_handle tree_h, int fd,
+                     mkavl_serialize_fn serialize_fn)
+{
+    mkavl_allocator_st *allocator;
+    mkavl_stream_st *stream = NULL;
+    struct avl_traverser avl_t;
+    uint8_t *stream_buf = NULL, *item_buf = NULL;
+    size_t *pos_array = NULL;
+    size_t i, j, key_cnt, item_cnt, item_len, item_buf_len = 0;
+    void *item;
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h) || (fd < 0) || (NULL == serialize_fn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    key_cnt = tree_h->avl_tree_count;
+
+    rc = mkavl_save_count(tree_h, &item_cnt);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    /* The counts, and so every position, are written in 32 bits */
+    if ((key_cnt > UINT32_MAX) || (item_cnt > UINT32_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    allocator = &(tree_h->allocator.mkavl_allocator);
+    stream = allocator->malloc_fn(sizeof(*stream), tree_h->context);
+    stream_buf = allocator->malloc_fn(MKAVL_STREAM_BUF_SIZE, tree_h->context);
+    if ((NULL == stream) || (NULL == stream_buf)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+    mkavl_stream_init(stream, fd, stream_buf);
+
+    if ((key_cnt > 1) && (0 != item_cnt)) {
+        rc = mkavl_save_positions(tree_h, item_cnt, &pos_array);
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto cleanup;
+        }
+    }
+
+    rc = mkavl_stream_write(stream, mkavl_save_magic,
+                            sizeof(mkavl_save_magic));
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_write_u32(stream, MKAVL_SAVE_VERSION);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_write_u32(stream, key_cnt);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_write_u32(stream, item_cnt);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    /* The items themselves in the order of the first key */
+    for (item = avl_t_first(&avl_t, tree_h->avl_tree_array[0].tree);
+         NULL != item; item = avl_t_next(&avl_t)) {
+        rc = mkavl_save_serialize(tree_h, serialize_fn, item, &item_buf,
+                                  &item_buf_len, &item_len);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_stream_write_u32(stream, item_len);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_stream_write(stream, item_buf, item_len);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto cleanup;
+        }
+    }
+
+    /* The order of the items by every other key */
+    for (i = 1; i < key_cnt; ++i) {
+        for (j = 0; j < item_cnt; ++j) {
+            rc = mkavl_stream_write_u32(stream,
+                                        pos_array[(i * item_cnt) + j]);
+            if (mkavl_rc_e_is_notok(rc)) {
+                goto cleanup;
+            }
+        }
+    }
+
+    rc = mkavl_stream_write_u32(stream, stream->crc);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_flush(stream);
+    }
+
+cleanup:
+
+    if (NULL != item_buf) {
+        allocator->free_fn(item_buf, tree_h->context);
+    }
+    if (NULL != pos_array) {
+        allocator->free_fn(pos_array, tree_h->context);
+    }
+    if (NULL != stream_buf) {
+        allocator->free_fn(stream_buf, tree_h->context);
+    }
+    if (NULL != stream) {
+        allocator->free_fn(stream, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Save the items of a tree to a file descriptor, to be read back by
+ * mkavl_load().  The items are written once, in the order of the first key,
+ * followed by the order of the items by each other key as positions into
+ * the items.  This takes O(N) time for N items and one key, and O(M N lg N)
+ * time for M keys, to match each item to its position.  The tree is not
+ * changed.
+ *
+ * @param tree_h The tree to save.
+ * @param fd The file descriptor to write to, from its current offset.  It is
+ * neither synced nor closed.
+ * @param serialize_fn Writes each item as bytes.
+ * @return The return code.  MKAVL_RC_E_EIO is returned if writing fails, in
+ * which case part of the file may have been written.  MKAVL_RC_E_EINVAL is
+ * returned if the tree holds more than UINT32_MAX items, before anything is
+ * written, or if an item serializes to more than UINT32_MAX bytes, in which
+ * case the items before it may have been written.
+ */
+mkavl_rc_e
+mkavl_save (mkavl_tree_handle tree_h, int fd, mkavl_serialize_fn serialize_fn)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_save_unlocked(tree_h, fd, serialize_fn);
+    mkavl_unlock(tree_h);
+
+    return (rc);
+}
+
+/**
+ * The body of mkavl_save_mapped() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_save_mapped
+ */
+static mkavl_rc_e
+mkavl_save_mapped_unlocked (mkavl_tree_handle tree_h, int fd,
+                            mkavl_serialize_fn serialize_fn)
+{
+    static const uint8_t pad[sizeof(uint64_t)] = { 0 };
+    mkavl_allocator_st *allocator;
+    mkavl_mapped_header_st header;
+    mkavl_mapped_footer_st footer;
+    mkavl_stream_st *stream = NULL;
+    struct avl_traverser avl_t;
+    uint8_t *stream_buf = NULL, *item_buf = NULL;
+    uint64_t *item_off_array = NULL, value;
+    size_t *pos_array = NULL;
+    size_t i, j, key_cnt, item_cnt, item_len, item_buf_len = 0;
+    void *item;
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h) || (fd < 0) || (NULL == serialize_fn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    key_cnt = tree_h->avl_tree_count;
+
+    rc = mkavl_save_count(tree_h, &item_cnt);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    allocator = &(tree_h->allocator.mkavl_allocator);
+    stream = allocator->malloc_fn(sizeof(*stream), tree_h->context);
+    stream_buf = allocator->malloc_fn(MKAVL_STREAM_BUF_SIZE, tree_h->context);
+    if ((NULL == stream) || (NULL == stream_buf)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+    mkavl_stream_init(stream, fd, stream_buf);
+
+    if (0 != item_cnt) {
+        item_off_array = allocator->malloc_fn(
+                             (item_cnt * sizeof(*item_off_array)),
+                             tree_h->context);
+        if (NULL == item_off_array) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto cleanup;
+        }
+
+        if (key_cnt > 1) {
+            rc = mkavl_save_positions(tree_h, item_cnt, &pos_array);
+            if (mkavl_rc_e_is_notok(rc)) {
+                goto cleanup;
+            }
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MKAVL_MAPPED_MAGIC, sizeof(header.magic));
+    header.version = MKAVL_MAPPED_VERSION;
+    header.byte_order = MKAVL_MAPPED_BYTE_ORDER;
+    rc = mkavl_stream_write(stream, &header, sizeof(header));
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    /* Each item padded to keep the next one aligned */
+    j = 0;
+    for (item = avl_t_first(&avl_t, tree_h->avl_tree_array[0].tree);
+         NULL != item; item = avl_t_next(&avl_t)) {
+        item_off_array[j++] = stream->off;
+        rc = mkavl_save_serialize(tree_h, serialize_fn, item, &item_buf,
+                                  &item_buf_len, &item_len);
+        if (mkavl_rc_e_is_ok(rc)) {
+            value = item_len;
+            rc = mkavl_stream_write(stream, &value, sizeof(value));
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_stream_write(stream, item_buf, item_len);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_stream_write(stream, pad,
+                                    ((sizeof(pad) - (item_len % sizeof(pad))) %
+                                     sizeof(pad)));
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto cleanup;
+        }
+    }
+
+    memset(&footer, 0, sizeof(footer));
+    footer.keys_off = stream->off;
+    for (i = 0; i < key_cnt; ++i) {
+        for (j = 0; j < item_cnt; ++j) {
+            value = item_off_array[(NULL == pos_array) ? j :
+                                   pos_array[(i * item_cnt) + j]];
+            rc = mkavl_stream_write(stream, &value, sizeof(value));
+            if (mkavl_rc_e_is_notok(rc)) {
+                goto cleanup;
+            }
+        }
+    }
+
+    footer.item_cnt = item_cnt;
+    footer.key_cnt = key_cnt;
+    footer.data_crc = stream->crc;
+    footer.footer_crc = mkavl_crc32(0, &footer,
+                                    offsetof(mkavl_mapped_footer_st,
+                                             footer_crc));
+    rc = mkavl_stream_write(stream, &footer, sizeof(footer));
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_flush(stream);
+    }
+
+cleanup:
+
+    if (NULL != item_buf) {
+        allocator->free_fn(item_buf, tree_h->context);
+    }
+    if (NULL != pos_array) {
+        allocator->free_fn(pos_array, tree_h->context);
+    }
+    if (NULL != item_off_array) {
+        allocator->free_fn(item_off_array, tree_h->context);
+    }
+    if (NULL != stream_buf) {
+        allocator->free_fn(stream_buf, tree_h->context);
+    }
+    if (NULL != stream) {
+        allocator->free_fn(stream, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Save the items of a tree to a file descriptor as a mapped tree, to be
+ * searched in place by mkavl_mapped_open() and the other functions of
+ * mkavl_mapped.h.  The file is written in one pass from its current offset,
+ * so it may also be a pipe, but it must start at offset zero of the file that
+ * is later mapped.  The tree is not changed.
+ *
+ * @param tree_h The tree to save.
+ * @param fd The file descriptor to write to.  It is neither synced nor closed.
+ * @param serialize_fn Writes each item as bytes.  The bytes must be usable as
+ * the item by the comparison functions of the tree.
+ * @return The return code.  MKAVL_RC_E_EIO is returned if writing fails, in
+ * which case part of the file may have been written.
+ */
+mkavl_rc_e
+mkavl_save_mapped (mkavl_tree_handle tree_h, int fd,
+                   mkavl_serialize_fn serialize_fn)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_save_mapped_unlocked(tree_h, fd, serialize_fn);
+    mkavl_unlock(tree_h);
+
+    return (rc);
+}
+
+/**
+ * The body of mkavl_checkpoint() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_checkpoint
+ */
+static mkavl_rc_e
+mkavl_checkpoint_unlocked (mkavl_tree_handle tree_h, int fd,
+                           mkavl_serialize_fn serialize_fn)
+{
+    mkavl_allocator_st *allocator;
+    mkavl_stream_st *stream = NULL;
+    uint8_t *stream_buf = NULL;
+    uint64_t lsn = 0;
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h) || (fd < 0) || (NULL == serialize_fn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    /* No change is logged while the lock is held */
+    if (NULL != tree_h->wal) {
+        lsn = mkavl_wal_last_lsn(tree_h->wal);
+    }
+
+    allocator = &(tree_h->allocator.mkavl_allocator);
+    stream = allocator->malloc_fn(sizeof(*stream), tree_h->context);
+    stream_buf = allocator->malloc_fn(MKAVL_STREAM_BUF_SIZE, tree_h->context);
+    if ((NULL == stream) || (NULL == stream_buf)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+    mkavl_stream_init(stream, fd, stream_buf);
+
+    rc = mkavl_stream_write(stream, MKAVL_WAL_CHECKPOINT_MAGIC,
+                            strlen(MKAVL_WAL_CHECKPOINT_MAGIC));
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_write_u32(stream, (lsn & UINT32_MAX));
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_write_u32(stream, (lsn >> 32));
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_flush(stream);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_save_unlocked(tree_h, fd, serialize_fn);
+    }
+
+cleanup:
+
+    if (NULL != stream_buf) {
+        allocator->free_fn(stream_buf, tree_h->context);
+    }
+    if (NULL != stream) {
+        allocator->free_fn(stream, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Save the tree as a snapshot for mkavl_wal_replay(): the LSN of the last
+ * change logged to the write-ahead log of the tree, if any, followed by the
+ * tree as written by mkavl_save().  No change is made while the tree is
+ * saved, so the snapshot holds exactly the changes up to that LSN.  The file
+ * is synced before this returns, so it can then be renamed over the previous
+ * snapshot.
+ *
+ * @see mkavl_set_wal
+ * @param tree_h The tree to save.
+ * @param fd The file descriptor to write to, from its current offset.  It is
+ * not closed.
+ * @param serialize_fn Writes each item as bytes.
+ * @return The return code.  MKAVL_RC_E_EIO is returned if writing or syncing
+ * fails, in which case part of the file may have been written.
+ */
+mkavl_rc_e
+mkavl_checkpoint (mkavl_tree_handle tree_h, int fd,
+                  mkavl_serialize_fn serialize_fn)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_checkpoint_unlocked(tree_h, fd, serialize_fn);
+    mkavl_unlock(tree_h);
+
+    if (mkavl_rc_e_is_ok(rc) && (0 != fsync(fd))) {
+        rc = MKAVL_RC_E_EIO;
+    }
+
+    return (rc);
+}
+
+/**
+ * Grow a buffer that mkavl_load() is filling from a file, at least doubling
+ * it but never past what it needs, so that what is allocated stays within a
+ * small multiple of what has been read rather than what the file claims.
+ *
+ * @param tree_h The tree whose allocator to use.
+ * @param buf The buffer, replaced by the grown one.  May point to NULL.
+ * @param buf_len The size of the buffer in bytes, updated.
+ * @param used_len The number of bytes of the buffer to keep.
+ * @param max_len The most bytes the buffer needs.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_load_grow (mkavl_tree_handle tree_h, void **buf, size_t *buf_len,
+                 size_t used_len, size_t max_len)
+{
+    mkavl_allocator_st *allocator = &(tree_h->allocator.mkavl_allocator);
+    size_t new_len;
+    void *new_buf;
+
+    new_len = MKAVL_STREAM_BUF_SIZE;
+    if (*buf_len > (MKAVL_STREAM_BUF_SIZE / 2)) {
+        new_len = (*buf_len * 2);
+    }
+    if (new_len > max_len) {
+        new_len = max_len;
+    }
+
+    new_buf = allocator->malloc_fn(new_len, tree_h->context);
+    if (NULL == new_buf) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    if (0 != used_len) {
+        memcpy(new_buf, *buf, used_len);
+    }
+    if (NULL != *buf) {
+        allocator->free_fn(*buf, tree_h->context);
+    }
+    *buf = new_buf;
+    *buf_len = new_len;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Read the bytes of an item for mkavl_load(), growing the buffer for them as
+ * they arrive so that a length from a damaged file cannot make it allocate
+ * much more than the file holds.
+ *
+ * @param tree_h The tree whose allocator to use.
+ * @param stream The stream to read from.
+ * @param len The number of bytes of the item.
+ * @param item_buf The buffer for the bytes, replaced if grown.
+ * @param item_buf_len The size of the buffer, updated.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the file ends
+ * first.
+ */
+static mkavl_rc_e
+mkavl_load_item_bytes (mkavl_tree_handle tree_h, mkavl_stream_st *stream,
+                       size_t len, uint8_t **item_buf, size_t *item_buf_len)
+{
+    size_t off = 0, cnt;
+    mkavl_rc_e rc;
+
+    while (off < len) {
+        if (off == *item_buf_len) {
+            rc = mkavl_load_grow(tree_h, (void **) item_buf, item_buf_len, off,
+                                 len);
+            if (mkavl_rc_e_is_notok(rc)) {
+                return (rc);
+            }
+        }
+
+        cnt = ((len < *item_buf_len) ? len : *item_buf_len) - off;
+        rc = mkavl_stream_read(stream, &((*item_buf)[off]), cnt);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        off += cnt;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * The body of mkavl_load() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_load
+ */
+static mkavl_rc_e
+mkavl_load_unlocked (mkavl_tree_handle tree_h, int fd,
+                     mkavl_deserialize_fn deserialize_fn,
+                     mkavl_item_fn item_fn)
+{
+    mkavl_allocator_st *allocator;
+    mkavl_stream_st *stream = NULL;
+    uint8_t magic[sizeof(mkavl_save_magic)];
+    uint8_t *stream_buf = NULL, *item_buf = NULL, *is_seen = NULL;
+    void **item_array = NULL;
+    size_t *pos_array = NULL;
+    size_t i, j, key_cnt, item_cnt, item_buf_len = 0, load_cnt = 0;
+    size_t item_array_len = 0;
+    uint32_t value, version, crc;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only ||
+        (NULL != tree_h->wal) || (fd < 0) || (NULL == deserialize_fn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    key_cnt = tree_h->avl_tree_count;
+
+    if (!mkavl_is_empty_unlocked(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    allocator = &(tree_h->allocator.mkavl_allocator);
+    stream = allocator->malloc_fn(sizeof(*stream), tree_h->context);
+    stream_buf = allocator->malloc_fn(MKAVL_STREAM_BUF_SIZE, tree_h->context);
+    if ((NULL == stream) || (NULL == stream_buf)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+    mkavl_stream_init(stream, fd, stream_buf);
+
+    rc = mkavl_stream_read(stream, magic, sizeof(magic));
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_read_u32(stream, &version);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_stream_read_u32(stream, &value);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+    if ((0 != memcmp(magic, mkavl_save_magic, sizeof(magic))) ||
+        (MKAVL_SAVE_VERSION != version) || (value != key_cnt)) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto cleanup;
+    }
+
+    rc = mkavl_stream_read_u32(stream, &value);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+    item_cnt = value;
+
+    if (item_cnt > (SIZE_MAX / (key_cnt * sizeof(*pos_array)))) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+
+    /*
+     * The count is not checked until the end, so the items are only made
+     * room for as they are read.
+     */
+    for (load_cnt = 0; load_cnt < item_cnt; ++load_cnt) {
+        if ((load_cnt * sizeof(*item_array)) == item_array_len) {
+            rc = mkavl_load_grow(tree_h, (void **) &item_array,
+                                 &item_array_len, item_array_len,
+                                 (item_cnt * sizeof(*item_array)));
+            if (mkavl_rc_e_is_notok(rc)) {
+                goto cleanup;
+            }
+        }
+
+        rc = mkavl_stream_read_u32(stream, &value);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_load_item_bytes(tree_h, stream, value, &item_buf,
+                                       &item_buf_len);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = deserialize_fn(item_buf, value, &(item_array[load_cnt]),
+                                tree_h->context);
+        }
+        if (mkavl_rc_e_is_ok(rc) && (NULL == item_array[load_cnt])) {
+            rc = MKAVL_RC_E_EINVAL;
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto cleanup;
+        }
+    }
+
+    /* Every item was read, so the orders are no bigger than the file */
+    if (0 != item_cnt) {
+        pos_array = allocator->malloc_fn(
+                        (key_cnt * item_cnt * sizeof(*pos_array)),
+                        tree_h->context);
+        is_seen = allocator->malloc_fn((item_cnt * sizeof(*is_seen)),
+                                       tree_h->context);
+        if ((NULL == pos_array) || (NULL == is_seen)) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto cleanup;
+        }
+        for (j = 0; j < item_cnt; ++j) {
+            pos_array[j] = j;
+        }
+    }
+
+    /* Each other order must be a permutation of the items */
+    for (i = 1; i < key_cnt; ++i) {
+        memset(is_seen, 0, (item_cnt * sizeof(*is_seen)));
+        for (j = 0; j < item_cnt; ++j) {
+            rc = mkavl_stream_read_u32(stream, &value);
+            if (mkavl_rc_e_is_notok(rc)) {
+                goto cleanup;
+            }
+            if ((value >= item_cnt) || is_seen[value]) {
+                rc = MKAVL_RC_E_EINVAL;
+                goto cleanup;
+            }
+            is_seen[value] = true;
+            pos_array[(i * item_cnt) + j] = value;
+        }
+    }
+
+    crc = stream->crc;
+    rc = mkavl_stream_read_u32(stream, &value);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+    if (value != crc) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto cleanup;
+    }
+
+    if (0 != item_cnt) {
+        rc = mkavl_build_unlocked(tree_h, item_array, item_cnt, pos_array);
+    }
+
+cleanup:
+
+    if (mkavl_rc_e_is_notok(rc) && (NULL != item_fn)) {
+        /* The items never made it into the tree */
+        for (j = 0; j < load_cnt; ++j) {
+            item_fn(item_array[j], tree_h->context);
+        }
+    }
+
+    if (NULL != is_seen) {
+        allocator->free_fn(is_seen, tree_h->context);
+    }
+    if (NULL != pos_array) {
+        allocator->free_fn(pos_array, tree_h->context);
+    }
+    if (NULL != item_array) {
+        allocator->free_fn(item_array, tree_h->context);
+    }
+    if (NULL != item_buf) {
+        allocator->free_fn(item_buf, tree_h->context);
+    }
+    if (NULL != stream_buf) {
+        allocator->free_fn(stream_buf, tree_h->context);
+    }
+    if (NULL != stream) {
+        allocator->free_fn(stream, tree_h->context);
+    }
+
+    return (rc);
+}
+
+/**
+ * Load the items saved by mkavl_save() into an empty tree.  Every AVL tree is
+ * built from the saved order in O(M N) time for N items and M keys, with no
+ * comparison function called, so the tree must have been created with the
+ * same comparison functions, in the same order, as the saved tree.  With
+ * workers in the options of the tree, the keys are built in parallel.
+ *
+ * Either all the items are loaded or none are.
+ *
+ * @param tree_h The tree into which to load the items.  It must be empty.
+ * @param fd The file descriptor to read from, from its current offset.  It is
+ * read through a buffer, so it may be left past the end of the saved tree.
+ * @param deserialize_fn Makes each item from its bytes.  The bytes are only
+ * checked against the CRC-32 once they have all been read, so it must not
+ * trust them.  Nor are the item count and lengths in the file trusted: the
+ * memory of the load only grows as the bytes it is for are read, to a small
+ * multiple of the bytes read so far (M times that for the orders of the
+ * keys), so a damaged or truncated file fails with MKAVL_RC_E_EINVAL rather
+ * than allocating whatever its header claims.
+ * @param item_fn If the load fails, applied to each item made so far.  If NULL,
+ * no function is applied.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the tree is not
+ * empty or if the file is not a whole, intact save of a tree with as many
+ * keys.  MKAVL_RC_E_EIO is returned if reading fails.
+ */
+mkavl_rc_e
+mkavl_load (mkavl_tree_handle tree_h, int fd,
+            mkavl_deserialize_fn deserialize_fn, mkavl_item_fn item_fn)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_write_lock(tree_h);
+    rc = mkavl_load_unlocked(tree_h, fd, deserialize_fn, item_fn);
+    mkavl_write_unlock(tree_h);
+
+    return (rc);
+}
+
+/**
+ * Get the item at the end of the AVL tree.  That is, either the first or last
+ * item in the tree rooted at the node depending on the side input.
+ *
+ * @param node The root of the subtree to search.
+ * @param found_item  The item found.
+ * @param side 0 to find the first (smallest) item or 1 to find the last
+ * (largest) item
+ * @return The return code
+ */
+static inline mkavl_rc_e
+mkavl_avl_end_item (const struct avl_node *node, void **found_item,
+                    uint8_t side)
+{
+    const struct avl_node *cur_node;
+
+    if (NULL == found_item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (side >= 2) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (NULL == node) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+    cur_node = node;
+
+    while (NULL != cur_node->avl_link[side]) {
+        cur_node = cur_node->avl_link[side];
+    }
+    *found_item = cur_node->avl_data;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the first (smallest) item in the tree rooted at the node.
+ *
+ * @param node The root of the subtree.
+ * @param found_item The item that was found.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_avl_first (const struct avl_node *node, void **found_item)
+{
+    return (mkavl_avl_end_item(node, found_item, 0));
+}
+
+/**
+ * Get the last (largest) item in the tree rooted at the node.
+ *
+ * @param node The root of the subtree.
+ * @param found_item The item that was found.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_avl_last (const struct avl_node *node, void **found_item)
+{
+    return (mkavl_avl_end_item(node, found_item, 1));
+}
+
+/**
+ * Find the item less than (or equal to) the given lookup_item.  Note that the
+ * lookup_item does not necessarily have to exist in the tree for an item to be
+ * found.  This is a recursive funciton.
+ *
+ * @param avl_tree The AVL tree to search.
+ * @param node The current node to compare.
+ * @param find_equal_to Indicates whether to return an equal item if found or
+ * only strictly less than.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_find_avl_lt (const struct avl_table *avl_tree,
+                   const struct avl_node *node,
+                   bool find_equal_to, const void *lookup_item, 
+                   void **found_item)
+{
+    int32_t cmp_rc;
+    mkavl_rc_e rc;
+
+    if ((NULL == found_item) || (NULL == lookup_item) ||
+        (NULL == avl_tree)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (NULL == node) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    cmp_rc = avl_tree->avl_compare(node->avl_data, lookup_item,
+                                   avl_tree->avl_param);
+
+    if (cmp_rc < 0) {
+        /* Current node is less than what we're searching for */
+        rc = mkavl_find_avl_lt(avl_tree, node->avl_link[1], find_equal_to,
+                               lookup_item, found_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+
+        if (NULL == *found_item) {
+            /* 
+             * There is nothing smaller in the right subtree, so the current
+             * node is the winner.  Otherwise, return what was found in the
+             * right subtree.
+             */
+            *found_item = node->avl_data;
+        }
+
+        return (MKAVL_RC_E_SUCCESS);
+    } else if (cmp_rc > 0) {
+        /* Current node is greater than what we're searching for */
+        return (mkavl_find_avl_lt(avl_tree, node->avl_link[0], find_equal_to,
+                                  lookup_item, found_item));
+    }
+
+    /* Current node is equal to what we're searching for */
+
+    if (find_equal_to) {
+        /* We're done if we can stop on equality */
+        *found_item = node->avl_data;
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    /* 
+     * If we can't stop on equality, then get the biggest item in the left
+     * subtree.
+     */
+    return (mkavl_avl_last(node->avl_link[0], found_item));
+}
+
+/**
+ * Find the item greater than (or equal to) the given lookup_item.  Note that
+ * the lookup_item does not necessarily have to exist in the tree for an item to
+ * be found.  This is a recursive funciton.
+ *
+ * @param avl_tree The AVL tree to search.
+ * @param node The current node to compare.
+ * @param find_equal_to Indicates whether to return an equal item if found or
+ * only strictly greater than.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_find_avl_gt (const struct avl_table *avl_tree,
+                   const struct avl_node *node,
+                   bool find_equal_to, const void *lookup_item, 
+                   void **found_item)
+{
+    int32_t cmp_rc;
+    mkavl_rc_e rc;
+
+    if ((NULL == found_item) || (NULL == lookup_item) ||
+        (NULL == avl_tree)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (NULL == node) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    cmp_rc = avl_tree->avl_compare(node->avl_data, lookup_item,
+                                   avl_tree->avl_param);
+
+    if (cmp_rc < 0) {
+        /* Current node is less than what we're searching for */
+        return (mkavl_find_avl_gt(avl_tree, node->avl_link[1], find_equal_to,
+                                  lookup_item, found_item));
+    } else if (cmp_rc > 0) {
+        /* Current node is greater than what we're searching for */
+        rc = mkavl_find_avl_gt(avl_tree, node->avl_link[0], find_equal_to,
+                               lookup_item, found_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+
+        if (NULL == *found_item) {
+            /* 
+             * There is nothing bigger in the left subtree, so the current node
+             * is the winner.  Otherwise, return what was found in the left
+             * subtree.
+             */
+            *found_item = node->avl_data;
+        }
+
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    /* Current node is equal to what we're searching for */
+
+    if (find_equal_to) {
+        /* We're done if we can stop on equality */
+        *found_item = node->avl_data;
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    /* 
+     * If we can't stop on equality, then get the smallest item in the right
+     * subtree.
+     */
+    return (mkavl_avl_first(node->avl_link[1], found_item));
+}
+
+/**
+ * The body of mkavl_find() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_find
+ */
+static mkavl_rc_e
+mkavl_find_unlocked (mkavl_tree_handle tree_h, mkavl_find_type_e type,
+                     size_t key_idx, const void *lookup_item, void **found_item)
+{
+    void *item = NULL;
+    mkavl_rc_e rc;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_find_type_e_is_valid(type)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (key_idx >= tree_h->avl_tree_count) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    switch (type) {
+    case MKAVL_FIND_TYPE_E_EQUAL:
+        item = avl_find(tree_h->avl_tree_array[key_idx].tree, lookup_item);
+        break;
+    case MKAVL_FIND_TYPE_E_GT:
+        rc = mkavl_find_avl_gt(tree_h->avl_tree_array[key_idx].tree,
+                               tree_h->avl_tree_array[key_idx].tree->avl_root,
+                               false, lookup_item, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        break;
+    case MKAVL_FIND_TYPE_E_GE:
+        rc = mkavl_find_avl_gt(tree_h->avl_tree_array[key_idx].tree,
+                               tree_h->avl_tree_array[key_idx].tree->avl_root,
+                               true, lookup_item, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        break;
+    case MKAVL_FIND_TYPE_E_LT:
+        rc = mkavl_find_avl_lt(tree_h->avl_tree_array[key_idx].tree,
+                               tree_h->avl_tree_array[key_idx].tree->avl_root,
+                               false, lookup_item, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        break;
+    case MKAVL_FIND_TYPE_E_LE:
+        rc = mkavl_find_avl_lt(tree_h->avl_tree_array[key_idx].tree,
+                               tree_h->avl_tree_array[key_idx].tree->avl_root,
+                               true, lookup_item, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        break;
+    default:
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    *found_item = item;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Count a find in the stats of the tree, if it keeps them.
+ *
+ * @param tree_h The tree searched.
+ * @param type The type of lookup done.
+ * @param key_idx The AVL tree searched.
+ * @param cmp_cnt The comparisons made by the calling thread before the find,
+ * from which the nodes visited are counted.
+ */
+static inline void
+mkavl_find_count (mkavl_tree_handle tree_h, mkavl_find_type_e type,
+                  size_t key_idx, uint64_t cmp_cnt)
+{
+    if (NULL == tree_h->stats) {
+        return;
+    }
+
+    mkavl_stats_add(tree_h, (MKAVL_STAT_E_FIND + type), 1);
+    mkavl_key_stats_add(tree_h, key_idx, MKAVL_KEY_STAT_E_FIND, 1);
+    mkavl_key_stats_add(tree_h, key_idx, MKAVL_KEY_STAT_E_FIND_VISIT,
+                        (mkavl_thread_cmp_cnt - cmp_cnt));
+}
+
+/**
+ * Find an item in the tree.
+ *
+ * @param tree_h The tree to search
+ * @param type The type of lookup to do.
+ * @param key_idx The AVL tree being searched.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found for the lookup.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_find (mkavl_tree_handle tree_h, mkavl_find_type_e type,
+            size_t key_idx, const void *lookup_item, void **found_item)
+{
+    mkavl_epoch_guard_st guard;
+    uint64_t cmp_cnt = mkavl_thread_cmp_cnt;
+    mkavl_rc_e rc;
+    MKAVL_LATENCY_START(start);
+
+    mkavl_trace_call(MKAVL_TRACE_EVENT_E_FIND_ENTRY, tree_h, key_idx, type,
+                     lookup_item, cmp_cnt, MKAVL_RC_E_INVALID);
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != found_item) {
+            *found_item = NULL;
+        }
+        rc = MKAVL_RC_E_EINVAL;
+        goto cleanup;
+    }
+
+    if (NULL != tree_h->lockless) {
+        if ((NULL == lookup_item) || (NULL == found_item)) {
+            rc = MKAVL_RC_E_EINVAL;
+            goto cleanup;
+        }
+        *found_item = NULL;
+
+        if ((type < MKAVL_FIND_TYPE_E_EQUAL) ||
+            (type >= MKAVL_FIND_TYPE_E_MAX) ||
+            (key_idx >= tree_h->avl_tree_count)) {
+            rc = MKAVL_RC_E_EINVAL;
+            goto cleanup;
+        }
+
+        mkavl_epoch_enter(tree_h->lockless, &guard);
+        mkavl_lockless_find(tree_h, key_idx, type, lookup_item, found_item);
+        mkavl_epoch_exit(&guard);
+        mkavl_find_count(tree_h, type, key_idx, cmp_cnt);
+        rc = MKAVL_RC_E_SUCCESS;
+        goto cleanup;
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_find_unlocked(tree_h, type, key_idx, lookup_item, found_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        mkavl_find_count(tree_h, type, key_idx, cmp_cnt);
+    }
+    mkavl_unlock(tree_h);
+
+cleanup:
+
+    if (mkavl_rc_e_is_ok(rc)) {
+        MKAVL_LATENCY_END((MKAVL_LATENCY_OP_E_FIND_EQUAL +
+                           (type - MKAVL_FIND_TYPE_E_EQUAL)), start);
+    }
+    mkavl_trace_call(MKAVL_TRACE_EVENT_E_FIND_EXIT, tree_h, key_idx, type,
+                     lookup_item, cmp_cnt, rc);
+
+    return (rc);
+}
+
+/**
+ * The body of mkavl_find_range() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_find_range
+ */
+static mkavl_rc_e
+mkavl_find_range_unlocked (mkavl_tree_handle tree_h, size_t key_idx,
+                           const void *lo_item, bool lo_inclusive,
+                           const void *hi_item, bool hi_inclusive,
+                           bool descending, mkavl_walk_cb_fn cb_fn,
+                           void *walk_context)
 {
-    bool is_valid = true;
+    struct avl_traverser avl_t = {0};
+    struct avl_table *avl_tree;
+    mkavl_compare_fn compare_fn;
+    const void *start_item, *end_item;
+    bool start_inclusive, end_inclusive;
+    bool stop_walk = false;
+    int32_t cmp;
+    void *item;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
 
-    if (is_valid && (NULL == iterator_h)) {
-        is_valid = false;
+    if (NULL == cb_fn) {
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    if (is_valid && !mkavl_tree_is_valid(iterator_h->tree_h)) {
-        is_valid = false;
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    if (is_valid && 
-        (iterator_h->key_idx >= iterator_h->tree_h->avl_tree_count)) {
-        is_valid = false;
+    if (key_idx >= tree_h->avl_tree_count) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    avl_tree = tree_h->avl_tree_array[key_idx].tree;
+    compare_fn = tree_h->avl_tree_array[key_idx].compare_fn;
+
+    start_item = descending ? hi_item : lo_item;
+    start_inclusive = descending ? hi_inclusive : lo_inclusive;
+    end_item = descending ? lo_item : hi_item;
+    end_inclusive = descending ? lo_inclusive : hi_inclusive;
+
+    if (NULL == start_item) {
+        item = descending ? avl_t_last(&avl_t, avl_tree) :
+                            avl_t_first(&avl_t, avl_tree);
+    } else {
+        item = avl_t_seek(&avl_t, avl_tree, start_item, !descending,
+                          start_inclusive);
     }
 
-    return (is_valid);
+    while ((NULL != item) && !stop_walk) {
+        if (NULL != end_item) {
+            cmp = compare_fn(item, end_item, tree_h->context);
+            if (descending) {
+                cmp = -cmp;
+            }
+            if ((cmp > 0) || ((0 == cmp) && !end_inclusive)) {
+                break;
+            }
+        }
+
+        rc = cb_fn(item, tree_h->context, walk_context, &stop_walk);
+        if (mkavl_rc_e_is_notok(rc)) {
+            break;
+        }
+        item = descending ? avl_t_prev(&avl_t) : avl_t_next(&avl_t);
+    }
+
+    return (rc);
 }
 
 /**
- * Create a new mkavl tree composed of AVL trees using the given array of
- * comparison functions.
+ * Walk the items of one key that lie between two bounds, in ascending or
+ * descending order.  The tree is only descended once to find the first item in
+ * the range and then walked in order, so this is O(lg N + K) for K items
+ * walked.
  *
- * @see mkavl_delete
- * @param tree_h A pointer to the memory location for the new tree.
- * @param compare_fn_array An array of size compare_fn_array_count of the
- * comparison functions for the mkavl.  This allows the same set of data items
- * to be stored in different orders by mulitple keys.  A deep copy of the
- * functions is made for the tree_h.  There must be at least one function passed
- * in.
- * @param compare_fn_array_count The size of the compare_fn_array.
- * @param context An opaque context passed back to the client in callbacks.
- * @param allocator The memory allocation functions to use for the tree, or NULL
- * if the default functions are to be used.
- * @return The return value
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param descending If true, the walk goes from the upper bound to the lower
+ * bound.
+ * @param cb_fn The callback function to apply to each item in the range.  The
+ * walk stops early if it sets stop_walk or returns an error.
+ * @param walk_context The opaque walk context passed to the callback.
+ * @return The return code.  An error from the callback is returned as is.
  */
 mkavl_rc_e
-mkavl_new (mkavl_tree_handle *tree_h,
-           mkavl_compare_fn *compare_fn_array, 
-           size_t compare_fn_array_count, 
-           void *context, mkavl_allocator_st *allocator)
+mkavl_find_range (mkavl_tree_handle tree_h, size_t key_idx,
+                  const void *lo_item, bool lo_inclusive,
+                  const void *hi_item, bool hi_inclusive, bool descending,
+                  mkavl_walk_cb_fn cb_fn, void *walk_context)
 {
-    mkavl_allocator_st *local_allocator;
-    mkavl_tree_handle local_tree_h;
-    mkavl_avl_ctx_st *avl_ctx;
-    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
-    uint32_t i;
+    mkavl_rc_e rc;
 
-    if ((NULL == tree_h) || (NULL == compare_fn_array) ||
-        (0 == compare_fn_array_count)) {
+    if (!mkavl_tree_is_valid(tree_h)) {
         return (MKAVL_RC_E_EINVAL);
     }
-    *tree_h = NULL;
 
-    local_allocator = 
-        (NULL == allocator) ? &mkavl_allocator_default : allocator;
+    mkavl_read_lock(tree_h);
+    rc = mkavl_find_range_unlocked(tree_h, key_idx, lo_item, lo_inclusive,
+                                   hi_item, hi_inclusive, descending, cb_fn,
+                                   walk_context);
+    mkavl_unlock(tree_h);
 
-    local_tree_h = local_allocator->malloc_fn(sizeof(*local_tree_h), context);
-    if (NULL == local_tree_h) {
-        rc = MKAVL_RC_E_ENOMEM;
-        goto err_exit;
-    }
+    return (rc);
+}
 
-    local_tree_h->context = context;
-    memcpy(&(local_tree_h->allocator.avl_allocator), &mkavl_allocator_wrapper,
-           sizeof(local_tree_h->allocator.avl_allocator));
-    memcpy(&(local_tree_h->allocator.mkavl_allocator), local_allocator,
-           sizeof(local_tree_h->allocator));
-    local_tree_h->allocator.tree_h = local_tree_h;
-    local_tree_h->allocator.magic = MKAVL_CTX_MAGIC;
-    local_tree_h->avl_tree_count = compare_fn_array_count;
-    local_tree_h->avl_tree_array = NULL;
-    local_tree_h->item_count = 0;
-    local_tree_h->copy_fn = NULL;
+/**
+ * The state for filling an array from mkavl_find_range_array().
+ */
+typedef struct mkavl_range_array_ctx_st_ {
+    /** The array to fill */
+    void **item_array;
+    /** The size of the array */
+    size_t item_array_cnt;
+    /** The number of items put in the array so far */
+    size_t found_cnt;
+} mkavl_range_array_ctx_st;
 
-    local_tree_h->avl_tree_array = 
-        local_allocator->malloc_fn(local_tree_h->avl_tree_count * 
-                                   sizeof(*(local_tree_h->avl_tree_array)),
-                                   context);
-    if (NULL == local_tree_h->avl_tree_array) {
-        rc = MKAVL_RC_E_ENOMEM;
-        goto err_exit;
+/**
+ * Walk callback to put each item in the range in the array.
+ *
+ * @param item The current item.
+ * @param tree_context The context for the tree.
+ * @param walk_context The mkavl_range_array_ctx_st being filled.
+ * @param stop_walk Set to true once the array is full.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_range_array_cb (void *item, void *tree_context, void *walk_context,
+                      bool *stop_walk)
+{
+    mkavl_range_array_ctx_st *ctx = (mkavl_range_array_ctx_st *) walk_context;
+
+    ctx->item_array[(ctx->found_cnt)++] = item;
+    *stop_walk = (ctx->found_cnt >= ctx->item_array_cnt);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the items of one key that lie between two bounds, as with
+ * mkavl_find_range(), putting up to a given number of them in an array.
+ *
+ * @see mkavl_find_range
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param descending If true, the items are found from the upper bound to the
+ * lower bound.
+ * @param item_array The array in which to put the items found.
+ * @param item_array_cnt The size of item_array, which limits the number of
+ * items found.
+ * @param found_cnt Set to the number of items put in item_array.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_find_range_array (mkavl_tree_handle tree_h, size_t key_idx,
+                        const void *lo_item, bool lo_inclusive,
+                        const void *hi_item, bool hi_inclusive,
+                        bool descending, void **item_array,
+                        size_t item_array_cnt, size_t *found_cnt)
+{
+    mkavl_range_array_ctx_st ctx;
+    mkavl_rc_e rc;
+
+    if ((NULL == found_cnt) || 
+        ((NULL == item_array) && (0 != item_array_cnt))) {
+        return (MKAVL_RC_E_EINVAL);
     }
+    *found_cnt = 0;
 
-    for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
-        local_tree_h->avl_tree_array[i].tree = NULL;
-        local_tree_h->avl_tree_array[i].compare_fn = compare_fn_array[i];
-        if (NULL == local_tree_h->avl_tree_array[i].compare_fn) {
-            rc = MKAVL_RC_E_ENOMEM;
-            goto err_exit;
-        }
-        local_tree_h->avl_tree_array[i].avl_ctx = NULL;
+    if (0 == item_array_cnt) {
+        return (mkavl_tree_is_valid(tree_h) ? MKAVL_RC_E_SUCCESS : 
+                                              MKAVL_RC_E_EINVAL);
     }
 
-    for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
-        avl_ctx = local_allocator->malloc_fn(sizeof(*avl_ctx), context);
-        if (NULL == avl_ctx) {
-            rc = MKAVL_RC_E_ENOMEM;
-            goto err_exit;
-        }
-        avl_ctx->magic = MKAVL_CTX_STALE;
+    ctx.item_array = item_array;
+    ctx.item_array_cnt = item_array_cnt;
+    ctx.found_cnt = 0;
 
-        local_tree_h->avl_tree_array[i].tree = 
-            avl_create(mkavl_compare_wrapper, avl_ctx,
-                       &(local_tree_h->allocator.avl_allocator));
-        if (NULL == local_tree_h->avl_tree_array[i].tree) {
-            rc = MKAVL_RC_E_ENOMEM;
-            goto err_exit;
-        }
+    rc = mkavl_find_range(tree_h, key_idx, lo_item, lo_inclusive, hi_item,
+                          hi_inclusive, descending, mkavl_range_array_cb, &ctx);
+    *found_cnt = ctx.found_cnt;
 
-        avl_ctx->tree_h = local_tree_h;
-        avl_ctx->key_idx = i;
-        avl_ctx->magic = MKAVL_CTX_MAGIC;
-        local_tree_h->avl_tree_array[i].avl_ctx = avl_ctx;
-        avl_ctx = NULL;
+    return (rc);
+}
+
+/**
+ * The body of mkavl_rank() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_rank
+ */
+static mkavl_rc_e
+mkavl_rank_unlocked (mkavl_tree_handle tree_h, size_t key_idx,
+                     const void *lookup_item, size_t *rank)
+{
+    if ((NULL == lookup_item) || (NULL == rank)) {
+        return (MKAVL_RC_E_EINVAL);
     }
+    *rank = 0;
 
-    if (!mkavl_tree_is_valid(local_tree_h)) {
-        rc = MKAVL_RC_E_EINVAL;
-        goto err_exit;
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    *tree_h = local_tree_h;
+    if (key_idx >= tree_h->avl_tree_count) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    *rank = avl_rank(tree_h->avl_tree_array[key_idx].tree, lookup_item, false);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the rank of an item for one key, which is the number of items less than
+ * it.  If the item is in the tree, this is its 0-based position in the order of
+ * the key.  This is O(lg N).
+ *
+ * @see mkavl_select
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param lookup_item The item whose rank to get.  It need not be in the tree.
+ * @param rank Set to the number of items less than lookup_item.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_rank (mkavl_tree_handle tree_h, size_t key_idx, const void *lookup_item,
+            size_t *rank)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != rank) {
+            *rank = 0;
+        }
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_rank_unlocked(tree_h, key_idx, lookup_item, rank);
+    mkavl_unlock(tree_h);
 
     return (rc);
+}
 
-err_exit:
+/**
+ * The body of mkavl_select() once the lock of the tree, if any, is held.
+ *
+ * @see mkavl_select
+ */
+static mkavl_rc_e
+mkavl_select_unlocked (mkavl_tree_handle tree_h, size_t key_idx, size_t idx,
+                       void **found_item)
+{
+    if (NULL == found_item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
 
-    if (NULL != local_tree_h) {
-        err_rc = mkavl_delete_tree(&local_tree_h);
-        mkavl_assert_abort(mkavl_rc_e_is_ok(err_rc));
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    if (NULL != avl_ctx) {
-        /* Ownership of this memory hasn't been transferred to a tree yet */
-        local_allocator->free_fn(avl_ctx, context);
+    if (key_idx >= tree_h->avl_tree_count) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    *found_item = avl_select(tree_h->avl_tree_array[key_idx].tree, idx);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the item at a 0-based position in the order of one key.  This is
+ * O(lg N).
+ *
+ * @see mkavl_rank
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param idx The position of the item to get.
+ * @param found_item Set to the item at the position, or NULL if idx is not
+ * less than the number of items in the AVL tree.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_select (mkavl_tree_handle tree_h, size_t key_idx, size_t idx,
+              void **found_item)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != found_item) {
+            *found_item = NULL;
+        }
+        return (MKAVL_RC_E_EINVAL);
     }
 
+    mkavl_read_lock(tree_h);
+    rc = mkavl_select_unlocked(tree_h, key_idx, idx, found_item);
+    mkavl_unlock(tree_h);
+
     return (rc);
 }
 
 /**
- * Get the context pointer for the tree.
+ * The body of mkavl_count_range() once the lock of the tree, if any, is held.
  *
- * @see mkavl_new
- * @param tree_h The tree whose context to get.  This must be a valid, non-NULL
- * tree pointer or else a crash will occur.
- * @return The tree's context (possibly NULL if that was passed to mkavl_new()).
+ * @see mkavl_count_range
  */
-void *
-mkavl_get_tree_context (mkavl_tree_handle tree_h)
+static mkavl_rc_e
+mkavl_count_range_unlocked (mkavl_tree_handle tree_h, size_t key_idx,
+                            const void *lo_item, bool lo_inclusive,
+                            const void *hi_item, bool hi_inclusive,
+                            size_t *count)
 {
-    mkavl_assert_abort(mkavl_tree_is_valid(tree_h));
+    struct avl_table *avl_tree;
+    size_t lo_rank = 0, hi_rank;
+
+    if (NULL == count) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *count = 0;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (key_idx >= tree_h->avl_tree_count) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    avl_tree = tree_h->avl_tree_array[key_idx].tree;
+
+    /* The range is everything up to the upper bound less everything below */
+    hi_rank = avl_count(avl_tree);
+    if (NULL != hi_item) {
+        hi_rank = avl_rank(avl_tree, hi_item, hi_inclusive);
+    }
+    if (NULL != lo_item) {
+        lo_rank = avl_rank(avl_tree, lo_item, !lo_inclusive);
+    }
 
-    return (tree_h->context);
+    if (hi_rank > lo_rank) {
+        *count = (hi_rank - lo_rank);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
 }
 
 /**
- * The destroys the tree that was allocated by mkavl_new.  Note that this
- * doesn't actually free the data of the items as that is left to the client.
- * The item_fn parameter can be used for this purpose.  Upon return, the tree_h
- * memory is set to NULL.  This is O(N lg N) for N items.
+ * Count the items of one key that lie between two bounds without walking them.
+ * This is O(lg N) regardless of the number of items in the range.
  *
- * @see mkavl_new
- * @see mkavl_delete_tree
- * @param tree_h A pointer the the tree to free.
- * @param item_fn This function is applied to each item after it has been
- * removed from all the AVL trees.  This is only called once per item regardless
- * of how many AVL trees there are.  E.g., this could be the function to free
- * the memory for the data.  If NULL, no function is applied.
- * @param delete_context_fn This function is applied to the tree's opaque client
- * context that was given via mkavl_new().  E.g., this could free the client
- * context if it was a heap memory pointer.  If NULL, no function is applied.
- * If given, the function will be called even if the client context is NULL.
- * This function is called after all the items have been deleted and item
- * functions called.
+ * @see mkavl_find_range
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param count Set to the number of items in the range.
  * @return The return code
  */
 mkavl_rc_e
-mkavl_delete (mkavl_tree_handle *tree_h, mkavl_item_fn item_fn,
-              mkavl_delete_context_fn delete_context_fn)
+mkavl_count_range (mkavl_tree_handle tree_h, size_t key_idx,
+                   const void *lo_item, bool lo_inclusive,
+                   const void *hi_item, bool hi_inclusive, size_t *count)
 {
-    mkavl_tree_handle local_tree_h;
-    void *item, *item_to_delete;
-    uint32_t i, first_tree_idx;
-    uint32_t runaway_counter = 0;
-    struct avl_traverser avl_t = {0};
-    void *context;
-    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
-    mkavl_rc_e retval = MKAVL_RC_E_SUCCESS;
-
-    if (NULL == tree_h) {
-        return (MKAVL_RC_E_EINVAL);
-    }
-    local_tree_h = *tree_h;
-
-    if (!mkavl_tree_is_valid(local_tree_h)) {
-        return (MKAVL_RC_E_EINVAL);
-    }
+    mkavl_rc_e rc;
 
-    /* 
-     * Just randomly select the first tree as the one on which to iterate.
-     * All trees should have the same set of data, just in different orders.
-     */
-    first_tree_idx = local_tree_h->avl_tree_count;
-    for (i = 0; i < local_tree_h->avl_tree_count; ++i) {
-        if (NULL != local_tree_h->avl_tree_array[i].tree) {
-            first_tree_idx = i;
-            avl_t_init(&avl_t, 
-                       local_tree_h->avl_tree_array[first_tree_idx].tree);
-            break;
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != count) {
+            *count = 0;
         }
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    if (first_tree_idx < local_tree_h->avl_tree_count) {
-        /* 
-         * May be more efficient to just pull the root out each time instead
-         * of traversing to get the first.
-         */
-        item_to_delete = 
-            avl_t_first(&avl_t,
-                        local_tree_h->avl_tree_array[first_tree_idx].tree);
-        while (NULL != item_to_delete) {
-            mkavl_assert_abort(runaway_counter <= MKAVL_RUNAWAY_SANITY);
-            for (i = first_tree_idx; i < local_tree_h->avl_tree_count; ++i) {
-                if (NULL != local_tree_h->avl_tree_array[i].tree) {
-                    item = avl_delete(local_tree_h->avl_tree_array[i].tree,
-                                      item_to_delete);
-                    mkavl_assert_abort(NULL != item);
-                }
-            }
+    mkavl_read_lock(tree_h);
+    rc = mkavl_count_range_unlocked(tree_h, key_idx, lo_item, lo_inclusive,
+                                    hi_item, hi_inclusive, count);
+    mkavl_unlock(tree_h);
 
-            if (NULL != item_fn) {
-                rc = item_fn(item_to_delete, local_tree_h->context);
-                if (mkavl_rc_e_is_notok(rc)) {
-                    retval = rc;
-                }
-            }
+    return (rc);
+}
 
-            --(local_tree_h->item_count);
+/**
+ * Check whether an item lies below the lower bound of a range.
+ *
+ * @param tree_h The tree being searched.
+ * @param compare_fn The comparison function of the key.
+ * @param item The item to check.
+ * @param lo_item The lower bound, or NULL if there is none.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @return true if the item is below the range.
+ */
+static inline bool
+mkavl_is_below_range (mkavl_tree_handle tree_h, mkavl_compare_fn compare_fn,
+                      const void *item, const void *lo_item, bool lo_inclusive)
+{
+    int32_t cmp;
 
-            /* We deleted the last item, so there should be a new first */
-            item_to_delete = 
-                avl_t_first(&avl_t, 
-                            local_tree_h->avl_tree_array[first_tree_idx].tree);
-            ++runaway_counter;
-        }
+    if (NULL == lo_item) {
+        return (false);
     }
+    cmp = compare_fn(item, lo_item, tree_h->context);
 
-    context = local_tree_h->context;
+    return ((cmp < 0) || ((0 == cmp) && !lo_inclusive));
+}
 
-    rc = mkavl_delete_tree(tree_h);
-    mkavl_assert_abort(mkavl_rc_e_is_ok(rc));
+/**
+ * Check whether an item lies above the upper bound of a range.
+ *
+ * @param tree_h The tree being searched.
+ * @param compare_fn The comparison function of the key.
+ * @param item The item to check.
+ * @param hi_item The upper bound, or NULL if there is none.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @return true if the item is above the range.
+ */
+static inline bool
+mkavl_is_above_range (mkavl_tree_handle tree_h, mkavl_compare_fn compare_fn,
+                      const void *item, const void *hi_item, bool hi_inclusive)
+{
+    int32_t cmp;
 
-    if (NULL != delete_context_fn) {
-        rc = delete_context_fn(context);
-        if (mkavl_rc_e_is_notok(rc)) {
-            retval = rc;
-        }
+    if (NULL == hi_item) {
+        return (false);
     }
+    cmp = compare_fn(item, hi_item, tree_h->context);
 
-    return (retval);
+    return ((cmp > 0) || ((0 == cmp) && !hi_inclusive));
 }
 
 /**
- * Deep copy a mkavl tree into a new tree.
+ * The body of mkavl_aggregate_range() once the lock of the tree, if any, is
+ * held.
  *
- * @param source_tree_h The tree from which to copy.
- * @param new_tree_h A pointer to the new tree to which the copy will be done.
- * @param copy_fn A function that is applied to each item in the source tree
- * before it is copied to the new tree.  This is applied once per item
- * regardless of how many AVL trees there are.  E.g., this may allocate a deep
- * copy of the data.  If NULL, then a shallow copy of the data is copied to the
- * new tree.  Note that this function is called with the source tree's context
- * value.
- * @param item_fn If there is an error copying the new tree, this function is
- * applied to all items in the new tree as it is destroyed.  E.g., this may be a
- * function to free the data.
- * @param use_source_context If true, the client context from source_tree_h is
- * used for the new tree.  If false, new_context is used for the new tree.
- * @param new_context The opaque client context to use for the new tree if
- * user_source_context if false.
- * @param delete_context_fn Upon an error, this function will be applied to the
- * new_context if use_source_context is false.  If use_source_context is true,
- * this is a no-op in the case of an error (will not call on the source tree's
- * context).  If NULL, no function is applied.  If given, the function will be
- * called even if the client context is NULL.
- * @param allocator The memory allocation functions to use for the new tree.
- * @return The return code
+ * @see mkavl_aggregate_range
  */
-mkavl_rc_e
-mkavl_copy (mkavl_tree_handle source_tree_h, 
-            mkavl_tree_handle *new_tree_h,
-            mkavl_copy_fn copy_fn, mkavl_item_fn item_fn, 
-            bool use_source_context, void *new_context,
-            mkavl_delete_context_fn delete_context_fn,
-            mkavl_allocator_st *allocator)
+static mkavl_rc_e
+mkavl_aggregate_range_unlocked (mkavl_tree_handle tree_h, size_t key_idx,
+                                const void *lo_item, bool lo_inclusive,
+                                const void *hi_item, bool hi_inclusive,
+                                int64_t *value)
 {
-    mkavl_tree_handle local_tree_h = NULL;
-    mkavl_allocator_st *local_allocator = allocator;
-    bool allocated_mkavl_tree = false;
-    struct avl_traverser avl_t = {0};
-    mkavl_copy_fn old_copy_fn, copy_fn_to_use;
-    void *item, *existing_item;
-    void *context_to_use;
-    mkavl_delete_context_fn delete_context_fn_to_use;
-    uint32_t i;
-    bool is_first_item;
-    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+    const mkavl_aggregate_st *aggregate;
+    mkavl_compare_fn compare_fn;
+    struct avl_node *split, *node;
+    int64_t lo_value, hi_value, node_value;
+    void *context;
 
-    if (NULL == new_tree_h) {
+    if (NULL == value) {
         return (MKAVL_RC_E_EINVAL);
     }
-    *new_tree_h = NULL;
+    *value = 0;
 
-    if (!mkavl_tree_is_valid(source_tree_h)) {
+    if (!mkavl_tree_is_valid(tree_h)) {
         return (MKAVL_RC_E_EINVAL);
     }
 
-    if (NULL == local_allocator) {
-        local_allocator = &(source_tree_h->allocator.mkavl_allocator);
+    if ((key_idx >= tree_h->avl_tree_count) ||
+        !mkavl_aggregate_is_kept(tree_h, key_idx)) {
+        return (MKAVL_RC_E_EINVAL);
     }
-
-    {
-        mkavl_compare_fn cmp_fn_array[source_tree_h->avl_tree_count];
-
-        for (i = 0; i < NELEMS(cmp_fn_array); ++i) {
-            cmp_fn_array[i] = source_tree_h->avl_tree_array[i].compare_fn;
+    aggregate = &(tree_h->aggregate_array[key_idx]);
+    compare_fn = tree_h->avl_tree_array[key_idx].compare_fn;
+    context = tree_h->context;
+    *value = mkavl_aggregate_identity(aggregate);
+
+    /* Find the highest node in the range, where the two bounds split */
+    split = tree_h->avl_tree_array[key_idx].tree->avl_root;
+    while (NULL != split) {
+        if (mkavl_is_below_range(tree_h, compare_fn, split->avl_data, lo_item,
+                                 lo_inclusive)) {
+            split = split->avl_link[1];
+        } else if (mkavl_is_above_range(tree_h, compare_fn, split->avl_data,
+                                        hi_item, hi_inclusive)) {
+            split = split->avl_link[0];
+        } else {
+            break;
         }
+    }
 
-        context_to_use = new_context;
-        if (use_source_context) {
-            context_to_use = source_tree_h->context;
+    if (NULL == split) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    /*
+     * Everything left of the split is below the upper bound.  Each node at or
+     * above the lower bound is in the range along with its right subtree, and
+     * comes after whatever is found deeper down.
+     */
+    lo_value = mkavl_aggregate_identity(aggregate);
+    node = split->avl_link[0];
+    while (NULL != node) {
+        if (mkavl_is_below_range(tree_h, compare_fn, node->avl_data, lo_item,
+                                 lo_inclusive)) {
+            node = node->avl_link[1];
+            continue;
         }
 
-        rc = mkavl_new(&local_tree_h,
-                       cmp_fn_array, NELEMS(cmp_fn_array),
-                       context_to_use, local_allocator);
-        if (mkavl_rc_e_is_notok(rc)) {
-            goto err_exit;
+        node_value = mkavl_aggregate_extract(aggregate, node->avl_data,
+                                             context);
+        if (NULL != node->avl_link[1]) {
+            node_value = mkavl_aggregate_combine(aggregate, node_value,
+                             *mkavl_node_aggregate(node->avl_link[1]), context);
         }
-        allocated_mkavl_tree = true;
+        lo_value = mkavl_aggregate_combine(aggregate, node_value, lo_value,
+                                           context);
+        node = node->avl_link[0];
+    }
 
-        /*
-         * Copy the first AVL tree (which applies the user's copy function to
-         * each item).  Then, iterate over the new, copied tree and add each
-         * item to each of the other AVL trees.  Need to temorarily set the
-         * source tree's copy function to the user provided one during this
-         * iteration, since mkavl_copy_wrapper will look there for the function
-         * to use for the real copy function.
-         */
-        old_copy_fn = source_tree_h->copy_fn;
-        source_tree_h->copy_fn = copy_fn;
-        copy_fn_to_use = NULL;
-        if (NULL != copy_fn) {
-            copy_fn_to_use = mkavl_copy_wrapper;
-        }
-        /*
-         * avl_copy() is going to allocate the tree, but mkavl_new() already did
-         * this, so we free the mkavl_new one here to prevent a leak.
-         */
-        local_tree_h->allocator.mkavl_allocator.free_fn(
-            local_tree_h->avl_tree_array[0].tree, local_tree_h->context);
-        local_tree_h->avl_tree_array[0].tree = 
-            avl_copy(source_tree_h->avl_tree_array[0].tree, copy_fn_to_use,
-                     NULL, &(local_tree_h->allocator.avl_allocator));
-        source_tree_h->copy_fn = old_copy_fn;
-        if (NULL == local_tree_h->avl_tree_array[0].tree) {
-            goto err_exit;
+    /* The mirror image for the upper bound right of the split */
+    hi_value = mkavl_aggregate_identity(aggregate);
+    node = split->avl_link[1];
+    while (NULL != node) {
+        if (mkavl_is_above_range(tree_h, compare_fn, node->avl_data, hi_item,
+                                 hi_inclusive)) {
+            node = node->avl_link[0];
+            continue;
         }
 
-        local_tree_h->item_count = 
-            avl_count(local_tree_h->avl_tree_array[0].tree);
-        /* 
-         * avl_copy() sets the AVL context to that of the source, so we need to
-         * fix it up here explicitly.
-         */
-        local_tree_h->avl_tree_array[0].tree->avl_param =
-            local_tree_h->avl_tree_array[0].avl_ctx;
-
-        if (local_tree_h->avl_tree_count > 1) {
-            item = avl_t_first(&avl_t, local_tree_h->avl_tree_array[0].tree);
-            is_first_item = true;
-            while (NULL != item) {
-                for (i = 1; i < local_tree_h->avl_tree_count; ++i) {
-                    if (is_first_item) {
-                        /* 
-                         * avl_copy() sets the AVL context to that of the
-                         * source, so we need to fix it up here explicitly.
-                         */
-                        local_tree_h->avl_tree_array[i].tree->avl_param =
-                            local_tree_h->avl_tree_array[i].avl_ctx;
-                    }
-                    rc = mkavl_add_key_idx(local_tree_h, i,
-                                           item, &existing_item);
-                    if (mkavl_rc_e_is_notok(rc)) {
-                        goto err_exit;
-                    }
-                }
-                item = avl_t_next(&avl_t);
-                is_first_item = false;
-            }
+        node_value = mkavl_aggregate_extract(aggregate, node->avl_data,
+                                             context);
+        if (NULL != node->avl_link[0]) {
+            node_value = mkavl_aggregate_combine(aggregate,
+                             *mkavl_node_aggregate(node->avl_link[0]),
+                             node_value, context);
         }
+        hi_value = mkavl_aggregate_combine(aggregate, hi_value, node_value,
+                                           context);
+        node = node->avl_link[1];
     }
 
-    *new_tree_h = local_tree_h;
+    node_value = mkavl_aggregate_extract(aggregate, split->avl_data, context);
+    *value = mkavl_aggregate_combine(aggregate,
+                 mkavl_aggregate_combine(aggregate, lo_value, node_value,
+                                         context),
+                 hi_value, context);
 
     return (MKAVL_RC_E_SUCCESS);
+}
 
-err_exit:
+/**
+ * Get the aggregate over the items of one key that lie between two bounds.
+ * The key must have been given an aggregate in the options of the tree.  This
+ * is O(lg N) regardless of the number of items in the range since only the
+ * subtree aggregates along the two boundary paths are combined.
+ *
+ * @see mkavl_aggregate_st
+ * @see mkavl_count_range
+ * @param tree_h The tree to search.
+ * @param key_idx The AVL tree being searched.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param value Set to the aggregate of the items in the range, or the identity
+ * of the aggregate if the range is empty.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_aggregate_range (mkavl_tree_handle tree_h, size_t key_idx,
+                       const void *lo_item, bool lo_inclusive,
+                       const void *hi_item, bool hi_inclusive, int64_t *value)
+{
+    mkavl_rc_e rc;
 
-    if (allocated_mkavl_tree) {
-        delete_context_fn_to_use = NULL;
-        if (!use_source_context) {
-            delete_context_fn_to_use = delete_context_fn;
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != value) {
+            *value = 0;
         }
-        /* Just deleting the tree should clean everything up. */
-        mkavl_delete(&local_tree_h, item_fn, delete_context_fn_to_use);
+        return (MKAVL_RC_E_EINVAL);
     }
 
+    mkavl_read_lock(tree_h);
+    rc = mkavl_aggregate_range_unlocked(tree_h, key_idx, lo_item, lo_inclusive,
+                                        hi_item, hi_inclusive, value);
+    mkavl_unlock(tree_h);
+
     return (rc);
 }
 
 /**
- * Add an item to each AVL tree in the mkavl.
+ * The body of mkavl_remove() once the lock of the tree, if any, is held.
  *
- * @param tree_h The mkavl tree.
- * @param item_to_add A pointer to the data to add.
- * @param existing_item If an existing item is found, it is returned.
- * Otherwise, NULL if the item was not found.
- * @return The return code
+ * @see mkavl_remove
  */
-mkavl_rc_e
-mkavl_add (mkavl_tree_handle tree_h, void *item_to_add, 
-           void **existing_item)
+static mkavl_rc_e
+mkavl_remove_unlocked (mkavl_tree_handle tree_h, const void *item_to_remove,
+                       void **found_item)
 {
     uint32_t i, err_idx = 0;
     void *item, *first_item = NULL;
-    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
 
-    if ((NULL == item_to_add) || (NULL == existing_item)) {
+    if ((NULL == item_to_remove) || (NULL == found_item)) {
         return (MKAVL_RC_E_EINVAL);
     }
-    *existing_item = NULL;
+    *found_item = NULL;
 
-    if (!mkavl_tree_is_valid(tree_h)) {
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only) {
         return (MKAVL_RC_E_EINVAL);
     }
 
+    rc = mkavl_prepare_remove(tree_h, 0, item_to_remove);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    if (tree_h->opts.persistent) {
+        for (i = 0; i < tree_h->avl_tree_count; ++i) {
+            if (0 == avl_unshare(tree_h->avl_tree_array[i].tree,
+                                 item_to_remove, 1)) {
+                return (MKAVL_RC_E_ENOMEM);
+            }
+        }
+    }
+
     for (i = 0; i < tree_h->avl_tree_count; ++i) {
-        item = avl_insert(tree_h->avl_tree_array[i].tree, item_to_add);
+        item = mkavl_avl_delete(tree_h, i, item_to_remove);
         if (0 == i) {
             first_item = item;
         } else if (first_item != item) {
@@ -1028,461 +6825,488 @@ mkavl_add (mkavl_tree_handle tree_h, void *item_to_add,
         }
     }
 
-    if (NULL == first_item) {
-        ++(tree_h->item_count);
+    if (NULL != first_item) {
+        if (0 == tree_h->item_count) {
+            rc = MKAVL_RC_E_EOOSYNC;
+            goto err_exit;
+        }
+        --(tree_h->item_count);
     }
 
-    *existing_item = first_item;
+    *found_item = first_item;
 
     return (rc);
 
 err_exit:
 
     for (i = 0; i < err_idx; ++i) {
-        if (NULL == first_item) {
-            /* Attempt to remove all the items we added */
-            item = avl_delete(tree_h->avl_tree_array[i].tree, item_to_add);
-            mkavl_assert_abort(NULL != item);
+        if (NULL != first_item) {
+            /* Attempt to insert all the items we removed */
+            err_rc = mkavl_avl_insert(tree_h, i, first_item, NULL, &item);
+            mkavl_assert_abort(mkavl_rc_e_is_ok(err_rc) && (NULL == item));
         }
     }
 
-    return (rc);
-}
-
-/**
- * Get the item at the end of the AVL tree.  That is, either the first or last
- * item in the tree rooted at the node depending on the side input.
- *
- * @param node The root of the subtree to search.
- * @param found_item  The item found.
- * @param side 0 to find the first (smallest) item or 1 to find the last
- * (largest) item
- * @return The return code
- */
-static inline mkavl_rc_e
-mkavl_avl_end_item (const struct avl_node *node, void **found_item,
-                    uint8_t side)
-{
-    const struct avl_node *cur_node;
-
-    if (NULL == found_item) {
-        return (MKAVL_RC_E_EINVAL);
-    }
-    *found_item = NULL;
-
-    if (side >= 2) {
-        return (MKAVL_RC_E_EINVAL);
-    }
-
-    if (NULL == node) {
-        return (MKAVL_RC_E_SUCCESS);
-    }
-    cur_node = node;
-
-    while (NULL != cur_node->avl_link[side]) {
-        cur_node = cur_node->avl_link[side];
-    }
-    *found_item = cur_node->avl_data;
-
-    return (MKAVL_RC_E_SUCCESS);
-}
-
-/**
- * Get the first (smallest) item in the tree rooted at the node.
- *
- * @param node The root of the subtree.
- * @param found_item The item that was found.
- * @return The return code
- */
-static mkavl_rc_e
-mkavl_avl_first (const struct avl_node *node, void **found_item)
-{
-    return (mkavl_avl_end_item(node, found_item, 0));
+    return (rc);
 }
 
 /**
- * Get the last (largest) item in the tree rooted at the node.
+ * Remove an item from mkavl tree.
  *
- * @param node The root of the subtree.
- * @param found_item The item that was found.
- * @return The return code
+ * @param tree_h The tree from which to remove.
+ * @param item_to_remove The item being removed.
+ * @param found_item If the item existed, the item that was found and removed.
+ * @return The return code.  With a write-ahead log, the item found is
+ * serialized before it is removed, and an error from the serialize function
+ * is returned as is with the tree unchanged.  MKAVL_RC_E_EINVAL is returned,
+ * with the tree unchanged, once the log has failed.  MKAVL_RC_E_EIO means the
+ * item was removed but the removal may not be durable, since the log failed.
  */
-static mkavl_rc_e
-mkavl_avl_last (const struct avl_node *node, void **found_item)
+mkavl_rc_e
+mkavl_remove (mkavl_tree_handle tree_h, const void *item_to_remove,
+              void **found_item)
 {
-    return (mkavl_avl_end_item(node, found_item, 1));
+    mkavl_wal_handle wal_h = NULL;
+    uint64_t cmp_cnt = mkavl_thread_cmp_cnt;
+    uint64_t lsn = 0;
+    mkavl_rc_e rc;
+    MKAVL_LATENCY_START(start);
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != found_item) {
+            *found_item = NULL;
+        }
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_trace_call(MKAVL_TRACE_EVENT_E_REMOVE_ENTRY, tree_h, MKAVL_TRACE_ALL_KEYS,
+                     MKAVL_FIND_TYPE_E_INVALID, item_to_remove, cmp_cnt,
+                     MKAVL_RC_E_INVALID);
+    mkavl_write_lock(tree_h);
+    rc = mkavl_remove_unlocked(tree_h, item_to_remove, found_item);
+    mkavl_lockless_write_end(tree_h);
+    if (mkavl_rc_e_is_ok(rc) && (NULL != *found_item)) {
+        mkavl_stats_add(tree_h, MKAVL_STAT_E_REMOVE, 1);
+        rc = mkavl_log_change(tree_h, MKAVL_WAL_OP_E_REMOVE, 0, &wal_h,
+                              &lsn);
+    }
+    mkavl_write_unlock(tree_h);
+
+    rc = mkavl_commit_change(wal_h, lsn, rc);
+    MKAVL_LATENCY_END(MKAVL_LATENCY_OP_E_REMOVE, start);
+    mkavl_trace_call(MKAVL_TRACE_EVENT_E_REMOVE_EXIT, tree_h, MKAVL_TRACE_ALL_KEYS,
+                     MKAVL_FIND_TYPE_E_INVALID, item_to_remove, cmp_cnt, rc);
+
+    return (rc);
 }
 
 /**
- * Find the item less than (or equal to) the given lookup_item.  Note that the
- * lookup_item does not necessarily have to exist in the tree for an item to be
- * found.  This is a recursive funciton.
+ * The body of mkavl_add_key_idx() once the lock of the tree, if any, is held.
  *
- * @param avl_tree The AVL tree to search.
- * @param node The current node to compare.
- * @param find_equal_to Indicates whether to return an equal item if found or
- * only strictly less than.
- * @param lookup_item The item to use as the lookup target.
- * @param found_item The item found.
- * @return The return code
+ * @see mkavl_add_key_idx
  */
 static mkavl_rc_e
-mkavl_find_avl_lt (const struct avl_table *avl_tree,
-                   const struct avl_node *node,
-                   bool find_equal_to, const void *lookup_item, 
-                   void **found_item)
+mkavl_add_key_idx_unlocked (mkavl_tree_handle tree_h, size_t key_idx,
+                            void *item_to_add, void **existing_item)
 {
-    int32_t cmp_rc;
     mkavl_rc_e rc;
 
-    if ((NULL == found_item) || (NULL == lookup_item) ||
-        (NULL == avl_tree)) {
+    if ((NULL == item_to_add) || (NULL == existing_item)) {
         return (MKAVL_RC_E_EINVAL);
     }
-    *found_item = NULL;
+    *existing_item = NULL;
 
-    if (NULL == node) {
-        return (MKAVL_RC_E_SUCCESS);
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only) {
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    cmp_rc = avl_tree->avl_compare(node->avl_data, lookup_item,
-                                   avl_tree->avl_param);
-
-    if (cmp_rc < 0) {
-        /* Current node is less than what we're searching for */
-        rc = mkavl_find_avl_lt(avl_tree, node->avl_link[1], find_equal_to,
-                               lookup_item, found_item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            return (rc);
-        }
-
-        if (NULL == *found_item) {
-            /* 
-             * There is nothing smaller in the right subtree, so the current
-             * node is the winner.  Otherwise, return what was found in the
-             * right subtree.
-             */
-            *found_item = node->avl_data;
-        }
-
-        return (MKAVL_RC_E_SUCCESS);
-    } else if (cmp_rc > 0) {
-        /* Current node is greater than what we're searching for */
-        return (mkavl_find_avl_lt(avl_tree, node->avl_link[0], find_equal_to,
-                                  lookup_item, found_item));
+    if (key_idx >= tree_h->avl_tree_count) {
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    /* Current node is equal to what we're searching for */
-
-    if (find_equal_to) {
-        /* We're done if we can stop on equality */
-        *found_item = node->avl_data;
-        return (MKAVL_RC_E_SUCCESS);
+    rc = mkavl_prepare_change(tree_h, item_to_add);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
     }
 
-    /* 
-     * If we can't stop on equality, then get the biggest item in the left
-     * subtree.
-     */
-    return (mkavl_avl_last(node->avl_link[0], found_item));
+    return (mkavl_avl_insert(tree_h, key_idx, item_to_add, NULL,
+                             existing_item));
 }
 
 /**
- * Find the item greater than (or equal to) the given lookup_item.  Note that
- * the lookup_item does not necessarily have to exist in the tree for an item to
- * be found.  This is a recursive funciton.
+ * Add an item only to a specific AVL tree within the mkavl tree.  Note that
+ * this must be used very carefully in conjunction with mkavl_remove_key_idx to
+ * make sure the mkavl does not become out of sync.  In steady state, the mkavl
+ * should always have an equal number of data items in each AVL tree.  However,
+ * if a field changes in an item that affects some keys but not other, these
+ * APIs may be used to remove the item with the old values from the affected
+ * AVLs, update the values, and then re-add to each AVL tree from which the old
+ * item was removed.
  *
- * @param avl_tree The AVL tree to search.
- * @param node The current node to compare.
- * @param find_equal_to Indicates whether to return an equal item if found or
- * only strictly greater than.
- * @param lookup_item The item to use as the lookup target.
- * @param found_item The item found.
- * @return The return code
+ * @see mkavl_remove_key_idx
+ * @param tree_h The mkavl tree.
+ * @param key_idx The index of the AVL tree to which the item is added.
+ * @param item_to_add The item being added.
+ * @param existing_item If an existing item is found, it is returned.
+ * @return The return code.  With a write-ahead log, the errors are as for
+ * mkavl_add().
  */
-static mkavl_rc_e
-mkavl_find_avl_gt (const struct avl_table *avl_tree,
-                   const struct avl_node *node,
-                   bool find_equal_to, const void *lookup_item, 
-                   void **found_item)
+mkavl_rc_e
+mkavl_add_key_idx (mkavl_tree_handle tree_h, size_t key_idx,
+                   void *item_to_add, void **existing_item)
 {
-    int32_t cmp_rc;
+    mkavl_wal_handle wal_h = NULL;
+    uint64_t lsn = 0;
     mkavl_rc_e rc;
 
-    if ((NULL == found_item) || (NULL == lookup_item) ||
-        (NULL == avl_tree)) {
-        return (MKAVL_RC_E_EINVAL);
-    }
-    *found_item = NULL;
-
-    if (NULL == node) {
-        return (MKAVL_RC_E_SUCCESS);
-    }
-
-    cmp_rc = avl_tree->avl_compare(node->avl_data, lookup_item,
-                                   avl_tree->avl_param);
-
-    if (cmp_rc < 0) {
-        /* Current node is less than what we're searching for */
-        return (mkavl_find_avl_gt(avl_tree, node->avl_link[1], find_equal_to,
-                                  lookup_item, found_item));
-    } else if (cmp_rc > 0) {
-        /* Current node is greater than what we're searching for */
-        rc = mkavl_find_avl_gt(avl_tree, node->avl_link[0], find_equal_to,
-                               lookup_item, found_item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            return (rc);
-        }
-
-        if (NULL == *found_item) {
-            /* 
-             * There is nothing bigger in the left subtree, so the current node
-             * is the winner.  Otherwise, return what was found in the left
-             * subtree.
-             */
-            *found_item = node->avl_data;
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != existing_item) {
+            *existing_item = NULL;
         }
-
-        return (MKAVL_RC_E_SUCCESS);
+        return (MKAVL_RC_E_EINVAL);
     }
 
-    /* Current node is equal to what we're searching for */
-
-    if (find_equal_to) {
-        /* We're done if we can stop on equality */
-        *found_item = node->avl_data;
-        return (MKAVL_RC_E_SUCCESS);
+    mkavl_write_lock(tree_h);
+    rc = mkavl_add_key_idx_unlocked(tree_h, key_idx, item_to_add,
+                                    existing_item);
+    mkavl_lockless_write_end(tree_h);
+    if (mkavl_rc_e_is_ok(rc) && (NULL == *existing_item)) {
+        rc = mkavl_log_change(tree_h, MKAVL_WAL_OP_E_ADD_KEY_IDX, key_idx,
+                              &wal_h, &lsn);
     }
+    mkavl_write_unlock(tree_h);
 
-    /* 
-     * If we can't stop on equality, then get the smallest item in the right
-     * subtree.
-     */
-    return (mkavl_avl_first(node->avl_link[1], found_item));
+    return (mkavl_commit_change(wal_h, lsn, rc));
 }
 
 /**
- * Find an item in the tree.
+ * The body of mkavl_remove_key_idx() once the lock of the tree, if any, is
+ * held.
  *
- * @param tree_h The tree to search
- * @param type The type of lookup to do.
- * @param key_idx The AVL tree being searched.
- * @param lookup_item The item to use as the lookup target.
- * @param found_item The item found for the lookup.
- * @return The return code
+ * @see mkavl_remove_key_idx
  */
-mkavl_rc_e
-mkavl_find (mkavl_tree_handle tree_h, mkavl_find_type_e type,
-            size_t key_idx, const void *lookup_item, void **found_item)
+static mkavl_rc_e
+mkavl_remove_key_idx_unlocked (mkavl_tree_handle tree_h, size_t key_idx,
+                               const void *item_to_remove, void **found_item)
 {
-    void *item = NULL;
     mkavl_rc_e rc;
 
-    if ((NULL == lookup_item) || (NULL == found_item)) {
+    if ((NULL == item_to_remove) || (NULL == found_item)) {
         return (MKAVL_RC_E_EINVAL);
     }
     *found_item = NULL;
 
-    if (!mkavl_find_type_e_is_valid(type)) {
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->read_only) {
         return (MKAVL_RC_E_EINVAL);
     }
 
-    if (!mkavl_tree_is_valid(tree_h)) {
+    if (key_idx >= tree_h->avl_tree_count) {
         return (MKAVL_RC_E_EINVAL);
     }
 
-    if (key_idx >= tree_h->avl_tree_count) {
-        return (MKAVL_RC_E_EINVAL);
+    rc = mkavl_prepare_remove(tree_h, key_idx, item_to_remove);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
     }
 
-    switch (type) {
-    case MKAVL_FIND_TYPE_E_EQUAL:
-        item = avl_find(tree_h->avl_tree_array[key_idx].tree, lookup_item);
-        break;
-    case MKAVL_FIND_TYPE_E_GT:
-        rc = mkavl_find_avl_gt(tree_h->avl_tree_array[key_idx].tree,
-                               tree_h->avl_tree_array[key_idx].tree->avl_root,
-                               false, lookup_item, &item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            return (rc);
-        }
-        break;
-    case MKAVL_FIND_TYPE_E_GE:
-        rc = mkavl_find_avl_gt(tree_h->avl_tree_array[key_idx].tree,
-                               tree_h->avl_tree_array[key_idx].tree->avl_root,
-                               true, lookup_item, &item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            return (rc);
-        }
-        break;
-    case MKAVL_FIND_TYPE_E_LT:
-        rc = mkavl_find_avl_lt(tree_h->avl_tree_array[key_idx].tree,
-                               tree_h->avl_tree_array[key_idx].tree->avl_root,
-                               false, lookup_item, &item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            return (rc);
-        }
-        break;
-    case MKAVL_FIND_TYPE_E_LE:
-        rc = mkavl_find_avl_lt(tree_h->avl_tree_array[key_idx].tree,
-                               tree_h->avl_tree_array[key_idx].tree->avl_root,
-                               true, lookup_item, &item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            return (rc);
-        }
-        break;
-    default:
-        return (MKAVL_RC_E_EINVAL);
+    if (tree_h->opts.persistent &&
+        (0 == avl_unshare(tree_h->avl_tree_array[key_idx].tree,
+                          item_to_remove, 1))) {
+        return (MKAVL_RC_E_ENOMEM);
     }
 
-    *found_item = item;
+    *found_item = mkavl_avl_delete(tree_h, key_idx, item_to_remove);
 
     return (MKAVL_RC_E_SUCCESS);
 }
 
 /**
- * Remove an item from mkavl tree.
+ * Remove an item only from a specific AVL tree within the mkavl tree.  Note
+ * that this must be used very carefully in conjunction with
+ * mkavl_add_key_idx to make sure the mkavl does not become out of sync.  In
+ * steady state, the mkavl should always have an equal number of data items in
+ * each AVL tree.  However, if a field changes in an item that affects some keys
+ * but not other, these APIs may be used to remove the item with the old values
+ * from the affected AVLs, update the values, and then re-add to each AVL tree
+ * from which the old item was removed.  mkavl_update() does this safely.
  *
- * @param tree_h The tree from which to remove.
+ * @see mkavl_add_key_idx
+ * @see mkavl_update
+ * @param tree_h The mkavl tree.
+ * @param key_idx The index of the AVL tree to which the item is added.
  * @param item_to_remove The item being removed.
  * @param found_item If the item existed, the item that was found and removed.
+ * @return The return code.  With a write-ahead log, the errors are as for
+ * mkavl_remove().
+ */
+mkavl_rc_e
+mkavl_remove_key_idx (mkavl_tree_handle tree_h, size_t key_idx,
+                      const void *item_to_remove, void **found_item)
+{
+    mkavl_wal_handle wal_h = NULL;
+    uint64_t lsn = 0;
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        if (NULL != found_item) {
+            *found_item = NULL;
+        }
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_write_lock(tree_h);
+    rc = mkavl_remove_key_idx_unlocked(tree_h, key_idx, item_to_remove,
+                                       found_item);
+    mkavl_lockless_write_end(tree_h);
+    if (mkavl_rc_e_is_ok(rc) && (NULL != *found_item)) {
+        rc = mkavl_log_change(tree_h, MKAVL_WAL_OP_E_REMOVE_KEY_IDX, key_idx,
+                              &wal_h, &lsn);
+    }
+    mkavl_write_unlock(tree_h);
+
+    return (mkavl_commit_change(wal_h, lsn, rc));
+}
+
+/**
+ * The body of mkavl_update() once the input has been checked.
+ *
+ * @see mkavl_update
+ * @param tree_h The mkavl tree.
+ * @param item The item to change.
+ * @param update_fn The function to change the item.
+ * @param update_context The opaque context passed to update_fn.
+ * @param existing_item Set to the item collided with, if any.
  * @return The return code
  */
-mkavl_rc_e
-mkavl_remove (mkavl_tree_handle tree_h, const void *item_to_remove,
-              void **found_item)
+static mkavl_rc_e
+mkavl_update_item (mkavl_tree_handle tree_h, void *item,
+                   mkavl_update_fn update_fn, void *update_context,
+                   void **existing_item)
 {
-    uint32_t i, err_idx = 0;
-    void *item, *first_item = NULL;
-    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+    struct avl_traverser avl_t[tree_h->avl_tree_count];
+    struct avl_node *moved_node_array[tree_h->avl_tree_count];
+    unsigned long rotation_cnt_array[tree_h->avl_tree_count];
+    struct avl_traverser neighbor_avl_t;
+    struct avl_table *avl_tree;
+    mkavl_compare_fn compare_fn;
+    void *neighbor, *collision = NULL, **found;
+    bool is_in_tree = false, is_moved;
+    mkavl_rc_e rc, undo_rc;
+    size_t i;
 
-    if ((NULL == item_to_remove) || (NULL == found_item)) {
-        return (MKAVL_RC_E_EINVAL);
+    /* Remember where the item is in each AVL tree before changing it */
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        if (item == avl_t_find(&(avl_t[i]), tree_h->avl_tree_array[i].tree,
+                               item)) {
+            is_in_tree = true;
+        } else {
+            avl_t[i].avl_node = NULL;
+        }
     }
-    *found_item = NULL;
 
-    if (!mkavl_tree_is_valid(tree_h)) {
+    if (!is_in_tree) {
         return (MKAVL_RC_E_EINVAL);
     }
 
+    /* Lockless readers compare against the item while it is changed */
+    mkavl_lockless_write_begin(tree_h);
+    rc = update_fn(item, false, tree_h->context, update_context);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    /* The record needs the changed item, and the change is undone without it */
+    rc = mkavl_prepare_change(tree_h, item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        undo_rc = update_fn(item, true, tree_h->context, update_context);
+        mkavl_assert_abort(mkavl_rc_e_is_ok(undo_rc));
+        return (rc);
+    }
+
+    /* Take the item out of each AVL tree whose order the change upset */
     for (i = 0; i < tree_h->avl_tree_count; ++i) {
-        item = avl_delete(tree_h->avl_tree_array[i].tree, item_to_remove);
-        if (0 == i) {
-            first_item = item;
-        } else if (first_item != item) {
-            err_idx = i + 1;
-            rc = MKAVL_RC_E_EOOSYNC;
-            goto err_exit;
+        moved_node_array[i] = NULL;
+        if (NULL == avl_t[i].avl_node) {
+            continue;
+        }
+        compare_fn = tree_h->avl_tree_array[i].compare_fn;
+
+        avl_t_copy(&neighbor_avl_t, &(avl_t[i]));
+        neighbor = avl_t_prev(&neighbor_avl_t);
+        is_moved = ((NULL != neighbor) &&
+                    (compare_fn(neighbor, item, tree_h->context) >= 0));
+
+        if (!is_moved) {
+            avl_t_copy(&neighbor_avl_t, &(avl_t[i]));
+            neighbor = avl_t_next(&neighbor_avl_t);
+            is_moved = ((NULL != neighbor) &&
+                        (compare_fn(item, neighbor, tree_h->context) >= 0));
         }
-    }
 
-    if (NULL != first_item) {
-        if (0 == tree_h->item_count) {
-            rc = MKAVL_RC_E_EOOSYNC;
-            goto err_exit;
+        if (is_moved) {
+            rotation_cnt_array[i] =
+                tree_h->avl_tree_array[i].tree->avl_rotations;
+            moved_node_array[i] = avl_t_unlink(&(avl_t[i]));
         }
-        --(tree_h->item_count);
     }
 
-    *found_item = first_item;
-
-    return (rc);
+    for (i = 0; (i < tree_h->avl_tree_count) && (NULL == collision); ++i) {
+        if (NULL != moved_node_array[i]) {
+            collision = avl_find(tree_h->avl_tree_array[i].tree, item);
+        }
+    }
 
-err_exit:
+    if (NULL != collision) {
+        rc = update_fn(item, true, tree_h->context, update_context);
+        mkavl_assert_abort(mkavl_rc_e_is_ok(rc));
+        *existing_item = collision;
+    }
 
-    for (i = 0; i < err_idx; ++i) {
-        if (NULL != first_item) {
-            /* Attempt to insert all the items we removed */
-            item = avl_insert(tree_h->avl_tree_array[i].tree, first_item);
-            mkavl_assert_abort(NULL == item);
+    /* Put the item back with its new or restored keys */
+    for (i = 0; i < tree_h->avl_tree_count; ++i) {
+        avl_tree = tree_h->avl_tree_array[i].tree;
+        if (NULL != moved_node_array[i]) {
+            found = avl_probe_node(avl_tree, item, moved_node_array[i]);
+            mkavl_assert_abort(found == &(moved_node_array[i]->avl_data));
+            mkavl_trace_rebalance(tree_h, i, rotation_cnt_array[i]);
+        } else if ((NULL != avl_t[i].avl_node) && (NULL == collision)) {
+            /* Still in place, but the aggregates may have changed */
+            avl_t_refresh(&(avl_t[i]));
         }
     }
 
-    return (rc);
+    return (MKAVL_RC_E_SUCCESS);
 }
 
 /**
- * Add an item only to a specific AVL tree within the mkavl tree.  Note that
- * this must be used very carefully in conjunction with mkavl_remove_key_idx to
- * make sure the mkavl does not become out of sync.  In steady state, the mkavl
- * should always have an equal number of data items in each AVL tree.  However,
- * if a field changes in an item that affects some keys but not other, these
- * APIs may be used to remove the item with the old values from the affected
- * AVLs, update the values, and then re-add to each AVL tree from which the old
- * item was removed.
+ * Change the keyed fields of an item in place.  The item is only moved in the
+ * AVL trees whose order the change upsets: the neighbors of the item in each
+ * AVL tree are found before the change, and if the item still falls between
+ * them afterwards it stays where it is.  Moving reuses the nodes of the item,
+ * so an update never allocates.
  *
- * @see mkavl_remove_key_idx
+ * If the changed item would be equal to another item for some key, the change
+ * is undone by calling update_fn again with undo set, the item is put back
+ * where it was and the other item is returned in existing_item.
+ *
+ * @see mkavl_update_fn
  * @param tree_h The mkavl tree.
- * @param key_idx The index of the AVL tree to which the item is added.
- * @param item_to_add The item being added.
- * @param existing_item If an existing item is found, it is returned.
- * @return The return code
+ * @param item The item to change, which must be in the tree.
+ * @param update_fn The function to change the item.
+ * @param update_context The opaque context passed to update_fn.
+ * @param existing_item If the change collided with an item for some key, that
+ * item is returned and the change is undone.  Otherwise, NULL is returned.
+ * @return The return code.  An error from update_fn is returned as is, and the
+ * tree is unchanged.  MKAVL_RC_E_EINVAL is returned for a persistent tree.
+ * With a write-ahead log, the item is serialized before and after update_fn
+ * changes it, but before it is moved.  An error from the serialize function
+ * is returned as is with the change undone.  MKAVL_RC_E_EINVAL is returned,
+ * with the tree unchanged, once the log has failed.  MKAVL_RC_E_EIO means the
+ * item was changed but the change may not be durable, since the log failed.
  */
 mkavl_rc_e
-mkavl_add_key_idx (mkavl_tree_handle tree_h, size_t key_idx,
-                   void *item_to_add, void **existing_item)
+mkavl_update (mkavl_tree_handle tree_h, void *item,
+              mkavl_update_fn update_fn, void *update_context,
+              void **existing_item)
 {
-    void *item;
+    mkavl_wal_handle wal_h = NULL;
+    uint64_t lsn = 0;
+    mkavl_rc_e rc;
 
-    if ((NULL == item_to_add) || (NULL == existing_item)) {
+    if ((NULL == item) || (NULL == update_fn) || (NULL == existing_item)) {
         return (MKAVL_RC_E_EINVAL);
     }
     *existing_item = NULL;
 
-    if (!mkavl_tree_is_valid(tree_h)) {
+    /* The item may also be in trees sharing the nodes of a persistent tree */
+    if (!mkavl_tree_is_valid(tree_h) || tree_h->opts.persistent) {
         return (MKAVL_RC_E_EINVAL);
     }
 
-    if (key_idx >= tree_h->avl_tree_count) {
-        return (MKAVL_RC_E_EINVAL);
+    mkavl_write_lock(tree_h);
+    rc = MKAVL_RC_E_SUCCESS;
+    if (NULL != tree_h->wal) {
+        /* The record needs the item from before the change */
+        rc = mkavl_wal_stage(tree_h->wal, item, tree_h->context);
     }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_update_item(tree_h, item, update_fn, update_context,
+                               existing_item);
+    }
+    mkavl_lockless_write_end(tree_h);
+    if (mkavl_rc_e_is_ok(rc) && (NULL == *existing_item)) {
+        rc = mkavl_log_change(tree_h, MKAVL_WAL_OP_E_UPDATE, 0, &wal_h, &lsn);
+    }
+    mkavl_write_unlock(tree_h);
 
-    item = avl_insert(tree_h->avl_tree_array[key_idx].tree, item_to_add);
-    *existing_item = item;
-
-    return (MKAVL_RC_E_SUCCESS);
+    return (mkavl_commit_change(wal_h, lsn, rc));
 }
 
 /**
- * Remove an item only from a specific AVL tree within the mkavl tree.  Note
- * that this must be used very carefully in conjunction with
- * mkavl_add_key_idx to make sure the mkavl does not become out of sync.  In
- * steady state, the mkavl should always have an equal number of data items in
- * each AVL tree.  However, if a field changes in an item that affects some keys
- * but not other, these APIs may be used to remove the item with the old values
- * from the affected AVLs, update the values, and then re-add to each AVL tree
- * from which the old item was removed.
+ * Apply a function to an item once no reader can still be using it, e.g., to
+ * free an item after mkavl_remove().  With lockless reads, a reader may have
+ * found the item just before it was removed, so it must not be freed right
+ * away.  The function is applied once every reader that was inside the tree
+ * when the item was retired has left, which is checked each time an item is
+ * retired.  Items still held when the tree is deleted are released by
+ * mkavl_delete().  For a tree without lockless reads, the function is applied
+ * right away.
  *
- * @see mkavl_add_key_idx
- * @param tree_h The mkavl tree.
- * @param key_idx The index of the AVL tree to which the item is added.
- * @param item_to_remove The item being removed.
- * @param found_item If the item existed, the item that was found and removed.
- * @return The return code
+ * @see mkavl_opts_st
+ * @param tree_h The tree from which the item was removed.
+ * @param item The item, which must no longer be in the tree.
+ * @param item_fn The function to apply to the item, passed the tree context.
+ * @return The return code.  If an item function applied now fails, its return
+ * code is returned.
  */
 mkavl_rc_e
-mkavl_remove_key_idx (mkavl_tree_handle tree_h, size_t key_idx,
-                      const void *item_to_remove, void **found_item)
+mkavl_retire (mkavl_tree_handle tree_h, void *item, mkavl_item_fn item_fn)
 {
-    void *item;
+    mkavl_lockless_st *lockless;
+    mkavl_retired_st *retired;
+    uint32_t i;
 
-    if ((NULL == item_to_remove) || (NULL == found_item)) {
+    if ((NULL == item) || (NULL == item_fn) || !mkavl_tree_is_valid(tree_h)) {
         return (MKAVL_RC_E_EINVAL);
     }
-    *found_item = NULL;
 
-    if (!mkavl_tree_is_valid(tree_h)) {
-        return (MKAVL_RC_E_EINVAL);
+    lockless = tree_h->lockless;
+    if (NULL == lockless) {
+        return (item_fn(item, tree_h->context));
     }
 
-    if (key_idx >= tree_h->avl_tree_count) {
-        return (MKAVL_RC_E_EINVAL);
+    retired = tree_h->allocator.mkavl_allocator.malloc_fn(sizeof(*retired),
+                                                          tree_h->context);
+    if (NULL == retired) {
+        return (MKAVL_RC_E_ENOMEM);
     }
+    retired->item = item;
+    retired->item_fn = item_fn;
+    retired->next = NULL;
+
+    /* The tree itself is unchanged, so lockless readers need not retry */
+    mkavl_assert_abort(0 == pthread_rwlock_wrlock(&(tree_h->rwlock)));
+
+    retired->epoch = lockless->epoch;
+    if (NULL == lockless->retired_tail) {
+        lockless->retired_head = retired;
+    } else {
+        lockless->retired_tail->next = retired;
+    }
+    lockless->retired_tail = retired;
 
-    item = avl_delete(tree_h->avl_tree_array[key_idx].tree, item_to_remove);
-    *found_item = item;
+    /* Without readers in the way, the item just retired can go right away */
+    for (i = 0; i < 2; ++i) {
+        if (!mkavl_epoch_try_advance(lockless)) {
+            break;
+        }
+    }
+    retired = mkavl_retired_take(lockless, false);
 
-    return (MKAVL_RC_E_SUCCESS);
+    mkavl_assert_abort(0 == pthread_rwlock_unlock(&(tree_h->rwlock)));
+
+    /* The functions may take a while, so apply them without the lock */
+    return (mkavl_retired_release(tree_h, retired));
 }
 
 /**
@@ -1501,25 +7325,31 @@ mkavl_remove_key_idx (mkavl_tree_handle tree_h, size_t key_idx,
 uint32_t
 mkavl_count (mkavl_tree_handle tree_h)
 {
+    uint32_t count;
+
     if (!mkavl_tree_is_valid(tree_h)) {
         return (0);
     }
 
-    return (tree_h->item_count);
+    if (NULL != tree_h->lockless) {
+        return (__atomic_load_n(&(tree_h->item_count), __ATOMIC_RELAXED));
+    }
+
+    mkavl_read_lock(tree_h);
+    count = tree_h->item_count;
+    mkavl_unlock(tree_h);
+
+    return (count);
 }
 
 /**
- * Walk every node in the tree, calling the given function for each item.  There
- * is no guarantee on the order of the walk.
+ * The body of mkavl_walk() once the lock of the tree, if any, is held.
  *
- * @param tree_h The tree to walk.
- * @param cb_fn The callback function to apply to each item.
- * @param walk_context The opaque walk context passed to the callback.
- * @return The return code.
+ * @see mkavl_walk
  */
-mkavl_rc_e
-mkavl_walk (mkavl_tree_handle tree_h, mkavl_walk_cb_fn cb_fn,
-            void *walk_context)
+static mkavl_rc_e
+mkavl_walk_unlocked (mkavl_tree_handle tree_h, mkavl_walk_cb_fn cb_fn,
+                     void *walk_context)
 {
     void *item;
     bool stop_walk = false;
@@ -1552,6 +7382,55 @@ mkavl_walk (mkavl_tree_handle tree_h, mkavl_walk_cb_fn cb_fn,
     return (rc);
 }
 
+/**
+ * Walk every node in the tree, calling the given function for each item.  There
+ * is no guarantee on the order of the walk.
+ *
+ * @param tree_h The tree to walk.
+ * @param cb_fn The callback function to apply to each item.
+ * @param walk_context The opaque walk context passed to the callback.
+ * @return The return code.
+ */
+mkavl_rc_e
+mkavl_walk (mkavl_tree_handle tree_h, mkavl_walk_cb_fn cb_fn,
+            void *walk_context)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_tree_is_valid(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_read_lock(tree_h);
+    rc = mkavl_walk_unlocked(tree_h, cb_fn, walk_context);
+    mkavl_unlock(tree_h);
+
+    return (rc);
+}
+
+/**
+ * Move an iterator of a tree with lockless reads to the item of a lookup.
+ * Rather than a path through the tree, which writers may change at any time,
+ * the iterator just keeps the item, and moving on to the next or previous item
+ * is a lookup from it.
+ *
+ * @see mkavl_lockless_find
+ * @param iterator_h The iterator to move.
+ * @param type The type of lookup.
+ * @param lookup_item The item to use as the lookup target, or NULL.
+ * @param found_item The item found, or NULL if the iterator is left at the null
+ * item.
+ */
+static void
+mkavl_iter_lockless_find (mkavl_iterator_handle iterator_h,
+                          mkavl_find_type_e type, const void *lookup_item,
+                          void **found_item)
+{
+    mkavl_lockless_find(iterator_h->tree_h, iterator_h->key_idx, type,
+                        lookup_item, found_item);
+    iterator_h->cur_item = *found_item;
+}
+
 /**
  * Create a new iterator to use.
  *
@@ -1586,9 +7465,22 @@ mkavl_iter_new (mkavl_iterator_handle *iterator_h, mkavl_tree_handle tree_h,
     }
     local_iter_h->tree_h = tree_h;
     local_iter_h->key_idx = key_idx;
+    local_iter_h->cur_item = NULL;
     memset(&(local_iter_h->avl_t), 0, sizeof(local_iter_h->avl_t));
 
-    avl_t_init(&(local_iter_h->avl_t), tree_h->avl_tree_array[key_idx].tree);
+    if (NULL != tree_h->lockless) {
+        /* The epoch keeps the items the iterator sees from being released */
+        mkavl_epoch_enter(tree_h->lockless, &(local_iter_h->epoch_guard));
+    } else {
+        /* Each call on the iterator takes the lock, so the tree may change */
+        mkavl_read_lock(tree_h);
+        avl_t_init(&(local_iter_h->avl_t),
+                   tree_h->avl_tree_array[key_idx].tree);
+        mkavl_unlock(tree_h);
+    }
+    __atomic_add_fetch(&(tree_h->avl_tree_array[key_idx].iter_count), 1,
+                       __ATOMIC_RELAXED);
+    mkavl_mem_add(tree_h, sizeof(*local_iter_h));
 
     *iterator_h = local_iter_h;
 
@@ -1628,6 +7520,15 @@ mkavl_iter_delete (mkavl_iterator_handle *iterator_h)
         return (MKAVL_RC_E_EINVAL);
     }
 
+    if (NULL != local_iter_h->tree_h->lockless) {
+        mkavl_epoch_exit(&(local_iter_h->epoch_guard));
+    }
+
+    __atomic_sub_fetch(&(local_iter_h->tree_h->avl_tree_array[
+                             local_iter_h->key_idx].iter_count), 1,
+                       __ATOMIC_RELAXED);
+    mkavl_mem_sub(local_iter_h->tree_h, sizeof(*local_iter_h));
+
     free_fn = local_iter_h->tree_h->allocator.mkavl_allocator.free_fn;
     free_fn(local_iter_h, local_iter_h->tree_h->context);
 
@@ -1656,8 +7557,16 @@ mkavl_iter_first (mkavl_iterator_handle iterator_h, void **item)
         return (MKAVL_RC_E_EINVAL);
     }
 
+    if (NULL != iterator_h->tree_h->lockless) {
+        mkavl_iter_lockless_find(iterator_h, MKAVL_FIND_TYPE_E_GT, NULL, item);
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    mkavl_read_lock(iterator_h->tree_h);
     *item = avl_t_first(&(iterator_h->avl_t),
                 iterator_h->tree_h->avl_tree_array[iterator_h->key_idx].tree);
+    iterator_h->cur_item = *item;
+    mkavl_unlock(iterator_h->tree_h);
 
     return (MKAVL_RC_E_SUCCESS);
 }
@@ -1682,8 +7591,16 @@ mkavl_iter_last (mkavl_iterator_handle iterator_h, void **item)
         return (MKAVL_RC_E_EINVAL);
     }
 
+    if (NULL != iterator_h->tree_h->lockless) {
+        mkavl_iter_lockless_find(iterator_h, MKAVL_FIND_TYPE_E_LT, NULL, item);
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    mkavl_read_lock(iterator_h->tree_h);
     *item = avl_t_last(&(iterator_h->avl_t),
                 iterator_h->tree_h->avl_tree_array[iterator_h->key_idx].tree);
+    iterator_h->cur_item = *item;
+    mkavl_unlock(iterator_h->tree_h);
 
     return (MKAVL_RC_E_SUCCESS);
 }
@@ -1710,14 +7627,171 @@ mkavl_iter_find (mkavl_iterator_handle iterator_h, void *lookup_item,
         return (MKAVL_RC_E_EINVAL);
     }
 
+    if (NULL != iterator_h->tree_h->lockless) {
+        mkavl_iter_lockless_find(iterator_h, MKAVL_FIND_TYPE_E_EQUAL,
+                                 lookup_item, found_item);
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    mkavl_read_lock(iterator_h->tree_h);
     *found_item = 
         avl_t_find(&(iterator_h->avl_t),
                    iterator_h->tree_h->avl_tree_array[iterator_h->key_idx].tree,
                    lookup_item);
+    iterator_h->cur_item = *found_item;
+    mkavl_unlock(iterator_h->tree_h);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Find an item by any type of lookup and update the iterator to that node.
+ * Unlike mkavl_find(), this leaves the iterator at the item found so that the
+ * iteration can continue from there with mkavl_iter_next() or
+ * mkavl_iter_prev() without another search.  If no item is found, the
+ * iterator is left at the null item, from which mkavl_iter_next() starts at the
+ * first item and mkavl_iter_prev() starts at the last item.
+ *
+ * @see mkavl_iter_new
+ * @see mkavl_find
+ * @param iterator_h The iterator to use.
+ * @param type The type of lookup to do.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_iter_seek (mkavl_iterator_handle iterator_h, mkavl_find_type_e type,
+                 const void *lookup_item, void **found_item)
+{
+    struct avl_table *avl_tree;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_find_type_e_is_valid(type)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (!mkavl_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (NULL != iterator_h->tree_h->lockless) {
+        if ((type < MKAVL_FIND_TYPE_E_EQUAL) ||
+            (type >= MKAVL_FIND_TYPE_E_MAX)) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+        mkavl_iter_lockless_find(iterator_h, type, lookup_item, found_item);
+        return (MKAVL_RC_E_SUCCESS);
+    }
+    avl_tree = iterator_h->tree_h->avl_tree_array[iterator_h->key_idx].tree;
+
+    mkavl_read_lock(iterator_h->tree_h);
+    switch (type) {
+    case MKAVL_FIND_TYPE_E_EQUAL:
+        /* avl_t_find() does not modify the item despite the prototype */
+        *found_item = avl_t_find(&(iterator_h->avl_t), avl_tree,
+                                 (void *) lookup_item);
+        break;
+    case MKAVL_FIND_TYPE_E_GT:
+        *found_item = avl_t_seek(&(iterator_h->avl_t), avl_tree, lookup_item,
+                                 1, false);
+        break;
+    case MKAVL_FIND_TYPE_E_GE:
+        *found_item = avl_t_seek(&(iterator_h->avl_t), avl_tree, lookup_item,
+                                 1, true);
+        break;
+    case MKAVL_FIND_TYPE_E_LT:
+        *found_item = avl_t_seek(&(iterator_h->avl_t), avl_tree, lookup_item,
+                                 0, false);
+        break;
+    case MKAVL_FIND_TYPE_E_LE:
+        *found_item = avl_t_seek(&(iterator_h->avl_t), avl_tree, lookup_item,
+                                 0, true);
+        break;
+    default:
+        mkavl_unlock(iterator_h->tree_h);
+        return (MKAVL_RC_E_EINVAL);
+    }
+    iterator_h->cur_item = *found_item;
+    mkavl_unlock(iterator_h->tree_h);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Update the iterator to the item at a 0-based position in the order of its
+ * key, so the iteration can continue from there.  This is O(lg N), which makes
+ * it suitable for offset based pagination.
+ *
+ * @see mkavl_iter_new
+ * @see mkavl_select
+ * @param iterator_h The iterator to use.
+ * @param idx The position of the item.
+ * @param found_item The item found, or NULL if idx is not less than the number
+ * of items, in which case the iterator is left at the null item.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_iter_select (mkavl_iterator_handle iterator_h, size_t idx,
+                   void **found_item)
+{
+    struct avl_table *avl_tree;
+
+    if (NULL == found_item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (NULL != iterator_h->tree_h->lockless) {
+        mkavl_lockless_select(iterator_h->tree_h, iterator_h->key_idx, idx,
+                              found_item);
+        iterator_h->cur_item = *found_item;
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    avl_tree = iterator_h->tree_h->avl_tree_array[iterator_h->key_idx].tree;
+    mkavl_read_lock(iterator_h->tree_h);
+    *found_item = avl_t_select(&(iterator_h->avl_t), avl_tree, idx);
+    iterator_h->cur_item = *found_item;
+    mkavl_unlock(iterator_h->tree_h);
 
     return (MKAVL_RC_E_SUCCESS);
 }
 
+/**
+ * Check whether the tree changed since the iterator last moved, so that its
+ * path may hold nodes that were since freed.  The iterator must then descend
+ * the tree again from its current item, which is counted in the stats of the
+ * tree if it keeps them.  The read lock of the tree must be held.
+ *
+ * @param iterator_h The iterator about to move.
+ * @return true if the iterator must find its place again.
+ */
+static inline bool
+mkavl_iter_is_stale (mkavl_iterator_handle iterator_h)
+{
+    if ((NULL == iterator_h->avl_t.avl_node) ||
+        (iterator_h->avl_t.avl_generation ==
+         iterator_h->avl_t.avl_table->avl_generation)) {
+        return (false);
+    }
+
+    if (NULL != iterator_h->tree_h->stats) {
+        mkavl_key_stats_add(iterator_h->tree_h, iterator_h->key_idx,
+                            MKAVL_KEY_STAT_E_ITER_REFRESH, 1);
+    }
+
+    return (true);
+}
+
 /**
  * Get the next item in the iteration and update the iterator to that node.
  *
@@ -1729,6 +7803,8 @@ mkavl_iter_find (mkavl_iterator_handle iterator_h, void *lookup_item,
 mkavl_rc_e
 mkavl_iter_next (mkavl_iterator_handle iterator_h, void **item)
 {
+    MKAVL_LATENCY_START(start);
+
     if (NULL == item) {
         return (MKAVL_RC_E_EINVAL);
     }
@@ -1738,7 +7814,25 @@ mkavl_iter_next (mkavl_iterator_handle iterator_h, void **item)
         return (MKAVL_RC_E_EINVAL);
     }
 
-    *item = avl_t_next(&(iterator_h->avl_t));
+    if (NULL != iterator_h->tree_h->lockless) {
+        /* From the null item, the next item is the first */
+        mkavl_iter_lockless_find(iterator_h, MKAVL_FIND_TYPE_E_GT,
+                                 iterator_h->cur_item, item);
+        MKAVL_LATENCY_END(MKAVL_LATENCY_OP_E_ITER_NEXT, start);
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    mkavl_read_lock(iterator_h->tree_h);
+    if (mkavl_iter_is_stale(iterator_h)) {
+        /* The current item may have been removed, so go past where it was */
+        *item = avl_t_seek(&(iterator_h->avl_t), iterator_h->avl_t.avl_table,
+                           iterator_h->cur_item, 1, false);
+    } else {
+        *item = avl_t_next(&(iterator_h->avl_t));
+    }
+    iterator_h->cur_item = *item;
+    mkavl_unlock(iterator_h->tree_h);
+    MKAVL_LATENCY_END(MKAVL_LATENCY_OP_E_ITER_NEXT, start);
 
     return (MKAVL_RC_E_SUCCESS);
 }
@@ -1763,7 +7857,22 @@ mkavl_iter_prev (mkavl_iterator_handle iterator_h, void **item)
         return (MKAVL_RC_E_EINVAL);
     }
 
-    *item = avl_t_prev(&(iterator_h->avl_t));
+    if (NULL != iterator_h->tree_h->lockless) {
+        /* From the null item, the previous item is the last */
+        mkavl_iter_lockless_find(iterator_h, MKAVL_FIND_TYPE_E_LT,
+                                 iterator_h->cur_item, item);
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    mkavl_read_lock(iterator_h->tree_h);
+    if (mkavl_iter_is_stale(iterator_h)) {
+        *item = avl_t_seek(&(iterator_h->avl_t), iterator_h->avl_t.avl_table,
+                           iterator_h->cur_item, 0, false);
+    } else {
+        *item = avl_t_prev(&(iterator_h->avl_t));
+    }
+    iterator_h->cur_item = *item;
+    mkavl_unlock(iterator_h->tree_h);
 
     return (MKAVL_RC_E_SUCCESS);
 }
@@ -1779,6 +7888,8 @@ mkavl_iter_prev (mkavl_iterator_handle iterator_h, void **item)
 mkavl_rc_e
 mkavl_iter_cur (mkavl_iterator_handle iterator_h, void **item)
 {
+    struct avl_traverser local_avl_t;
+
     if (NULL == item) {
         return (MKAVL_RC_E_EINVAL);
     }
@@ -1788,7 +7899,23 @@ mkavl_iter_cur (mkavl_iterator_handle iterator_h, void **item)
         return (MKAVL_RC_E_EINVAL);
     }
 
-    *item = avl_t_cur(&(iterator_h->avl_t));
+    if (NULL != iterator_h->tree_h->lockless) {
+        *item = iterator_h->cur_item;
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    mkavl_read_lock(iterator_h->tree_h);
+    if (mkavl_iter_is_stale(iterator_h)) {
+        /* Leave the iterator where it was if the item has since been removed */
+        *item = avl_t_find(&local_avl_t, iterator_h->avl_t.avl_table,
+                           iterator_h->cur_item);
+        if (NULL != *item) {
+            iterator_h->avl_t = local_avl_t;
+        }
+    } else {
+        *item = avl_t_cur(&(iterator_h->avl_t));
+    }
+    mkavl_unlock(iterator_h->tree_h);
 
     return (MKAVL_RC_E_SUCCESS);
 }
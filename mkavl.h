@@ -79,6 +79,59 @@
  * Otherwise, you can continue iterating through all the "Smith" records doing
  * greater than lookups until you hit NULL or a non-"Smith" record.
  *
+ * \section sec_sharded Sharded Trees
+ *
+ * A single tree orders all its writers by one lock.  For many concurrent
+ * writers, mkavl_sharded.h spreads the items over several trees by a hash of
+ * their primary key, and merges the trees in key order for ordered lookups,
+ * range walks and iterators.
+ *
+ * \section sec_ranged Range-Partitioned Trees
+ *
+ * Hashing scatters neighboring keys over every shard.  mkavl_ranged.h instead
+ * gives each tree a contiguous interval of the primary key, splitting trees
+ * that grow too large and merging those that shrink too small, so that range
+ * walks only visit the trees they overlap and writers in different key ranges
+ * do not contend.
+ *
+ * \section sec_snapshots Snapshots
+ *
+ * A tree created with the persistent option can be frozen by mkavl_snapshot()
+ * in time independent of its size.  The snapshot and the tree share their
+ * nodes, and each change to the tree copies only the nodes on its path, so a
+ * long-running reader can walk a consistent view while writers go on.
+ *
+ * \section sec_workers Parallel Construction
+ *
+ * The AVL trees of the keys are independent of one another, so
+ * mkavl_bulk_load() and mkavl_copy() can build them at the same time.  Given a
+ * pool of worker threads from mkavl_workers_new() in its options, a tree fans
+ * that work out one task per key, splitting large sorts further, and idle
+ * workers steal tasks from busy ones.  Loading a tree with several keys then
+ * takes about the time of loading one.
+ *
+ * \section sec_save_load Saving and Loading
+ *
+ * mkavl_save() writes the items of a tree to a file descriptor together with
+ * the order of the items by every key.  mkavl_load() reads them back into an
+ * empty tree with the same keys and builds every AVL tree from the saved
+ * order in linear time, without calling any comparison function.  The file
+ * starts with a version header and ends with a CRC-32 of its contents, and
+ * nothing is added to the tree unless the whole file checks out.
+ *
+ * mkavl_save_mapped() instead writes a file that mkavl_mapped_open() maps into
+ * memory as a read-only tree, searched in place without loading anything.  See
+ * mkavl_mapped.h.
+ *
+ * \section sec_wal Write-Ahead Logging
+ *
+ * A log from mkavl_wal_new() attached by mkavl_set_wal() makes the changes to
+ * a tree durable.  Each change is logged before the call that made it
+ * returns, and the writes and syncs of callers that change the tree at once
+ * are shared, so that durable changes do not cost one sync each.  After a
+ * crash, mkavl_wal_replay() rebuilds the tree from the last snapshot written
+ * by mkavl_checkpoint() and the logs.  See mkavl_wal.h.
+ *
  * \section sec_usage Usage
  *
  * Just run <tt>make all</tt> to build the dynamic and shared libraries in lib/.
@@ -116,6 +169,12 @@ typedef struct mkavl_tree_st_ *mkavl_tree_handle;
 /** Opaque pointer to reference instances of AVL iterators */
 typedef struct mkavl_iterator_st_ *mkavl_iterator_handle;
 
+/** Opaque pointer to reference a pool of worker threads, see mkavl_workers.h */
+typedef struct mkavl_workers_st_ *mkavl_workers_handle;
+
+/** Opaque pointer to reference a write-ahead log, see mkavl_wal.h */
+typedef struct mkavl_wal_st_ *mkavl_wal_handle;
+
 /**
  * Return codes used to indicate whether a function call was successful.
  */
@@ -130,6 +189,8 @@ typedef enum mkavl_rc_e_ {
     MKAVL_RC_E_ENOMEM,
     /** Internal data structures are out of sync*/
     MKAVL_RC_E_EOOSYNC,
+    /** Reading or writing a file descriptor failed */
+    MKAVL_RC_E_EIO,
     /** Max return code for bounds testing */
     MKAVL_RC_E_MAX,
 } mkavl_rc_e;
@@ -178,6 +239,356 @@ typedef struct mkavl_allocator_st_ {
     mkavl_free_fn free_fn;
 } mkavl_allocator_st;
 
+/**
+ * The kind of aggregate kept over the items of a key.
+ */
+typedef enum mkavl_aggregate_type_e_ {
+    /** No aggregate is kept */
+    MKAVL_AGGREGATE_TYPE_E_NONE,
+    /** The sum of a field of the items */
+    MKAVL_AGGREGATE_TYPE_E_SUM,
+    /** The minimum of a field of the items */
+    MKAVL_AGGREGATE_TYPE_E_MINIMUM,
+    /** The maximum of a field of the items */
+    MKAVL_AGGREGATE_TYPE_E_MAXIMUM,
+    /** Client supplied extract and combine functions */
+    MKAVL_AGGREGATE_TYPE_E_CUSTOM,
+    /** Max value for bounds testing */
+    MKAVL_AGGREGATE_TYPE_E_MAX,
+} mkavl_aggregate_type_e;
+
+/**
+ * The type of the item field read by the built-in aggregates.
+ */
+typedef enum mkavl_aggregate_field_e_ {
+    /** A uint32_t field */
+    MKAVL_AGGREGATE_FIELD_E_U32,
+    /** An int32_t field */
+    MKAVL_AGGREGATE_FIELD_E_I32,
+    /** A uint64_t field, which must not exceed INT64_MAX */
+    MKAVL_AGGREGATE_FIELD_E_U64,
+    /** An int64_t field */
+    MKAVL_AGGREGATE_FIELD_E_I64,
+    /** Max value for bounds testing */
+    MKAVL_AGGREGATE_FIELD_E_MAX,
+} mkavl_aggregate_field_e;
+
+/**
+ * Prototype for getting the value an item contributes to a custom aggregate.
+ * The context is that of the tree.
+ */
+typedef int64_t
+(*mkavl_aggregate_extract_fn)(const void *item, void *context);
+
+/**
+ * Prototype for combining two values of a custom aggregate.  The function must
+ * be associative and the identity value of the aggregate must leave any value
+ * unchanged.  The values are always passed in key order, so the function need
+ * not be commutative.  The context is that of the tree.
+ */
+typedef int64_t
+(*mkavl_aggregate_combine_fn)(int64_t value1, int64_t value2, void *context);
+
+/**
+ * Describes an aggregate kept over the items of a key.  Each AVL node stores
+ * the aggregate of its subtree, which lets mkavl_aggregate_range() answer in
+ * O(lg N).
+ */
+typedef struct mkavl_aggregate_st_ {
+    /** The kind of aggregate */
+    mkavl_aggregate_type_e type;
+    /** For built-in aggregates, the offset of the field within an item */
+    size_t field_offset;
+    /** For built-in aggregates, the type of the field */
+    mkavl_aggregate_field_e field_type;
+    /** For custom aggregates, gets the value of an item */
+    mkavl_aggregate_extract_fn extract_fn;
+    /** For custom aggregates, combines two values */
+    mkavl_aggregate_combine_fn combine_fn;
+    /** For custom aggregates, the aggregate of an empty range */
+    int64_t identity;
+} mkavl_aggregate_st;
+
+/**
+ * Optional settings for a tree given to mkavl_new_opts().  A zeroed structure
+ * (or a NULL pointer) gives the same behavior as mkavl_new().
+ */
+typedef struct mkavl_opts_st_ {
+    /**
+     * Store the AVL nodes for all the keys of an item in a single allocation
+     * rather than allocating one node per key.
+     */
+    bool intrusive_nodes;
+    /**
+     * Carve the AVL nodes out of large slabs owned by the tree instead of
+     * allocating each one from the client allocator.  Freed nodes are kept on a
+     * per-tree free list and the slabs are only freed when the tree is deleted.
+     */
+    bool pooled_nodes;
+    /**
+     * An array with one aggregate per key, or NULL if no aggregates are kept.
+     * Keys that need no aggregate use MKAVL_AGGREGATE_TYPE_E_NONE.  The tree
+     * keeps its own copy of the array.
+     */
+    const mkavl_aggregate_st *aggregate_array;
+    /**
+     * Guard the tree with a reader-writer lock so that it may be shared by
+     * threads.  Lookups, walks and iterators take the shared side and changes
+     * take the exclusive side.  An iterator takes the shared side for each
+     * call only, so the tree may change between calls, even from the thread
+     * holding the iterator, which then finds its place again from its current
+     * item.  That item must not be freed while the iterator is at it.
+     * Callbacks run with the lock held and must not call back into the tree.
+     * mkavl_delete() takes no lock; no other thread may be using the tree.
+     */
+    bool thread_safe;
+    /**
+     * For a thread safe tree, let a waiting writer go ahead of readers that
+     * arrive after it so that a steady stream of readers cannot starve it.
+     */
+    bool writer_preference;
+    /**
+     * Let mkavl_find() and iterators read the tree without taking the lock,
+     * so readers do not contend on it.  A writer only holds readers off while
+     * it changes the AVL trees themselves; a reader waits that out, and a
+     * read that a writer still gets in the way of is retried and after a few
+     * tries takes the shared side of the lock.  This implies thread_safe,
+     * which still orders the writers, and pooled_nodes, since readers may
+     * touch nodes freed under them.  An iterator does not keep the tree from
+     * changing; it moves from item to item by lookups, so each step costs
+     * O(lg N) rather than amortized O(1), and the thread holding it may change
+     * the tree.  Items removed from the tree must only be freed via
+     * mkavl_retire(), and an item found by mkavl_find() may be freed once it
+     * is removed by another thread, so hold an iterator on it to keep it.  An
+     * iterator keeps every item retired while it is open from being released
+     * until it is deleted, so iterators should be short-lived.
+     */
+    bool lockless_reads;
+    /**
+     * Keep the tree persistent, so that mkavl_snapshot() and mkavl_copy()
+     * share its nodes rather than copying them and take O(M) time for M keys
+     * however many items the tree holds.  A change to either tree copies the
+     * O(lg N) nodes it touches that are shared, and a node is freed when no
+     * tree links to it any longer.  Shared trees also share their items, so
+     * an item removed from one tree must not be freed while another still
+     * holds it.  mkavl_update() is not supported since it changes items in
+     * place.  May not be combined with intrusive_nodes, pooled_nodes or
+     * lockless_reads.
+     */
+    bool persistent;
+    /**
+     * A pool of worker threads made by mkavl_workers_new() on which
+     * mkavl_bulk_load() and mkavl_copy() work on each key in parallel, sorting
+     * large arrays in parallel as well.  The compare and aggregate functions
+     * may then be called from several threads at once, but the allocator is
+     * only called from the calling thread.  The pool may be shared by many
+     * trees and must outlive them, including their copies.  NULL does all the
+     * work on the calling thread.
+     */
+    mkavl_workers_handle workers;
+    /**
+     * Count the operations on the tree and the work they do, as reported by
+     * mkavl_get_stats().  A thread safe tree spreads the counters over
+     * stripes padded to cache lines, so threads counting at once seldom write
+     * the same line.  Without stats, each counter costs a single branch.
+     */
+    bool stats;
+    /**
+     * Keep the bytes the tree has allocated and holds, and their high-water
+     * mark, as reported by mkavl_memory_usage().  Each allocation libavl makes
+     * then carries a small header holding its size, so that its size is known
+     * when it is freed.  May not be combined with persistent.
+     */
+    bool track_memory;
+} mkavl_opts_st;
+
+/**
+ * The counters of a tree kept with the stats option.
+ *
+ * @see mkavl_get_stats
+ */
+typedef struct mkavl_stats_st_ {
+    /** The items added by mkavl_add() */
+    uint64_t add_cnt;
+    /** The items removed by mkavl_remove() */
+    uint64_t remove_cnt;
+    /** The calls to mkavl_find() of each find type */
+    uint64_t find_cnt[MKAVL_FIND_TYPE_E_MAX];
+    /** The calls to the client allocator for AVL nodes and node blocks */
+    uint64_t alloc_cnt;
+    /** The bytes asked of the client allocator by those calls */
+    uint64_t alloc_bytes;
+    /** The calls to the client free function for AVL nodes and node blocks */
+    uint64_t free_cnt;
+} mkavl_stats_st;
+
+/**
+ * The counters of a key of a tree kept with the stats option.
+ *
+ * @see mkavl_get_stats
+ */
+typedef struct mkavl_key_stats_st_ {
+    /** The calls to the comparison function of the key */
+    uint64_t cmp_cnt;
+    /** The rotations done to rebalance the AVL tree of the key */
+    uint64_t rotation_cnt;
+    /** The calls to mkavl_find() on the key */
+    uint64_t find_cnt;
+    /** The nodes compared against by those calls, over all of them */
+    uint64_t find_visit_cnt;
+    /**
+     * The times an iterator on the key had to descend the tree again to find
+     * its place after the tree changed under it
+     */
+    uint64_t iter_refresh_cnt;
+    /** The current height of the AVL tree of the key */
+    uint32_t height;
+} mkavl_key_stats_st;
+
+/**
+ * The memory used by a key of a tree.
+ *
+ * @see mkavl_memory_usage
+ */
+typedef struct mkavl_key_memory_st_ {
+    /** The bytes of the AVL nodes of the key */
+    uint64_t node_bytes;
+    /** The bytes of the AVL tree of the key and its callback context */
+    uint64_t header_bytes;
+    /** The bytes of the iterators outstanding on the key */
+    uint64_t iter_bytes;
+    /**
+     * The bytes allocated for the nodes of the key but not holding one: the
+     * unused and freed parts of the slabs of its node pool, and the size
+     * headers of its nodes if the tree tracks memory
+     */
+    uint64_t slack_bytes;
+} mkavl_key_memory_st;
+
+/**
+ * The memory used by a tree.  Each count is the sum over the keys plus what
+ * the keys share: the tree itself, its counters and aggregates, the headers
+ * of node blocks and the slack of the pool of node blocks.
+ *
+ * @see mkavl_memory_usage
+ */
+typedef struct mkavl_memory_st_ {
+    /** The bytes of the AVL nodes and node blocks */
+    uint64_t node_bytes;
+    /** The bytes of the tree and AVL tree structures */
+    uint64_t header_bytes;
+    /** The bytes of the iterators outstanding */
+    uint64_t iter_bytes;
+    /** The bytes allocated for nodes but not holding one */
+    uint64_t slack_bytes;
+    /** The sum of the counts above */
+    uint64_t total_bytes;
+    /**
+     * The bytes the tree holds from the client allocator as it has kept
+     * count, or 0 if the tree does not track memory.  This matches
+     * total_bytes when no other thread is using the tree.
+     */
+    uint64_t live_bytes;
+    /**
+     * The most that live_bytes has been, or 0 if the tree does not track
+     * memory
+     */
+    uint64_t high_water_bytes;
+} mkavl_memory_st;
+
+/**
+ * The key index of trace events that are not about a single key.
+ */
+#define MKAVL_TRACE_ALL_KEYS SIZE_MAX
+
+/**
+ * The events given to a trace hook.
+ *
+ * @see mkavl_set_trace_hook
+ */
+typedef enum mkavl_trace_event_e_ {
+    /** Invalid */
+    MKAVL_TRACE_EVENT_E_INVALID,
+    /** mkavl_add() was called */
+    MKAVL_TRACE_EVENT_E_ADD_ENTRY,
+    /** First valid event */
+    MKAVL_TRACE_EVENT_E_FIRST = MKAVL_TRACE_EVENT_E_ADD_ENTRY,
+    /** mkavl_add() is about to return */
+    MKAVL_TRACE_EVENT_E_ADD_EXIT,
+    /** mkavl_remove() was called */
+    MKAVL_TRACE_EVENT_E_REMOVE_ENTRY,
+    /** mkavl_remove() is about to return */
+    MKAVL_TRACE_EVENT_E_REMOVE_EXIT,
+    /** mkavl_find() was called */
+    MKAVL_TRACE_EVENT_E_FIND_ENTRY,
+    /** mkavl_find() is about to return */
+    MKAVL_TRACE_EVENT_E_FIND_EXIT,
+    /** The AVL tree of a key was rotated to rebalance it after a change */
+    MKAVL_TRACE_EVENT_E_REBALANCE,
+    /** The client allocator was called for an AVL tree, node or node block */
+    MKAVL_TRACE_EVENT_E_ALLOC,
+    /** The client free function was called for an AVL tree, node or block */
+    MKAVL_TRACE_EVENT_E_FREE,
+    /** Max value for bounds testing */
+    MKAVL_TRACE_EVENT_E_MAX,
+} mkavl_trace_event_e;
+
+/**
+ * A trace event.  The fields that do not apply to the event are zero.
+ */
+typedef struct mkavl_trace_st_ {
+    /** The event */
+    mkavl_trace_event_e event;
+    /** The tree */
+    mkavl_tree_handle tree_h;
+    /**
+     * The key of a find or rebalance, or MKAVL_TRACE_ALL_KEYS for the other
+     * events
+     */
+    size_t key_idx;
+    /** The find type of a find */
+    mkavl_find_type_e type;
+    /** The item added, removed or looked up, or the memory allocated or freed */
+    const void *item;
+    /**
+     * For the exit events, the nodes compared against by the call, over all
+     * the keys for an add or remove.  For a rebalance, the rotations done.
+     */
+    uint32_t depth;
+    /** The bytes allocated */
+    size_t size;
+    /** The return code of the call, for the exit events */
+    mkavl_rc_e rc;
+} mkavl_trace_st;
+
+/**
+ * Prototype for the function of a trace hook.  It is called on the thread
+ * that caused the event, with the lock of the tree held for all but the entry
+ * and exit events, so it must be quick and must not call back into the tree.
+ *
+ * @param trace The event.
+ * @param context The context of the hook.
+ */
+typedef void
+(*mkavl_trace_fn)(const mkavl_trace_st *trace, void *context);
+
+/**
+ * A hook given trace events of all the trees of the process.
+ *
+ * @see mkavl_set_trace_hook
+ */
+typedef struct mkavl_trace_hook_st_ {
+    /** The function called with each event */
+    mkavl_trace_fn trace_fn;
+    /** The context passed to the function */
+    void *context;
+    /**
+     * The events for which to call the function, as a mask with bit
+     * (1 << event) set for each event wanted.
+     */
+    uint32_t event_mask;
+} mkavl_trace_hook_st;
+
 /**
  * Prototype for comparing two items.  The context is what was passed in when
  * the AVL tree was created.
@@ -234,6 +645,53 @@ typedef mkavl_rc_e
 (*mkavl_walk_cb_fn)(void *item, void *tree_context, void *walk_context,
                     bool *stop_walk);
 
+/**
+ * Prototype for a function that changes the keyed fields of an item in place
+ * for mkavl_update().  It is first called with undo set to false to make the
+ * change.  If the changed item collides with another item for some key, it is
+ * called again with undo set to true and must restore the fields it changed.
+ *
+ * @param item The item to change.
+ * @param undo If true, revert the change made by the previous call.
+ * @param tree_context The context for the tree.
+ * @param update_context The context passed to mkavl_update().
+ * @return The return code.  If an error is returned when making the change,
+ * the item must be left unchanged.  Undoing a change must not fail.
+ */
+typedef mkavl_rc_e
+(*mkavl_update_fn)(void *item, bool undo, void *tree_context,
+                   void *update_context);
+
+/**
+ * Prototype for a function that writes an item as bytes for mkavl_save().
+ *
+ * @param item The item to write.
+ * @param buf Where to write the bytes of the item.
+ * @param buf_len The number of bytes buf has room for.
+ * @param item_len Set to the number of bytes the item takes, at most
+ * UINT32_MAX.  If that is more than buf_len, nothing need be written and the
+ * function is called again with a buffer at least that large.
+ * @param context The context for the tree.
+ * @return The return code.  An error stops the save and is returned by it.
+ */
+typedef mkavl_rc_e
+(*mkavl_serialize_fn)(const void *item, void *buf, size_t buf_len,
+                      size_t *item_len, void *context);
+
+/**
+ * Prototype for a function that makes an item from the bytes written for it by
+ * a mkavl_serialize_fn, for mkavl_load().
+ *
+ * @param buf The bytes of the item.
+ * @param buf_len The number of bytes.
+ * @param item Set to the new item.
+ * @param context The context for the tree.
+ * @return The return code.  An error stops the load and is returned by it.
+ */
+typedef mkavl_rc_e
+(*mkavl_deserialize_fn)(const void *buf, size_t buf_len, void **item,
+                        void *context);
+
 /* APIs below are documented in their implementation file */
 
 /* Utility functions */
@@ -253,6 +711,9 @@ mkavl_rc_e_get_string(mkavl_rc_e rc);
 extern bool
 mkavl_find_type_e_is_valid(mkavl_find_type_e type);
 
+extern uint32_t
+mkavl_crc32(uint32_t crc, const void *buf, size_t len);
+
 extern const char *
 mkavl_find_type_e_get_string(mkavl_find_type_e type);
 
@@ -264,9 +725,40 @@ mkavl_new(mkavl_tree_handle *tree_h,
           size_t compare_fn_array_count, 
           void *context, mkavl_allocator_st *allocator);
 
+extern mkavl_rc_e
+mkavl_new_opts(mkavl_tree_handle *tree_h,
+               mkavl_compare_fn *compare_fn_array, 
+               size_t compare_fn_array_count, 
+               void *context, mkavl_allocator_st *allocator,
+               const mkavl_opts_st *opts);
+
 extern void *
 mkavl_get_tree_context(mkavl_tree_handle tree_h);
 
+extern const mkavl_allocator_st *
+mkavl_get_allocator(mkavl_tree_handle tree_h);
+
+extern size_t
+mkavl_get_key_count(mkavl_tree_handle tree_h);
+
+extern mkavl_rc_e
+mkavl_set_wal(mkavl_tree_handle tree_h, mkavl_wal_handle wal_h);
+
+extern mkavl_rc_e
+mkavl_get_stats(mkavl_tree_handle tree_h, mkavl_stats_st *stats,
+                mkavl_key_stats_st *key_stats_array, size_t key_stats_cnt);
+
+extern mkavl_rc_e
+mkavl_reset_stats(mkavl_tree_handle tree_h);
+
+extern mkavl_rc_e
+mkavl_set_trace_hook(const mkavl_trace_hook_st *hook);
+
+extern mkavl_rc_e
+mkavl_memory_usage(mkavl_tree_handle tree_h, mkavl_memory_st *memory,
+                   mkavl_key_memory_st *key_memory_array,
+                   size_t key_memory_cnt);
+
 extern mkavl_rc_e
 mkavl_delete(mkavl_tree_handle *tree_h, mkavl_item_fn item_fn, 
              mkavl_delete_context_fn delete_context_fn);
@@ -279,14 +771,75 @@ mkavl_copy(const mkavl_tree_handle source_tree_h,
            mkavl_delete_context_fn delete_context_fn,
            mkavl_allocator_st *allocator);
 
+extern mkavl_rc_e
+mkavl_copy_opts(const mkavl_tree_handle source_tree_h, 
+                mkavl_tree_handle *new_tree_h,
+                mkavl_copy_fn copy_fn, mkavl_item_fn item_fn, 
+                bool use_source_context, void *new_context,
+                mkavl_delete_context_fn delete_context_fn,
+                mkavl_allocator_st *allocator, const mkavl_opts_st *opts);
+
+extern mkavl_rc_e
+mkavl_snapshot(mkavl_tree_handle tree_h, mkavl_tree_handle *snapshot_h);
+
 extern mkavl_rc_e
 mkavl_add(mkavl_tree_handle tree_h, void *item_to_add, 
           void **existing_item);
 
+extern mkavl_rc_e
+mkavl_bulk_load(mkavl_tree_handle tree_h, void **item_array, size_t item_cnt,
+                bool is_sorted, size_t sorted_key_idx);
+
+extern mkavl_rc_e
+mkavl_save(mkavl_tree_handle tree_h, int fd, mkavl_serialize_fn serialize_fn);
+
+extern mkavl_rc_e
+mkavl_load(mkavl_tree_handle tree_h, int fd,
+           mkavl_deserialize_fn deserialize_fn, mkavl_item_fn item_fn);
+
+extern mkavl_rc_e
+mkavl_save_mapped(mkavl_tree_handle tree_h, int fd,
+                  mkavl_serialize_fn serialize_fn);
+
+extern mkavl_rc_e
+mkavl_checkpoint(mkavl_tree_handle tree_h, int fd,
+                 mkavl_serialize_fn serialize_fn);
+
 extern mkavl_rc_e
 mkavl_find(mkavl_tree_handle tree_h, mkavl_find_type_e type,
            size_t key_idx, const void *lookup_item, void **found_item);
 
+extern mkavl_rc_e
+mkavl_find_range(mkavl_tree_handle tree_h, size_t key_idx,
+                 const void *lo_item, bool lo_inclusive,
+                 const void *hi_item, bool hi_inclusive, bool descending,
+                 mkavl_walk_cb_fn cb_fn, void *walk_context);
+
+extern mkavl_rc_e
+mkavl_find_range_array(mkavl_tree_handle tree_h, size_t key_idx,
+                       const void *lo_item, bool lo_inclusive,
+                       const void *hi_item, bool hi_inclusive,
+                       bool descending, void **item_array,
+                       size_t item_array_cnt, size_t *found_cnt);
+
+extern mkavl_rc_e
+mkavl_rank(mkavl_tree_handle tree_h, size_t key_idx, const void *lookup_item,
+           size_t *rank);
+
+extern mkavl_rc_e
+mkavl_select(mkavl_tree_handle tree_h, size_t key_idx, size_t idx,
+             void **found_item);
+
+extern mkavl_rc_e
+mkavl_count_range(mkavl_tree_handle tree_h, size_t key_idx,
+                  const void *lo_item, bool lo_inclusive,
+                  const void *hi_item, bool hi_inclusive, size_t *count);
+
+extern mkavl_rc_e
+mkavl_aggregate_range(mkavl_tree_handle tree_h, size_t key_idx,
+                      const void *lo_item, bool lo_inclusive,
+                      const void *hi_item, bool hi_inclusive, int64_t *value);
+
 extern mkavl_rc_e
 mkavl_remove(mkavl_tree_handle tree_h, const void *item_to_remove,
              void **found_item);
@@ -299,8 +852,15 @@ extern mkavl_rc_e
 mkavl_remove_key_idx(mkavl_tree_handle tree_h, size_t key_idx,
                      const void *item_to_remove, void **found_item);
 
+extern mkavl_rc_e
+mkavl_update(mkavl_tree_handle tree_h, void *item, mkavl_update_fn update_fn,
+             void *update_context, void **existing_item);
+
 /* AVL utility functions */
 
+extern mkavl_rc_e
+mkavl_retire(mkavl_tree_handle tree_h, void *item, mkavl_item_fn item_fn);
+
 extern uint32_t
 mkavl_count(mkavl_tree_handle tree_h);
 
@@ -329,6 +889,14 @@ extern mkavl_rc_e
 mkavl_iter_find(mkavl_iterator_handle iterator_h, void *lookup_item,
                 void **found_item);
 
+extern mkavl_rc_e
+mkavl_iter_seek(mkavl_iterator_handle iterator_h, mkavl_find_type_e type,
+                const void *lookup_item, void **found_item);
+
+extern mkavl_rc_e
+mkavl_iter_select(mkavl_iterator_handle iterator_h, size_t idx,
+                  void **found_item);
+
 extern mkavl_rc_e
 mkavl_iter_next(mkavl_iterator_handle iterator_h, void **item);
 
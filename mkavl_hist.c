@@ -0,0 +1,500 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the implementation for latency histograms.  The histograms of the
+ * tree operations are kept in stripes, each padded to whole cache lines, and
+ * each thread records in the stripe it was given on first use, so threads
+ * recording at once seldom write the same line.  A snapshot sums the stripes.
+ */
+
+#include "mkavl_hist.h"
+#include <string.h>
+#include <pthread.h>
+
+/**
+ * Compile time assert macro from:
+ * http://www.pixelbeat.org/programming/gcc/static_assert.html
+ */
+#ifndef CT_ASSERT
+#define CT_ASSERT(e) extern char (*CT_ASSERT(void)) [sizeof(char[1 - 2*!(e)])]
+#endif
+
+/**
+ * Determine the number of elements in an array.
+ */
+#ifndef NELEMS
+#define NELEMS(x) (sizeof(x) / sizeof(x[0]))
+#endif
+
+/**
+ * The size of a cache line, used to keep data written by different threads
+ * apart.
+ */
+#define MKAVL_CACHE_LINE_SIZE 64
+
+/** The number of stripes of the histograms of the tree operations */
+#define MKAVL_LATENCY_STRIPE_CNT 16
+
+/** The number of buckets for each power of two past the first */
+#define MKAVL_HIST_HALF_CNT (MKAVL_HIST_SUB_CNT / 2)
+
+/** The time over which the ticks are measured against the clock */
+#define MKAVL_HIST_CALIBRATE_NS 10000000
+
+/**
+ * String representations of the operations.
+ *
+ * @see mkavl_latency_op_e
+ */
+static const char * const mkavl_latency_op_e_string[] = {
+    "Invalid",
+    "Add",
+    "Remove",
+    "Find equal",
+    "Find greater than",
+    "Find less than",
+    "Find greater than or equal",
+    "Find less than or equal",
+    "Iterator next",
+    "Copy",
+    "Delete",
+    "Max op"
+};
+
+/** @cond doxygen_suppress */
+/* Ensure there is a string for each enum declared */
+CT_ASSERT(NELEMS(mkavl_latency_op_e_string) == (MKAVL_LATENCY_OP_E_MAX + 1));
+/** @endcond */
+
+/**
+ * Get a string representation of the operation.
+ *
+ * @param op The operation.
+ * @return A string representation of the operation or "__Invalid__" if an
+ * invalid operation is input.
+ */
+const char *
+mkavl_latency_op_e_get_string (mkavl_latency_op_e op)
+{
+    const char *retval = "__Invalid__";
+
+    if ((op >= MKAVL_LATENCY_OP_E_INVALID) && (op <= MKAVL_LATENCY_OP_E_MAX)) {
+        retval = mkavl_latency_op_e_string[op];
+    }
+
+    return (retval);
+}
+
+/**
+ * Get the bucket in which a value is counted.  Values below
+ * MKAVL_HIST_SUB_CNT each have their own bucket, and each power of two above
+ * is split into MKAVL_HIST_HALF_CNT buckets by the bits after the highest.
+ *
+ * @param value The value.
+ * @return The index of the bucket.
+ */
+static size_t
+mkavl_hist_bucket (uint64_t value)
+{
+    uint32_t shift;
+
+    if (value > MKAVL_HIST_VALUE_MAX) {
+        value = MKAVL_HIST_VALUE_MAX;
+    }
+
+    if (value < MKAVL_HIST_SUB_CNT) {
+        return (value);
+    }
+
+    shift = ((63 - __builtin_clzll(value)) - MKAVL_HIST_SUB_BITS + 1);
+
+    return (((shift + 1) * MKAVL_HIST_HALF_CNT) +
+            ((value >> shift) - MKAVL_HIST_HALF_CNT));
+}
+
+/**
+ * Get the largest value counted in a bucket.
+ *
+ * @param bucket_idx The index of the bucket.
+ * @return The largest value of the bucket.
+ */
+static uint64_t
+mkavl_hist_bucket_max (size_t bucket_idx)
+{
+    uint32_t shift;
+
+    if (bucket_idx < MKAVL_HIST_SUB_CNT) {
+        return (bucket_idx);
+    }
+
+    shift = ((bucket_idx / MKAVL_HIST_HALF_CNT) - 1);
+
+    return (((((uint64_t) (bucket_idx % MKAVL_HIST_HALF_CNT)) +
+              MKAVL_HIST_HALF_CNT + 1) << shift) - 1);
+}
+
+/** @cond doxygen_suppress */
+/* Ensure the largest value falls in the last bucket */
+CT_ASSERT(((((MKAVL_HIST_BUCKET_CNT - 1) / MKAVL_HIST_HALF_CNT) - 1) +
+           MKAVL_HIST_SUB_BITS) == MKAVL_HIST_VALUE_BITS);
+/** @endcond */
+
+/**
+ * Count a value in a histogram.  The histogram must not be used by another
+ * thread at the same time.
+ *
+ * @param hist The histogram.
+ * @param value The value.
+ */
+void
+mkavl_hist_record (mkavl_hist_st *hist, uint64_t value)
+{
+    ++(hist->count);
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    ++(hist->bucket_array[mkavl_hist_bucket(value)]);
+}
+
+/**
+ * Add the counts of one histogram to another, e.g. to combine the histograms
+ * recorded by several threads or processes.
+ *
+ * @param hist The histogram to add to.
+ * @param src_hist The histogram whose counts to add.
+ */
+void
+mkavl_hist_merge (mkavl_hist_st *hist, const mkavl_hist_st *src_hist)
+{
+    size_t i;
+
+    hist->count += src_hist->count;
+    hist->sum += src_hist->sum;
+    if (src_hist->max > hist->max) {
+        hist->max = src_hist->max;
+    }
+    for (i = 0; i < NELEMS(hist->bucket_array); ++i) {
+        hist->bucket_array[i] += src_hist->bucket_array[i];
+    }
+}
+
+/**
+ * Get a percentile of the values counted in a histogram.  The value returned
+ * is the largest of its bucket, so it is at most about 1 /
+ * MKAVL_HIST_HALF_CNT over the true one, and never over the largest value
+ * counted.
+ *
+ * @param hist The histogram.
+ * @param percentile The percentile, from 0 to 100, e.g. 99.9.
+ * @return The value at or below which the percentile of the values fall, or 0
+ * if the histogram is empty.
+ */
+uint64_t
+mkavl_hist_percentile (const mkavl_hist_st *hist, double percentile)
+{
+    uint64_t rank, seen = 0;
+    size_t i;
+
+    if (0 == hist->count) {
+        return (0);
+    }
+
+    if (percentile < 0) {
+        percentile = 0;
+    } else if (percentile > 100) {
+        percentile = 100;
+    }
+
+    /* The rank of the value is rounded up, and the first value is rank 1 */
+    rank = (uint64_t) ((percentile * hist->count) / 100);
+    if (((double) rank * 100) < (percentile * hist->count)) {
+        ++rank;
+    }
+    if (0 == rank) {
+        rank = 1;
+    }
+
+    for (i = 0; i < NELEMS(hist->bucket_array); ++i) {
+        seen += hist->bucket_array[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    if ((i == NELEMS(hist->bucket_array)) ||
+        (mkavl_hist_bucket_max(i) > hist->max)) {
+        return (hist->max);
+    }
+
+    return (mkavl_hist_bucket_max(i));
+}
+
+/** The nanoseconds per tick, measured once */
+static double mkavl_hist_tick_ns = 1.0;
+
+/** Guards the measurement of the nanoseconds per tick */
+static pthread_once_t mkavl_hist_tick_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Get the monotonic clock in nanoseconds.
+ *
+ * @return The clock.
+ */
+static uint64_t
+mkavl_hist_clock_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec);
+}
+
+/**
+ * Measure the ticks against the monotonic clock.
+ */
+static void
+mkavl_hist_calibrate (void)
+{
+    uint64_t start_ns, start_ticks, end_ns, end_ticks;
+
+    start_ns = mkavl_hist_clock_ns();
+    start_ticks = mkavl_hist_ticks();
+    do {
+        end_ns = mkavl_hist_clock_ns();
+    } while ((end_ns - start_ns) < MKAVL_HIST_CALIBRATE_NS);
+    end_ticks = mkavl_hist_ticks();
+
+    if (end_ticks > start_ticks) {
+        mkavl_hist_tick_ns = ((double) (end_ns - start_ns) /
+                              (end_ticks - start_ticks));
+    }
+}
+
+/**
+ * Get the nanoseconds per tick of mkavl_hist_ticks().  The first call measures
+ * this over about 10 milliseconds.
+ *
+ * @return The nanoseconds per tick.
+ */
+double
+mkavl_hist_ns_per_tick (void)
+{
+    pthread_once(&mkavl_hist_tick_once, mkavl_hist_calibrate);
+
+    return (mkavl_hist_tick_ns);
+}
+
+/**
+ * Print a line with the count, mean, 50th, 99th and 99.9th percentiles and
+ * largest value of a histogram of ticks, in nanoseconds.
+ *
+ * @param hist The histogram.
+ * @param name The name to start the line with.
+ * @param stream Where to print.
+ */
+void
+mkavl_hist_print (const mkavl_hist_st *hist, const char *name, FILE *stream)
+{
+    double ns_per_tick = mkavl_hist_ns_per_tick();
+
+    if (0 == hist->count) {
+        fprintf(stream, "%s: count 0\n", name);
+        return;
+    }
+
+    fprintf(stream, "%s: count %llu mean %.0f ns p50 %.0f ns p99 %.0f ns "
+            "p999 %.0f ns max %.0f ns\n", name,
+            (unsigned long long) hist->count,
+            ((ns_per_tick * hist->sum) / hist->count),
+            (ns_per_tick * mkavl_hist_percentile(hist, 50)),
+            (ns_per_tick * mkavl_hist_percentile(hist, 99)),
+            (ns_per_tick * mkavl_hist_percentile(hist, 99.9)),
+            (ns_per_tick * hist->max));
+}
+
+#ifdef MKAVL_HISTOGRAMS
+
+/**
+ * A stripe of the histograms of the tree operations.
+ */
+typedef struct mkavl_latency_stripe_st_ {
+    /** The histogram of each operation */
+    mkavl_hist_st hist_array[MKAVL_LATENCY_OP_E_MAX];
+} __attribute__((aligned(MKAVL_CACHE_LINE_SIZE))) mkavl_latency_stripe_st;
+
+/** The histograms of the tree operations */
+static mkavl_latency_stripe_st
+    mkavl_latency_stripe_array[MKAVL_LATENCY_STRIPE_CNT];
+
+/** The stripe in which the calling thread records, assigned on first use */
+static __thread uint32_t mkavl_latency_thread_stripe = UINT32_MAX;
+
+/** The stripe to assign to the next thread that records */
+static uint32_t mkavl_latency_next_stripe;
+
+/**
+ * Record the latency of a call of a tree operation.
+ *
+ * @param op The operation.
+ * @param ticks The ticks the call took.
+ */
+void
+mkavl_latency_record (mkavl_latency_op_e op, uint64_t ticks)
+{
+    mkavl_hist_st *hist;
+    uint64_t max;
+
+    if (UINT32_MAX == mkavl_latency_thread_stripe) {
+        mkavl_latency_thread_stripe =
+            (__atomic_fetch_add(&mkavl_latency_next_stripe, 1,
+                                __ATOMIC_RELAXED) % MKAVL_LATENCY_STRIPE_CNT);
+    }
+
+    hist = &(mkavl_latency_stripe_array[mkavl_latency_thread_stripe].
+             hist_array[op]);
+    __atomic_fetch_add(&(hist->count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->sum), ticks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->bucket_array[mkavl_hist_bucket(ticks)]), 1,
+                       __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&(hist->max), __ATOMIC_RELAXED);
+    while ((ticks > max) &&
+           !__atomic_compare_exchange_n(&(hist->max), &max, ticks, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * Copy out the histogram of the latency of a tree operation, over all the
+ * trees of the process.  Calls made while this runs may or may not be
+ * included.
+ *
+ * @param op The operation.
+ * @param hist Filled in with the histogram, in ticks of mkavl_hist_ticks().
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned, with an empty
+ * histogram, if the library was built without MKAVL_HISTOGRAMS.
+ */
+mkavl_rc_e
+mkavl_latency_snapshot (mkavl_latency_op_e op, mkavl_hist_st *hist)
+{
+    const mkavl_hist_st *stripe_hist;
+    uint64_t max;
+    uint32_t i;
+    size_t j;
+
+    if (NULL == hist) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    memset(hist, 0, sizeof(*hist));
+
+    if ((op < MKAVL_LATENCY_OP_E_FIRST) || (op >= MKAVL_LATENCY_OP_E_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    for (i = 0; i < MKAVL_LATENCY_STRIPE_CNT; ++i) {
+        stripe_hist = &(mkavl_latency_stripe_array[i].hist_array[op]);
+        hist->count += __atomic_load_n(&(stripe_hist->count),
+                                       __ATOMIC_RELAXED);
+        hist->sum += __atomic_load_n(&(stripe_hist->sum), __ATOMIC_RELAXED);
+        max = __atomic_load_n(&(stripe_hist->max), __ATOMIC_RELAXED);
+        if (max > hist->max) {
+            hist->max = max;
+        }
+        for (j = 0; j < NELEMS(hist->bucket_array); ++j) {
+            hist->bucket_array[j] +=
+                __atomic_load_n(&(stripe_hist->bucket_array[j]),
+                                __ATOMIC_RELAXED);
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Empty the histograms of the latency of the tree operations.  Calls made
+ * while this runs may be lost.
+ *
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the library was
+ * built without MKAVL_HISTOGRAMS.
+ */
+mkavl_rc_e
+mkavl_latency_reset (void)
+{
+    uint64_t *counter, *end;
+    uint32_t i;
+
+    for (i = 0; i < MKAVL_LATENCY_STRIPE_CNT; ++i) {
+        counter = (uint64_t *) mkavl_latency_stripe_array[i].hist_array;
+        end = (uint64_t *) (mkavl_latency_stripe_array[i].hist_array +
+                            MKAVL_LATENCY_OP_E_MAX);
+        for (; counter < end; ++counter) {
+            __atomic_store_n(counter, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+#else
+
+/**
+ * Record nothing, as the library was built without MKAVL_HISTOGRAMS.
+ *
+ * @param op The operation.
+ * @param ticks The ticks the call took.
+ */
+void
+mkavl_latency_record (mkavl_latency_op_e op, uint64_t ticks)
+{
+}
+
+/**
+ * Give an empty histogram, as the library was built without
+ * MKAVL_HISTOGRAMS.
+ *
+ * @param op The operation.
+ * @param hist Filled in with an empty histogram.
+ * @return MKAVL_RC_E_EINVAL
+ */
+mkavl_rc_e
+mkavl_latency_snapshot (mkavl_latency_op_e op, mkavl_hist_st *hist)
+{
+    if (NULL != hist) {
+        memset(hist, 0, sizeof(*hist));
+    }
+
+    return (MKAVL_RC_E_EINVAL);
+}
+
+/**
+ * Do nothing, as the library was built without MKAVL_HISTOGRAMS.
+ *
+ * @return MKAVL_RC_E_EINVAL
+ */
+mkavl_rc_e
+mkavl_latency_reset (void)
+{
+    return (MKAVL_RC_E_EINVAL);
+}
+
+#endif
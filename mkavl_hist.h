@@ -0,0 +1,172 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the public interface for latency histograms.  A histogram counts
+ * values in log-linear buckets, as HDR histograms do: each power of two is
+ * split into MKAVL_HIST_SUB_CNT / 2 buckets of equal width, so a value is
+ * known to within about 1 / (MKAVL_HIST_SUB_CNT / 2) of itself whatever its
+ * size, in a fixed amount of memory.  Values are in ticks of
+ * mkavl_hist_ticks(), the cycle counter where there is one.
+ *
+ * When the library is built with MKAVL_HISTOGRAMS defined (make
+ * HISTOGRAMS=1), the time taken by each call of mkavl_add(), mkavl_remove(),
+ * mkavl_find(), mkavl_iter_next(), mkavl_copy() and mkavl_delete() is recorded
+ * in a histogram per operation, shared by all the trees of the process.
+ * mkavl_latency_snapshot() copies one out.  Without MKAVL_HISTOGRAMS the calls
+ * record nothing and cost nothing extra.
+ */
+
+#ifndef __MKAVL_HIST_H__
+#define __MKAVL_HIST_H__
+
+#include "mkavl.h"
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** The number of bits of the values counted each in their own bucket */
+#define MKAVL_HIST_SUB_BITS 4
+
+/**
+ * The number of values counted each in their own bucket.  Each larger power
+ * of two is split into half as many buckets.
+ */
+#define MKAVL_HIST_SUB_CNT (1 << MKAVL_HIST_SUB_BITS)
+
+/**
+ * The number of bits of the largest value counted.  Larger values are counted
+ * as this largest one, which is several minutes of ticks.
+ */
+#define MKAVL_HIST_VALUE_BITS 40
+
+/** The largest value counted */
+#define MKAVL_HIST_VALUE_MAX ((UINT64_C(1) << MKAVL_HIST_VALUE_BITS) - 1)
+
+/** The number of buckets of a histogram */
+#define MKAVL_HIST_BUCKET_CNT \
+    ((MKAVL_HIST_VALUE_BITS - MKAVL_HIST_SUB_BITS + 2) * \
+     (MKAVL_HIST_SUB_CNT / 2))
+
+/**
+ * A histogram of values.  A zeroed histogram is empty.
+ */
+typedef struct mkavl_hist_st_ {
+    /** The number of values counted */
+    uint64_t count;
+    /** The sum of the values counted */
+    uint64_t sum;
+    /** The largest value counted */
+    uint64_t max;
+    /** The count of values in each bucket */
+    uint64_t bucket_array[MKAVL_HIST_BUCKET_CNT];
+} mkavl_hist_st;
+
+/**
+ * The operations whose latency is recorded when the library is built with
+ * MKAVL_HISTOGRAMS.
+ */
+typedef enum mkavl_latency_op_e_ {
+    /** Invalid */
+    MKAVL_LATENCY_OP_E_INVALID,
+    /** mkavl_add() */
+    MKAVL_LATENCY_OP_E_ADD,
+    /** First valid operation */
+    MKAVL_LATENCY_OP_E_FIRST = MKAVL_LATENCY_OP_E_ADD,
+    /** mkavl_remove() */
+    MKAVL_LATENCY_OP_E_REMOVE,
+    /** mkavl_find() with MKAVL_FIND_TYPE_E_EQUAL */
+    MKAVL_LATENCY_OP_E_FIND_EQUAL,
+    /** mkavl_find() with MKAVL_FIND_TYPE_E_GT */
+    MKAVL_LATENCY_OP_E_FIND_GT,
+    /** mkavl_find() with MKAVL_FIND_TYPE_E_LT */
+    MKAVL_LATENCY_OP_E_FIND_LT,
+    /** mkavl_find() with MKAVL_FIND_TYPE_E_GE */
+    MKAVL_LATENCY_OP_E_FIND_GE,
+    /** mkavl_find() with MKAVL_FIND_TYPE_E_LE */
+    MKAVL_LATENCY_OP_E_FIND_LE,
+    /** mkavl_iter_next() */
+    MKAVL_LATENCY_OP_E_ITER_NEXT,
+    /** mkavl_copy() and mkavl_copy_opts() */
+    MKAVL_LATENCY_OP_E_COPY,
+    /** mkavl_delete() */
+    MKAVL_LATENCY_OP_E_DELETE,
+    /** Max value for bounds testing */
+    MKAVL_LATENCY_OP_E_MAX,
+} mkavl_latency_op_e;
+
+/**
+ * Read the cycle counter, or the monotonic clock in nanoseconds where there
+ * is no cycle counter.
+ *
+ * @return The current tick.
+ */
+static inline uint64_t
+mkavl_hist_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (__rdtsc());
+#elif defined(__aarch64__)
+    uint64_t ticks;
+
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (ticks));
+    return (ticks);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec);
+#endif
+}
+
+/* APIs below are documented in their implementation file */
+
+extern const char *
+mkavl_latency_op_e_get_string(mkavl_latency_op_e op);
+
+extern void
+mkavl_hist_record(mkavl_hist_st *hist, uint64_t value);
+
+extern void
+mkavl_hist_merge(mkavl_hist_st *hist, const mkavl_hist_st *src_hist);
+
+extern uint64_t
+mkavl_hist_percentile(const mkavl_hist_st *hist, double percentile);
+
+extern double
+mkavl_hist_ns_per_tick(void);
+
+extern void
+mkavl_hist_print(const mkavl_hist_st *hist, const char *name, FILE *stream);
+
+extern mkavl_rc_e
+mkavl_latency_snapshot(mkavl_latency_op_e op, mkavl_hist_st *hist);
+
+extern mkavl_rc_e
+mkavl_latency_reset(void);
+
+/* Used by the tree to record the latency of its calls */
+
+extern void
+mkavl_latency_record(mkavl_latency_op_e op, uint64_t ticks);
+
+#endif
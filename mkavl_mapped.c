@@ -0,0 +1,816 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the implementation for mapped trees.  Opening a file only checks its
+ * header and footer, so the offsets within it are checked as they are read:
+ * an offset that is out of bounds or misaligned fails the call that read it
+ * with MKAVL_RC_E_EINVAL rather than reading outside the mapping.  Positions
+ * in the order of a key are indexes into its array of offsets, with the count
+ * of items standing for the null position of iterators.
+ */
+
+#include "mkavl_mapped.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Magic number indicating a pointer is valid for sanity checks.
+ */
+#define MKAVL_CTX_MAGIC 0xCAFEBABE
+
+/**
+ * Magic number indicating a pointer is stale for sanity checks.
+ */
+#define MKAVL_CTX_STALE 0xDEADBEEF
+
+/**
+ * An open mapped tree.
+ */
+typedef struct mkavl_mapped_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The start of the mapping */
+    const uint8_t *base;
+    /** The size of the mapping */
+    size_t len;
+    /** The number of items */
+    size_t item_cnt;
+    /** The number of keys */
+    size_t key_cnt;
+    /** The file offset of the first byte after the items */
+    size_t items_end;
+    /** The arrays of item offsets of each key, one after another */
+    const uint64_t *off_array;
+    /** The comparison function of each key */
+    mkavl_compare_fn *compare_fn_array;
+    /** The context passed to the comparison functions and callbacks */
+    void *context;
+} mkavl_mapped_st;
+
+/**
+ * An iterator over the items of one key of a mapped tree.
+ */
+typedef struct mkavl_mapped_iterator_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The tree iterated */
+    mkavl_mapped_handle mapped_h;
+    /** The key iterated */
+    size_t key_idx;
+    /** The current position, the count of items for the null position */
+    size_t idx;
+} mkavl_mapped_iterator_st;
+
+/**
+ * Check whether a mapped tree is valid.
+ *
+ * @param mapped_h The tree.
+ * @return Whether the tree is valid.
+ */
+static inline bool
+mkavl_mapped_is_valid (mkavl_mapped_handle mapped_h)
+{
+    return ((NULL != mapped_h) && (MKAVL_CTX_MAGIC == mapped_h->magic));
+}
+
+/**
+ * Check whether a mapped tree iterator is valid.
+ *
+ * @param iterator_h The iterator.
+ * @return Whether the iterator is valid.
+ */
+static inline bool
+mkavl_mapped_iterator_is_valid (mkavl_mapped_iterator_handle iterator_h)
+{
+    return ((NULL != iterator_h) && (MKAVL_CTX_MAGIC == iterator_h->magic) &&
+            mkavl_mapped_is_valid(iterator_h->mapped_h));
+}
+
+/**
+ * Get the item at a position in the order of a key, checking that the record
+ * of the item lies within the items of the file.
+ *
+ * @param mapped_h The tree.
+ * @param key_idx The key.
+ * @param idx The position, which may be the null position.
+ * @param item Filled in with the item, or NULL for the null position.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the file is
+ * corrupt.
+ */
+static mkavl_rc_e
+mkavl_mapped_get (mkavl_mapped_handle mapped_h, size_t key_idx, size_t idx,
+                  const void **item)
+{
+    uint64_t off, len;
+
+    *item = NULL;
+    if (idx >= mapped_h->item_cnt) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    off = mapped_h->off_array[(key_idx * mapped_h->item_cnt) + idx];
+    if ((off < sizeof(mkavl_mapped_header_st)) || (0 != (off % sizeof(len))) ||
+        (off > (mapped_h->items_end - sizeof(len)))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    memcpy(&len, (mapped_h->base + off), sizeof(len));
+    if (len > (mapped_h->items_end - off - sizeof(len))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = (mapped_h->base + off + sizeof(len));
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Find the first position in the order of a key whose item is greater than,
+ * or greater than or equal to, a lookup item.
+ *
+ * @param mapped_h The tree.
+ * @param key_idx The key.
+ * @param lookup_item The item to compare against.
+ * @param upper If true, skip the items equal to lookup_item.
+ * @param idx Filled in with the position, the count of items if there is none.
+ * @return The return code.
+ */
+static mkavl_rc_e
+mkavl_mapped_bound (mkavl_mapped_handle mapped_h, size_t key_idx,
+                    const void *lookup_item, bool upper, size_t *idx)
+{
+    mkavl_compare_fn compare_fn = mapped_h->compare_fn_array[key_idx];
+    size_t lo = 0, hi = mapped_h->item_cnt, mid;
+    const void *item;
+    int32_t cmp;
+    mkavl_rc_e rc;
+
+    /* The middle of each range is the root of its subtree */
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        rc = mkavl_mapped_get(mapped_h, key_idx, mid, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        cmp = compare_fn(item, lookup_item, mapped_h->context);
+        if ((cmp < 0) || (upper && (0 == cmp))) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *idx = lo;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Find the position of the item for a lookup.
+ *
+ * @param mapped_h The tree.
+ * @param type The type of lookup to do.
+ * @param key_idx The key.
+ * @param lookup_item The item to use as the lookup target.
+ * @param idx Filled in with the position, the count of items if no item is
+ * found.
+ * @return The return code.
+ */
+static mkavl_rc_e
+mkavl_mapped_find_idx (mkavl_mapped_handle mapped_h, mkavl_find_type_e type,
+                       size_t key_idx, const void *lookup_item, size_t *idx)
+{
+    const void *item;
+    mkavl_rc_e rc;
+
+    switch (type) {
+    case MKAVL_FIND_TYPE_E_EQUAL:
+        rc = mkavl_mapped_bound(mapped_h, key_idx, lookup_item, false, idx);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_mapped_get(mapped_h, key_idx, *idx, &item);
+        }
+        if (mkavl_rc_e_is_ok(rc) && (NULL != item) &&
+            (0 != mapped_h->compare_fn_array[key_idx](item, lookup_item,
+                                                      mapped_h->context))) {
+            *idx = mapped_h->item_cnt;
+        }
+        break;
+    case MKAVL_FIND_TYPE_E_GT:
+    case MKAVL_FIND_TYPE_E_GE:
+        rc = mkavl_mapped_bound(mapped_h, key_idx, lookup_item,
+                                (MKAVL_FIND_TYPE_E_GT == type), idx);
+        break;
+    case MKAVL_FIND_TYPE_E_LT:
+    case MKAVL_FIND_TYPE_E_LE:
+        /* The item before the first one past the lookup item */
+        rc = mkavl_mapped_bound(mapped_h, key_idx, lookup_item,
+                                (MKAVL_FIND_TYPE_E_LE == type), idx);
+        if (mkavl_rc_e_is_ok(rc)) {
+            *idx = (0 == *idx) ? mapped_h->item_cnt : (*idx - 1);
+        }
+        break;
+    default:
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (rc);
+}
+
+/**
+ * Map a file written by mkavl_save_mapped() to search it in place.  Only the
+ * header and footer are checked, so this is O(1) time however large the file
+ * is; mkavl_mapped_verify() checks the rest.  The file is mapped read-only and
+ * shared, so the mapping stays valid if the file descriptor is closed, but the
+ * file must not be changed while it is mapped.
+ *
+ * @see mkavl_mapped_close
+ * @param mapped_h The pointer to fill in with the new tree.
+ * @param fd The file descriptor of the file.
+ * @param compare_fn_array The comparison function of each key, in the order
+ * of the keys of the tree that was saved.  The array is copied.
+ * @param compare_fn_array_count The number of keys, which must be the number
+ * of keys of the tree that was saved.
+ * @param context The context passed to the comparison functions and to the
+ * callbacks of mkavl_mapped_find_range().
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the file is not a
+ * mapped tree and MKAVL_RC_E_EIO if it cannot be mapped.
+ */
+mkavl_rc_e
+mkavl_mapped_open (mkavl_mapped_handle *mapped_h, int fd,
+                   mkavl_compare_fn *compare_fn_array,
+                   size_t compare_fn_array_count, void *context)
+{
+    mkavl_mapped_handle local_mapped_h = NULL;
+    mkavl_mapped_header_st header;
+    mkavl_mapped_footer_st footer;
+    struct stat st;
+    void *base = MAP_FAILED;
+    size_t i, len, avail;
+    mkavl_rc_e rc;
+
+    if ((NULL == mapped_h) || (fd < 0) || (NULL == compare_fn_array) ||
+        (0 == compare_fn_array_count)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *mapped_h = NULL;
+
+    for (i = 0; i < compare_fn_array_count; ++i) {
+        if (NULL == compare_fn_array[i]) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+    }
+
+    if (0 != fstat(fd, &st)) {
+        return (MKAVL_RC_E_EIO);
+    }
+    if ((st.st_size < (off_t) (sizeof(header) + sizeof(footer))) ||
+        ((uint64_t) st.st_size > SIZE_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    len = st.st_size;
+
+    base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == base) {
+        return (MKAVL_RC_E_EIO);
+    }
+
+    memcpy(&header, base, sizeof(header));
+    memcpy(&footer, ((uint8_t *) base + len - sizeof(footer)),
+           sizeof(footer));
+    if ((0 != memcmp(header.magic, MKAVL_MAPPED_MAGIC,
+                     sizeof(header.magic))) ||
+        (MKAVL_MAPPED_VERSION != header.version) ||
+        (MKAVL_MAPPED_BYTE_ORDER != header.byte_order) ||
+        (footer.footer_crc !=
+         mkavl_crc32(0, &footer, offsetof(mkavl_mapped_footer_st,
+                                          footer_crc)))) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto err_exit;
+    }
+
+    /* The offsets of every key exactly fill the space before the footer */
+    avail = len - sizeof(footer);
+    if ((footer.key_cnt != compare_fn_array_count) ||
+        (footer.keys_off < sizeof(header)) || (footer.keys_off > avail) ||
+        (0 != (footer.keys_off % sizeof(uint64_t))) ||
+        (footer.item_cnt > UINT32_MAX)) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto err_exit;
+    }
+    avail = (avail - footer.keys_off) / sizeof(uint64_t);
+    if ((footer.item_cnt > (avail / footer.key_cnt)) ||
+        ((footer.item_cnt * footer.key_cnt * sizeof(uint64_t)) !=
+         (len - sizeof(footer) - footer.keys_off))) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto err_exit;
+    }
+
+    local_mapped_h = calloc(1, sizeof(*local_mapped_h));
+    if (NULL == local_mapped_h) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+
+    local_mapped_h->compare_fn_array =
+        calloc(compare_fn_array_count,
+               sizeof(*(local_mapped_h->compare_fn_array)));
+    if (NULL == local_mapped_h->compare_fn_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    memcpy(local_mapped_h->compare_fn_array, compare_fn_array,
+           (compare_fn_array_count *
+            sizeof(*(local_mapped_h->compare_fn_array))));
+
+    local_mapped_h->base = base;
+    local_mapped_h->len = len;
+    local_mapped_h->item_cnt = footer.item_cnt;
+    local_mapped_h->key_cnt = footer.key_cnt;
+    local_mapped_h->items_end = footer.keys_off;
+    /* The mapping is page aligned, so the aligned offsets are too */
+    local_mapped_h->off_array =
+        (const uint64_t *) (local_mapped_h->base + footer.keys_off);
+    local_mapped_h->context = context;
+    local_mapped_h->magic = MKAVL_CTX_MAGIC;
+
+    *mapped_h = local_mapped_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+
+err_exit:
+
+    if (NULL != local_mapped_h) {
+        free(local_mapped_h->compare_fn_array);
+        free(local_mapped_h);
+    }
+    munmap(base, len);
+
+    return (rc);
+}
+
+/**
+ * Unmap a mapped tree.  Any iterators on it must be deleted first, and the
+ * items found in it may not be used afterwards.
+ *
+ * @see mkavl_mapped_open
+ * @param mapped_h The tree to close.  Upon return, this will be set to NULL.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_close (mkavl_mapped_handle *mapped_h)
+{
+    mkavl_mapped_handle local_mapped_h;
+
+    if (NULL == mapped_h) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_mapped_h = *mapped_h;
+
+    if (!mkavl_mapped_is_valid(local_mapped_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    munmap((void *) local_mapped_h->base, local_mapped_h->len);
+    free(local_mapped_h->compare_fn_array);
+    local_mapped_h->magic = MKAVL_CTX_STALE;
+    free(local_mapped_h);
+
+    *mapped_h = NULL;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Check the CRC of the whole file of a mapped tree.  This reads every page of
+ * the file, so it is O(N) and is left out of mkavl_mapped_open().  Corruption
+ * that it misses, such as a file changed while mapped, still fails lookups
+ * rather than reading outside the mapping.
+ *
+ * @param mapped_h The tree.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the CRC does not
+ * match.
+ */
+mkavl_rc_e
+mkavl_mapped_verify (mkavl_mapped_handle mapped_h)
+{
+    mkavl_mapped_footer_st footer;
+
+    if (!mkavl_mapped_is_valid(mapped_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    memcpy(&footer, (mapped_h->base + mapped_h->len - sizeof(footer)),
+           sizeof(footer));
+    if (footer.data_crc !=
+        mkavl_crc32(0, mapped_h->base, (mapped_h->len - sizeof(footer)))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the number of items in a mapped tree.
+ *
+ * @param mapped_h The tree.
+ * @return The number of items, or 0 if the tree is not valid.
+ */
+uint32_t
+mkavl_mapped_count (mkavl_mapped_handle mapped_h)
+{
+    if (!mkavl_mapped_is_valid(mapped_h)) {
+        return (0);
+    }
+
+    return (mapped_h->item_cnt);
+}
+
+/**
+ * Find an item in a mapped tree.  This is a binary search of the offsets of
+ * the key, so it is O(lg N) and only touches the pages it compares.
+ *
+ * @param mapped_h The tree to search.
+ * @param type The type of lookup to do.
+ * @param key_idx The key being searched.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found for the lookup, or NULL if none is found.
+ * It points into the mapping, which is read-only.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_find (mkavl_mapped_handle mapped_h, mkavl_find_type_e type,
+                   size_t key_idx, const void *lookup_item,
+                   const void **found_item)
+{
+    size_t idx;
+    mkavl_rc_e rc;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_find_type_e_is_valid(type) ||
+        !mkavl_mapped_is_valid(mapped_h) ||
+        (key_idx >= mapped_h->key_cnt)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    rc = mkavl_mapped_find_idx(mapped_h, type, key_idx, lookup_item, &idx);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    return (mkavl_mapped_get(mapped_h, key_idx, idx, found_item));
+}
+
+/**
+ * Walk the items of one key of a mapped tree that lie between two bounds, in
+ * ascending or descending order.  Both ends of the range are found by binary
+ * search and the offsets between them are then read in order, so this is
+ * O(lg N + K) for K items walked.
+ *
+ * @see mkavl_find_range
+ * @param mapped_h The tree to search.
+ * @param key_idx The key being searched.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param descending If true, the walk goes from the upper bound to the lower
+ * bound.
+ * @param cb_fn The callback function to apply to each item in the range.  The
+ * items are in the read-only mapping and must not be changed.  The walk stops
+ * early if it sets stop_walk or returns an error.
+ * @param walk_context The opaque walk context passed to the callback.
+ * @return The return code.  An error from the callback is returned as is.
+ */
+mkavl_rc_e
+mkavl_mapped_find_range (mkavl_mapped_handle mapped_h, size_t key_idx,
+                         const void *lo_item, bool lo_inclusive,
+                         const void *hi_item, bool hi_inclusive,
+                         bool descending, mkavl_walk_cb_fn cb_fn,
+                         void *walk_context)
+{
+    size_t start_idx = 0, end_idx, i;
+    bool stop_walk = false;
+    const void *item;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if ((NULL == cb_fn) || !mkavl_mapped_is_valid(mapped_h) ||
+        (key_idx >= mapped_h->key_cnt)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    end_idx = mapped_h->item_cnt;
+
+    if (NULL != lo_item) {
+        rc = mkavl_mapped_bound(mapped_h, key_idx, lo_item, !lo_inclusive,
+                                &start_idx);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (NULL != hi_item)) {
+        rc = mkavl_mapped_bound(mapped_h, key_idx, hi_item, hi_inclusive,
+                                &end_idx);
+    }
+
+    for (i = 0; mkavl_rc_e_is_ok(rc) && !stop_walk &&
+         ((start_idx + i) < end_idx); ++i) {
+        rc = mkavl_mapped_get(mapped_h, key_idx,
+                              (descending ? (end_idx - i - 1) :
+                                            (start_idx + i)), &item);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = cb_fn((void *) item, mapped_h->context, walk_context,
+                       &stop_walk);
+        }
+    }
+
+    return (rc);
+}
+
+/**
+ * Create a new iterator over a mapped tree.  The iterator takes no lock, since
+ * the tree never changes, but it must be deleted before the tree is closed.
+ *
+ * @see mkavl_mapped_iter_delete
+ * @param iterator_h The pointer to fill in with the new iterator.
+ * @param mapped_h The tree on which to iterate.
+ * @param key_idx The key on which to iterate.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_new (mkavl_mapped_iterator_handle *iterator_h,
+                       mkavl_mapped_handle mapped_h, size_t key_idx)
+{
+    mkavl_mapped_iterator_handle local_iter_h;
+
+    if ((NULL == iterator_h) || !mkavl_mapped_is_valid(mapped_h) ||
+        (key_idx >= mapped_h->key_cnt)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *iterator_h = NULL;
+
+    local_iter_h = calloc(1, sizeof(*local_iter_h));
+    if (NULL == local_iter_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    local_iter_h->mapped_h = mapped_h;
+    local_iter_h->key_idx = key_idx;
+    local_iter_h->idx = mapped_h->item_cnt;
+    local_iter_h->magic = MKAVL_CTX_MAGIC;
+
+    *iterator_h = local_iter_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Destroy an iterator over a mapped tree.
+ *
+ * @see mkavl_mapped_iter_new
+ * @param iterator_h The iterator to free.  Upon return, this will be set to
+ * NULL.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_delete (mkavl_mapped_iterator_handle *iterator_h)
+{
+    mkavl_mapped_iterator_handle local_iter_h;
+
+    if (NULL == iterator_h) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_iter_h = *iterator_h;
+
+    if (!mkavl_mapped_iterator_is_valid(local_iter_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    local_iter_h->magic = MKAVL_CTX_STALE;
+    free(local_iter_h);
+
+    *iterator_h = NULL;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Move an iterator to a position and get the item there.
+ *
+ * @param iterator_h The iterator.
+ * @param idx The position, which may be the null position.
+ * @param item The item found, or NULL for the null position.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_mapped_iter_move (mkavl_mapped_iterator_handle iterator_h, size_t idx,
+                        const void **item)
+{
+    iterator_h->idx = idx;
+
+    return (mkavl_mapped_get(iterator_h->mapped_h, iterator_h->key_idx, idx,
+                             item));
+}
+
+/**
+ * Get the first item in the iteration.
+ *
+ * @see mkavl_mapped_iter_new
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_first (mkavl_mapped_iterator_handle iterator_h,
+                         const void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_mapped_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    /* An empty tree has only the null position */
+    return (mkavl_mapped_iter_move(iterator_h, 0, item));
+}
+
+/**
+ * Get the last item in the iteration.
+ *
+ * @see mkavl_mapped_iter_new
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_last (mkavl_mapped_iterator_handle iterator_h,
+                        const void **item)
+{
+    size_t item_cnt;
+
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_mapped_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    item_cnt = iterator_h->mapped_h->item_cnt;
+
+    return (mkavl_mapped_iter_move(iterator_h,
+                                   ((0 == item_cnt) ? 0 : (item_cnt - 1)),
+                                   item));
+}
+
+/**
+ * Find an item by any type of lookup and update the iterator to it, so the
+ * iteration can continue from there.  If no item is found, the iterator is
+ * left at the null position, from which mkavl_mapped_iter_next() starts at the
+ * first item and mkavl_mapped_iter_prev() starts at the last item.
+ *
+ * @see mkavl_mapped_iter_new
+ * @see mkavl_iter_seek
+ * @param iterator_h The iterator to use.
+ * @param type The type of lookup to do.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_seek (mkavl_mapped_iterator_handle iterator_h,
+                        mkavl_find_type_e type, const void *lookup_item,
+                        const void **found_item)
+{
+    size_t idx;
+    mkavl_rc_e rc;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_find_type_e_is_valid(type) ||
+        !mkavl_mapped_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    rc = mkavl_mapped_find_idx(iterator_h->mapped_h, type,
+                               iterator_h->key_idx, lookup_item, &idx);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    return (mkavl_mapped_iter_move(iterator_h, idx, found_item));
+}
+
+/**
+ * Get the next item in the iteration and update the iterator to it.
+ *
+ * @see mkavl_mapped_iter_new
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_next (mkavl_mapped_iterator_handle iterator_h,
+                        const void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_mapped_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    /* From the null position, the next item is the first */
+    return (mkavl_mapped_iter_move(iterator_h,
+                ((iterator_h->idx >= iterator_h->mapped_h->item_cnt) ? 0 :
+                                                    (iterator_h->idx + 1)),
+                item));
+}
+
+/**
+ * Get the previous item in the iteration and update the iterator to it.
+ *
+ * @see mkavl_mapped_iter_new
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_prev (mkavl_mapped_iterator_handle iterator_h,
+                        const void **item)
+{
+    size_t item_cnt;
+
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_mapped_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    item_cnt = iterator_h->mapped_h->item_cnt;
+
+    /* From the null position, the previous item is the last */
+    if (iterator_h->idx >= item_cnt) {
+        return (mkavl_mapped_iter_move(iterator_h,
+                                       ((0 == item_cnt) ? 0 : (item_cnt - 1)),
+                                       item));
+    }
+
+    return (mkavl_mapped_iter_move(iterator_h,
+                                   ((0 == iterator_h->idx) ? item_cnt :
+                                                    (iterator_h->idx - 1)),
+                                   item));
+}
+
+/**
+ * Get the current item in the iteration.
+ *
+ * @see mkavl_mapped_iter_new
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_mapped_iter_cur (mkavl_mapped_iterator_handle iterator_h,
+                       const void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_mapped_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_mapped_get(iterator_h->mapped_h, iterator_h->key_idx,
+                             iterator_h->idx, item));
+}
@@ -0,0 +1,151 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the public interface for mapped trees, read-only indexes that are
+ * searched in place in a file mapped into memory.  mkavl_save_mapped() writes
+ * the file from a tree and mkavl_mapped_open() maps it in O(1) time, however
+ * many items it holds.  Lookups, range walks and iterators by any key then
+ * read the mapping directly, so the pages are shared through the page cache
+ * by every process that maps the file and a file larger than memory is paged
+ * in and out by the kernel.
+ *
+ * The file holds the bytes of each item once, followed by the items of each
+ * key in order as the file offsets of the items.  This is a perfectly
+ * balanced tree with implicit links: the root of a range of the array is its
+ * middle, so searches take O(lg N) time and walks read the array in order.
+ * The bytes of an item are what the comparison functions get as the item, so
+ * the items must be flat, with no pointers, and need at most 8-byte alignment.
+ * The file is in the byte order of the machine that wrote it.
+ */
+
+#ifndef __MKAVL_MAPPED_H__
+#define __MKAVL_MAPPED_H__
+
+#include "mkavl.h"
+
+/** The bytes at the start of a mapped tree file */
+#define MKAVL_MAPPED_MAGIC "MKAVLMAP"
+
+/** The version of the mapped tree file format */
+#define MKAVL_MAPPED_VERSION 1
+
+/** Written in the byte order of the writer to refuse other byte orders */
+#define MKAVL_MAPPED_BYTE_ORDER 0x01020304
+
+/**
+ * The start of a mapped tree file.  Each item follows, 8-byte aligned, as a
+ * uint64_t length and then its bytes.  The arrays of item offsets of each key
+ * in turn follow the items, and the file ends with a mkavl_mapped_footer_st.
+ */
+typedef struct mkavl_mapped_header_st_ {
+    /** MKAVL_MAPPED_MAGIC without its terminating NUL */
+    char magic[8];
+    /** MKAVL_MAPPED_VERSION */
+    uint32_t version;
+    /** MKAVL_MAPPED_BYTE_ORDER */
+    uint32_t byte_order;
+} mkavl_mapped_header_st;
+
+/**
+ * The end of a mapped tree file, which locates the rest of it.
+ */
+typedef struct mkavl_mapped_footer_st_ {
+    /** The number of items */
+    uint64_t item_cnt;
+    /** The number of keys */
+    uint64_t key_cnt;
+    /** The file offset of the array of item offsets of the first key */
+    uint64_t keys_off;
+    /** The CRC-32 of every byte before the footer */
+    uint32_t data_crc;
+    /** The CRC-32 of the fields of the footer before this one */
+    uint32_t footer_crc;
+} mkavl_mapped_footer_st;
+
+/** Opaque pointer to reference instances of mapped trees */
+typedef struct mkavl_mapped_st_ *mkavl_mapped_handle;
+
+/** Opaque pointer to reference instances of mapped tree iterators */
+typedef struct mkavl_mapped_iterator_st_ *mkavl_mapped_iterator_handle;
+
+/* APIs below are documented in their implementation file */
+
+extern mkavl_rc_e
+mkavl_mapped_open(mkavl_mapped_handle *mapped_h, int fd,
+                  mkavl_compare_fn *compare_fn_array,
+                  size_t compare_fn_array_count, void *context);
+
+extern mkavl_rc_e
+mkavl_mapped_close(mkavl_mapped_handle *mapped_h);
+
+extern mkavl_rc_e
+mkavl_mapped_verify(mkavl_mapped_handle mapped_h);
+
+extern uint32_t
+mkavl_mapped_count(mkavl_mapped_handle mapped_h);
+
+extern mkavl_rc_e
+mkavl_mapped_find(mkavl_mapped_handle mapped_h, mkavl_find_type_e type,
+                  size_t key_idx, const void *lookup_item,
+                  const void **found_item);
+
+extern mkavl_rc_e
+mkavl_mapped_find_range(mkavl_mapped_handle mapped_h, size_t key_idx,
+                        const void *lo_item, bool lo_inclusive,
+                        const void *hi_item, bool hi_inclusive,
+                        bool descending, mkavl_walk_cb_fn cb_fn,
+                        void *walk_context);
+
+/* Mapped tree iterator functions */
+
+extern mkavl_rc_e
+mkavl_mapped_iter_new(mkavl_mapped_iterator_handle *iterator_h,
+                      mkavl_mapped_handle mapped_h, size_t key_idx);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_delete(mkavl_mapped_iterator_handle *iterator_h);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_first(mkavl_mapped_iterator_handle iterator_h,
+                        const void **item);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_last(mkavl_mapped_iterator_handle iterator_h,
+                       const void **item);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_seek(mkavl_mapped_iterator_handle iterator_h,
+                       mkavl_find_type_e type, const void *lookup_item,
+                       const void **found_item);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_next(mkavl_mapped_iterator_handle iterator_h,
+                       const void **item);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_prev(mkavl_mapped_iterator_handle iterator_h,
+                       const void **item);
+
+extern mkavl_rc_e
+mkavl_mapped_iter_cur(mkavl_mapped_iterator_handle iterator_h,
+                      const void **item);
+
+#endif
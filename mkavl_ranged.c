@@ -0,0 +1,1419 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the implementation for range-partitioned mkavl trees.  The routing
+ * table is an array of partitions sorted by their lower bounds and guarded by a
+ * reader-writer lock.  Operations on items share the lock and leave the rest
+ * to the thread safe tree of the partition.  A split or merge takes the lock
+ * exclusively and builds the new partitions with mkavl_bulk_load().
+ */
+
+#include "mkavl_ranged.h"
+#include <pthread.h>
+
+/**
+ * Magic number indicating a pointer is valid for sanity checks.
+ */
+#define MKAVL_CTX_MAGIC 0xCAFEBABE
+
+/**
+ * Magic number indicating a pointer is stale for sanity checks.
+ */
+#define MKAVL_CTX_STALE 0xDEADBEEF
+
+/**
+ * The initial number of partitions for which the routing table has room.
+ */
+#define MKAVL_RANGED_INITIAL_PART_CNT 8
+
+/**
+ * One entry of the routing table.
+ */
+typedef struct mkavl_partition_st_ {
+    /**
+     * The smallest primary key the partition may hold, copied by the
+     * bound_copy_fn.  NULL for the first partition, which has no lower bound.
+     * The upper bound is the lower bound of the next partition.
+     */
+    void *lo_bound;
+    /** The items in the interval */
+    mkavl_tree_handle tree_h;
+} mkavl_partition_st;
+
+/**
+ * A tree whose items are spread over several mkavl trees by intervals of their
+ * primary key.
+ */
+typedef struct mkavl_ranged_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /**
+     * Guards the routing table.  Shared by all the operations on items and
+     * taken exclusively to split or merge partitions.
+     */
+    pthread_rwlock_t rwlock;
+    /** The routing table, sorted by lower bound */
+    mkavl_partition_st *part_array;
+    /** The number of partitions */
+    size_t part_cnt;
+    /** The number of partitions for which part_array has room */
+    size_t part_array_cnt;
+    /** The settings given to mkavl_ranged_new() */
+    mkavl_ranged_opts_st ranged_opts;
+    /** The options for the trees of new partitions */
+    mkavl_opts_st tree_opts;
+    /** Our own copy of the aggregates in tree_opts, if any */
+    mkavl_aggregate_st *aggregate_array;
+    /** The comparison functions */
+    mkavl_compare_fn *compare_fn_array;
+    /** The number of comparison functions */
+    size_t compare_fn_array_count;
+    /** The client context given to mkavl_ranged_new() */
+    void *context;
+    /** The allocator for the ranged tree and its partitions */
+    mkavl_allocator_st allocator;
+} mkavl_ranged_st;
+
+/**
+ * An iterator over a ranged tree in the order of the primary key.  It shares
+ * the routing table for a call only, since partitions may be split or merged
+ * between calls, so each call routes from the current item to find its
+ * partition again.
+ */
+typedef struct mkavl_ranged_iterator_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The tree being iterated */
+    mkavl_ranged_handle ranged_h;
+    /** The current item, NULL at the null item */
+    void *cur_item;
+} mkavl_ranged_iterator_st;
+
+/**
+ * The state for mkavl_ranged_walk_cb().
+ */
+typedef struct mkavl_ranged_walk_st_ {
+    /** The callback of the client */
+    mkavl_walk_cb_fn cb_fn;
+    /** The walk context of the client */
+    void *walk_context;
+    /** Set once the callback of the client stops the walk */
+    bool stopped;
+} mkavl_ranged_walk_st;
+
+/**
+ * The default malloc function.
+ *
+ * @param size Size of memory to allocate.
+ * @param context The tree context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_ranged_default_malloc_fn (size_t size, void *context)
+{
+    return (malloc(size));
+}
+
+/**
+ * The default free function.
+ *
+ * @param ptr The memory to free.
+ * @param context The tree context.
+ */
+static void
+mkavl_ranged_default_free_fn (void *ptr, void *context)
+{
+    return (free(ptr));
+}
+
+/**
+ * By default, we'll just use malloc and free if the client passes nothing in.
+ */
+static mkavl_allocator_st mkavl_ranged_allocator_default = {
+    mkavl_ranged_default_malloc_fn,
+    mkavl_ranged_default_free_fn
+};
+
+/**
+ * Verify the ranged tree is valid.
+ *
+ * @param ranged_h The tree to check.
+ * @return true if the tree is valid.
+ */
+static bool
+mkavl_ranged_is_valid (mkavl_ranged_handle ranged_h)
+{
+    /* The routing table may only be looked at with the lock held */
+    return ((NULL != ranged_h) && (MKAVL_CTX_MAGIC == ranged_h->magic));
+}
+
+/**
+ * Verify the ranged iterator is valid.
+ *
+ * @param iterator_h The iterator to check.
+ * @return true if the iterator is valid.
+ */
+static bool
+mkavl_ranged_iterator_is_valid (mkavl_ranged_iterator_handle iterator_h)
+{
+    return ((NULL != iterator_h) && (MKAVL_CTX_MAGIC == iterator_h->magic) &&
+            mkavl_ranged_is_valid(iterator_h->ranged_h));
+}
+
+/**
+ * Abort if a lock call failed.  None of them can fail on a lock that is used
+ * correctly.
+ *
+ * @param err The result of the pthread call.
+ */
+static void
+mkavl_ranged_lock_check (int err)
+{
+    if (0 != err) {
+        abort();
+    }
+}
+
+/**
+ * Share the routing table.
+ *
+ * @param ranged_h The tree.
+ */
+static void
+mkavl_ranged_read_lock (mkavl_ranged_handle ranged_h)
+{
+    mkavl_ranged_lock_check(pthread_rwlock_rdlock(&(ranged_h->rwlock)));
+}
+
+/**
+ * Take the routing table exclusively.
+ *
+ * @param ranged_h The tree.
+ */
+static void
+mkavl_ranged_write_lock (mkavl_ranged_handle ranged_h)
+{
+    mkavl_ranged_lock_check(pthread_rwlock_wrlock(&(ranged_h->rwlock)));
+}
+
+/**
+ * Release the routing table.
+ *
+ * @param ranged_h The tree.
+ */
+static void
+mkavl_ranged_unlock (mkavl_ranged_handle ranged_h)
+{
+    mkavl_ranged_lock_check(pthread_rwlock_unlock(&(ranged_h->rwlock)));
+}
+
+/**
+ * Get the partition whose interval holds an item.  This is a binary search for
+ * the last partition whose lower bound is not greater than the item.  The
+ * routing table must be held.
+ *
+ * @param ranged_h The tree.
+ * @param item The item, or lookup item, by whose primary key to route.
+ * @return The index of the partition.
+ */
+static size_t
+mkavl_ranged_route (mkavl_ranged_handle ranged_h, const void *item)
+{
+    mkavl_compare_fn compare_fn = ranged_h->compare_fn_array[0];
+    size_t lo = 1, hi = ranged_h->part_cnt, mid;
+
+    while (lo < hi) {
+        mid = (lo + ((hi - lo) / 2));
+        if (compare_fn(ranged_h->part_array[mid].lo_bound, item,
+                       ranged_h->context) <= 0) {
+            lo = (mid + 1);
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo - 1);
+}
+
+/**
+ * Get the index of the partition with the given tree, which a writer noted
+ * while sharing the routing table.  The routing table must be held.
+ *
+ * @param ranged_h The tree.
+ * @param tree_h The tree of the partition.
+ * @param part_idx Set to the index of the partition.
+ * @return true if the partition is still in the routing table.
+ */
+static bool
+mkavl_ranged_lookup_part (mkavl_ranged_handle ranged_h,
+                          mkavl_tree_handle tree_h, size_t *part_idx)
+{
+    size_t i;
+
+    for (i = 0; i < ranged_h->part_cnt; ++i) {
+        if (ranged_h->part_array[i].tree_h == tree_h) {
+            *part_idx = i;
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+/**
+ * Create the tree for a new partition.
+ *
+ * @param ranged_h The ranged tree.
+ * @param tree_h Set to the new tree.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_ranged_tree_new (mkavl_ranged_handle ranged_h,
+                       mkavl_tree_handle *tree_h)
+{
+    return (mkavl_new_opts(tree_h, ranged_h->compare_fn_array,
+                           ranged_h->compare_fn_array_count,
+                           ranged_h->context, &(ranged_h->allocator),
+                           &(ranged_h->tree_opts)));
+}
+
+/**
+ * Get all the items of a partition in the order of the primary key.
+ *
+ * @param ranged_h The ranged tree.
+ * @param tree_h The tree of the partition.
+ * @param item_array The array in which to put the items.  It must have room
+ * for all of them.
+ * @param item_cnt Set to the number of items.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_ranged_gather (mkavl_ranged_handle ranged_h, mkavl_tree_handle tree_h,
+                     void **item_array, size_t *item_cnt)
+{
+    *item_cnt = 0;
+    if (0 == mkavl_count(tree_h)) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    return (mkavl_find_range_array(tree_h, 0, NULL, false, NULL, false, false,
+                                   item_array, mkavl_count(tree_h), item_cnt));
+}
+
+/**
+ * Make room for one more partition in the routing table.  The routing table
+ * must be held exclusively.
+ *
+ * @param ranged_h The tree.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_ranged_grow (mkavl_ranged_handle ranged_h)
+{
+    mkavl_partition_st *part_array;
+    size_t part_array_cnt;
+
+    if (ranged_h->part_cnt < ranged_h->part_array_cnt) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    part_array_cnt = (2 * ranged_h->part_array_cnt);
+    part_array = ranged_h->allocator.malloc_fn((part_array_cnt *
+                                                sizeof(*part_array)),
+                                               ranged_h->context);
+    if (NULL == part_array) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memcpy(part_array, ranged_h->part_array,
+           (ranged_h->part_cnt * sizeof(*part_array)));
+    ranged_h->allocator.free_fn(ranged_h->part_array, ranged_h->context);
+    ranged_h->part_array = part_array;
+    ranged_h->part_array_cnt = part_array_cnt;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Split a partition in two at its median item.  Both halves are bulk loaded
+ * into new trees, so they come out balanced.  The routing table must be held
+ * exclusively.  If anything fails, the partition is left as it was.
+ *
+ * @param ranged_h The tree.
+ * @param part_idx The index of the partition to split.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_ranged_split (mkavl_ranged_handle ranged_h, size_t part_idx)
+{
+    mkavl_partition_st *part = &(ranged_h->part_array[part_idx]);
+    mkavl_tree_handle lo_tree_h = NULL, hi_tree_h = NULL;
+    void **item_array;
+    void *bound = NULL;
+    size_t item_cnt, half;
+    mkavl_rc_e rc;
+
+    rc = mkavl_ranged_grow(ranged_h);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+    part = &(ranged_h->part_array[part_idx]);
+
+    item_array = ranged_h->allocator.malloc_fn((mkavl_count(part->tree_h) *
+                                                sizeof(*item_array)),
+                                               ranged_h->context);
+    if (NULL == item_array) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    rc = mkavl_ranged_gather(ranged_h, part->tree_h, item_array, &item_cnt);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    if (item_cnt < 2) {
+        goto cleanup;
+    }
+    half = (item_cnt / 2);
+
+    bound = ranged_h->ranged_opts.bound_copy_fn(item_array[half],
+                                                ranged_h->context);
+    if (NULL == bound) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto cleanup;
+    }
+
+    rc = mkavl_ranged_tree_new(ranged_h, &lo_tree_h);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_ranged_tree_new(ranged_h, &hi_tree_h);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_bulk_load(lo_tree_h, item_array, half, true, 0);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_bulk_load(hi_tree_h, &(item_array[half]),
+                             (item_cnt - half), true, 0);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    rc = mkavl_delete(&(part->tree_h), NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+    part->tree_h = lo_tree_h;
+    lo_tree_h = NULL;
+
+    memmove(&(ranged_h->part_array[part_idx + 2]),
+            &(ranged_h->part_array[part_idx + 1]),
+            ((ranged_h->part_cnt - part_idx - 1) * sizeof(*part)));
+    ranged_h->part_array[part_idx + 1].lo_bound = bound;
+    ranged_h->part_array[part_idx + 1].tree_h = hi_tree_h;
+    ++(ranged_h->part_cnt);
+    bound = NULL;
+    hi_tree_h = NULL;
+
+cleanup:
+
+    if (NULL != lo_tree_h) {
+        mkavl_delete(&lo_tree_h, NULL, NULL);
+    }
+    if (NULL != hi_tree_h) {
+        mkavl_delete(&hi_tree_h, NULL, NULL);
+    }
+    if (NULL != bound) {
+        ranged_h->ranged_opts.bound_free_fn(bound, ranged_h->context);
+    }
+    ranged_h->allocator.free_fn(item_array, ranged_h->context);
+
+    return (rc);
+}
+
+/**
+ * Merge a partition with a neighbor, normally the next one, into a single
+ * bulk loaded tree.  Nothing is done if the merged partition would need to be
+ * split.  The routing table must be held exclusively.  If anything fails, the
+ * partitions are left as they were.
+ *
+ * @param ranged_h The tree.
+ * @param part_idx The index of the partition to merge.
+ * @return The return code.  MKAVL_RC_E_EOOSYNC is returned if an item of one
+ * partition is equal to an item of the other by a key other than the primary
+ * key, as a single tree cannot hold both.
+ */
+static mkavl_rc_e
+mkavl_ranged_merge (mkavl_ranged_handle ranged_h, size_t part_idx)
+{
+    mkavl_partition_st *lo_part, *hi_part;
+    mkavl_tree_handle tree_h = NULL;
+    void **item_array;
+    size_t lo_cnt, hi_cnt;
+    mkavl_rc_e rc;
+
+    if (ranged_h->part_cnt < 2) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    if ((part_idx + 1) == ranged_h->part_cnt) {
+        --part_idx;
+    }
+    lo_part = &(ranged_h->part_array[part_idx]);
+    hi_part = &(ranged_h->part_array[part_idx + 1]);
+
+    lo_cnt = mkavl_count(lo_part->tree_h);
+    hi_cnt = mkavl_count(hi_part->tree_h);
+    if ((lo_cnt + hi_cnt) > ranged_h->ranged_opts.split_cnt) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    /* Allocate at least one slot so that empty partitions can be merged */
+    item_array = ranged_h->allocator.malloc_fn(((lo_cnt + hi_cnt + 1) *
+                                                sizeof(*item_array)),
+                                               ranged_h->context);
+    if (NULL == item_array) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    /* The items of the lower partition all come before those of the upper */
+    rc = mkavl_ranged_gather(ranged_h, lo_part->tree_h, item_array, &lo_cnt);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_ranged_gather(ranged_h, hi_part->tree_h,
+                                 &(item_array[lo_cnt]), &hi_cnt);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_ranged_tree_new(ranged_h, &tree_h);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_bulk_load(tree_h, item_array, (lo_cnt + hi_cnt), true, 0);
+        /*
+         * The tree is new and the items are sorted by the primary key, which
+         * is unique across partitions, so only a secondary key can collide
+         */
+        if (MKAVL_RC_E_EINVAL == rc) {
+            rc = MKAVL_RC_E_EOOSYNC;
+        }
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto cleanup;
+    }
+
+    rc = mkavl_delete(&(lo_part->tree_h), NULL, NULL);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_delete(&(hi_part->tree_h), NULL, NULL);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        /* A thread safe tree without lockless reads cannot fail to delete */
+        abort();
+    }
+    lo_part->tree_h = tree_h;
+    tree_h = NULL;
+
+    ranged_h->ranged_opts.bound_free_fn(hi_part->lo_bound, ranged_h->context);
+    memmove(hi_part, (hi_part + 1),
+            ((ranged_h->part_cnt - part_idx - 2) * sizeof(*hi_part)));
+    --(ranged_h->part_cnt);
+
+cleanup:
+
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+    ranged_h->allocator.free_fn(item_array, ranged_h->context);
+
+    return (rc);
+}
+
+/**
+ * Split or merge a partition that a writer found past a threshold while
+ * sharing the routing table.  The partition is checked again once the routing
+ * table is held exclusively, as another writer may have got there first.
+ * Rebalancing is best effort: if it fails, the partition is merely left too
+ * large or too small.  In particular, a partition is never merged with a
+ * neighbor holding an item equal to one of its own by a secondary key.
+ *
+ * @param ranged_h The tree.
+ * @param tree_h The tree of the partition.
+ */
+static void
+mkavl_ranged_rebalance (mkavl_ranged_handle ranged_h,
+                        mkavl_tree_handle tree_h)
+{
+    size_t part_idx, item_cnt;
+
+    mkavl_ranged_write_lock(ranged_h);
+
+    if (mkavl_ranged_lookup_part(ranged_h, tree_h, &part_idx)) {
+        item_cnt = mkavl_count(tree_h);
+        if (item_cnt > ranged_h->ranged_opts.split_cnt) {
+            mkavl_ranged_split(ranged_h, part_idx);
+        } else if (item_cnt < ranged_h->ranged_opts.merge_cnt) {
+            mkavl_ranged_merge(ranged_h, part_idx);
+        }
+    }
+
+    mkavl_ranged_unlock(ranged_h);
+}
+
+/**
+ * Create a new ranged tree, which starts out with a single partition.  Each
+ * partition is created with mkavl_new_opts() from the given arguments, except
+ * that the partitions are always thread safe.
+ *
+ * @see mkavl_ranged_delete
+ * @see mkavl_new_opts
+ * @param ranged_h A pointer to the memory location for the new tree.
+ * @param ranged_opts How the tree is partitioned.  A copy is made for the tree.
+ * @param compare_fn_array An array of size compare_fn_array_count of the
+ * comparison functions for the tree.  Index 0 is the primary key.
+ * @param compare_fn_array_count The size of the compare_fn_array.
+ * @param context An opaque context passed back to the client in callbacks.
+ * @param allocator The memory allocation functions to use for the tree, or NULL
+ * if the default functions are to be used.
+ * @param opts The options for the partitions, or NULL for the defaults.
+ * Lockless reads are not supported, as the routing table is always locked.
+ * @return The return value
+ */
+mkavl_rc_e
+mkavl_ranged_new (mkavl_ranged_handle *ranged_h,
+                  const mkavl_ranged_opts_st *ranged_opts,
+                  mkavl_compare_fn *compare_fn_array,
+                  size_t compare_fn_array_count, void *context,
+                  mkavl_allocator_st *allocator, const mkavl_opts_st *opts)
+{
+    mkavl_allocator_st *local_allocator;
+    mkavl_ranged_handle local_ranged_h;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
+
+    if ((NULL == ranged_h) || (NULL == ranged_opts) ||
+        (ranged_opts->split_cnt < 2) ||
+        (ranged_opts->merge_cnt >= ranged_opts->split_cnt) ||
+        (NULL == ranged_opts->bound_copy_fn) ||
+        (NULL == ranged_opts->bound_free_fn) ||
+        (NULL == compare_fn_array) || (0 == compare_fn_array_count) ||
+        ((NULL != opts) && opts->lockless_reads)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *ranged_h = NULL;
+
+    local_allocator =
+        (NULL == allocator) ? &mkavl_ranged_allocator_default : allocator;
+
+    local_ranged_h = local_allocator->malloc_fn(sizeof(*local_ranged_h),
+                                                context);
+    if (NULL == local_ranged_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(local_ranged_h, 0, sizeof(*local_ranged_h));
+    if (0 != pthread_rwlock_init(&(local_ranged_h->rwlock), NULL)) {
+        local_allocator->free_fn(local_ranged_h, context);
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    local_ranged_h->magic = MKAVL_CTX_MAGIC;
+    memcpy(&(local_ranged_h->ranged_opts), ranged_opts,
+           sizeof(local_ranged_h->ranged_opts));
+    local_ranged_h->compare_fn_array_count = compare_fn_array_count;
+    local_ranged_h->context = context;
+    memcpy(&(local_ranged_h->allocator), local_allocator,
+           sizeof(local_ranged_h->allocator));
+
+    if (NULL != opts) {
+        memcpy(&(local_ranged_h->tree_opts), opts,
+               sizeof(local_ranged_h->tree_opts));
+    }
+    local_ranged_h->tree_opts.thread_safe = true;
+
+    /* Partitions are created long after the client's array may be gone */
+    if ((NULL != opts) && (NULL != opts->aggregate_array)) {
+        local_ranged_h->aggregate_array =
+            local_allocator->malloc_fn((compare_fn_array_count *
+                                        sizeof(*(opts->aggregate_array))),
+                                       context);
+        if (NULL == local_ranged_h->aggregate_array) {
+            rc = MKAVL_RC_E_ENOMEM;
+            goto err_exit;
+        }
+        memcpy(local_ranged_h->aggregate_array, opts->aggregate_array,
+               (compare_fn_array_count * sizeof(*(opts->aggregate_array))));
+        local_ranged_h->tree_opts.aggregate_array =
+            local_ranged_h->aggregate_array;
+    }
+
+    local_ranged_h->compare_fn_array =
+        local_allocator->malloc_fn((compare_fn_array_count *
+                                    sizeof(*compare_fn_array)), context);
+    if (NULL == local_ranged_h->compare_fn_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    memcpy(local_ranged_h->compare_fn_array, compare_fn_array,
+           (compare_fn_array_count * sizeof(*compare_fn_array)));
+
+    local_ranged_h->part_array =
+        local_allocator->malloc_fn((MKAVL_RANGED_INITIAL_PART_CNT *
+                                    sizeof(*(local_ranged_h->part_array))),
+                                   context);
+    if (NULL == local_ranged_h->part_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    local_ranged_h->part_array_cnt = MKAVL_RANGED_INITIAL_PART_CNT;
+
+    local_ranged_h->part_array[0].lo_bound = NULL;
+    rc = mkavl_ranged_tree_new(local_ranged_h,
+                               &(local_ranged_h->part_array[0].tree_h));
+    if (mkavl_rc_e_is_notok(rc)) {
+        goto err_exit;
+    }
+    local_ranged_h->part_cnt = 1;
+
+    *ranged_h = local_ranged_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+
+err_exit:
+
+    err_rc = mkavl_ranged_delete(&local_ranged_h, NULL, NULL);
+    if (mkavl_rc_e_is_notok(err_rc)) {
+        abort();
+    }
+
+    return (rc);
+}
+
+/**
+ * Destroy a ranged tree created by mkavl_ranged_new(), as mkavl_delete() does
+ * for a tree.  Upon return, the ranged_h memory is set to NULL.  No other
+ * thread may be using the tree.
+ *
+ * @see mkavl_ranged_new
+ * @see mkavl_delete
+ * @param ranged_h A pointer the the tree to free.
+ * @param item_fn This function is applied once to each item of every
+ * partition.  If NULL, no function is applied.
+ * @param delete_context_fn This function is applied once to the client context
+ * after all the partitions have been deleted.  If NULL, no function is applied.
+ * @return The return code.  If deleting a partition fails, the other
+ * partitions are still deleted and the first error is returned.
+ */
+mkavl_rc_e
+mkavl_ranged_delete (mkavl_ranged_handle *ranged_h, mkavl_item_fn item_fn,
+                     mkavl_delete_context_fn delete_context_fn)
+{
+    mkavl_ranged_handle local_ranged_h;
+    mkavl_free_fn free_fn;
+    void *context;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
+    size_t i;
+
+    if ((NULL == ranged_h) || (NULL == *ranged_h) ||
+        (MKAVL_CTX_MAGIC != (*ranged_h)->magic)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_ranged_h = *ranged_h;
+    context = local_ranged_h->context;
+    free_fn = local_ranged_h->allocator.free_fn;
+
+    if (NULL != local_ranged_h->part_array) {
+        for (i = 0; i < local_ranged_h->part_cnt; ++i) {
+            err_rc = mkavl_delete(&(local_ranged_h->part_array[i].tree_h),
+                                  item_fn, NULL);
+            if (mkavl_rc_e_is_notok(err_rc) && mkavl_rc_e_is_ok(rc)) {
+                rc = err_rc;
+            }
+            if (NULL != local_ranged_h->part_array[i].lo_bound) {
+                local_ranged_h->ranged_opts.bound_free_fn(
+                    local_ranged_h->part_array[i].lo_bound, context);
+            }
+        }
+        free_fn(local_ranged_h->part_array, context);
+    }
+
+    if (NULL != local_ranged_h->compare_fn_array) {
+        free_fn(local_ranged_h->compare_fn_array, context);
+    }
+
+    if (NULL != local_ranged_h->aggregate_array) {
+        free_fn(local_ranged_h->aggregate_array, context);
+    }
+
+    if (NULL != delete_context_fn) {
+        err_rc = delete_context_fn(context);
+        if (mkavl_rc_e_is_notok(err_rc) && mkavl_rc_e_is_ok(rc)) {
+            rc = err_rc;
+        }
+    }
+
+    pthread_rwlock_destroy(&(local_ranged_h->rwlock));
+    local_ranged_h->magic = MKAVL_CTX_STALE;
+    free_fn(local_ranged_h, context);
+    *ranged_h = NULL;
+
+    return (rc);
+}
+
+/**
+ * Add an item to the partition whose interval holds its primary key, as with
+ * mkavl_add().  If the partition grows past the split threshold, it is split
+ * before returning.
+ *
+ * @see mkavl_add
+ * @param ranged_h The tree to add to.
+ * @param item_to_add The item to add.
+ * @param existing_item Set to the item already in the partition that is equal
+ * to item_to_add for some key, if any, in which case item_to_add is not added.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_add (mkavl_ranged_handle ranged_h, void *item_to_add,
+                  void **existing_item)
+{
+    mkavl_tree_handle tree_h;
+    bool do_split;
+    mkavl_rc_e rc;
+
+    if ((NULL == item_to_add) || (NULL == existing_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *existing_item = NULL;
+
+    if (!mkavl_ranged_is_valid(ranged_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_ranged_read_lock(ranged_h);
+    tree_h = ranged_h->part_array[mkavl_ranged_route(ranged_h,
+                                                     item_to_add)].tree_h;
+    rc = mkavl_add(tree_h, item_to_add, existing_item);
+    do_split = (mkavl_rc_e_is_ok(rc) && (NULL == *existing_item) &&
+                (mkavl_count(tree_h) > ranged_h->ranged_opts.split_cnt));
+    mkavl_ranged_unlock(ranged_h);
+
+    if (do_split) {
+        mkavl_ranged_rebalance(ranged_h, tree_h);
+    }
+
+    return (rc);
+}
+
+/**
+ * Remove an item from the partition whose interval holds its primary key, as
+ * with mkavl_remove().  If the partition shrinks below the merge threshold, it
+ * is merged with a neighbor before returning.
+ *
+ * @see mkavl_remove
+ * @param ranged_h The tree to remove from.
+ * @param item_to_remove The item to remove, or an item equal to it by the
+ * primary key.
+ * @param found_item Set to the item removed, NULL if there was none.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_remove (mkavl_ranged_handle ranged_h, const void *item_to_remove,
+                     void **found_item)
+{
+    mkavl_tree_handle tree_h;
+    bool do_merge;
+    mkavl_rc_e rc;
+
+    if ((NULL == item_to_remove) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_ranged_is_valid(ranged_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    mkavl_ranged_read_lock(ranged_h);
+    tree_h = ranged_h->part_array[mkavl_ranged_route(ranged_h,
+                                                     item_to_remove)].tree_h;
+    rc = mkavl_remove(tree_h, item_to_remove, found_item);
+    do_merge = (mkavl_rc_e_is_ok(rc) && (NULL != *found_item) &&
+                (ranged_h->part_cnt > 1) &&
+                (mkavl_count(tree_h) < ranged_h->ranged_opts.merge_cnt));
+    mkavl_ranged_unlock(ranged_h);
+
+    if (do_merge) {
+        mkavl_ranged_rebalance(ranged_h, tree_h);
+    }
+
+    return (rc);
+}
+
+/**
+ * Find an item, as with mkavl_find().  A lookup by the primary key starts in
+ * the partition of the lookup item and only moves on to the neighboring
+ * partitions if nothing is found there.  A lookup by any other key searches
+ * every partition and takes the nearest of the items found.
+ *
+ * @see mkavl_find
+ * @param ranged_h The tree to search.
+ * @param type The type of lookup to do.
+ * @param key_idx The key to search by.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found for the lookup.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_find (mkavl_ranged_handle ranged_h, mkavl_find_type_e type,
+                   size_t key_idx, const void *lookup_item, void **found_item)
+{
+    mkavl_compare_fn compare_fn;
+    bool is_greater_type;
+    size_t part_idx;
+    int32_t cmp;
+    void *item;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_ranged_is_valid(ranged_h) ||
+        (key_idx >= ranged_h->compare_fn_array_count) ||
+        (type < MKAVL_FIND_TYPE_E_FIRST) || (type >= MKAVL_FIND_TYPE_E_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    is_greater_type = ((MKAVL_FIND_TYPE_E_GT == type) ||
+                       (MKAVL_FIND_TYPE_E_GE == type));
+
+    mkavl_ranged_read_lock(ranged_h);
+
+    if (0 == key_idx) {
+        /*
+         * Every item of a later partition is greater than the lookup item, so
+         * the same lookup there gives its first item, and likewise for earlier
+         * partitions and their last item.
+         */
+        part_idx = mkavl_ranged_route(ranged_h, lookup_item);
+        while (true) {
+            rc = mkavl_find(ranged_h->part_array[part_idx].tree_h, type,
+                            key_idx, lookup_item, found_item);
+            if (mkavl_rc_e_is_notok(rc) || (NULL != *found_item) ||
+                (MKAVL_FIND_TYPE_E_EQUAL == type)) {
+                break;
+            }
+
+            if (is_greater_type) {
+                if (++part_idx == ranged_h->part_cnt) {
+                    break;
+                }
+            } else {
+                if (0 == part_idx--) {
+                    break;
+                }
+            }
+        }
+        goto exit;
+    }
+
+    compare_fn = ranged_h->compare_fn_array[key_idx];
+    for (part_idx = 0; part_idx < ranged_h->part_cnt; ++part_idx) {
+        rc = mkavl_find(ranged_h->part_array[part_idx].tree_h, type, key_idx,
+                        lookup_item, &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            break;
+        }
+
+        if (NULL == item) {
+            continue;
+        }
+
+        if (NULL != *found_item) {
+            cmp = compare_fn(item, *found_item, ranged_h->context);
+            if ((is_greater_type && (cmp >= 0)) ||
+                (!is_greater_type && (cmp <= 0))) {
+                continue;
+            }
+        }
+        *found_item = item;
+
+        if (MKAVL_FIND_TYPE_E_EQUAL == type) {
+            break;
+        }
+    }
+
+exit:
+
+    mkavl_ranged_unlock(ranged_h);
+
+    if (mkavl_rc_e_is_notok(rc)) {
+        *found_item = NULL;
+    }
+
+    return (rc);
+}
+
+/**
+ * Walk callback that passes each item on to the callback of the client and
+ * notes whether it stopped the walk.
+ *
+ * @param item The current item.
+ * @param tree_context The context for the tree.
+ * @param walk_context The mkavl_ranged_walk_st of the walk.
+ * @param stop_walk Set by the callback of the client.
+ * @return The return code of the callback of the client.
+ */
+static mkavl_rc_e
+mkavl_ranged_walk_cb (void *item, void *tree_context, void *walk_context,
+                      bool *stop_walk)
+{
+    mkavl_ranged_walk_st *walk = walk_context;
+    mkavl_rc_e rc;
+
+    rc = walk->cb_fn(item, tree_context, walk->walk_context, stop_walk);
+    walk->stopped = *stop_walk;
+
+    return (rc);
+}
+
+/**
+ * Walk the items whose primary keys lie between two bounds, in ascending or
+ * descending order, as with mkavl_find_range().  Only the partitions whose
+ * intervals overlap the range are visited, each with a single range walk, so
+ * this is O(P lg N + K) for P partitions visited and K items walked.  The
+ * routing table and each partition in turn are held during the walk, so the
+ * callback must not change the tree.
+ *
+ * @see mkavl_find_range
+ * @param ranged_h The tree to search.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param descending If true, the walk goes from the upper bound to the lower
+ * bound.
+ * @param cb_fn The callback function to apply to each item in the range.  The
+ * walk stops early if it sets stop_walk or returns an error.
+ * @param walk_context The opaque walk context passed to the callback.
+ * @return The return code.  An error from the callback is returned as is.
+ */
+mkavl_rc_e
+mkavl_ranged_find_range (mkavl_ranged_handle ranged_h,
+                         const void *lo_item, bool lo_inclusive,
+                         const void *hi_item, bool hi_inclusive,
+                         bool descending, mkavl_walk_cb_fn cb_fn,
+                         void *walk_context)
+{
+    mkavl_ranged_walk_st walk;
+    size_t lo_idx, hi_idx, part_idx;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if (NULL == cb_fn) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (!mkavl_ranged_is_valid(ranged_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    walk.cb_fn = cb_fn;
+    walk.walk_context = walk_context;
+    walk.stopped = false;
+
+    mkavl_ranged_read_lock(ranged_h);
+
+    lo_idx = (NULL == lo_item) ? 0 : mkavl_ranged_route(ranged_h, lo_item);
+    hi_idx = (NULL == hi_item) ? (ranged_h->part_cnt - 1) :
+                                 mkavl_ranged_route(ranged_h, hi_item);
+
+    /* An empty range may have its bounds in the wrong order */
+    for (part_idx = (descending ? hi_idx : lo_idx);
+         (lo_idx <= part_idx) && (part_idx <= hi_idx);
+         part_idx = (descending ? (part_idx - 1) : (part_idx + 1))) {
+        rc = mkavl_find_range(ranged_h->part_array[part_idx].tree_h, 0,
+                              lo_item, lo_inclusive, hi_item, hi_inclusive,
+                              descending, mkavl_ranged_walk_cb, &walk);
+        if (mkavl_rc_e_is_notok(rc) || walk.stopped ||
+            (descending && (0 == part_idx))) {
+            break;
+        }
+    }
+
+    mkavl_ranged_unlock(ranged_h);
+
+    return (rc);
+}
+
+/**
+ * Get the number of items in all the partitions.
+ *
+ * @param ranged_h The tree.
+ * @return The number of items.
+ */
+uint32_t
+mkavl_ranged_count (mkavl_ranged_handle ranged_h)
+{
+    uint32_t count = 0;
+    size_t i;
+
+    if (!mkavl_ranged_is_valid(ranged_h)) {
+        return (0);
+    }
+
+    mkavl_ranged_read_lock(ranged_h);
+    for (i = 0; i < ranged_h->part_cnt; ++i) {
+        count += mkavl_count(ranged_h->part_array[i].tree_h);
+    }
+    mkavl_ranged_unlock(ranged_h);
+
+    return (count);
+}
+
+/**
+ * Get the number of partitions of the tree.
+ *
+ * @param ranged_h The tree.
+ * @return The number of partitions.
+ */
+size_t
+mkavl_ranged_partition_count (mkavl_ranged_handle ranged_h)
+{
+    size_t part_cnt;
+
+    if (!mkavl_ranged_is_valid(ranged_h)) {
+        return (0);
+    }
+
+    mkavl_ranged_read_lock(ranged_h);
+    part_cnt = ranged_h->part_cnt;
+    mkavl_ranged_unlock(ranged_h);
+
+    return (part_cnt);
+}
+
+/**
+ * Create an iterator over a ranged tree in the order of the primary key.  The
+ * iterator shares the routing table for each call only, so the tree may be
+ * changed between calls, even by the thread holding the iterator.  The current
+ * item must not be freed while the iterator is at it.
+ *
+ * @see mkavl_iter_new
+ * @param iterator_h The pointer to fill in with the new iterator.
+ * @param ranged_h The tree on which to iterate.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_new (mkavl_ranged_iterator_handle *iterator_h,
+                       mkavl_ranged_handle ranged_h)
+{
+    mkavl_ranged_iterator_handle local_iter_h;
+
+    if ((NULL == iterator_h) || !mkavl_ranged_is_valid(ranged_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *iterator_h = NULL;
+
+    local_iter_h = ranged_h->allocator.malloc_fn(sizeof(*local_iter_h),
+                                                 ranged_h->context);
+    if (NULL == local_iter_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    local_iter_h->magic = MKAVL_CTX_MAGIC;
+    local_iter_h->ranged_h = ranged_h;
+    local_iter_h->cur_item = NULL;
+
+    *iterator_h = local_iter_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Destroy a ranged iterator.
+ *
+ * @see mkavl_ranged_iter_new
+ * @param iterator_h The iterator to free.  Upon return, this will be set to
+ * NULL.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_delete (mkavl_ranged_iterator_handle *iterator_h)
+{
+    mkavl_ranged_iterator_handle local_iter_h;
+    mkavl_ranged_handle ranged_h;
+
+    if ((NULL == iterator_h) ||
+        !mkavl_ranged_iterator_is_valid(*iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_iter_h = *iterator_h;
+    ranged_h = local_iter_h->ranged_h;
+
+    local_iter_h->magic = MKAVL_CTX_STALE;
+    ranged_h->allocator.free_fn(local_iter_h, ranged_h->context);
+    *iterator_h = NULL;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Look an item up in one partition.  Without a lookup item, this gets the
+ * first item of the partition for a lookup of greater items and the last item
+ * for a lookup of lesser items, by position so that nothing is allocated.  The
+ * routing table must be shared.
+ *
+ * @param ranged_h The tree.
+ * @param part_idx The index of the partition.
+ * @param type The type of lookup.
+ * @param lookup_item The item to use as the lookup target, or NULL.
+ * @param item Set to the item found, NULL if there is none.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_ranged_part_find (mkavl_ranged_handle ranged_h, size_t part_idx,
+                        mkavl_find_type_e type, const void *lookup_item,
+                        void **item)
+{
+    mkavl_tree_handle tree_h = ranged_h->part_array[part_idx].tree_h;
+    bool forward;
+    uint32_t cnt;
+    mkavl_rc_e rc;
+
+    if (NULL != lookup_item) {
+        return (mkavl_find(tree_h, type, 0, lookup_item, item));
+    }
+
+    forward = ((MKAVL_FIND_TYPE_E_GT == type) ||
+               (MKAVL_FIND_TYPE_E_GE == type));
+    do {
+        /* The partition may shrink between the count and the select */
+        *item = NULL;
+        cnt = mkavl_count(tree_h);
+        if (0 == cnt) {
+            return (MKAVL_RC_E_SUCCESS);
+        }
+        rc = mkavl_select(tree_h, 0, (forward ? 0 : (cnt - 1)), item);
+    } while (mkavl_rc_e_is_ok(rc) && (NULL == *item));
+
+    return (rc);
+}
+
+/**
+ * Move the iterator to the item of a lookup, which may be in a later partition
+ * than that of the lookup item for a lookup of greater items or an earlier one
+ * for a lookup of lesser items.  If no item is found, the iterator is left at
+ * the null item.
+ *
+ * @param iterator_h The iterator.
+ * @param type The type of lookup.
+ * @param lookup_item The item to use as the lookup target, or NULL to start from
+ * the first or last item.
+ * @param item Set to the item found, NULL if there is none.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_ranged_iter_move (mkavl_ranged_iterator_handle iterator_h,
+                        mkavl_find_type_e type, const void *lookup_item,
+                        void **item)
+{
+    mkavl_ranged_handle ranged_h = iterator_h->ranged_h;
+    size_t part_idx;
+    bool forward;
+    mkavl_rc_e rc;
+
+    *item = NULL;
+    forward = ((MKAVL_FIND_TYPE_E_GT == type) ||
+               (MKAVL_FIND_TYPE_E_GE == type));
+
+    mkavl_ranged_read_lock(ranged_h);
+
+    if (NULL != lookup_item) {
+        part_idx = mkavl_ranged_route(ranged_h, lookup_item);
+    } else {
+        part_idx = forward ? 0 : (ranged_h->part_cnt - 1);
+    }
+
+    rc = mkavl_ranged_part_find(ranged_h, part_idx, type, lookup_item, item);
+    if (MKAVL_FIND_TYPE_E_EQUAL != type) {
+        /* Every item of the neighboring partitions lies beyond the lookup */
+        while (mkavl_rc_e_is_ok(rc) && (NULL == *item)) {
+            if (forward ? ((part_idx + 1) == ranged_h->part_cnt) :
+                          (0 == part_idx)) {
+                break;
+            }
+            part_idx = forward ? (part_idx + 1) : (part_idx - 1);
+            rc = mkavl_ranged_part_find(ranged_h, part_idx, type, NULL, item);
+        }
+    }
+
+    mkavl_ranged_unlock(ranged_h);
+
+    if (mkavl_rc_e_is_notok(rc)) {
+        *item = NULL;
+    }
+    iterator_h->cur_item = *item;
+
+    return (rc);
+}
+
+/**
+ * Get the first item in the iteration.
+ *
+ * @see mkavl_iter_first
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_first (mkavl_ranged_iterator_handle iterator_h, void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_ranged_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_ranged_iter_move(iterator_h, MKAVL_FIND_TYPE_E_GT, NULL,
+                                   item));
+}
+
+/**
+ * Get the last item in the iteration.
+ *
+ * @see mkavl_iter_last
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_last (mkavl_ranged_iterator_handle iterator_h, void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_ranged_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_ranged_iter_move(iterator_h, MKAVL_FIND_TYPE_E_LT, NULL,
+                                   item));
+}
+
+/**
+ * Find an item by any type of lookup and update the iterator to that item, as
+ * with mkavl_iter_seek().  If no item is found, the iterator is left at the
+ * null item.
+ *
+ * @see mkavl_iter_seek
+ * @param iterator_h The iterator to use.
+ * @param type The type of lookup to do.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_seek (mkavl_ranged_iterator_handle iterator_h,
+                        mkavl_find_type_e type, const void *lookup_item,
+                        void **found_item)
+{
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_ranged_iterator_is_valid(iterator_h) ||
+        (type < MKAVL_FIND_TYPE_E_FIRST) || (type >= MKAVL_FIND_TYPE_E_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_ranged_iter_move(iterator_h, type, lookup_item, found_item));
+}
+
+/**
+ * Get the next item in the iteration and update the iterator to that item.
+ * From the null item, the next item is the first.
+ *
+ * @see mkavl_iter_next
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_next (mkavl_ranged_iterator_handle iterator_h, void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_ranged_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_ranged_iter_move(iterator_h, MKAVL_FIND_TYPE_E_GT,
+                                   iterator_h->cur_item, item));
+}
+
+/**
+ * Get the previous item in the iteration and update the iterator to that item.
+ * From the null item, the previous item is the last.
+ *
+ * @see mkavl_iter_prev
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_prev (mkavl_ranged_iterator_handle iterator_h, void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_ranged_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_ranged_iter_move(iterator_h, MKAVL_FIND_TYPE_E_LT,
+                                   iterator_h->cur_item, item));
+}
+
+/**
+ * Get the current item in the iteration.
+ *
+ * @see mkavl_iter_cur
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_ranged_iter_cur (mkavl_ranged_iterator_handle iterator_h, void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_ranged_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = iterator_h->cur_item;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
@@ -0,0 +1,145 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the public interface for range-partitioned mkavl trees.  A ranged
+ * tree splits the primary key (key index 0) into contiguous intervals, each
+ * owned by its own thread safe mkavl tree called a partition.  A routing table
+ * of the lower bounds of the partitions sends each operation to its partition,
+ * so writers in different key ranges do not contend on a tree lock, and range
+ * walks and iterators by the primary key only touch the partitions they
+ * overlap.
+ *
+ * A partition that grows past a size threshold is split in two at its median
+ * and one that shrinks below another threshold is merged with a neighbor.
+ * Splits and merges take the routing table exclusively; every other operation
+ * shares it.  As with sharded trees, the keys other than the primary key are
+ * only unique within a partition, and lookups by them search every partition.
+ * Two partitions that hold items equal by a key other than the primary key
+ * cannot be merged, since a single tree cannot hold both items, so the smaller
+ * one is left below the merge threshold.  Keep the other keys unique across
+ * the whole tree for merges to always happen.
+ */
+
+#ifndef __MKAVL_RANGED_H__
+#define __MKAVL_RANGED_H__
+
+#include "mkavl.h"
+
+/** Opaque pointer to reference instances of ranged trees */
+typedef struct mkavl_ranged_st_ *mkavl_ranged_handle;
+
+/** Opaque pointer to reference instances of ranged tree iterators */
+typedef struct mkavl_ranged_iterator_st_ *mkavl_ranged_iterator_handle;
+
+/**
+ * Settings for how a ranged tree is partitioned, given to mkavl_ranged_new().
+ */
+typedef struct mkavl_ranged_opts_st_ {
+    /**
+     * A partition is split in two once it holds more than this many items.
+     * Must be at least 2.
+     */
+    size_t split_cnt;
+    /**
+     * A partition is merged with a neighbor once it holds fewer than this many
+     * items, as long as the merged partition holds no more than split_cnt
+     * items.  Must be less than split_cnt.  Zero never merges.
+     */
+    size_t merge_cnt;
+    /**
+     * Copy the primary key of an item into a new item of its own, which is
+     * kept as the lower bound of a partition after the item itself may be
+     * gone.  Only the fields of the primary key need be set.
+     */
+    mkavl_copy_fn bound_copy_fn;
+    /** Free a bound made by bound_copy_fn */
+    mkavl_item_fn bound_free_fn;
+} mkavl_ranged_opts_st;
+
+/* APIs below are documented in their implementation file */
+
+extern mkavl_rc_e
+mkavl_ranged_new(mkavl_ranged_handle *ranged_h,
+                 const mkavl_ranged_opts_st *ranged_opts,
+                 mkavl_compare_fn *compare_fn_array,
+                 size_t compare_fn_array_count, void *context,
+                 mkavl_allocator_st *allocator, const mkavl_opts_st *opts);
+
+extern mkavl_rc_e
+mkavl_ranged_delete(mkavl_ranged_handle *ranged_h, mkavl_item_fn item_fn,
+                    mkavl_delete_context_fn delete_context_fn);
+
+extern mkavl_rc_e
+mkavl_ranged_add(mkavl_ranged_handle ranged_h, void *item_to_add,
+                 void **existing_item);
+
+extern mkavl_rc_e
+mkavl_ranged_remove(mkavl_ranged_handle ranged_h, const void *item_to_remove,
+                    void **found_item);
+
+extern mkavl_rc_e
+mkavl_ranged_find(mkavl_ranged_handle ranged_h, mkavl_find_type_e type,
+                  size_t key_idx, const void *lookup_item, void **found_item);
+
+extern mkavl_rc_e
+mkavl_ranged_find_range(mkavl_ranged_handle ranged_h,
+                        const void *lo_item, bool lo_inclusive,
+                        const void *hi_item, bool hi_inclusive,
+                        bool descending, mkavl_walk_cb_fn cb_fn,
+                        void *walk_context);
+
+extern uint32_t
+mkavl_ranged_count(mkavl_ranged_handle ranged_h);
+
+extern size_t
+mkavl_ranged_partition_count(mkavl_ranged_handle ranged_h);
+
+/* Ranged tree iterator functions, in the order of the primary key */
+
+extern mkavl_rc_e
+mkavl_ranged_iter_new(mkavl_ranged_iterator_handle *iterator_h,
+                      mkavl_ranged_handle ranged_h);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_delete(mkavl_ranged_iterator_handle *iterator_h);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_first(mkavl_ranged_iterator_handle iterator_h,
+                        void **item);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_last(mkavl_ranged_iterator_handle iterator_h, void **item);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_seek(mkavl_ranged_iterator_handle iterator_h,
+                       mkavl_find_type_e type, const void *lookup_item,
+                       void **found_item);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_next(mkavl_ranged_iterator_handle iterator_h, void **item);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_prev(mkavl_ranged_iterator_handle iterator_h, void **item);
+
+extern mkavl_rc_e
+mkavl_ranged_iter_cur(mkavl_ranged_iterator_handle iterator_h, void **item);
+
+#endif
@@ -0,0 +1,1228 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the implementation for hash-sharded mkavl trees.  Each shard is an
+ * ordinary thread safe mkavl tree, so all the locking is left to the shards.
+ * Anything ordered across the shards is a k-way merge: each shard is looked up
+ * or iterated on its own and the best of the shard results is taken.
+ */
+
+#include "mkavl_sharded.h"
+
+/**
+ * Magic number indicating a pointer is valid for sanity checks.
+ */
+#define MKAVL_CTX_MAGIC 0xCAFEBABE
+
+/**
+ * Magic number indicating a pointer is stale for sanity checks.
+ */
+#define MKAVL_CTX_STALE 0xDEADBEEF
+
+/** The size of a cache line, to keep the change counts of shards apart */
+#define MKAVL_SHARDED_CACHE_LINE_SIZE 64
+
+/**
+ * The count of changes to one shard.  Each is padded to a cache line, so that
+ * the counts of two shards are never on the same line, whatever the alignment
+ * the client allocator gives the array, and writers on different shards do not
+ * share one.
+ */
+typedef struct mkavl_sharded_change_st_ {
+    /** Bumped after each item added to or removed from the shard */
+    uint64_t cnt;
+    /** Padding to the size of a cache line */
+    uint8_t pad[MKAVL_SHARDED_CACHE_LINE_SIZE - sizeof(uint64_t)];
+} mkavl_sharded_change_st;
+
+/**
+ * A tree whose items are spread over several mkavl trees by the hash of their
+ * primary key.
+ */
+typedef struct mkavl_sharded_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The shards, each an mkavl tree with all the keys */
+    mkavl_tree_handle *shard_array;
+    /** The number of shards */
+    size_t shard_cnt;
+    /** The count of changes to each shard */
+    mkavl_sharded_change_st *change_array;
+    /** The hash of the primary key that picks the shard of an item */
+    mkavl_hash_fn hash_fn;
+    /** The comparison functions, used to merge the shards */
+    mkavl_compare_fn *compare_fn_array;
+    /** The number of comparison functions */
+    size_t compare_fn_array_count;
+    /** The client context given to mkavl_sharded_new() */
+    void *context;
+    /** The allocator for the memory of the sharded tree itself */
+    mkavl_allocator_st allocator;
+} mkavl_sharded_st;
+
+/**
+ * An iterator over a sharded tree.  It holds an iterator for each shard, each
+ * of which takes the lock of its shard for a call only.  While moving in one
+ * direction, the head of each shard is the item the shard would give next in
+ * that direction, and each step takes the best head and advances only the
+ * shard it came from.  A shard changed since its head was found is looked up
+ * again from the current item, as are all the shards when the direction
+ * changes.
+ */
+typedef struct mkavl_sharded_iterator_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The tree being iterated */
+    mkavl_sharded_handle sharded_h;
+    /** The key of the iteration */
+    size_t key_idx;
+    /** The iterator for each shard */
+    mkavl_iterator_handle *iter_array;
+    /** The head item of each shard, NULL if the shard has none */
+    void **head_array;
+    /** The change count of each shard when its head was found */
+    uint64_t *change_array;
+    /**
+     * MKAVL_FIND_TYPE_E_GT if the heads are the next item of each shard,
+     * MKAVL_FIND_TYPE_E_LT if they are the previous one, or
+     * MKAVL_FIND_TYPE_E_INVALID if they are not set
+     */
+    mkavl_find_type_e head_type;
+    /** The shard of the current item */
+    size_t cur_idx;
+    /** The current item, NULL at the null item */
+    void *cur_item;
+} mkavl_sharded_iterator_st;
+
+/**
+ * The default malloc function.
+ *
+ * @param size Size of memory to allocate.
+ * @param context The tree context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_sharded_default_malloc_fn (size_t size, void *context)
+{
+    return (malloc(size));
+}
+
+/**
+ * The default free function.
+ *
+ * @param ptr The memory to free.
+ * @param context The tree context.
+ */
+static void
+mkavl_sharded_default_free_fn (void *ptr, void *context)
+{
+    return (free(ptr));
+}
+
+/**
+ * By default, we'll just use malloc and free if the client passes nothing in.
+ */
+static mkavl_allocator_st mkavl_sharded_allocator_default = {
+    mkavl_sharded_default_malloc_fn,
+    mkavl_sharded_default_free_fn
+};
+
+/**
+ * Verify the sharded tree is valid.
+ *
+ * @param sharded_h The tree to check.
+ * @return true if the tree is valid.
+ */
+static bool
+mkavl_sharded_is_valid (mkavl_sharded_handle sharded_h)
+{
+    return ((NULL != sharded_h) && (MKAVL_CTX_MAGIC == sharded_h->magic) &&
+            (NULL != sharded_h->shard_array) && (0 != sharded_h->shard_cnt));
+}
+
+/**
+ * Verify the sharded iterator is valid.
+ *
+ * @param iterator_h The iterator to check.
+ * @return true if the iterator is valid.
+ */
+static bool
+mkavl_sharded_iterator_is_valid (mkavl_sharded_iterator_handle iterator_h)
+{
+    return ((NULL != iterator_h) && (MKAVL_CTX_MAGIC == iterator_h->magic) &&
+            mkavl_sharded_is_valid(iterator_h->sharded_h));
+}
+
+/**
+ * Get the index of the shard that holds an item.
+ *
+ * @param sharded_h The sharded tree.
+ * @param item The item, or lookup item, whose primary key picks the shard.
+ * @return The index of the shard of the item.
+ */
+static size_t
+mkavl_sharded_pick_idx (mkavl_sharded_handle sharded_h, const void *item)
+{
+    uint64_t hash;
+
+    hash = sharded_h->hash_fn(item, sharded_h->context);
+
+    return (hash % sharded_h->shard_cnt);
+}
+
+/**
+ * Get the shard that holds an item.
+ *
+ * @param sharded_h The sharded tree.
+ * @param item The item, or lookup item, whose primary key picks the shard.
+ * @return The shard of the item.
+ */
+static mkavl_tree_handle
+mkavl_sharded_pick (mkavl_sharded_handle sharded_h, const void *item)
+{
+    return (sharded_h->shard_array[mkavl_sharded_pick_idx(sharded_h, item)]);
+}
+
+/**
+ * Note a change to a shard, so that iterators look up its head again.
+ *
+ * @param sharded_h The sharded tree.
+ * @param shard_idx The index of the shard changed.
+ */
+static inline void
+mkavl_sharded_note_change (mkavl_sharded_handle sharded_h, size_t shard_idx)
+{
+    __atomic_add_fetch(&(sharded_h->change_array[shard_idx].cnt), 1,
+                       __ATOMIC_RELEASE);
+}
+
+/**
+ * Check whether an item found in one shard is a better result than the best
+ * found so far for a lookup of the given type.  Items greater than the lookup
+ * are better the smaller they are, and items less than the lookup are better
+ * the larger they are.
+ *
+ * @param sharded_h The sharded tree.
+ * @param key_idx The key of the lookup.
+ * @param type The type of lookup.
+ * @param item The item found in a shard.
+ * @param best_item The best item so far, or NULL if there is none.
+ * @return true if item is better than best_item.
+ */
+static bool
+mkavl_sharded_is_better (mkavl_sharded_handle sharded_h, size_t key_idx,
+                         mkavl_find_type_e type, const void *item,
+                         const void *best_item)
+{
+    int32_t cmp;
+
+    if (NULL == best_item) {
+        return (true);
+    }
+
+    cmp = sharded_h->compare_fn_array[key_idx](item, best_item,
+                                               sharded_h->context);
+    switch (type) {
+    case MKAVL_FIND_TYPE_E_GT:
+    case MKAVL_FIND_TYPE_E_GE:
+        return (cmp < 0);
+    case MKAVL_FIND_TYPE_E_LT:
+    case MKAVL_FIND_TYPE_E_LE:
+        return (cmp > 0);
+    default:
+        break;
+    }
+
+    return (false);
+}
+
+/**
+ * Create a new sharded tree.  Each shard is created with mkavl_new_opts() from
+ * the given arguments, except that the shards are always thread safe and keep
+ * their nodes in pools of their own, so that writers on different shards share
+ * neither a lock nor an allocator.  Persistent shards allocate their nodes from
+ * the client allocator since the nodes may be shared.
+ *
+ * @see mkavl_sharded_delete
+ * @see mkavl_new_opts
+ * @param sharded_h A pointer to the memory location for the new tree.
+ * @param shard_cnt The number of shards, at least one.  More shards let more
+ * writers run at once but make each merged lookup visit more shards.
+ * @param hash_fn The hash of the primary key that picks the shard of an item.
+ * @param compare_fn_array An array of size compare_fn_array_count of the
+ * comparison functions for the tree.  Index 0 is the primary key.
+ * @param compare_fn_array_count The size of the compare_fn_array.
+ * @param context An opaque context passed back to the client in callbacks.
+ * @param allocator The memory allocation functions to use for the tree, or NULL
+ * if the default functions are to be used.
+ * @param opts The options for the shards, or NULL for the defaults.
+ * @return The return value
+ */
+mkavl_rc_e
+mkavl_sharded_new (mkavl_sharded_handle *sharded_h, size_t shard_cnt,
+                   mkavl_hash_fn hash_fn, mkavl_compare_fn *compare_fn_array,
+                   size_t compare_fn_array_count, void *context,
+                   mkavl_allocator_st *allocator, const mkavl_opts_st *opts)
+{
+    mkavl_allocator_st *local_allocator;
+    mkavl_sharded_handle local_sharded_h;
+    mkavl_opts_st shard_opts = {0};
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
+    size_t i;
+
+    if ((NULL == sharded_h) || (0 == shard_cnt) || (NULL == hash_fn) ||
+        (NULL == compare_fn_array) || (0 == compare_fn_array_count)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *sharded_h = NULL;
+
+    local_allocator =
+        (NULL == allocator) ? &mkavl_sharded_allocator_default : allocator;
+
+    local_sharded_h = local_allocator->malloc_fn(sizeof(*local_sharded_h),
+                                                 context);
+    if (NULL == local_sharded_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(local_sharded_h, 0, sizeof(*local_sharded_h));
+    local_sharded_h->magic = MKAVL_CTX_MAGIC;
+    local_sharded_h->hash_fn = hash_fn;
+    local_sharded_h->compare_fn_array_count = compare_fn_array_count;
+    local_sharded_h->context = context;
+    memcpy(&(local_sharded_h->allocator), local_allocator,
+           sizeof(local_sharded_h->allocator));
+
+    local_sharded_h->compare_fn_array =
+        local_allocator->malloc_fn((compare_fn_array_count *
+                                    sizeof(*compare_fn_array)), context);
+    if (NULL == local_sharded_h->compare_fn_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    memcpy(local_sharded_h->compare_fn_array, compare_fn_array,
+           (compare_fn_array_count * sizeof(*compare_fn_array)));
+
+    local_sharded_h->shard_array =
+        local_allocator->malloc_fn((shard_cnt *
+                                    sizeof(*(local_sharded_h->shard_array))),
+                                   context);
+    if (NULL == local_sharded_h->shard_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    memset(local_sharded_h->shard_array, 0,
+           (shard_cnt * sizeof(*(local_sharded_h->shard_array))));
+    local_sharded_h->shard_cnt = shard_cnt;
+
+    local_sharded_h->change_array =
+        local_allocator->malloc_fn((shard_cnt *
+                                    sizeof(*(local_sharded_h->change_array))),
+                                   context);
+    if (NULL == local_sharded_h->change_array) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    memset(local_sharded_h->change_array, 0,
+           (shard_cnt * sizeof(*(local_sharded_h->change_array))));
+
+    if (NULL != opts) {
+        memcpy(&shard_opts, opts, sizeof(shard_opts));
+    }
+    shard_opts.thread_safe = true;
+    /* The nodes of persistent shards may be shared, so they are not pooled */
+    shard_opts.pooled_nodes = !shard_opts.persistent;
+
+    for (i = 0; i < shard_cnt; ++i) {
+        rc = mkavl_new_opts(&(local_sharded_h->shard_array[i]),
+                            compare_fn_array, compare_fn_array_count, context,
+                            allocator, &shard_opts);
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto err_exit;
+        }
+    }
+
+    *sharded_h = local_sharded_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+
+err_exit:
+
+    err_rc = mkavl_sharded_delete(&local_sharded_h, NULL, NULL);
+    if (mkavl_rc_e_is_notok(err_rc)) {
+        abort();
+    }
+
+    return (rc);
+}
+
+/**
+ * Destroy a sharded tree created by mkavl_sharded_new(), as mkavl_delete() does
+ * for a tree.  Upon return, the sharded_h memory is set to NULL.  No other
+ * thread may be using the tree.
+ *
+ * @see mkavl_sharded_new
+ * @see mkavl_delete
+ * @param sharded_h A pointer the the tree to free.
+ * @param item_fn This function is applied once to each item of every shard.  If
+ * NULL, no function is applied.
+ * @param delete_context_fn This function is applied once to the client context
+ * after all the shards have been deleted.  If NULL, no function is applied.
+ * @return The return code.  If deleting a shard fails, the other shards are
+ * still deleted and the first error is returned.
+ */
+mkavl_rc_e
+mkavl_sharded_delete (mkavl_sharded_handle *sharded_h, mkavl_item_fn item_fn,
+                      mkavl_delete_context_fn delete_context_fn)
+{
+    mkavl_sharded_handle local_sharded_h;
+    mkavl_free_fn free_fn;
+    void *context;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
+    size_t i;
+
+    if ((NULL == sharded_h) || (NULL == *sharded_h) ||
+        (MKAVL_CTX_MAGIC != (*sharded_h)->magic)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_sharded_h = *sharded_h;
+    context = local_sharded_h->context;
+    free_fn = local_sharded_h->allocator.free_fn;
+
+    if (NULL != local_sharded_h->shard_array) {
+        for (i = 0; i < local_sharded_h->shard_cnt; ++i) {
+            if (NULL == local_sharded_h->shard_array[i]) {
+                continue;
+            }
+            err_rc = mkavl_delete(&(local_sharded_h->shard_array[i]), item_fn,
+                                  NULL);
+            if (mkavl_rc_e_is_notok(err_rc) && mkavl_rc_e_is_ok(rc)) {
+                rc = err_rc;
+            }
+        }
+        free_fn(local_sharded_h->shard_array, context);
+    }
+
+    if (NULL != local_sharded_h->change_array) {
+        free_fn(local_sharded_h->change_array, context);
+    }
+
+    if (NULL != local_sharded_h->compare_fn_array) {
+        free_fn(local_sharded_h->compare_fn_array, context);
+    }
+
+    if (NULL != delete_context_fn) {
+        err_rc = delete_context_fn(context);
+        if (mkavl_rc_e_is_notok(err_rc) && mkavl_rc_e_is_ok(rc)) {
+            rc = err_rc;
+        }
+    }
+
+    local_sharded_h->magic = MKAVL_CTX_STALE;
+    free_fn(local_sharded_h, context);
+    *sharded_h = NULL;
+
+    return (rc);
+}
+
+/**
+ * Add an item to the shard picked by its primary key, as with mkavl_add().
+ * Only the shard of the item is locked, so adds to different shards run at
+ * once.
+ *
+ * @see mkavl_add
+ * @param sharded_h The tree to add to.
+ * @param item_to_add The item to add.
+ * @param existing_item Set to the item already in the shard that is equal to
+ * item_to_add for some key, if any, in which case item_to_add is not added.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_add (mkavl_sharded_handle sharded_h, void *item_to_add,
+                   void **existing_item)
+{
+    size_t shard_idx;
+    mkavl_rc_e rc;
+
+    if ((NULL == item_to_add) || (NULL == existing_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *existing_item = NULL;
+
+    if (!mkavl_sharded_is_valid(sharded_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    shard_idx = mkavl_sharded_pick_idx(sharded_h, item_to_add);
+    rc = mkavl_add(sharded_h->shard_array[shard_idx], item_to_add,
+                   existing_item);
+    if (NULL == *existing_item) {
+        mkavl_sharded_note_change(sharded_h, shard_idx);
+    }
+
+    return (rc);
+}
+
+/**
+ * Remove an item from the shard picked by its primary key, as with
+ * mkavl_remove().
+ *
+ * @see mkavl_remove
+ * @param sharded_h The tree to remove from.
+ * @param item_to_remove The item to remove, or an item equal to it by the
+ * primary key.
+ * @param found_item Set to the item removed, NULL if there was none.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_remove (mkavl_sharded_handle sharded_h,
+                      const void *item_to_remove, void **found_item)
+{
+    size_t shard_idx;
+    mkavl_rc_e rc;
+
+    if ((NULL == item_to_remove) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_sharded_is_valid(sharded_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    shard_idx = mkavl_sharded_pick_idx(sharded_h, item_to_remove);
+    rc = mkavl_remove(sharded_h->shard_array[shard_idx], item_to_remove,
+                      found_item);
+    if (NULL != *found_item) {
+        mkavl_sharded_note_change(sharded_h, shard_idx);
+    }
+
+    return (rc);
+}
+
+/**
+ * Free an item removed from the tree once no reader of its shard can still see
+ * it, as with mkavl_retire().
+ *
+ * @see mkavl_retire
+ * @param sharded_h The tree the item was removed from.
+ * @param item The item removed.
+ * @param item_fn The function that frees the item.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_retire (mkavl_sharded_handle sharded_h, void *item,
+                      mkavl_item_fn item_fn)
+{
+    if (!mkavl_sharded_is_valid(sharded_h) || (NULL == item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_retire(mkavl_sharded_pick(sharded_h, item), item, item_fn));
+}
+
+/**
+ * Find an item, as with mkavl_find().  An equal lookup by the primary key only
+ * searches the shard of the lookup item.  Any other lookup searches every
+ * shard and takes the nearest of the items found.
+ *
+ * @see mkavl_find
+ * @param sharded_h The tree to search.
+ * @param type The type of lookup to do.
+ * @param key_idx The key to search by.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found for the lookup.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_find (mkavl_sharded_handle sharded_h, mkavl_find_type_e type,
+                    size_t key_idx, const void *lookup_item,
+                    void **found_item)
+{
+    void *item;
+    mkavl_rc_e rc;
+    size_t i;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_sharded_is_valid(sharded_h) ||
+        (key_idx >= sharded_h->compare_fn_array_count) ||
+        (type < MKAVL_FIND_TYPE_E_FIRST) || (type >= MKAVL_FIND_TYPE_E_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if ((0 == key_idx) && (MKAVL_FIND_TYPE_E_EQUAL == type)) {
+        return (mkavl_find(mkavl_sharded_pick(sharded_h, lookup_item), type,
+                           key_idx, lookup_item, found_item));
+    }
+
+    for (i = 0; i < sharded_h->shard_cnt; ++i) {
+        rc = mkavl_find(sharded_h->shard_array[i], type, key_idx, lookup_item,
+                        &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            *found_item = NULL;
+            return (rc);
+        }
+
+        if ((NULL != item) &&
+            mkavl_sharded_is_better(sharded_h, key_idx, type, item,
+                                    *found_item)) {
+            *found_item = item;
+            if (MKAVL_FIND_TYPE_E_EQUAL == type) {
+                break;
+            }
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Walk the items of one key that lie between two bounds, in ascending or
+ * descending order, as with mkavl_find_range().  The shards are merged in key
+ * order, so this is O(S lg N + K (S + lg N)) for K items walked from S shards,
+ * plus a lookup for each shard changed during the walk.  No shard is locked
+ * while the callback runs, so it may change the tree, and items another thread
+ * adds or removes during the walk may or may not be seen.
+ *
+ * @see mkavl_find_range
+ * @param sharded_h The tree to search.
+ * @param key_idx The key to walk.
+ * @param lo_item The lower bound of the range, or NULL if the range has no
+ * lower bound.
+ * @param lo_inclusive If true, items equal to lo_item are in the range.
+ * @param hi_item The upper bound of the range, or NULL if the range has no
+ * upper bound.
+ * @param hi_inclusive If true, items equal to hi_item are in the range.
+ * @param descending If true, the walk goes from the upper bound to the lower
+ * bound.
+ * @param cb_fn The callback function to apply to each item in the range.  The
+ * walk stops early if it sets stop_walk or returns an error.
+ * @param walk_context The opaque walk context passed to the callback.
+ * @return The return code.  An error from the callback is returned as is.
+ */
+mkavl_rc_e
+mkavl_sharded_find_range (mkavl_sharded_handle sharded_h, size_t key_idx,
+                          const void *lo_item, bool lo_inclusive,
+                          const void *hi_item, bool hi_inclusive,
+                          bool descending, mkavl_walk_cb_fn cb_fn,
+                          void *walk_context)
+{
+    mkavl_sharded_iterator_handle iter_h;
+    mkavl_compare_fn compare_fn;
+    mkavl_find_type_e start_type;
+    const void *start_item, *end_item;
+    bool end_inclusive, stop_walk = false;
+    int32_t cmp;
+    void *item;
+    mkavl_rc_e rc, err_rc;
+
+    if (NULL == cb_fn) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    rc = mkavl_sharded_iter_new(&iter_h, sharded_h, key_idx);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+    compare_fn = sharded_h->compare_fn_array[key_idx];
+
+    start_item = descending ? hi_item : lo_item;
+    end_item = descending ? lo_item : hi_item;
+    end_inclusive = descending ? lo_inclusive : hi_inclusive;
+
+    if (NULL == start_item) {
+        rc = descending ? mkavl_sharded_iter_last(iter_h, &item) :
+                          mkavl_sharded_iter_first(iter_h, &item);
+    } else {
+        if (descending) {
+            start_type = hi_inclusive ? MKAVL_FIND_TYPE_E_LE :
+                                        MKAVL_FIND_TYPE_E_LT;
+        } else {
+            start_type = lo_inclusive ? MKAVL_FIND_TYPE_E_GE :
+                                        MKAVL_FIND_TYPE_E_GT;
+        }
+        rc = mkavl_sharded_iter_seek(iter_h, start_type, start_item, &item);
+    }
+
+    while (mkavl_rc_e_is_ok(rc) && (NULL != item) && !stop_walk) {
+        if (NULL != end_item) {
+            cmp = compare_fn(item, end_item, sharded_h->context);
+            if (descending) {
+                cmp = -cmp;
+            }
+            if ((cmp > 0) || ((0 == cmp) && !end_inclusive)) {
+                break;
+            }
+        }
+
+        rc = cb_fn(item, sharded_h->context, walk_context, &stop_walk);
+        if (mkavl_rc_e_is_notok(rc) || stop_walk) {
+            break;
+        }
+        rc = descending ? mkavl_sharded_iter_prev(iter_h, &item) :
+                          mkavl_sharded_iter_next(iter_h, &item);
+    }
+
+    err_rc = mkavl_sharded_iter_delete(&iter_h);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = err_rc;
+    }
+
+    return (rc);
+}
+
+/**
+ * Get the number of items in all the shards.
+ *
+ * @param sharded_h The tree.
+ * @return The number of items.
+ */
+uint32_t
+mkavl_sharded_count (mkavl_sharded_handle sharded_h)
+{
+    uint32_t count = 0;
+    size_t i;
+
+    if (!mkavl_sharded_is_valid(sharded_h)) {
+        return (0);
+    }
+
+    for (i = 0; i < sharded_h->shard_cnt; ++i) {
+        count += mkavl_count(sharded_h->shard_array[i]);
+    }
+
+    return (count);
+}
+
+/**
+ * Get the number of shards of the tree.
+ *
+ * @param sharded_h The tree.
+ * @return The number of shards.
+ */
+size_t
+mkavl_sharded_shard_count (mkavl_sharded_handle sharded_h)
+{
+    if (!mkavl_sharded_is_valid(sharded_h)) {
+        return (0);
+    }
+
+    return (sharded_h->shard_cnt);
+}
+
+/**
+ * Get one shard of the tree, e.g., to look at it on its own.  Items must only
+ * be added to or removed from a shard via the sharded tree, so that each item
+ * stays in the shard its primary key picks and sharded iterators see the change.
+ *
+ * @param sharded_h The tree.
+ * @param shard_idx The index of the shard.
+ * @return The shard, or NULL if the index is out of range.
+ */
+mkavl_tree_handle
+mkavl_sharded_get_shard (mkavl_sharded_handle sharded_h, size_t shard_idx)
+{
+    if (!mkavl_sharded_is_valid(sharded_h) ||
+        (shard_idx >= sharded_h->shard_cnt)) {
+        return (NULL);
+    }
+
+    return (sharded_h->shard_array[shard_idx]);
+}
+
+/**
+ * Create an iterator over one key of a sharded tree.  This creates an iterator
+ * on every shard.  No shard is locked between calls.  A step advances only the
+ * shard the current item came from and looks up again only the shards changed
+ * since, so it is O(S + lg N) for S shards when the tree is not changing.
+ *
+ * @see mkavl_iter_new
+ * @param iterator_h The pointer to fill in with the new iterator.
+ * @param sharded_h The tree on which to iterate.
+ * @param key_idx The key on which to iterate.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_new (mkavl_sharded_iterator_handle *iterator_h,
+                        mkavl_sharded_handle sharded_h, size_t key_idx)
+{
+    mkavl_sharded_iterator_handle local_iter_h;
+    mkavl_malloc_fn malloc_fn;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS, err_rc;
+    size_t i;
+
+    if ((NULL == iterator_h) || !mkavl_sharded_is_valid(sharded_h) ||
+        (key_idx >= sharded_h->compare_fn_array_count)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *iterator_h = NULL;
+    malloc_fn = sharded_h->allocator.malloc_fn;
+
+    local_iter_h = malloc_fn(sizeof(*local_iter_h), sharded_h->context);
+    if (NULL == local_iter_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(local_iter_h, 0, sizeof(*local_iter_h));
+    local_iter_h->magic = MKAVL_CTX_MAGIC;
+    local_iter_h->sharded_h = sharded_h;
+    local_iter_h->key_idx = key_idx;
+    local_iter_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+
+    local_iter_h->iter_array =
+        malloc_fn((sharded_h->shard_cnt *
+                   sizeof(*(local_iter_h->iter_array))), sharded_h->context);
+    local_iter_h->head_array =
+        malloc_fn((sharded_h->shard_cnt *
+                   sizeof(*(local_iter_h->head_array))), sharded_h->context);
+    local_iter_h->change_array =
+        malloc_fn((sharded_h->shard_cnt *
+                   sizeof(*(local_iter_h->change_array))), sharded_h->context);
+    if ((NULL == local_iter_h->iter_array) ||
+        (NULL == local_iter_h->head_array) ||
+        (NULL == local_iter_h->change_array)) {
+        rc = MKAVL_RC_E_ENOMEM;
+        goto err_exit;
+    }
+    memset(local_iter_h->iter_array, 0,
+           (sharded_h->shard_cnt * sizeof(*(local_iter_h->iter_array))));
+
+    for (i = 0; i < sharded_h->shard_cnt; ++i) {
+        rc = mkavl_iter_new(&(local_iter_h->iter_array[i]),
+                            sharded_h->shard_array[i], key_idx);
+        if (mkavl_rc_e_is_notok(rc)) {
+            goto err_exit;
+        }
+    }
+
+    *iterator_h = local_iter_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+
+err_exit:
+
+    err_rc = mkavl_sharded_iter_delete(&local_iter_h);
+    if (mkavl_rc_e_is_notok(err_rc)) {
+        abort();
+    }
+
+    return (rc);
+}
+
+/**
+ * Destroy a sharded iterator.
+ *
+ * @see mkavl_sharded_iter_new
+ * @param iterator_h The iterator to free.  Upon return, this will be set to
+ * NULL.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_delete (mkavl_sharded_iterator_handle *iterator_h)
+{
+    mkavl_sharded_iterator_handle local_iter_h;
+    mkavl_sharded_handle sharded_h;
+    mkavl_free_fn free_fn;
+    size_t i;
+
+    if ((NULL == iterator_h) ||
+        !mkavl_sharded_iterator_is_valid(*iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_iter_h = *iterator_h;
+    sharded_h = local_iter_h->sharded_h;
+    free_fn = sharded_h->allocator.free_fn;
+
+    if (NULL != local_iter_h->iter_array) {
+        for (i = 0; i < sharded_h->shard_cnt; ++i) {
+            if (NULL != local_iter_h->iter_array[i]) {
+                mkavl_iter_delete(&(local_iter_h->iter_array[i]));
+            }
+        }
+        free_fn(local_iter_h->iter_array, sharded_h->context);
+    }
+
+    if (NULL != local_iter_h->head_array) {
+        free_fn(local_iter_h->head_array, sharded_h->context);
+    }
+
+    if (NULL != local_iter_h->change_array) {
+        free_fn(local_iter_h->change_array, sharded_h->context);
+    }
+
+    local_iter_h->magic = MKAVL_CTX_STALE;
+    free_fn(local_iter_h, sharded_h->context);
+    *iterator_h = NULL;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Find the head of every shard for a lookup of the given type, which sets the
+ * direction of the heads.  Any find type other than equal may be used.
+ *
+ * @param iterator_h The iterator.
+ * @param type The type of lookup.
+ * @param lookup_item The item to use as the lookup target, or NULL to start from
+ * the null item, i.e., from the first or last item of each shard.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_sharded_iter_fill (mkavl_sharded_iterator_handle iterator_h,
+                         mkavl_find_type_e type, const void *lookup_item)
+{
+    mkavl_sharded_handle sharded_h = iterator_h->sharded_h;
+    bool is_next;
+    mkavl_rc_e rc;
+    size_t i;
+
+    iterator_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+    is_next = ((MKAVL_FIND_TYPE_E_GT == type) ||
+               (MKAVL_FIND_TYPE_E_GE == type));
+
+    for (i = 0; i < sharded_h->shard_cnt; ++i) {
+        /* The count is read first so that a change during the lookup is seen */
+        iterator_h->change_array[i] =
+            __atomic_load_n(&(sharded_h->change_array[i].cnt),
+                            __ATOMIC_ACQUIRE);
+        if (NULL == lookup_item) {
+            rc = is_next ?
+                mkavl_iter_first(iterator_h->iter_array[i],
+                                 &(iterator_h->head_array[i])) :
+                mkavl_iter_last(iterator_h->iter_array[i],
+                                &(iterator_h->head_array[i]));
+        } else {
+            rc = mkavl_iter_seek(iterator_h->iter_array[i], type, lookup_item,
+                                 &(iterator_h->head_array[i]));
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+    }
+
+    iterator_h->head_type = is_next ? MKAVL_FIND_TYPE_E_GT :
+                                      MKAVL_FIND_TYPE_E_LT;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Move the heads on past the current item in their direction: the shard of the
+ * current item is advanced by one, and any other shard changed since its head
+ * was found is looked up again from the current item.
+ *
+ * @param iterator_h The iterator, whose heads must be set.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_sharded_iter_advance (mkavl_sharded_iterator_handle iterator_h)
+{
+    mkavl_sharded_handle sharded_h = iterator_h->sharded_h;
+    mkavl_find_type_e type = iterator_h->head_type;
+    uint64_t change_cnt;
+    mkavl_rc_e rc;
+    size_t i;
+
+    for (i = 0; i < sharded_h->shard_cnt; ++i) {
+        change_cnt = __atomic_load_n(&(sharded_h->change_array[i].cnt),
+                                     __ATOMIC_ACQUIRE);
+        if (i == iterator_h->cur_idx) {
+            /* The shard iterator finds its place again if it must */
+            rc = (MKAVL_FIND_TYPE_E_GT == type) ?
+                mkavl_iter_next(iterator_h->iter_array[i],
+                                &(iterator_h->head_array[i])) :
+                mkavl_iter_prev(iterator_h->iter_array[i],
+                                &(iterator_h->head_array[i]));
+        } else if (change_cnt != iterator_h->change_array[i]) {
+            rc = mkavl_iter_seek(iterator_h->iter_array[i], type,
+                                 iterator_h->cur_item,
+                                 &(iterator_h->head_array[i]));
+        } else {
+            continue;
+        }
+        iterator_h->change_array[i] = change_cnt;
+        if (mkavl_rc_e_is_notok(rc)) {
+            iterator_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+            return (rc);
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Take the best head as the current item.  If no shard has a head, the
+ * iterator is left at the null item.
+ *
+ * @param iterator_h The iterator, whose heads must be set.
+ * @param item Set to the new current item.
+ */
+static void
+mkavl_sharded_iter_take (mkavl_sharded_iterator_handle iterator_h,
+                         void **item)
+{
+    mkavl_sharded_handle sharded_h = iterator_h->sharded_h;
+    void *best_item = NULL;
+    size_t i;
+
+    for (i = 0; i < sharded_h->shard_cnt; ++i) {
+        if ((NULL != iterator_h->head_array[i]) &&
+            mkavl_sharded_is_better(sharded_h, iterator_h->key_idx,
+                                    iterator_h->head_type,
+                                    iterator_h->head_array[i], best_item)) {
+            best_item = iterator_h->head_array[i];
+            iterator_h->cur_idx = i;
+        }
+    }
+
+    if (NULL == best_item) {
+        /* From the null item, the heads are found again */
+        iterator_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+    }
+    iterator_h->cur_item = best_item;
+    *item = best_item;
+}
+
+/**
+ * Move the iterator one item in the given direction.  From the null item, this
+ * moves to the first or last item.
+ *
+ * @param iterator_h The iterator.
+ * @param type MKAVL_FIND_TYPE_E_GT to move to the next item or
+ * MKAVL_FIND_TYPE_E_LT to move to the previous one.
+ * @param item Set to the new current item.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_sharded_iter_step (mkavl_sharded_iterator_handle iterator_h,
+                         mkavl_find_type_e type, void **item)
+{
+    mkavl_rc_e rc;
+
+    if (type == iterator_h->head_type) {
+        rc = mkavl_sharded_iter_advance(iterator_h);
+    } else {
+        /* The heads for this direction are found from the current item */
+        rc = mkavl_sharded_iter_fill(iterator_h, type, iterator_h->cur_item);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    mkavl_sharded_iter_take(iterator_h, item);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the first item in the iteration.
+ *
+ * @see mkavl_iter_first
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_first (mkavl_sharded_iterator_handle iterator_h,
+                          void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_sharded_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    iterator_h->cur_item = NULL;
+    iterator_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+
+    return (mkavl_sharded_iter_step(iterator_h, MKAVL_FIND_TYPE_E_GT, item));
+}
+
+/**
+ * Get the last item in the iteration.
+ *
+ * @see mkavl_iter_last
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_last (mkavl_sharded_iterator_handle iterator_h,
+                         void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_sharded_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    iterator_h->cur_item = NULL;
+    iterator_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+
+    return (mkavl_sharded_iter_step(iterator_h, MKAVL_FIND_TYPE_E_LT, item));
+}
+
+/**
+ * Find an item by any type of lookup and update the iterator to that item, as
+ * with mkavl_iter_seek().  If no item is found, the iterator is left at the
+ * null item.
+ *
+ * @see mkavl_iter_seek
+ * @param iterator_h The iterator to use.
+ * @param type The type of lookup to do.
+ * @param lookup_item The item to use as the lookup target.
+ * @param found_item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_seek (mkavl_sharded_iterator_handle iterator_h,
+                         mkavl_find_type_e type, const void *lookup_item,
+                         void **found_item)
+{
+    mkavl_tree_handle pick_h;
+    mkavl_rc_e rc;
+    size_t i;
+
+    if ((NULL == lookup_item) || (NULL == found_item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *found_item = NULL;
+
+    if (!mkavl_sharded_iterator_is_valid(iterator_h) ||
+        (type < MKAVL_FIND_TYPE_E_FIRST) || (type >= MKAVL_FIND_TYPE_E_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    iterator_h->cur_item = NULL;
+    iterator_h->head_type = MKAVL_FIND_TYPE_E_INVALID;
+
+    if (MKAVL_FIND_TYPE_E_EQUAL != type) {
+        rc = mkavl_sharded_iter_fill(iterator_h, type, lookup_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        mkavl_sharded_iter_take(iterator_h, found_item);
+
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    /* An equal item is in one shard; the heads are found when moving on */
+    pick_h = mkavl_sharded_pick(iterator_h->sharded_h, lookup_item);
+    for (i = 0; i < iterator_h->sharded_h->shard_cnt; ++i) {
+        if ((0 == iterator_h->key_idx) &&
+            (iterator_h->sharded_h->shard_array[i] != pick_h)) {
+            continue;
+        }
+
+        rc = mkavl_iter_seek(iterator_h->iter_array[i], type, lookup_item,
+                             found_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+
+        if (NULL != *found_item) {
+            break;
+        }
+    }
+    iterator_h->cur_item = *found_item;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the next item in the iteration and update the iterator to that item.
+ * From the null item, the next item is the first.
+ *
+ * @see mkavl_iter_next
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_next (mkavl_sharded_iterator_handle iterator_h,
+                         void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_sharded_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_sharded_iter_step(iterator_h, MKAVL_FIND_TYPE_E_GT, item));
+}
+
+/**
+ * Get the previous item in the iteration and update the iterator to that item.
+ * From the null item, the previous item is the last.
+ *
+ * @see mkavl_iter_prev
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_prev (mkavl_sharded_iterator_handle iterator_h,
+                         void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_sharded_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_sharded_iter_step(iterator_h, MKAVL_FIND_TYPE_E_LT, item));
+}
+
+/**
+ * Get the current item in the iteration.
+ *
+ * @see mkavl_iter_cur
+ * @param iterator_h The iterator to use.
+ * @param item The item found.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_sharded_iter_cur (mkavl_sharded_iterator_handle iterator_h,
+                        void **item)
+{
+    if (NULL == item) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = NULL;
+
+    if (!mkavl_sharded_iterator_is_valid(iterator_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *item = iterator_h->cur_item;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the public interface for hash-sharded mkavl trees.  A sharded tree
+ * spreads its items over several independent thread safe mkavl trees by a hash
+ * of their primary key (key index 0), so that writers working on different
+ * shards do not contend.  Lookups by the primary key go to a single shard while
+ * ordered lookups, range walks and iterators merge the shards in key order.
+ *
+ * Items must be unique by the primary key.  The other keys are only kept
+ * unique within a shard, so they should include the primary key as a tie
+ * breaker (e.g., <tt>&lt;LastName | ID&gt;</tt>) for lookups on them to be
+ * well defined.  An operation that spans the shards visits them one at a time
+ * and does not see them all at a single point in time.
+ */
+
+#ifndef __MKAVL_SHARDED_H__
+#define __MKAVL_SHARDED_H__
+
+#include "mkavl.h"
+
+/** Opaque pointer to reference instances of sharded trees */
+typedef struct mkavl_sharded_st_ *mkavl_sharded_handle;
+
+/** Opaque pointer to reference instances of sharded tree iterators */
+typedef struct mkavl_sharded_iterator_st_ *mkavl_sharded_iterator_handle;
+
+/**
+ * Prototype for hashing the primary key of an item to pick its shard.  Items
+ * that are equal by the primary key must hash to the same value.
+ *
+ * @param item The item, or lookup item, to hash.
+ * @param context The context for the tree.
+ * @return The hash of the primary key of the item.
+ */
+typedef uint64_t
+(*mkavl_hash_fn)(const void *item, void *context);
+
+/* APIs below are documented in their implementation file */
+
+extern mkavl_rc_e
+mkavl_sharded_new(mkavl_sharded_handle *sharded_h, size_t shard_cnt,
+                  mkavl_hash_fn hash_fn, mkavl_compare_fn *compare_fn_array,
+                  size_t compare_fn_array_count, void *context,
+                  mkavl_allocator_st *allocator, const mkavl_opts_st *opts);
+
+extern mkavl_rc_e
+mkavl_sharded_delete(mkavl_sharded_handle *sharded_h, mkavl_item_fn item_fn,
+                     mkavl_delete_context_fn delete_context_fn);
+
+extern mkavl_rc_e
+mkavl_sharded_add(mkavl_sharded_handle sharded_h, void *item_to_add,
+                  void **existing_item);
+
+extern mkavl_rc_e
+mkavl_sharded_remove(mkavl_sharded_handle sharded_h,
+                     const void *item_to_remove, void **found_item);
+
+extern mkavl_rc_e
+mkavl_sharded_retire(mkavl_sharded_handle sharded_h, void *item,
+                     mkavl_item_fn item_fn);
+
+extern mkavl_rc_e
+mkavl_sharded_find(mkavl_sharded_handle sharded_h, mkavl_find_type_e type,
+                   size_t key_idx, const void *lookup_item,
+                   void **found_item);
+
+extern mkavl_rc_e
+mkavl_sharded_find_range(mkavl_sharded_handle sharded_h, size_t key_idx,
+                         const void *lo_item, bool lo_inclusive,
+                         const void *hi_item, bool hi_inclusive,
+                         bool descending, mkavl_walk_cb_fn cb_fn,
+                         void *walk_context);
+
+extern uint32_t
+mkavl_sharded_count(mkavl_sharded_handle sharded_h);
+
+extern size_t
+mkavl_sharded_shard_count(mkavl_sharded_handle sharded_h);
+
+extern mkavl_tree_handle
+mkavl_sharded_get_shard(mkavl_sharded_handle sharded_h, size_t shard_idx);
+
+/* Sharded tree iterator functions */
+
+extern mkavl_rc_e
+mkavl_sharded_iter_new(mkavl_sharded_iterator_handle *iterator_h,
+                       mkavl_sharded_handle sharded_h, size_t key_idx);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_delete(mkavl_sharded_iterator_handle *iterator_h);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_first(mkavl_sharded_iterator_handle iterator_h,
+                         void **item);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_last(mkavl_sharded_iterator_handle iterator_h,
+                        void **item);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_seek(mkavl_sharded_iterator_handle iterator_h,
+                        mkavl_find_type_e type, const void *lookup_item,
+                        void **found_item);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_next(mkavl_sharded_iterator_handle iterator_h,
+                        void **item);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_prev(mkavl_sharded_iterator_handle iterator_h,
+                        void **item);
+
+extern mkavl_rc_e
+mkavl_sharded_iter_cur(mkavl_sharded_iterator_handle iterator_h,
+                       void **item);
+
+#endif
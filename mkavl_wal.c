@@ -0,0 +1,1424 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the implementation for write-ahead logs.  Records are appended to a
+ * buffer under the lock of the log.  A caller that has to wait for its record
+ * and finds no write in progress becomes the leader: it swaps the buffer for
+ * an empty one and writes and syncs it without the lock, so that the records
+ * logged meanwhile gather in the new buffer for the next leader.
+ *
+ * A log file is a header followed by records, all little-endian:
+ *  - the header is MKAVL_WAL_MAGIC, the version and a reserved word;
+ *  - each record is its length and the CRC-32 of its body, then the body:
+ *    the LSN, the change, the key and the items as a length and the bytes
+ *    written by the serialize function.  An update has the item before the
+ *    change and then the item after it.
+ * A record that is cut short or fails its CRC is taken as the torn end of
+ * the log, where a crash stopped a write.
+ */
+
+#include "mkavl_wal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/**
+ * Magic number indicating a pointer is valid for sanity checks.
+ */
+#define MKAVL_CTX_MAGIC 0xCAFEBABE
+
+/**
+ * Magic number indicating a pointer is stale for sanity checks.
+ */
+#define MKAVL_CTX_STALE 0xDEADBEEF
+
+/**
+ * The size of the records waiting to be written at which a log that does not
+ * wait for them writes them anyway, and the size of the reads of a replay.
+ */
+#define MKAVL_WAL_BUF_SIZE 65536
+
+/** The size of the header of a log file */
+#define MKAVL_WAL_HEADER_SIZE 16
+
+/** The size of the length and CRC before the body of each record */
+#define MKAVL_WAL_RECORD_HEADER_SIZE 8
+
+/** The size of the LSN, change and key at the start of a record body */
+#define MKAVL_WAL_RECORD_FIXED_SIZE 16
+
+/** The size of the header of a snapshot written by mkavl_checkpoint() */
+#define MKAVL_WAL_CHECKPOINT_SIZE 16
+
+/**
+ * A growable array of bytes.
+ */
+typedef struct mkavl_wal_buf_st_ {
+    /** The bytes */
+    uint8_t *data;
+    /** The number of bytes in use */
+    size_t len;
+    /** The number of bytes allocated */
+    size_t size;
+} mkavl_wal_buf_st;
+
+/**
+ * A write-ahead log.
+ */
+typedef struct mkavl_wal_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** The log file */
+    int fd;
+    /** How long changes wait for their records */
+    mkavl_wal_sync_e sync;
+    /** Writes the items of the records */
+    mkavl_serialize_fn serialize_fn;
+    /** Guards the fields below */
+    pthread_mutex_t lock;
+    /** Signaled when a leader is done writing */
+    pthread_cond_t cond;
+    /** The records logged that no leader has taken yet */
+    mkavl_wal_buf_st pending;
+    /** The records being written by the leader */
+    mkavl_wal_buf_st writing;
+    /** The item of the record being logged, only used under the tree lock */
+    mkavl_wal_buf_st item_buf;
+    /** The item staged for an update, only used under the tree lock */
+    mkavl_wal_buf_st stage_buf;
+    /** The file offset at which the next records are written */
+    off_t file_off;
+    /** The LSN of the last record logged */
+    uint64_t last_lsn;
+    /** The LSN of the last record written to the file */
+    uint64_t written_lsn;
+    /** The LSN of the last record synced to the disk */
+    uint64_t synced_lsn;
+    /** Whether a leader is writing */
+    bool is_flushing;
+    /** The first error writing the log, after which nothing more is logged */
+    mkavl_rc_e rc;
+    /** The client context given to mkavl_wal_new() */
+    void *context;
+    /** The allocator for the memory of the log */
+    mkavl_allocator_st allocator;
+} mkavl_wal_st;
+
+/**
+ * A buffered reader of a log file for a replay.
+ */
+typedef struct mkavl_wal_reader_st_ {
+    /** The log file */
+    int fd;
+    /** The size of the file */
+    off_t file_len;
+    /** The file offset of the first byte of buf */
+    off_t file_off;
+    /** The bytes read from the file */
+    uint8_t *buf;
+    /** The offset in buf of the next byte to return */
+    size_t buf_off;
+    /** The number of bytes in buf */
+    size_t len;
+} mkavl_wal_reader_st;
+
+/**
+ * The default malloc function.
+ *
+ * @param size The size of memory to allocate.
+ * @param context The log context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_wal_default_malloc_fn (size_t size, void *context)
+{
+    return (malloc(size));
+}
+
+/**
+ * The default free function.
+ *
+ * @param ptr The memory to free.
+ * @param context The log context.
+ */
+static void
+mkavl_wal_default_free_fn (void *ptr, void *context)
+{
+    return (free(ptr));
+}
+
+/**
+ * By default, we'll just use malloc and free if the client passes nothing in.
+ */
+static mkavl_allocator_st mkavl_wal_allocator_default = {
+    mkavl_wal_default_malloc_fn,
+    mkavl_wal_default_free_fn
+};
+
+/**
+ * Check whether a log is valid.
+ *
+ * @param wal_h The log.
+ * @return Whether the log is valid.
+ */
+static inline bool
+mkavl_wal_is_valid (mkavl_wal_handle wal_h)
+{
+    return ((NULL != wal_h) && (MKAVL_CTX_MAGIC == wal_h->magic));
+}
+
+/**
+ * Check whether a sync mode is valid.
+ *
+ * @param sync The sync mode.
+ * @return Whether the sync mode is valid.
+ */
+static inline bool
+mkavl_wal_sync_e_is_valid (mkavl_wal_sync_e sync)
+{
+    return ((sync >= MKAVL_WAL_SYNC_E_FIRST) && (sync < MKAVL_WAL_SYNC_E_MAX));
+}
+
+/**
+ * Check whether a change is valid.
+ *
+ * @param op The change.
+ * @return Whether the change is valid.
+ */
+static inline bool
+mkavl_wal_op_e_is_valid (mkavl_wal_op_e op)
+{
+    return ((op >= MKAVL_WAL_OP_E_FIRST) && (op < MKAVL_WAL_OP_E_MAX));
+}
+
+/**
+ * Store a 32-bit integer as little-endian bytes.
+ *
+ * @param dst Where to store the bytes.
+ * @param value The integer.
+ */
+static void
+mkavl_wal_put_u32 (uint8_t *dst, uint32_t value)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(value); ++i) {
+        dst[i] = ((value >> (8 * i)) & 0xFF);
+    }
+}
+
+/**
+ * Load a 32-bit integer from little-endian bytes.
+ *
+ * @param src The bytes.
+ * @return The integer.
+ */
+static uint32_t
+mkavl_wal_get_u32 (const uint8_t *src)
+{
+    uint32_t value = 0, i;
+
+    for (i = 0; i < sizeof(value); ++i) {
+        value |= (((uint32_t) src[i]) << (8 * i));
+    }
+
+    return (value);
+}
+
+/**
+ * Store a 64-bit integer as little-endian bytes.
+ *
+ * @param dst Where to store the bytes.
+ * @param value The integer.
+ */
+static void
+mkavl_wal_put_u64 (uint8_t *dst, uint64_t value)
+{
+    mkavl_wal_put_u32(dst, (value & 0xFFFFFFFF));
+    mkavl_wal_put_u32((dst + sizeof(uint32_t)), (value >> 32));
+}
+
+/**
+ * Load a 64-bit integer from little-endian bytes.
+ *
+ * @param src The bytes.
+ * @return The integer.
+ */
+static uint64_t
+mkavl_wal_get_u64 (const uint8_t *src)
+{
+    return (mkavl_wal_get_u32(src) |
+            (((uint64_t) mkavl_wal_get_u32(src + sizeof(uint32_t))) << 32));
+}
+
+/**
+ * Make room for more bytes in a buffer.  The allocator has no realloc, so the
+ * bytes in use are copied into the larger buffer.
+ *
+ * @param allocator The allocator of the buffer.
+ * @param context The context passed to the allocator.
+ * @param buf The buffer.
+ * @param len The number of bytes to make room for after those in use.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_buf_reserve (const mkavl_allocator_st *allocator, void *context,
+                       mkavl_wal_buf_st *buf, size_t len)
+{
+    size_t size;
+    uint8_t *data;
+
+    if (len > (SIZE_MAX - buf->len)) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    if ((buf->len + len) <= buf->size) {
+        return (MKAVL_RC_E_SUCCESS);
+    }
+
+    size = (0 == buf->size) ? 256 : buf->size;
+    while (size < (buf->len + len)) {
+        size = (size > (SIZE_MAX / 2)) ? (buf->len + len) : (size * 2);
+    }
+
+    data = allocator->malloc_fn(size, context);
+    if (NULL == data) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    if (NULL != buf->data) {
+        memcpy(data, buf->data, buf->len);
+        allocator->free_fn(buf->data, context);
+    }
+    buf->data = data;
+    buf->size = size;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Free the bytes of a buffer, if any.
+ *
+ * @param allocator The allocator of the buffer.
+ * @param context The context passed to the allocator.
+ * @param buf The buffer.
+ */
+static void
+mkavl_wal_buf_free (const mkavl_allocator_st *allocator, void *context,
+                    mkavl_wal_buf_st *buf)
+{
+    if (NULL != buf->data) {
+        allocator->free_fn(buf->data, context);
+    }
+    memset(buf, 0, sizeof(*buf));
+}
+
+/**
+ * Write all the bytes to a file at an offset.
+ *
+ * @param fd The file.
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @param off The file offset.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_pwrite (int fd, const uint8_t *data, size_t len, off_t off)
+{
+    ssize_t cnt;
+
+    while (0 != len) {
+        cnt = pwrite(fd, data, len, off);
+        if (cnt < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return (MKAVL_RC_E_EIO);
+        }
+        data += cnt;
+        len -= cnt;
+        off += cnt;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Write the header of a log file.
+ *
+ * @param fd The file, which must be empty.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_write_header (int fd)
+{
+    uint8_t header[MKAVL_WAL_HEADER_SIZE] = { 0 };
+
+    memcpy(header, MKAVL_WAL_MAGIC, strlen(MKAVL_WAL_MAGIC));
+    mkavl_wal_put_u32(&(header[8]), MKAVL_WAL_VERSION);
+
+    return (mkavl_wal_pwrite(fd, header, sizeof(header), 0));
+}
+
+/**
+ * Check that a file is empty, so that a log does not overwrite anything.
+ *
+ * @param fd The file.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_check_empty (int fd)
+{
+    struct stat st;
+
+    if (fd < 0) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    if (0 != fstat(fd, &st)) {
+        return (MKAVL_RC_E_EIO);
+    }
+
+    return ((0 == st.st_size) ? MKAVL_RC_E_SUCCESS : MKAVL_RC_E_EINVAL);
+}
+
+/**
+ * Record the first error of a log, after which it logs nothing more, and wake
+ * the callers waiting on it.  The lock of the log must be held.
+ *
+ * @param wal_h The log.
+ * @param rc The error.
+ */
+static void
+mkavl_wal_fail_locked (mkavl_wal_handle wal_h, mkavl_rc_e rc)
+{
+    if (mkavl_rc_e_is_ok(wal_h->rc)) {
+        wal_h->rc = rc;
+    }
+    pthread_cond_broadcast(&(wal_h->cond));
+}
+
+/**
+ * As the leader, write the records logged so far and sync them if asked.  The
+ * lock of the log must be held and no other leader may be writing.  The lock
+ * is released while writing, so records may be logged meanwhile.
+ *
+ * @param wal_h The log.
+ * @param sync Whether to sync the file after writing.
+ */
+static void
+mkavl_wal_flush_locked (mkavl_wal_handle wal_h, bool sync)
+{
+    mkavl_wal_buf_st swap;
+    uint64_t lsn;
+    off_t off;
+    int fd;
+    mkavl_rc_e rc;
+
+    swap = wal_h->writing;
+    wal_h->writing = wal_h->pending;
+    wal_h->pending = swap;
+    wal_h->pending.len = 0;
+
+    lsn = wal_h->last_lsn;
+    off = wal_h->file_off;
+    fd = wal_h->fd;
+    wal_h->file_off += wal_h->writing.len;
+    wal_h->is_flushing = true;
+    pthread_mutex_unlock(&(wal_h->lock));
+
+    rc = mkavl_wal_pwrite(fd, wal_h->writing.data, wal_h->writing.len, off);
+    if (mkavl_rc_e_is_ok(rc) && sync && (0 != fdatasync(fd))) {
+        rc = MKAVL_RC_E_EIO;
+    }
+
+    pthread_mutex_lock(&(wal_h->lock));
+    wal_h->is_flushing = false;
+    if (mkavl_rc_e_is_ok(rc)) {
+        wal_h->written_lsn = lsn;
+        if (sync) {
+            wal_h->synced_lsn = lsn;
+        }
+    } else {
+        mkavl_wal_fail_locked(wal_h, rc);
+    }
+    pthread_cond_broadcast(&(wal_h->cond));
+}
+
+/**
+ * Wait until every record logged so far is written and synced, leading the
+ * writes as needed.  The lock of the log must be held.
+ *
+ * @param wal_h The log.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_sync_locked (mkavl_wal_handle wal_h)
+{
+    while (mkavl_rc_e_is_ok(wal_h->rc) &&
+           (wal_h->is_flushing || (0 != wal_h->pending.len) ||
+            (wal_h->synced_lsn < wal_h->last_lsn))) {
+        if (wal_h->is_flushing) {
+            pthread_cond_wait(&(wal_h->cond), &(wal_h->lock));
+        } else {
+            mkavl_wal_flush_locked(wal_h, true);
+        }
+    }
+
+    return (wal_h->rc);
+}
+
+/**
+ * Create a new log.  The header is written to the file, and records then
+ * follow it.
+ *
+ * @see mkavl_wal_delete
+ * @see mkavl_set_wal
+ * @param wal_h The pointer to fill in with the new log.
+ * @param fd The log file, which must be an empty regular file open for
+ * writing.  It is neither synced nor closed when the log is deleted.
+ * @param sync How long changes wait for their records to be written.
+ * @param serialize_fn Writes the items of the records.
+ * @param last_lsn The LSN of the last change already saved in a snapshot or
+ * logged, from which the LSNs of the new records follow: 0 for a new tree, or
+ * as given by mkavl_wal_replay().
+ * @param context An opaque context passed back to the allocator functions.
+ * @param allocator The memory allocation functions to use for the log and
+ * its record buffers, or NULL if the default functions are to be used.
+ * Typically the context and allocator of the tree the log is attached to.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_wal_new (mkavl_wal_handle *wal_h, int fd, mkavl_wal_sync_e sync,
+               mkavl_serialize_fn serialize_fn, uint64_t last_lsn,
+               void *context, mkavl_allocator_st *allocator)
+{
+    mkavl_allocator_st *local_allocator;
+    mkavl_wal_handle local_wal_h;
+    mkavl_rc_e rc;
+
+    if ((NULL == wal_h) || !mkavl_wal_sync_e_is_valid(sync) ||
+        (NULL == serialize_fn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *wal_h = NULL;
+
+    rc = mkavl_wal_check_empty(fd);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_wal_write_header(fd);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    local_allocator =
+        (NULL == allocator) ? &mkavl_wal_allocator_default : allocator;
+
+    local_wal_h = local_allocator->malloc_fn(sizeof(*local_wal_h), context);
+    if (NULL == local_wal_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(local_wal_h, 0, sizeof(*local_wal_h));
+
+    local_wal_h->context = context;
+    memcpy(&(local_wal_h->allocator), local_allocator,
+           sizeof(local_wal_h->allocator));
+    local_wal_h->magic = MKAVL_CTX_MAGIC;
+    local_wal_h->fd = fd;
+    local_wal_h->sync = sync;
+    local_wal_h->serialize_fn = serialize_fn;
+    pthread_mutex_init(&(local_wal_h->lock), NULL);
+    pthread_cond_init(&(local_wal_h->cond), NULL);
+    local_wal_h->file_off = MKAVL_WAL_HEADER_SIZE;
+    local_wal_h->last_lsn = last_lsn;
+    local_wal_h->written_lsn = last_lsn;
+    local_wal_h->synced_lsn = last_lsn;
+    local_wal_h->rc = MKAVL_RC_E_SUCCESS;
+
+    *wal_h = local_wal_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Write and sync the records logged so far and free a log.  It must first be
+ * detached from its tree, and no change may be waiting on it.  Upon return,
+ * the wal_h memory is set to NULL.
+ *
+ * @param wal_h A pointer to the log to free.
+ * @return The return code.  An error writing the records is returned, but the
+ * log is freed anyway.
+ */
+mkavl_rc_e
+mkavl_wal_delete (mkavl_wal_handle *wal_h)
+{
+    mkavl_wal_handle local_wal_h;
+    mkavl_allocator_st allocator;
+    void *context;
+    mkavl_rc_e rc;
+
+    if (NULL == wal_h) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_wal_h = *wal_h;
+
+    if (!mkavl_wal_is_valid(local_wal_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    pthread_mutex_lock(&(local_wal_h->lock));
+    rc = mkavl_wal_sync_locked(local_wal_h);
+    pthread_mutex_unlock(&(local_wal_h->lock));
+
+    pthread_cond_destroy(&(local_wal_h->cond));
+    pthread_mutex_destroy(&(local_wal_h->lock));
+    allocator = local_wal_h->allocator;
+    context = local_wal_h->context;
+    mkavl_wal_buf_free(&allocator, context, &(local_wal_h->pending));
+    mkavl_wal_buf_free(&allocator, context, &(local_wal_h->writing));
+    mkavl_wal_buf_free(&allocator, context, &(local_wal_h->item_buf));
+    mkavl_wal_buf_free(&allocator, context, &(local_wal_h->stage_buf));
+    local_wal_h->magic = MKAVL_CTX_STALE;
+    allocator.free_fn(local_wal_h, context);
+
+    *wal_h = NULL;
+
+    return (rc);
+}
+
+/**
+ * Wait until every record logged so far is written and synced, whatever the
+ * sync mode of the log.  With MKAVL_WAL_SYNC_E_NONE, this is how a caller
+ * makes its changes durable at a point of its choosing.
+ *
+ * @param wal_h The log.
+ * @return The return code.  Once writing the log has failed, the error is
+ * returned by every later call.
+ */
+mkavl_rc_e
+mkavl_wal_sync (mkavl_wal_handle wal_h)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_wal_is_valid(wal_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    pthread_mutex_lock(&(wal_h->lock));
+    rc = mkavl_wal_sync_locked(wal_h);
+    pthread_mutex_unlock(&(wal_h->lock));
+
+    return (rc);
+}
+
+/**
+ * Switch a log to a new file.  The records logged so far are written and
+ * synced to the old file, and later records go to the new one, so the old
+ * file is complete once this returns.  It may be deleted once a snapshot from
+ * a later mkavl_checkpoint() is in place.
+ *
+ * @param wal_h The log.
+ * @param fd The new log file, which must be an empty regular file open for
+ * writing.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_wal_rotate (mkavl_wal_handle wal_h, int fd)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_wal_is_valid(wal_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    rc = mkavl_wal_check_empty(fd);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    pthread_mutex_lock(&(wal_h->lock));
+    rc = mkavl_wal_sync_locked(wal_h);
+    if (mkavl_rc_e_is_ok(rc)) {
+        /* Nothing is pending, and appends wait for the lock */
+        rc = mkavl_wal_write_header(fd);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        wal_h->fd = fd;
+        wal_h->file_off = MKAVL_WAL_HEADER_SIZE;
+    }
+    pthread_mutex_unlock(&(wal_h->lock));
+
+    return (rc);
+}
+
+/**
+ * Get the LSN of the last record logged.
+ *
+ * @param wal_h The log.
+ * @return The LSN, or 0 if the log is not valid.
+ */
+uint64_t
+mkavl_wal_last_lsn (mkavl_wal_handle wal_h)
+{
+    uint64_t lsn;
+
+    if (!mkavl_wal_is_valid(wal_h)) {
+        return (0);
+    }
+
+    pthread_mutex_lock(&(wal_h->lock));
+    lsn = wal_h->last_lsn;
+    pthread_mutex_unlock(&(wal_h->lock));
+
+    return (lsn);
+}
+
+/**
+ * Serialize an item into a buffer, growing it as needed.
+ *
+ * @param wal_h The log.
+ * @param item The item.
+ * @param context The context of the tree.
+ * @param buf The buffer, whose contents are replaced by the item.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_serialize (mkavl_wal_handle wal_h, const void *item, void *context,
+                     mkavl_wal_buf_st *buf)
+{
+    size_t item_len = 0;
+    mkavl_rc_e rc;
+
+    buf->len = 0;
+    rc = wal_h->serialize_fn(item, buf->data, buf->size, &item_len, context);
+    if (mkavl_rc_e_is_ok(rc) && (item_len > buf->size)) {
+        rc = mkavl_wal_buf_reserve(&(wal_h->allocator), wal_h->context, buf,
+                                   item_len);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = wal_h->serialize_fn(item, buf->data, buf->size, &item_len,
+                                     context);
+        }
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    if ((item_len > buf->size) || (item_len > UINT32_MAX)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    buf->len = item_len;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Serialize an item for the next record before the tree is changed, so that a
+ * change is only made once its record can be made.  A log that has failed
+ * takes no more changes.
+ *
+ * @param wal_h The log.
+ * @param item The item.
+ * @param context The context of the tree.
+ * @param buf The buffer for the item.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the log has
+ * failed.  An error from the serialize function is returned as is, and the
+ * log is left as it was.
+ */
+static mkavl_rc_e
+mkavl_wal_serialize_next (mkavl_wal_handle wal_h, const void *item,
+                          void *context, mkavl_wal_buf_st *buf)
+{
+    mkavl_rc_e rc;
+
+    if (!mkavl_wal_is_valid(wal_h) || (NULL == item)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    pthread_mutex_lock(&(wal_h->lock));
+    rc = wal_h->rc;
+    pthread_mutex_unlock(&(wal_h->lock));
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    return (mkavl_wal_serialize(wal_h, item, context, buf));
+}
+
+/**
+ * Serialize an item before mkavl_update() changes it, to be logged as the
+ * item before the change by the next MKAVL_WAL_OP_E_UPDATE record.
+ *
+ * @see mkavl_wal_serialize_next
+ * @param wal_h The log.
+ * @param item The item, before the change.
+ * @param context The context of the tree.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_wal_stage (mkavl_wal_handle wal_h, const void *item, void *context)
+{
+    return (mkavl_wal_serialize_next(wal_h, item, context,
+                                     &(wal_h->stage_buf)));
+}
+
+/**
+ * Serialize the item of the next record before the change it logs is made,
+ * or for mkavl_update(), once the item is changed but not yet moved.
+ *
+ * @see mkavl_wal_serialize_next
+ * @param wal_h The log.
+ * @param item The item, as it is after the change.
+ * @param context The context of the tree.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_wal_prepare (mkavl_wal_handle wal_h, const void *item, void *context)
+{
+    return (mkavl_wal_serialize_next(wal_h, item, context,
+                                     &(wal_h->item_buf)));
+}
+
+/**
+ * Log a change that was just made to the tree, with the item serialized by
+ * mkavl_wal_prepare().  The record is only buffered; mkavl_wal_commit() waits
+ * for it to be written.  The change is already made, so if the record cannot
+ * be buffered, the log fails with MKAVL_RC_E_EIO and logs nothing more.
+ *
+ * @param wal_h The log.
+ * @param op The change.
+ * @param key_idx The key, for the changes to a single key.
+ * @param lsn Set to the LSN of the record.
+ * @return The return code.  MKAVL_RC_E_EIO means the change is not logged.
+ */
+mkavl_rc_e
+mkavl_wal_append (mkavl_wal_handle wal_h, mkavl_wal_op_e op, size_t key_idx,
+                  uint64_t *lsn)
+{
+    const mkavl_wal_buf_st *image_array[2];
+    size_t i, image_cnt = 0, body_len;
+    uint8_t *record, *dst;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    if (!mkavl_wal_is_valid(wal_h) || !mkavl_wal_op_e_is_valid(op) ||
+        (key_idx > UINT32_MAX) || (NULL == lsn)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *lsn = 0;
+
+    if (MKAVL_WAL_OP_E_UPDATE == op) {
+        image_array[image_cnt++] = &(wal_h->stage_buf);
+    }
+    image_array[image_cnt++] = &(wal_h->item_buf);
+
+    body_len = MKAVL_WAL_RECORD_FIXED_SIZE;
+    for (i = 0; i < image_cnt; ++i) {
+        body_len += (sizeof(uint32_t) + image_array[i]->len);
+    }
+
+    pthread_mutex_lock(&(wal_h->lock));
+    if ((body_len > UINT32_MAX) ||
+        mkavl_rc_e_is_notok(mkavl_wal_buf_reserve(
+                                &(wal_h->allocator), wal_h->context,
+                                &(wal_h->pending),
+                                (MKAVL_WAL_RECORD_HEADER_SIZE + body_len)))) {
+        rc = MKAVL_RC_E_EIO;
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        mkavl_wal_fail_locked(wal_h, rc);
+    }
+    if (mkavl_rc_e_is_notok(wal_h->rc)) {
+        rc = wal_h->rc;
+        pthread_mutex_unlock(&(wal_h->lock));
+        return (rc);
+    }
+
+    record = &(wal_h->pending.data[wal_h->pending.len]);
+    dst = (record + MKAVL_WAL_RECORD_HEADER_SIZE);
+    *lsn = ++(wal_h->last_lsn);
+    mkavl_wal_put_u64(dst, *lsn);
+    mkavl_wal_put_u32((dst + 8), op);
+    mkavl_wal_put_u32((dst + 12), key_idx);
+    dst += MKAVL_WAL_RECORD_FIXED_SIZE;
+    for (i = 0; i < image_cnt; ++i) {
+        mkavl_wal_put_u32(dst, image_array[i]->len);
+        dst += sizeof(uint32_t);
+        memcpy(dst, image_array[i]->data, image_array[i]->len);
+        dst += image_array[i]->len;
+    }
+    mkavl_wal_put_u32(record, body_len);
+    mkavl_wal_put_u32((record + sizeof(uint32_t)),
+                      mkavl_crc32(0, (record + MKAVL_WAL_RECORD_HEADER_SIZE),
+                                  body_len));
+    wal_h->pending.len += (MKAVL_WAL_RECORD_HEADER_SIZE + body_len);
+    pthread_mutex_unlock(&(wal_h->lock));
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Wait for a record to be written as the sync mode of the log asks.  This is
+ * called after the lock of the tree is released, so that other changes may
+ * log their records while this one waits and be written with it.
+ *
+ * @param wal_h The log.
+ * @param lsn The LSN of the record.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_wal_commit (mkavl_wal_handle wal_h, uint64_t lsn)
+{
+    bool sync;
+    mkavl_rc_e rc;
+
+    if (!mkavl_wal_is_valid(wal_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    sync = (MKAVL_WAL_SYNC_E_FSYNC == wal_h->sync);
+
+    pthread_mutex_lock(&(wal_h->lock));
+    if (MKAVL_WAL_SYNC_E_NONE == wal_h->sync) {
+        if (mkavl_rc_e_is_ok(wal_h->rc) && !wal_h->is_flushing &&
+            (wal_h->pending.len >= MKAVL_WAL_BUF_SIZE)) {
+            mkavl_wal_flush_locked(wal_h, false);
+        }
+    } else {
+        while (mkavl_rc_e_is_ok(wal_h->rc) &&
+               ((sync ? wal_h->synced_lsn : wal_h->written_lsn) < lsn)) {
+            if (wal_h->is_flushing) {
+                pthread_cond_wait(&(wal_h->cond), &(wal_h->lock));
+            } else {
+                mkavl_wal_flush_locked(wal_h, sync);
+            }
+        }
+    }
+    rc = wal_h->rc;
+    pthread_mutex_unlock(&(wal_h->lock));
+
+    return (rc);
+}
+
+/**
+ * Read bytes from a log file for a replay.
+ *
+ * @param reader The reader.
+ * @param data Where to put the bytes.
+ * @param len The number of bytes to read.
+ * @param read_len Set to the number of bytes read, which is less than len
+ * only at the end of the file.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_read (mkavl_wal_reader_st *reader, uint8_t *data, size_t len,
+                size_t *read_len)
+{
+    size_t cnt;
+    ssize_t got;
+
+    *read_len = 0;
+    while (0 != len) {
+        if (reader->buf_off == reader->len) {
+            reader->file_off += reader->len;
+            reader->buf_off = reader->len = 0;
+            got = pread(reader->fd, reader->buf, MKAVL_WAL_BUF_SIZE,
+                        reader->file_off);
+            if (got < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                return (MKAVL_RC_E_EIO);
+            }
+            if (0 == got) {
+                break;
+            }
+            reader->len = got;
+        }
+        cnt = (reader->len - reader->buf_off);
+        if (cnt > len) {
+            cnt = len;
+        }
+        memcpy(data, &(reader->buf[reader->buf_off]), cnt);
+        reader->buf_off += cnt;
+        *read_len += cnt;
+        data += cnt;
+        len -= cnt;
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Free an item of a replay with the item function, if any.
+ *
+ * @param tree_h The tree being rebuilt.
+ * @param item_fn The item function.
+ * @param item The item.
+ */
+static void
+mkavl_wal_free_item (mkavl_tree_handle tree_h, mkavl_item_fn item_fn,
+                     void *item)
+{
+    if ((NULL != item_fn) && (NULL != item)) {
+        item_fn(item, mkavl_get_tree_context(tree_h));
+    }
+}
+
+/**
+ * Check whether an item is in the AVL tree of a key.
+ *
+ * @param tree_h The tree.
+ * @param key_idx The key.
+ * @param item The item.
+ * @return Whether the item itself, not just an equal one, is there.
+ */
+static bool
+mkavl_wal_is_in_key (mkavl_tree_handle tree_h, size_t key_idx, void *item)
+{
+    void *found_item = NULL;
+
+    mkavl_find(tree_h, MKAVL_FIND_TYPE_E_EQUAL, key_idx, item, &found_item);
+
+    return (found_item == item);
+}
+
+/**
+ * Check whether an item is in the AVL tree of any key.
+ *
+ * @param tree_h The tree.
+ * @param item The item.
+ * @return Whether the item itself is in the tree for some key.
+ */
+static bool
+mkavl_wal_is_in_tree (mkavl_tree_handle tree_h, void *item)
+{
+    size_t i;
+
+    for (i = 0; i < mkavl_get_key_count(tree_h); ++i) {
+        if (mkavl_wal_is_in_key(tree_h, i, item)) {
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+/**
+ * Find the item of a tree equal to a lookup item by any key but one.
+ *
+ * @param tree_h The tree.
+ * @param skip_key_idx The key not to search, or the number of keys.
+ * @param lookup_item The item to look up.
+ * @return The item found, or NULL.
+ */
+static void *
+mkavl_wal_find_any (mkavl_tree_handle tree_h, size_t skip_key_idx,
+                    const void *lookup_item)
+{
+    void *found_item = NULL;
+    size_t i;
+
+    for (i = 0; (i < mkavl_get_key_count(tree_h)) && (NULL == found_item);
+         ++i) {
+        if (i != skip_key_idx) {
+            mkavl_find(tree_h, MKAVL_FIND_TYPE_E_EQUAL, i, lookup_item,
+                       &found_item);
+        }
+    }
+
+    return (found_item);
+}
+
+/**
+ * Put a new item in place of an item of the tree for each key the item is in,
+ * and free the item.  Replayed items are copies, so this is how a change made
+ * in place to an item is replayed.
+ *
+ * @param tree_h The tree being rebuilt.
+ * @param old_item The item in the tree.
+ * @param new_item The item to take its place.
+ * @param item_fn The item function.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_replace (mkavl_tree_handle tree_h, void *old_item, void *new_item,
+                   mkavl_item_fn item_fn)
+{
+    void *found_item, *existing_item;
+    size_t i;
+    mkavl_rc_e rc;
+
+    for (i = 0; i < mkavl_get_key_count(tree_h); ++i) {
+        if (!mkavl_wal_is_in_key(tree_h, i, old_item)) {
+            continue;
+        }
+
+        rc = mkavl_remove_key_idx(tree_h, i, old_item, &found_item);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_add_key_idx(tree_h, i, new_item, &existing_item);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+        if (NULL != existing_item) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+    }
+    mkavl_wal_free_item(tree_h, item_fn, old_item);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Apply the change of a log record to a tree.
+ *
+ * @param tree_h The tree being rebuilt.
+ * @param op The change.
+ * @param key_idx The key of the change.
+ * @param item_array The items of the record.
+ * @param item_fn The item function.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the change does
+ * not fit the tree, e.g., an add of an item already there.
+ */
+static mkavl_rc_e
+mkavl_wal_apply (mkavl_tree_handle tree_h, mkavl_wal_op_e op, size_t key_idx,
+                 void **item_array, mkavl_item_fn item_fn)
+{
+    void *item = item_array[0], *found_item = NULL;
+    mkavl_rc_e rc;
+
+    switch (op) {
+    case MKAVL_WAL_OP_E_ADD:
+        rc = mkavl_add(tree_h, item, &found_item);
+        if (mkavl_rc_e_is_ok(rc) && (NULL != found_item)) {
+            rc = MKAVL_RC_E_EINVAL;
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            mkavl_wal_free_item(tree_h, item_fn, item);
+        }
+        break;
+    case MKAVL_WAL_OP_E_REMOVE:
+        rc = mkavl_remove(tree_h, item, &found_item);
+        mkavl_wal_free_item(tree_h, item_fn, item);
+        if (mkavl_rc_e_is_ok(rc) && (NULL == found_item)) {
+            rc = MKAVL_RC_E_EINVAL;
+        }
+        mkavl_wal_free_item(tree_h, item_fn, found_item);
+        break;
+    case MKAVL_WAL_OP_E_REMOVE_KEY_IDX:
+        rc = mkavl_remove_key_idx(tree_h, key_idx, item, &found_item);
+        mkavl_wal_free_item(tree_h, item_fn, item);
+        if (mkavl_rc_e_is_ok(rc) && (NULL == found_item)) {
+            rc = MKAVL_RC_E_EINVAL;
+        }
+        /* An item left in no key is held by the caller until it is re-added */
+        if (mkavl_rc_e_is_ok(rc) &&
+            !mkavl_wal_is_in_tree(tree_h, found_item)) {
+            mkavl_wal_free_item(tree_h, item_fn, found_item);
+        }
+        break;
+    case MKAVL_WAL_OP_E_ADD_KEY_IDX:
+        /* The item may have changed since it was taken out of this key */
+        found_item = mkavl_wal_find_any(tree_h, key_idx, item);
+        rc = MKAVL_RC_E_SUCCESS;
+        if (NULL != found_item) {
+            rc = mkavl_wal_replace(tree_h, found_item, item, item_fn);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_add_key_idx(tree_h, key_idx, item, &found_item);
+        }
+        if (mkavl_rc_e_is_ok(rc) && (NULL != found_item)) {
+            rc = MKAVL_RC_E_EINVAL;
+        }
+        break;
+    case MKAVL_WAL_OP_E_UPDATE:
+        found_item = mkavl_wal_find_any(tree_h, mkavl_get_key_count(tree_h),
+                                        item);
+        mkavl_wal_free_item(tree_h, item_fn, item);
+        if (NULL == found_item) {
+            mkavl_wal_free_item(tree_h, item_fn, item_array[1]);
+            rc = MKAVL_RC_E_EINVAL;
+            break;
+        }
+        rc = mkavl_wal_replace(tree_h, found_item, item_array[1], item_fn);
+        break;
+    default:
+        rc = MKAVL_RC_E_EINVAL;
+        break;
+    }
+
+    return (rc);
+}
+
+/**
+ * Parse a log record and apply it to a tree.
+ *
+ * @param tree_h The tree being rebuilt.
+ * @param body The body of the record.
+ * @param body_len The size of the body.
+ * @param deserialize_fn Makes the items of the record.
+ * @param item_fn The item function.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_replay_record (mkavl_tree_handle tree_h, const uint8_t *body,
+                         size_t body_len, mkavl_deserialize_fn deserialize_fn,
+                         mkavl_item_fn item_fn)
+{
+    void *item_array[2] = { NULL, NULL };
+    size_t i, image_cnt, off, image_len;
+    mkavl_wal_op_e op;
+    uint32_t key_idx;
+    mkavl_rc_e rc = MKAVL_RC_E_SUCCESS;
+
+    op = mkavl_wal_get_u32(body + 8);
+    key_idx = mkavl_wal_get_u32(body + 12);
+    if (!mkavl_wal_op_e_is_valid(op) ||
+        (key_idx >= mkavl_get_key_count(tree_h))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    image_cnt = (MKAVL_WAL_OP_E_UPDATE == op) ? 2 : 1;
+
+    off = MKAVL_WAL_RECORD_FIXED_SIZE;
+    for (i = 0; (i < image_cnt) && mkavl_rc_e_is_ok(rc); ++i) {
+        if ((body_len - off) < sizeof(uint32_t)) {
+            rc = MKAVL_RC_E_EINVAL;
+            break;
+        }
+        image_len = mkavl_wal_get_u32(body + off);
+        off += sizeof(uint32_t);
+        if ((body_len - off) < image_len) {
+            rc = MKAVL_RC_E_EINVAL;
+            break;
+        }
+        rc = deserialize_fn((body + off), image_len, &(item_array[i]),
+                            mkavl_get_tree_context(tree_h));
+        off += image_len;
+    }
+    if (mkavl_rc_e_is_ok(rc) && (off != body_len)) {
+        rc = MKAVL_RC_E_EINVAL;
+    }
+
+    if (mkavl_rc_e_is_notok(rc)) {
+        for (i = 0; i < image_cnt; ++i) {
+            mkavl_wal_free_item(tree_h, item_fn, item_array[i]);
+        }
+        return (rc);
+    }
+
+    return (mkavl_wal_apply(tree_h, op, key_idx, item_array, item_fn));
+}
+
+/**
+ * Apply the records of a log file that follow a snapshot to a tree.
+ *
+ * @param tree_h The tree being rebuilt.
+ * @param fd The log file.
+ * @param snapshot_lsn The LSN of the snapshot, whose records are skipped.
+ * @param deserialize_fn Makes the items of the records.
+ * @param item_fn The item function.
+ * @param last_lsn The LSN of the last change applied, updated as records are
+ * applied.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_wal_replay_log (mkavl_tree_handle tree_h, int fd, uint64_t snapshot_lsn,
+                      mkavl_deserialize_fn deserialize_fn,
+                      mkavl_item_fn item_fn, uint64_t *last_lsn)
+{
+    uint8_t header[MKAVL_WAL_HEADER_SIZE];
+    const mkavl_allocator_st *allocator;
+    mkavl_wal_reader_st reader = { 0 };
+    mkavl_wal_buf_st body = { 0 };
+    struct stat st;
+    size_t read_len, body_len;
+    uint64_t lsn;
+    void *context;
+    mkavl_rc_e rc;
+
+    /* The buffers of a replay belong with the tree being rebuilt */
+    allocator = mkavl_get_allocator(tree_h);
+    if (NULL == allocator) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    context = mkavl_get_tree_context(tree_h);
+
+    if (0 != fstat(fd, &st)) {
+        return (MKAVL_RC_E_EIO);
+    }
+    reader.fd = fd;
+    reader.file_len = st.st_size;
+    reader.buf = allocator->malloc_fn(MKAVL_WAL_BUF_SIZE, context);
+    if (NULL == reader.buf) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    rc = mkavl_wal_read(&reader, header, sizeof(header), &read_len);
+    if (mkavl_rc_e_is_notok(rc) || (read_len < sizeof(header))) {
+        /* A crash while the header was written leaves no records */
+        goto cleanup;
+    }
+    if ((0 != memcmp(header, MKAVL_WAL_MAGIC, strlen(MKAVL_WAL_MAGIC))) ||
+        (MKAVL_WAL_VERSION != mkavl_wal_get_u32(&(header[8])))) {
+        rc = MKAVL_RC_E_EINVAL;
+        goto cleanup;
+    }
+
+    while (true) {
+        rc = mkavl_wal_read(&reader, header, MKAVL_WAL_RECORD_HEADER_SIZE,
+                            &read_len);
+        if (mkavl_rc_e_is_notok(rc) ||
+            (MKAVL_WAL_RECORD_HEADER_SIZE != read_len)) {
+            break;
+        }
+
+        /* A length past the end of the file is from a torn write */
+        body_len = mkavl_wal_get_u32(header);
+        if ((body_len < MKAVL_WAL_RECORD_FIXED_SIZE) ||
+            (body_len > (uint64_t) (reader.file_len - reader.file_off -
+                                    reader.buf_off))) {
+            break;
+        }
+
+        body.len = 0;
+        rc = mkavl_wal_buf_reserve(allocator, context, &body, body_len);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_wal_read(&reader, body.data, body_len, &read_len);
+        }
+        if (mkavl_rc_e_is_notok(rc) || (body_len != read_len) ||
+            (mkavl_wal_get_u32(&(header[4])) !=
+             mkavl_crc32(0, body.data, body_len))) {
+            break;
+        }
+
+        /* Records the snapshot holds are skipped, and no record is missed */
+        lsn = mkavl_wal_get_u64(body.data);
+        if (lsn <= *last_lsn) {
+            if (lsn > snapshot_lsn) {
+                rc = MKAVL_RC_E_EINVAL;
+                break;
+            }
+            continue;
+        }
+        if (lsn != (*last_lsn + 1)) {
+            rc = MKAVL_RC_E_EINVAL;
+            break;
+        }
+
+        rc = mkavl_wal_replay_record(tree_h, body.data, body_len,
+                                     deserialize_fn, item_fn);
+        if (mkavl_rc_e_is_notok(rc)) {
+            break;
+        }
+        *last_lsn = lsn;
+    }
+
+cleanup:
+
+    mkavl_wal_buf_free(allocator, context, &body);
+    allocator->free_fn(reader.buf, context);
+
+    return (rc);
+}
+
+/**
+ * Rebuild a tree after a crash from the last snapshot written by
+ * mkavl_checkpoint() and the logs written since.  Each record of the logs
+ * after the snapshot is applied in turn, with the items made by
+ * deserialize_fn.  A change made in place, by mkavl_update() or to an item
+ * between mkavl_remove_key_idx() and mkavl_add_key_idx(), is applied by
+ * putting a new item in place of the old one, which is freed.  Each log ends
+ * at its first torn record, where a crash cut a write short.
+ *
+ * The log should then be started afresh in a new, empty file with
+ * mkavl_wal_new() and last_lsn, and attached to the tree.  The files replayed
+ * must be kept until the next checkpoint.
+ *
+ * @param tree_h The tree to rebuild, which must be empty and have the same
+ * keys as the tree that was logged, and no log attached.
+ * @param snapshot_fd The snapshot, read from its current offset, or -1 to
+ * replay the logs of a tree from its start.
+ * @param log_fd_array The log files, oldest first.
+ * @param log_fd_cnt The number of log files.
+ * @param deserialize_fn Makes the items from the bytes of the snapshot and
+ * the records.
+ * @param item_fn Frees the items replaced or removed, and those not added to
+ * the tree when the replay fails.  May be NULL.
+ * @param last_lsn Set to the LSN of the last change applied, from which a new
+ * log goes on.
+ * @return The return code.  MKAVL_RC_E_EINVAL is returned if the snapshot is
+ * damaged or the logs do not follow it, in which case the tree holds part of
+ * the changes and should be deleted.
+ */
+mkavl_rc_e
+mkavl_wal_replay (mkavl_tree_handle tree_h, int snapshot_fd,
+                  const int *log_fd_array, size_t log_fd_cnt,
+                  mkavl_deserialize_fn deserialize_fn, mkavl_item_fn item_fn,
+                  uint64_t *last_lsn)
+{
+    uint8_t header[MKAVL_WAL_CHECKPOINT_SIZE];
+    uint64_t snapshot_lsn = 0;
+    size_t i, off;
+    ssize_t cnt;
+    mkavl_rc_e rc;
+
+    if ((NULL == tree_h) || (NULL == deserialize_fn) || (NULL == last_lsn) ||
+        ((NULL == log_fd_array) && (0 != log_fd_cnt))) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *last_lsn = 0;
+
+    if (0 != mkavl_count(tree_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    if (snapshot_fd >= 0) {
+        for (off = 0; off < sizeof(header); off += cnt) {
+            cnt = read(snapshot_fd, &(header[off]), (sizeof(header) - off));
+            if ((cnt < 0) && (EINTR == errno)) {
+                cnt = 0;
+                continue;
+            }
+            if (cnt <= 0) {
+                return ((cnt < 0) ? MKAVL_RC_E_EIO : MKAVL_RC_E_EINVAL);
+            }
+        }
+        if (0 != memcmp(header, MKAVL_WAL_CHECKPOINT_MAGIC,
+                        strlen(MKAVL_WAL_CHECKPOINT_MAGIC))) {
+            return (MKAVL_RC_E_EINVAL);
+        }
+        snapshot_lsn = mkavl_wal_get_u64(&(header[8]));
+
+        rc = mkavl_load(tree_h, snapshot_fd, deserialize_fn, item_fn);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+    }
+    *last_lsn = snapshot_lsn;
+
+    for (i = 0; i < log_fd_cnt; ++i) {
+        rc = mkavl_wal_replay_log(tree_h, log_fd_array[i], snapshot_lsn,
+                                  deserialize_fn, item_fn, last_lsn);
+        if (mkavl_rc_e_is_notok(rc)) {
+            return (rc);
+        }
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
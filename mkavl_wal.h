@@ -0,0 +1,151 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the public interface for write-ahead logs of the changes to a tree.
+ * A log made by mkavl_wal_new() and attached to a tree with mkavl_set_wal()
+ * gets a record for each change made by mkavl_add(), mkavl_remove(),
+ * mkavl_add_key_idx(), mkavl_remove_key_idx() and mkavl_update(), holding the
+ * items as written by a serialize function.  The items are serialized before
+ * the change is made, so a change whose record cannot be made is not made
+ * either.  The change is made and logged under the lock of the tree, and the
+ * caller then waits for the record to be written as the sync mode asks, after
+ * the lock is released.  Once writing the log fails, the changes already made
+ * return MKAVL_RC_E_EIO and the tree takes no more changes.
+ *
+ * Writes are committed as a group: the first caller to wait becomes the
+ * leader and writes and syncs every record logged so far with one write and
+ * one fdatasync(), while the callers that log records meanwhile wait for the
+ * next leader.  So N threads changing the tree at once pay for about one sync
+ * between them rather than N, and a single thread pays one per change.
+ *
+ * Each record has a log sequence number (LSN), one more than the record
+ * before it.  mkavl_checkpoint() saves the tree together with the LSN of the
+ * last change it holds, and mkavl_wal_replay() loads such a snapshot and then
+ * applies the records of the logs that come after it.  To keep the logs from
+ * growing forever:
+ *  - mkavl_wal_rotate() to a new, empty log file;
+ *  - mkavl_checkpoint() to a new snapshot file, and rename it over the old
+ *    snapshot;
+ *  - delete the logs from before the rotation.
+ * A crash at any point leaves a snapshot and logs that replay to the tree.
+ */
+
+#ifndef __MKAVL_WAL_H__
+#define __MKAVL_WAL_H__
+
+#include "mkavl.h"
+
+/** The bytes at the start of a log file */
+#define MKAVL_WAL_MAGIC "MKAVLWAL"
+
+/** The bytes at the start of a snapshot written by mkavl_checkpoint() */
+#define MKAVL_WAL_CHECKPOINT_MAGIC "MKAVLCKP"
+
+/** The version of the log file format */
+#define MKAVL_WAL_VERSION 1
+
+/**
+ * How long a change waits for its record to be written.
+ */
+typedef enum mkavl_wal_sync_e_ {
+    /** Invalid */
+    MKAVL_WAL_SYNC_E_INVALID,
+    /**
+     * Do not wait.  Records are written once enough of them are buffered or
+     * by mkavl_wal_sync(), so a crash of the process loses the last changes.
+     */
+    MKAVL_WAL_SYNC_E_NONE,
+    /** First valid sync mode */
+    MKAVL_WAL_SYNC_E_FIRST = MKAVL_WAL_SYNC_E_NONE,
+    /**
+     * Wait until the record is written to the file, so only a crash of the
+     * system loses changes.
+     */
+    MKAVL_WAL_SYNC_E_WRITE,
+    /** Wait until the record is written and synced to the disk */
+    MKAVL_WAL_SYNC_E_FSYNC,
+    /** Max value for bounds testing */
+    MKAVL_WAL_SYNC_E_MAX,
+} mkavl_wal_sync_e;
+
+/**
+ * The change recorded by a log record.
+ */
+typedef enum mkavl_wal_op_e_ {
+    /** Invalid */
+    MKAVL_WAL_OP_E_INVALID,
+    /** mkavl_add() of the item */
+    MKAVL_WAL_OP_E_ADD,
+    /** First valid change */
+    MKAVL_WAL_OP_E_FIRST = MKAVL_WAL_OP_E_ADD,
+    /** mkavl_remove() of the item */
+    MKAVL_WAL_OP_E_REMOVE,
+    /** mkavl_add_key_idx() of the item */
+    MKAVL_WAL_OP_E_ADD_KEY_IDX,
+    /** mkavl_remove_key_idx() of the item */
+    MKAVL_WAL_OP_E_REMOVE_KEY_IDX,
+    /** mkavl_update() of the item, with the item before the change */
+    MKAVL_WAL_OP_E_UPDATE,
+    /** Max value for bounds testing */
+    MKAVL_WAL_OP_E_MAX,
+} mkavl_wal_op_e;
+
+/* APIs below are documented in their implementation file */
+
+extern mkavl_rc_e
+mkavl_wal_new(mkavl_wal_handle *wal_h, int fd, mkavl_wal_sync_e sync,
+              mkavl_serialize_fn serialize_fn, uint64_t last_lsn,
+              void *context, mkavl_allocator_st *allocator);
+
+extern mkavl_rc_e
+mkavl_wal_delete(mkavl_wal_handle *wal_h);
+
+extern mkavl_rc_e
+mkavl_wal_sync(mkavl_wal_handle wal_h);
+
+extern mkavl_rc_e
+mkavl_wal_rotate(mkavl_wal_handle wal_h, int fd);
+
+extern uint64_t
+mkavl_wal_last_lsn(mkavl_wal_handle wal_h);
+
+extern mkavl_rc_e
+mkavl_wal_replay(mkavl_tree_handle tree_h, int snapshot_fd,
+                 const int *log_fd_array, size_t log_fd_cnt,
+                 mkavl_deserialize_fn deserialize_fn, mkavl_item_fn item_fn,
+                 uint64_t *last_lsn);
+
+/* Used by the tree the log is attached to, under the lock of the tree */
+
+extern mkavl_rc_e
+mkavl_wal_stage(mkavl_wal_handle wal_h, const void *item, void *context);
+
+extern mkavl_rc_e
+mkavl_wal_prepare(mkavl_wal_handle wal_h, const void *item, void *context);
+
+extern mkavl_rc_e
+mkavl_wal_append(mkavl_wal_handle wal_h, mkavl_wal_op_e op, size_t key_idx,
+                 uint64_t *lsn);
+
+extern mkavl_rc_e
+mkavl_wal_commit(mkavl_wal_handle wal_h, uint64_t lsn);
+
+#endif
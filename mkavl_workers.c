@@ -0,0 +1,519 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the implementation for pools of worker threads.  Each worker keeps a
+ * queue of the tasks it spawned as a list linked from oldest to newest under a
+ * lock of its own, and a further queue takes the tasks spawned by threads
+ * outside the pool.  Tasks are short-lived and coarse, so a lock per queue
+ * costs little next to the work of a task.  The pool lock and condition only
+ * put idle threads to sleep and wake them when a task is queued or a group is
+ * done.
+ */
+
+#include "mkavl_workers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ * Magic number indicating a pointer is valid for sanity checks.
+ */
+#define MKAVL_CTX_MAGIC 0xCAFEBABE
+
+/**
+ * Magic number indicating a pointer is stale for sanity checks.
+ */
+#define MKAVL_CTX_STALE 0xDEADBEEF
+
+/**
+ * The queue of tasks of one worker thread, or of the threads outside the pool.
+ */
+typedef struct mkavl_worker_st_ {
+    /** The pool of the worker */
+    struct mkavl_workers_st_ *workers;
+    /** The thread of the worker, unused for the queue of outside threads */
+    pthread_t thread;
+    /** Guards the queue */
+    pthread_mutex_t lock;
+    /** The task spawned first, taken by thieves */
+    mkavl_task_st *oldest;
+    /** The task spawned last, taken by the worker itself */
+    mkavl_task_st *newest;
+    /** The index of the worker in the pool */
+    uint32_t idx;
+} mkavl_worker_st;
+
+/**
+ * A pool of worker threads.
+ */
+typedef struct mkavl_workers_st_ {
+    /** Used for sanity checks */
+    uint32_t magic;
+    /** Guards stopping and sleeping on cond */
+    pthread_mutex_t lock;
+    /** Signaled when a task is queued or a group is done */
+    pthread_cond_t cond;
+    /** The number of tasks on all the queues, changed atomically */
+    uint32_t queued_cnt;
+    /** Set when the pool is being deleted */
+    bool stopping;
+    /** The number of worker threads */
+    uint32_t thread_cnt;
+    /**
+     * The queues of the worker threads followed by the queue of the threads
+     * outside the pool
+     */
+    mkavl_worker_st *worker_array;
+    /** The client context given to mkavl_workers_new() */
+    void *context;
+    /** The allocator for the memory of the pool */
+    mkavl_allocator_st allocator;
+} mkavl_workers_st;
+
+/** The worker run by the current thread, if any */
+static __thread mkavl_worker_st *mkavl_workers_self;
+
+/**
+ * The default malloc function.
+ *
+ * @param size The size of memory to allocate.
+ * @param context The pool context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_workers_default_malloc_fn (size_t size, void *context)
+{
+    return (malloc(size));
+}
+
+/**
+ * The default free function.
+ *
+ * @param ptr The memory to free.
+ * @param context The pool context.
+ */
+static void
+mkavl_workers_default_free_fn (void *ptr, void *context)
+{
+    return (free(ptr));
+}
+
+/**
+ * By default, we'll just use malloc and free if the client passes nothing in.
+ */
+static mkavl_allocator_st mkavl_workers_allocator_default = {
+    mkavl_workers_default_malloc_fn,
+    mkavl_workers_default_free_fn
+};
+
+/**
+ * Assert utility to crash (via abort()) if the condition is not met regardless
+ * of whether NDEBUG is defined.  Spawning and waiting have no return code with
+ * which to report a stale pool.
+ *
+ * @param condition The condition for which a crash will happen if false.
+ */
+static inline void
+mkavl_assert_abort (bool condition)
+{
+    if (!condition) {
+        abort();
+    }
+}
+
+/**
+ * Check whether a pool is valid.
+ *
+ * @param workers_h The pool.
+ * @return Whether the pool is valid.
+ */
+static inline bool
+mkavl_workers_is_valid (mkavl_workers_handle workers_h)
+{
+    return ((NULL != workers_h) && (MKAVL_CTX_MAGIC == workers_h->magic));
+}
+
+/**
+ * Get the queue on which the current thread spawns tasks.
+ *
+ * @param workers_h The pool.
+ * @return The queue of the current thread if it is a worker of the pool, else
+ * the queue of the threads outside the pool.
+ */
+static mkavl_worker_st *
+mkavl_workers_own_queue (mkavl_workers_handle workers_h)
+{
+    if ((NULL != mkavl_workers_self) &&
+        (workers_h == mkavl_workers_self->workers)) {
+        return (mkavl_workers_self);
+    }
+
+    return (&(workers_h->worker_array[workers_h->thread_cnt]));
+}
+
+/**
+ * Take a task off a queue.
+ *
+ * @param worker The queue.
+ * @param newest Whether to take the task spawned last rather than first.
+ * @return The task or NULL if the queue is empty.
+ */
+static mkavl_task_st *
+mkavl_workers_pop (mkavl_worker_st *worker, bool newest)
+{
+    mkavl_task_st *task;
+
+    pthread_mutex_lock(&(worker->lock));
+    task = (newest ? worker->newest : worker->oldest);
+    if (NULL != task) {
+        if (NULL != task->older) {
+            task->older->newer = task->newer;
+        } else {
+            worker->oldest = task->newer;
+        }
+        if (NULL != task->newer) {
+            task->newer->older = task->older;
+        } else {
+            worker->newest = task->older;
+        }
+    }
+    pthread_mutex_unlock(&(worker->lock));
+
+    return (task);
+}
+
+/**
+ * Find a task for the current thread to run.  Its own queue is tried first,
+ * newest task first, and then the oldest task of each other queue in turn
+ * starting after its own.
+ *
+ * @param workers_h The pool.
+ * @return The task or NULL if no task was queued.
+ */
+static mkavl_task_st *
+mkavl_workers_take (mkavl_workers_handle workers_h)
+{
+    mkavl_worker_st *own_worker = mkavl_workers_own_queue(workers_h);
+    mkavl_task_st *task;
+    uint32_t i, queue_cnt = (workers_h->thread_cnt + 1);
+
+    if (0 == __atomic_load_n(&(workers_h->queued_cnt), __ATOMIC_ACQUIRE)) {
+        return (NULL);
+    }
+
+    task = mkavl_workers_pop(own_worker, true);
+    for (i = 1; (NULL == task) && (i < queue_cnt); ++i) {
+        task = mkavl_workers_pop(
+                   &(workers_h->worker_array[(own_worker->idx + i) %
+                                             queue_cnt]), false);
+    }
+
+    if (NULL != task) {
+        __atomic_sub_fetch(&(workers_h->queued_cnt), 1, __ATOMIC_ACQ_REL);
+    }
+
+    return (task);
+}
+
+/**
+ * Run a task and, if it was the last of its group, wake the threads waiting on
+ * the group.  The task and group may be gone once their count drops, so
+ * neither is touched after that.
+ *
+ * @param workers_h The pool.
+ * @param task The task.
+ */
+static void
+mkavl_workers_run (mkavl_workers_handle workers_h, mkavl_task_st *task)
+{
+    mkavl_task_group_st *group = task->group;
+
+    task->task_fn(task->task_context);
+
+    if (0 == __atomic_sub_fetch(&(group->pending_cnt), 1, __ATOMIC_ACQ_REL)) {
+        pthread_mutex_lock(&(workers_h->lock));
+        pthread_cond_broadcast(&(workers_h->cond));
+        pthread_mutex_unlock(&(workers_h->lock));
+    }
+}
+
+/**
+ * The body of a worker thread, which runs tasks until the pool is deleted.
+ *
+ * @param arg The mkavl_worker_st of the thread.
+ * @return NULL
+ */
+static void *
+mkavl_workers_main (void *arg)
+{
+    mkavl_worker_st *worker = arg;
+    mkavl_workers_handle workers_h = worker->workers;
+    mkavl_task_st *task;
+    bool stopping = false;
+
+    mkavl_workers_self = worker;
+    while (!stopping) {
+        task = mkavl_workers_take(workers_h);
+        if (NULL != task) {
+            mkavl_workers_run(workers_h, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&(workers_h->lock));
+        while (!workers_h->stopping &&
+               (0 == __atomic_load_n(&(workers_h->queued_cnt),
+                                     __ATOMIC_ACQUIRE))) {
+            pthread_cond_wait(&(workers_h->cond), &(workers_h->lock));
+        }
+        stopping = workers_h->stopping;
+        pthread_mutex_unlock(&(workers_h->lock));
+    }
+    mkavl_workers_self = NULL;
+
+    return (NULL);
+}
+
+/**
+ * Create a new pool of worker threads.  The pool may be given to any number of
+ * trees in their mkavl_opts_st.
+ *
+ * @param workers_h A pointer to the memory location for the new pool.
+ * @param thread_cnt The number of worker threads, at least one.  The threads
+ * that wait on tasks also run them, so the number of cores less one keeps
+ * every core busy.
+ * @param context An opaque context passed back to the allocator functions.
+ * @param allocator The memory allocation functions to use for the pool, or
+ * NULL if the default functions are to be used.  Typically the allocator of
+ * the trees that use the pool.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_workers_new (mkavl_workers_handle *workers_h, uint32_t thread_cnt,
+                   void *context, mkavl_allocator_st *allocator)
+{
+    mkavl_allocator_st *local_allocator;
+    mkavl_workers_handle local_workers_h;
+    mkavl_worker_st *worker;
+    size_t worker_array_size;
+    uint32_t i, started_cnt;
+
+    if ((NULL == workers_h) || (0 == thread_cnt)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    *workers_h = NULL;
+
+    local_allocator =
+        (NULL == allocator) ? &mkavl_workers_allocator_default : allocator;
+
+    local_workers_h = local_allocator->malloc_fn(sizeof(*local_workers_h),
+                                                 context);
+    if (NULL == local_workers_h) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(local_workers_h, 0, sizeof(*local_workers_h));
+    local_workers_h->context = context;
+    memcpy(&(local_workers_h->allocator), local_allocator,
+           sizeof(local_workers_h->allocator));
+
+    worker_array_size =
+        ((thread_cnt + 1) * sizeof(*(local_workers_h->worker_array)));
+    local_workers_h->worker_array =
+        local_allocator->malloc_fn(worker_array_size, context);
+    if (NULL == local_workers_h->worker_array) {
+        local_allocator->free_fn(local_workers_h, context);
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memset(local_workers_h->worker_array, 0, worker_array_size);
+
+    local_workers_h->magic = MKAVL_CTX_MAGIC;
+    local_workers_h->thread_cnt = thread_cnt;
+    pthread_mutex_init(&(local_workers_h->lock), NULL);
+    pthread_cond_init(&(local_workers_h->cond), NULL);
+    for (i = 0; i <= thread_cnt; ++i) {
+        worker = &(local_workers_h->worker_array[i]);
+        worker->workers = local_workers_h;
+        worker->idx = i;
+        pthread_mutex_init(&(worker->lock), NULL);
+    }
+
+    for (started_cnt = 0; started_cnt < thread_cnt; ++started_cnt) {
+        worker = &(local_workers_h->worker_array[started_cnt]);
+        if (0 != pthread_create(&(worker->thread), NULL, mkavl_workers_main,
+                                worker)) {
+            break;
+        }
+    }
+
+    if (started_cnt < thread_cnt) {
+        /* Stop the threads that did start and give up */
+        local_workers_h->thread_cnt = started_cnt;
+        mkavl_workers_delete(&local_workers_h);
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    *workers_h = local_workers_h;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Stop the worker threads of a pool and free it.  No task may be queued and no
+ * tree may still be using the pool.  Upon return, the workers_h memory is set
+ * to NULL.
+ *
+ * @param workers_h A pointer to the pool to free.
+ * @return The return code
+ */
+mkavl_rc_e
+mkavl_workers_delete (mkavl_workers_handle *workers_h)
+{
+    mkavl_workers_handle local_workers_h;
+    uint32_t i;
+
+    if ((NULL == workers_h) || !mkavl_workers_is_valid(*workers_h)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    local_workers_h = *workers_h;
+
+    pthread_mutex_lock(&(local_workers_h->lock));
+    local_workers_h->stopping = true;
+    pthread_cond_broadcast(&(local_workers_h->cond));
+    pthread_mutex_unlock(&(local_workers_h->lock));
+
+    for (i = 0; i < local_workers_h->thread_cnt; ++i) {
+        pthread_join(local_workers_h->worker_array[i].thread, NULL);
+    }
+
+    for (i = 0; i <= local_workers_h->thread_cnt; ++i) {
+        pthread_mutex_destroy(&(local_workers_h->worker_array[i].lock));
+    }
+    pthread_cond_destroy(&(local_workers_h->cond));
+    pthread_mutex_destroy(&(local_workers_h->lock));
+
+    local_workers_h->magic = MKAVL_CTX_STALE;
+    local_workers_h->allocator.free_fn(local_workers_h->worker_array,
+                                       local_workers_h->context);
+    local_workers_h->allocator.free_fn(local_workers_h,
+                                       local_workers_h->context);
+    *workers_h = NULL;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Get the number of worker threads of a pool.
+ *
+ * @param workers_h The pool.
+ * @return The number of worker threads, or zero if the pool is NULL or not
+ * valid.
+ */
+uint32_t
+mkavl_workers_count (mkavl_workers_handle workers_h)
+{
+    if (!mkavl_workers_is_valid(workers_h)) {
+        return (0);
+    }
+
+    return (workers_h->thread_cnt);
+}
+
+/**
+ * Spawn a task into a group.  A worker thread spawns onto its own queue and any
+ * other thread onto the queue shared by threads outside the pool.  The task
+ * may run on any thread before or during mkavl_workers_wait() on the group.
+ *
+ * @param workers_h The pool.  If NULL, the task is run before this returns.
+ * @param group The group, which must not be waited on by another thread yet.
+ * @param task The memory for the task.
+ * @param task_fn The work of the task.
+ * @param task_context The context given to task_fn.
+ */
+void
+mkavl_workers_spawn (mkavl_workers_handle workers_h, mkavl_task_group_st *group,
+                     mkavl_task_st *task, mkavl_task_fn task_fn,
+                     void *task_context)
+{
+    mkavl_worker_st *worker;
+
+    if (NULL == workers_h) {
+        task_fn(task_context);
+        return;
+    }
+    mkavl_assert_abort(mkavl_workers_is_valid(workers_h));
+
+    task->task_fn = task_fn;
+    task->task_context = task_context;
+    task->group = group;
+    task->newer = NULL;
+    __atomic_add_fetch(&(group->pending_cnt), 1, __ATOMIC_ACQ_REL);
+
+    worker = mkavl_workers_own_queue(workers_h);
+    pthread_mutex_lock(&(worker->lock));
+    task->older = worker->newest;
+    if (NULL != worker->newest) {
+        worker->newest->newer = task;
+    } else {
+        worker->oldest = task;
+    }
+    worker->newest = task;
+    pthread_mutex_unlock(&(worker->lock));
+
+    /* Whichever thread wakes runs this task or another one still queued */
+    pthread_mutex_lock(&(workers_h->lock));
+    __atomic_add_fetch(&(workers_h->queued_cnt), 1, __ATOMIC_ACQ_REL);
+    pthread_cond_signal(&(workers_h->cond));
+    pthread_mutex_unlock(&(workers_h->lock));
+}
+
+/**
+ * Wait until every task spawned into a group has run.  The waiting thread runs
+ * queued tasks, of this group or any other, while it waits.
+ *
+ * @param workers_h The pool given to mkavl_workers_spawn().
+ * @param group The group.  It may be used again once this returns.
+ */
+void
+mkavl_workers_wait (mkavl_workers_handle workers_h, mkavl_task_group_st *group)
+{
+    mkavl_task_st *task;
+
+    if (NULL == workers_h) {
+        return;
+    }
+    mkavl_assert_abort(mkavl_workers_is_valid(workers_h));
+
+    while (0 != __atomic_load_n(&(group->pending_cnt), __ATOMIC_ACQUIRE)) {
+        task = mkavl_workers_take(workers_h);
+        if (NULL != task) {
+            mkavl_workers_run(workers_h, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&(workers_h->lock));
+        while ((0 != __atomic_load_n(&(group->pending_cnt),
+                                     __ATOMIC_ACQUIRE)) &&
+               (0 == __atomic_load_n(&(workers_h->queued_cnt),
+                                     __ATOMIC_ACQUIRE))) {
+            pthread_cond_wait(&(workers_h->cond), &(workers_h->lock));
+        }
+        pthread_mutex_unlock(&(workers_h->lock));
+    }
+}
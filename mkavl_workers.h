@@ -0,0 +1,97 @@
+/**
+ * @file
+ * @author Matt Miller <matt@matthewjmiller.net>
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * This is the public interface for pools of worker threads that run fork-join
+ * tasks.  A task is spawned into a task group and mkavl_workers_wait() returns
+ * once every task of the group, and every task those tasks spawned into it,
+ * has run.  Each worker has its own queue of tasks: it runs the task it
+ * spawned last, while an idle worker steals the task spawned first from the
+ * queue of another, which for divide and conquer is the largest piece of work
+ * left.  A thread waiting on a group runs queued tasks rather than blocking.
+ *
+ * The tasks and groups are owned by the caller, so spawning never allocates
+ * and cannot fail.  Both must stay in place until the wait on the group
+ * returns.
+ */
+
+#ifndef __MKAVL_WORKERS_H__
+#define __MKAVL_WORKERS_H__
+
+#include "mkavl.h"
+
+/**
+ * Prototype for the work of a task.
+ *
+ * @param task_context The context given when the task was spawned.
+ */
+typedef void
+(*mkavl_task_fn)(void *task_context);
+
+/**
+ * A group of tasks that is waited on together.  Initialize it with
+ * MKAVL_TASK_GROUP_INIT.  The fields are private to the workers.
+ */
+typedef struct mkavl_task_group_st_ {
+    /** The number of tasks spawned into the group that have not yet run */
+    uint32_t pending_cnt;
+} mkavl_task_group_st;
+
+/** The initializer for a task group with no tasks */
+#define MKAVL_TASK_GROUP_INIT { 0 }
+
+/**
+ * A task spawned by mkavl_workers_spawn().  The fields are private to the
+ * workers.
+ */
+typedef struct mkavl_task_st_ {
+    /** The work of the task */
+    mkavl_task_fn task_fn;
+    /** The context given to task_fn */
+    void *task_context;
+    /** The group to which the task belongs */
+    mkavl_task_group_st *group;
+    /** The task spawned before this one on the same queue */
+    struct mkavl_task_st_ *older;
+    /** The task spawned after this one on the same queue */
+    struct mkavl_task_st_ *newer;
+} mkavl_task_st;
+
+/* APIs below are documented in their implementation file */
+
+extern mkavl_rc_e
+mkavl_workers_new(mkavl_workers_handle *workers_h, uint32_t thread_cnt,
+                  void *context, mkavl_allocator_st *allocator);
+
+extern mkavl_rc_e
+mkavl_workers_delete(mkavl_workers_handle *workers_h);
+
+extern uint32_t
+mkavl_workers_count(mkavl_workers_handle workers_h);
+
+extern void
+mkavl_workers_spawn(mkavl_workers_handle workers_h, mkavl_task_group_st *group,
+                    mkavl_task_st *task, mkavl_task_fn task_fn,
+                    void *task_context);
+
+extern void
+mkavl_workers_wait(mkavl_workers_handle workers_h, mkavl_task_group_st *group);
+
+#endif
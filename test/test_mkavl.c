@@ -50,7 +50,15 @@
 #include <errno.h>
 #include <time.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include "../mkavl.h"
+#include "../mkavl_sharded.h"
+#include "../mkavl_ranged.h"
+#include "../mkavl_workers.h"
+#include "../mkavl_mapped.h"
+#include "../mkavl_wal.h"
+#include "../mkavl_hist.h"
 
 /**
  * Display a failure message.
@@ -354,8 +362,74 @@ typedef struct mkavl_test_input_st_ {
     mkavl_tree_handle tree_h;
     /** A deep copy of the tree (is such a copy has been done) */
     mkavl_tree_handle tree_copy_h;
+    /** The options with which the tree is created */
+    const mkavl_opts_st *tree_opts;
+    /** The options with which the copy of the tree is created */
+    mkavl_opts_st copy_opts;
 } mkavl_test_input_st;
 
+/**
+ * Extract function for the custom test aggregate.
+ *
+ * @param item The item, a uint32_t.
+ * @param context The tree context.
+ * @return The value of the item.
+ */
+static int64_t
+mkavl_test_aggregate_extract (const void *item, void *context)
+{
+    return (*((const uint32_t *) item));
+}
+
+/**
+ * Combine function for the custom test aggregate, which keeps the first value
+ * in key order.  This checks that values are combined in order.
+ *
+ * @param value1 The first value.
+ * @param value2 The second value.
+ * @param context The tree context.
+ * @return The first value that is not the identity.
+ */
+static int64_t
+mkavl_test_aggregate_first (int64_t value1, int64_t value2, void *context)
+{
+    return ((-1 != value1) ? value1 : value2);
+}
+
+/**
+ * The aggregates for the ascending and descending keys: a sum for the first
+ * and the first item in key order for the second.
+ */
+static const mkavl_aggregate_st mkavl_test_aggregate_array[] = {
+    { .type = MKAVL_AGGREGATE_TYPE_E_SUM, .field_offset = 0,
+      .field_type = MKAVL_AGGREGATE_FIELD_E_U32 },
+    { .type = MKAVL_AGGREGATE_TYPE_E_CUSTOM,
+      .extract_fn = mkavl_test_aggregate_extract,
+      .combine_fn = mkavl_test_aggregate_first, .identity = -1 },
+};
+
+/** The tree options with which each run is repeated */
+static const mkavl_opts_st mkavl_test_tree_opts[] = {
+    { .intrusive_nodes = false, .pooled_nodes = false },
+    { .intrusive_nodes = true, .pooled_nodes = false,
+      .aggregate_array = mkavl_test_aggregate_array },
+    { .intrusive_nodes = false, .pooled_nodes = true,
+      .aggregate_array = mkavl_test_aggregate_array },
+    { .intrusive_nodes = true, .pooled_nodes = true,
+      .aggregate_array = mkavl_test_aggregate_array },
+    { .intrusive_nodes = false, .pooled_nodes = false,
+      .aggregate_array = mkavl_test_aggregate_array },
+    { .intrusive_nodes = true, .pooled_nodes = true,
+      .aggregate_array = mkavl_test_aggregate_array, .thread_safe = true },
+    { .intrusive_nodes = false, .pooled_nodes = false,
+      .thread_safe = true, .writer_preference = true },
+    { .intrusive_nodes = true, .lockless_reads = true,
+      .aggregate_array = mkavl_test_aggregate_array },
+    { .intrusive_nodes = false, .lockless_reads = true },
+    { .persistent = true, .aggregate_array = mkavl_test_aggregate_array },
+    { .persistent = true, .thread_safe = true },
+};
+
 /* 
  * Do a forward declaration so we can keep all the AVL setup stuff separate
  * below main().
@@ -363,6 +437,50 @@ typedef struct mkavl_test_input_st_ {
 static bool
 run_mkavl_test(mkavl_test_input_st *input);
 
+static bool
+mkavl_test_delete_large(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_workers(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_threads(const mkavl_opts_st *tree_opts, uint32_t seed);
+
+static bool
+mkavl_test_sharded_threads(const mkavl_opts_st *tree_opts);
+static bool
+mkavl_test_sharded_merge(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_ranged_threads(const mkavl_opts_st *tree_opts);
+static bool
+mkavl_test_ranged_merge_collision(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_wal(const mkavl_opts_st *tree_opts);
+static bool
+mkavl_test_wal_failure(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_stats(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_hist(void);
+
+static bool
+mkavl_test_trace(const mkavl_opts_st *tree_opts);
+static bool
+mkavl_test_trace_free(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_memory(const mkavl_opts_st *tree_opts);
+
+static bool
+mkavl_test_stale_handle(void);
+
+static bool
+mkavl_test_iter_change(const mkavl_opts_st *tree_opts);
+
 /**
  * Main function to test objects.
  */
@@ -372,13 +490,130 @@ main (int argc, char *argv[])
     test_mkavl_opts_st opts;
     bool was_success;
     uint32_t fail_count = 0;
-    uint32_t i;
+    uint32_t i, j;
     uint32_t cur_run, cur_seed, uniq_cnt;
     mkavl_test_input_st test_input = {0};
 
     parse_command_line(argc, argv, &opts);
 
     printf("\n");
+    was_success = mkavl_test_hist();
+    if (!was_success) {
+        printf("FAILURE: the histogram test has failed!!!\n");
+        ++fail_count;
+    }
+
+    was_success = mkavl_test_stale_handle();
+    if (!was_success) {
+        printf("FAILURE: the stale handle test has failed!!!\n");
+        ++fail_count;
+    }
+
+    for (j = 0; j < NELEMS(mkavl_test_tree_opts); ++j) {
+        was_success = mkavl_test_delete_large(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the large delete test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_workers(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the workers test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_sharded_threads(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the sharded threads test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_sharded_merge(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the sharded merge test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_ranged_threads(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the ranged threads test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success =
+            mkavl_test_ranged_merge_collision(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the ranged merge collision test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_wal(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the write-ahead log test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_wal_failure(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the write-ahead log failure test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_stats(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the stats test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_trace(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the trace test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_trace_free(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the trace free test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_memory(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the memory test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        was_success = mkavl_test_iter_change(&(mkavl_test_tree_opts[j]));
+        if (!was_success) {
+            printf("FAILURE: the iterator change test has failed for "
+                   "options %u!!!\n", j);
+            ++fail_count;
+        }
+
+        if (mkavl_test_tree_opts[j].thread_safe ||
+            mkavl_test_tree_opts[j].lockless_reads) {
+            was_success = mkavl_test_threads(&(mkavl_test_tree_opts[j]),
+                                             opts.seed);
+            if (!was_success) {
+                printf("FAILURE: the threads test has failed for "
+                       "options %u!!!\n", j);
+                ++fail_count;
+            }
+        }
+    }
+
     cur_seed = opts.seed;
     for (cur_run = 0; cur_run < opts.run_cnt; ++cur_run) {
         uint32_t insert_seq[opts.node_cnt];
@@ -423,13 +658,19 @@ main (int argc, char *argv[])
         test_input.uniq_cnt = uniq_cnt;
         test_input.dup_cnt = (opts.node_cnt - uniq_cnt);
         test_input.opts = &opts;
-        test_input.tree_h = NULL;
-        test_input.tree_copy_h = NULL;
 
-        was_success = run_mkavl_test(&test_input);
-        if (!was_success) {
-            printf("FAILURE: the test has failed for seed %u!!!\n", cur_seed);
-            ++fail_count;
+        for (j = 0; j < NELEMS(mkavl_test_tree_opts); ++j) {
+            test_input.tree_h = NULL;
+            test_input.tree_copy_h = NULL;
+            test_input.tree_opts = &(mkavl_test_tree_opts[j]);
+
+            was_success = run_mkavl_test(&test_input);
+            if (!was_success) {
+                printf("FAILURE: the test has failed for seed %u, "
+                       "options %u!!!\n", cur_seed, j);
+                ++fail_count;
+                break;
+            }
         }
 
         ++cur_seed;
@@ -464,6 +705,11 @@ typedef struct mkavl_test_ctx_st_ {
     uint32_t copy_malloc_cnt;
     /** A count for how many time mkavl_test_copy_free() was called */ 
     uint32_t copy_free_cnt;
+    /**
+     * The number of calls left to mkavl_test_failing_serialize_fn() until one
+     * fails, or 0 for none to fail
+     */
+    uint32_t serialize_fail_cnt;
 } mkavl_test_ctx_st;
 
 /**
@@ -675,8 +921,8 @@ mkavl_test_new (mkavl_test_input_st *input, mkavl_allocator_st *allocator)
     }
     ctx->magic = MKAVL_TEST_MAGIC;
 
-    rc = mkavl_new(&(input->tree_h), cmp_fn_array, NELEMS(cmp_fn_array),
-                   ctx, allocator);
+    rc = mkavl_new_opts(&(input->tree_h), cmp_fn_array, NELEMS(cmp_fn_array),
+                        ctx, allocator, input->tree_opts);
     if (mkavl_rc_e_is_notok(rc)) {
         LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
         return (false);
@@ -817,6 +1063,21 @@ mkavl_test_add (mkavl_test_input_st *input)
         return (false);
     }
 
+    /* Adding an item that is already in the tree must return it as is */
+    rc = mkavl_add(input->tree_h, &(input->insert_seq[0]),
+                   (void **) &existing_item);
+    if (mkavl_rc_e_is_notok(rc) ||
+        (existing_item != &(input->insert_seq[0]))) {
+        LOG_FAIL("re-add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    if (mkavl_count(input->tree_h) != input->uniq_cnt) {
+        LOG_FAIL("re-add changed count, mkavl_count(%u) uniq_cnt(%u)", 
+                 mkavl_count(input->tree_h), input->uniq_cnt);
+        return (false);
+    }
+
     return (true);
 }
 
@@ -1048,52 +1309,157 @@ mkavl_test_find (mkavl_test_input_st *input, mkavl_find_type_e type)
     return (true);
 }
 
+/** The number of random ranges to look up per key and direction */
+#define MKAVL_TEST_RANGE_CNT 10
+
 /**
- * Test mkavl_find() for error handling.
+ * Walk callback for mkavl_find_range() that counts the items and stops after a
+ * given number.
+ *
+ * @param item The current item.
+ * @param tree_context The context for the tree.
+ * @param walk_context Points to the number of items still to walk.
+ * @param stop_walk Set to true when no items are left to walk.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_find_range_cb (void *item, void *tree_context, void *walk_context,
+                          bool *stop_walk)
+{
+    uint32_t *remaining_cnt = (uint32_t *) walk_context;
+
+    if ((NULL == item) || (NULL == remaining_cnt) || (NULL == stop_walk) ||
+        (0 == *remaining_cnt)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    *stop_walk = (0 == --(*remaining_cnt));
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Test mkavl_find_range() and mkavl_find_range_array() against the expected
+ * items computed from the sorted sequence.
  *
  * @param input The input state for the test.
  * @return True if test passed.
  */
 static bool
-mkavl_test_find_error (mkavl_test_input_st *input)
+mkavl_test_find_range (mkavl_test_input_st *input)
 {
-    uint32_t *existing_item;
+    uint32_t *expected[input->uniq_cnt];
+    uint32_t *found[input->uniq_cnt];
+    uint32_t lo_val, hi_val, *lo, *hi, *val;
+    uint32_t i, j, trial, expected_cnt, limit, remaining_cnt;
+    bool lo_incl, hi_incl, descending;
+    mkavl_test_key_e key;
+    mkavl_test_ctx_st *ctx;
+    size_t found_cnt;
+    int32_t cmp;
     mkavl_rc_e rc;
 
-    rc = mkavl_find(NULL, MKAVL_FIND_TYPE_E_EQUAL, MKAVL_TEST_KEY_E_ASC,
-                    &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("NULL tree failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        return (false);
-    }
+    ctx = mkavl_get_tree_context(input->tree_h);
+
+    for (key = 0; key < MKAVL_TEST_KEY_E_MAX; ++key) {
+        for (trial = 0; trial < (2 * MKAVL_TEST_RANGE_CNT); ++trial) {
+            descending = (trial >= MKAVL_TEST_RANGE_CNT);
+            lo_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            hi_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            lo = (0 == (rand() % 5)) ? NULL : &lo_val;
+            hi = (0 == (rand() % 5)) ? NULL : &hi_val;
+            lo_incl = (0 != (rand() % 2));
+            hi_incl = (0 != (rand() % 2));
+
+            /* Gather the expected items in the order of the walk */
+            expected_cnt = 0;
+            for (i = 0; i < input->opts->node_cnt; ++i) {
+                j = i;
+                if ((MKAVL_TEST_KEY_E_DESC == key) != descending) {
+                    j = (input->opts->node_cnt - i - 1);
+                }
+                val = &(input->sorted_seq[j]);
+                if ((0 != expected_cnt) &&
+                    (*val == *(expected[expected_cnt - 1]))) {
+                    continue;
+                }
 
-    rc = mkavl_find(input->tree_h, (MKAVL_FIND_TYPE_E_MAX + 1), 
-                    MKAVL_TEST_KEY_E_ASC,
-                    &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Invalid type failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        return (false);
-    }
+                if (NULL != lo) {
+                    cmp = cmp_fn_array[key](val, lo, ctx);
+                    if ((cmp < 0) || ((0 == cmp) && !lo_incl)) {
+                        continue;
+                    }
+                }
+                if (NULL != hi) {
+                    cmp = cmp_fn_array[key](val, hi, ctx);
+                    if ((cmp > 0) || ((0 == cmp) && !hi_incl)) {
+                        continue;
+                    }
+                }
+                expected[expected_cnt++] = val;
+            }
 
-    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, 
-                    MKAVL_TEST_KEY_E_MAX,
-                    &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Invalid key index failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        return (false);
+            rc = mkavl_count_range(input->tree_h, key, lo, lo_incl, hi,
+                                   hi_incl, &found_cnt);
+            if (mkavl_rc_e_is_notok(rc) || (found_cnt != expected_cnt)) {
+                LOG_FAIL("count range is %zu, expected %u, rc(%s)",
+                         found_cnt, expected_cnt, mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+
+            limit = ((rand() % input->uniq_cnt) + 1);
+            rc = mkavl_find_range_array(input->tree_h, key, lo, lo_incl, hi,
+                                        hi_incl, descending, (void **) found,
+                                        limit, &found_cnt);
+            if (mkavl_rc_e_is_notok(rc)) {
+                LOG_FAIL("find range failed, rc(%s)",
+                         mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+
+            if (found_cnt != 
+                ((expected_cnt < limit) ? expected_cnt : limit)) {
+                LOG_FAIL("find range count %zu, expected %u limit %u",
+                         found_cnt, expected_cnt, limit);
+                return (false);
+            }
+
+            for (i = 0; i < found_cnt; ++i) {
+                if (*(found[i]) != *(expected[i])) {
+                    LOG_FAIL("find range item %u is %u, expected %u", i,
+                             *(found[i]), *(expected[i]));
+                    return (false);
+                }
+            }
+
+            /* The callback must see every item unless it stops the walk */
+            remaining_cnt = limit;
+            rc = mkavl_find_range(input->tree_h, key, lo, lo_incl, hi,
+                                  hi_incl, descending,
+                                  mkavl_test_find_range_cb, &remaining_cnt);
+            if (mkavl_rc_e_is_notok(rc) ||
+                (found_cnt != (limit - remaining_cnt))) {
+                LOG_FAIL("find range walk failed, rc(%s) walked %u",
+                         mkavl_rc_e_get_string(rc), (limit - remaining_cnt));
+                return (false);
+            }
+        }
     }
 
-    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL,
-                    MKAVL_TEST_KEY_E_ASC, NULL, (void **) &existing_item);
+    rc = mkavl_find_range(input->tree_h, MKAVL_TEST_KEY_E_MAX, NULL, false,
+                          NULL, false, false, mkavl_test_find_range_cb,
+                          &remaining_cnt);
     if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("NULL item failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        LOG_FAIL("find range with bad key succeeded");
         return (false);
     }
 
-    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL,
-                    MKAVL_TEST_KEY_E_ASC, &(input->insert_seq[0]), NULL);
+    rc = mkavl_find_range(input->tree_h, MKAVL_TEST_KEY_E_ASC, NULL, false,
+                          NULL, false, false, NULL, NULL);
     if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("NULL item failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        LOG_FAIL("find range with no callback succeeded");
         return (false);
     }
 
@@ -1101,149 +1467,196 @@ mkavl_test_find_error (mkavl_test_input_st *input)
 }
 
 /**
- * Test mkavl_remove_key() and mkavl_add_key().
+ * Test mkavl_rank(), mkavl_select() and mkavl_iter_select() against the
+ * unique items of the sorted sequence.
  *
  * @param input The input state for the test.
  * @return True if test passed.
  */
 static bool
-mkavl_test_add_remove_key (mkavl_test_input_st *input)
+mkavl_test_rank_select (mkavl_test_input_st *input)
 {
+    mkavl_iterator_handle iter_h = NULL;
+    uint32_t *uniq_array[input->uniq_cnt];
+    uint32_t *item, *expected_item;
+    mkavl_test_key_e key;
     uint32_t i, j;
-    uint32_t non_null_cnt, null_cnt;
-    uint32_t *existing_item;
+    size_t rank;
     mkavl_rc_e rc;
+    bool retval = true;
 
-    for (i = 0; i < MKAVL_TEST_KEY_E_MAX; ++i) {
-        /* Take them all out for one key */
-        non_null_cnt = 0;
-        for (j = 0; j < input->opts->node_cnt; ++j) {
-            rc = mkavl_remove_key_idx(input->tree_h, i, 
-                                      &(input->delete_seq[j]), 
-                                      (void **) &existing_item);
-            if (mkavl_rc_e_is_notok(rc)) {
-                LOG_FAIL("remove key idx failed, rc(%s)", 
-                         mkavl_rc_e_get_string(rc));
-                return (false);
-            }
+    for (i = 0, j = 0; i < input->opts->node_cnt; ++i) {
+        if ((0 == i) || (input->sorted_seq[i] != input->sorted_seq[i - 1])) {
+            uniq_array[j++] = &(input->sorted_seq[i]);
+        }
+    }
 
-            if (NULL != existing_item) {
-                ++non_null_cnt;
-            }
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_iter_new(&iter_h, input->tree_h, key);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            return (false);
+        }
 
-            rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, i,
-                            &(input->delete_seq[j]), (void **) &existing_item);
-            if (mkavl_rc_e_is_notok(rc)) {
-                LOG_FAIL("find failed, rc(%s)", mkavl_rc_e_get_string(rc));
-                return (false);
+        for (i = 0; i < input->uniq_cnt; ++i) {
+            j = (MKAVL_TEST_KEY_E_ASC == key) ? i : (input->uniq_cnt - i - 1);
+            expected_item = uniq_array[j];
+
+            rc = mkavl_select(input->tree_h, key, i, (void **) &item);
+            if (mkavl_rc_e_is_notok(rc) || (NULL == item) ||
+                (*item != *expected_item)) {
+                LOG_FAIL("select %u with key %u failed, rc(%s)", i, key,
+                         mkavl_rc_e_get_string(rc));
+                retval = false;
+                break;
             }
 
-            if (NULL != existing_item) {
-                LOG_FAIL("found item expected to be deleted, %u", 
-                         input->delete_seq[j]);
-                return (false);
+            rc = mkavl_rank(input->tree_h, key, expected_item, &rank);
+            if (mkavl_rc_e_is_notok(rc) || (rank != i)) {
+                LOG_FAIL("rank of %u with key %u is %zu, expected %u",
+                         *expected_item, key, rank, i);
+                retval = false;
+                break;
             }
 
-            rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, 
-                            mkavl_key_opposite[i],
-                            &(input->delete_seq[j]), (void **) &existing_item);
-            if (mkavl_rc_e_is_notok(rc)) {
-                LOG_FAIL("find failed, rc(%s)", mkavl_rc_e_get_string(rc));
-                return (false);
+            rc = mkavl_iter_select(iter_h, i, (void **) &item);
+            if (mkavl_rc_e_is_notok(rc) || (NULL == item) ||
+                (*item != *expected_item)) {
+                LOG_FAIL("iterator select %u with key %u failed, rc(%s)", i,
+                         key, mkavl_rc_e_get_string(rc));
+                retval = false;
+                break;
             }
 
-            if (NULL == existing_item) {
-                LOG_FAIL("did not find item, %u", input->delete_seq[j]);
-                return (false);
+            /* The iteration continues from the selected item */
+            mkavl_iter_next(iter_h, (void **) &item);
+            mkavl_select(input->tree_h, key, (i + 1), (void **) &expected_item);
+            if (item != expected_item) {
+                LOG_FAIL("next after select %u with key %u is %p, "
+                         "expected %p", i, key, item, expected_item);
+                retval = false;
+                break;
             }
         }
 
-        if (non_null_cnt != input->uniq_cnt) {
-            LOG_FAIL("unique check failed, non_null_cnt(%u) uniq_cnt(%u)", 
-                     non_null_cnt, input->uniq_cnt);
-            return (false);
+        rc = mkavl_select(input->tree_h, key, input->uniq_cnt, (void **) &item);
+        if (retval && (mkavl_rc_e_is_notok(rc) || (NULL != item))) {
+            LOG_FAIL("select past the end with key %u failed, rc(%s)", key,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
         }
 
-        /* Tree count should remain unchanged */
-        if (mkavl_count(input->tree_h) != input->uniq_cnt) {
-            LOG_FAIL("unique check failed, mkavl_count(%u) uniq_cnt(%u)", 
-                     mkavl_count(input->tree_h), input->uniq_cnt);
-            return (false);
-        }
+        mkavl_iter_delete(&iter_h);
+    }
 
-        /* Put them all back in for the key */
-        null_cnt = 0;
-        for (j = 0; j < input->opts->node_cnt; ++j) {
-            rc = mkavl_add_key_idx(input->tree_h, i, &(input->insert_seq[j]), 
-                                   (void **) &existing_item);
-            if (mkavl_rc_e_is_notok(rc)) {
-                LOG_FAIL("add key idx failed, rc(%s)", 
-                         mkavl_rc_e_get_string(rc));
-                return (false);
-            }
-
-            if (NULL == existing_item) {
-                ++null_cnt;
-            }
-        }
-
-        if (null_cnt != input->uniq_cnt) {
-            LOG_FAIL("unique check failed, null_cnt(%u) uniq_cnt(%u)", 
-                     null_cnt, input->uniq_cnt);
-            return (false);
-        }
-
-        /* Tree count should remain unchanged */
-        if (mkavl_count(input->tree_h) != input->uniq_cnt) {
-            LOG_FAIL("unique check failed, mkavl_count(%u) uniq_cnt(%u)", 
-                     mkavl_count(input->tree_h), input->uniq_cnt);
-            return (false);
-        }
-    }
-
-    return (true);
+    return (retval);
 }
 
 /**
- * Test mkavl_add_key() for error handling.
+ * Test mkavl_aggregate_range() against aggregates computed over the unique
+ * items of the sorted sequence.
  *
  * @param input The input state for the test.
  * @return True if test passed.
  */
 static bool
-mkavl_test_add_key_error (mkavl_test_input_st *input)
+mkavl_test_aggregate_range (mkavl_test_input_st *input)
 {
-    uint32_t *existing_item;
+    static const mkavl_aggregate_st bad_aggregate_array[] = {
+        { .type = MKAVL_AGGREGATE_TYPE_E_CUSTOM },
+        { .type = MKAVL_AGGREGATE_TYPE_E_NONE },
+    };
+    mkavl_opts_st bad_opts = { .aggregate_array = bad_aggregate_array };
+    mkavl_tree_handle bad_tree_h = NULL;
+    uint32_t lo_val, hi_val, *lo, *hi, *val, *prev;
+    uint32_t i, j, trial;
+    bool lo_incl, hi_incl;
+    mkavl_test_key_e key;
+    mkavl_test_ctx_st *ctx;
+    int64_t value, expected;
+    int32_t cmp;
     mkavl_rc_e rc;
 
-    rc = mkavl_add_key_idx(NULL, MKAVL_TEST_KEY_E_ASC,
-                           &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        return (false);
+    ctx = mkavl_get_tree_context(input->tree_h);
+
+    if (NULL == input->tree_opts->aggregate_array) {
+        rc = mkavl_aggregate_range(input->tree_h, MKAVL_TEST_KEY_E_ASC, NULL,
+                                   false, NULL, false, &value);
+        if (mkavl_rc_e_is_ok(rc)) {
+            LOG_FAIL("aggregate range without aggregates succeeded");
+            return (false);
+        }
+
+        return (true);
     }
 
-    rc = mkavl_add_key_idx(input->tree_h, MKAVL_TEST_KEY_E_MAX,
-                           &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        return (false);
+    for (key = 0; key < MKAVL_TEST_KEY_E_MAX; ++key) {
+        for (trial = 0; trial < (2 * MKAVL_TEST_RANGE_CNT); ++trial) {
+            lo_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            hi_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            lo = (0 == (rand() % 5)) ? NULL : &lo_val;
+            hi = (0 == (rand() % 5)) ? NULL : &hi_val;
+            lo_incl = (0 != (rand() % 2));
+            hi_incl = (0 != (rand() % 2));
+
+            /* Combine the unique items in the range in key order */
+            expected = (MKAVL_TEST_KEY_E_ASC == key) ? 0 : -1;
+            prev = NULL;
+            for (i = 0; i < input->opts->node_cnt; ++i) {
+                j = i;
+                if (MKAVL_TEST_KEY_E_DESC == key) {
+                    j = (input->opts->node_cnt - i - 1);
+                }
+                val = &(input->sorted_seq[j]);
+                if ((NULL != prev) && (*val == *prev)) {
+                    continue;
+                }
+                prev = val;
+
+                if (NULL != lo) {
+                    cmp = cmp_fn_array[key](val, lo, ctx);
+                    if ((cmp < 0) || ((0 == cmp) && !lo_incl)) {
+                        continue;
+                    }
+                }
+                if (NULL != hi) {
+                    cmp = cmp_fn_array[key](val, hi, ctx);
+                    if ((cmp > 0) || ((0 == cmp) && !hi_incl)) {
+                        continue;
+                    }
+                }
+
+                if (MKAVL_TEST_KEY_E_ASC == key) {
+                    expected += *val;
+                } else if (-1 == expected) {
+                    expected = *val;
+                }
+            }
+
+            rc = mkavl_aggregate_range(input->tree_h, key, lo, lo_incl, hi,
+                                       hi_incl, &value);
+            if (mkavl_rc_e_is_notok(rc) || (value != expected)) {
+                LOG_FAIL("aggregate range with key %u is %" PRId64
+                         ", expected %" PRId64 ", rc(%s)", key, value,
+                         expected, mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+        }
     }
 
-    rc = mkavl_add_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
-                           NULL, (void **) &existing_item);
+    rc = mkavl_aggregate_range(input->tree_h, MKAVL_TEST_KEY_E_MAX, NULL,
+                               false, NULL, false, &value);
     if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
+        LOG_FAIL("aggregate range with bad key succeeded");
         return (false);
     }
 
-    rc = mkavl_add_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
-                           &(input->insert_seq[0]), NULL);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
+    rc = mkavl_new_opts(&bad_tree_h, cmp_fn_array, NELEMS(cmp_fn_array),
+                        NULL, NULL, &bad_opts);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("new with bad aggregate gave rc(%s)",
                  mkavl_rc_e_get_string(rc));
         return (false);
     }
@@ -1252,118 +1665,187 @@ mkavl_test_add_key_error (mkavl_test_input_st *input)
 }
 
 /**
- * Test mkavl_remove_key() for error handling.
- *
- * @param input The input state for the test.
- * @return True if test passed.
+ * The context for mkavl_test_update_fn().
  */
-static bool
-mkavl_test_remove_key_error (mkavl_test_input_st *input)
-{
-    uint32_t *existing_item;
+typedef struct mkavl_test_update_ctx_st_ {
+    /** The value to give the item */
+    uint32_t new_val;
+    /** The value of the item before the change */
+    uint32_t old_val;
+    /** The return code to give, or success to change the item */
     mkavl_rc_e rc;
+} mkavl_test_update_ctx_st;
 
-    rc = mkavl_remove_key_idx(NULL, MKAVL_TEST_KEY_E_ASC,
-                           &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        return (false);
-    }
+/**
+ * Update callback to change the value of an item.
+ *
+ * @param item The item to change.
+ * @param undo If true, restore the old value.
+ * @param tree_context The tree context.
+ * @param update_context The mkavl_test_update_ctx_st.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_update_fn (void *item, bool undo, void *tree_context,
+                      void *update_context)
+{
+    mkavl_test_update_ctx_st *ctx = (mkavl_test_update_ctx_st *) update_context;
+    uint32_t *val = (uint32_t *) item;
 
-    rc = mkavl_remove_key_idx(input->tree_h, MKAVL_TEST_KEY_E_MAX,
-                           &(input->insert_seq[0]), (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        return (false);
+    if (undo) {
+        *val = ctx->old_val;
+        return (MKAVL_RC_E_SUCCESS);
     }
 
-    rc = mkavl_remove_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
-                           NULL, (void **) &existing_item);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        return (false);
+    if (mkavl_rc_e_is_notok(ctx->rc)) {
+        return (ctx->rc);
     }
 
-    rc = mkavl_remove_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
-                           &(input->insert_seq[0]), NULL);
-    if (mkavl_rc_e_is_ok(rc)) {
-        LOG_FAIL("Key index operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        return (false);
-    }
+    ctx->old_val = *val;
+    *val = ctx->new_val;
 
-    return (true);
+    return (MKAVL_RC_E_SUCCESS);
 }
 
 /**
- * The callback for mkavl_copy().
+ * Check that an item can be found by its value with every key.
  *
- * @param item The original item being copied.
- * @param context The context for the tree.
- * @return The item to place in the copied tree.
+ * @param input The input state for the test.
+ * @param item The item to look for.
+ * @return True if the item was found.
  */
-static void *
-mkavl_test_copy_fn (void *item, void *context)
+static bool
+mkavl_test_update_find (mkavl_test_input_st *input, uint32_t *item)
 {
-    mkavl_test_ctx_st *ctx;
-
-    ctx = (mkavl_test_ctx_st *) context;
+    uint32_t *found_item;
+    mkavl_test_key_e key;
+    mkavl_rc_e rc;
 
-    if ((NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
-        abort();
+    for (key = 0; key < MKAVL_TEST_KEY_E_MAX; ++key) {
+        rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, key, item,
+                        (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (found_item != item)) {
+            LOG_FAIL("item %u not found with key %u after update", *item,
+                     key);
+            return (false);
+        }
     }
-    ++(ctx->copy_cnt);
 
-    return (item);
+    return (true);
 }
 
 /**
- * Test mkavl_copy().
+ * Test mkavl_update() by changing random items to random values and back.  A
+ * change to a value already in the tree must be undone.
  *
  * @param input The input state for the test.
  * @return True if test passed.
  */
 static bool
-mkavl_test_copy (mkavl_test_input_st *input)
+mkavl_test_update (mkavl_test_input_st *input)
 {
+    mkavl_test_update_ctx_st ctx = { .rc = MKAVL_RC_E_SUCCESS };
+    uint32_t *item, *existing_item, *collision;
+    uint32_t old_val, lookup_val, trial;
+    int64_t sum_before, sum_after;
+    bool has_sum;
     mkavl_rc_e rc;
-    mkavl_test_ctx_st *ctx, *src_ctx;
 
-    src_ctx = mkavl_get_tree_context(input->tree_h);
-    if (NULL == src_ctx) {
-        LOG_FAIL("NULL context pointer");
-        return (false);
-    }
+    has_sum = (NULL != input->tree_opts->aggregate_array);
+    sum_before = sum_after = 0;
 
-    ctx = calloc(1, sizeof(*ctx));
-    if (NULL == ctx) {
-        LOG_FAIL("calloc failed");
-        return (false);
+    if (input->tree_opts->persistent) {
+        rc = mkavl_update(input->tree_h, input->tree_h, mkavl_test_update_fn,
+                          &ctx, (void **) &existing_item);
+        if (MKAVL_RC_E_EINVAL != rc) {
+            LOG_FAIL("update of persistent tree gave rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+        return (true);
     }
-    ctx->magic = MKAVL_TEST_MAGIC;
 
-    rc = mkavl_copy(input->tree_h,
-                    &(input->tree_copy_h),
-                    mkavl_test_copy_fn, NULL, false, ctx,
-                    mkavl_test_delete_context,
-                    &copy_allocator);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("copy failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        return (false);
+    for (trial = 0; trial < MKAVL_TEST_RANGE_CNT; ++trial) {
+        rc = mkavl_select(input->tree_h, MKAVL_TEST_KEY_E_ASC,
+                          (rand() % input->uniq_cnt), (void **) &item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL == item)) {
+            LOG_FAIL("select for update failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+        old_val = *item;
+        lookup_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+        mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL,
+                   MKAVL_TEST_KEY_E_ASC, &lookup_val, (void **) &collision);
+
+        if (has_sum) {
+            mkavl_aggregate_range(input->tree_h, MKAVL_TEST_KEY_E_ASC, NULL,
+                                  false, NULL, false, &sum_before);
+        }
+
+        ctx.new_val = lookup_val;
+        rc = mkavl_update(input->tree_h, item, mkavl_test_update_fn, &ctx,
+                          (void **) &existing_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("update of %u to %u failed, rc(%s)", old_val,
+                     lookup_val, mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+
+        if ((collision == item) || (NULL == collision)) {
+            /* The item must have moved to its new value */
+            if ((NULL != existing_item) || (*item != lookup_val) ||
+                !mkavl_test_update_find(input, item)) {
+                LOG_FAIL("update of %u to %u did not take", old_val,
+                         lookup_val);
+                return (false);
+            }
+        } else if ((existing_item != collision) || (*item != old_val)) {
+            LOG_FAIL("update of %u to %u was not undone", old_val,
+                     lookup_val);
+            return (false);
+        }
+
+        if (has_sum) {
+            mkavl_aggregate_range(input->tree_h, MKAVL_TEST_KEY_E_ASC, NULL,
+                                  false, NULL, false, &sum_after);
+            if ((sum_after - sum_before) != ((int64_t) *item - old_val)) {
+                LOG_FAIL("sum went from %" PRId64 " to %" PRId64 " updating "
+                         "%u to %u", sum_before, sum_after, old_val, *item);
+                return (false);
+            }
+        }
+
+        /* Put it back as it was */
+        ctx.new_val = old_val;
+        rc = mkavl_update(input->tree_h, item, mkavl_test_update_fn, &ctx,
+                          (void **) &existing_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != existing_item) ||
+            (*item != old_val) || !mkavl_test_update_find(input, item)) {
+            LOG_FAIL("update back to %u failed, rc(%s)", old_val,
+                     mkavl_rc_e_get_string(rc));
+            return (false);
+        }
     }
 
-    if (src_ctx->copy_cnt != input->uniq_cnt) {
-        LOG_FAIL("unexpected copy count, copy count %u "
-                 "unique count %u)", ctx->copy_cnt, input->uniq_cnt);
+    /* A failing callback leaves the tree alone */
+    ctx.rc = MKAVL_RC_E_ENOMEM;
+    ctx.new_val = (old_val + 1);
+    rc = mkavl_update(input->tree_h, item, mkavl_test_update_fn, &ctx,
+                      (void **) &existing_item);
+    if ((MKAVL_RC_E_ENOMEM != rc) || (*item != old_val) ||
+        !mkavl_test_update_find(input, item)) {
+        LOG_FAIL("failed update gave rc(%s)", mkavl_rc_e_get_string(rc));
         return (false);
     }
 
-    if (mkavl_count(input->tree_h) != mkavl_count(input->tree_copy_h)) {
-        LOG_FAIL("unequal count after copy, original %u copy %u)", 
-                 mkavl_count(input->tree_h), mkavl_count(input->tree_copy_h));
+    /* Only items in the tree may be updated */
+    lookup_val = old_val;
+    rc = mkavl_update(input->tree_h, &lookup_val, mkavl_test_update_fn, &ctx,
+                      (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("update of item not in tree succeeded");
         return (false);
     }
 
@@ -1371,387 +1853,5768 @@ mkavl_test_copy (mkavl_test_input_st *input)
 }
 
 /**
- * Test mkavl iterators.
+ * Test mkavl_find() for error handling.
  *
  * @param input The input state for the test.
  * @return True if test passed.
  */
 static bool
-mkavl_test_iterator (mkavl_test_input_st *input)
+mkavl_test_find_error (mkavl_test_input_st *input)
 {
-    mkavl_iterator_handle iter1_h = NULL, iter2_h = NULL;
-    mkavl_iterator_handle copy_iter1_h = NULL;
-    uint32_t last_idx = (input->opts->node_cnt - 1);
-    uint32_t *item, *copy_item, *cur_item, *prev_item, *found_item;
-    uint32_t idx;
+    uint32_t *existing_item;
     mkavl_rc_e rc;
-    bool retval = true;
 
-    /* 
-     * Iterate over both trees, make sure order is the same, everything is less
-     * than in one iterator and greater than in the other.
-     */
-    rc = mkavl_iter_new(&iter1_h, input->tree_h, MKAVL_TEST_KEY_E_ASC);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        retval = false;
-        goto cleanup;
+    rc = mkavl_find(NULL, MKAVL_FIND_TYPE_E_EQUAL, MKAVL_TEST_KEY_E_ASC,
+                    &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("NULL tree failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    rc = mkavl_iter_new(&iter2_h, input->tree_h, MKAVL_TEST_KEY_E_DESC);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        retval = false;
-        goto cleanup;
+    rc = mkavl_find(input->tree_h, (MKAVL_FIND_TYPE_E_MAX + 1), 
+                    MKAVL_TEST_KEY_E_ASC,
+                    &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Invalid type failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    rc = mkavl_iter_new(&copy_iter1_h, input->tree_copy_h,
-                        MKAVL_TEST_KEY_E_ASC);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        retval = false;
-        goto cleanup;
+    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, 
+                    MKAVL_TEST_KEY_E_MAX,
+                    &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Invalid key index failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    rc = mkavl_iter_last(iter1_h, (void **) &item);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("iterator operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        retval = false;
-        goto cleanup;
+    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL,
+                    MKAVL_TEST_KEY_E_ASC, NULL, (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("NULL item failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    if (*item != input->sorted_seq[last_idx]) {
-        LOG_FAIL("iterator item value mismatch, item %u array val %u",
-                 *item, input->sorted_seq[last_idx]);
-        retval = false;
-        goto cleanup;
+    rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL,
+                    MKAVL_TEST_KEY_E_ASC, &(input->insert_seq[0]), NULL);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("NULL item failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    rc = mkavl_iter_last(iter2_h, (void **) &item);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("iterator operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
-        retval = false;
-        goto cleanup;
-    }
+    return (true);
+}
 
-    if (*item != input->sorted_seq[0]) {
-        LOG_FAIL("iterator item value mismatch, item %u array val %u",
-                 *item, input->sorted_seq[0]);
-        retval = false;
-        goto cleanup;
+/**
+ * Test mkavl_remove_key() and mkavl_add_key().
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_add_remove_key (mkavl_test_input_st *input)
+{
+    uint32_t i, j;
+    uint32_t non_null_cnt, null_cnt;
+    uint32_t *existing_item;
+    mkavl_rc_e rc;
+
+    for (i = 0; i < MKAVL_TEST_KEY_E_MAX; ++i) {
+        /* Take them all out for one key */
+        non_null_cnt = 0;
+        for (j = 0; j < input->opts->node_cnt; ++j) {
+            rc = mkavl_remove_key_idx(input->tree_h, i, 
+                                      &(input->delete_seq[j]), 
+                                      (void **) &existing_item);
+            if (mkavl_rc_e_is_notok(rc)) {
+                LOG_FAIL("remove key idx failed, rc(%s)", 
+                         mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+
+            if (NULL != existing_item) {
+                ++non_null_cnt;
+            }
+
+            rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, i,
+                            &(input->delete_seq[j]), (void **) &existing_item);
+            if (mkavl_rc_e_is_notok(rc)) {
+                LOG_FAIL("find failed, rc(%s)", mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+
+            if (NULL != existing_item) {
+                LOG_FAIL("found item expected to be deleted, %u", 
+                         input->delete_seq[j]);
+                return (false);
+            }
+
+            rc = mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_EQUAL, 
+                            mkavl_key_opposite[i],
+                            &(input->delete_seq[j]), (void **) &existing_item);
+            if (mkavl_rc_e_is_notok(rc)) {
+                LOG_FAIL("find failed, rc(%s)", mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+
+            if (NULL == existing_item) {
+                LOG_FAIL("did not find item, %u", input->delete_seq[j]);
+                return (false);
+            }
+        }
+
+        if (non_null_cnt != input->uniq_cnt) {
+            LOG_FAIL("unique check failed, non_null_cnt(%u) uniq_cnt(%u)", 
+                     non_null_cnt, input->uniq_cnt);
+            return (false);
+        }
+
+        /* Tree count should remain unchanged */
+        if (mkavl_count(input->tree_h) != input->uniq_cnt) {
+            LOG_FAIL("unique check failed, mkavl_count(%u) uniq_cnt(%u)", 
+                     mkavl_count(input->tree_h), input->uniq_cnt);
+            return (false);
+        }
+
+        /* Put them all back in for the key */
+        null_cnt = 0;
+        for (j = 0; j < input->opts->node_cnt; ++j) {
+            rc = mkavl_add_key_idx(input->tree_h, i, &(input->insert_seq[j]), 
+                                   (void **) &existing_item);
+            if (mkavl_rc_e_is_notok(rc)) {
+                LOG_FAIL("add key idx failed, rc(%s)", 
+                         mkavl_rc_e_get_string(rc));
+                return (false);
+            }
+
+            if (NULL == existing_item) {
+                ++null_cnt;
+            }
+        }
+
+        if (null_cnt != input->uniq_cnt) {
+            LOG_FAIL("unique check failed, null_cnt(%u) uniq_cnt(%u)", 
+                     null_cnt, input->uniq_cnt);
+            return (false);
+        }
+
+        /* Tree count should remain unchanged */
+        if (mkavl_count(input->tree_h) != input->uniq_cnt) {
+            LOG_FAIL("unique check failed, mkavl_count(%u) uniq_cnt(%u)", 
+                     mkavl_count(input->tree_h), input->uniq_cnt);
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+/**
+ * Test mkavl_add_key() for error handling.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_add_key_error (mkavl_test_input_st *input)
+{
+    uint32_t *existing_item;
+    mkavl_rc_e rc;
+
+    rc = mkavl_add_key_idx(NULL, MKAVL_TEST_KEY_E_ASC,
+                           &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_add_key_idx(input->tree_h, MKAVL_TEST_KEY_E_MAX,
+                           &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_add_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
+                           NULL, (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_add_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
+                           &(input->insert_seq[0]), NULL);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Test mkavl_remove_key() for error handling.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_remove_key_error (mkavl_test_input_st *input)
+{
+    uint32_t *existing_item;
+    mkavl_rc_e rc;
+
+    rc = mkavl_remove_key_idx(NULL, MKAVL_TEST_KEY_E_ASC,
+                           &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_remove_key_idx(input->tree_h, MKAVL_TEST_KEY_E_MAX,
+                           &(input->insert_seq[0]), (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_remove_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
+                           NULL, (void **) &existing_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_remove_key_idx(input->tree_h, MKAVL_TEST_KEY_E_ASC,
+                           &(input->insert_seq[0]), NULL);
+    if (mkavl_rc_e_is_ok(rc)) {
+        LOG_FAIL("Key index operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * The callback for mkavl_copy().
+ *
+ * @param item The original item being copied.
+ * @param context The context for the tree.
+ * @return The item to place in the copied tree.
+ */
+static void *
+mkavl_test_copy_fn (void *item, void *context)
+{
+    mkavl_test_ctx_st *ctx;
+
+    ctx = (mkavl_test_ctx_st *) context;
+
+    if ((NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+    ++(ctx->copy_cnt);
+
+    return (item);
+}
+
+/**
+ * Test mkavl_copy().
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_copy (mkavl_test_input_st *input)
+{
+    mkavl_rc_e rc;
+    mkavl_test_ctx_st *ctx, *src_ctx;
+
+    src_ctx = mkavl_get_tree_context(input->tree_h);
+    if (NULL == src_ctx) {
+        LOG_FAIL("NULL context pointer");
+        return (false);
+    }
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (NULL == ctx) {
+        LOG_FAIL("calloc failed");
+        return (false);
+    }
+    ctx->magic = MKAVL_TEST_MAGIC;
+
+    /*
+     * Switch between pooled and unpooled nodes to cover both copy paths.  The
+     * nodes of a persistent tree are never pooled.
+     */
+    input->copy_opts = *(input->tree_opts);
+    input->copy_opts.pooled_nodes = (!input->tree_opts->pooled_nodes &&
+                                     !input->tree_opts->persistent);
+
+    rc = mkavl_copy_opts(input->tree_h,
+                         &(input->tree_copy_h),
+                         mkavl_test_copy_fn, NULL, false, ctx,
+                         mkavl_test_delete_context,
+                         &copy_allocator, &(input->copy_opts));
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("copy failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    if (src_ctx->copy_cnt != input->uniq_cnt) {
+        LOG_FAIL("unexpected copy count, copy count %u "
+                 "unique count %u)", ctx->copy_cnt, input->uniq_cnt);
+        return (false);
+    }
+
+    if (mkavl_count(input->tree_h) != mkavl_count(input->tree_copy_h)) {
+        LOG_FAIL("unequal count after copy, original %u copy %u)", 
+                 mkavl_count(input->tree_h), mkavl_count(input->tree_copy_h));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Copy function that gives each copy its own memory.
+ *
+ * @param item The item to copy.
+ * @param context The tree context.
+ * @return The copy, or NULL if it could not be allocated.
+ */
+static void *
+mkavl_test_copy_alloc_fn (void *item, void *context)
+{
+    uint32_t *copy;
+
+    copy = malloc(sizeof(*copy));
+    if (NULL != copy) {
+        *copy = *((uint32_t *) item);
+    }
+
+    return (copy);
+}
+
+/**
+ * Free an item made by mkavl_test_copy_alloc_fn().
+ *
+ * @param item The item to free.
+ * @param context The tree context.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_copy_free_fn (void *item, void *context)
+{
+    free(item);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Test that a copy holds the items, and the same copy of an item, in the order
+ * of the source for every key.
+ *
+ * @param input The input state for the test.
+ * @param is_deep Whether the copy function allocates new items, rather than
+ * there being no copy function.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_copy_items (mkavl_test_input_st *input, bool is_deep)
+{
+    mkavl_iterator_handle iter_h = NULL, src_iter_h = NULL;
+    mkavl_tree_handle copy_h;
+    uint32_t *item, *src_item, *found_item;
+    mkavl_test_key_e key;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    rc = mkavl_copy(input->tree_h, &copy_h,
+                    is_deep ? mkavl_test_copy_alloc_fn : NULL,
+                    is_deep ? mkavl_test_copy_free_fn : NULL, true, NULL,
+                    NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("copy failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_iter_new(&iter_h, copy_h, key);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_new(&src_iter_h, input->tree_h, key);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+            break;
+        }
+
+        mkavl_iter_first(iter_h, (void **) &item);
+        mkavl_iter_first(src_iter_h, (void **) &src_item);
+        while (retval && ((NULL != item) || (NULL != src_item))) {
+            if ((NULL == item) || (NULL == src_item) ||
+                ((item == src_item) == is_deep) || (*item != *src_item)) {
+                LOG_FAIL("copied tree differs for key %u", key);
+                retval = false;
+                break;
+            }
+
+            mkavl_find(copy_h, MKAVL_FIND_TYPE_E_EQUAL,
+                       mkavl_key_opposite[key], item, (void **) &found_item);
+            if (found_item != item) {
+                LOG_FAIL("keys of copied tree hold different copies of %u",
+                         *item);
+                retval = false;
+                break;
+            }
+            mkavl_iter_next(iter_h, (void **) &item);
+            mkavl_iter_next(src_iter_h, (void **) &src_item);
+        }
+
+        mkavl_iter_delete(&iter_h);
+        mkavl_iter_delete(&src_iter_h);
+    }
+
+    if (NULL != iter_h) {
+        mkavl_iter_delete(&iter_h);
+    }
+
+    mkavl_delete(&copy_h, is_deep ? mkavl_test_copy_free_fn : NULL, NULL);
+
+    return (retval);
+}
+
+/**
+ * Test the number of allocations done for the nodes of an item, using the
+ * copied tree since it has a counting allocator.  With pooled nodes, at most a
+ * new slab per pool may be allocated and nothing is freed until the tree is
+ * deleted.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_node_alloc (mkavl_test_input_st *input)
+{
+    uint32_t new_item = UINT32_MAX;
+    uint32_t malloc_cnt, free_cnt, expected_cnt, expected_free_cnt;
+    uint32_t *found_item;
+    mkavl_test_ctx_st *ctx;
+    mkavl_rc_e rc;
+
+    ctx = mkavl_get_tree_context(input->tree_copy_h);
+    malloc_cnt = ctx->copy_malloc_cnt;
+    free_cnt = ctx->copy_free_cnt;
+    expected_cnt = 
+        input->copy_opts.intrusive_nodes ? 1 : MKAVL_TEST_KEY_E_MAX;
+    expected_free_cnt = input->copy_opts.pooled_nodes ? 0 : expected_cnt;
+
+    rc = mkavl_add(input->tree_copy_h, &new_item, (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+        LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    if ((input->copy_opts.pooled_nodes &&
+         ((ctx->copy_malloc_cnt - malloc_cnt) > expected_cnt)) ||
+        (!input->copy_opts.pooled_nodes &&
+         ((ctx->copy_malloc_cnt - malloc_cnt) != expected_cnt))) {
+        LOG_FAIL("unexpected malloc count(%u), expected(%u)",
+                 (ctx->copy_malloc_cnt - malloc_cnt), expected_cnt);
+        return (false);
+    }
+
+    rc = mkavl_remove(input->tree_copy_h, &new_item, (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc) || (&new_item != found_item)) {
+        LOG_FAIL("remove failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    if ((ctx->copy_free_cnt - free_cnt) != expected_free_cnt) {
+        LOG_FAIL("unexpected free count(%u), expected(%u)",
+                 (ctx->copy_free_cnt - free_cnt), expected_free_cnt);
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Check that the bulk loaded tree holds the same items in the same order as
+ * the original tree for every key.
+ *
+ * @param input The input state for the test.
+ * @param tree_h The bulk loaded tree.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_bulk_load_compare (mkavl_test_input_st *input,
+                              mkavl_tree_handle tree_h)
+{
+    mkavl_iterator_handle iter_h = NULL, orig_iter_h = NULL;
+    uint32_t *item, *orig_item;
+    mkavl_test_key_e key;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    if (mkavl_count(tree_h) != input->uniq_cnt) {
+        LOG_FAIL("unexpected count after bulk load, count %u unique count %u",
+                 mkavl_count(tree_h), input->uniq_cnt);
+        return (false);
+    }
+
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_iter_new(&iter_h, tree_h, key);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_new(&orig_iter_h, input->tree_h, key);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+            break;
+        }
+
+        mkavl_iter_first(iter_h, (void **) &item);
+        mkavl_iter_first(orig_iter_h, (void **) &orig_item);
+        while ((NULL != item) || (NULL != orig_item)) {
+            if ((NULL == item) || (NULL == orig_item) ||
+                (*item != *orig_item)) {
+                LOG_FAIL("bulk loaded tree differs for key %u", key);
+                retval = false;
+                break;
+            }
+            mkavl_iter_next(iter_h, (void **) &item);
+            mkavl_iter_next(orig_iter_h, (void **) &orig_item);
+        }
+
+        mkavl_iter_delete(&iter_h);
+        mkavl_iter_delete(&orig_iter_h);
+    }
+
+    if (NULL != iter_h) {
+        mkavl_iter_delete(&iter_h);
+    }
+
+    return (retval);
+}
+
+/**
+ * Test mkavl_bulk_load().
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_bulk_load (mkavl_test_input_st *input)
+{
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st *ctx;
+    uint32_t *uniq_array[input->uniq_cnt];
+    uint32_t *item_array[input->opts->node_cnt];
+    uint32_t i, j;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (NULL == ctx) {
+        LOG_FAIL("calloc failed");
+        return (false);
+    }
+    ctx->magic = MKAVL_TEST_MAGIC;
+
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        NULL, input->tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        free(ctx);
+        return (false);
+    }
+
+    /* The unique items in ascending order */
+    for (i = 0, j = 0; i < input->opts->node_cnt; ++i) {
+        if ((0 == i) || (input->sorted_seq[i] != input->sorted_seq[i - 1])) {
+            uniq_array[j++] = &(input->sorted_seq[i]);
+        }
+    }
+
+    rc = mkavl_bulk_load(input->tree_h, (void **) uniq_array, input->uniq_cnt,
+                         false, 0);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("bulk load into non-empty tree failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_bulk_load(tree_h, (void **) uniq_array, input->uniq_cnt,
+                         true, MKAVL_TEST_KEY_E_MAX);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("bulk load with bad key failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    if (input->uniq_cnt > 1) {
+        /* Ascending order is not sorted by the descending key */
+        rc = mkavl_bulk_load(tree_h, (void **) uniq_array, input->uniq_cnt,
+                             true, MKAVL_TEST_KEY_E_DESC);
+        if ((MKAVL_RC_E_EINVAL != rc) || (0 != mkavl_count(tree_h))) {
+            LOG_FAIL("bulk load of unsorted items failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    if (0 != input->dup_cnt) {
+        for (i = 0; i < input->opts->node_cnt; ++i) {
+            item_array[i] = &(input->insert_seq[i]);
+        }
+        rc = mkavl_bulk_load(tree_h, (void **) item_array,
+                             input->opts->node_cnt, false, 0);
+        if ((MKAVL_RC_E_EINVAL != rc) || (0 != mkavl_count(tree_h))) {
+            LOG_FAIL("bulk load of duplicate items failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    rc = mkavl_bulk_load(tree_h, (void **) uniq_array, input->uniq_cnt,
+                         true, MKAVL_TEST_KEY_E_ASC);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sorted bulk load failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    retval = mkavl_test_bulk_load_compare(input, tree_h);
+    if (!retval) {
+        goto cleanup;
+    }
+
+    rc = mkavl_delete(&tree_h, NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("delete failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        NULL, input->tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* Rotate the items by half so they must be sorted for every key */
+    for (i = 0; i < input->uniq_cnt; ++i) {
+        item_array[i] = 
+            uniq_array[(i + (input->uniq_cnt / 2)) % input->uniq_cnt];
+    }
+
+    rc = mkavl_bulk_load(tree_h, (void **) item_array, input->uniq_cnt,
+                         false, 0);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("unsorted bulk load failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    retval = mkavl_test_bulk_load_compare(input, tree_h);
+
+cleanup:
+
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+    free(ctx);
+
+    return (retval);
+}
+
+/**
+ * Serialize function for mkavl_test_save_load(), which writes the value of an
+ * item.
+ *
+ * @param item The item to write.
+ * @param buf Where to write the bytes.
+ * @param buf_len The room in buf.
+ * @param item_len Set to the size of the value.
+ * @param context The tree context.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_serialize_fn (const void *item, void *buf, size_t buf_len,
+                         size_t *item_len, void *context)
+{
+    *item_len = sizeof(uint32_t);
+    if (buf_len >= *item_len) {
+        memcpy(buf, item, *item_len);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Serialize function for mkavl_test_save_load() that claims each item needs
+ * more bytes than a saved length can hold, writing nothing.
+ *
+ * @param item The item to write.
+ * @param buf Where to write the bytes.
+ * @param buf_len The room in buf.
+ * @param item_len Set to the claimed size.
+ * @param context The tree context.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_oversized_serialize_fn (const void *item, void *buf, size_t buf_len,
+                                   size_t *item_len, void *context)
+{
+    *item_len = SIZE_MAX;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Deserialize function for mkavl_test_save_load(), which gives each item its
+ * own memory to be freed by mkavl_test_copy_free_fn().
+ *
+ * @param buf The bytes of the item.
+ * @param buf_len The number of bytes.
+ * @param item Set to the new item.
+ * @param context The tree context.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_deserialize_fn (const void *buf, size_t buf_len, void **item,
+                           void *context)
+{
+    if (sizeof(uint32_t) != buf_len) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    *item = malloc(buf_len);
+    if (NULL == *item) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+    memcpy(*item, buf, buf_len);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/** The largest allocation made by the allocator of capped_allocator */
+#define MKAVL_TEST_CAPPED_MALLOC_MAX (1024 * 1024)
+
+/**
+ * The offset in a file saved by mkavl_save() of the item count, and after it
+ * the length of the first item.
+ */
+#define MKAVL_TEST_SAVE_ITEM_CNT_OFF 16
+
+/**
+ * The malloc function for the tree of mkavl_test_save_load() into which files
+ * with damaged counts are loaded, which fails anything large enough to be
+ * sized from the count rather than from what was read.
+ *
+ * @param size Size of memory to allocate.
+ * @param context The tree context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_test_capped_malloc (size_t size, void *context)
+{
+    if (size > MKAVL_TEST_CAPPED_MALLOC_MAX) {
+        return (NULL);
+    }
+
+    return (malloc(size));
+}
+
+/**
+ * The free function for the tree of mkavl_test_save_load() into which files
+ * with damaged counts are loaded.
+ *
+ * @param ptr The memory to free.
+ * @param context The tree context.
+ */
+static void
+mkavl_test_capped_free (void *ptr, void *context)
+{
+    free(ptr);
+}
+
+/**
+ * Allocators for the tree of mkavl_test_save_load() into which files with
+ * damaged counts are loaded.
+ */
+static mkavl_allocator_st capped_allocator = {
+    mkavl_test_capped_malloc,
+    mkavl_test_capped_free
+};
+
+/**
+ * Load a file whose 32-bit value at an offset has been overwritten, which
+ * must fail as damaged rather than for want of memory, and put the value
+ * back.
+ *
+ * @param tree_h The empty tree to load into, whose allocator is
+ * capped_allocator.
+ * @param fd The file saved by mkavl_save().
+ * @param off The offset of the value to overwrite.
+ * @param value The value to write.
+ * @return True if the load failed as it should.
+ */
+static bool
+mkavl_test_load_damaged_value (mkavl_tree_handle tree_h, int fd, off_t off,
+                               uint32_t value)
+{
+    uint32_t saved_value;
+    mkavl_rc_e rc;
+
+    if ((sizeof(saved_value) != pread(fd, &saved_value, sizeof(saved_value),
+                                      off)) ||
+        (sizeof(value) != pwrite(fd, &value, sizeof(value), off))) {
+        LOG_FAIL("damaging the value at %ld failed", (long) off);
+        return (false);
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    rc = mkavl_load(tree_h, fd, mkavl_test_deserialize_fn,
+                    mkavl_test_copy_free_fn);
+    pwrite(fd, &saved_value, sizeof(saved_value), off);
+    if ((MKAVL_RC_E_EINVAL != rc) || (0 != mkavl_count(tree_h))) {
+        LOG_FAIL("load with %u at %ld failed, rc(%s)", value, (long) off,
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Test mkavl_save() and mkavl_load(), including loads of damaged files.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_save_load (mkavl_test_input_st *input)
+{
+    mkavl_tree_handle tree_h = NULL, capped_h = NULL;
+    mkavl_test_ctx_st *ctx;
+    FILE *file;
+    off_t file_len;
+    uint8_t byte;
+    int fd;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (NULL == ctx) {
+        LOG_FAIL("calloc failed");
+        return (false);
+    }
+    ctx->magic = MKAVL_TEST_MAGIC;
+
+    file = tmpfile();
+    if (NULL == file) {
+        LOG_FAIL("tmpfile failed");
+        free(ctx);
+        return (false);
+    }
+    fd = fileno(file);
+
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        NULL, input->tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        fclose(file);
+        free(ctx);
+        return (false);
+    }
+
+    rc = mkavl_save(input->tree_h, fd, mkavl_test_serialize_fn);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("save failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    file_len = lseek(fd, 0, SEEK_CUR);
+
+    lseek(fd, 0, SEEK_SET);
+    rc = mkavl_load(input->tree_h, fd, mkavl_test_deserialize_fn,
+                    mkavl_test_copy_free_fn);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("load into non-empty tree failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* Huge counts in the header must not be allocated up front */
+    rc = mkavl_new_opts(&capped_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        &capped_allocator, input->tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new capped tree failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    if (!mkavl_test_load_damaged_value(capped_h, fd,
+                                       MKAVL_TEST_SAVE_ITEM_CNT_OFF,
+                                       UINT32_MAX)) {
+        retval = false;
+        goto cleanup;
+    }
+    if ((file_len > (MKAVL_TEST_SAVE_ITEM_CNT_OFF + 8)) &&
+        !mkavl_test_load_damaged_value(capped_h, fd,
+                                       (MKAVL_TEST_SAVE_ITEM_CNT_OFF + 4),
+                                       (UINT32_MAX - 16))) {
+        retval = false;
+        goto cleanup;
+    }
+
+    /* Flip a bit in the middle, which only the checksum may catch */
+    pread(fd, &byte, sizeof(byte), (file_len / 2));
+    byte ^= 0x10;
+    pwrite(fd, &byte, sizeof(byte), (file_len / 2));
+    lseek(fd, 0, SEEK_SET);
+    rc = mkavl_load(tree_h, fd, mkavl_test_deserialize_fn,
+                    mkavl_test_copy_free_fn);
+    if ((MKAVL_RC_E_EINVAL != rc) || (0 != mkavl_count(tree_h))) {
+        LOG_FAIL("load of damaged file failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    byte ^= 0x10;
+    pwrite(fd, &byte, sizeof(byte), (file_len / 2));
+
+    if (0 != ftruncate(fd, (file_len - 1))) {
+        LOG_FAIL("ftruncate failed");
+        retval = false;
+        goto cleanup;
+    }
+    lseek(fd, 0, SEEK_SET);
+    rc = mkavl_load(tree_h, fd, mkavl_test_deserialize_fn,
+                    mkavl_test_copy_free_fn);
+    if ((MKAVL_RC_E_EINVAL != rc) || (0 != mkavl_count(tree_h))) {
+        LOG_FAIL("load of truncated file failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* An item too large for its saved length is refused, not truncated */
+    lseek(fd, 0, SEEK_SET);
+    rc = mkavl_save(input->tree_h, fd, mkavl_test_oversized_serialize_fn);
+    if ((0 != mkavl_count(input->tree_h)) && (MKAVL_RC_E_EINVAL != rc)) {
+        LOG_FAIL("save of oversized item failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    rc = mkavl_save(input->tree_h, fd, mkavl_test_serialize_fn);
+    if (mkavl_rc_e_is_ok(rc)) {
+        lseek(fd, 0, SEEK_SET);
+        rc = mkavl_load(tree_h, fd, mkavl_test_deserialize_fn,
+                        mkavl_test_copy_free_fn);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("save and load failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    retval = mkavl_test_bulk_load_compare(input, tree_h);
+
+cleanup:
+
+    mkavl_delete(&capped_h, mkavl_test_copy_free_fn, NULL);
+    mkavl_delete(&tree_h, mkavl_test_copy_free_fn, NULL);
+    fclose(file);
+    free(ctx);
+
+    return (retval);
+}
+
+/**
+ * The items walked by mkavl_test_mapped_range_cb().
+ */
+typedef struct mkavl_test_mapped_range_st_ {
+    /** The items walked so far */
+    const uint32_t **found;
+    /** The number of items walked so far */
+    size_t found_cnt;
+    /** The size of found */
+    size_t found_max;
+} mkavl_test_mapped_range_st;
+
+/**
+ * Walk callback for mkavl_mapped_find_range() that gathers the items.
+ *
+ * @param item The current item.
+ * @param tree_context The context for the tree.
+ * @param walk_context The mkavl_test_mapped_range_st being filled.
+ * @param stop_walk Unused.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_mapped_range_cb (void *item, void *tree_context,
+                            void *walk_context, bool *stop_walk)
+{
+    mkavl_test_mapped_range_st *range =
+        (mkavl_test_mapped_range_st *) walk_context;
+
+    if ((NULL == item) || (range->found_cnt >= range->found_max)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+    range->found[range->found_cnt++] = item;
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Check whether an item of a tree and an item of a mapped tree are the same.
+ *
+ * @param item The item of the tree, or NULL.
+ * @param mapped_item The item of the mapped tree, or NULL.
+ * @return Whether both are NULL or both have the same value.
+ */
+static bool
+mkavl_test_mapped_same (const void *item, const void *mapped_item)
+{
+    if ((NULL == item) || (NULL == mapped_item)) {
+        return (item == mapped_item);
+    }
+
+    return (*((const uint32_t *) item) == *((const uint32_t *) mapped_item));
+}
+
+/**
+ * Test mkavl_save_mapped() and the mapped tree functions against the same
+ * operations on the tree that was saved.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_mapped (mkavl_test_input_st *input)
+{
+    mkavl_mapped_handle mapped_h = NULL;
+    mkavl_mapped_iterator_handle mapped_iter_h = NULL;
+    mkavl_iterator_handle iter_h = NULL;
+    mkavl_test_mapped_range_st range = { 0 };
+    mkavl_test_ctx_st *ctx;
+    mkavl_find_type_e type;
+    const uint32_t **found;
+    const void *mapped_item;
+    const uint32_t *lo, *hi;
+    uint32_t lookup, lo_val, hi_val, trial;
+    size_t key, i, found_cnt;
+    bool lo_incl, hi_incl, descending;
+    void *item;
+    FILE *file;
+    off_t file_len;
+    uint8_t byte;
+    int fd;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx = calloc(1, sizeof(*ctx));
+    found = calloc((input->opts->node_cnt + 1), sizeof(*found));
+    range.found = calloc((input->opts->node_cnt + 1), sizeof(*(range.found)));
+    range.found_max = (input->opts->node_cnt + 1);
+    file = tmpfile();
+    if ((NULL == ctx) || (NULL == found) || (NULL == range.found) ||
+        (NULL == file)) {
+        LOG_FAIL("allocation failed");
+        retval = false;
+        goto cleanup;
+    }
+    ctx->magic = MKAVL_TEST_MAGIC;
+    fd = fileno(file);
+
+    rc = mkavl_save_mapped(input->tree_h, fd, mkavl_test_serialize_fn);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_mapped_open(&mapped_h, fd, cmp_fn_array,
+                               NELEMS(cmp_fn_array), ctx);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_mapped_verify(mapped_h);
+    }
+    if (mkavl_rc_e_is_notok(rc) ||
+        (mkavl_mapped_count(mapped_h) != mkavl_count(input->tree_h))) {
+        LOG_FAIL("save mapped failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    file_len = lseek(fd, 0, SEEK_CUR);
+
+    for (key = 0; key < MKAVL_TEST_KEY_E_MAX; ++key) {
+        rc = mkavl_iter_new(&iter_h, input->tree_h, key);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_mapped_iter_new(&mapped_iter_h, mapped_h, key);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iterator new failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+
+        /* Walk both in order, then wrap from the null position to the last */
+        mkavl_iter_first(iter_h, &item);
+        mkavl_mapped_iter_first(mapped_iter_h, &mapped_item);
+        for (i = 0; retval; ++i) {
+            if (!mkavl_test_mapped_same(item, mapped_item)) {
+                LOG_FAIL("mapped item %zu of key %zu differs", i, key);
+                retval = false;
+            }
+            if (NULL == item) {
+                break;
+            }
+            mkavl_iter_next(iter_h, &item);
+            mkavl_mapped_iter_next(mapped_iter_h, &mapped_item);
+        }
+        mkavl_iter_prev(iter_h, &item);
+        mkavl_mapped_iter_prev(mapped_iter_h, &mapped_item);
+        if (retval && !mkavl_test_mapped_same(item, mapped_item)) {
+            LOG_FAIL("mapped last item of key %zu differs", key);
+            retval = false;
+        }
+        mkavl_iter_delete(&iter_h);
+        mkavl_mapped_iter_delete(&mapped_iter_h);
+        if (!retval) {
+            goto cleanup;
+        }
+
+        for (trial = 0; trial < (2 * MKAVL_TEST_RANGE_CNT); ++trial) {
+            lookup = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            for (type = MKAVL_FIND_TYPE_E_FIRST; type < MKAVL_FIND_TYPE_E_MAX;
+                 ++type) {
+                rc = mkavl_find(input->tree_h, type, key, &lookup, &item);
+                if (mkavl_rc_e_is_ok(rc)) {
+                    rc = mkavl_mapped_find(mapped_h, type, key, &lookup,
+                                           &mapped_item);
+                }
+                if (mkavl_rc_e_is_notok(rc) ||
+                    !mkavl_test_mapped_same(item, mapped_item)) {
+                    LOG_FAIL("mapped find type %u of %u differs, rc(%s)",
+                             type, lookup, mkavl_rc_e_get_string(rc));
+                    retval = false;
+                    goto cleanup;
+                }
+            }
+
+            descending = (trial >= MKAVL_TEST_RANGE_CNT);
+            lo_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            hi_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            lo = (0 == (rand() % 5)) ? NULL : &lo_val;
+            hi = (0 == (rand() % 5)) ? NULL : &hi_val;
+            lo_incl = (0 != (rand() % 2));
+            hi_incl = (0 != (rand() % 2));
+
+            range.found_cnt = 0;
+            rc = mkavl_find_range_array(input->tree_h, key, lo, lo_incl, hi,
+                                        hi_incl, descending, (void **) found,
+                                        (input->opts->node_cnt + 1),
+                                        &found_cnt);
+            if (mkavl_rc_e_is_ok(rc)) {
+                rc = mkavl_mapped_find_range(mapped_h, key, lo, lo_incl, hi,
+                                             hi_incl, descending,
+                                             mkavl_test_mapped_range_cb,
+                                             &range);
+            }
+            if (mkavl_rc_e_is_notok(rc) || (found_cnt != range.found_cnt)) {
+                LOG_FAIL("mapped find range count %zu, expected %zu, rc(%s)",
+                         range.found_cnt, found_cnt,
+                         mkavl_rc_e_get_string(rc));
+                retval = false;
+                goto cleanup;
+            }
+            for (i = 0; i < found_cnt; ++i) {
+                if (*(found[i]) != *(range.found[i])) {
+                    LOG_FAIL("mapped find range item %zu is %u, expected %u",
+                             i, *(range.found[i]), *(found[i]));
+                    retval = false;
+                    goto cleanup;
+                }
+            }
+        }
+    }
+    mkavl_mapped_close(&mapped_h);
+
+    /* Flip a bit in the middle, which only verifying may catch */
+    pread(fd, &byte, sizeof(byte), (file_len / 2));
+    byte ^= 0x10;
+    pwrite(fd, &byte, sizeof(byte), (file_len / 2));
+    rc = mkavl_mapped_open(&mapped_h, fd, cmp_fn_array, NELEMS(cmp_fn_array),
+                           ctx);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_mapped_verify(mapped_h);
+        mkavl_mapped_close(&mapped_h);
+    }
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("verify of damaged file failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    byte ^= 0x10;
+    pwrite(fd, &byte, sizeof(byte), (file_len / 2));
+
+    /* The footer is checked when the file is opened */
+    pread(fd, &byte, sizeof(byte), (file_len - 1));
+    byte ^= 0x10;
+    pwrite(fd, &byte, sizeof(byte), (file_len - 1));
+    rc = mkavl_mapped_open(&mapped_h, fd, cmp_fn_array, NELEMS(cmp_fn_array),
+                           ctx);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("open of damaged file failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+cleanup:
+
+    if (NULL != mapped_h) {
+        mkavl_mapped_close(&mapped_h);
+    }
+    if (NULL != file) {
+        fclose(file);
+    }
+    free(range.found);
+    free(found);
+    free(ctx);
+
+    return (retval);
+}
+
+/**
+ * Test mkavl iterators.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_iterator (mkavl_test_input_st *input)
+{
+    mkavl_iterator_handle iter1_h = NULL, iter2_h = NULL;
+    mkavl_iterator_handle copy_iter1_h = NULL;
+    uint32_t last_idx = (input->opts->node_cnt - 1);
+    uint32_t *item, *copy_item, *cur_item, *prev_item, *found_item;
+    uint32_t idx;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    /* 
+     * Iterate over both trees, make sure order is the same, everything is less
+     * than in one iterator and greater than in the other.
+     */
+    rc = mkavl_iter_new(&iter1_h, input->tree_h, MKAVL_TEST_KEY_E_ASC);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_new(&iter2_h, input->tree_h, MKAVL_TEST_KEY_E_DESC);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_new(&copy_iter1_h, input->tree_copy_h,
+                        MKAVL_TEST_KEY_E_ASC);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_last(iter1_h, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("iterator operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    if (*item != input->sorted_seq[last_idx]) {
+        LOG_FAIL("iterator item value mismatch, item %u array val %u",
+                 *item, input->sorted_seq[last_idx]);
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_last(iter2_h, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("iterator operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    if (*item != input->sorted_seq[0]) {
+        LOG_FAIL("iterator item value mismatch, item %u array val %u",
+                 *item, input->sorted_seq[0]);
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_first(iter2_h, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("iterator operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    if (*item != input->sorted_seq[last_idx]) {
+        LOG_FAIL("iterator item value mismatch, item %u array val %u",
+                 *item, input->sorted_seq[last_idx]);
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_first(iter1_h, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("iterator operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    if (*item != input->sorted_seq[0]) {
+        LOG_FAIL("iterator item value mismatch, item %u array val %u",
+                 *item, input->sorted_seq[0]);
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_iter_first(copy_iter1_h, (void **) &copy_item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("iterator operation failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    idx = 0;
+    prev_item = NULL;
+    while ((NULL != item) && (NULL != copy_item)) {
+        if (idx >= input->opts->node_cnt) {
+            LOG_FAIL("invalid idx(%u), node_cnt(%u)", idx,
+                     input->opts->node_cnt);
+            retval = false;
+            goto cleanup;
+        }
+
+        if (*item != *copy_item) {
+            LOG_FAIL("iterator has mismatch, item %u copy_item %u", *item,
+                     *copy_item);
+            retval = false;
+            goto cleanup;
+        }
+
+        if (*item != input->sorted_seq[idx]) {
+            LOG_FAIL("iterator has mismatch, item %u sorted_seq %u", *item,
+                     input->sorted_seq[idx]);
+            retval = false;
+            goto cleanup;
+        }
+
+        /* Go to the next unique value in the sorted array */
+        while ((idx < input->opts->node_cnt) &&
+               (*item == input->sorted_seq[idx])) {
+            ++idx;
+        }
+
+        /* Test the current function */
+        rc = mkavl_iter_cur(iter1_h, (void **) &cur_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iterator operation failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+
+        if (item != cur_item) {
+            LOG_FAIL("iterator has mismatch, item %p cur_item %p", item,
+                     cur_item);
+            retval = false;
+            goto cleanup;
+        }
+
+        /* Test previous */
+        rc = mkavl_iter_prev(iter1_h, (void **) &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iterator operation failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+
+        if (prev_item != item) {
+            LOG_FAIL("iterator has mismatch, item %p prev_item %p", item,
+                     prev_item);
+            retval = false;
+            goto cleanup;
+        }
+
+        /* Test find */
+        rc = mkavl_iter_find(iter1_h, cur_item, (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iterator operation failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+
+        if (found_item != cur_item) {
+            LOG_FAIL("iterator has mismatch, found_item %p cur_item %p", 
+                     found_item, cur_item);
+            retval = false;
+            goto cleanup;
+        }
+
+        rc = mkavl_iter_next(iter1_h, (void **) &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iterator operation failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+
+        rc = mkavl_iter_next(copy_iter1_h, (void **) &copy_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iterator operation failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+
+        prev_item = cur_item;
+    }
+
+    if (item != copy_item) {
+        LOG_FAIL("iterator has mismatch, item %p copy_item %p", item,
+                 copy_item);
+        retval = false;
+        goto cleanup;
+    }
+
+cleanup:
+
+    if (NULL != iter1_h) {
+        mkavl_iter_delete(&iter1_h);
+    }
+
+    if (NULL != iter2_h) {
+        mkavl_iter_delete(&iter2_h);
+    }
+
+    if (NULL != copy_iter1_h) {
+        mkavl_iter_delete(&copy_iter1_h);
+    }
+
+    return (retval);
+}
+
+/** The context for mkavl_walk() */
+typedef struct mkavl_test_walk_ctx_st_ {
+    /** Magic value for sanity check */
+    uint32_t magic;
+    /** A count of the number of nodes walked */
+    uint32_t walk_node_cnt;
+    /** Tells when the walk should be stopped */
+    uint32_t walk_stop_cnt;
+} mkavl_test_walk_ctx_st;
+
+/**
+ * Test mkavl_iter_seek() against mkavl_find() for every type of lookup, and
+ * make sure the iteration continues correctly from the item found.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_iter_seek (mkavl_test_input_st *input)
+{
+    mkavl_iterator_handle iter_h = NULL;
+    mkavl_find_type_e type;
+    mkavl_test_key_e key;
+    uint32_t i, lookup_val = 0;
+    uint32_t *item, *found_item, *expected_item;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_iter_new(&iter_h, input->tree_h, key);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+
+        for (i = 0; retval && (i < MKAVL_TEST_RANGE_CNT); ++i) {
+            lookup_val = ((rand() % (input->opts->range_end + 1)) +
+                          input->opts->range_start);
+            for (type = MKAVL_FIND_TYPE_E_FIRST; type < MKAVL_FIND_TYPE_E_MAX;
+                 ++type) {
+                expected_item = NULL;
+                rc = mkavl_iter_seek(iter_h, type, &lookup_val,
+                                     (void **) &found_item);
+                if (mkavl_rc_e_is_ok(rc)) {
+                    rc = mkavl_find(input->tree_h, type, key, &lookup_val,
+                                    (void **) &expected_item);
+                }
+                if (mkavl_rc_e_is_notok(rc) || (found_item != expected_item)) {
+                    LOG_FAIL("seek %s for %u with key %u found %p, "
+                             "expected %p", mkavl_find_type_e_get_string(type),
+                             lookup_val, key, found_item, expected_item);
+                    retval = false;
+                    break;
+                }
+
+                if (NULL == found_item) {
+                    continue;
+                }
+
+                /* The neighbors must follow without another lookup */
+                mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_GT, key,
+                           found_item, (void **) &expected_item);
+                mkavl_iter_next(iter_h, (void **) &item);
+                if (item != expected_item) {
+                    LOG_FAIL("next after seek for %u is %p, expected %p",
+                             lookup_val, item, expected_item);
+                    retval = false;
+                    break;
+                }
+
+                rc = mkavl_iter_seek(iter_h, type, &lookup_val,
+                                     (void **) &found_item);
+                mkavl_find(input->tree_h, MKAVL_FIND_TYPE_E_LT, key,
+                           found_item, (void **) &expected_item);
+                mkavl_iter_prev(iter_h, (void **) &item);
+                if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+                    LOG_FAIL("prev after seek for %u is %p, expected %p",
+                             lookup_val, item, expected_item);
+                    retval = false;
+                    break;
+                }
+            }
+        }
+
+        rc = mkavl_iter_seek(iter_h, MKAVL_FIND_TYPE_E_MAX, &lookup_val,
+                             (void **) &found_item);
+        if (retval && mkavl_rc_e_is_ok(rc)) {
+            LOG_FAIL("seek with bad type succeeded");
+            retval = false;
+        }
+
+        mkavl_iter_delete(&iter_h);
+    }
+
+    return (retval);
+}
+
+/** The number of shards for the sharded tree tests */
+#define MKAVL_TEST_SHARD_CNT 3
+
+/**
+ * The hash of the primary key of the test items for sharded trees.
+ *
+ * @param item The item, a uint32_t.
+ * @param context The tree context.
+ * @return The hash of the item.
+ */
+static uint64_t
+mkavl_test_shard_hash (const void *item, void *context)
+{
+    return (*((const uint32_t *) item) * 2654435761ULL);
+}
+
+/**
+ * The state for gathering the items walked by mkavl_sharded_find_range().
+ */
+typedef struct mkavl_test_sharded_range_st_ {
+    /** The array of items walked */
+    uint32_t **item_array;
+    /** The number of items walked */
+    uint32_t item_cnt;
+    /** The number of items after which to stop */
+    uint32_t limit;
+} mkavl_test_sharded_range_st;
+
+/**
+ * Walk callback for mkavl_sharded_find_range() that gathers the items.
+ *
+ * @param item The current item.
+ * @param tree_context The context for the tree.
+ * @param walk_context The mkavl_test_sharded_range_st being filled.
+ * @param stop_walk Set to true once the limit is reached.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_sharded_range_cb (void *item, void *tree_context,
+                             void *walk_context, bool *stop_walk)
+{
+    mkavl_test_sharded_range_st *range = walk_context;
+
+    if ((NULL == item) || (range->item_cnt >= range->limit)) {
+        return (MKAVL_RC_E_EINVAL);
+    }
+
+    range->item_array[(range->item_cnt)++] = item;
+    *stop_walk = (range->item_cnt >= range->limit);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Test a sharded tree against a plain tree holding the same items: lookups,
+ * merged iteration in both directions and range walks must give the same
+ * items.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_sharded (mkavl_test_input_st *input)
+{
+    mkavl_sharded_handle sharded_h = NULL;
+    mkavl_sharded_iterator_handle iter_h = NULL;
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_sharded_range_st range;
+    mkavl_test_ctx_st ctx = {0};
+    mkavl_find_type_e type;
+    mkavl_test_key_e key;
+    uint32_t *found[input->uniq_cnt];
+    uint32_t *expected[input->uniq_cnt];
+    uint32_t *item, *expected_item;
+    uint32_t i, trial, lo_val, hi_val, *lo, *hi;
+    bool lo_incl, hi_incl, descending;
+    size_t found_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_sharded_new(&sharded_h, MKAVL_TEST_SHARD_CNT,
+                           mkavl_test_shard_hash, cmp_fn_array,
+                           NELEMS(cmp_fn_array), &ctx, NULL,
+                           input->tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sharded new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_new(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    for (i = 0; i < input->opts->node_cnt; ++i) {
+        rc = mkavl_sharded_add(sharded_h, &(input->insert_seq[i]),
+                               (void **) &item);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_add(tree_h, &(input->insert_seq[i]),
+                           (void **) &expected_item);
+        }
+        if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+            LOG_FAIL("sharded add of %u found %p, expected %p, rc(%s)",
+                     input->insert_seq[i], item, expected_item,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    if (mkavl_sharded_count(sharded_h) != input->uniq_cnt) {
+        LOG_FAIL("sharded count(%u) != uniq count(%u)",
+                 mkavl_sharded_count(sharded_h), input->uniq_cnt);
+        retval = false;
+        goto cleanup;
+    }
+
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_sharded_iter_new(&iter_h, sharded_h, key);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("sharded iter new failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            break;
+        }
+
+        /* The shards must merge into the order of the plain tree */
+        rc = mkavl_find_range_array(tree_h, key, NULL, false, NULL, false,
+                                    false, (void **) expected,
+                                    input->uniq_cnt, &found_cnt);
+        mkavl_sharded_iter_first(iter_h, (void **) &item);
+        for (i = 0; mkavl_rc_e_is_ok(rc) && (i < found_cnt); ++i) {
+            if (item != expected[i]) {
+                LOG_FAIL("sharded item %u is %p, expected %p", i, item,
+                         expected[i]);
+                retval = false;
+                break;
+            }
+            mkavl_sharded_iter_next(iter_h, (void **) &item);
+        }
+        if (retval && (NULL != item)) {
+            LOG_FAIL("sharded iteration went past the last item");
+            retval = false;
+        }
+
+        mkavl_sharded_iter_last(iter_h, (void **) &item);
+        for (i = found_cnt; retval && (i > 0); --i) {
+            if (item != expected[i - 1]) {
+                LOG_FAIL("sharded item %u is %p, expected %p", (i - 1), item,
+                         expected[i - 1]);
+                retval = false;
+                break;
+            }
+            mkavl_sharded_iter_prev(iter_h, (void **) &item);
+        }
+
+        for (trial = 0; retval && (trial < MKAVL_TEST_RANGE_CNT); ++trial) {
+            lo_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            for (type = MKAVL_FIND_TYPE_E_FIRST; type < MKAVL_FIND_TYPE_E_MAX;
+                 ++type) {
+                rc = mkavl_find(tree_h, type, key, &lo_val,
+                                (void **) &expected_item);
+                if (mkavl_rc_e_is_ok(rc)) {
+                    rc = mkavl_sharded_find(sharded_h, type, key, &lo_val,
+                                            (void **) &item);
+                }
+                if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+                    LOG_FAIL("sharded find %s for %u with key %u found %p, "
+                             "expected %p", mkavl_find_type_e_get_string(type),
+                             lo_val, key, item, expected_item);
+                    retval = false;
+                    break;
+                }
+
+                rc = mkavl_sharded_iter_seek(iter_h, type, &lo_val,
+                                             (void **) &item);
+                if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+                    LOG_FAIL("sharded seek %s for %u with key %u found %p, "
+                             "expected %p", mkavl_find_type_e_get_string(type),
+                             lo_val, key, item, expected_item);
+                    retval = false;
+                    break;
+                }
+
+                if (NULL == item) {
+                    continue;
+                }
+
+                /* Turn around after the seek, in both directions */
+                mkavl_find(tree_h, MKAVL_FIND_TYPE_E_GT, key, item,
+                           (void **) &expected_item);
+                mkavl_sharded_iter_next(iter_h, (void **) &item);
+                if (item != expected_item) {
+                    LOG_FAIL("sharded next is %p, expected %p", item,
+                             expected_item);
+                    retval = false;
+                    break;
+                }
+
+                mkavl_sharded_iter_seek(iter_h, type, &lo_val,
+                                        (void **) &item);
+                mkavl_find(tree_h, MKAVL_FIND_TYPE_E_LT, key, item,
+                           (void **) &expected_item);
+                mkavl_sharded_iter_prev(iter_h, (void **) &item);
+                if (item != expected_item) {
+                    LOG_FAIL("sharded prev is %p, expected %p", item,
+                             expected_item);
+                    retval = false;
+                    break;
+                }
+            }
+        }
+
+        mkavl_sharded_iter_delete(&iter_h);
+
+        for (trial = 0; retval && (trial < (2 * MKAVL_TEST_RANGE_CNT));
+             ++trial) {
+            descending = (trial >= MKAVL_TEST_RANGE_CNT);
+            lo_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            hi_val = ((rand() % (input->opts->range_end + 1)) +
+                      input->opts->range_start);
+            lo = (0 == (rand() % 5)) ? NULL : &lo_val;
+            hi = (0 == (rand() % 5)) ? NULL : &hi_val;
+            lo_incl = (0 != (rand() % 2));
+            hi_incl = (0 != (rand() % 2));
+
+            range.item_array = found;
+            range.item_cnt = 0;
+            range.limit = ((rand() % input->uniq_cnt) + 1);
+            rc = mkavl_find_range_array(tree_h, key, lo, lo_incl, hi,
+                                        hi_incl, descending,
+                                        (void **) expected, range.limit,
+                                        &found_cnt);
+            if (mkavl_rc_e_is_ok(rc)) {
+                rc = mkavl_sharded_find_range(sharded_h, key, lo, lo_incl, hi,
+                                              hi_incl, descending,
+                                              mkavl_test_sharded_range_cb,
+                                              &range);
+            }
+            if (mkavl_rc_e_is_notok(rc) || (range.item_cnt != found_cnt) ||
+                (0 != memcmp(found, expected,
+                             (found_cnt * sizeof(found[0]))))) {
+                LOG_FAIL("sharded range walked %u items, expected %zu, "
+                         "rc(%s)", range.item_cnt, found_cnt,
+                         mkavl_rc_e_get_string(rc));
+                retval = false;
+            }
+        }
+    }
+
+    for (i = 0; retval && (i < input->opts->node_cnt); ++i) {
+        rc = mkavl_remove(tree_h, &(input->delete_seq[i]),
+                          (void **) &expected_item);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_sharded_remove(sharded_h, &(input->delete_seq[i]),
+                                      (void **) &item);
+        }
+        if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+            LOG_FAIL("sharded remove of %u found %p, expected %p, rc(%s)",
+                     input->delete_seq[i], item, expected_item,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
+    }
+
+    if (retval && (0 != mkavl_sharded_count(sharded_h))) {
+        LOG_FAIL("sharded count(%u) after removals",
+                 mkavl_sharded_count(sharded_h));
+        retval = false;
+    }
+
+cleanup:
+
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+
+    rc = mkavl_sharded_delete(&sharded_h, NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc) || (NULL != sharded_h)) {
+        LOG_FAIL("sharded delete failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    return (retval);
+}
+
+/** The split threshold for the ranged tree tests, small so splits happen */
+#define MKAVL_TEST_RANGED_SPLIT_CNT 4
+
+/** The merge threshold for the ranged tree tests */
+#define MKAVL_TEST_RANGED_MERGE_CNT 2
+
+/**
+ * Copy the primary key of a test item into a partition bound.
+ *
+ * @param item The item, a uint32_t.
+ * @param context The tree context.
+ * @return The new bound.
+ */
+static void *
+mkavl_test_ranged_bound_copy (void *item, void *context)
+{
+    mkavl_test_ctx_st *ctx = (mkavl_test_ctx_st *) context;
+    uint32_t *bound;
+
+    if ((NULL == item) || (NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+
+    bound = malloc(sizeof(*bound));
+    if (NULL != bound) {
+        *bound = *((uint32_t *) item);
+        ++(ctx->copy_malloc_cnt);
+    }
+
+    return (bound);
+}
+
+/**
+ * Free a partition bound made by mkavl_test_ranged_bound_copy().
+ *
+ * @param item The bound.
+ * @param context The tree context.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_ranged_bound_free (void *item, void *context)
+{
+    mkavl_test_ctx_st *ctx = (mkavl_test_ctx_st *) context;
+
+    if ((NULL == item) || (NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+
+    free(item);
+    ++(ctx->copy_free_cnt);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Test a ranged tree against a plain tree holding the same items: lookups,
+ * iteration across partitions in both directions and range walks must give the
+ * same items, while partitions are split and merged underneath.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_ranged (mkavl_test_input_st *input)
+{
+    mkavl_ranged_opts_st ranged_opts = {
+        .split_cnt = MKAVL_TEST_RANGED_SPLIT_CNT,
+        .merge_cnt = MKAVL_TEST_RANGED_MERGE_CNT,
+        .bound_copy_fn = mkavl_test_ranged_bound_copy,
+        .bound_free_fn = mkavl_test_ranged_bound_free,
+    };
+    mkavl_ranged_handle ranged_h = NULL;
+    mkavl_ranged_iterator_handle iter_h = NULL;
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_sharded_range_st range;
+    mkavl_test_ctx_st ctx = {0};
+    mkavl_opts_st tree_opts;
+    mkavl_find_type_e type;
+    mkavl_test_key_e key;
+    uint32_t *found[input->uniq_cnt];
+    uint32_t *expected[input->uniq_cnt];
+    uint32_t *item, *expected_item;
+    uint32_t i, trial, lo_val, hi_val, *lo, *hi;
+    bool lo_incl, hi_incl, descending;
+    size_t found_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    memcpy(&tree_opts, input->tree_opts, sizeof(tree_opts));
+
+    /* The routing table is always locked, so lockless reads are refused */
+    tree_opts.lockless_reads = true;
+    rc = mkavl_ranged_new(&ranged_h, &ranged_opts, cmp_fn_array,
+                          NELEMS(cmp_fn_array), &ctx, NULL, &tree_opts);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("ranged new with lockless reads gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+    tree_opts.lockless_reads = false;
+
+    rc = mkavl_ranged_new(&ranged_h, &ranged_opts, cmp_fn_array,
+                          NELEMS(cmp_fn_array), &ctx, NULL, &tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("ranged new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    rc = mkavl_new(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    for (i = 0; i < input->opts->node_cnt; ++i) {
+        rc = mkavl_ranged_add(ranged_h, &(input->insert_seq[i]),
+                              (void **) &item);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_add(tree_h, &(input->insert_seq[i]),
+                           (void **) &expected_item);
+        }
+        if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+            LOG_FAIL("ranged add of %u found %p, expected %p, rc(%s)",
+                     input->insert_seq[i], item, expected_item,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    if (mkavl_ranged_count(ranged_h) != input->uniq_cnt) {
+        LOG_FAIL("ranged count(%u) != uniq count(%u)",
+                 mkavl_ranged_count(ranged_h), input->uniq_cnt);
+        retval = false;
+        goto cleanup;
+    }
+
+    /* No partition may be left holding more than the split threshold */
+    if ((mkavl_ranged_partition_count(ranged_h) *
+         MKAVL_TEST_RANGED_SPLIT_CNT) < input->uniq_cnt) {
+        LOG_FAIL("ranged tree has only %zu partitions for %u items",
+                 mkavl_ranged_partition_count(ranged_h), input->uniq_cnt);
+        retval = false;
+        goto cleanup;
+    }
+
+    /* The iterator shares the routing table, so look items up before */
+    for (trial = 0; retval && (trial < MKAVL_TEST_RANGE_CNT); ++trial) {
+        lo_val = ((rand() % (input->opts->range_end + 1)) +
+                  input->opts->range_start);
+        for (type = MKAVL_FIND_TYPE_E_FIRST; retval &&
+             (type < MKAVL_FIND_TYPE_E_MAX); ++type) {
+            for (key = 0; key < MKAVL_TEST_KEY_E_MAX; ++key) {
+                rc = mkavl_find(tree_h, type, key, &lo_val,
+                                (void **) &expected_item);
+                if (mkavl_rc_e_is_ok(rc)) {
+                    rc = mkavl_ranged_find(ranged_h, type, key, &lo_val,
+                                           (void **) &item);
+                }
+                if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+                    LOG_FAIL("ranged find %s for %u with key %u found %p, "
+                             "expected %p", mkavl_find_type_e_get_string(type),
+                             lo_val, key, item, expected_item);
+                    retval = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    rc = mkavl_ranged_iter_new(&iter_h, ranged_h);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("ranged iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_find_range_array(tree_h, MKAVL_TEST_KEY_E_ASC, NULL, false,
+                                NULL, false, false, (void **) expected,
+                                input->uniq_cnt, &found_cnt);
+    mkavl_ranged_iter_first(iter_h, (void **) &item);
+    for (i = 0; mkavl_rc_e_is_ok(rc) && (i < found_cnt); ++i) {
+        if (item != expected[i]) {
+            LOG_FAIL("ranged item %u is %p, expected %p", i, item,
+                     expected[i]);
+            retval = false;
+            break;
+        }
+        mkavl_ranged_iter_next(iter_h, (void **) &item);
+    }
+    if (retval && (NULL != item)) {
+        LOG_FAIL("ranged iteration went past the last item");
+        retval = false;
+    }
+
+    mkavl_ranged_iter_last(iter_h, (void **) &item);
+    for (i = found_cnt; retval && (i > 0); --i) {
+        if (item != expected[i - 1]) {
+            LOG_FAIL("ranged item %u is %p, expected %p", (i - 1), item,
+                     expected[i - 1]);
+            retval = false;
+            break;
+        }
+        mkavl_ranged_iter_prev(iter_h, (void **) &item);
+    }
+    if (retval && (NULL != item)) {
+        LOG_FAIL("ranged iteration went past the first item");
+        retval = false;
+    }
+
+    for (trial = 0; retval && (trial < MKAVL_TEST_RANGE_CNT); ++trial) {
+        lo_val = ((rand() % (input->opts->range_end + 1)) +
+                  input->opts->range_start);
+        for (type = MKAVL_FIND_TYPE_E_FIRST; type < MKAVL_FIND_TYPE_E_MAX;
+             ++type) {
+            mkavl_find(tree_h, type, MKAVL_TEST_KEY_E_ASC, &lo_val,
+                       (void **) &expected_item);
+            rc = mkavl_ranged_iter_seek(iter_h, type, &lo_val,
+                                        (void **) &item);
+            if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+                LOG_FAIL("ranged seek %s for %u found %p, expected %p",
+                         mkavl_find_type_e_get_string(type), lo_val, item,
+                         expected_item);
+                retval = false;
+                break;
+            }
+
+            if (NULL == item) {
+                continue;
+            }
+
+            /* Step off the seek in both directions */
+            mkavl_find(tree_h, MKAVL_FIND_TYPE_E_GT, MKAVL_TEST_KEY_E_ASC,
+                       item, (void **) &expected_item);
+            mkavl_ranged_iter_next(iter_h, (void **) &item);
+            if (item != expected_item) {
+                LOG_FAIL("ranged next is %p, expected %p", item,
+                         expected_item);
+                retval = false;
+                break;
+            }
+
+            mkavl_ranged_iter_seek(iter_h, type, &lo_val, (void **) &item);
+            mkavl_find(tree_h, MKAVL_FIND_TYPE_E_LT, MKAVL_TEST_KEY_E_ASC,
+                       item, (void **) &expected_item);
+            mkavl_ranged_iter_prev(iter_h, (void **) &item);
+            if (item != expected_item) {
+                LOG_FAIL("ranged prev is %p, expected %p", item,
+                         expected_item);
+                retval = false;
+                break;
+            }
+        }
+    }
+
+    mkavl_ranged_iter_delete(&iter_h);
+
+    for (trial = 0; retval && (trial < (2 * MKAVL_TEST_RANGE_CNT)); ++trial) {
+        descending = (trial >= MKAVL_TEST_RANGE_CNT);
+        lo_val = ((rand() % (input->opts->range_end + 1)) +
+                  input->opts->range_start);
+        hi_val = ((rand() % (input->opts->range_end + 1)) +
+                  input->opts->range_start);
+        lo = (0 == (rand() % 5)) ? NULL : &lo_val;
+        hi = (0 == (rand() % 5)) ? NULL : &hi_val;
+        lo_incl = (0 != (rand() % 2));
+        hi_incl = (0 != (rand() % 2));
+
+        range.item_array = found;
+        range.item_cnt = 0;
+        range.limit = ((rand() % input->uniq_cnt) + 1);
+        rc = mkavl_find_range_array(tree_h, MKAVL_TEST_KEY_E_ASC, lo, lo_incl,
+                                    hi, hi_incl, descending,
+                                    (void **) expected, range.limit,
+                                    &found_cnt);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_ranged_find_range(ranged_h, lo, lo_incl, hi, hi_incl,
+                                         descending,
+                                         mkavl_test_sharded_range_cb, &range);
+        }
+        if (mkavl_rc_e_is_notok(rc) || (range.item_cnt != found_cnt) ||
+            (0 != memcmp(found, expected, (found_cnt * sizeof(found[0]))))) {
+            LOG_FAIL("ranged range walked %u items, expected %zu, rc(%s)",
+                     range.item_cnt, found_cnt, mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
+    }
+
+    for (i = 0; retval && (i < input->opts->node_cnt); ++i) {
+        rc = mkavl_remove(tree_h, &(input->delete_seq[i]),
+                          (void **) &expected_item);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_ranged_remove(ranged_h, &(input->delete_seq[i]),
+                                     (void **) &item);
+        }
+        if (mkavl_rc_e_is_notok(rc) || (item != expected_item)) {
+            LOG_FAIL("ranged remove of %u found %p, expected %p, rc(%s)",
+                     input->delete_seq[i], item, expected_item,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
+    }
+
+    /* Emptied partitions are always merged away */
+    if (retval && ((0 != mkavl_ranged_count(ranged_h)) ||
+                   (1 != mkavl_ranged_partition_count(ranged_h)))) {
+        LOG_FAIL("ranged count(%u) with %zu partitions after removals",
+                 mkavl_ranged_count(ranged_h),
+                 mkavl_ranged_partition_count(ranged_h));
+        retval = false;
+    }
+
+cleanup:
+
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+
+    rc = mkavl_ranged_delete(&ranged_h, NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc) || (NULL != ranged_h)) {
+        LOG_FAIL("ranged delete failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    if (ctx.copy_malloc_cnt != ctx.copy_free_cnt) {
+        LOG_FAIL("ranged bounds copied(%u) != freed(%u)", ctx.copy_malloc_cnt,
+                 ctx.copy_free_cnt);
+        retval = false;
+    }
+
+    return (retval);
+}
+
+/** The number of times the writer of mkavl_test_snapshot() empties the tree */
+#define MKAVL_TEST_SNAPSHOT_ROUND_CNT 20
+
+/**
+ * The state of the writer thread of mkavl_test_snapshot().
+ */
+typedef struct mkavl_test_snapshot_thread_st_ {
+    /** The tree being changed */
+    mkavl_tree_handle tree_h;
+    /** The items of the tree */
+    uint32_t **item_array;
+    /** The number of items in item_array */
+    uint32_t item_cnt;
+    /** Set if the thread saw something wrong */
+    bool failed;
+} mkavl_test_snapshot_thread_st;
+
+/**
+ * Gather the items of a tree in ascending order.
+ *
+ * @param tree_h The tree.
+ * @param item_array Filled in with the items, which must have room for them.
+ * @param item_cnt Set to the number of items.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_snapshot_items (mkavl_tree_handle tree_h, uint32_t **item_array,
+                           uint32_t *item_cnt)
+{
+    mkavl_iterator_handle iter_h;
+    uint32_t *item;
+    mkavl_rc_e rc;
+
+    *item_cnt = 0;
+    rc = mkavl_iter_new(&iter_h, tree_h, MKAVL_TEST_KEY_E_ASC);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    mkavl_iter_first(iter_h, (void **) &item);
+    while (NULL != item) {
+        item_array[(*item_cnt)++] = item;
+        mkavl_iter_next(iter_h, (void **) &item);
+    }
+    mkavl_iter_delete(&iter_h);
+
+    return (true);
+}
+
+/**
+ * Check that a tree holds exactly the given items, in order by every key.
+ *
+ * @param tree_h The tree.
+ * @param item_array The items in ascending order.
+ * @param item_cnt The number of items in item_array.
+ * @param has_sum Whether the ascending key keeps a sum to check as well.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_snapshot_check (mkavl_tree_handle tree_h, uint32_t **item_array,
+                           uint32_t item_cnt, bool has_sum)
+{
+    mkavl_iterator_handle iter_h;
+    mkavl_test_key_e key;
+    uint32_t *item, *expected, i;
+    int64_t sum, expected_sum = 0;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    if (mkavl_count(tree_h) != item_cnt) {
+        LOG_FAIL("count %u, expected %u", mkavl_count(tree_h), item_cnt);
+        return (false);
+    }
+
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_iter_new(&iter_h, tree_h, key);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+
+        mkavl_iter_first(iter_h, (void **) &item);
+        for (i = 0; i < item_cnt; ++i) {
+            expected = (MKAVL_TEST_KEY_E_ASC == key) ?
+                item_array[i] : item_array[item_cnt - i - 1];
+            if (expected != item) {
+                LOG_FAIL("item %u differs for key %u", i, key);
+                retval = false;
+                break;
+            }
+            mkavl_iter_next(iter_h, (void **) &item);
+        }
+        if (retval && (NULL != item)) {
+            LOG_FAIL("extra item %u for key %u", *item, key);
+            retval = false;
+        }
+        mkavl_iter_delete(&iter_h);
+    }
+
+    if (retval && has_sum) {
+        for (i = 0; i < item_cnt; ++i) {
+            expected_sum += *(item_array[i]);
+        }
+        mkavl_aggregate_range(tree_h, MKAVL_TEST_KEY_E_ASC, NULL, false, NULL,
+                              false, &sum);
+        if (sum != expected_sum) {
+            LOG_FAIL("sum %" PRId64 ", expected %" PRId64, sum,
+                     expected_sum);
+            retval = false;
+        }
+    }
+
+    return (retval);
+}
+
+/**
+ * The writer thread of mkavl_test_snapshot(), which repeatedly removes every
+ * item from the tree and adds them back.
+ *
+ * @param arg The thread state.
+ * @return NULL
+ */
+static void *
+mkavl_test_snapshot_writer (void *arg)
+{
+    mkavl_test_snapshot_thread_st *thread = arg;
+    uint32_t *item, round, i;
+    mkavl_rc_e rc;
+
+    for (round = 0; round < MKAVL_TEST_SNAPSHOT_ROUND_CNT; ++round) {
+        for (i = 0; i < thread->item_cnt; ++i) {
+            rc = mkavl_remove(thread->tree_h, thread->item_array[i],
+                              (void **) &item);
+            if (mkavl_rc_e_is_notok(rc) || (thread->item_array[i] != item)) {
+                thread->failed = true;
+            }
+        }
+        for (i = 0; i < thread->item_cnt; ++i) {
+            rc = mkavl_add(thread->tree_h, thread->item_array[i],
+                           (void **) &item);
+            if (mkavl_rc_e_is_notok(rc) || (NULL != item)) {
+                thread->failed = true;
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+/**
+ * Test mkavl_snapshot() and the copies of persistent trees that share nodes.
+ * The snapshot, a copy and the tree are each changed and checked against the
+ * items they should hold.  For a thread safe tree, the snapshot is also read
+ * while another thread changes the tree.  The tree holds the same items
+ * afterwards.
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_snapshot (mkavl_test_input_st *input)
+{
+    mkavl_tree_handle snapshot_h = NULL, later_h = NULL, copy_h = NULL;
+    uint32_t *before_array[mkavl_count(input->tree_h) + 1];
+    uint32_t *after_array[mkavl_count(input->tree_h) + 1];
+    uint32_t *removed_array[mkavl_count(input->tree_h) + 1];
+    uint32_t before_cnt, after_cnt, removed_cnt = 0, i;
+    uint32_t extra_item = UINT32_MAX;
+    mkavl_test_snapshot_thread_st thread;
+    uint32_t *item;
+    pthread_t tid;
+    bool has_sum, retval = false;
+    mkavl_rc_e rc;
+
+    rc = mkavl_snapshot(input->tree_h, &snapshot_h);
+    if (!input->tree_opts->persistent) {
+        if (MKAVL_RC_E_EINVAL != rc) {
+            LOG_FAIL("snapshot of tree that is not persistent gave rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+        return (true);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("snapshot failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    has_sum = (NULL != input->tree_opts->aggregate_array);
+    if (!mkavl_test_snapshot_items(input->tree_h, before_array, &before_cnt)) {
+        goto cleanup;
+    }
+
+    rc = mkavl_copy(input->tree_h, &copy_h, NULL, NULL, true, NULL, NULL,
+                    NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("copy failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        goto cleanup;
+    }
+
+    /* A snapshot cannot be changed */
+    rc = mkavl_add(snapshot_h, &extra_item, (void **) &item);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("add to snapshot gave rc(%s)", mkavl_rc_e_get_string(rc));
+        goto cleanup;
+    }
+    if (0 != before_cnt) {
+        rc = mkavl_remove(snapshot_h, before_array[0], (void **) &item);
+        if (MKAVL_RC_E_EINVAL != rc) {
+            LOG_FAIL("remove from snapshot gave rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            goto cleanup;
+        }
+    }
+
+    /* Change the tree and check that only a later snapshot sees it */
+    for (i = 0; i < (input->opts->node_cnt / 2); ++i) {
+        rc = mkavl_remove(input->tree_h, &(input->delete_seq[i]),
+                          (void **) &item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("remove failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            goto cleanup;
+        }
+        if (NULL != item) {
+            removed_array[removed_cnt++] = item;
+        }
+    }
+    rc = mkavl_add(input->tree_h, &extra_item, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc) || (NULL != item)) {
+        LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        goto cleanup;
+    }
+
+    rc = mkavl_snapshot(input->tree_h, &later_h);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("snapshot failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        goto cleanup;
+    }
+    if (!mkavl_test_snapshot_items(input->tree_h, after_array, &after_cnt) ||
+        !mkavl_test_snapshot_check(snapshot_h, before_array, before_cnt,
+                                   has_sum) ||
+        !mkavl_test_snapshot_check(copy_h, before_array, before_cnt,
+                                   has_sum) ||
+        !mkavl_test_snapshot_check(later_h, after_array, after_cnt,
+                                   has_sum)) {
+        goto cleanup;
+    }
+
+    /* Empty the copy, which must leave the others alone */
+    for (i = 0; i < before_cnt; ++i) {
+        rc = mkavl_remove(copy_h, before_array[i], (void **) &item);
+        if (mkavl_rc_e_is_notok(rc) || (before_array[i] != item)) {
+            LOG_FAIL("remove from copy failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            goto cleanup;
+        }
+    }
+    if (!mkavl_test_snapshot_check(copy_h, before_array, 0, has_sum) ||
+        !mkavl_test_snapshot_check(snapshot_h, before_array, before_cnt,
+                                   has_sum) ||
+        !mkavl_test_snapshot_check(input->tree_h, after_array, after_cnt,
+                                   has_sum)) {
+        goto cleanup;
+    }
+
+    /* Put the tree back while the first snapshot is read */
+    rc = mkavl_remove(input->tree_h, &extra_item, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc) || (&extra_item != item)) {
+        LOG_FAIL("remove failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        goto cleanup;
+    }
+    for (i = 0; i < removed_cnt; ++i) {
+        rc = mkavl_add(input->tree_h, removed_array[i], (void **) &item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != item)) {
+            LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            goto cleanup;
+        }
+    }
+
+    if (input->tree_opts->thread_safe) {
+        thread.tree_h = input->tree_h;
+        thread.item_array = before_array;
+        thread.item_cnt = before_cnt;
+        thread.failed = false;
+        if (0 != pthread_create(&tid, NULL, mkavl_test_snapshot_writer,
+                                &thread)) {
+            LOG_FAIL("pthread_create failed");
+            goto cleanup;
+        }
+        for (i = 0; i < MKAVL_TEST_SNAPSHOT_ROUND_CNT; ++i) {
+            if (!mkavl_test_snapshot_check(snapshot_h, before_array,
+                                           before_cnt, has_sum)) {
+                break;
+            }
+        }
+        pthread_join(tid, NULL);
+        if (thread.failed || (i != MKAVL_TEST_SNAPSHOT_ROUND_CNT)) {
+            LOG_FAIL("snapshot changed by writer thread");
+            goto cleanup;
+        }
+    }
+
+    /* Either snapshot may go first */
+    mkavl_delete(&snapshot_h, NULL, NULL);
+    if (!mkavl_test_snapshot_check(input->tree_h, before_array, before_cnt,
+                                   has_sum) ||
+        !mkavl_test_snapshot_check(later_h, after_array, after_cnt,
+                                   has_sum)) {
+        goto cleanup;
+    }
+
+    retval = true;
+
+cleanup:
+
+    if (NULL != snapshot_h) {
+        mkavl_delete(&snapshot_h, NULL, NULL);
+    }
+    if (NULL != later_h) {
+        mkavl_delete(&later_h, NULL, NULL);
+    }
+    if (NULL != copy_h) {
+        mkavl_delete(&copy_h, NULL, NULL);
+    }
+
+    return (retval);
+}
+
+/**
+ * The callback for mkavl_walk().
+ *
+ * @param item The current item in the walk.
+ * @param tree_context The tree's context.
+ * @param walk_context The walks' context.
+ * @param stop_walk Can be set true to stop the walk upon return.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_walk_cb (void *item, void *tree_context, void *walk_context,
+                    bool *stop_walk)
+{
+    mkavl_test_walk_ctx_st *walk_ctx = (mkavl_test_walk_ctx_st *) walk_context;
+    mkavl_test_ctx_st *tree_ctx = (mkavl_test_ctx_st *) tree_context;
+
+    if ((NULL == item) || (NULL == walk_ctx) || (NULL == tree_ctx) ||
+        (NULL == stop_walk) || (MKAVL_TEST_MAGIC != walk_ctx->magic) ||
+        (MKAVL_TEST_MAGIC != tree_ctx->magic)) {
+        abort();
+    }
+
+    if (walk_ctx->walk_stop_cnt == walk_ctx->walk_node_cnt) {
+        *stop_walk = true;
+    } else {
+        ++(walk_ctx->walk_node_cnt);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Test mkavl_walk().
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_walk (mkavl_test_input_st *input)
+{
+    mkavl_test_walk_ctx_st walk_ctx = {0};
+    mkavl_rc_e rc;
+    
+    walk_ctx.magic = MKAVL_TEST_MAGIC;
+    /* Set it high enough that this walk will go all the way */
+    walk_ctx.walk_stop_cnt = input->uniq_cnt;
+    rc = mkavl_walk(input->tree_h, mkavl_test_walk_cb, &walk_ctx); 
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("walk failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    if (walk_ctx.walk_node_cnt != walk_ctx.walk_stop_cnt) {
+        LOG_FAIL("unexpected walk count, walk_node_cnt(%u) stop_cnt(%u)", 
+                 walk_ctx.walk_node_cnt, walk_ctx.walk_stop_cnt);
+        return (false);
+    }
+
+    walk_ctx.walk_node_cnt = 0;
+    /* Set it high enough that this walk will go all the way */
+    walk_ctx.walk_stop_cnt = (rand() %  input->uniq_cnt);
+    rc = mkavl_walk(input->tree_copy_h, mkavl_test_walk_cb, &walk_ctx); 
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("walk failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    if (walk_ctx.walk_node_cnt != walk_ctx.walk_stop_cnt) {
+        LOG_FAIL("unexpected walk count, walk_node_cnt(%u) stop_cnt(%u)", 
+                 walk_ctx.walk_node_cnt, walk_ctx.walk_stop_cnt);
+        return (false);
+    }
+
+    walk_ctx.magic = 0;
+
+    return (true);
+}
+
+/**
+ * Test mkavl_remove().
+ *
+ * @param input The input state for the test.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_remove (mkavl_test_input_st *input)
+{
+    uint32_t i, null_cnt = 0;
+    mkavl_rc_e rc;
+    uint32_t *found_item;
+
+    for (i = 0; i < input->opts->node_cnt; ++i) {
+        rc = mkavl_remove(input->tree_h, &(input->delete_seq[i]), 
+                          (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("remove failed, rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+
+        if (NULL == found_item) {
+            ++null_cnt;
+        }
+    }
+
+    if (null_cnt != input->dup_cnt) {
+        LOG_FAIL("duplicate check failed, null_cnt(%u) dup_cnt(%u)", 
+                 null_cnt, input->dup_cnt);
+        return (false);
+    }
+
+    if (0 != mkavl_count(input->tree_h)) {
+        LOG_FAIL("remove count check failed, count(%u)",
+                 mkavl_count(input->tree_h));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * The callback for per-item functions.
+ *
+ * @param item The current item.
+ * @param context The tree's context.
+ * @return The return code
+ */
+static mkavl_rc_e
+mkavl_test_item_fn (void *item, void *context)
+{
+    mkavl_test_ctx_st *ctx = (mkavl_test_ctx_st *) context;
+
+    if ((NULL == item) || (NULL == ctx) || 
+        (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+
+    ++(ctx->item_fn_cnt);
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * Test mkavl_delete() on a tree with more items than any loop sanity limit,
+ * making sure the item function is called once per item and all the node
+ * memory is freed.
+ *
+ * @param tree_opts The options with which to create the tree.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_delete_large (const mkavl_opts_st *tree_opts)
+{
+    const uint32_t item_cnt = ((2 * MKAVL_TEST_RUNAWAY_SANITY) + 1);
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st *ctx;
+    uint32_t *items, *found_item;
+    uint32_t i, item_fn_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    items = calloc(item_cnt, sizeof(*items));
+    ctx = calloc(1, sizeof(*ctx));
+    if ((NULL == items) || (NULL == ctx)) {
+        LOG_FAIL("calloc failed");
+        free(items);
+        free(ctx);
+        return (false);
+    }
+    ctx->magic = MKAVL_TEST_MAGIC;
+
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        &copy_allocator, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        free(items);
+        free(ctx);
+        return (false);
+    }
+
+    for (i = 0; i < item_cnt; ++i) {
+        items[i] = i;
+        rc = mkavl_add(tree_h, &(items[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+            break;
+        }
+    }
+    item_fn_cnt = mkavl_count(tree_h);
+
+    rc = mkavl_delete(&tree_h, mkavl_test_item_fn, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("delete failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    if (retval && (ctx->item_fn_cnt != item_fn_cnt)) {
+        LOG_FAIL("item fn count(%u) != item count(%u)", ctx->item_fn_cnt,
+                 item_fn_cnt);
+        retval = false;
+    }
+
+    if (ctx->copy_malloc_cnt != ctx->copy_free_cnt) {
+        LOG_FAIL("malloc count(%u) != free count(%u)", 
+                 ctx->copy_malloc_cnt, ctx->copy_free_cnt);
+        retval = false;
+    }
+
+    free(items);
+    free(ctx);
+
+    return (retval);
+}
+
+/** The number of items loaded by mkavl_test_workers(), enough to split sorts */
+#define MKAVL_TEST_WORKERS_ITEM_CNT 100000
+/** The number of worker threads for mkavl_test_workers() */
+#define MKAVL_TEST_WORKERS_THREAD_CNT 4
+/** The fewest values mkavl_test_sum_task() splits between two tasks */
+#define MKAVL_TEST_WORKERS_SUM_SPLIT 64
+
+/**
+ * A task of mkavl_test_workers() that sums a range of values by splitting it
+ * into nested tasks.
+ */
+typedef struct mkavl_test_sum_st_ {
+    /** The task given to the workers */
+    mkavl_task_st task;
+    /** The pool */
+    mkavl_workers_handle workers_h;
+    /** The first value of the range */
+    uint64_t lo;
+    /** One past the last value of the range */
+    uint64_t hi;
+    /** The sum of the range, once the task has run */
+    uint64_t sum;
+} mkavl_test_sum_st;
+
+/**
+ * Sum a range of values, spawning a task for each half of a large range.
+ *
+ * @param task_context The mkavl_test_sum_st.
+ */
+static void
+mkavl_test_sum_task (void *task_context)
+{
+    mkavl_test_sum_st *sum = task_context, lo_sum, hi_sum;
+    mkavl_task_group_st group = MKAVL_TASK_GROUP_INIT;
+    uint64_t i;
+
+    if ((sum->hi - sum->lo) < MKAVL_TEST_WORKERS_SUM_SPLIT) {
+        sum->sum = 0;
+        for (i = sum->lo; i < sum->hi; ++i) {
+            sum->sum += i;
+        }
+        return;
+    }
+
+    lo_sum = *sum;
+    lo_sum.hi = (sum->lo + ((sum->hi - sum->lo) / 2));
+    hi_sum = *sum;
+    hi_sum.lo = lo_sum.hi;
+    mkavl_workers_spawn(sum->workers_h, &group, &(lo_sum.task),
+                        mkavl_test_sum_task, &lo_sum);
+    mkavl_workers_spawn(sum->workers_h, &group, &(hi_sum.task),
+                        mkavl_test_sum_task, &hi_sum);
+    mkavl_workers_wait(sum->workers_h, &group);
+    sum->sum = (lo_sum.sum + hi_sum.sum);
+}
+
+/**
+ * Check that two trees hold the same items in the same order for every key.
+ *
+ * @param tree_h The tree to check.
+ * @param expect_h The tree holding the expected items.
+ * @return True if the trees match.
+ */
+static bool
+mkavl_test_workers_compare (mkavl_tree_handle tree_h,
+                            mkavl_tree_handle expect_h)
+{
+    mkavl_iterator_handle iter_h = NULL, expect_iter_h = NULL;
+    uint32_t *item, *expect_item;
+    mkavl_test_key_e key;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    if (mkavl_count(tree_h) != mkavl_count(expect_h)) {
+        LOG_FAIL("count %u != expected count %u", mkavl_count(tree_h),
+                 mkavl_count(expect_h));
+        return (false);
+    }
+
+    for (key = 0; retval && (key < MKAVL_TEST_KEY_E_MAX); ++key) {
+        rc = mkavl_iter_new(&iter_h, tree_h, key);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_new(&expect_iter_h, expect_h, key);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("new iterator failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+            break;
+        }
+
+        mkavl_iter_first(iter_h, (void **) &item);
+        mkavl_iter_first(expect_iter_h, (void **) &expect_item);
+        while ((NULL != item) || (NULL != expect_item)) {
+            if ((NULL == item) || (NULL == expect_item) ||
+                (*item != *expect_item)) {
+                LOG_FAIL("tree differs for key %u", key);
+                retval = false;
+                break;
+            }
+            mkavl_iter_next(iter_h, (void **) &item);
+            mkavl_iter_next(expect_iter_h, (void **) &expect_item);
+        }
+
+        mkavl_iter_delete(&iter_h);
+        mkavl_iter_delete(&expect_iter_h);
+    }
+
+    if (NULL != iter_h) {
+        mkavl_iter_delete(&iter_h);
+    }
+
+    return (retval);
+}
+
+/**
+ * Test trees with a pool of workers: nested tasks in the pool itself, and bulk
+ * loads and copies large enough to split their sorts, which must match those
+ * done without workers.  The allocator counts calls without locking, so it
+ * also checks that only the calling thread allocates.
+ *
+ * @param tree_opts The options with which to create the trees.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_workers (const mkavl_opts_st *tree_opts)
+{
+    const uint32_t item_cnt = MKAVL_TEST_WORKERS_ITEM_CNT;
+    mkavl_tree_handle tree_h = NULL, serial_tree_h = NULL, copy_h = NULL;
+    mkavl_workers_handle workers_h = NULL;
+    mkavl_test_sum_st sum = {0};
+    mkavl_test_ctx_st *ctx, workers_ctx = {0};
+    mkavl_opts_st opts;
+    uint32_t *items = NULL, **item_array = NULL, *swap_item;
+    uint32_t i, j, seed = item_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    workers_ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_workers_new(&workers_h, 0, &workers_ctx, &copy_allocator);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("new workers with no threads failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    /* The pool itself comes from the client allocator */
+    rc = mkavl_workers_new(&workers_h, MKAVL_TEST_WORKERS_THREAD_CNT,
+                           &workers_ctx, &copy_allocator);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new workers failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    sum.workers_h = workers_h;
+    sum.hi = item_cnt;
+    mkavl_test_sum_task(&sum);
+    if (sum.sum != (((uint64_t) item_cnt * (item_cnt - 1)) / 2)) {
+        LOG_FAIL("unexpected sum %" PRIu64, sum.sum);
+        mkavl_workers_delete(&workers_h);
+        return (false);
+    }
+
+    items = calloc(item_cnt, sizeof(*items));
+    item_array = calloc(item_cnt, sizeof(*item_array));
+    ctx = calloc(1, sizeof(*ctx));
+    if ((NULL == items) || (NULL == item_array) || (NULL == ctx)) {
+        LOG_FAIL("calloc failed");
+        retval = false;
+        goto cleanup;
+    }
+    ctx->magic = MKAVL_TEST_MAGIC;
+
+    for (i = 0; i < item_cnt; ++i) {
+        items[i] = i;
+        item_array[i] = &(items[i]);
+    }
+    for (i = (item_cnt - 1); i > 0; --i) {
+        j = (rand_r(&seed) % (i + 1));
+        swap_item = item_array[i];
+        item_array[i] = item_array[j];
+        item_array[j] = swap_item;
+    }
+
+    opts = *tree_opts;
+    opts.workers = workers_h;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        &copy_allocator, &opts);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_new_opts(&serial_tree_h, cmp_fn_array, NELEMS(cmp_fn_array),
+                            ctx, &copy_allocator, tree_opts);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* A duplicate anywhere fails the whole load */
+    swap_item = item_array[item_cnt - 1];
+    item_array[item_cnt - 1] = item_array[0];
+    rc = mkavl_bulk_load(tree_h, (void **) item_array, item_cnt, false, 0);
+    item_array[item_cnt - 1] = swap_item;
+    if ((MKAVL_RC_E_EINVAL != rc) || (0 != mkavl_count(tree_h))) {
+        LOG_FAIL("bulk load of duplicate items failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_bulk_load(tree_h, (void **) item_array, item_cnt, false, 0);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_bulk_load(serial_tree_h, (void **) item_array, item_cnt,
+                             false, 0);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("bulk load failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    retval = mkavl_test_workers_compare(tree_h, serial_tree_h);
+    if (!retval) {
+        goto cleanup;
+    }
+
+    /* Copy the items to cover the mapped copy as well as the plain one */
+    rc = mkavl_copy(tree_h, &copy_h, mkavl_test_copy_fn, NULL, true, NULL,
+                    NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("copy failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    retval = mkavl_test_workers_compare(copy_h, serial_tree_h);
+    mkavl_delete(&copy_h, NULL, NULL);
+    if (!retval) {
+        goto cleanup;
+    }
+
+    rc = mkavl_copy(tree_h, &copy_h, NULL, NULL, true, NULL, NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("copy failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    retval = mkavl_test_workers_compare(copy_h, serial_tree_h);
+    mkavl_delete(&copy_h, NULL, NULL);
+
+cleanup:
+
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+    if (NULL != serial_tree_h) {
+        mkavl_delete(&serial_tree_h, NULL, NULL);
+    }
+
+    if ((NULL != ctx) && (ctx->copy_malloc_cnt != ctx->copy_free_cnt)) {
+        LOG_FAIL("malloc count(%u) != free count(%u)",
+                 ctx->copy_malloc_cnt, ctx->copy_free_cnt);
+        retval = false;
+    }
+
+    rc = mkavl_workers_delete(&workers_h);
+    if (mkavl_rc_e_is_notok(rc) || (NULL != workers_h)) {
+        LOG_FAIL("delete workers failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+    if ((0 == workers_ctx.copy_malloc_cnt) ||
+        (workers_ctx.copy_malloc_cnt != workers_ctx.copy_free_cnt)) {
+        LOG_FAIL("workers malloc count(%u) != free count(%u)",
+                 workers_ctx.copy_malloc_cnt, workers_ctx.copy_free_cnt);
+        retval = false;
+    }
+
+    free(ctx);
+    free(item_array);
+    free(items);
+
+    return (retval);
+}
+
+/** The number of values in the tree for mkavl_test_threads() */
+#define MKAVL_TEST_THREAD_VALUE_CNT 2000
+/** The number of changes each writer makes in mkavl_test_threads() */
+#define MKAVL_TEST_THREAD_WRITE_CNT 5000
+/** The number of readers and the number of writers for mkavl_test_threads() */
+#define MKAVL_TEST_THREAD_CNT 2
+
+/**
+ * The state shared by the threads of mkavl_test_threads().
+ */
+typedef struct mkavl_test_threads_st_ {
+    /** The tree being shared */
+    mkavl_tree_handle tree_h;
+    /** The values that may be in the tree */
+    uint32_t *values;
+    /** The number of writers that have not finished */
+    uint32_t writers_left;
+    /** The writers followed by the readers */
+    struct mkavl_test_thread_st_ *thread_array;
+    /** The number of odd values added, each in its own heap item */
+    uint32_t added_cnt;
+    /** Keep removed items until the readers are done rather than retire them */
+    bool keep_removed;
+} mkavl_test_threads_st;
+
+/**
+ * The state of one thread of mkavl_test_threads().
+ */
+typedef struct mkavl_test_thread_st_ {
+    /** The shared state */
+    mkavl_test_threads_st *shared;
+    /** The RNG state of the thread */
+    unsigned int seed;
+    /** Set if the thread saw something wrong */
+    bool failed;
+    /** The items a writer removed, if they are kept */
+    uint32_t *removed_array[MKAVL_TEST_THREAD_WRITE_CNT];
+    /** The number of items in removed_array */
+    uint32_t removed_cnt;
+} mkavl_test_thread_st;
+
+/**
+ * Release an item of mkavl_test_threads().  Odd values are heap items, which
+ * are freed and counted.
+ *
+ * @param item The item to release.
+ * @param context The tree context.
+ * @return The return code.
+ */
+static mkavl_rc_e
+mkavl_test_thread_release (void *item, void *context)
+{
+    mkavl_test_ctx_st *ctx = context;
+    uint32_t *value = item;
+
+    if ((NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+
+    if (0 != (*value % 2)) {
+        free(value);
+        __atomic_add_fetch(&(ctx->item_fn_cnt), 1, __ATOMIC_RELAXED);
+    }
+
+    return (MKAVL_RC_E_SUCCESS);
+}
+
+/**
+ * A writer for mkavl_test_threads(): flip whether random odd values are in the
+ * tree.  Each writer has its own odd values so that the add and remove of a
+ * flip are not split by another writer.  Removed items are freed via
+ * mkavl_retire() while readers may still be comparing them.  Without lockless
+ * reads, the iterator of a reader may be at a removed item between its calls,
+ * so those items are kept until the readers are done.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+mkavl_test_thread_writer (void *arg)
+{
+    mkavl_test_thread_st *thread = arg;
+    mkavl_test_threads_st *shared = thread->shared;
+    uint32_t writer_idx = (thread - shared->thread_array);
+    uint32_t *item, *existing_item, *found_item;
+    uint32_t i, idx;
+    mkavl_rc_e rc;
+
+    for (i = 0; i < MKAVL_TEST_THREAD_WRITE_CNT; ++i) {
+        idx = (rand_r(&(thread->seed)) %
+               (MKAVL_TEST_THREAD_VALUE_CNT / (2 * MKAVL_TEST_THREAD_CNT)));
+        idx = (((idx * MKAVL_TEST_THREAD_CNT) + writer_idx) * 2) + 1;
+
+        item = malloc(sizeof(*item));
+        if (NULL == item) {
+            LOG_FAIL("malloc failed");
+            abort();
+        }
+        *item = idx;
+
+        rc = mkavl_add(shared->tree_h, item, (void **) &existing_item);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            free(item);
+            thread->failed = true;
+            break;
+        }
+
+        if (NULL == existing_item) {
+            __atomic_add_fetch(&(shared->added_cnt), 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        free(item);
+
+        rc = mkavl_remove(shared->tree_h, existing_item,
+                          (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (existing_item != found_item)) {
+            LOG_FAIL("remove failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            break;
+        }
+
+        if (shared->keep_removed) {
+            thread->removed_array[thread->removed_cnt++] = found_item;
+            continue;
+        }
+
+        rc = mkavl_retire(shared->tree_h, found_item,
+                          mkavl_test_thread_release);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("retire failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            break;
+        }
+    }
+
+    __atomic_sub_fetch(&(shared->writers_left), 1, __ATOMIC_RELEASE);
+
+    return (NULL);
+}
+
+/**
+ * A reader for mkavl_test_threads(): until the writers are done, look up even
+ * values, which are never changed, and iterate over the whole tree, which must
+ * stay in order with all the even values while the iterator exists.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+mkavl_test_thread_reader (void *arg)
+{
+    mkavl_test_thread_st *thread = arg;
+    mkavl_test_threads_st *shared = thread->shared;
+    mkavl_iterator_handle iter_h;
+    uint32_t *found_item, *prev_item;
+    uint32_t lookup, even_cnt;
+    mkavl_rc_e rc;
+
+    while (!thread->failed &&
+           (0 != __atomic_load_n(&(shared->writers_left), __ATOMIC_ACQUIRE))) {
+        lookup = ((rand_r(&(thread->seed)) %
+                   (MKAVL_TEST_THREAD_VALUE_CNT / 2)) * 2);
+        rc = mkavl_find(shared->tree_h, MKAVL_FIND_TYPE_E_EQUAL,
+                        MKAVL_TEST_KEY_E_ASC, &lookup, (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL == found_item) ||
+            (*found_item != lookup)) {
+            LOG_FAIL("find of %u failed, rc(%s)", lookup,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            break;
+        }
+
+        rc = mkavl_iter_new(&iter_h, shared->tree_h, MKAVL_TEST_KEY_E_ASC);
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            break;
+        }
+
+        even_cnt = 0;
+        prev_item = NULL;
+        rc = mkavl_iter_first(iter_h, (void **) &found_item);
+        while (mkavl_rc_e_is_ok(rc) && (NULL != found_item)) {
+            if ((NULL != prev_item) && (*prev_item >= *found_item)) {
+                LOG_FAIL("%u came after %u", *found_item, *prev_item);
+                thread->failed = true;
+                break;
+            }
+            if (0 == (*found_item % 2)) {
+                ++even_cnt;
+            }
+            prev_item = found_item;
+            rc = mkavl_iter_next(iter_h, (void **) &found_item);
+        }
+
+        if (mkavl_rc_e_is_notok(rc) ||
+            (even_cnt != (MKAVL_TEST_THREAD_VALUE_CNT / 2))) {
+            LOG_FAIL("iteration saw %u even values, rc(%s)", even_cnt,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+        }
+
+        mkavl_iter_delete(&iter_h);
+    }
+
+    return (NULL);
+}
+
+/**
+ * Test a thread safe tree shared by readers and writers at once.  Every odd
+ * value added must be released exactly once, either when retired or when the
+ * tree is deleted.
+ *
+ * @param tree_opts The options with which to create the tree.
+ * @param seed The seed for the RNGs of the threads.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_threads (const mkavl_opts_st *tree_opts, uint32_t seed)
+{
+    mkavl_test_threads_st shared = {0};
+    mkavl_test_thread_st thread_array[2 * MKAVL_TEST_THREAD_CNT] = {{0}};
+    pthread_t tid_array[2 * MKAVL_TEST_THREAD_CNT];
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t *found_item;
+    uint32_t i, j, found_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    shared.values = calloc(MKAVL_TEST_THREAD_VALUE_CNT,
+                           sizeof(*(shared.values)));
+    if (NULL == shared.values) {
+        LOG_FAIL("calloc failed");
+        return (false);
+    }
+    ctx.magic = MKAVL_TEST_MAGIC;
+
+    rc = mkavl_new_opts(&(shared.tree_h), cmp_fn_array, NELEMS(cmp_fn_array),
+                        &ctx, NULL, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        free(shared.values);
+        return (false);
+    }
+
+    for (i = 0; i < MKAVL_TEST_THREAD_VALUE_CNT; ++i) {
+        shared.values[i] = i;
+        if (0 != (i % 2)) {
+            continue;
+        }
+        rc = mkavl_add(shared.tree_h, &(shared.values[i]),
+                       (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    shared.writers_left = MKAVL_TEST_THREAD_CNT;
+    shared.thread_array = thread_array;
+    shared.keep_removed = !tree_opts->lockless_reads;
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        thread_array[i].shared = &shared;
+        thread_array[i].seed = seed + i;
+        if (0 != pthread_create(&(tid_array[i]), NULL,
+                                (i < MKAVL_TEST_THREAD_CNT) ?
+                                mkavl_test_thread_writer :
+                                mkavl_test_thread_reader,
+                                &(thread_array[i]))) {
+            LOG_FAIL("pthread_create failed");
+            abort();
+        }
+    }
+
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        pthread_join(tid_array[i], NULL);
+        if (thread_array[i].failed) {
+            retval = false;
+        }
+    }
+
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        for (j = 0; j < thread_array[i].removed_cnt; ++j) {
+            mkavl_test_thread_release(thread_array[i].removed_array[j], &ctx);
+        }
+    }
+
+    /* The count must match what is actually in the tree */
+    found_cnt = 0;
+    for (i = 0; i < MKAVL_TEST_THREAD_VALUE_CNT; ++i) {
+        rc = mkavl_find(shared.tree_h, MKAVL_FIND_TYPE_E_EQUAL,
+                        MKAVL_TEST_KEY_E_DESC, &i, (void **) &found_item);
+        if (mkavl_rc_e_is_ok(rc) && (NULL != found_item)) {
+            ++found_cnt;
+        }
+    }
+
+    if (retval && (found_cnt != mkavl_count(shared.tree_h))) {
+        LOG_FAIL("found count(%u) != count(%u)", found_cnt,
+                 mkavl_count(shared.tree_h));
+        retval = false;
+    }
+
+cleanup:
+
+    rc = mkavl_delete(&(shared.tree_h), mkavl_test_thread_release, NULL);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("delete failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    if (retval && (ctx.item_fn_cnt != shared.added_cnt)) {
+        LOG_FAIL("released count(%u) != added count(%u)", ctx.item_fn_cnt,
+                 shared.added_cnt);
+        retval = false;
+    }
+
+    free(shared.values);
+
+    return (retval);
+}
+
+/**
+ * The state of one writer of mkavl_test_sharded_threads().
+ */
+typedef struct mkavl_test_sharded_thread_st_ {
+    /** The tree being shared */
+    mkavl_sharded_handle sharded_h;
+    /** The values that may be in the tree */
+    uint32_t *values;
+    /** The index of the writer */
+    uint32_t writer_idx;
+    /** Set if the thread saw something wrong */
+    bool failed;
+} mkavl_test_sharded_thread_st;
+
+/**
+ * A writer for mkavl_test_sharded_threads(): add every value the writer owns
+ * and then remove every other one.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+mkavl_test_sharded_writer (void *arg)
+{
+    mkavl_test_sharded_thread_st *thread = arg;
+    uint32_t *found_item;
+    uint32_t i;
+    mkavl_rc_e rc;
+
+    for (i = thread->writer_idx; i < MKAVL_TEST_THREAD_VALUE_CNT;
+         i += (2 * MKAVL_TEST_THREAD_CNT)) {
+        rc = mkavl_sharded_add(thread->sharded_h, &(thread->values[i]),
+                               (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("sharded add of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            return (NULL);
+        }
+    }
+
+    for (i = thread->writer_idx; i < MKAVL_TEST_THREAD_VALUE_CNT;
+         i += (2 * MKAVL_TEST_THREAD_CNT)) {
+        if (0 == ((i / (2 * MKAVL_TEST_THREAD_CNT)) % 2)) {
+            continue;
+        }
+        rc = mkavl_sharded_remove(thread->sharded_h, &(thread->values[i]),
+                                  (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(thread->values[i]) != found_item)) {
+            LOG_FAIL("sharded remove of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            return (NULL);
+        }
+    }
+
+    return (NULL);
+}
+
+/**
+ * Test writers sharing a sharded tree at once.  Once they are done, the merged
+ * iteration must give exactly the values that were kept, in order, and the
+ * thread iterating over it may then change it.
+ *
+ * @param tree_opts The options with which to create the shards.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_sharded_threads (const mkavl_opts_st *tree_opts)
+{
+    mkavl_test_sharded_thread_st thread_array[2 * MKAVL_TEST_THREAD_CNT];
+    pthread_t tid_array[2 * MKAVL_TEST_THREAD_CNT];
+    mkavl_sharded_iterator_handle iter_h;
+    mkavl_sharded_handle sharded_h;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[MKAVL_TEST_THREAD_VALUE_CNT];
+    uint32_t *item, *found_item;
+    uint32_t i, expected;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_sharded_new(&sharded_h, MKAVL_TEST_SHARD_CNT,
+                           mkavl_test_shard_hash, cmp_fn_array,
+                           NELEMS(cmp_fn_array), &ctx, NULL, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sharded new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    for (i = 0; i < MKAVL_TEST_THREAD_VALUE_CNT; ++i) {
+        values[i] = i;
+    }
+
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        thread_array[i].sharded_h = sharded_h;
+        thread_array[i].values = values;
+        thread_array[i].writer_idx = i;
+        thread_array[i].failed = false;
+        if (0 != pthread_create(&(tid_array[i]), NULL,
+                                mkavl_test_sharded_writer,
+                                &(thread_array[i]))) {
+            LOG_FAIL("pthread_create failed");
+            abort();
+        }
+    }
+
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        pthread_join(tid_array[i], NULL);
+        if (thread_array[i].failed) {
+            retval = false;
+        }
+    }
+
+    if (retval && (mkavl_sharded_count(sharded_h) !=
+                   (MKAVL_TEST_THREAD_VALUE_CNT / 2))) {
+        LOG_FAIL("sharded count(%u) != %u", mkavl_sharded_count(sharded_h),
+                 (MKAVL_TEST_THREAD_VALUE_CNT / 2));
+        retval = false;
+    }
+
+    rc = mkavl_sharded_iter_new(&iter_h, sharded_h, MKAVL_TEST_KEY_E_ASC);
+    if (retval && mkavl_rc_e_is_ok(rc)) {
+        mkavl_sharded_iter_first(iter_h, (void **) &item);
+        for (i = 0; i < MKAVL_TEST_THREAD_VALUE_CNT; ++i) {
+            if (0 != ((i / (2 * MKAVL_TEST_THREAD_CNT)) % 2)) {
+                continue;
+            }
+            if (item != &(values[i])) {
+                LOG_FAIL("sharded item for %u is %p, expected %p", i, item,
+                         &(values[i]));
+                retval = false;
+                break;
+            }
+            mkavl_sharded_iter_next(iter_h, (void **) &item);
+        }
+        mkavl_sharded_iter_delete(&iter_h);
+    } else if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sharded iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    /*
+     * The thread iterating may change the tree: remove each item as it is
+     * reached, and at the end of each kept run add back the value after it,
+     * which the iteration must then reach.
+     */
+    rc = mkavl_sharded_iter_new(&iter_h, sharded_h, MKAVL_TEST_KEY_E_ASC);
+    if (retval && mkavl_rc_e_is_ok(rc)) {
+        expected = 0;
+        rc = mkavl_sharded_iter_first(iter_h, (void **) &item);
+        while (mkavl_rc_e_is_ok(rc) && (NULL != item)) {
+            if (*item != expected) {
+                LOG_FAIL("sharded iteration reached %u, expected %u", *item,
+                         expected);
+                retval = false;
+                break;
+            }
+            rc = mkavl_sharded_remove(sharded_h, item, (void **) &found_item);
+            if (mkavl_rc_e_is_ok(rc) &&
+                (((2 * MKAVL_TEST_THREAD_CNT) - 1) ==
+                 (*item % (4 * MKAVL_TEST_THREAD_CNT)))) {
+                rc = mkavl_sharded_add(sharded_h, &(values[*item + 1]),
+                                       (void **) &found_item);
+            }
+            if (mkavl_rc_e_is_notok(rc)) {
+                LOG_FAIL("sharded change of %u while iterating, rc(%s)",
+                         *item, mkavl_rc_e_get_string(rc));
+                retval = false;
+                break;
+            }
+            expected += ((2 * MKAVL_TEST_THREAD_CNT) ==
+                         (expected % (4 * MKAVL_TEST_THREAD_CNT))) ?
+                (2 * MKAVL_TEST_THREAD_CNT) : 1;
+            rc = mkavl_sharded_iter_next(iter_h, (void **) &item);
+        }
+        if (retval && ((MKAVL_TEST_THREAD_VALUE_CNT != expected) ||
+                       (0 != mkavl_sharded_count(sharded_h)))) {
+            LOG_FAIL("sharded iteration stopped at %u with %u items left",
+                     expected, mkavl_sharded_count(sharded_h));
+            retval = false;
+        }
+        mkavl_sharded_iter_delete(&iter_h);
+    } else if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sharded iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    mkavl_sharded_delete(&sharded_h, NULL, NULL);
+
+    return (retval);
+}
+
+/**
+ * Get the number of comparisons made by the shards of a sharded tree for one
+ * key since their stats were reset.
+ *
+ * @param sharded_h The sharded tree, whose shards keep stats.
+ * @param key_idx The key.
+ * @return The number of comparisons.
+ */
+static uint64_t
+mkavl_test_sharded_cmp_cnt (mkavl_sharded_handle sharded_h, size_t key_idx)
+{
+    mkavl_key_stats_st key_stats[NELEMS(cmp_fn_array)];
+    mkavl_stats_st stats;
+    uint64_t cmp_cnt = 0;
+    size_t i;
+
+    for (i = 0; i < mkavl_sharded_shard_count(sharded_h); ++i) {
+        if (mkavl_rc_e_is_ok(mkavl_get_stats(
+                mkavl_sharded_get_shard(sharded_h, i), &stats, key_stats,
+                NELEMS(key_stats)))) {
+            cmp_cnt += key_stats[key_idx].cmp_cnt;
+        }
+    }
+
+    return (cmp_cnt);
+}
+
+/**
+ * The most comparisons of a lookup in one shard of mkavl_test_sharded_merge(),
+ * from the height of an AVL tree with a third of its values
+ */
+#define MKAVL_TEST_SHARDED_MERGE_DEPTH 15
+
+/**
+ * Test that a merged iteration of a sharded tree that is not changing only
+ * advances the shard it takes from: walking every item in either direction
+ * must not look the shards up again at each step.
+ *
+ * @param tree_opts The options with which to create the shards.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_sharded_merge (const mkavl_opts_st *tree_opts)
+{
+    mkavl_sharded_iterator_handle iter_h = NULL;
+    mkavl_sharded_handle sharded_h;
+    mkavl_test_ctx_st ctx = {0};
+    mkavl_opts_st shard_opts;
+    uint32_t values[MKAVL_TEST_THREAD_VALUE_CNT];
+    uint32_t *item, *found_item;
+    uint32_t i, expected;
+    uint64_t cmp_cnt, max_cmp_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    memcpy(&shard_opts, tree_opts, sizeof(shard_opts));
+    shard_opts.stats = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_sharded_new(&sharded_h, MKAVL_TEST_SHARD_CNT,
+                           mkavl_test_shard_hash, cmp_fn_array,
+                           NELEMS(cmp_fn_array), &ctx, NULL, &shard_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sharded new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    for (i = 0; mkavl_rc_e_is_ok(rc) && (i < NELEMS(values)); ++i) {
+        values[i] = i;
+        rc = mkavl_sharded_add(sharded_h, &(values[i]), (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_sharded_iter_new(&iter_h, sharded_h, MKAVL_TEST_KEY_E_ASC);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("sharded setup failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    for (i = 0; i < mkavl_sharded_shard_count(sharded_h); ++i) {
+        mkavl_reset_stats(mkavl_sharded_get_shard(sharded_h, i));
+    }
+
+    expected = 0;
+    rc = mkavl_sharded_iter_first(iter_h, (void **) &item);
+    while (mkavl_rc_e_is_ok(rc) && (NULL != item) && (*item == expected)) {
+        ++expected;
+        rc = mkavl_sharded_iter_next(iter_h, (void **) &item);
+    }
+    while (mkavl_rc_e_is_ok(rc) && (expected > 0)) {
+        rc = mkavl_sharded_iter_prev(iter_h, (void **) &item);
+        if ((NULL == item) || (*item != (expected - 1))) {
+            break;
+        }
+        --expected;
+    }
+    if (mkavl_rc_e_is_notok(rc) || (0 != expected)) {
+        LOG_FAIL("sharded walk stopped at %u, rc(%s)", expected,
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /*
+     * Moving on from the end finds the first or last item of each shard
+     * without a lookup, so with no lookup per step there are far fewer
+     * comparisons than items.  A lockless shard iterator looks its next item
+     * up, so there each step may cost one lookup, but not one in every shard.
+     */
+    max_cmp_cnt = NELEMS(values);
+    if (tree_opts->lockless_reads) {
+        max_cmp_cnt *= (2 * MKAVL_TEST_SHARDED_MERGE_DEPTH);
+    }
+    cmp_cnt = mkavl_test_sharded_cmp_cnt(sharded_h, MKAVL_TEST_KEY_E_ASC);
+    if (cmp_cnt >= max_cmp_cnt) {
+        LOG_FAIL("sharded walk of %zu items made %" PRIu64 " comparisons",
+                 NELEMS(values), cmp_cnt);
+        retval = false;
+    }
+
+cleanup:
+
+    if (NULL != iter_h) {
+        mkavl_sharded_iter_delete(&iter_h);
+    }
+    mkavl_sharded_delete(&sharded_h, NULL, NULL);
+
+    return (retval);
+}
+
+/**
+ * The state of one writer of mkavl_test_ranged_threads().
+ */
+typedef struct mkavl_test_ranged_thread_st_ {
+    /** The tree being shared */
+    mkavl_ranged_handle ranged_h;
+    /** The values that may be in the tree */
+    uint32_t *values;
+    /** The index of the writer */
+    uint32_t writer_idx;
+    /** Set if the thread saw something wrong */
+    bool failed;
+} mkavl_test_ranged_thread_st;
+
+/** The number of values owned by each writer of mkavl_test_ranged_threads() */
+#define MKAVL_TEST_RANGED_THREAD_SPAN \
+    (MKAVL_TEST_THREAD_VALUE_CNT / (2 * MKAVL_TEST_THREAD_CNT))
+
+/**
+ * A writer for mkavl_test_ranged_threads(): add every value in the range the
+ * writer owns and then remove every other one.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+mkavl_test_ranged_writer (void *arg)
+{
+    mkavl_test_ranged_thread_st *thread = arg;
+    uint32_t *found_item;
+    uint32_t i, start, end;
+    mkavl_rc_e rc;
+
+    start = (thread->writer_idx * MKAVL_TEST_RANGED_THREAD_SPAN);
+    end = (start + MKAVL_TEST_RANGED_THREAD_SPAN);
+
+    for (i = start; i < end; ++i) {
+        rc = mkavl_ranged_add(thread->ranged_h, &(thread->values[i]),
+                              (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("ranged add of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            return (NULL);
+        }
+    }
+
+    for (i = (start + 1); i < end; i += 2) {
+        rc = mkavl_ranged_remove(thread->ranged_h, &(thread->values[i]),
+                                 (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(thread->values[i]) != found_item)) {
+            LOG_FAIL("ranged remove of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            return (NULL);
+        }
+    }
+
+    return (NULL);
+}
+
+/**
+ * Test writers sharing a ranged tree at once, each in its own key range, while
+ * partitions are split and merged.  Once they are done, the iteration must give
+ * exactly the values that were kept, in order, and the thread iterating over it
+ * may then change it.
+ *
+ * @param tree_opts The options with which to create the partitions.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_ranged_threads (const mkavl_opts_st *tree_opts)
+{
+    mkavl_ranged_opts_st ranged_opts = {
+        .split_cnt = (4 * MKAVL_TEST_RANGED_SPLIT_CNT),
+        .merge_cnt = (2 * MKAVL_TEST_RANGED_SPLIT_CNT),
+        .bound_copy_fn = mkavl_test_ranged_bound_copy,
+        .bound_free_fn = mkavl_test_ranged_bound_free,
+    };
+    mkavl_test_ranged_thread_st thread_array[2 * MKAVL_TEST_THREAD_CNT];
+    pthread_t tid_array[2 * MKAVL_TEST_THREAD_CNT];
+    mkavl_ranged_iterator_handle iter_h;
+    mkavl_ranged_handle ranged_h;
+    mkavl_opts_st local_opts;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[MKAVL_TEST_THREAD_VALUE_CNT];
+    uint32_t *item, *found_item;
+    uint32_t i, expected;
+    size_t part_cnt;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    memcpy(&local_opts, tree_opts, sizeof(local_opts));
+    local_opts.lockless_reads = false;
+    rc = mkavl_ranged_new(&ranged_h, &ranged_opts, cmp_fn_array,
+                          NELEMS(cmp_fn_array), &ctx, NULL, &local_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("ranged new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    for (i = 0; i < MKAVL_TEST_THREAD_VALUE_CNT; ++i) {
+        values[i] = i;
+    }
+
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        thread_array[i].ranged_h = ranged_h;
+        thread_array[i].values = values;
+        thread_array[i].writer_idx = i;
+        thread_array[i].failed = false;
+        if (0 != pthread_create(&(tid_array[i]), NULL,
+                                mkavl_test_ranged_writer,
+                                &(thread_array[i]))) {
+            LOG_FAIL("pthread_create failed");
+            abort();
+        }
+    }
+
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        pthread_join(tid_array[i], NULL);
+        if (thread_array[i].failed) {
+            retval = false;
+        }
+    }
+
+    if (retval && (mkavl_ranged_count(ranged_h) !=
+                   (MKAVL_TEST_THREAD_VALUE_CNT / 2))) {
+        LOG_FAIL("ranged count(%u) != %u", mkavl_ranged_count(ranged_h),
+                 (MKAVL_TEST_THREAD_VALUE_CNT / 2));
+        retval = false;
+    }
+
+    rc = mkavl_ranged_iter_new(&iter_h, ranged_h);
+    if (retval && mkavl_rc_e_is_ok(rc)) {
+        mkavl_ranged_iter_first(iter_h, (void **) &item);
+        for (i = 0; i < MKAVL_TEST_THREAD_VALUE_CNT; i += 2) {
+            if (item != &(values[i])) {
+                LOG_FAIL("ranged item for %u is %p, expected %p", i, item,
+                         &(values[i]));
+                retval = false;
+                break;
+            }
+            mkavl_ranged_iter_next(iter_h, (void **) &item);
+        }
+        mkavl_ranged_iter_delete(&iter_h);
+    } else if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("ranged iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    /*
+     * The thread iterating may change the tree: add back the odd value after
+     * each item reached, which splits partitions under the iterator.
+     */
+    part_cnt = mkavl_ranged_partition_count(ranged_h);
+    rc = mkavl_ranged_iter_new(&iter_h, ranged_h);
+    if (retval && mkavl_rc_e_is_ok(rc)) {
+        expected = 0;
+        rc = mkavl_ranged_iter_first(iter_h, (void **) &item);
+        while (mkavl_rc_e_is_ok(rc) && (NULL != item)) {
+            if (*item != expected) {
+                LOG_FAIL("ranged iteration reached %u, expected %u", *item,
+                         expected);
+                retval = false;
+                break;
+            }
+            ++expected;
+            if (0 == (*item % 2)) {
+                rc = mkavl_ranged_add(ranged_h, &(values[*item + 1]),
+                                      (void **) &found_item);
+                if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+                    LOG_FAIL("ranged add of %u while iterating, rc(%s)",
+                             (*item + 1), mkavl_rc_e_get_string(rc));
+                    retval = false;
+                    break;
+                }
+            }
+            rc = mkavl_ranged_iter_next(iter_h, (void **) &item);
+        }
+        if (retval && ((MKAVL_TEST_THREAD_VALUE_CNT != expected) ||
+                       (mkavl_ranged_partition_count(ranged_h) <= part_cnt))) {
+            LOG_FAIL("ranged iteration stopped at %u, partitions %zu -> %zu",
+                     expected, part_cnt,
+                     mkavl_ranged_partition_count(ranged_h));
+            retval = false;
+        }
+        mkavl_ranged_iter_delete(&iter_h);
+    } else if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("ranged iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    mkavl_ranged_delete(&ranged_h, NULL, NULL);
+
+    if (ctx.copy_malloc_cnt != ctx.copy_free_cnt) {
+        LOG_FAIL("ranged bounds copied(%u) != freed(%u)", ctx.copy_malloc_cnt,
+                 ctx.copy_free_cnt);
+        retval = false;
+    }
+
+    return (retval);
+}
+
+/** The modulus of the secondary key of mkavl_test_ranged_merge_collision() */
+#define MKAVL_TEST_RANGED_RESIDUE_MOD 5
+
+/**
+ * Compare the uint32_t values by their residue, so that values a multiple of
+ * MKAVL_TEST_RANGED_RESIDUE_MOD apart are equal.
+ *
+ * @param item1 Item to compare
+ * @param item2 Item to compare
+ * @param context Context for the tree
+ * @return Comparison result
+ */
+static int32_t
+mkavl_test_ranged_residue_cmp (const void *item1, const void *item2,
+                               void *context)
+{
+    const uint32_t *i1 = item1;
+    const uint32_t *i2 = item2;
+    mkavl_test_ctx_st *ctx;
+
+    ctx = (mkavl_test_ctx_st *) context;
+
+    if ((NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+
+    if ((*i1 % MKAVL_TEST_RANGED_RESIDUE_MOD) <
+        (*i2 % MKAVL_TEST_RANGED_RESIDUE_MOD)) {
+        return (-1);
+    } else if ((*i1 % MKAVL_TEST_RANGED_RESIDUE_MOD) >
+               (*i2 % MKAVL_TEST_RANGED_RESIDUE_MOD)) {
+        return (1);
+    }
+
+    return (0);
+}
+
+/**
+ * Test that a ranged tree does not merge two partitions holding items equal by
+ * a secondary key, and merges them once the collision is gone.  Values
+ * 0 to 4 split into {0, 1} and {2, 3, 4}; 5 then joins the second partition,
+ * where its residue is free, and shrinking both partitions asks for a merge in
+ * which 0 and 5 collide.
+ *
+ * @param tree_opts The options with which to create the partitions.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_ranged_merge_collision (const mkavl_opts_st *tree_opts)
+{
+    mkavl_ranged_opts_st ranged_opts = {
+        .split_cnt = MKAVL_TEST_RANGED_SPLIT_CNT,
+        .merge_cnt = MKAVL_TEST_RANGED_MERGE_CNT,
+        .bound_copy_fn = mkavl_test_ranged_bound_copy,
+        .bound_free_fn = mkavl_test_ranged_bound_free,
+    };
+    mkavl_compare_fn cmp_array[] = { mkavl_cmp_fn1,
+                                     mkavl_test_ranged_residue_cmp };
+    static const uint32_t remove_array[] = { 3, 4, 1 };
+    static const uint32_t left_array[] = { 0, 2, 5 };
+    mkavl_ranged_handle ranged_h;
+    mkavl_opts_st local_opts;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[(MKAVL_TEST_RANGED_RESIDUE_MOD + 1)];
+    uint32_t *found_item;
+    size_t part_cnt;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    memcpy(&local_opts, tree_opts, sizeof(local_opts));
+    local_opts.lockless_reads = false;
+    rc = mkavl_ranged_new(&ranged_h, &ranged_opts, cmp_array,
+                          NELEMS(cmp_array), &ctx, NULL, &local_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("ranged new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    for (i = 0; i < NELEMS(values); ++i) {
+        values[i] = i;
+        rc = mkavl_ranged_add(ranged_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("ranged add of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    part_cnt = mkavl_ranged_partition_count(ranged_h);
+    if (2 != part_cnt) {
+        LOG_FAIL("ranged partitions(%zu) != 2 after the split", part_cnt);
+        retval = false;
+        goto cleanup;
+    }
+
+    /* The last remove asks to merge {0} with {2, 5}, which collide */
+    for (i = 0; i < NELEMS(remove_array); ++i) {
+        rc = mkavl_ranged_remove(ranged_h, &(remove_array[i]),
+                                 (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) ||
+            (found_item != &(values[remove_array[i]]))) {
+            LOG_FAIL("ranged remove of %u failed, rc(%s)", remove_array[i],
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    part_cnt = mkavl_ranged_partition_count(ranged_h);
+    if (2 != part_cnt) {
+        LOG_FAIL("ranged partitions(%zu) != 2 after a colliding merge",
+                 part_cnt);
+        retval = false;
+    }
+
+    for (i = 0; i < NELEMS(left_array); ++i) {
+        rc = mkavl_ranged_find(ranged_h, MKAVL_FIND_TYPE_E_EQUAL, 0,
+                               &(left_array[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) ||
+            (found_item != &(values[left_array[i]]))) {
+            LOG_FAIL("ranged find of %u failed, rc(%s)", left_array[i],
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
+    }
+
+    /* Without 5, the lone {2} merges with {0} */
+    rc = mkavl_ranged_remove(ranged_h, &(values[5]), (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc) || (found_item != &(values[5]))) {
+        LOG_FAIL("ranged remove of 5 failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    part_cnt = mkavl_ranged_partition_count(ranged_h);
+    if (1 != part_cnt) {
+        LOG_FAIL("ranged partitions(%zu) != 1 once the collision is gone",
+                 part_cnt);
+        retval = false;
+    }
+
+cleanup:
+
+    mkavl_ranged_delete(&ranged_h, NULL, NULL);
+
+    if (ctx.copy_malloc_cnt != ctx.copy_free_cnt) {
+        LOG_FAIL("ranged bounds copied(%u) != freed(%u)", ctx.copy_malloc_cnt,
+                 ctx.copy_free_cnt);
+        retval = false;
+    }
+
+    return (retval);
+}
+
+/** The number of values in mkavl_test_wal() */
+#define MKAVL_TEST_WAL_VALUE_CNT 400
+
+/** The number of values owned by each writer of mkavl_test_wal() */
+#define MKAVL_TEST_WAL_SPAN \
+    (MKAVL_TEST_WAL_VALUE_CNT / (2 * MKAVL_TEST_THREAD_CNT))
+
+/**
+ * The state of a writer of mkavl_test_wal().
+ */
+typedef struct mkavl_test_wal_thread_st_ {
+    /** The tree being logged */
+    mkavl_tree_handle tree_h;
+    /** The values that may be in the tree */
+    uint32_t *values;
+    /** The index of the writer */
+    uint32_t writer_idx;
+    /** Set if the thread saw something wrong */
+    bool failed;
+} mkavl_test_wal_thread_st;
+
+/**
+ * A writer for mkavl_test_wal(): add every value in the range the writer owns
+ * and then remove every other one, each change waiting for its record.
+ *
+ * @param arg The state of the thread.
+ * @return Unused.
+ */
+static void *
+mkavl_test_wal_writer (void *arg)
+{
+    mkavl_test_wal_thread_st *thread = arg;
+    uint32_t *found_item;
+    uint32_t i, start, end;
+    mkavl_rc_e rc;
+
+    start = (thread->writer_idx * MKAVL_TEST_WAL_SPAN);
+    end = (start + MKAVL_TEST_WAL_SPAN);
+
+    for (i = start; i < end; ++i) {
+        rc = mkavl_add(thread->tree_h, &(thread->values[i]),
+                       (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("logged add of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            return (NULL);
+        }
+    }
+
+    for (i = (start + 1); i < end; i += 2) {
+        rc = mkavl_remove(thread->tree_h, &(thread->values[i]),
+                          (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(thread->values[i]) != found_item)) {
+            LOG_FAIL("logged remove of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            thread->failed = true;
+            return (NULL);
+        }
+    }
+
+    return (NULL);
+}
+
+/**
+ * Check that a replayed tree holds the values of the logged tree in the same
+ * order for every key.
+ *
+ * @param tree_h The logged tree.
+ * @param replay_h The replayed tree.
+ * @return True if the trees match.
+ */
+static bool
+mkavl_test_wal_compare (mkavl_tree_handle tree_h, mkavl_tree_handle replay_h)
+{
+    mkavl_iterator_handle iter_h = NULL, replay_iter_h = NULL;
+    uint32_t *item, *replay_item;
+    size_t key_idx;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    for (key_idx = 0; retval && (key_idx < NELEMS(cmp_fn_array)); ++key_idx) {
+        rc = mkavl_iter_new(&iter_h, tree_h, key_idx);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_new(&replay_iter_h, replay_h, key_idx);
+        }
+        if (mkavl_rc_e_is_notok(rc)) {
+            LOG_FAIL("iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            mkavl_iter_delete(&iter_h);
+            return (false);
+        }
+
+        mkavl_iter_first(iter_h, (void **) &item);
+        mkavl_iter_first(replay_iter_h, (void **) &replay_item);
+        while ((NULL != item) || (NULL != replay_item)) {
+            if ((NULL == item) || (NULL == replay_item) ||
+                (*item != *replay_item)) {
+                LOG_FAIL("key %zu: replayed %d != logged %d", key_idx,
+                         (NULL == replay_item) ? -1 : (int) *replay_item,
+                         (NULL == item) ? -1 : (int) *item);
+                retval = false;
+                break;
+            }
+            mkavl_iter_next(iter_h, (void **) &item);
+            mkavl_iter_next(replay_iter_h, (void **) &replay_item);
+        }
+
+        mkavl_iter_delete(&replay_iter_h);
+        mkavl_iter_delete(&iter_h);
+    }
+
+    return (retval);
+}
+
+/**
+ * Replay a snapshot and logs into a new tree.
+ *
+ * @param tree_opts The options with which to create the tree.
+ * @param ctx The tree context.
+ * @param snapshot_fd The snapshot, or -1.
+ * @param log_fd_array The logs.
+ * @param log_fd_cnt The number of logs.
+ * @param replay_h Set to the new tree, to be deleted by the caller.
+ * @param last_lsn Set to the LSN of the last change replayed.
+ * @return The return code of the replay
+ */
+static mkavl_rc_e
+mkavl_test_wal_replay (const mkavl_opts_st *tree_opts, mkavl_test_ctx_st *ctx,
+                       int snapshot_fd, const int *log_fd_array,
+                       size_t log_fd_cnt, mkavl_tree_handle *replay_h,
+                       uint64_t *last_lsn)
+{
+    mkavl_rc_e rc;
+
+    rc = mkavl_new_opts(replay_h, cmp_fn_array, NELEMS(cmp_fn_array), ctx,
+                        &copy_allocator, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        return (rc);
+    }
+
+    if (snapshot_fd >= 0) {
+        lseek(snapshot_fd, 0, SEEK_SET);
+    }
+
+    return (mkavl_wal_replay(*replay_h, snapshot_fd, log_fd_array, log_fd_cnt,
+                             mkavl_test_deserialize_fn,
+                             mkavl_test_copy_free_fn, last_lsn));
+}
+
+/**
+ * Test write-ahead logs: writers log changes at once with group commit, the
+ * tree is checkpointed and its log rotated, and more changes of each kind are
+ * logged.  Replays of the snapshot and logs, and of the logs alone, must then
+ * rebuild the tree, a torn record must end a log and a missing log must be
+ * caught.
+ *
+ * @param tree_opts The options with which to create the tree.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_wal (const mkavl_opts_st *tree_opts)
+{
+    mkavl_test_wal_thread_st thread_array[2 * MKAVL_TEST_THREAD_CNT];
+    pthread_t tid_array[2 * MKAVL_TEST_THREAD_CNT];
+    mkavl_test_update_ctx_st update_ctx = {
+        .new_val = MKAVL_TEST_WAL_VALUE_CNT,
+        .rc = MKAVL_RC_E_SUCCESS,
+    };
+    mkavl_tree_handle tree_h = NULL, replay_h = NULL;
+    mkavl_wal_handle wal_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    FILE *file_array[3] = { NULL };
+    int fd_array[NELEMS(file_array)];
+    uint32_t values[MKAVL_TEST_WAL_VALUE_CNT];
+    uint32_t *found_item;
+    uint64_t last_lsn, replay_lsn;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    for (i = 0; i < NELEMS(file_array); ++i) {
+        file_array[i] = tmpfile();
+        if (NULL == file_array[i]) {
+            LOG_FAIL("tmpfile failed");
+            retval = false;
+            goto cleanup;
+        }
+        fd_array[i] = fileno(file_array[i]);
+    }
+
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_wal_new(&wal_h, fd_array[1], MKAVL_WAL_SYNC_E_FSYNC,
+                           mkavl_test_serialize_fn, 0, &ctx, &copy_allocator);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_set_wal(tree_h, wal_h);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("logged tree new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* The items of a bulk load would not be logged */
+    rc = mkavl_bulk_load(tree_h, NULL, 0, false, 0);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("bulk load of logged tree failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    for (i = 0; i < MKAVL_TEST_WAL_VALUE_CNT; ++i) {
+        values[i] = i;
+    }
+
+    /* Only a thread safe tree may be changed by the writers at once */
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        thread_array[i].tree_h = tree_h;
+        thread_array[i].values = values;
+        thread_array[i].writer_idx = i;
+        thread_array[i].failed = false;
+        if (!tree_opts->thread_safe) {
+            mkavl_test_wal_writer(&(thread_array[i]));
+        } else if (0 != pthread_create(&(tid_array[i]), NULL,
+                                       mkavl_test_wal_writer,
+                                       &(thread_array[i]))) {
+            LOG_FAIL("pthread_create failed");
+            abort();
+        }
+    }
+    for (i = 0; i < NELEMS(thread_array); ++i) {
+        if (tree_opts->thread_safe) {
+            pthread_join(tid_array[i], NULL);
+        }
+        if (thread_array[i].failed) {
+            retval = false;
+        }
+    }
+    if (!retval) {
+        goto cleanup;
+    }
+
+    if ((3 * (MKAVL_TEST_WAL_VALUE_CNT / 2)) != mkavl_wal_last_lsn(wal_h)) {
+        LOG_FAIL("last LSN(%" PRIu64 ") != %u", mkavl_wal_last_lsn(wal_h),
+                 (3 * (MKAVL_TEST_WAL_VALUE_CNT / 2)));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_checkpoint(tree_h, fd_array[0], mkavl_test_serialize_fn);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_wal_rotate(wal_h, fd_array[2]);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("checkpoint failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* A change of each kind after the checkpoint */
+    found_item = NULL;
+    rc = MKAVL_RC_E_SUCCESS;
+    if (!tree_opts->persistent) {
+        rc = mkavl_update(tree_h, &(values[0]), mkavl_test_update_fn,
+                          &update_ctx, (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (NULL == found_item)) {
+        rc = mkavl_remove_key_idx(tree_h, MKAVL_TEST_KEY_E_DESC, &(values[2]),
+                                  (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (&(values[2]) == found_item)) {
+        rc = mkavl_add_key_idx(tree_h, MKAVL_TEST_KEY_E_DESC, &(values[2]),
+                               (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (NULL == found_item)) {
+        /* Left in the first key so that deleting the replay frees it */
+        rc = mkavl_remove_key_idx(tree_h, MKAVL_TEST_KEY_E_DESC, &(values[4]),
+                                  (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (&(values[4]) == found_item)) {
+        rc = mkavl_remove(tree_h, &(values[6]), (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc) && (&(values[6]) == found_item)) {
+        rc = mkavl_add(tree_h, &(values[1]), (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+        LOG_FAIL("logged change failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    last_lsn = mkavl_wal_last_lsn(wal_h);
+
+    /* Until a replay, only the log allocates from the client allocator */
+    if (0 == ctx.copy_malloc_cnt) {
+        LOG_FAIL("log made no allocation from the client allocator");
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_test_wal_replay(tree_opts, &ctx, fd_array[0], &(fd_array[1]),
+                               2, &replay_h, &replay_lsn);
+    if (mkavl_rc_e_is_notok(rc) || (last_lsn != replay_lsn) ||
+        !mkavl_test_wal_compare(tree_h, replay_h)) {
+        LOG_FAIL("replay of snapshot failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    mkavl_delete(&replay_h, mkavl_test_copy_free_fn, NULL);
+
+    rc = mkavl_test_wal_replay(tree_opts, &ctx, -1, &(fd_array[1]), 2,
+                               &replay_h, &replay_lsn);
+    if (mkavl_rc_e_is_notok(rc) || (last_lsn != replay_lsn) ||
+        !mkavl_test_wal_compare(tree_h, replay_h)) {
+        LOG_FAIL("replay of logs failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    mkavl_delete(&replay_h, mkavl_test_copy_free_fn, NULL);
+
+    /* Without the snapshot, the second log does not follow from nothing */
+    rc = mkavl_test_wal_replay(tree_opts, &ctx, -1, &(fd_array[2]), 1,
+                               &replay_h, &replay_lsn);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("replay of missing log failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    mkavl_delete(&replay_h, mkavl_test_copy_free_fn, NULL);
+
+    /* A crash in the middle of the last write */
+    if (0 != ftruncate(fd_array[2], (lseek(fd_array[2], 0, SEEK_END) - 1))) {
+        LOG_FAIL("ftruncate failed");
+        retval = false;
+        goto cleanup;
+    }
+    rc = mkavl_test_wal_replay(tree_opts, &ctx, fd_array[0], &(fd_array[1]),
+                               2, &replay_h, &replay_lsn);
+    if (mkavl_rc_e_is_notok(rc) || ((last_lsn - 1) != replay_lsn) ||
+        (mkavl_count(tree_h) != (mkavl_count(replay_h) + 1))) {
+        LOG_FAIL("replay of torn log failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+cleanup:
+
+    mkavl_delete(&replay_h, mkavl_test_copy_free_fn, NULL);
+    if (NULL != tree_h) {
+        mkavl_set_wal(tree_h, NULL);
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+    mkavl_wal_delete(&wal_h);
+    for (i = 0; i < NELEMS(file_array); ++i) {
+        if (NULL != file_array[i]) {
+            fclose(file_array[i]);
+        }
+    }
+
+    if (ctx.copy_malloc_cnt != ctx.copy_free_cnt) {
+        LOG_FAIL("logged malloc count(%u) != free count(%u)",
+                 ctx.copy_malloc_cnt, ctx.copy_free_cnt);
+        retval = false;
+    }
+
+    return (retval);
+}
+
+/** The number of values in mkavl_test_wal_failure() */
+#define MKAVL_TEST_WAL_FAILURE_VALUE_CNT 8
+
+/**
+ * Serialize function for mkavl_test_wal_failure(), which fails with
+ * MKAVL_RC_E_ENOMEM once the count of calls set in the tree context runs out.
+ *
+ * @see mkavl_test_serialize_fn
+ */
+static mkavl_rc_e
+mkavl_test_failing_serialize_fn (const void *item, void *buf, size_t buf_len,
+                                 size_t *item_len, void *context)
+{
+    mkavl_test_ctx_st *ctx = (mkavl_test_ctx_st *) context;
+
+    if ((NULL == ctx) || (MKAVL_TEST_MAGIC != ctx->magic)) {
+        abort();
+    }
+
+    if ((0 != ctx->serialize_fail_cnt) && (0 == --(ctx->serialize_fail_cnt))) {
+        return (MKAVL_RC_E_ENOMEM);
+    }
+
+    return (mkavl_test_serialize_fn(item, buf, buf_len, item_len, context));
+}
+
+/**
+ * Check that a value is in a tree by every key, or in none.
+ *
+ * @param tree_h The tree.
+ * @param value The value.
+ * @param is_in Whether the value must be in the tree.
+ * @return True if the value is where it must be.
+ */
+static bool
+mkavl_test_wal_is_in (mkavl_tree_handle tree_h, uint32_t value, bool is_in)
+{
+    uint32_t *found_item;
+    size_t key_idx;
+    mkavl_rc_e rc;
+
+    for (key_idx = 0; key_idx < NELEMS(cmp_fn_array); ++key_idx) {
+        rc = mkavl_find(tree_h, MKAVL_FIND_TYPE_E_EQUAL, key_idx, &value,
+                        (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (is_in != (NULL != found_item))) {
+            LOG_FAIL("value %u is%s in key %zu, rc(%s)", value,
+                     is_in ? " not" : "", key_idx, mkavl_rc_e_get_string(rc));
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+/**
+ * Test that a change whose record cannot be made is not made: a serialize
+ * function failing for an add, a remove or either side of an update must
+ * leave the tree as it was and the log working.  Once writing the log fails,
+ * the change being logged is made but reported with MKAVL_RC_E_EIO, and later
+ * changes are refused without being made.
+ *
+ * @param tree_opts The options with which to create the tree.
+ * @return True if test passed.
+ */
+static bool
+mkavl_test_wal_failure (const mkavl_opts_st *tree_opts)
+{
+    mkavl_test_update_ctx_st update_ctx = {
+        .new_val = MKAVL_TEST_WAL_FAILURE_VALUE_CNT,
+        .rc = MKAVL_RC_E_SUCCESS,
+    };
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_wal_handle wal_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[MKAVL_TEST_WAL_FAILURE_VALUE_CNT];
+    uint32_t *found_item;
+    uint64_t lsn;
+    FILE *file;
+    int fd, pipe_fd[2] = { -1, -1 };
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    for (i = 0; i < NELEMS(values); ++i) {
+        values[i] = i;
+    }
+
+    file = tmpfile();
+    if (NULL == file) {
+        LOG_FAIL("tmpfile failed");
+        return (false);
+    }
+    fd = fileno(file);
+
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_wal_new(&wal_h, fd, MKAVL_WAL_SYNC_E_WRITE,
+                           mkavl_test_failing_serialize_fn, 0, NULL, NULL);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_set_wal(tree_h, wal_h);
+    }
+    for (i = 0; mkavl_rc_e_is_ok(rc) && (i < 4); ++i) {
+        rc = mkavl_add(tree_h, &(values[i]), (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("logged tree setup failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    ctx.serialize_fail_cnt = 1;
+    rc = mkavl_add(tree_h, &(values[4]), (void **) &found_item);
+    if ((MKAVL_RC_E_ENOMEM != rc) || (4 != mkavl_count(tree_h)) ||
+        !mkavl_test_wal_is_in(tree_h, 4, false)) {
+        LOG_FAIL("add with failed record gave rc(%s), count %u",
+                 mkavl_rc_e_get_string(rc), mkavl_count(tree_h));
+        retval = false;
+        goto cleanup;
+    }
+
+    /* The log is still taking changes */
+    rc = mkavl_add(tree_h, &(values[4]), (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc) || (5 != mkavl_count(tree_h))) {
+        LOG_FAIL("add after failed record gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    ctx.serialize_fail_cnt = 1;
+    rc = mkavl_remove(tree_h, &(values[0]), (void **) &found_item);
+    if ((MKAVL_RC_E_ENOMEM != rc) || (5 != mkavl_count(tree_h)) ||
+        !mkavl_test_wal_is_in(tree_h, 0, true)) {
+        LOG_FAIL("remove with failed record gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    ctx.serialize_fail_cnt = 1;
+    rc = mkavl_remove_key_idx(tree_h, MKAVL_TEST_KEY_E_DESC, &(values[1]),
+                              (void **) &found_item);
+    if ((MKAVL_RC_E_ENOMEM != rc) || !mkavl_test_wal_is_in(tree_h, 1, true)) {
+        LOG_FAIL("remove key index with failed record gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    lsn = 5;
+    if (!tree_opts->persistent) {
+        /* Failing on the item before the change, and then after it */
+        for (i = 1; i <= 2; ++i) {
+            ctx.serialize_fail_cnt = i;
+            rc = mkavl_update(tree_h, &(values[2]), mkavl_test_update_fn,
+                              &update_ctx, (void **) &found_item);
+            if ((MKAVL_RC_E_ENOMEM != rc) || (2 != values[2]) ||
+                !mkavl_test_wal_is_in(tree_h, 2, true) ||
+                !mkavl_test_wal_is_in(tree_h, update_ctx.new_val, false)) {
+                LOG_FAIL("update with record %u failing gave rc(%s)", i,
+                         mkavl_rc_e_get_string(rc));
+                retval = false;
+                goto cleanup;
+            }
+        }
+
+        ctx.serialize_fail_cnt = 0;
+        rc = mkavl_update(tree_h, &(values[2]), mkavl_test_update_fn,
+                          &update_ctx, (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) ||
+            !mkavl_test_wal_is_in(tree_h, update_ctx.new_val, true)) {
+            LOG_FAIL("update after failed records gave rc(%s)",
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+        ++lsn;
+    }
+
+    if (lsn != mkavl_wal_last_lsn(wal_h)) {
+        LOG_FAIL("last LSN(%" PRIu64 ") != %" PRIu64,
+                 mkavl_wal_last_lsn(wal_h), lsn);
+        retval = false;
+        goto cleanup;
+    }
+
+    /* Make writing the log fail */
+    if ((0 != pipe(pipe_fd)) || (dup2(pipe_fd[0], fd) < 0)) {
+        LOG_FAIL("pipe failed");
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_add(tree_h, &(values[5]), (void **) &found_item);
+    if ((MKAVL_RC_E_EIO != rc) || !mkavl_test_wal_is_in(tree_h, 5, true)) {
+        LOG_FAIL("add with failed write gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_add(tree_h, &(values[6]), (void **) &found_item);
+    if ((MKAVL_RC_E_EINVAL != rc) || !mkavl_test_wal_is_in(tree_h, 6, false)) {
+        LOG_FAIL("add after failed write gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_remove(tree_h, &(values[0]), (void **) &found_item);
+    if ((MKAVL_RC_E_EINVAL != rc) || !mkavl_test_wal_is_in(tree_h, 0, true)) {
+        LOG_FAIL("remove after failed write gave rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+cleanup:
+
+    if (NULL != tree_h) {
+        mkavl_set_wal(tree_h, NULL);
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+    mkavl_wal_delete(&wal_h);
+    for (i = 0; i < NELEMS(pipe_fd); ++i) {
+        if (pipe_fd[i] >= 0) {
+            close(pipe_fd[i]);
+        }
+    }
+    fclose(file);
+
+    return (retval);
+}
+
+/** The number of values in mkavl_test_stats() */
+#define MKAVL_TEST_STATS_VALUE_CNT 100
+
+/**
+ * Check the counters of a tree kept with the stats option as items are added,
+ * found, iterated over and removed, and that they reset.
+ *
+ * @param tree_opts The options of the tree, to which stats are added.
+ * @return True if the test passed.
+ */
+static bool
+mkavl_test_stats (const mkavl_opts_st *tree_opts)
+{
+    mkavl_key_stats_st key_stats[NELEMS(cmp_fn_array)];
+    mkavl_iterator_handle iter_h = NULL;
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    mkavl_stats_st stats;
+    mkavl_opts_st opts;
+    uint32_t values[MKAVL_TEST_STATS_VALUE_CNT];
+    uint32_t *found_item;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    /* A tree without the option keeps no stats */
+    rc = mkavl_get_stats(tree_h, &stats, NULL, 0);
+    mkavl_delete(&tree_h, NULL, NULL);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("stats of tree without stats, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    memcpy(&opts, tree_opts, sizeof(opts));
+    opts.stats = true;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, &opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("stats tree new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    /* Items added in order make the tree rotate */
+    for (i = 0; i < MKAVL_TEST_STATS_VALUE_CNT; ++i) {
+        values[i] = i;
+        rc = mkavl_add(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("add of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+    rc = mkavl_add(tree_h, &(values[0]), (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc) || (&(values[0]) != found_item)) {
+        LOG_FAIL("duplicate add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    rc = mkavl_get_stats(tree_h, &stats, key_stats, NELEMS(key_stats));
+    if (mkavl_rc_e_is_notok(rc) ||
+        (MKAVL_TEST_STATS_VALUE_CNT != stats.add_cnt) ||
+        (0 != stats.remove_cnt) || (0 == stats.alloc_cnt) ||
+        (stats.alloc_bytes < stats.alloc_cnt)) {
+        LOG_FAIL("stats after add, rc(%s) add(%" PRIu64 ") alloc(%" PRIu64
+                 ")", mkavl_rc_e_get_string(rc), stats.add_cnt,
+                 stats.alloc_cnt);
+        retval = false;
+        goto cleanup;
+    }
+    for (i = 0; i < NELEMS(key_stats); ++i) {
+        /* An AVL tree of 100 items is 7 to 9 nodes high */
+        if ((0 == key_stats[i].rotation_cnt) ||
+            (key_stats[i].cmp_cnt < MKAVL_TEST_STATS_VALUE_CNT) ||
+            (key_stats[i].height < 7) || (key_stats[i].height > 9) ||
+            (0 != key_stats[i].find_cnt)) {
+            LOG_FAIL("key %u stats after add, rotations(%" PRIu64 ") "
+                     "cmp(%" PRIu64 ") height(%u)", i,
+                     key_stats[i].rotation_cnt, key_stats[i].cmp_cnt,
+                     key_stats[i].height);
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    rc = mkavl_find(tree_h, MKAVL_FIND_TYPE_E_EQUAL, MKAVL_TEST_KEY_E_ASC,
+                    &(values[50]), (void **) &found_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_find(tree_h, MKAVL_FIND_TYPE_E_GT, MKAVL_TEST_KEY_E_DESC,
+                        &(values[50]), (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_get_stats(tree_h, &stats, key_stats, NELEMS(key_stats));
+    }
+    if (mkavl_rc_e_is_notok(rc) ||
+        (1 != stats.find_cnt[MKAVL_FIND_TYPE_E_EQUAL]) ||
+        (1 != stats.find_cnt[MKAVL_FIND_TYPE_E_GT]) ||
+        (0 != stats.find_cnt[MKAVL_FIND_TYPE_E_LT])) {
+        LOG_FAIL("stats after find, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    for (i = 0; i < NELEMS(key_stats); ++i) {
+        if ((1 != key_stats[i].find_cnt) ||
+            (0 == key_stats[i].find_visit_cnt) ||
+            (key_stats[i].find_visit_cnt > key_stats[i].height)) {
+            LOG_FAIL("key %u stats after find, finds(%" PRIu64 ") "
+                     "visits(%" PRIu64 ")", i, key_stats[i].find_cnt,
+                     key_stats[i].find_visit_cnt);
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    /*
+     * An iterator must find its place again after a change, which a thread
+     * holding an iterator on a thread safe tree may not make.
+     */
+    if (!opts.thread_safe && !opts.lockless_reads) {
+        rc = mkavl_iter_new(&iter_h, tree_h, MKAVL_TEST_KEY_E_ASC);
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_first(iter_h, (void **) &found_item);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_remove(tree_h, &(values[1]), (void **) &found_item);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_next(iter_h, (void **) &found_item);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_iter_next(iter_h, (void **) &found_item);
+        }
+        if (mkavl_rc_e_is_ok(rc)) {
+            rc = mkavl_get_stats(tree_h, NULL, key_stats, NELEMS(key_stats));
+        }
+        mkavl_iter_delete(&iter_h);
+        if (mkavl_rc_e_is_notok(rc) || (&(values[3]) != found_item) ||
+            (1 != key_stats[MKAVL_TEST_KEY_E_ASC].iter_refresh_cnt) ||
+            (0 != key_stats[MKAVL_TEST_KEY_E_DESC].iter_refresh_cnt)) {
+            LOG_FAIL("stats after iteration, rc(%s) refresh(%" PRIu64 ")",
+                     mkavl_rc_e_get_string(rc),
+                     key_stats[MKAVL_TEST_KEY_E_ASC].iter_refresh_cnt);
+            retval = false;
+            goto cleanup;
+        }
+        rc = mkavl_add(tree_h, &(values[1]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("re-add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    rc = mkavl_reset_stats(tree_h);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("reset failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+
+    for (i = 0; i < MKAVL_TEST_STATS_VALUE_CNT; ++i) {
+        rc = mkavl_remove(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(values[i]) != found_item)) {
+            LOG_FAIL("remove of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    /* Freed nodes stay in the pool, and the counts start over at the reset */
+    rc = mkavl_get_stats(tree_h, &stats, key_stats, NELEMS(key_stats));
+    if (mkavl_rc_e_is_notok(rc) || (0 != stats.add_cnt) ||
+        (MKAVL_TEST_STATS_VALUE_CNT != stats.remove_cnt) ||
+        (0 != stats.find_cnt[MKAVL_FIND_TYPE_E_EQUAL]) ||
+        (0 != stats.alloc_cnt) ||
+        ((0 == stats.free_cnt) !=
+         (opts.pooled_nodes || opts.lockless_reads))) {
+        LOG_FAIL("stats after remove, rc(%s) remove(%" PRIu64 ") "
+                 "free(%" PRIu64 ")", mkavl_rc_e_get_string(rc),
+                 stats.remove_cnt, stats.free_cnt);
+        retval = false;
+        goto cleanup;
+    }
+    for (i = 0; i < NELEMS(key_stats); ++i) {
+        if ((0 != key_stats[i].find_cnt) || (0 != key_stats[i].height) ||
+            (0 != key_stats[i].iter_refresh_cnt)) {
+            LOG_FAIL("key %u stats after remove, height(%u)", i,
+                     key_stats[i].height);
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+
+    mkavl_delete(&tree_h, NULL, NULL);
+
+    return (retval);
+}
+
+/** The number of values in mkavl_test_trace() */
+#define MKAVL_TEST_TRACE_VALUE_CNT 100
+
+/**
+ * The events seen by the hook of mkavl_test_trace().
+ */
+typedef struct mkavl_test_trace_ctx_st_ {
+    /** The tree traced */
+    mkavl_tree_handle tree_h;
+    /** The count of each event */
+    uint64_t event_cnt[MKAVL_TRACE_EVENT_E_MAX];
+    /** The exits of a find that compared against no node */
+    uint64_t find_no_depth_cnt;
+    /** The exits of a call that failed */
+    uint64_t fail_cnt;
+    /** The events of another tree, or with fields that are not set right */
+    uint64_t bad_cnt;
+} mkavl_test_trace_ctx_st;
+
+/**
+ * The hook function of mkavl_test_trace(), which counts the events.
+ *
+ * @param trace The event.
+ * @param context The mkavl_test_trace_ctx_st of the test.
+ */
+static void
+mkavl_test_trace_fn (const mkavl_trace_st *trace, void *context)
+{
+    mkavl_test_trace_ctx_st *ctx = (mkavl_test_trace_ctx_st *) context;
+
+    if ((trace->event < MKAVL_TRACE_EVENT_E_FIRST) ||
+        (trace->event >= MKAVL_TRACE_EVENT_E_MAX)) {
+        __atomic_fetch_add(&(ctx->bad_cnt), 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&(ctx->event_cnt[trace->event]), 1, __ATOMIC_RELAXED);
+
+    switch (trace->event) {
+    case MKAVL_TRACE_EVENT_E_ADD_EXIT:
+    case MKAVL_TRACE_EVENT_E_REMOVE_EXIT:
+    case MKAVL_TRACE_EVENT_E_FIND_EXIT:
+        if (mkavl_rc_e_is_notok(trace->rc)) {
+            __atomic_fetch_add(&(ctx->fail_cnt), 1, __ATOMIC_RELAXED);
+        }
+        if ((MKAVL_TRACE_EVENT_E_FIND_EXIT == trace->event) &&
+            (0 == trace->depth)) {
+            __atomic_fetch_add(&(ctx->find_no_depth_cnt), 1,
+                               __ATOMIC_RELAXED);
+        }
+        break;
+    case MKAVL_TRACE_EVENT_E_REBALANCE:
+        if ((0 == trace->depth) || (trace->key_idx >= NELEMS(cmp_fn_array))) {
+            __atomic_fetch_add(&(ctx->bad_cnt), 1, __ATOMIC_RELAXED);
+        }
+        break;
+    case MKAVL_TRACE_EVENT_E_ALLOC:
+        if ((NULL == trace->item) || (0 == trace->size)) {
+            __atomic_fetch_add(&(ctx->bad_cnt), 1, __ATOMIC_RELAXED);
+        }
+        /* The AVL trees are allocated before the handle is set */
+        return;
+    case MKAVL_TRACE_EVENT_E_FREE:
+        if (NULL == trace->item) {
+            __atomic_fetch_add(&(ctx->bad_cnt), 1, __ATOMIC_RELAXED);
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (ctx->tree_h != trace->tree_h) {
+        __atomic_fetch_add(&(ctx->bad_cnt), 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Check that a trace hook sees the entry and exit of adds, finds and
+ * removes, the rotations and the allocations they cause, only the events it
+ * asks for, and nothing once it is unset.
+ *
+ * @param tree_opts The options of the tree.
+ * @return True if the test passed.
+ */
+static bool
+mkavl_test_trace (const mkavl_opts_st *tree_opts)
+{
+    mkavl_test_trace_ctx_st trace_ctx = {0};
+    mkavl_trace_hook_st hook = {0};
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[MKAVL_TEST_TRACE_VALUE_CNT];
+    uint32_t extra_value = MKAVL_TEST_TRACE_VALUE_CNT;
+    uint32_t *found_item;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    rc = mkavl_set_trace_hook(&hook);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("set of hook without function, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    rc = mkavl_iter_first(iter2_h, (void **) &item);
+    hook.trace_fn = mkavl_test_trace_fn;
+    hook.context = &trace_ctx;
+    hook.event_mask = UINT32_MAX;
+    rc = mkavl_set_trace_hook(&hook);
     if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("iterator operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
+        LOG_FAIL("set of hook failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
         retval = false;
         goto cleanup;
     }
+    trace_ctx.tree_h = tree_h;
+
+    /* Items added in order make the tree rotate */
+    for (i = 0; i < MKAVL_TEST_TRACE_VALUE_CNT; ++i) {
+        values[i] = i;
+        rc = mkavl_add(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("add of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
 
-    if (*item != input->sorted_seq[last_idx]) {
-        LOG_FAIL("iterator item value mismatch, item %u array val %u",
-                 *item, input->sorted_seq[last_idx]);
+    for (i = 0; i < MKAVL_TEST_TRACE_VALUE_CNT; ++i) {
+        rc = mkavl_find(tree_h, MKAVL_FIND_TYPE_E_EQUAL, 0, &(values[i]),
+                        (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(values[i]) != found_item)) {
+            LOG_FAIL("find of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    if ((MKAVL_TEST_TRACE_VALUE_CNT !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_ENTRY]) ||
+        (MKAVL_TEST_TRACE_VALUE_CNT !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_EXIT]) ||
+        (MKAVL_TEST_TRACE_VALUE_CNT !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FIND_ENTRY]) ||
+        (MKAVL_TEST_TRACE_VALUE_CNT !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FIND_EXIT]) ||
+        (0 != trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REMOVE_ENTRY]) ||
+        (0 == trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REBALANCE]) ||
+        (0 == trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ALLOC]) ||
+        (0 != trace_ctx.find_no_depth_cnt) || (0 != trace_ctx.fail_cnt) ||
+        (0 != trace_ctx.bad_cnt)) {
+        LOG_FAIL("events after add and find, add(%" PRIu64 "/%" PRIu64 ") "
+                 "find(%" PRIu64 "/%" PRIu64 ") rebalance(%" PRIu64 ") "
+                 "alloc(%" PRIu64 ") no depth(%" PRIu64 ") fail(%" PRIu64 ") "
+                 "bad(%" PRIu64 ")",
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_ENTRY],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_EXIT],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FIND_ENTRY],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FIND_EXIT],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REBALANCE],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ALLOC],
+                 trace_ctx.find_no_depth_cnt, trace_ctx.fail_cnt,
+                 trace_ctx.bad_cnt);
         retval = false;
         goto cleanup;
     }
 
-    rc = mkavl_iter_first(iter1_h, (void **) &item);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("iterator operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
+    for (i = 0; i < MKAVL_TEST_TRACE_VALUE_CNT; ++i) {
+        rc = mkavl_remove(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(values[i]) != found_item)) {
+            LOG_FAIL("remove of %u failed, rc(%s)", i,
+                     mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
+    }
+
+    if ((MKAVL_TEST_TRACE_VALUE_CNT !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REMOVE_ENTRY]) ||
+        (MKAVL_TEST_TRACE_VALUE_CNT !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REMOVE_EXIT]) ||
+        (0 != trace_ctx.fail_cnt) || (0 != trace_ctx.bad_cnt)) {
+        LOG_FAIL("events after remove, remove(%" PRIu64 "/%" PRIu64 ") "
+                 "fail(%" PRIu64 ") bad(%" PRIu64 ")",
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REMOVE_ENTRY],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_REMOVE_EXIT],
+                 trace_ctx.fail_cnt, trace_ctx.bad_cnt);
         retval = false;
         goto cleanup;
     }
 
-    if (*item != input->sorted_seq[0]) {
-        LOG_FAIL("iterator item value mismatch, item %u array val %u",
-                 *item, input->sorted_seq[0]);
+    /* Only the events in the mask are given to the hook */
+    memset(trace_ctx.event_cnt, 0, sizeof(trace_ctx.event_cnt));
+    hook.event_mask = (1U << MKAVL_TRACE_EVENT_E_ADD_EXIT);
+    rc = mkavl_add(tree_h, &extra_value, (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc) ||
+        (1 != trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_EXIT]) ||
+        (0 != trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_ENTRY]) ||
+        (0 != trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ALLOC])) {
+        LOG_FAIL("masked add, rc(%s) exit(%" PRIu64 ") entry(%" PRIu64 ")",
+                 mkavl_rc_e_get_string(rc),
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_EXIT],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ADD_ENTRY]);
         retval = false;
         goto cleanup;
     }
 
-    rc = mkavl_iter_first(copy_iter1_h, (void **) &copy_item);
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("iterator operation failed, rc(%s)",
-                 mkavl_rc_e_get_string(rc));
+    /* Freeing the tree gives its memory back */
+    hook.event_mask = (1U << MKAVL_TRACE_EVENT_E_FREE);
+    rc = mkavl_delete(&tree_h, NULL, NULL);
+    if (mkavl_rc_e_is_notok(rc) ||
+        (0 == trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FREE])) {
+        LOG_FAIL("delete, rc(%s) free(%" PRIu64 ")",
+                 mkavl_rc_e_get_string(rc),
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FREE]);
         retval = false;
         goto cleanup;
     }
 
-    idx = 0;
-    prev_item = NULL;
-    while ((NULL != item) && (NULL != copy_item)) {
-        if (idx >= input->opts->node_cnt) {
-            LOG_FAIL("invalid idx(%u), node_cnt(%u)", idx,
-                     input->opts->node_cnt);
+    /* With the hook unset nothing more is seen */
+    rc = mkavl_set_trace_hook(NULL);
+    memset(trace_ctx.event_cnt, 0, sizeof(trace_ctx.event_cnt));
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_add(tree_h, &extra_value, (void **) &found_item);
+    }
+    for (i = MKAVL_TRACE_EVENT_E_FIRST; i < MKAVL_TRACE_EVENT_E_MAX; ++i) {
+        if (mkavl_rc_e_is_notok(rc) || (0 != trace_ctx.event_cnt[i])) {
+            LOG_FAIL("event %u after unset, rc(%s) count(%" PRIu64 ")", i,
+                     mkavl_rc_e_get_string(rc), trace_ctx.event_cnt[i]);
             retval = false;
             goto cleanup;
         }
+    }
 
-        if (*item != *copy_item) {
-            LOG_FAIL("iterator has mismatch, item %u copy_item %u", *item,
-                     *copy_item);
-            retval = false;
-            goto cleanup;
-        }
+cleanup:
 
-        if (*item != input->sorted_seq[idx]) {
-            LOG_FAIL("iterator has mismatch, item %u sorted_seq %u", *item,
-                     input->sorted_seq[idx]);
-            retval = false;
-            goto cleanup;
-        }
+    mkavl_set_trace_hook(NULL);
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
 
-        /* Go to the next unique value in the sorted array */
-        while ((idx < input->opts->node_cnt) &&
-               (*item == input->sorted_seq[idx])) {
-            ++idx;
-        }
+    return (retval);
+}
 
-        /* Test the current function */
-        rc = mkavl_iter_cur(iter1_h, (void **) &cur_item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            LOG_FAIL("iterator operation failed, rc(%s)",
+/**
+ * Check that every allocation a trace hook sees for a tree, including the
+ * slabs of pooled nodes, is matched by a free once the tree is deleted.
+ *
+ * @param tree_opts The options of the tree.
+ * @return True if the test passed.
+ */
+static bool
+mkavl_test_trace_free (const mkavl_opts_st *tree_opts)
+{
+    mkavl_test_trace_ctx_st trace_ctx = {0};
+    mkavl_trace_hook_st hook = {0};
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[MKAVL_TEST_TRACE_VALUE_CNT];
+    uint32_t *found_item;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    hook.trace_fn = mkavl_test_trace_fn;
+    hook.context = &trace_ctx;
+    hook.event_mask = ((1U << MKAVL_TRACE_EVENT_E_ALLOC) |
+                       (1U << MKAVL_TRACE_EVENT_E_FREE));
+    rc = mkavl_set_trace_hook(&hook);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("set of hook failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    for (i = 0; mkavl_rc_e_is_ok(rc) && (i < NELEMS(values)); ++i) {
+        values[i] = i;
+        rc = mkavl_add(tree_h, &(values[i]), (void **) &found_item);
+    }
+    for (i = 0; mkavl_rc_e_is_ok(rc) && (i < NELEMS(values)); i += 2) {
+        rc = mkavl_remove(tree_h, &(values[i]), (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_delete(&tree_h, NULL, NULL);
+    }
+    if (mkavl_rc_e_is_notok(rc) ||
+        (0 == trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ALLOC]) ||
+        (trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ALLOC] !=
+         trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FREE]) ||
+        (0 != trace_ctx.bad_cnt)) {
+        LOG_FAIL("alloc(%" PRIu64 ") free(%" PRIu64 ") bad(%" PRIu64 "), "
+                 "rc(%s)", trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_ALLOC],
+                 trace_ctx.event_cnt[MKAVL_TRACE_EVENT_E_FREE],
+                 trace_ctx.bad_cnt, mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+
+    mkavl_set_trace_hook(NULL);
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+
+    return (retval);
+}
+
+/** The number of values in mkavl_test_memory() */
+#define MKAVL_TEST_MEMORY_VALUE_CNT 100
+
+/**
+ * Check the memory usage of a tree, and that a tree that tracks memory counts
+ * as much as the usage adds up to.
+ *
+ * @param tree_h The tree.
+ * @param memory Filled in with the memory of the tree.
+ * @param key_memory Filled in with the memory of each key.
+ * @return True if the usage was found and matches what was tracked.
+ */
+static bool
+mkavl_test_memory_get (mkavl_tree_handle tree_h, mkavl_memory_st *memory,
+                       mkavl_key_memory_st *key_memory)
+{
+    mkavl_rc_e rc;
+
+    rc = mkavl_memory_usage(tree_h, memory, key_memory,
+                            NELEMS(cmp_fn_array));
+    if (mkavl_rc_e_is_notok(rc) || (0 == memory->header_bytes) ||
+        (memory->total_bytes != (memory->node_bytes + memory->header_bytes +
+                                 memory->iter_bytes + memory->slack_bytes)) ||
+        (memory->live_bytes > memory->high_water_bytes) ||
+        ((0 != memory->live_bytes) &&
+         (memory->live_bytes != memory->total_bytes))) {
+        LOG_FAIL("memory usage, rc(%s) total(%" PRIu64 ") live(%" PRIu64
+                 ") high water(%" PRIu64 ")", mkavl_rc_e_get_string(rc),
+                 memory->total_bytes, memory->live_bytes,
+                 memory->high_water_bytes);
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Check the memory reported for a tree as items are added and removed and an
+ * iterator comes and goes, and that a tree that tracks memory agrees with it
+ * and keeps its high-water mark.
+ *
+ * @param tree_opts The options of the tree, to which memory tracking is
+ * added unless the tree is persistent.
+ * @return True if the test passed.
+ */
+static bool
+mkavl_test_memory (const mkavl_opts_st *tree_opts)
+{
+    mkavl_key_memory_st key_memory[NELEMS(cmp_fn_array)];
+    mkavl_iterator_handle iter_h = NULL;
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    mkavl_memory_st memory, full_memory;
+    mkavl_opts_st opts;
+    uint32_t values[MKAVL_TEST_MEMORY_VALUE_CNT];
+    uint32_t *found_item;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    rc = mkavl_memory_usage(NULL, &memory, NULL, 0);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("memory usage of no tree, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+
+    memcpy(&opts, tree_opts, sizeof(opts));
+    opts.track_memory = true;
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, &opts);
+    if (opts.persistent) {
+        /* The nodes of a persistent tree are not its alone to track */
+        if (MKAVL_RC_E_EINVAL != rc) {
+            LOG_FAIL("persistent tree tracking memory, rc(%s)",
                      mkavl_rc_e_get_string(rc));
             retval = false;
             goto cleanup;
         }
+        opts.track_memory = false;
+        rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array),
+                            &ctx, NULL, &opts);
+    }
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
 
-        if (item != cur_item) {
-            LOG_FAIL("iterator has mismatch, item %p cur_item %p", item,
-                     cur_item);
-            retval = false;
-            goto cleanup;
-        }
+    if (!mkavl_test_memory_get(tree_h, &memory, key_memory)) {
+        retval = false;
+        goto cleanup;
+    }
+    if ((0 != memory.node_bytes) || (0 != memory.iter_bytes) ||
+        (opts.track_memory != (0 != memory.live_bytes))) {
+        LOG_FAIL("memory of new tree, nodes(%" PRIu64 ") live(%" PRIu64 ")",
+                 memory.node_bytes, memory.live_bytes);
+        retval = false;
+        goto cleanup;
+    }
 
-        /* Test previous */
-        rc = mkavl_iter_prev(iter1_h, (void **) &item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            LOG_FAIL("iterator operation failed, rc(%s)",
+    for (i = 0; i < MKAVL_TEST_MEMORY_VALUE_CNT; ++i) {
+        values[i] = i;
+        rc = mkavl_add(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("add of %u failed, rc(%s)", i,
                      mkavl_rc_e_get_string(rc));
             retval = false;
             goto cleanup;
         }
+    }
 
-        if (prev_item != item) {
-            LOG_FAIL("iterator has mismatch, item %p prev_item %p", item,
-                     prev_item);
+    if (!mkavl_test_memory_get(tree_h, &full_memory, key_memory)) {
+        retval = false;
+        goto cleanup;
+    }
+    for (i = 0; i < NELEMS(key_memory); ++i) {
+        if ((key_memory[i].node_bytes <
+             (MKAVL_TEST_MEMORY_VALUE_CNT * 3 * sizeof(void *))) ||
+            (0 == key_memory[i].header_bytes) ||
+            (0 != key_memory[i].iter_bytes)) {
+            LOG_FAIL("key %u memory after add, nodes(%" PRIu64 ")", i,
+                     key_memory[i].node_bytes);
             retval = false;
             goto cleanup;
         }
+    }
 
-        /* Test find */
-        rc = mkavl_iter_find(iter1_h, cur_item, (void **) &found_item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            LOG_FAIL("iterator operation failed, rc(%s)",
+    /* An iterator is counted against its key while it is outstanding */
+    rc = mkavl_iter_new(&iter_h, tree_h, (NELEMS(cmp_fn_array) - 1));
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
+    }
+    if (!mkavl_test_memory_get(tree_h, &memory, key_memory)) {
+        retval = false;
+        goto cleanup;
+    }
+    if ((0 == key_memory[NELEMS(key_memory) - 1].iter_bytes) ||
+        (memory.iter_bytes != key_memory[NELEMS(key_memory) - 1].iter_bytes) ||
+        (memory.total_bytes !=
+         (full_memory.total_bytes + memory.iter_bytes))) {
+        LOG_FAIL("memory with iterator, iter(%" PRIu64 ") total(%" PRIu64
+                 ")", memory.iter_bytes, memory.total_bytes);
+        retval = false;
+        goto cleanup;
+    }
+    mkavl_iter_delete(&iter_h);
+
+    for (i = 0; i < MKAVL_TEST_MEMORY_VALUE_CNT; ++i) {
+        rc = mkavl_remove(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (&(values[i]) != found_item)) {
+            LOG_FAIL("remove of %u failed, rc(%s)", i,
                      mkavl_rc_e_get_string(rc));
             retval = false;
             goto cleanup;
         }
+    }
 
-        if (found_item != cur_item) {
-            LOG_FAIL("iterator has mismatch, found_item %p cur_item %p", 
-                     found_item, cur_item);
-            retval = false;
-            goto cleanup;
-        }
+    /* Pooled nodes stay with the tree as slack once freed */
+    if (!mkavl_test_memory_get(tree_h, &memory, key_memory)) {
+        retval = false;
+        goto cleanup;
+    }
+    if ((0 != memory.node_bytes) || (0 != memory.iter_bytes) ||
+        ((opts.pooled_nodes || opts.lockless_reads) !=
+         (0 != memory.slack_bytes)) ||
+        (opts.track_memory &&
+         (memory.high_water_bytes < full_memory.live_bytes)) ||
+        (!opts.pooled_nodes && !opts.lockless_reads &&
+         (memory.total_bytes >= full_memory.total_bytes))) {
+        LOG_FAIL("memory after remove, nodes(%" PRIu64 ") slack(%" PRIu64
+                 ") total(%" PRIu64 ") high water(%" PRIu64 ")",
+                 memory.node_bytes, memory.slack_bytes, memory.total_bytes,
+                 memory.high_water_bytes);
+        retval = false;
+        goto cleanup;
+    }
+
+cleanup:
+
+    if (NULL != iter_h) {
+        mkavl_iter_delete(&iter_h);
+    }
+    if (NULL != tree_h) {
+        mkavl_delete(&tree_h, NULL, NULL);
+    }
+
+    return (retval);
+}
+
+/** The most allocations mkavl_test_stale_malloc() keeps track of */
+#define MKAVL_TEST_STALE_ALLOC_CNT 256
+
+/** The memory allocated by the tree of mkavl_test_stale_handle() */
+static void *mkavl_test_stale_ptr_array[MKAVL_TEST_STALE_ALLOC_CNT];
+
+/** The size of each entry of mkavl_test_stale_ptr_array */
+static size_t mkavl_test_stale_size_array[MKAVL_TEST_STALE_ALLOC_CNT];
+
+/** The number of entries of mkavl_test_stale_ptr_array */
+static uint32_t mkavl_test_stale_alloc_cnt;
+
+/**
+ * The malloc function for the tree of mkavl_test_stale_handle(), which keeps
+ * track of the memory so it can be reused by the test.
+ *
+ * @param size Size of memory to allocate.
+ * @param context The tree context.
+ * @return A pointer to the memory or NULL if allocation was not possible.
+ */
+static void *
+mkavl_test_stale_malloc (size_t size, void *context)
+{
+    void *ptr;
+
+    if (mkavl_test_stale_alloc_cnt >= MKAVL_TEST_STALE_ALLOC_CNT) {
+        return (NULL);
+    }
+
+    ptr = malloc(size);
+    if (NULL != ptr) {
+        mkavl_test_stale_ptr_array[mkavl_test_stale_alloc_cnt] = ptr;
+        mkavl_test_stale_size_array[mkavl_test_stale_alloc_cnt] = size;
+        ++mkavl_test_stale_alloc_cnt;
+    }
+
+    return (ptr);
+}
+
+/**
+ * The free function for the tree of mkavl_test_stale_handle(), which holds
+ * the memory back until the end of the test.
+ *
+ * @param ptr The memory to free.
+ * @param context The tree context.
+ */
+static void
+mkavl_test_stale_free (void *ptr, void *context)
+{
+}
+
+/**
+ * Allocators for the tree of mkavl_test_stale_handle().
+ */
+static mkavl_allocator_st stale_allocator = {
+    mkavl_test_stale_malloc,
+    mkavl_test_stale_free
+};
+
+/**
+ * Check that the calls given the handle of a deleted thread safe tree whose
+ * memory has been reused fail before they take its lock.
+ *
+ * @return True if the test passed.
+ */
+static bool
+mkavl_test_stale_handle (void)
+{
+    mkavl_tree_handle tree_h = NULL, stale_h;
+    mkavl_test_ctx_st ctx = {0};
+    mkavl_opts_st opts = {0};
+    mkavl_test_walk_ctx_st walk_ctx = {0};
+    uint32_t value = 1;
+    uint32_t *found_item = &value;
+    size_t count = 1;
+    uint32_t i;
+    mkavl_rc_e rc;
+    bool retval = true;
+
+    ctx.magic = MKAVL_TEST_MAGIC;
+    walk_ctx.magic = MKAVL_TEST_MAGIC;
+    walk_ctx.walk_stop_cnt = UINT32_MAX;
+    opts.thread_safe = true;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        &stale_allocator, &opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
+    rc = mkavl_add(tree_h, &value, (void **) &found_item);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("add failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+    }
+    stale_h = tree_h;
+    mkavl_delete(&tree_h, NULL, NULL);
+
+    /* The memory of the tree is reused for something else */
+    for (i = 0; i < mkavl_test_stale_alloc_cnt; ++i) {
+        memset(mkavl_test_stale_ptr_array[i], 0xff,
+               mkavl_test_stale_size_array[i]);
+    }
 
-        rc = mkavl_iter_next(iter1_h, (void **) &item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            LOG_FAIL("iterator operation failed, rc(%s)",
-                     mkavl_rc_e_get_string(rc));
+    if (retval) {
+        found_item = &value;
+        rc = mkavl_add(stale_h, &value, (void **) &found_item);
+        if ((MKAVL_RC_E_EINVAL != rc) || (NULL != found_item)) {
+            LOG_FAIL("add to stale tree, rc(%s)", mkavl_rc_e_get_string(rc));
             retval = false;
-            goto cleanup;
         }
+    }
 
-        rc = mkavl_iter_next(copy_iter1_h, (void **) &copy_item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            LOG_FAIL("iterator operation failed, rc(%s)",
+    if (retval) {
+        found_item = &value;
+        rc = mkavl_remove(stale_h, &value, (void **) &found_item);
+        if ((MKAVL_RC_E_EINVAL != rc) || (NULL != found_item)) {
+            LOG_FAIL("remove from stale tree, rc(%s)",
                      mkavl_rc_e_get_string(rc));
             retval = false;
-            goto cleanup;
         }
-
-        prev_item = cur_item;
     }
 
-    if (item != copy_item) {
-        LOG_FAIL("iterator has mismatch, item %p copy_item %p", item,
-                 copy_item);
-        retval = false;
-        goto cleanup;
+    if (retval) {
+        found_item = &value;
+        rc = mkavl_find(stale_h, MKAVL_FIND_TYPE_E_EQUAL, 0, &value,
+                        (void **) &found_item);
+        if ((MKAVL_RC_E_EINVAL != rc) || (NULL != found_item)) {
+            LOG_FAIL("find in stale tree, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
     }
 
-cleanup:
-
-    if (NULL != iter1_h) {
-        mkavl_iter_delete(&iter1_h);
+    if (retval) {
+        rc = mkavl_count_range(stale_h, 0, NULL, false, NULL, false, &count);
+        if ((MKAVL_RC_E_EINVAL != rc) || (0 != count)) {
+            LOG_FAIL("count of stale tree, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
     }
 
-    if (NULL != iter2_h) {
-        mkavl_iter_delete(&iter2_h);
+    if (retval) {
+        rc = mkavl_walk(stale_h, mkavl_test_walk_cb, &walk_ctx);
+        if ((MKAVL_RC_E_EINVAL != rc) || (0 != walk_ctx.walk_node_cnt)) {
+            LOG_FAIL("walk of stale tree, rc(%s)", mkavl_rc_e_get_string(rc));
+            retval = false;
+        }
     }
 
-    if (NULL != copy_iter1_h) {
-        mkavl_iter_delete(&copy_iter1_h);
+    for (i = 0; i < mkavl_test_stale_alloc_cnt; ++i) {
+        free(mkavl_test_stale_ptr_array[i]);
     }
+    mkavl_test_stale_alloc_cnt = 0;
 
     return (retval);
 }
 
-/** The context for mkavl_walk() */
-typedef struct mkavl_test_walk_ctx_st_ {
-    /** Magic value for sanity check */
-    uint32_t magic;
-    /** A count of the number of nodes walked */
-    uint32_t walk_node_cnt;
-    /** Tells when the walk should be stopped */
-    uint32_t walk_stop_cnt;
-} mkavl_test_walk_ctx_st;
+/** The number of values in mkavl_test_iter_change() */
+#define MKAVL_TEST_ITER_CHANGE_CNT 64
 
 /**
- * The callback for mkavl_walk().
+ * Check that the thread holding an iterator may change the tree between calls
+ * on it, even removing the item the iterator is at, and that the iteration
+ * goes on from where it was.
  *
- * @param item The current item in the walk.
- * @param tree_context The tree's context.
- * @param walk_context The walks' context.
- * @param stop_walk Can be set true to stop the walk upon return.
- * @return The return code
+ * @param tree_opts The options of the tree.
+ * @return True if the test passed.
  */
-static mkavl_rc_e
-mkavl_test_walk_cb (void *item, void *tree_context, void *walk_context,
-                    bool *stop_walk)
+static bool
+mkavl_test_iter_change (const mkavl_opts_st *tree_opts)
 {
-    mkavl_test_walk_ctx_st *walk_ctx = (mkavl_test_walk_ctx_st *) walk_context;
-    mkavl_test_ctx_st *tree_ctx = (mkavl_test_ctx_st *) tree_context;
+    mkavl_iterator_handle iter_h = NULL;
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t values[2 * MKAVL_TEST_ITER_CHANGE_CNT];
+    uint32_t *item, *found_item;
+    uint32_t i, expected = 0;
+    mkavl_rc_e rc;
+    bool retval = true;
 
-    if ((NULL == item) || (NULL == walk_ctx) || (NULL == tree_ctx) ||
-        (NULL == stop_walk) || (MKAVL_TEST_MAGIC != walk_ctx->magic) ||
-        (MKAVL_TEST_MAGIC != tree_ctx->magic)) {
-        abort();
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_new_opts(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx,
+                        NULL, tree_opts);
+    if (mkavl_rc_e_is_notok(rc)) {
+        LOG_FAIL("new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
     }
 
-    if (walk_ctx->walk_stop_cnt == walk_ctx->walk_node_cnt) {
-        *stop_walk = true;
-    } else {
-        ++(walk_ctx->walk_node_cnt);
+    for (i = 0; i < NELEMS(values); ++i) {
+        values[i] = i;
+        if (0 != (i % 2)) {
+            continue;
+        }
+        rc = mkavl_add(tree_h, &(values[i]), (void **) &found_item);
+        if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+            LOG_FAIL("add of %u failed, rc(%s)", i, mkavl_rc_e_get_string(rc));
+            retval = false;
+            goto cleanup;
+        }
     }
 
-    return (MKAVL_RC_E_SUCCESS);
-}
-
-/**
- * Test mkavl_walk().
- *
- * @param input The input state for the test.
- * @return True if test passed.
- */
-static bool
-mkavl_test_walk (mkavl_test_input_st *input)
-{
-    mkavl_test_walk_ctx_st walk_ctx = {0};
-    mkavl_rc_e rc;
-    
-    walk_ctx.magic = MKAVL_TEST_MAGIC;
-    /* Set it high enough that this walk will go all the way */
-    walk_ctx.walk_stop_cnt = input->uniq_cnt;
-    rc = mkavl_walk(input->tree_h, mkavl_test_walk_cb, &walk_ctx); 
+    rc = mkavl_iter_new(&iter_h, tree_h, MKAVL_TEST_KEY_E_ASC);
     if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("walk failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        return (false);
+        LOG_FAIL("iter new failed, rc(%s)", mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
     }
 
-    if (walk_ctx.walk_node_cnt != walk_ctx.walk_stop_cnt) {
-        LOG_FAIL("unexpected walk count, walk_node_cnt(%u) stop_cnt(%u)", 
-                 walk_ctx.walk_node_cnt, walk_ctx.walk_stop_cnt);
-        return (false);
+    /*
+     * At each even item, replace it by the odd item after it, so the iteration
+     * must go on past a removed item to one added after the iterator moved.
+     */
+    rc = mkavl_iter_first(iter_h, (void **) &item);
+    while (mkavl_rc_e_is_ok(rc) && (NULL != item)) {
+        if (*item != expected) {
+            LOG_FAIL("iterated to %u, expected %u", *item, expected);
+            retval = false;
+            goto cleanup;
+        }
+        ++expected;
+
+        if (0 == (*item % 2)) {
+            rc = mkavl_add(tree_h, &(values[*item + 1]), (void **) &found_item);
+            if (mkavl_rc_e_is_notok(rc) || (NULL != found_item)) {
+                LOG_FAIL("add of %u while iterating, rc(%s)", (*item + 1),
+                         mkavl_rc_e_get_string(rc));
+                retval = false;
+                goto cleanup;
+            }
+            rc = mkavl_remove(tree_h, item, (void **) &found_item);
+            if (mkavl_rc_e_is_notok(rc) || (item != found_item)) {
+                LOG_FAIL("remove of %u while iterating, rc(%s)", *item,
+                         mkavl_rc_e_get_string(rc));
+                retval = false;
+                goto cleanup;
+            }
+        }
+        rc = mkavl_iter_next(iter_h, (void **) &item);
+    }
+    if (mkavl_rc_e_is_notok(rc) || (NELEMS(values) != expected)) {
+        LOG_FAIL("iteration stopped at %u, rc(%s)", expected,
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
     }
 
-    walk_ctx.walk_node_cnt = 0;
-    /* Set it high enough that this walk will go all the way */
-    walk_ctx.walk_stop_cnt = (rand() %  input->uniq_cnt);
-    rc = mkavl_walk(input->tree_copy_h, mkavl_test_walk_cb, &walk_ctx); 
-    if (mkavl_rc_e_is_notok(rc)) {
-        LOG_FAIL("walk failed, rc(%s)", mkavl_rc_e_get_string(rc));
-        return (false);
+    /* Going back from the null item sees only the odd items */
+    rc = mkavl_iter_prev(iter_h, (void **) &item);
+    if (mkavl_rc_e_is_notok(rc) || (NULL == item) ||
+        ((NELEMS(values) - 1) != *item)) {
+        LOG_FAIL("prev from the end failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
     }
 
-    if (walk_ctx.walk_node_cnt != walk_ctx.walk_stop_cnt) {
-        LOG_FAIL("unexpected walk count, walk_node_cnt(%u) stop_cnt(%u)", 
-                 walk_ctx.walk_node_cnt, walk_ctx.walk_stop_cnt);
-        return (false);
+    rc = mkavl_remove(tree_h, item, (void **) &found_item);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_iter_prev(iter_h, (void **) &item);
+    }
+    if (mkavl_rc_e_is_notok(rc) || (NULL == item) ||
+        ((NELEMS(values) - 3) != *item)) {
+        LOG_FAIL("prev past a removed item failed, rc(%s)",
+                 mkavl_rc_e_get_string(rc));
+        retval = false;
+        goto cleanup;
     }
 
-    walk_ctx.magic = 0;
+cleanup:
 
-    return (true);
+    if (NULL != iter_h) {
+        mkavl_iter_delete(&iter_h);
+    }
+    mkavl_delete(&tree_h, NULL, NULL);
+
+    return (retval);
 }
 
 /**
- * Test mkavl_remove().
+ * Check the percentiles and merging of histograms, and that the latency of
+ * tree operations is recorded if the library was built to record it.
  *
- * @param input The input state for the test.
- * @return True if test passed.
+ * @return True if the test passed.
  */
 static bool
-mkavl_test_remove (mkavl_test_input_st *input)
+mkavl_test_hist (void)
 {
-    uint32_t i, null_cnt = 0;
+    mkavl_hist_st hist = {0}, hist2 = {0}, latency;
+    mkavl_tree_handle tree_h = NULL;
+    mkavl_test_ctx_st ctx = {0};
+    uint32_t value = 1, *found_item;
+    uint64_t add_cnt, p50;
+    char line[256];
+    FILE *file;
+    uint32_t i;
     mkavl_rc_e rc;
-    uint32_t *found_item;
+    bool retval = true;
 
-    for (i = 0; i < input->opts->node_cnt; ++i) {
-        rc = mkavl_remove(input->tree_h, &(input->delete_seq[i]), 
-                          (void **) &found_item);
-        if (mkavl_rc_e_is_notok(rc)) {
-            LOG_FAIL("remove failed, rc(%s)",
-                     mkavl_rc_e_get_string(rc));
-            return (false);
-        }
+    if ((0 != mkavl_hist_percentile(&hist, 50)) ||
+        (0 != strcmp("Find less than or equal",
+                     mkavl_latency_op_e_get_string(
+                         MKAVL_LATENCY_OP_E_FIND_LE)))) {
+        LOG_FAIL("empty histogram");
+        return (false);
+    }
 
-        if (NULL == found_item) {
-            ++null_cnt;
-        }
+    /* Small values each have their own bucket */
+    mkavl_hist_record(&hist, 5);
+    mkavl_hist_record(&hist, 7);
+    if ((5 != mkavl_hist_percentile(&hist, 50)) ||
+        (7 != mkavl_hist_percentile(&hist, 100))) {
+        LOG_FAIL("small values p50(%" PRIu64 ")",
+                 mkavl_hist_percentile(&hist, 50));
+        return (false);
     }
 
-    if (null_cnt != input->dup_cnt) {
-        LOG_FAIL("duplicate check failed, null_cnt(%u) dup_cnt(%u)", 
-                 null_cnt, input->dup_cnt);
+    /* Larger ones are within an eighth */
+    memset(&hist, 0, sizeof(hist));
+    for (i = 1; i <= 500; ++i) {
+        mkavl_hist_record(&hist, i);
+        mkavl_hist_record(&hist2, (i + 500));
+    }
+    mkavl_hist_merge(&hist, &hist2);
+    p50 = mkavl_hist_percentile(&hist, 50);
+    if ((1000 != hist.count) || (1000 != hist.max) ||
+        (500500 != hist.sum) || (p50 < 500) || (p50 > (500 + (500 / 8))) ||
+        (1000 != mkavl_hist_percentile(&hist, 100)) ||
+        (mkavl_hist_percentile(&hist, 99.9) < 999) ||
+        (1 != mkavl_hist_percentile(&hist, 0))) {
+        LOG_FAIL("merged count(%" PRIu64 ") p50(%" PRIu64 ")", hist.count,
+                 p50);
         return (false);
     }
 
-    if (0 != mkavl_count(input->tree_h)) {
-        LOG_FAIL("remove count check failed, count(%u)",
-                 mkavl_count(input->tree_h));
+    /* Values too large to count are counted as the largest */
+    memset(&hist, 0, sizeof(hist));
+    mkavl_hist_record(&hist, UINT64_MAX);
+    if (MKAVL_HIST_VALUE_MAX != mkavl_hist_percentile(&hist, 50)) {
+        LOG_FAIL("clamped p50(%" PRIu64 ")", mkavl_hist_percentile(&hist, 50));
         return (false);
     }
 
-    return (true);
-}
+    file = tmpfile();
+    if (NULL == file) {
+        LOG_FAIL("tmpfile failed");
+        return (false);
+    }
+    mkavl_hist_print(&hist2, "merged", file);
+    rewind(file);
+    if ((NULL == fgets(line, sizeof(line), file)) ||
+        (0 != strncmp("merged: count 500 ", line, 18)) ||
+        (NULL == strstr(line, " p999 "))) {
+        LOG_FAIL("print gave \"%s\"", line);
+        retval = false;
+    }
+    fclose(file);
+    if (!retval) {
+        return (false);
+    }
 
-/**
- * The callback for per-item functions.
- *
- * @param item The current item.
- * @param context The tree's context.
- * @return The return code
- */
-static mkavl_rc_e
-mkavl_test_item_fn (void *item, void *context)
-{
-    mkavl_test_ctx_st *ctx = (mkavl_test_ctx_st *) context;
+    rc = mkavl_latency_snapshot(MKAVL_LATENCY_OP_E_MAX, &latency);
+    if (MKAVL_RC_E_EINVAL != rc) {
+        LOG_FAIL("snapshot of invalid op, rc(%s)", mkavl_rc_e_get_string(rc));
+        return (false);
+    }
 
-    if ((NULL == item) || (NULL == ctx) || 
-        (MKAVL_TEST_MAGIC != ctx->magic)) {
-        abort();
+    /* Without MKAVL_HISTOGRAMS in the library, nothing is recorded */
+    rc = mkavl_latency_snapshot(MKAVL_LATENCY_OP_E_ADD, &latency);
+    add_cnt = latency.count;
+    if (MKAVL_RC_E_EINVAL == rc) {
+        return (0 == add_cnt);
     }
 
-    ++(ctx->item_fn_cnt);
+    ctx.magic = MKAVL_TEST_MAGIC;
+    rc = mkavl_new(&tree_h, cmp_fn_array, NELEMS(cmp_fn_array), &ctx, NULL);
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_add(tree_h, &value, (void **) &found_item);
+    }
+    if (mkavl_rc_e_is_ok(rc)) {
+        rc = mkavl_latency_snapshot(MKAVL_LATENCY_OP_E_ADD, &latency);
+    }
+    if (mkavl_rc_e_is_notok(rc) || (latency.count <= add_cnt)) {
+        LOG_FAIL("add latency, rc(%s) count(%" PRIu64 ")",
+                 mkavl_rc_e_get_string(rc), latency.count);
+        retval = false;
+    }
+    mkavl_delete(&tree_h, NULL, NULL);
 
-    return (MKAVL_RC_E_SUCCESS);
+    return (retval);
 }
 
 /**
@@ -1823,12 +7686,48 @@ run_mkavl_test (mkavl_test_input_st *input)
         goto err_exit;
     }
 
+    /* Test range lookups */
+    test_rc = mkavl_test_find_range(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test snapshots and copies sharing nodes */
+    test_rc = mkavl_test_snapshot(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test order statistics */
+    test_rc = mkavl_test_rank_select(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test range aggregates */
+    test_rc = mkavl_test_aggregate_range(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test changing items in place */
+    test_rc = mkavl_test_update(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
     /* Test find and add/remove from key */
     test_rc = mkavl_test_add_remove_key(input);
     if (!test_rc) {
         goto err_exit;
     }
 
+    /* The aggregates must follow the removals and additions */
+    test_rc = mkavl_test_aggregate_range(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
     /* Test add/remove idx error conditions */
     test_rc = mkavl_test_add_key_error(input);
     if (!test_rc) {
@@ -1846,12 +7745,61 @@ run_mkavl_test (mkavl_test_input_st *input)
         goto err_exit;
     }
 
+    /* Test the order of the items of copies */
+    test_rc = (mkavl_test_copy_items(input, false) &&
+               mkavl_test_copy_items(input, true));
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test the allocations done per item */
+    test_rc = mkavl_test_node_alloc(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test bulk loading a new tree */
+    test_rc = mkavl_test_bulk_load(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test saving the tree and loading it into a new tree */
+    test_rc = mkavl_test_save_load(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test saving the tree and searching it in place in a mapped file */
+    test_rc = mkavl_test_mapped(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
     /* Test iterators */
     test_rc = mkavl_test_iterator(input);
     if (!test_rc) {
         goto err_exit;
     }
 
+    /* Test seeking iterators */
+    test_rc = mkavl_test_iter_seek(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test sharded trees */
+    test_rc = mkavl_test_sharded(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
+    /* Test range-partitioned trees */
+    test_rc = mkavl_test_ranged(input);
+    if (!test_rc) {
+        goto err_exit;
+    }
+
     /* Do walk over trees */
     test_rc = mkavl_test_walk(input);
     if (!test_rc) {